@@ -518,6 +518,36 @@ public:
     {
         return false;
     }
+    /**
+     * Returns whether the analyzer may call parallel_shard_memref_batch() in place of
+     * parallel_shard_memref().  A tool should only return true if it does not query
+     * the \p shard_stream passed to parallel_shard_init_stream() for the state of
+     * individual entries, as during a batch the stream reflects the final entry of
+     * the batch.  Batches are only used if every tool returns true and no interval
+     * analysis was requested.
+     */
+    virtual bool
+    parallel_shard_batch_supported()
+    {
+        return false;
+    }
+    /**
+     * Operates on \p num_entries consecutive trace entries of a single shard, all
+     * from the same input: the batch ends before any context switch.  This avoids
+     * the overhead of a separate call for each entry for tools whose per-entry work
+     * is small.  The default implementation calls parallel_shard_memref() for each
+     * entry.  See parallel_shard_batch_supported().
+     */
+    virtual bool
+    parallel_shard_memref_batch(void *shard_data, const RecordType *entries,
+                                size_t num_entries)
+    {
+        for (size_t i = 0; i < num_entries; ++i) {
+            if (!parallel_shard_memref(shard_data, entries[i]))
+                return false;
+        }
+        return true;
+    }
     /** Returns a description of the last error for this shard. */
     virtual std::string
     parallel_shard_error(void *shard_data)
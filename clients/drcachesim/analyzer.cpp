@@ -37,6 +37,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -309,12 +310,18 @@ analyzer_tmpl_t<RecordType, ReaderType>::init_scheduler_common(
     } else if (parallel_) {
         sched_ops = sched_type_t::make_scheduler_parallel_options(verbosity_);
         sched_ops.read_inputs_in_init = options.read_inputs_in_init;
+        sched_ops.read_ahead_threads = options.read_ahead_threads;
+        sched_ops.read_ahead_depth = options.read_ahead_depth;
+        sched_ops.read_ahead_buffer_size = options.read_ahead_buffer_size;
         if (worker_count_ <= 0)
             worker_count_ = std::thread::hardware_concurrency();
         output_count = worker_count_;
     } else {
         sched_ops = sched_type_t::make_scheduler_serial_options(verbosity_);
         sched_ops.read_inputs_in_init = options.read_inputs_in_init;
+        sched_ops.read_ahead_threads = options.read_ahead_threads;
+        sched_ops.read_ahead_depth = options.read_ahead_depth;
+        sched_ops.read_ahead_buffer_size = options.read_ahead_buffer_size;
         worker_count_ = 1;
         output_count = 1;
     }
@@ -607,14 +614,60 @@ analyzer_tmpl_t<RecordType, ReaderType>::process_shard_exit(
 
 template <typename RecordType, typename ReaderType>
 bool
-analyzer_tmpl_t<RecordType, ReaderType>::process_tasks_internal(
-    analyzer_worker_data_t *worker)
+analyzer_tmpl_t<RecordType, ReaderType>::use_batches()
 {
-    std::vector<void *> user_worker_data(num_tools_);
+    // Interval boundaries must be found at individual records using the stream state.
+    if (records_per_batch_ <= 0 || interval_microseconds_ != 0 ||
+        interval_instr_count_ != 0)
+        return false;
+    for (int i = 0; i < num_tools_; ++i) {
+        if (!tools_[i]->parallel_shard_batch_supported())
+            return false;
+    }
+    return true;
+}
 
-    for (int i = 0; i < num_tools_; ++i)
-        user_worker_data[i] = tools_[i]->parallel_worker_init(worker->index);
+template <typename RecordType, typename ReaderType>
+int
+analyzer_tmpl_t<RecordType, ReaderType>::prepare_shard(
+    analyzer_worker_data_t *worker, const std::vector<void *> &user_worker_data,
+    const RecordType *records, int num_records)
+{
+    int shard_index = worker->stream->get_shard_index();
+    if (worker->shard_data.find(shard_index) == worker->shard_data.end()) {
+        VPRINT(this, 1, "Worker %d starting on trace shard %d stream is %p\n",
+               worker->index, shard_index, worker->stream);
+        worker->shard_data[shard_index].tool_data.resize(num_tools_);
+        if (interval_microseconds_ != 0 || interval_instr_count_ != 0)
+            worker->shard_data[shard_index].cur_interval_index = 1;
+        for (int i = 0; i < num_tools_; ++i) {
+            worker->shard_data[shard_index].tool_data[i].shard_data =
+                tools_[i]->parallel_shard_init_stream(shard_index, user_worker_data[i],
+                                                      worker->stream);
+        }
+        worker->shard_data[shard_index].shard_index = shard_index;
+    }
+    memref_tid_t tid;
+    if (worker->shard_data[shard_index].shard_id == 0) {
+        if (shard_type_ == SHARD_BY_CORE)
+            worker->shard_data[shard_index].shard_id = worker->index;
+        else {
+            for (int i = 0; i < num_records; ++i) {
+                if (record_has_tid(records[i], tid)) {
+                    worker->shard_data[shard_index].shard_id = tid;
+                    break;
+                }
+            }
+        }
+    }
+    return shard_index;
+}
 
+template <typename RecordType, typename ReaderType>
+bool
+analyzer_tmpl_t<RecordType, ReaderType>::process_records(
+    analyzer_worker_data_t *worker, const std::vector<void *> &user_worker_data)
+{
     RecordType record;
     // The current time is used for time quanta; for instr quanta, it's ignored and
     // we pass 0.
@@ -646,27 +699,7 @@ analyzer_tmpl_t<RecordType, ReaderType>::process_tasks_internal(
             }
             return false;
         }
-        int shard_index = worker->stream->get_shard_index();
-        if (worker->shard_data.find(shard_index) == worker->shard_data.end()) {
-            VPRINT(this, 1, "Worker %d starting on trace shard %d stream is %p\n",
-                   worker->index, shard_index, worker->stream);
-            worker->shard_data[shard_index].tool_data.resize(num_tools_);
-            if (interval_microseconds_ != 0 || interval_instr_count_ != 0)
-                worker->shard_data[shard_index].cur_interval_index = 1;
-            for (int i = 0; i < num_tools_; ++i) {
-                worker->shard_data[shard_index].tool_data[i].shard_data =
-                    tools_[i]->parallel_shard_init_stream(
-                        shard_index, user_worker_data[i], worker->stream);
-            }
-            worker->shard_data[shard_index].shard_index = shard_index;
-        }
-        memref_tid_t tid;
-        if (worker->shard_data[shard_index].shard_id == 0) {
-            if (shard_type_ == SHARD_BY_CORE)
-                worker->shard_data[shard_index].shard_id = worker->index;
-            else if (record_has_tid(record, tid))
-                worker->shard_data[shard_index].shard_id = tid;
-        }
+        int shard_index = prepare_shard(worker, user_worker_data, &record, 1);
         uint64_t prev_interval_index;
         uint64_t prev_interval_init_instr_count;
         if ((record_is_timestamp(record) || record_is_instr(record)) &&
@@ -694,6 +727,83 @@ analyzer_tmpl_t<RecordType, ReaderType>::process_tasks_internal(
             }
         }
     }
+    return true;
+}
+
+template <typename RecordType, typename ReaderType>
+bool
+analyzer_tmpl_t<RecordType, ReaderType>::process_batches(
+    analyzer_worker_data_t *worker, const std::vector<void *> &user_worker_data)
+{
+    std::vector<RecordType> batch(records_per_batch_);
+    int num_records;
+    uint64_t cur_micros = sched_by_time_ ? get_current_microseconds() : 0;
+    for (typename sched_type_t::stream_status_t status =
+             worker->stream->next_record_batch(batch.data(), records_per_batch_,
+                                               num_records, cur_micros);
+         status != sched_type_t::STATUS_EOF;
+         status = worker->stream->next_record_batch(batch.data(), records_per_batch_,
+                                                    num_records, cur_micros)) {
+        if (sched_by_time_)
+            cur_micros = get_current_microseconds();
+        if (status == sched_type_t::STATUS_WAIT) {
+            // See process_records() on these synthetic records.
+            batch[0] = create_wait_marker();
+            num_records = 1;
+        } else if (status == sched_type_t::STATUS_IDLE) {
+            assert(shard_type_ == SHARD_BY_CORE);
+            batch[0] = create_idle_marker();
+            num_records = 1;
+        } else if (status != sched_type_t::STATUS_OK) {
+            if (status == sched_type_t::STATUS_REGION_INVALID) {
+                worker->error =
+                    "Too-far -skip_instrs for: " + worker->stream->get_stream_name();
+            } else {
+                worker->error =
+                    "Failed to read from trace: " + worker->stream->get_stream_name();
+            }
+            return false;
+        }
+        int shard_index =
+            prepare_shard(worker, user_worker_data, batch.data(), num_records);
+        for (int i = 0; i < num_tools_; ++i) {
+            if (!tools_[i]->parallel_shard_memref_batch(
+                    worker->shard_data[shard_index].tool_data[i].shard_data, batch.data(),
+                    num_records)) {
+                worker->error = tools_[i]->parallel_shard_error(
+                    worker->shard_data[shard_index].tool_data[i].shard_data);
+                VPRINT(this, 1, "Worker %d hit shard memref error %s on trace shard %s\n",
+                       worker->index, worker->error.c_str(),
+                       worker->stream->get_stream_name().c_str());
+                return false;
+            }
+        }
+        // A batch never extends past the end of its input.
+        if (record_is_thread_final(batch[num_records - 1]) &&
+            shard_type_ != SHARD_BY_CORE) {
+            if (!process_shard_exit(worker, shard_index)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename RecordType, typename ReaderType>
+bool
+analyzer_tmpl_t<RecordType, ReaderType>::process_tasks_internal(
+    analyzer_worker_data_t *worker)
+{
+    std::vector<void *> user_worker_data(num_tools_);
+
+    for (int i = 0; i < num_tools_; ++i)
+        user_worker_data[i] = tools_[i]->parallel_worker_init(worker->index);
+
+    if (use_batches()) {
+        if (!process_batches(worker, user_worker_data))
+            return false;
+    } else if (!process_records(worker, user_worker_data))
+        return false;
     if (shard_type_ == SHARD_BY_CORE) {
         if (worker->shard_data.find(worker->index) != worker->shard_data.end()) {
             if (!process_shard_exit(worker, worker->index)) {
@@ -1076,6 +1186,26 @@ analyzer_tmpl_t<RecordType, ReaderType>::print_stats()
             print_output_separator();
         }
     }
+    if (scheduler_.get_read_ahead_statistic(
+            sched_type_t::READ_AHEAD_STAT_BUFFERS_FILLED) >= 0) {
+        print_output_separator();
+        std::cerr << "Trace read-ahead statistics:\n";
+        std::cerr << std::setw(28) << std::left << "  Buffers filled:" << std::right
+                  << std::setw(14)
+                  << scheduler_.get_read_ahead_statistic(
+                         sched_type_t::READ_AHEAD_STAT_BUFFERS_FILLED)
+                  << "\n";
+        std::cerr << std::setw(28) << std::left << "  Reader stall (us):" << std::right
+                  << std::setw(14)
+                  << scheduler_.get_read_ahead_statistic(
+                         sched_type_t::READ_AHEAD_STAT_CONSUMER_STALL_US)
+                  << "\n";
+        std::cerr << std::setw(28) << std::left << "  Decompressor stall (us):"
+                  << std::right << std::setw(14)
+                  << scheduler_.get_read_ahead_statistic(
+                         sched_type_t::READ_AHEAD_STAT_PRODUCER_STALL_US)
+                  << "\n";
+    }
     return true;
 }
 
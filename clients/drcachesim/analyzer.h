@@ -245,6 +245,27 @@ protected:
     bool
     process_tasks_internal(analyzer_worker_data_t *worker);
 
+    // Helpers for process_tasks_internal() which pass the records to the tools one
+    // at a time or in batches.
+    bool
+    process_records(analyzer_worker_data_t *worker,
+                    const std::vector<void *> &user_worker_data);
+    bool
+    process_batches(analyzer_worker_data_t *worker,
+                    const std::vector<void *> &user_worker_data);
+
+    // Returns whether to pass records to the tools in batches.
+    bool
+    use_batches();
+
+    // Initializes the data for the stream's current shard if this is the first time
+    // we have seen it, and returns its index.  The records are those about to be
+    // passed to the tools.
+    int
+    prepare_shard(analyzer_worker_data_t *worker,
+                  const std::vector<void *> &user_worker_data, const RecordType *records,
+                  int num_records);
+
     // Helper for process_tasks() which calls parallel_shard_exit() in each tool.
     // Returns false if there was an error and the caller should return early.
     bool
@@ -426,6 +447,9 @@ protected:
     uint64_t skip_instrs_ = 0;
     uint64_t interval_microseconds_ = 0;
     uint64_t interval_instr_count_ = 0;
+    // The maximum number of records passed to parallel_shard_memref_batch(), with 0
+    // disabling batches.
+    int records_per_batch_ = 256;
     int verbosity_ = 0;
     shard_type_t shard_type_ = SHARD_BY_THREAD;
     bool sched_by_time_ = false;
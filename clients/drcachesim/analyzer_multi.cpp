@@ -232,10 +232,24 @@ analyzer_multi_t::create_analysis_tool_from_options(const std::string &tool)
             ERRMSG("Usage error: reuse_histogram_bin_multiplier must be >= 1.0\n");
             return nullptr;
         }
+        knobs.use_order_tree = op_reuse_order_tree.get_value();
+        knobs.sample_rate = op_reuse_sample_rate.get_value();
+        if (knobs.sample_rate <= 0.0 || knobs.sample_rate > 1.0) {
+            ERRMSG("Usage error: reuse_sample_rate must be in (0, 1]\n");
+            return nullptr;
+        }
+        knobs.sample_max_lines = op_reuse_sample_max_lines.get_value();
         knobs.verbose = op_verbose.get_value();
         return reuse_distance_tool_create(knobs);
     } else if (tool == REUSE_TIME) {
-        return reuse_time_tool_create(op_line_size.get_value(), op_verbose.get_value());
+        if (op_reuse_sample_rate.get_value() <= 0.0 ||
+            op_reuse_sample_rate.get_value() > 1.0) {
+            ERRMSG("Usage error: reuse_sample_rate must be in (0, 1]\n");
+            return nullptr;
+        }
+        return reuse_time_tool_create(op_line_size.get_value(), op_verbose.get_value(),
+                                      op_reuse_sample_rate.get_value(),
+                                      op_reuse_sample_max_lines.get_value());
     } else if (tool == BASIC_COUNTS) {
         return basic_counts_tool_create(op_verbose.get_value());
     } else if (tool == OPCODE_MIX) {
@@ -334,7 +348,8 @@ record_analyzer_multi_t::create_analysis_tool_from_options(const std::string &to
             op_filter_cache_size.get_value(), op_filter_trace_types.get_value(),
             op_filter_marker_types.get_value(), op_trim_before_timestamp.get_value(),
             op_trim_after_timestamp.get_value(), op_encodings2regdeps.get_value(),
-            op_verbose.get_value());
+            op_verbose.get_value(), op_filter_compress_threads.get_value(),
+            op_filter_compress_level.get_value());
     }
     ERRMSG("Usage error: unsupported record analyzer type \"%s\".  Only " RECORD_FILTER
            " is supported.\n",
@@ -353,6 +368,7 @@ analyzer_multi_tmpl_t<RecordType, ReaderType>::analyzer_multi_tmpl_t()
     this->skip_instrs_ = op_skip_instrs.get_value();
     this->interval_microseconds_ = op_interval_microseconds.get_value();
     this->interval_instr_count_ = op_interval_instr_count.get_value();
+    this->records_per_batch_ = op_records_per_batch.get_value();
     // Initial measurements show it's sometimes faster to keep the parallel model
     // of using single-file readers but use them sequentially, as opposed to
     // the every-file interleaving reader, but the user can specify -jobs 1, so
@@ -415,7 +431,8 @@ analyzer_multi_tmpl_t<RecordType, ReaderType>::analyzer_multi_tmpl_t()
                 nullptr, op_verbose.get_value(), op_jobs.get_value(),
                 op_alt_module_dir.get_value(), op_chunk_instr_count.get_value(),
                 dir.in_kfiles_map_, dir.kcoredir_, dir.kallsymsdir_,
-                std::move(dir.syscall_template_file_reader_));
+                std::move(dir.syscall_template_file_reader_),
+                op_thread_segment_size.get_value(), op_decode_cache_file.get_value());
             std::string error = raw2trace.do_conversion();
             if (!error.empty()) {
                 this->success_ = false;
@@ -438,6 +455,9 @@ analyzer_multi_tmpl_t<RecordType, ReaderType>::analyzer_multi_tmpl_t()
         }
         sched_ops = init_dynamic_schedule();
     }
+    sched_ops.read_ahead_threads = op_read_ahead_threads.get_value();
+    sched_ops.read_ahead_depth = op_read_ahead_depth.get_value();
+    sched_ops.read_ahead_buffer_size = op_read_ahead_buffer_size.get_value();
 
     if (!op_indir.get_value().empty()) {
         std::string tracedir =
@@ -510,6 +530,8 @@ analyzer_multi_tmpl_t<RecordType, ReaderType>::init_dynamic_schedule()
     sched_ops.block_time_max = op_sched_block_max_us.get_value();
     sched_ops.randomize_next_input = op_sched_randomize.get_value();
     sched_ops.honor_direct_switches = !op_sched_disable_direct_switches.get_value();
+    sched_ops.per_output_ready_queues = op_sched_per_output_queues.get_value();
+    sched_ops.rebalance_period = op_sched_rebalance_period_us.get_value();
 #ifdef HAS_ZIP
     if (!op_record_file.get_value().empty()) {
         record_schedule_zip_.reset(new zipfile_ostream_t(op_record_file.get_value()));
@@ -668,6 +690,8 @@ analyzer_multi_tmpl_t<RecordType, ReaderType>::get_cache_simulator_knobs()
     knobs->LL_assoc = op_LL_assoc.get_value();
     knobs->LL_miss_file = op_LL_miss_file.get_value();
     knobs->model_coherence = op_coherence.get_value();
+    knobs->parallel = op_cache_parallel.get_value();
+    knobs->parallel_epoch = op_cache_parallel_epoch.get_value();
     knobs->replace_policy = op_replace_policy.get_value();
     knobs->data_prefetcher = op_data_prefetcher.get_value();
     knobs->skip_refs = op_skip_refs.get_value();
@@ -0,0 +1,318 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "columnar_codec.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+namespace {
+
+static const char kMagic[] = "DRMEMCOL";
+
+// Varints are LEB128: 7 bits per byte, least significant first, with the top
+// bit set on all but the last byte.
+static constexpr size_t kMaxVarintSize = 10;
+
+void
+append_varint(uint64_t value, std::vector<char> *out)
+{
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+inline bool
+read_varint(const char **pos, const char *end, uint64_t *value)
+{
+    // Most values fit in one byte.
+    if (*pos < end && (**pos & 0x80) == 0) {
+        *value = static_cast<unsigned char>(*(*pos)++);
+        return true;
+    }
+    uint64_t res = 0;
+    for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(*(*pos)++);
+        res |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = res;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Maps small deltas of either sign to small unsigned values.
+uint64_t
+zigzag_encode(uint64_t delta)
+{
+    return (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+}
+
+uint64_t
+zigzag_decode(uint64_t code)
+{
+    return (code >> 1) ^ (~(code & 1) + 1);
+}
+
+// Value codes 0 and 1 name the two predictions; larger codes hold the zigzag
+// delta from the first.
+static constexpr uint64_t kPredictionCodes = 2;
+
+// Predictions wrap at the width of a record's value, so that the deltas of
+// 32-bit values stay small.
+inline uint64_t
+wrap_value(uint64_t value)
+{
+    return static_cast<addr_t>(value);
+}
+
+} // namespace
+
+/**************************************************
+ * columnar_codec_t.
+ */
+
+columnar_codec_t::columnar_codec_t()
+    : targets_(static_cast<size_t>(1) << kSlotBits, 0)
+    , data_(static_cast<size_t>(1) << kSlotBits, stride_t { 0, 0 })
+    , strides_(kStrideSlots, stride_t { 0, 0 })
+{
+}
+
+const char *
+columnar_codec_t::get_magic()
+{
+    static_assert(sizeof(kMagic) == kMagicSize + 1, "magic size mismatch");
+    return kMagic;
+}
+
+size_t
+columnar_codec_t::get_block_payload_size(const block_header_t &header)
+{
+    // Bound each column by the largest size it could legitimately have, which
+    // also keeps the sum from overflowing.
+    const uint64_t max_column = static_cast<uint64_t>(kBlockEntries) * kMaxVarintSize;
+    if (header.entry_count > kBlockEntries || header.tail_size >= sizeof(trace_entry_t) ||
+        header.shapes_size > max_column || header.new_shapes_size > 2 * max_column ||
+        header.values_size > max_column ||
+        (header.entry_count == 0 && header.tail_size == 0))
+        return 0;
+    return static_cast<size_t>(header.shapes_size) + header.new_shapes_size +
+        header.values_size + header.tail_size;
+}
+
+columnar_codec_t::shape_t
+columnar_codec_t::make_shape(unsigned short type, unsigned short size)
+{
+    shape_t shape = { type, size, VALUE_STRIDE, 0 };
+    trace_type_t trace_type = static_cast<trace_type_t>(type);
+    if (is_any_instr_type(trace_type))
+        shape.kind = VALUE_INSTR;
+    else if (type_has_address(trace_type))
+        shape.kind = VALUE_DATA;
+    else if (trace_type == TRACE_TYPE_ENCODING) {
+        // Encoding bytes are as good as random.
+        shape.kind = VALUE_RAW;
+    } else if (trace_type == TRACE_TYPE_MARKER)
+        shape.slot = size % (kStrideSlots / 2);
+    else
+        shape.slot = kStrideSlots / 2 + type % (kStrideSlots / 2);
+    return shape;
+}
+
+template <bool kEncode>
+uint64_t
+columnar_codec_t::convert_value(const shape_t &shape, uint64_t in)
+{
+    uint64_t first, second;
+    uint64_t *target = nullptr;
+    stride_t *slot = nullptr;
+    switch (shape.kind) {
+    case VALUE_INSTR:
+        first = wrap_value(last_pc_ + last_instr_size_);
+        target = &targets_[hash_slot(last_pc_)];
+        second = *target;
+        break;
+    case VALUE_DATA:
+        slot = &data_[hash_slot(last_pc_ ^ (operand_index_ * 0xff51afd7ed558ccdULL))];
+        ++operand_index_;
+        first = wrap_value(slot->value + slot->stride);
+        second = slot->value;
+        break;
+    case VALUE_STRIDE:
+        slot = &strides_[shape.slot];
+        first = wrap_value(slot->value + slot->stride);
+        second = slot->value;
+        break;
+    default: return in;
+    }
+    uint64_t value, code;
+    if (kEncode) {
+        value = in;
+        if (value == first)
+            code = 0;
+        else if (value == second)
+            code = 1;
+        else
+            code = zigzag_encode(value - first) + kPredictionCodes;
+    } else {
+        // These are written to become conditional moves rather than branches,
+        // which would be poorly predicted.
+        code = in;
+        uint64_t delta_value = wrap_value(first + zigzag_decode(code - kPredictionCodes));
+        value = code == 0 ? first : delta_value;
+        value = code == 1 ? second : value;
+    }
+    if (target != nullptr) {
+        *target = value != first ? value : second;
+        last_pc_ = value;
+        last_instr_size_ = shape.size;
+        operand_index_ = 0;
+    } else {
+        slot->stride = value - slot->value;
+        slot->value = value;
+    }
+    return kEncode ? code : value;
+}
+
+/**************************************************
+ * columnar_encoder_t.
+ */
+
+void
+columnar_encoder_t::encode_block(const trace_entry_t *entries, uint32_t count,
+                                 const char *tail, uint32_t tail_size,
+                                 std::vector<char> *out)
+{
+    shapes_.clear();
+    new_shapes_.clear();
+    values_.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        const trace_entry_t &entry = entries[i];
+        uint32_t key = (static_cast<uint32_t>(entry.type) << 16) | entry.size;
+        auto it = shape_ids_.find(key);
+        shape_t shape;
+        if (it != shape_ids_.end()) {
+            append_varint(it->second + 1, &shapes_);
+            shape = shape_table_[it->second];
+        } else {
+            append_varint(0, &shapes_);
+            append_varint(entry.type, &new_shapes_);
+            append_varint(entry.size, &new_shapes_);
+            shape = make_shape(entry.type, entry.size);
+            // Past the cap, further new shapes are stored in full every time.
+            if (shape_table_.size() < kMaxShapes) {
+                shape_ids_.emplace(key, static_cast<uint32_t>(shape_table_.size()));
+                shape_table_.push_back(shape);
+            }
+        }
+        append_varint(convert_value<true>(shape, entry.addr), &values_);
+    }
+    block_header_t header;
+    header.entry_count = count;
+    header.tail_size = tail_size;
+    header.shapes_size = static_cast<uint32_t>(shapes_.size());
+    header.new_shapes_size = static_cast<uint32_t>(new_shapes_.size());
+    header.values_size = static_cast<uint32_t>(values_.size());
+    const char *header_bytes = reinterpret_cast<const char *>(&header);
+    out->insert(out->end(), header_bytes, header_bytes + sizeof(header));
+    out->insert(out->end(), shapes_.begin(), shapes_.end());
+    out->insert(out->end(), new_shapes_.begin(), new_shapes_.end());
+    out->insert(out->end(), values_.begin(), values_.end());
+    out->insert(out->end(), tail, tail + tail_size);
+}
+
+/**************************************************
+ * columnar_decoder_t.
+ */
+
+bool
+columnar_decoder_t::decode_block(const block_header_t &header, const char *payload,
+                                 char *out)
+{
+    const char *shapes = payload;
+    const char *shapes_end = shapes + header.shapes_size;
+    const char *new_shapes = shapes_end;
+    const char *new_shapes_end = new_shapes + header.new_shapes_size;
+    const char *values = new_shapes_end;
+    const char *values_end = values + header.values_size;
+    trace_entry_t *entries = reinterpret_cast<trace_entry_t *>(out);
+    for (uint32_t i = 0; i < header.entry_count; ++i) {
+        uint64_t id, code;
+        if (!read_varint(&shapes, shapes_end, &id))
+            return false;
+        shape_t new_shape;
+        const shape_t *shape;
+        if (id == 0) {
+            uint64_t type, size;
+            if (!read_varint(&new_shapes, new_shapes_end, &type) ||
+                !read_varint(&new_shapes, new_shapes_end, &size) || type > USHRT_MAX ||
+                size > USHRT_MAX)
+                return false;
+            new_shape = make_shape(static_cast<unsigned short>(type),
+                                   static_cast<unsigned short>(size));
+            if (shapes_.size() < kMaxShapes)
+                shapes_.push_back(new_shape);
+            shape = &new_shape;
+        } else {
+            if (id > shapes_.size())
+                return false;
+            shape = &shapes_[id - 1];
+        }
+        if (!read_varint(&values, values_end, &code))
+            return false;
+        trace_entry_t &entry = entries[i];
+        entry.type = shape->type;
+        entry.size = shape->size;
+        entry.addr = static_cast<addr_t>(convert_value<false>(*shape, code));
+    }
+    if (shapes != shapes_end || new_shapes != new_shapes_end || values != values_end)
+        return false;
+    memcpy(out + header.entry_count * sizeof(trace_entry_t), values_end,
+           header.tail_size);
+    return true;
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
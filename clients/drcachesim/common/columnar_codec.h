@@ -0,0 +1,191 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* columnar_codec: the compact drmemtrace file encoding, shared by
+ * columnar_ostream_t and columnar_file_reader_t.
+ *
+ * Rather than compressing the bytes of a stream of trace_entry_t records, this
+ * encoding exploits their structure.  After an 8-byte magic string, the records
+ * are grouped into blocks of up to kBlockEntries.  Each block starts with a
+ * block_header_t and holds three columns of varints:
+ * - shapes: one per record, naming the record's (type, size) pair in a
+ *   dictionary built up over the stream, or 0 for a pair not yet seen;
+ * - new shapes: the type and size of each pair not yet seen;
+ * - values: one per record, giving its addr field relative to a prediction made
+ *   from prior records of the same kind.  Instruction PCs are predicted to fall
+ *   through from the prior instruction or else to repeat the target last taken
+ *   from there, data addresses to repeat the stride last seen for the same
+ *   operand of the same instruction, and marker values to repeat the delta of
+ *   the prior marker of the same type.
+ * Any trailing bytes which do not form a whole record follow the columns.
+ *
+ * The dictionary and prediction state carry over from block to block, so the
+ * blocks of a stream must be decoded in order.
+ */
+
+#ifndef _COLUMNAR_CODEC_H_
+#define _COLUMNAR_CODEC_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+class columnar_codec_t {
+public:
+    static constexpr size_t kMagicSize = 8;
+    // This matches the record buffers of the file readers, so that a block can
+    // be decoded straight into one.
+    static constexpr uint32_t kBlockEntries = 4096;
+
+    struct block_header_t {
+        uint32_t entry_count;
+        uint32_t tail_size;
+        uint32_t shapes_size;
+        uint32_t new_shapes_size;
+        uint32_t values_size;
+    };
+
+    columnar_codec_t();
+
+    // Returns the kMagicSize bytes which start every file in this encoding.
+    static const char *
+    get_magic();
+
+    // Returns the number of bytes following "header" in its block, or 0 if the
+    // header is not valid.
+    static size_t
+    get_block_payload_size(const block_header_t &header);
+
+    // Returns the number of bytes "header"'s block decodes to.
+    static size_t
+    get_block_output_size(const block_header_t &header)
+    {
+        return header.entry_count * sizeof(trace_entry_t) + header.tail_size;
+    }
+
+protected:
+    enum value_kind_t : unsigned char {
+        // Predicted from control flow.
+        VALUE_INSTR,
+        // Predicted from the prior address of the same operand of the same PC.
+        VALUE_DATA,
+        // Predicted from the prior record with the same shape slot.
+        VALUE_STRIDE,
+        // Stored as is.
+        VALUE_RAW,
+    };
+
+    // A distinct (type, size) pair, along with how values of records with it are
+    // predicted.
+    struct shape_t {
+        unsigned short type;
+        unsigned short size;
+        value_kind_t kind;
+        uint32_t slot;
+    };
+
+    static shape_t
+    make_shape(unsigned short type, unsigned short size);
+
+    // Converts the value of a record with "shape" to its code when "kEncode" is
+    // set and a code back to its value otherwise, updating the predictions.
+    template <bool kEncode>
+    uint64_t
+    convert_value(const shape_t &shape, uint64_t in);
+
+    static constexpr uint32_t kMaxShapes = 1 << 16;
+
+private:
+    static constexpr int kSlotBits = 10;
+    static constexpr uint32_t kStrideSlots = 512;
+
+    static size_t
+    hash_slot(uint64_t key)
+    {
+        return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> (64 - kSlotBits));
+    }
+
+    struct stride_t {
+        uint64_t value;
+        uint64_t stride;
+    };
+
+    uint64_t last_pc_ = 0;
+    uint64_t last_instr_size_ = 0;
+    uint64_t operand_index_ = 0;
+    // Indexed by a hash of the PC a branch was taken from.
+    std::vector<uint64_t> targets_;
+    // Indexed by a hash of the PC and operand index of data references.
+    std::vector<stride_t> data_;
+    // Indexed by marker type for markers and by record type for other records.
+    std::vector<stride_t> strides_;
+};
+
+class columnar_encoder_t : public columnar_codec_t {
+public:
+    // Appends a block holding "count" records followed by "tail_size" bytes which
+    // do not form a whole record to "out".
+    void
+    encode_block(const trace_entry_t *entries, uint32_t count, const char *tail,
+                 uint32_t tail_size, std::vector<char> *out);
+
+private:
+    std::unordered_map<uint32_t, uint32_t> shape_ids_;
+    std::vector<shape_t> shape_table_;
+    std::vector<char> shapes_;
+    std::vector<char> new_shapes_;
+    std::vector<char> values_;
+};
+
+class columnar_decoder_t : public columnar_codec_t {
+public:
+    // Decodes the block with "header" whose remaining get_block_payload_size()
+    // bytes are at "payload" into the get_block_output_size() bytes at "out".
+    // Returns false if the block is malformed.
+    bool
+    decode_block(const block_header_t &header, const char *payload, char *out);
+
+private:
+    std::vector<shape_t> shapes_;
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _COLUMNAR_CODEC_H_ */
@@ -0,0 +1,148 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* columnar_ostream_t: writes trace_entry_t records in the columnar encoding of
+ * columnar_codec.h while matching the parts of the std::ostream interface we use
+ * for raw2trace and record_filter.
+ */
+
+#ifndef _COLUMNAR_OSTREAM_H_
+#define _COLUMNAR_OSTREAM_H_ 1
+
+#include <string.h>
+
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "columnar_codec.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+class columnar_ostreambuf_t : public std::basic_streambuf<char, std::char_traits<char>> {
+public:
+    explicit columnar_ostreambuf_t(const std::string &path)
+        : file_(path, std::ofstream::binary)
+    {
+        // One spare byte holds the character passed to overflow().
+        src_buf_.resize(columnar_codec_t::kBlockEntries * sizeof(trace_entry_t) + 1);
+        char *base = &src_buf_.front();
+        setp(base, base + src_buf_.size() - 1);
+        file_.write(columnar_codec_t::get_magic(), columnar_codec_t::kMagicSize);
+    }
+
+    ~columnar_ostreambuf_t() override
+    {
+        sync();
+        // Write out any partial record, which the reader will hand back as-is.
+        size_t tail_size = pptr() - pbase();
+        if (tail_size > 0) {
+            dest_buf_.clear();
+            encoder_.encode_block(nullptr, 0, pbase(), static_cast<uint32_t>(tail_size),
+                                  &dest_buf_);
+            file_.write(&dest_buf_.front(), dest_buf_.size());
+        }
+    }
+
+    bool
+    failed() const
+    {
+        return !file_;
+    }
+
+private:
+    int
+    overflow(int extra_char) override
+    {
+        if (!file_)
+            return traits_type::eof();
+
+        if (extra_char != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(extra_char);
+            pbump(1);
+        }
+
+        size_t size = pptr() - pbase();
+        uint32_t count = static_cast<uint32_t>(size / sizeof(trace_entry_t));
+        if (count > 0) {
+            dest_buf_.clear();
+            encoder_.encode_block(reinterpret_cast<const trace_entry_t *>(pbase()), count,
+                                  nullptr, 0, &dest_buf_);
+            file_.write(&dest_buf_.front(), dest_buf_.size());
+            if (!file_)
+                return traits_type::eof();
+        }
+        // Keep any partial record at the front of the buffer until the rest of it
+        // arrives.
+        size_t left = size - count * sizeof(trace_entry_t);
+        memmove(pbase(), pbase() + count * sizeof(trace_entry_t), left);
+        pbump(-static_cast<int>(size - left));
+        return traits_type::not_eof(extra_char);
+    }
+
+    int
+    sync() override
+    {
+        if (overflow(traits_type::eof()) == traits_type::eof())
+            return -1;
+        file_.flush();
+        return 0;
+    }
+
+    std::ofstream file_;
+    std::vector<char> src_buf_;
+    std::vector<char> dest_buf_;
+    columnar_encoder_t encoder_;
+};
+
+class columnar_ostream_t : public std::ostream {
+public:
+    explicit columnar_ostream_t(const std::string &path)
+        : std::ostream(new columnar_ostreambuf_t(path))
+    {
+        if (static_cast<columnar_ostreambuf_t *>(rdbuf())->failed())
+            setstate(std::ios::badbit);
+    }
+
+    ~columnar_ostream_t() override
+    {
+        delete rdbuf();
+    }
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _COLUMNAR_OSTREAM_H_ */
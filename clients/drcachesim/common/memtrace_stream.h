@@ -64,6 +64,35 @@ namespace drmemtrace { /**< DrMemtrace tracing + simulation infrastructure names
  */
 class memtrace_stream_t {
 public:
+    /**
+     * Statistics on the behavior of the scheduler for the current output stream,
+     * queried via get_schedule_statistic().
+     */
+    enum schedule_statistic_t {
+        /**
+         * Count of inputs selected to run on this output which last ran on a
+         * different output.
+         */
+        SCHED_STAT_MIGRATIONS,
+        /**
+         * Count of inputs this output took from another output's ready queue.
+         * Only non-zero when per-output ready queues are enabled.
+         */
+        SCHED_STAT_RUNQUEUE_STEALS,
+        /**
+         * Count of redistributions of all ready queues initiated by this output.
+         * Only non-zero when per-output ready queues are enabled.
+         */
+        SCHED_STAT_RUNQUEUE_REBALANCES,
+        /**
+         * Count of scheduling lock acquisitions by this output which found the lock
+         * already held by another output.
+         */
+        SCHED_STAT_LOCK_CONTENTION,
+        /** Count of statistic types. */
+        SCHED_STAT_TYPE_COUNT,
+    };
+
     /** Destructor. */
     virtual ~memtrace_stream_t()
     {
@@ -184,6 +213,18 @@ public:
         return -1;
     }
 
+    /**
+     * Returns the total number of output streams, which for #SHARD_BY_CORE is the
+     * number of cores and thus of shards.  This allows a tool to know in
+     * parallel_shard_init_stream() which other shards to expect.  If not implemented
+     * for the current mode, -1 is returned.
+     */
+    virtual int
+    get_output_count() const
+    {
+        return -1;
+    }
+
     /**
      * Returns a unique identifier for the current workload.  This might be an ordinal
      * from the list of active workloads, or some other identifier.  This is guaranteed
@@ -240,6 +281,16 @@ public:
     {
         return false;
     }
+
+    /**
+     * Returns the value of the specified statistic for this output stream.
+     * If not implemented for the current mode, -1 is returned.
+     */
+    virtual int64_t
+    get_schedule_statistic(schedule_statistic_t stat) const
+    {
+        return -1;
+    }
 };
 
 /**
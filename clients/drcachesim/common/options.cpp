@@ -140,6 +140,27 @@ droption_t<bytesize_t> op_chunk_instr_count(
     "support for writing .zip files, this option is ignored. "
     "For 32-bit this cannot exceed 4G.");
 
+droption_t<bytesize_t> op_thread_segment_size(
+    DROPTION_SCOPE_FRONTEND, "thread_segment_size", 0,
+    "Size of concurrently converted pieces of a thread",
+    "Applies to the post-processing of offline raw trace files.  If non-zero, each "
+    "thread's raw file is split into segments of at least this many bytes which all of "
+    "the -jobs workers convert concurrently, rather than one worker converting the "
+    "whole thread.  This speeds up traces where a few threads hold most of the data.  "
+    "The output is identical to that without this option.  Each worker holds the "
+    "converted records of about one segment in memory.");
+
+droption_t<std::string> op_decode_cache_file(
+    DROPTION_SCOPE_FRONTEND, "decode_cache_file", "",
+    "File of block decodings shared across conversions",
+    "Applies to the post-processing of offline raw trace files.  If non-empty, names a "
+    "file holding the decodings of code blocks from earlier post-processing runs, "
+    "which are used in place of decoding blocks whose code is unchanged.  Blocks "
+    "decoded by this run are appended to the file, which is created if it does not "
+    "exist.  This speeds up repeated post-processing of traces of the same binaries.  "
+    "Concurrent runs may share the file.  A file written by a different build of the "
+    "post-processor is replaced.");
+
 droption_t<bool> op_instr_encodings(
     DROPTION_SCOPE_CLIENT, "instr_encodings", false,
     "Whether to include encodings for online tools",
@@ -259,6 +280,30 @@ droption_t<bool> op_coherence(
     DROPTION_SCOPE_FRONTEND, "coherence", false, "Model coherence for private caches",
     "Writes to cache lines will invalidate other private caches that hold that line.");
 
+droption_t<bool> op_cache_parallel(
+    DROPTION_SCOPE_FRONTEND, "cache_parallel", false,
+    "Simulate caches in parallel for -core_sharded",
+    "By default the cache simulator only runs in serial mode.  If this option is "
+    "enabled along with -core_sharded, each core's private caches are simulated on "
+    "the analysis worker thread for that core, while the shared last-level cache and "
+    "the coherence snoop filter are split into address slices which are updated in "
+    "parallel at every epoch boundary (see -cache_parallel_epoch).  Accesses to shared "
+    "structures are applied in a deterministic order, so results are reproducible "
+    "for a given schedule, but they may differ from a serial simulation as the "
+    "interleaving of cores is only exact up to the epoch length.  This supports "
+    "hierarchies with at most one shared cache, which must be the last level, and "
+    "does not support -skip_refs, -warmup_refs, -warmup_fraction, -sim_refs, "
+    "-cpu_scheduling, -use_physical, a last-level prefetcher, or a last-level "
+    "miss file.");
+
+droption_t<uint64_t> op_cache_parallel_epoch(
+    DROPTION_SCOPE_FRONTEND, "cache_parallel_epoch", 10000,
+    "Records per core between shared cache synchronizations for -cache_parallel",
+    "For -cache_parallel, specifies how many trace records each core processes "
+    "between applying its accesses to the shared last-level cache and snoop filter.  "
+    "Smaller values keep the cores' views of shared state closer together at the cost "
+    "of more frequent synchronization.");
+
 droption_t<bool> op_use_physical(
     DROPTION_SCOPE_ALL, "use_physical", false, "Use physical addresses if possible",
     "If available, metadata with virtual-to-physical-address translation information "
@@ -390,16 +435,40 @@ droption_t<std::string> op_raw_compress(
     "for an SSD, zlib and gzip typically add overhead and would only be used if space is "
     "at a premium; snappy_nocrc and lz4 are nearly always performance wins.");
 
+droption_t<unsigned int> op_raw_writer_threads(
+    DROPTION_SCOPE_CLIENT, "raw_writer_threads", 0,
+    "Threads compressing and writing raw files",
+    "For -offline, if non-zero, this many background threads compress (per "
+    "-raw_compress) and write out each full trace buffer, rather than the application "
+    "thread doing so before it resumes.  This reduces the tracing overhead and timing "
+    "distortion seen by the application at the cost of extra memory for the buffers "
+    "in flight: see -raw_writer_buffers.  Each application thread's buffers are "
+    "always written by the same background thread and in order, so the output is "
+    "identical.  This is ignored when the buffer handoff interface "
+    "drmemtrace_buffer_handoff() is in use.");
+
+droption_t<unsigned int> op_raw_writer_buffers(
+    DROPTION_SCOPE_CLIENT, "raw_writer_buffers", 4, 1, 1024,
+    "Maximum buffers in flight per thread",
+    "For -raw_writer_threads, the maximum number of full trace buffers per application "
+    "thread which can be waiting to be written.  When this limit is reached, the "
+    "application thread waits for a write to finish before continuing.  Each buffer "
+    "is the size of the trace buffer plus its redzone.");
+
 droption_t<std::string> op_trace_compress(
     DROPTION_SCOPE_FRONTEND, "compress", DEFAULT_TRACE_COMPRESSION_TYPE,
-    "Trace compression: \"zip\",\"gzip\",\"zlib\",\"lz4\",\"none\"",
+    "Trace compression: \"zip\",\"gzip\",\"zlib\",\"lz4\",\"columnar\",\"none\"",
     "Specifies the compression type to use for trace files: \"zip\", "
-    "\"gzip\", \"zlib\", \"lz4\", or \"none\". "
+    "\"gzip\", \"zlib\", \"lz4\", \"columnar\", or \"none\". "
     "In most cases where fast skipping by instruction count is not needed "
     "lz4 compression generally improves performance and is recommended. "
     "When it comes to storage types, the impact on overhead varies: "
     "for SSDs, zip and gzip often increase overhead and should only be chosen "
-    "if space is limited.");
+    "if space is limited.  The \"columnar\" format encodes each field of the "
+    "trace records separately, predicting instruction addresses from control flow "
+    "and data addresses from their prior strides.  Its output is typically 4 to 6 "
+    "times smaller than uncompressed output and, while larger than gzip output, "
+    "is faster to decode.");
 
 droption_t<bool> op_online_instr_types(
     DROPTION_SCOPE_CLIENT, "online_instr_types", false,
@@ -538,6 +607,15 @@ droption_t<bytesize_t> op_interval_instr_count(
     "and separate callbacks per shard at the end of trace analysis to print each "
     "shard's interval results.");
 
+droption_t<int> op_records_per_batch(
+    DROPTION_SCOPE_FRONTEND, "records_per_batch", 256, 0, 64 * 1024,
+    "Maximum records passed to a parallel tool at once",
+    "For parallel analysis, if every tool supports it (see "
+    "parallel_shard_batch_supported()), records are passed to the tools in batches of "
+    "up to this many consecutive records from one input to reduce the per-record "
+    "overhead.  Batches are not used with -interval_microseconds or "
+    "-interval_instr_count.  0 disables batches.");
+
 droption_t<int>
     op_only_thread(DROPTION_SCOPE_FRONTEND, "only_thread", 0,
                    "Only analyze this thread (0 means all)",
@@ -665,6 +743,31 @@ droption_t<double> op_reuse_histogram_bin_multiplier(
     "bins.  Note that this option only affects the printing of histograms via "
     "the -reuse_distance_histogram option; the raw histogram data is always "
     "collected at full precision.");
+droption_t<bool> op_reuse_order_tree(
+    DROPTION_SCOPE_FRONTEND, "reuse_order_tree", false,
+    "Compute reuse distances with an order tree instead of a skip list.",
+    "Computes each reuse distance in time logarithmic in the number of cache lines "
+    "tracked using a Fenwick tree over access order, rather than walking the skip list "
+    "whose cost grows with the distance.  This is much faster for traces whose "
+    "working sets reach millions of cache lines.  The -reuse_skip_dist option is "
+    "ignored when this is set.");
+droption_t<double> op_reuse_sample_rate(
+    DROPTION_SCOPE_FRONTEND, "reuse_sample_rate", 1.00,
+    "Fraction of cache lines to track for reuse distance and reuse time.",
+    "If below 1, only this fraction of the cache lines, chosen by a hash of their "
+    "addresses, are tracked: all accesses to a chosen line are tracked while the others "
+    "are ignored.  The reported distances are scaled up by the rate, along with an "
+    "estimate of the sampling error.  This reduces time and memory in proportion to "
+    "the rate.  The -reuse_distance_threshold for distant references is scaled down "
+    "by the rate.  For the reuse_time tool the reported times are exact and the "
+    "histogram counts are scaled up by the rate.");
+droption_t<unsigned int> op_reuse_sample_max_lines(
+    DROPTION_SCOPE_FRONTEND, "reuse_sample_max_lines", 0,
+    "If nonzero, bounds the cache lines tracked by lowering the sampling rate.",
+    "If nonzero, sampling as described for -reuse_sample_rate is enabled and the "
+    "rate is lowered as needed to track at most this many cache lines per shard, "
+    "bounding the memory used regardless of the trace's working set.  Unlike "
+    "-reuse_distance_limit this does not omit long distances.");
 
 #define OP_RECORD_FUNC_ITEM_SEP "&"
 // XXX i#3048: replace function return address with function callstack
@@ -929,6 +1032,46 @@ droption_t<bool> op_sched_disable_direct_switches(
     "switch being determined by latency and the next input in the queue.  The "
     "TRACE_MARKER_TYPE_DIRECT_THREAD_SWITCH markers are not removed from the trace.");
 
+droption_t<bool> op_sched_per_output_queues(
+    DROPTION_SCOPE_FRONTEND, "sched_per_output_queues", false,
+    "Use a separate ready queue per core",
+    "Applies to -core_sharded and -core_serial.  Replaces the single global ready "
+    "queue and its lock with a queue per output core.  A core whose queue is empty, "
+    "or whose queue's best input is lower priority than another queue's, steals from "
+    "the other queues.  The queues are periodically rebalanced (see "
+    "-sched_rebalance_period_us) to approximate the global ordering.  This reduces "
+    "lock contention with many cores at the cost of strict timestamp ordering.");
+
+droption_t<uint64_t> op_sched_rebalance_period_us(
+    DROPTION_SCOPE_FRONTEND, "sched_rebalance_period_us", 50000,
+    "Period for rebalancing per-core queues",
+    "Applies to -sched_per_output_queues.  The period, in microseconds (or simulated "
+    "microseconds if -sched_time is set), between redistributions of the per-core ready "
+    "queues.  A value of 0 disables rebalancing.");
+
+droption_t<int> op_read_ahead_threads(
+    DROPTION_SCOPE_FRONTEND, "read_ahead_threads", 0,
+    "Threads decompressing trace files ahead of analysis",
+    "If non-zero, this many background threads read and decompress offline trace "
+    "files ahead of the analysis threads consuming them, overlapping decompression "
+    "with analysis.  As each file is decompressed sequentially, this helps the most "
+    "when many files are being read at once.  Each file uses up to "
+    "-read_ahead_depth times -read_ahead_buffer_size bytes of memory.  Statistics on "
+    "how long the analysis and decompression sides waited for each other are printed "
+    "at the end.  A value of 0 disables reading ahead.");
+
+droption_t<int> op_read_ahead_depth(
+    DROPTION_SCOPE_FRONTEND, "read_ahead_depth", 4, 2, 1024,
+    "Buffers read ahead per trace file",
+    "Applies to -read_ahead_threads.  The number of buffers read ahead for each trace "
+    "file.");
+
+droption_t<bytesize_t> op_read_ahead_buffer_size(
+    DROPTION_SCOPE_FRONTEND, "read_ahead_buffer_size", bytesize_t(1024 * 1024),
+    "Size of each read-ahead buffer",
+    "Applies to -read_ahead_threads.  The size of each buffer read ahead for each "
+    "trace file.");
+
 // Schedule_stats options.
 droption_t<uint64_t>
     op_schedule_stats_print_every(DROPTION_SCOPE_ALL, "schedule_stats_print_every",
@@ -982,6 +1125,21 @@ droption_t<bool> op_encodings2regdeps(
     "This option is for -simulator_type " RECORD_FILTER ". When present, it converts "
     "the encoding of instructions from a real ISA to the DR_ISA_REGDEPS synthetic ISA.");
 
+droption_t<int> op_filter_compress_threads(
+    DROPTION_SCOPE_FRONTEND, "filter_compress_threads", 0, 0, 256,
+    "Threads compressing zipfile output chunks.",
+    "This option is for -simulator_type " RECORD_FILTER ". When positive, the chunks "
+    "of zipfile output are compressed on a pool of this many threads shared by all "
+    "shards while each shard's worker goes on to filter its next chunk, rather than by "
+    "the shard's worker itself. Chunk order and boundaries are unchanged.");
+
+droption_t<int> op_filter_compress_level(
+    DROPTION_SCOPE_FRONTEND, "filter_compress_level", -1, -1, 9,
+    "zlib compression level for zipfile output.",
+    "This option is for -simulator_type " RECORD_FILTER ". Sets the zlib compression "
+    "level, from 0 (none) to 9 (best), of zipfile output chunks. The default of -1 uses "
+    "zlib's default level.");
+
 droption_t<uint64_t> op_trim_before_timestamp(
     DROPTION_SCOPE_ALL, "trim_before_timestamp", 0, 0,
     (std::numeric_limits<uint64_t>::max)(),
@@ -98,6 +98,9 @@ extern dynamorio::droption::droption_t<std::string> op_module_file;
 extern dynamorio::droption::droption_t<std::string> op_alt_module_dir;
 extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t>
     op_chunk_instr_count;
+extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t>
+    op_thread_segment_size;
+extern dynamorio::droption::droption_t<std::string> op_decode_cache_file;
 extern dynamorio::droption::droption_t<bool> op_instr_encodings;
 extern dynamorio::droption::droption_t<std::string> op_funclist_file;
 extern dynamorio::droption::droption_t<unsigned int> op_num_cores;
@@ -118,6 +121,8 @@ extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t>
     op_L0_filter_until_instrs;
 extern dynamorio::droption::droption_t<bool> op_instr_only_trace;
 extern dynamorio::droption::droption_t<bool> op_coherence;
+extern dynamorio::droption::droption_t<bool> op_cache_parallel;
+extern dynamorio::droption::droption_t<uint64_t> op_cache_parallel_epoch;
 extern dynamorio::droption::droption_t<bool> op_use_physical;
 extern dynamorio::droption::droption_t<unsigned int> op_virt2phys_freq;
 extern dynamorio::droption::droption_t<bool> op_cpu_scheduling;
@@ -135,6 +140,8 @@ extern dynamorio::droption::droption_t<bool> op_split_windows;
 extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t>
     op_exit_after_tracing;
 extern dynamorio::droption::droption_t<std::string> op_raw_compress;
+extern dynamorio::droption::droption_t<unsigned int> op_raw_writer_threads;
+extern dynamorio::droption::droption_t<unsigned int> op_raw_writer_buffers;
 extern dynamorio::droption::droption_t<std::string> op_trace_compress;
 extern dynamorio::droption::droption_t<bool> op_online_instr_types;
 extern dynamorio::droption::droption_t<std::string> op_replace_policy;
@@ -164,6 +171,7 @@ extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t>
     op_interval_microseconds;
 extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t>
     op_interval_instr_count;
+extern dynamorio::droption::droption_t<int> op_records_per_batch;
 extern dynamorio::droption::droption_t<int> op_only_thread;
 extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t> op_skip_instrs;
 extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t> op_skip_refs;
@@ -178,6 +186,9 @@ extern dynamorio::droption::droption_t<unsigned int> op_reuse_skip_dist;
 extern dynamorio::droption::droption_t<unsigned int> op_reuse_distance_limit;
 extern dynamorio::droption::droption_t<bool> op_reuse_verify_skip;
 extern dynamorio::droption::droption_t<double> op_reuse_histogram_bin_multiplier;
+extern dynamorio::droption::droption_t<bool> op_reuse_order_tree;
+extern dynamorio::droption::droption_t<double> op_reuse_sample_rate;
+extern dynamorio::droption::droption_t<unsigned int> op_reuse_sample_max_lines;
 extern dynamorio::droption::droption_t<std::string> op_view_syntax;
 extern dynamorio::droption::droption_t<std::string> op_record_function;
 extern dynamorio::droption::droption_t<bool> op_record_heap;
@@ -209,6 +220,12 @@ extern dynamorio::droption::droption_t<std::string> op_cpu_schedule_file;
 extern dynamorio::droption::droption_t<std::string> op_sched_switch_file;
 extern dynamorio::droption::droption_t<bool> op_sched_randomize;
 extern dynamorio::droption::droption_t<bool> op_sched_disable_direct_switches;
+extern dynamorio::droption::droption_t<bool> op_sched_per_output_queues;
+extern dynamorio::droption::droption_t<uint64_t> op_sched_rebalance_period_us;
+extern dynamorio::droption::droption_t<int> op_read_ahead_threads;
+extern dynamorio::droption::droption_t<int> op_read_ahead_depth;
+extern dynamorio::droption::droption_t<dynamorio::droption::bytesize_t>
+    op_read_ahead_buffer_size;
 extern dynamorio::droption::droption_t<uint64_t> op_schedule_stats_print_every;
 extern dynamorio::droption::droption_t<std::string> op_syscall_template_file;
 extern dynamorio::droption::droption_t<uint64_t> op_filter_stop_timestamp;
@@ -216,6 +233,8 @@ extern dynamorio::droption::droption_t<int> op_filter_cache_size;
 extern dynamorio::droption::droption_t<std::string> op_filter_trace_types;
 extern dynamorio::droption::droption_t<std::string> op_filter_marker_types;
 extern dynamorio::droption::droption_t<bool> op_encodings2regdeps;
+extern dynamorio::droption::droption_t<int> op_filter_compress_threads;
+extern dynamorio::droption::droption_t<int> op_filter_compress_level;
 extern dynamorio::droption::droption_t<uint64_t> op_trim_before_timestamp;
 extern dynamorio::droption::droption_t<uint64_t> op_trim_after_timestamp;
 extern dynamorio::droption::droption_t<bool> op_abort_on_invariant_error;
@@ -0,0 +1,266 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "parallel_zipfile_ostream.h"
+
+#include <stdint.h>
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <zlib.h>
+#include "minizip/zip.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+zipfile_compression_pool_t::zipfile_compression_pool_t(int num_threads)
+{
+    if (num_threads < 1)
+        num_threads = 1;
+    for (int i = 0; i < num_threads; ++i)
+        threads_.emplace_back(&zipfile_compression_pool_t::process_jobs, this);
+}
+
+zipfile_compression_pool_t::~zipfile_compression_pool_t()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        exiting_ = true;
+    }
+    work_cond_.notify_all();
+    for (auto &thread : threads_)
+        thread.join();
+}
+
+void
+zipfile_compression_pool_t::schedule(std::shared_ptr<job_t> job)
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        queue_.push_back(std::move(job));
+    }
+    work_cond_.notify_one();
+}
+
+void
+zipfile_compression_pool_t::wait(const job_t &job)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [&job]() { return job.done; });
+}
+
+void
+zipfile_compression_pool_t::process_jobs()
+{
+    while (true) {
+        std::shared_ptr<job_t> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cond_.wait(lock, [this]() { return exiting_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        compress(job.get());
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            job->done = true;
+        }
+        done_cond_.notify_all();
+    }
+}
+
+void
+zipfile_compression_pool_t::compress(job_t *job)
+{
+    // We produce the raw deflate stream, without a zlib header, which minizip
+    // writes for us when not in raw mode.  As we do not use zip64, components
+    // are limited to 4GB, which also keeps sizes within zlib's uInt.
+    if (job->data.size() > UINT32_MAX) {
+        job->failed = true;
+        return;
+    }
+    uInt size = static_cast<uInt>(job->data.size());
+    Bytef *data = reinterpret_cast<Bytef *>(job->data.data());
+    job->crc = crc32(0L, data, size);
+    z_stream zstream = {};
+    if (deflateInit2(&zstream, job->level, Z_DEFLATED, -MAX_WBITS, /*memLevel=*/8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        job->failed = true;
+        return;
+    }
+    job->compressed.resize(deflateBound(&zstream, size));
+    zstream.next_in = data;
+    zstream.avail_in = size;
+    zstream.next_out = reinterpret_cast<Bytef *>(job->compressed.data());
+    zstream.avail_out = static_cast<uInt>(job->compressed.size());
+    // The output buffer is large enough for a single call to finish.
+    if (deflate(&zstream, Z_FINISH) != Z_STREAM_END)
+        job->failed = true;
+    else
+        job->compressed.resize(zstream.total_out);
+    deflateEnd(&zstream);
+    // Free the uncompressed data now rather than when the job is written.
+    job->size = size;
+    std::vector<char>().swap(job->data);
+}
+
+parallel_zipfile_streambuf_t::parallel_zipfile_streambuf_t(
+    const std::string &path, std::shared_ptr<zipfile_compression_pool_t> pool,
+    int level)
+    : pool_(std::move(pool))
+    , level_(level)
+{
+    zip_ = zipOpen2_64(path.c_str(), APPEND_STATUS_CREATE, nullptr, nullptr);
+    if (zip_ == nullptr) {
+        error_ = "Failed to open zipfile";
+        return;
+    }
+    buf_ = new char[buffer_size_];
+    // We leave an extra slot for extra_char on overflow.
+    setp(buf_, buf_ + buffer_size_ - 1);
+}
+
+parallel_zipfile_streambuf_t::~parallel_zipfile_streambuf_t()
+{
+    close();
+    delete[] buf_;
+#ifdef DEBUG
+    // Let's at least have something visible in debug build.
+    if (!error_.empty())
+        std::cerr << "parallel_zipfile_ostream: " << error_ << "\n";
+#endif
+}
+
+std::string
+parallel_zipfile_streambuf_t::close()
+{
+    if (zip_ == nullptr)
+        return error_;
+    finish_component();
+    write_completed(/*wait_all=*/true);
+    // We do not bother with the zipfile comment, as in zipfile_ostream_t.
+    if (zipClose(zip_, nullptr) != ZIP_OK && error_.empty())
+        error_ = "Failed to close zipfile";
+    zip_ = nullptr;
+    return error_;
+}
+
+int
+parallel_zipfile_streambuf_t::overflow(int extra_char)
+{
+    if (zip_ == nullptr || !cur_)
+        return traits_type::eof();
+    if (extra_char != traits_type::eof()) {
+        // Put the extra char into the buffer.  We left an extra slot for it.
+        *pptr() = traits_type::to_char_type(extra_char);
+        pbump(1);
+    }
+    cur_->data.insert(cur_->data.end(), pbase(), pptr());
+    setp(buf_, buf_ + buffer_size_ - 1);
+    return traits_type::not_eof(extra_char);
+}
+
+int
+parallel_zipfile_streambuf_t::sync()
+{
+    return overflow(traits_type::eof()) == traits_type::eof() ? -1 : 0;
+}
+
+void
+parallel_zipfile_streambuf_t::finish_component()
+{
+    if (!cur_)
+        return;
+    sync();
+    pending_.push_back(cur_);
+    pool_->schedule(std::move(cur_));
+    cur_.reset();
+}
+
+void
+parallel_zipfile_streambuf_t::write_completed(bool wait_all)
+{
+    // Keeping one component per pool thread in flight lets a single stream use
+    // the whole pool.
+    const size_t max_pending = static_cast<size_t>(pool_->get_thread_count());
+    while (!pending_.empty()) {
+        zipfile_compression_pool_t::job_t &job = *pending_.front();
+        if (wait_all || pending_.size() > max_pending)
+            pool_->wait(job);
+        else {
+            std::lock_guard<std::mutex> guard(pool_->mutex_);
+            if (!job.done)
+                break;
+        }
+        if (job.failed) {
+            if (error_.empty())
+                error_ = "Failed to compress component " + job.name;
+        } else if (error_.empty()) {
+            // We pass the raw flag so minizip writes our deflate stream as is,
+            // with the sizes and crc we supply.
+            if (zipOpenNewFileInZip2(zip_, job.name.c_str(), nullptr, nullptr, 0,
+                                     nullptr, 0, nullptr, Z_DEFLATED, job.level,
+                                     /*raw=*/1) != ZIP_OK ||
+                zipWriteInFileInZip(zip_, job.compressed.data(),
+                                    static_cast<unsigned int>(job.compressed.size())) !=
+                    ZIP_OK ||
+                zipCloseFileInZipRaw64(zip_, job.size, job.crc) != ZIP_OK)
+                error_ = "Failed to write component " + job.name + " to zipfile";
+        }
+        pending_.pop_front();
+    }
+}
+
+std::string
+parallel_zipfile_streambuf_t::open_new_component(const std::string &name)
+{
+    if (zip_ == nullptr)
+        return error_.empty() ? "Zipfile is closed" : error_;
+    finish_component();
+    write_completed(/*wait_all=*/false);
+    if (!error_.empty())
+        return error_;
+    cur_ = std::make_shared<zipfile_compression_pool_t::job_t>();
+    cur_->name = name;
+    cur_->level = level_;
+    return "";
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
@@ -0,0 +1,188 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* parallel_zipfile_ostream_t: an instance of archive_ostream_t for zipfiles
+ * which compresses each component on a pool of threads while the caller goes on
+ * to write the next one.
+ */
+
+#ifndef _PARALLEL_ZIPFILE_OSTREAM_H_
+#define _PARALLEL_ZIPFILE_OSTREAM_H_ 1
+
+#ifndef HAS_ZIP
+#    error HAS_ZIP is required
+#endif
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+#include "minizip/zip.h"
+#include "archive_ostream.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/**
+ * A pool of threads which deflate the components of any number of
+ * #dynamorio::drmemtrace::parallel_zipfile_ostream_t streams.
+ */
+class zipfile_compression_pool_t {
+public:
+    explicit zipfile_compression_pool_t(int num_threads);
+    ~zipfile_compression_pool_t();
+
+    int
+    get_thread_count() const
+    {
+        return static_cast<int>(threads_.size());
+    }
+
+private:
+    friend class parallel_zipfile_streambuf_t;
+
+    struct job_t {
+        std::string name;
+        int level = Z_DEFAULT_COMPRESSION;
+        std::vector<char> data;
+        // The rest are written by a pool thread.
+        std::vector<char> compressed;
+        uint64_t size = 0;
+        uLong crc = 0;
+        bool failed = false;
+        // Guarded by the pool's mutex_.
+        bool done = false;
+    };
+
+    void
+    schedule(std::shared_ptr<job_t> job);
+    void
+    wait(const job_t &job);
+    void
+    process_jobs();
+    static void
+    compress(job_t *job);
+
+    std::mutex mutex_;
+    std::condition_variable work_cond_;
+    std::condition_variable done_cond_;
+    std::deque<std::shared_ptr<job_t>> queue_;
+    bool exiting_ = false;
+    std::vector<std::thread> threads_;
+};
+
+// Components are buffered uncompressed in memory until a pool thread deflates
+// them, and written to the zipfile in order on the thread which owns the stream.
+// At most one component per pool thread, plus the one being written, is held at
+// once.
+class parallel_zipfile_streambuf_t
+    : public std::basic_streambuf<char, std::char_traits<char>> {
+public:
+    parallel_zipfile_streambuf_t(const std::string &path,
+                                 std::shared_ptr<zipfile_compression_pool_t> pool,
+                                 int level);
+    ~parallel_zipfile_streambuf_t() override;
+    int
+    overflow(int extra_char) override;
+    int
+    sync() override;
+    std::string
+    open_new_component(const std::string &name);
+    std::string
+    close();
+
+private:
+    void
+    finish_component();
+    // Writes the leading compressed components, waiting for them if "wait_all"
+    // is set or too many are outstanding.
+    void
+    write_completed(bool wait_all);
+
+    static const int buffer_size_ = 64 * 1024;
+    std::shared_ptr<zipfile_compression_pool_t> pool_;
+    int level_;
+    zipFile zip_ = nullptr;
+    char *buf_ = nullptr;
+    std::shared_ptr<zipfile_compression_pool_t::job_t> cur_;
+    std::deque<std::shared_ptr<zipfile_compression_pool_t::job_t>> pending_;
+    std::string error_;
+};
+
+// open_new_component() should be called to create an initial component before
+// doing any writing.  A component's contents are not written to the file until
+// a later component is opened or the stream is closed, and errors compressing
+// or writing them are returned by a later open_new_component() or close().
+class parallel_zipfile_ostream_t : public archive_ostream_t {
+public:
+    parallel_zipfile_ostream_t(const std::string &path,
+                               std::shared_ptr<zipfile_compression_pool_t> pool,
+                               int level = Z_DEFAULT_COMPRESSION)
+        : archive_ostream_t(new parallel_zipfile_streambuf_t(path, pool, level))
+    {
+        if (!rdbuf())
+            setstate(std::ios::badbit);
+    }
+    ~parallel_zipfile_ostream_t() override
+    {
+        delete rdbuf();
+    }
+    std::string
+    open_new_component(const std::string &name) override
+    {
+        parallel_zipfile_streambuf_t *zbuf =
+            reinterpret_cast<parallel_zipfile_streambuf_t *>(rdbuf());
+        return zbuf->open_new_component(name);
+    }
+    // Writes out all components and closes the file, which is otherwise done on
+    // destruction.  Returns "" or an error string, including any error for an
+    // earlier component.
+    std::string
+    close()
+    {
+        parallel_zipfile_streambuf_t *zbuf =
+            reinterpret_cast<parallel_zipfile_streambuf_t *>(rdbuf());
+        return zbuf->close();
+    }
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _PARALLEL_ZIPFILE_OSTREAM_H_ */
@@ -1396,6 +1396,13 @@ typedef struct _pt_data_buf_t pt_data_buf_t;
  */
 #define DRMEMTRACE_CPU_SCHEDULE_FILENAME "cpu_schedule.bin.zip"
 
+/**
+ * The suffix appended to the path of a single-file trace to name its seek index,
+ * which lets readers skip to an instruction without decompressing the whole
+ * file up to it.  Seek indices are created with the drmemtrace_seek_index tool.
+ */
+#define DRMEMTRACE_SEEK_INDEX_SUFFIX ".seekidx"
+
 /**
  * The name of the folder in -offline mode where the kernel's per thread trace
  * data is stored.
@@ -52,7 +52,9 @@ namespace drmemtrace {
 // pptr().
 class zipfile_streambuf_t : public std::basic_streambuf<char, std::char_traits<char>> {
 public:
-    explicit zipfile_streambuf_t(const std::string &path)
+    explicit zipfile_streambuf_t(const std::string &path,
+                                 int level = Z_DEFAULT_COMPRESSION)
+        : level_(level)
     {
         zip_ = zipOpen2_64(path.c_str(), APPEND_STATUS_CREATE, nullptr, nullptr);
         if (zip_ == nullptr)
@@ -115,7 +117,7 @@ public:
         // XXX: We should set the date in a zip_fileinfo struct (3rd param)
         // so it's not 1980 in the file.
         if (zipOpenNewFileInZip(zip_, name.c_str(), nullptr, nullptr, 0, nullptr, 0,
-                                nullptr, Z_DEFLATED, Z_DEFAULT_COMPRESSION) != ZIP_OK) {
+                                nullptr, Z_DEFLATED, level_) != ZIP_OK) {
             return "Failed to add new component to zipfile";
         }
         return "";
@@ -123,6 +125,7 @@ public:
 
 private:
     static const int buffer_size_ = 4096;
+    int level_;
     zipFile zip_ = nullptr;
     char *buf_ = nullptr;
     bool first_component_ = true;
@@ -132,8 +135,9 @@ private:
 // doing any writing.
 class zipfile_ostream_t : public archive_ostream_t {
 public:
-    explicit zipfile_ostream_t(const std::string &path)
-        : archive_ostream_t(new zipfile_streambuf_t(path))
+    explicit zipfile_ostream_t(const std::string &path,
+                               int level = Z_DEFAULT_COMPRESSION)
+        : archive_ostream_t(new zipfile_streambuf_t(path, level))
     {
         if (!rdbuf())
             setstate(std::ios::badbit);
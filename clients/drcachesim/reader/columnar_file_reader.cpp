@@ -0,0 +1,272 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "columnar_file_reader.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "common/columnar_codec.h"
+#include "file_reader.h"
+#include "read_ahead.h"
+#include "record_file_reader.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/**************************************************
+ * columnar_input_t.
+ */
+
+columnar_input_t::columnar_input_t(const std::string &path)
+    : file_(path, std::ifstream::binary)
+{
+    char magic[columnar_codec_t::kMagicSize];
+    if (!file_.read(magic, sizeof(magic)) ||
+        memcmp(magic, columnar_codec_t::get_magic(), sizeof(magic)) != 0)
+        failed_ = true;
+}
+
+int
+columnar_input_t::next_block(char *out, size_t out_size, size_t *decoded_size)
+{
+    columnar_codec_t::block_header_t header;
+    file_.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (file_.gcount() == 0 && file_.eof())
+        return 0;
+    if (file_.gcount() != sizeof(header))
+        return -1;
+    size_t payload_size = columnar_codec_t::get_block_payload_size(header);
+    if (payload_size == 0)
+        return -1;
+    payload_.resize(payload_size);
+    if (!file_.read(payload_.data(), payload_size))
+        return -1;
+    *decoded_size = columnar_codec_t::get_block_output_size(header);
+    if (*decoded_size > out_size) {
+        decoded_.resize(*decoded_size);
+        out = decoded_.data();
+    }
+    if (!decoder_.decode_block(header, payload_.data(), out))
+        return -1;
+    return 1;
+}
+
+int64_t
+columnar_input_t::read(void *buf, size_t size)
+{
+    if (failed_)
+        return -1;
+    char *out = static_cast<char *>(buf);
+    size_t left = size;
+    while (left > 0) {
+        if (decoded_pos_ < decoded_.size()) {
+            size_t copy = std::min(left, decoded_.size() - decoded_pos_);
+            memcpy(out, decoded_.data() + decoded_pos_, copy);
+            decoded_pos_ += copy;
+            out += copy;
+            left -= copy;
+            continue;
+        }
+        size_t decoded_size;
+        decoded_.clear();
+        decoded_pos_ = 0;
+        int res = next_block(out, left, &decoded_size);
+        if (res < 0) {
+            failed_ = true;
+            return -1;
+        }
+        if (res == 0)
+            break;
+        if (decoded_.empty()) {
+            // The block was decoded in place.
+            out += decoded_size;
+            left -= decoded_size;
+        }
+    }
+    return size - left;
+}
+
+/**************************************************************************
+ * Common logic used in the columnar_reader_t specializations for file_reader_t
+ * and record_file_reader_t.
+ */
+
+namespace {
+
+bool
+open_single_file_common(const std::string &path, columnar_reader_t *reader,
+                        std::shared_ptr<read_ahead_pool_t> pool,
+                        const read_ahead_options_t &options)
+{
+    reader->input.reset(new columnar_input_t(path));
+    if (!*reader->input)
+        return false;
+    reader->cur_buf = reader->buf;
+    reader->max_buf = reader->buf;
+    if (pool) {
+        columnar_input_t *input = reader->input.get();
+        reader->read_ahead.reset(new read_ahead_t(
+            std::move(pool), options,
+            [input](void *buf, size_t size, uint64_t *position) -> int64_t {
+                return input->read(buf, size);
+            },
+            sizeof(trace_entry_t)));
+    }
+    return true;
+}
+
+trace_entry_t *
+read_next_entry_common(columnar_reader_t *reader, bool *eof)
+{
+    if (reader->cur_buf >= reader->max_buf) {
+        trace_entry_t *start = reader->buf;
+        int64_t len;
+        if (reader->read_ahead) {
+            size_t size;
+            start = reinterpret_cast<trace_entry_t *>(
+                reader->read_ahead->next_buffer(&size));
+            len = static_cast<int64_t>(size);
+            if (start == nullptr && reader->read_ahead->failed())
+                len = -1;
+        } else
+            len = reader->input->read(reader->buf, sizeof(reader->buf));
+        if (len < static_cast<int64_t>(sizeof(trace_entry_t)) ||
+            len % sizeof(trace_entry_t) != 0) {
+            *eof = (len >= 0);
+            return nullptr;
+        }
+        reader->cur_buf = start;
+        reader->max_buf = start + (len / sizeof(trace_entry_t));
+    }
+    trace_entry_t *res = reader->cur_buf;
+    ++reader->cur_buf;
+    return res;
+}
+
+} // namespace
+
+/**************************************************
+ * columnar_reader_t specializations for file_reader_t.
+ */
+
+/* clang-format off */ /* (make vera++ newline-after-type check happy) */
+template <>
+/* clang-format on */
+file_reader_t<columnar_reader_t>::file_reader_t()
+{
+}
+
+/* clang-format off */ /* (make vera++ newline-after-type check happy) */
+template <>
+/* clang-format on */
+file_reader_t<columnar_reader_t>::~file_reader_t<columnar_reader_t>()
+{
+    // Stop reading ahead before deleting the input out from under it.
+    input_file_.read_ahead.reset();
+}
+
+template <>
+bool
+file_reader_t<columnar_reader_t>::open_single_file(const std::string &path)
+{
+    if (!open_single_file_common(path, &input_file_, read_ahead_pool_,
+                                 read_ahead_options_))
+        return false;
+    VPRINT(this, 1, "Opened input file %s\n", path.c_str());
+    return true;
+}
+
+template <>
+trace_entry_t *
+file_reader_t<columnar_reader_t>::read_next_entry()
+{
+    trace_entry_t *entry = read_queued_entry();
+    if (entry != nullptr)
+        return entry;
+    entry = read_next_entry_common(&input_file_, &at_eof_);
+    if (entry == nullptr)
+        return entry;
+    VPRINT(this, 4, "Read from file: type=%s (%d), size=%d, addr=%zu\n",
+           trace_type_names[entry->type], entry->type, entry->size, entry->addr);
+    entry_copy_ = *entry;
+    return &entry_copy_;
+}
+
+/**************************************************
+ * columnar_reader_t specializations for record_file_reader_t.
+ */
+
+/* clang-format off */ /* (make vera++ newline-after-type check happy) */
+template <>
+/* clang-format on */
+record_file_reader_t<columnar_reader_t>::~record_file_reader_t<columnar_reader_t>()
+{
+    if (input_file_ != nullptr)
+        input_file_->read_ahead.reset();
+}
+
+template <>
+bool
+record_file_reader_t<columnar_reader_t>::open_single_file(const std::string &path)
+{
+    input_file_ = std::unique_ptr<columnar_reader_t>(new columnar_reader_t());
+    if (!open_single_file_common(path, input_file_.get(), read_ahead_pool_,
+                                 read_ahead_options_))
+        return false;
+    VPRINT(this, 1, "Opened input file %s\n", path.c_str());
+    return true;
+}
+
+template <>
+bool
+record_file_reader_t<columnar_reader_t>::read_next_entry()
+{
+    trace_entry_t *entry = read_next_entry_common(input_file_.get(), &eof_);
+    if (entry == nullptr)
+        return false;
+    cur_entry_ = *entry;
+    VPRINT(this, 4, "Read from file: type=%s (%d), size=%d, addr=%zu\n",
+           trace_type_names[cur_entry_.type], cur_entry_.type, cur_entry_.size,
+           cur_entry_.addr);
+    return true;
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
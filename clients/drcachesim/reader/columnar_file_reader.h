@@ -0,0 +1,109 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* columnar_file_reader: reads files in the columnar encoding of
+ * common/columnar_codec.h.
+ */
+
+#ifndef _COLUMNAR_FILE_READER_H_
+#define _COLUMNAR_FILE_READER_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/columnar_codec.h"
+#include "file_reader.h"
+#include "read_ahead.h"
+#include "record_file_reader.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/** The decoded contents of a file in the columnar encoding. */
+class columnar_input_t {
+public:
+    explicit columnar_input_t(const std::string &path);
+    // Returns true if the file could not be opened or is not in the columnar
+    // encoding.
+    bool
+    operator!()
+    {
+        return failed_;
+    }
+    // Reads up to "size" bytes, returning fewer only at the end of the data.
+    // Returns the number of bytes read, or -1 on an error.
+    int64_t
+    read(void *buf, size_t size);
+
+private:
+    // Decodes the next block into "out" if it has room for "out_size" bytes, or
+    // else into decoded_.  Returns 1 when a block was decoded, 0 at the end of
+    // the file, or -1 on an error.
+    int
+    next_block(char *out, size_t out_size, size_t *decoded_size);
+
+    std::ifstream file_;
+    bool failed_ = false;
+    columnar_decoder_t decoder_;
+    std::vector<char> payload_;
+    // A decoded block too large for the caller's buffer, which is returned from
+    // decoded_pos_ onward.
+    std::vector<char> decoded_;
+    size_t decoded_pos_ = 0;
+};
+
+struct columnar_reader_t {
+    columnar_reader_t() = default;
+    std::unique_ptr<columnar_input_t> input;
+    // We use the same buffer size as the other readers, which also matches the
+    // codec's block size so that blocks can be decoded straight into it.
+    trace_entry_t buf[columnar_codec_t::kBlockEntries];
+    trace_entry_t *cur_buf = buf;
+    trace_entry_t *max_buf = buf;
+    // When set, blocks are decoded on a background thread and cur_buf and
+    // max_buf point into read_ahead's buffers rather than buf.
+    std::unique_ptr<read_ahead_t> read_ahead;
+};
+
+typedef file_reader_t<columnar_reader_t> columnar_file_reader_t;
+typedef record_file_reader_t<columnar_reader_t> columnar_record_file_reader_t;
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _COLUMNAR_FILE_READER_H_ */
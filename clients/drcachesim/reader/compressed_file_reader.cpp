@@ -34,11 +34,19 @@
 
 #include <zlib.h>
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include "file_reader.h"
+#include "read_ahead.h"
 #include "record_file_reader.h"
+#include "seek_index.h"
 #include "trace_entry.h"
 
 namespace dynamorio {
@@ -56,11 +64,48 @@ open_single_file_common(const std::string &path, gzFile &out)
     return out != nullptr;
 }
 
+void
+start_read_ahead_common(gzip_reader_t *gzip, std::shared_ptr<read_ahead_pool_t> pool,
+                        const read_ahead_options_t &options)
+{
+    if (!pool)
+        return;
+    if (gzip->seek_input) {
+        seekable_input_t *input = gzip->seek_input.get();
+        gzip->read_ahead.reset(new read_ahead_t(
+            std::move(pool), options,
+            [input](void *buf, size_t size, uint64_t *position) -> int64_t {
+                return input->read(buf, size);
+            },
+            sizeof(trace_entry_t)));
+        return;
+    }
+    gzFile file = gzip->file;
+    gzip->read_ahead.reset(new read_ahead_t(
+        std::move(pool), options,
+        [file](void *buf, size_t size, uint64_t *position) -> int64_t {
+            return gzread(file, buf, static_cast<unsigned int>(size));
+        },
+        sizeof(trace_entry_t)));
+}
+
 trace_entry_t *
 read_next_entry_common(gzip_reader_t *gzip, bool *eof)
 {
     if (gzip->cur_buf >= gzip->max_buf) {
-        int len = gzread(gzip->file, gzip->buf, sizeof(gzip->buf));
+        trace_entry_t *start = gzip->buf;
+        int len;
+        if (gzip->read_ahead) {
+            size_t size;
+            start = reinterpret_cast<trace_entry_t *>(
+                gzip->read_ahead->next_buffer(&size));
+            len = static_cast<int>(size);
+            if (start == nullptr && gzip->read_ahead->failed())
+                len = -1;
+        } else if (gzip->seek_input) {
+            len = static_cast<int>(gzip->seek_input->read(gzip->buf, sizeof(gzip->buf)));
+        } else
+            len = gzread(gzip->file, gzip->buf, sizeof(gzip->buf));
         // Returns less than asked-for if at end of file, or –1 for error.
         // We should always get a multiple of the record size.
         if (len < static_cast<int>(sizeof(trace_entry_t)) ||
@@ -68,14 +113,176 @@ read_next_entry_common(gzip_reader_t *gzip, bool *eof)
             *eof = (len >= 0);
             return nullptr;
         }
-        gzip->cur_buf = gzip->buf;
-        gzip->max_buf = gzip->buf + (len / sizeof(*gzip->max_buf));
+        gzip->cur_buf = start;
+        gzip->max_buf = start + (len / sizeof(*gzip->max_buf));
     }
     trace_entry_t *res = gzip->cur_buf;
     ++gzip->cur_buf;
     return res;
 }
 
+/**************************************************
+ * gzip_seekable_input_t.
+ */
+
+constexpr size_t gzip_seekable_input_t::kWindowSize;
+
+gzip_seekable_input_t::gzip_seekable_input_t(const std::string &path)
+    : file_(path, std::ifstream::binary)
+{
+    // We accept zlib as well as gzip headers, like gzread.
+    zstream_ready_ = inflateInit2(&zstream_, 15 + 32) == Z_OK;
+}
+
+gzip_seekable_input_t::~gzip_seekable_input_t()
+{
+    if (zstream_ready_)
+        inflateEnd(&zstream_);
+}
+
+bool
+gzip_seekable_input_t::fill_input()
+{
+    file_.read(reinterpret_cast<char *>(in_buf_), sizeof(in_buf_));
+    if (file_.bad() || file_.gcount() == 0)
+        return false;
+    zstream_.next_in = in_buf_;
+    zstream_.avail_in = static_cast<uInt>(file_.gcount());
+    return true;
+}
+
+bool
+gzip_seekable_input_t::skip_input(size_t size)
+{
+    while (size > 0) {
+        if (zstream_.avail_in == 0 && !fill_input())
+            return false;
+        size_t skip = std::min(size, static_cast<size_t>(zstream_.avail_in));
+        zstream_.next_in += skip;
+        zstream_.avail_in -= static_cast<uInt>(skip);
+        in_offset_ += skip;
+        size -= skip;
+    }
+    return true;
+}
+
+void
+gzip_seekable_input_t::add_history(const char *data, size_t size)
+{
+    if (history_.empty())
+        history_.resize(kWindowSize);
+    if (size >= kWindowSize) {
+        memcpy(history_.data(), data + size - kWindowSize, kWindowSize);
+        history_pos_ = 0;
+        return;
+    }
+    size_t first = std::min(size, kWindowSize - history_pos_);
+    memcpy(history_.data() + history_pos_, data, first);
+    memcpy(history_.data(), data + first, size - first);
+    history_pos_ = (history_pos_ + size) % kWindowSize;
+}
+
+int64_t
+gzip_seekable_input_t::read(void *buf, size_t size)
+{
+    if (!zstream_ready_)
+        return -1;
+    char *out = static_cast<char *>(buf);
+    size_t left = size;
+    while (left > 0 && !at_end_) {
+        if (zstream_.avail_in == 0 && !fill_input()) {
+            if (file_.bad())
+                return -1;
+            at_end_ = true;
+            break;
+        }
+        zstream_.next_out = reinterpret_cast<Bytef *>(out);
+        zstream_.avail_out = static_cast<uInt>(std::min<size_t>(left, UINT32_MAX));
+        uInt avail_in = zstream_.avail_in;
+        uInt avail_out = zstream_.avail_out;
+        // When recording restarts we stop at each block boundary to consider it.
+        int res = inflate(&zstream_, restarts_ != nullptr ? Z_BLOCK : Z_NO_FLUSH);
+        size_t consumed = avail_in - zstream_.avail_in;
+        size_t produced = avail_out - zstream_.avail_out;
+        in_offset_ += consumed;
+        out_offset_ += produced;
+        if (restarts_ != nullptr)
+            add_history(out, produced);
+        out += produced;
+        left -= produced;
+        if (res == Z_STREAM_END) {
+            // Another member may follow.
+            if (raw_) {
+                static constexpr size_t kGzipTrailerSize = 8;
+                if (!skip_input(kGzipTrailerSize)) {
+                    at_end_ = true;
+                    break;
+                }
+                raw_ = false;
+                if (inflateReset2(&zstream_, 15 + 32) != Z_OK)
+                    return -1;
+            } else if (inflateReset(&zstream_) != Z_OK)
+                return -1;
+            continue;
+        }
+        // Z_BUF_ERROR just means more input is needed, unless we made no progress
+        // with the input we have.
+        if (res == Z_BUF_ERROR) {
+            if (consumed == 0 && produced == 0 && zstream_.avail_in > 0)
+                return -1;
+        } else if (res != Z_OK)
+            return -1;
+        // Bit 7 of data_type marks a block boundary and bit 6 the final block.
+        if (restarts_ != nullptr && (zstream_.data_type & 128) != 0 &&
+            (zstream_.data_type & 64) == 0 && want_restart(out_offset_)) {
+            seek_index_restart_t restart;
+            restart.in_offset = in_offset_;
+            restart.out_offset = out_offset_;
+            restart.state = zstream_.data_type & 7;
+            size_t window_size =
+                static_cast<size_t>(std::min<uint64_t>(out_offset_, kWindowSize));
+            restart.window.resize(window_size);
+            size_t start = (history_pos_ + kWindowSize - window_size) % kWindowSize;
+            size_t first = std::min(window_size, kWindowSize - start);
+            memcpy(restart.window.data(), history_.data() + start, first);
+            memcpy(restart.window.data() + first, history_.data(), window_size - first);
+            restarts_->push_back(std::move(restart));
+        }
+    }
+    return size - left;
+}
+
+bool
+gzip_seekable_input_t::restart(const seek_index_restart_t &restart)
+{
+    if (!zstream_ready_)
+        return false;
+    // A restart in the middle of a byte begins with its remaining bits.
+    int bits = static_cast<int>(restart.state);
+    file_.clear();
+    if (!file_.seekg(restart.in_offset - (bits != 0 ? 1 : 0)))
+        return false;
+    zstream_.avail_in = 0;
+    if (inflateReset2(&zstream_, -15) != Z_OK)
+        return false;
+    if (bits != 0) {
+        int byte = file_.get();
+        if (byte == std::char_traits<char>::eof() ||
+            inflatePrime(&zstream_, bits, byte >> (8 - bits)) != Z_OK)
+            return false;
+    }
+    if (!restart.window.empty() &&
+        inflateSetDictionary(&zstream_,
+                             reinterpret_cast<const Bytef *>(restart.window.data()),
+                             static_cast<uInt>(restart.window.size())) != Z_OK)
+        return false;
+    raw_ = true;
+    at_end_ = false;
+    in_offset_ = restart.in_offset;
+    out_offset_ = restart.out_offset;
+    return true;
+}
+
 /**************************************************
  * gzip_reader_t specializations for file_reader_t.
  */
@@ -93,6 +300,8 @@ template <>
 /* clang-format on */
 file_reader_t<gzip_reader_t>::~file_reader_t<gzip_reader_t>()
 {
+    // Stop reading ahead before closing the file out from under it.
+    input_file_.read_ahead.reset();
     if (input_file_.file != nullptr) {
         gzclose(input_file_.file);
         input_file_.file = nullptr;
@@ -107,7 +316,52 @@ file_reader_t<gzip_reader_t>::open_single_file(const std::string &path)
     if (!open_single_file_common(path, file))
         return false;
     VPRINT(this, 1, "Opened input file %s\n", path.c_str());
-    input_file_ = gzip_reader_t(file);
+    // We set the fields in place rather than assigning a temporary, which now
+    // has a non-trivial move and would copy the uninitialized buffer.
+    input_file_.file = file;
+    input_file_.cur_buf = input_file_.buf;
+    input_file_.max_buf = input_file_.buf;
+    start_read_ahead_common(&input_file_, read_ahead_pool_, read_ahead_options_);
+    return true;
+}
+
+template <>
+bool
+file_reader_t<gzip_reader_t>::accepts_seek_codec(seek_index_codec_t codec)
+{
+    // gzread passes uncompressed files through.
+    return codec == SEEK_INDEX_CODEC_GZIP || codec == SEEK_INDEX_CODEC_NONE;
+}
+
+template <>
+bool
+file_reader_t<gzip_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                              const seek_index_restart_t &restart,
+                                              uint64_t out_offset)
+{
+    // Stop reading ahead before repositioning.
+    input_file_.read_ahead.reset();
+    if (!input_file_.seek_input) {
+        if (codec == SEEK_INDEX_CODEC_GZIP) {
+            auto input = std::unique_ptr<gzip_seekable_input_t>(
+                new gzip_seekable_input_t(input_path_));
+            if (!*input)
+                return false;
+            input_file_.seek_input = std::move(input);
+        } else {
+            auto input = std::unique_ptr<raw_seekable_input_t>(
+                new raw_seekable_input_t(input_path_));
+            if (!*input)
+                return false;
+            input_file_.seek_input = std::move(input);
+        }
+    }
+    if (!input_file_.seek_input->restart(restart) ||
+        !input_file_.seek_input->discard(out_offset - restart.out_offset))
+        return false;
+    input_file_.cur_buf = input_file_.buf;
+    input_file_.max_buf = input_file_.buf;
+    start_read_ahead_common(&input_file_, read_ahead_pool_, read_ahead_options_);
     return true;
 }
 
@@ -137,6 +391,8 @@ template <>
 record_file_reader_t<gzip_reader_t>::~record_file_reader_t<gzip_reader_t>()
 {
     if (input_file_ != nullptr) {
+        // Stop reading ahead before closing the file out from under it.
+        input_file_->read_ahead.reset();
         gzclose(input_file_->file);
     }
 }
@@ -150,6 +406,7 @@ record_file_reader_t<gzip_reader_t>::open_single_file(const std::string &path)
         return false;
     VPRINT(this, 1, "Opened input file %s\n", path.c_str());
     input_file_ = std::unique_ptr<gzip_reader_t>(new gzip_reader_t(file));
+    start_read_ahead_common(input_file_.get(), read_ahead_pool_, read_ahead_options_);
     return true;
 }
 
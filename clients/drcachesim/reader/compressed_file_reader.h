@@ -37,8 +37,15 @@
 
 #include <zlib.h>
 
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "file_reader.h"
+#include "read_ahead.h"
 #include "record_file_reader.h"
+#include "seek_index.h"
 #include "trace_entry.h"
 
 namespace dynamorio {
@@ -60,12 +67,71 @@ struct gzip_reader_t {
     trace_entry_t buf[4096];
     trace_entry_t *cur_buf = buf;
     trace_entry_t *max_buf = buf;
+    // When set, gzread is called on a background thread and cur_buf and
+    // max_buf point into read_ahead's buffers rather than buf.
+    std::unique_ptr<read_ahead_t> read_ahead;
+    // Once we have used a seek index, we read from this rather than file.
+    std::unique_ptr<seekable_input_t> seek_input;
+};
+
+/**
+ * A #dynamorio::drmemtrace::seekable_input_t for a gzip file, which can restart
+ * at deflate block boundaries given the preceding 32K of output.
+ */
+class gzip_seekable_input_t : public seekable_input_t {
+public:
+    explicit gzip_seekable_input_t(const std::string &path);
+    ~gzip_seekable_input_t() override;
+    bool
+    operator!()
+    {
+        return !file_ || !zstream_ready_;
+    }
+    int64_t
+    read(void *buf, size_t size) override;
+    bool
+    restart(const seek_index_restart_t &restart) override;
+
+private:
+    bool
+    fill_input();
+    bool
+    skip_input(size_t size);
+    void
+    add_history(const char *data, size_t size);
+
+    static constexpr size_t kWindowSize = 32 * 1024;
+    std::ifstream file_;
+    z_stream zstream_ = {};
+    bool zstream_ready_ = false;
+    // Set when decoding raw deflate data from a restart point, in which case the
+    // member's trailer is not consumed by zlib.
+    bool raw_ = false;
+    bool at_end_ = false;
+    uint64_t in_offset_ = 0;
+    uint64_t out_offset_ = 0;
+    unsigned char in_buf_[64 * 1024];
+    // The last kWindowSize bytes of output, kept only when recording restarts.
+    std::vector<char> history_;
+    size_t history_pos_ = 0;
 };
 
 typedef file_reader_t<gzip_reader_t> compressed_file_reader_t;
 typedef dynamorio::drmemtrace::record_file_reader_t<gzip_reader_t>
     compressed_record_file_reader_t;
 
+/* Declare these so the compiler knows not to use the default implementations in the
+ * class declaration.
+ */
+template <>
+bool
+file_reader_t<gzip_reader_t>::accepts_seek_codec(seek_index_codec_t codec);
+template <>
+bool
+file_reader_t<gzip_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                              const seek_index_restart_t &restart,
+                                              uint64_t out_offset);
+
 } // namespace drmemtrace
 } // namespace dynamorio
 
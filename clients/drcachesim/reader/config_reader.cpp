@@ -159,6 +159,24 @@ config_reader_t::configure(std::istream *config_file, cache_simulator_knobs_t &k
             } else {
                 knobs.model_coherence = false;
             }
+        } else if (param == "parallel") {
+            // Whether to simulate the cores in parallel.
+            std::string bool_val;
+            if (!(*fin_ >> bool_val)) {
+                ERRMSG("Error reading parallel from the configuration file\n");
+                return false;
+            }
+            if (is_true(bool_val)) {
+                knobs.parallel = true;
+            } else {
+                knobs.parallel = false;
+            }
+        } else if (param == "parallel_epoch") {
+            // Records per core between shared cache synchronizations.
+            if (!(*fin_ >> knobs.parallel_epoch)) {
+                ERRMSG("Error reading parallel_epoch from the configuration file\n");
+                return false;
+            }
         } else if (param == "use_physical") {
             // Whether to use physical addresses
             std::string bool_val;
@@ -36,6 +36,7 @@
 #include <string>
 
 #include "reader.h"
+#include "seek_index.h"
 #include "trace_entry.h"
 
 namespace dynamorio {
@@ -71,6 +72,23 @@ file_reader_t<std::ifstream *>::open_single_file(const std::string &path)
     return true;
 }
 
+template <>
+bool
+file_reader_t<std::ifstream *>::accepts_seek_codec(seek_index_codec_t codec)
+{
+    return codec == SEEK_INDEX_CODEC_NONE;
+}
+
+template <>
+bool
+file_reader_t<std::ifstream *>::seek_input_file(seek_index_codec_t codec,
+                                                const seek_index_restart_t &restart,
+                                                uint64_t out_offset)
+{
+    input_file_->clear();
+    return !!input_file_->seekg(out_offset);
+}
+
 template <>
 trace_entry_t *
 file_reader_t<std::ifstream *>::read_next_entry()
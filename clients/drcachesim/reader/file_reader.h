@@ -43,13 +43,17 @@
 #include <string.h>
 
 #include <fstream>
+#include <memory>
 #include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "directory_iterator.h"
 #include "memref.h"
+#include "read_ahead.h"
 #include "reader.h"
+#include "seek_index.h"
 #include "trace_entry.h"
 #include "utils.h"
 
@@ -102,6 +106,19 @@ public:
         return input_path_.substr(ind + 1);
     }
 
+    /**
+     * Requests that the file be read and decompressed ahead of use on the
+     * threads of "pool", for the file types which support it (others ignore
+     * this).  Must be called prior to init().
+     */
+    void
+    set_read_ahead(std::shared_ptr<read_ahead_pool_t> pool,
+                   const read_ahead_options_t &options)
+    {
+        read_ahead_pool_ = std::move(pool);
+        read_ahead_options_ = options;
+    }
+
 protected:
     trace_entry_t *
     read_next_entry() override;
@@ -169,19 +186,120 @@ protected:
     }
 
     // Provided so that instantiations can specialize.
+    // By default, if the trace has a seek index we jump to the latest point it
+    // records before the target and walk forward from there.
     reader_t &
     skip_instructions(uint64_t instruction_count) override
     {
-        return reader_t::skip_instructions(instruction_count);
+        if (instruction_count == 0 || !open_seek_index())
+            return reader_t::skip_instructions(instruction_count);
+        if (!pre_skip_instructions())
+            return *this;
+        uint64_t stop_count = cur_instr_count_ + instruction_count;
+        if (!seek_with_index(stop_count))
+            return *this;
+        return skip_instructions_with_timestamp(stop_count);
+    }
+
+    // Returns whether the file type can be repositioned to a restart point of a
+    // seek index for "codec".  Provided so that instantiations can specialize.
+    bool
+    accepts_seek_codec(seek_index_codec_t codec)
+    {
+        return false;
+    }
+
+    // Repositions the file so that the next entry read is the one "out_offset"
+    // bytes into the decompressed data, starting from "restart".
+    // Provided so that instantiations can specialize.
+    bool
+    seek_input_file(seek_index_codec_t codec, const seek_index_restart_t &restart,
+                    uint64_t out_offset)
+    {
+        return false;
+    }
+
+    // Loads the seek index on the first skip.  Returns whether there is one.
+    bool
+    open_seek_index()
+    {
+        if (!seek_index_checked_) {
+            seek_index_checked_ = true;
+            seek_index_.reset(new seek_index_t());
+            if (!seek_index_->open(input_path_) ||
+                !accepts_seek_codec(seek_index_->get_codec())) {
+                seek_index_.reset();
+            } else {
+                VPRINT(this, 1, "Opened seek index for %s\n", input_path_.c_str());
+            }
+        }
+        return seek_index_ != nullptr;
+    }
+
+    // Moves to the latest index point before the instruction with ordinal
+    // "stop_instruction_count", if that is ahead of us, restoring the state that
+    // walking there would have produced.  Returns false on a fatal error.
+    bool
+    seek_with_index(uint64_t stop_instruction_count)
+    {
+        seek_index_point_t point;
+        seek_index_restart_t restart;
+        // Any entries already queued from the file would be lost.
+        if (!queue_.empty() ||
+            !seek_index_->find(stop_instruction_count, cur_instr_count_, &point,
+                               &restart))
+            return true;
+        std::vector<seek_index_encoding_t> encodings;
+        if (!seek_index_->read_encodings(point.encoding_count, &encodings))
+            return true;
+        VPRINT(this, 2,
+               "Seeking from instr %" PRIu64 " to instr %" PRIu64 " @%" PRIu64 "\n",
+               cur_instr_count_, point.instr_ordinal, point.out_offset);
+        if (!seek_input_file(seek_index_->get_codec(), restart, point.out_offset)) {
+            VPRINT(this, 1, "Failed to seek %s\n", input_path_.c_str());
+            at_eof_ = true;
+            return false;
+        }
+        cur_instr_count_ = point.instr_ordinal;
+        cur_ref_count_ = point.record_ordinal;
+        // Index points are never within a chunk header, so any pending skip of
+        // one from a chunk footer we read before seeking no longer applies.
+        skip_chunk_header_.clear();
+        for (const seek_index_encoding_t &encoding : encodings) {
+            encoding_info_t &info = encodings_[static_cast<addr_t>(encoding.pc)];
+            info.size = encoding.size;
+            memcpy(info.bits, encoding.bits, encoding.size);
+        }
+        // We skipped the first timestamp along with everything else.
+        if (first_timestamp_ == 0)
+            first_timestamp_ = seek_index_->get_first_timestamp();
+        return true;
     }
 
     // Protected for access by mock_file_reader_t.
     T input_file_;
+    // Set when reading ahead.
+    std::shared_ptr<read_ahead_pool_t> read_ahead_pool_;
+    read_ahead_options_t read_ahead_options_;
 
 private:
     std::string input_path_;
+    std::unique_ptr<seek_index_t> seek_index_;
+    bool seek_index_checked_ = false;
 };
 
+/* Declare these so the compiler knows not to use the default implementations in the
+ * class declaration.
+ */
+template <>
+bool
+file_reader_t<std::ifstream *>::accepts_seek_codec(seek_index_codec_t codec);
+template <>
+bool
+file_reader_t<std::ifstream *>::seek_input_file(seek_index_codec_t codec,
+                                                const seek_index_restart_t &restart,
+                                                uint64_t out_offset);
+
 } // namespace drmemtrace
 } // namespace dynamorio
 
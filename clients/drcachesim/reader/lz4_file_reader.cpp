@@ -32,6 +32,18 @@
 
 #include "lz4_file_reader.h"
 
+#include <lz4.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "read_ahead.h"
+#include "seek_index.h"
+
 namespace dynamorio {
 namespace drmemtrace {
 
@@ -39,22 +51,252 @@ trace_entry_t *
 read_next_entry_common(lz4_reader_t *reader, bool *eof)
 {
     if (reader->cur_buf >= reader->max_buf) {
-        int len = reader->file
+        trace_entry_t *start = reader->buf;
+        int len;
+        if (reader->read_ahead) {
+            size_t size;
+            start = reinterpret_cast<trace_entry_t *>(
+                reader->read_ahead->next_buffer(&size));
+            len = static_cast<int>(size);
+            if (start == nullptr && reader->read_ahead->failed())
+                len = -1;
+        } else if (reader->seek_input) {
+            len = static_cast<int>(
+                reader->seek_input->read(reader->buf, sizeof(reader->buf)));
+        } else {
+            len = reader->file
                       ->read(reinterpret_cast<char *>(&reader->buf), sizeof(reader->buf))
                       .gcount();
+        }
         if (len < static_cast<int>(sizeof(trace_entry_t)) ||
             len % static_cast<int>(sizeof(trace_entry_t)) != 0) {
             *eof = (len >= 0);
             return nullptr;
         }
-        reader->cur_buf = reader->buf;
-        reader->max_buf = reader->buf + (len / sizeof(trace_entry_t));
+        reader->cur_buf = start;
+        reader->max_buf = start + (len / sizeof(trace_entry_t));
     }
     trace_entry_t *res = reader->cur_buf;
     ++reader->cur_buf;
     return res;
 }
 
+/**************************************************
+ * lz4_seekable_input_t.
+ */
+
+namespace {
+
+// See the lz4 frame format description at
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+static constexpr uint32_t kFrameMagic = 0x184D2204;
+static constexpr uint32_t kSkippableMagicMask = 0xFFFFFFF0;
+static constexpr uint32_t kSkippableMagic = 0x184D2A50;
+static constexpr uint32_t kUncompressedBlockBit = 0x80000000;
+static constexpr size_t kChecksumSize = 4;
+
+// Our packing of the frame descriptor into seek_index_restart_t.state.
+static constexpr uint64_t kStateIndependent = 0x1;
+static constexpr uint64_t kStateBlockChecksum = 0x2;
+static constexpr uint64_t kStateContentChecksum = 0x4;
+static constexpr int kStateBlockSizeShift = 8;
+
+uint32_t
+read_le32(const unsigned char *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+        (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+} // namespace
+
+constexpr size_t lz4_seekable_input_t::kWindowSize;
+
+lz4_seekable_input_t::lz4_seekable_input_t(const std::string &path)
+    : file_(path, std::ifstream::binary)
+{
+}
+
+size_t
+lz4_seekable_input_t::read_input(void *buf, size_t size)
+{
+    file_.read(static_cast<char *>(buf), size);
+    if (file_.bad())
+        failed_ = true;
+    in_offset_ += file_.gcount();
+    return static_cast<size_t>(file_.gcount());
+}
+
+bool
+lz4_seekable_input_t::skip_input(uint64_t size)
+{
+    if (!file_.seekg(size, std::ios_base::cur))
+        return false;
+    in_offset_ += size;
+    return true;
+}
+
+bool
+lz4_seekable_input_t::set_frame_state(uint64_t state)
+{
+    int block_size_id = static_cast<int>(state >> kStateBlockSizeShift) & 0x7;
+    if (block_size_id < 4)
+        return false;
+    frame_state_ = state;
+    independent_blocks_ = (state & kStateIndependent) != 0;
+    block_checksum_ = (state & kStateBlockChecksum) != 0;
+    content_checksum_ = (state & kStateContentChecksum) != 0;
+    // The ids 4 through 7 are 64K, 256K, 1M, and 4M.
+    block_max_size_ = static_cast<size_t>(1) << (2 * block_size_id + 8);
+    out_buf_.resize(kWindowSize + block_max_size_);
+    in_buf_.resize(block_max_size_);
+    return true;
+}
+
+bool
+lz4_seekable_input_t::read_frame_descriptor()
+{
+    unsigned char flags[2];
+    if (read_input(flags, sizeof(flags)) != sizeof(flags))
+        return false;
+    // The version must be 01.
+    if ((flags[0] >> 6) != 1)
+        return false;
+    uint64_t state = static_cast<uint64_t>((flags[1] >> 4) & 0x7) << kStateBlockSizeShift;
+    if ((flags[0] & 0x20) != 0)
+        state |= kStateIndependent;
+    if ((flags[0] & 0x10) != 0)
+        state |= kStateBlockChecksum;
+    if ((flags[0] & 0x04) != 0)
+        state |= kStateContentChecksum;
+    // Skip the optional content size and dictionary id, and the header checksum.
+    uint64_t skip = 1;
+    if ((flags[0] & 0x08) != 0)
+        skip += 8;
+    if ((flags[0] & 0x01) != 0)
+        skip += 4;
+    return skip_input(skip) && set_frame_state(state);
+}
+
+int
+lz4_seekable_input_t::next_block()
+{
+    while (true) {
+        if (!in_frame_) {
+            unsigned char magic_bytes[4];
+            size_t len = read_input(magic_bytes, sizeof(magic_bytes));
+            if (len == 0)
+                return failed_ ? -1 : 0;
+            if (len != sizeof(magic_bytes))
+                return -1;
+            uint32_t magic = read_le32(magic_bytes);
+            if ((magic & kSkippableMagicMask) == kSkippableMagic) {
+                unsigned char size_bytes[4];
+                if (read_input(size_bytes, sizeof(size_bytes)) != sizeof(size_bytes) ||
+                    !skip_input(read_le32(size_bytes)))
+                    return -1;
+                continue;
+            }
+            if (magic != kFrameMagic || !read_frame_descriptor())
+                return -1;
+            in_frame_ = true;
+            out_pos_ = 0;
+            out_end_ = 0;
+        }
+        // We are at a block boundary, from which we can restart given the
+        // frame's recent output, all of which is still in out_buf_.
+        if (want_restart(out_offset_)) {
+            seek_index_restart_t restart;
+            restart.in_offset = in_offset_;
+            restart.out_offset = out_offset_;
+            restart.state = frame_state_;
+            if (!independent_blocks_) {
+                size_t window_size = std::min(out_end_, kWindowSize);
+                restart.window.assign(out_buf_.begin() + (out_end_ - window_size),
+                                      out_buf_.begin() + out_end_);
+            }
+            restarts_->push_back(std::move(restart));
+        }
+        unsigned char size_bytes[4];
+        if (read_input(size_bytes, sizeof(size_bytes)) != sizeof(size_bytes))
+            return -1;
+        uint32_t block_size = read_le32(size_bytes);
+        if (block_size == 0) {
+            // The end mark.
+            if (content_checksum_ && !skip_input(kChecksumSize))
+                return -1;
+            in_frame_ = false;
+            continue;
+        }
+        bool compressed = (block_size & kUncompressedBlockBit) == 0;
+        block_size &= ~kUncompressedBlockBit;
+        if (block_size > block_max_size_ ||
+            read_input(in_buf_.data(), block_size) != block_size ||
+            (block_checksum_ && !skip_input(kChecksumSize)))
+            return -1;
+        // Keep the window of prior output in front of the new block, where lz4
+        // can refer to it as a prefix.
+        size_t history = independent_blocks_ ? 0 : std::min(out_end_, kWindowSize);
+        memmove(out_buf_.data(), out_buf_.data() + out_end_ - history, history);
+        int decoded;
+        if (compressed) {
+            decoded = LZ4_decompress_safe_usingDict(
+                in_buf_.data(), out_buf_.data() + history, static_cast<int>(block_size),
+                static_cast<int>(block_max_size_), out_buf_.data(),
+                static_cast<int>(history));
+            if (decoded < 0)
+                return -1;
+        } else {
+            memcpy(out_buf_.data() + history, in_buf_.data(), block_size);
+            decoded = static_cast<int>(block_size);
+        }
+        out_pos_ = history;
+        out_end_ = history + decoded;
+        return 1;
+    }
+}
+
+int64_t
+lz4_seekable_input_t::read(void *buf, size_t size)
+{
+    char *out = static_cast<char *>(buf);
+    size_t left = size;
+    while (left > 0) {
+        if (out_pos_ == out_end_) {
+            int res = next_block();
+            if (res < 0)
+                return -1;
+            if (res == 0)
+                break;
+            continue;
+        }
+        size_t copy = std::min(left, out_end_ - out_pos_);
+        memcpy(out, out_buf_.data() + out_pos_, copy);
+        out_pos_ += copy;
+        out_offset_ += copy;
+        out += copy;
+        left -= copy;
+    }
+    return size - left;
+}
+
+bool
+lz4_seekable_input_t::restart(const seek_index_restart_t &restart)
+{
+    file_.clear();
+    if (!file_.seekg(restart.in_offset) || !set_frame_state(restart.state) ||
+        restart.window.size() > kWindowSize)
+        return false;
+    memcpy(out_buf_.data(), restart.window.data(), restart.window.size());
+    out_pos_ = restart.window.size();
+    out_end_ = restart.window.size();
+    in_frame_ = true;
+    failed_ = false;
+    in_offset_ = restart.in_offset;
+    out_offset_ = restart.out_offset;
+    return true;
+}
+
 /**************************************************
  * lz4_reader_t specializations for file_reader_t.
  */
@@ -72,6 +314,8 @@ template <>
 /* clang-format on */
 file_reader_t<lz4_reader_t>::~file_reader_t<lz4_reader_t>()
 {
+    // Stop reading ahead before deleting the file out from under it.
+    input_file_.read_ahead.reset();
     if (input_file_.file != nullptr) {
         delete input_file_.file;
         input_file_.file = nullptr;
@@ -84,7 +328,57 @@ file_reader_t<lz4_reader_t>::open_single_file(const std::string &path)
 {
     auto file = new lz4_istream_t(path);
     VPRINT(this, 1, "Opened input file %s\n", path.c_str());
-    input_file_ = lz4_reader_t(file);
+    // As in the gzip reader, avoid assigning a temporary with its 64K buffer.
+    input_file_.file = file;
+    input_file_.cur_buf = input_file_.buf;
+    input_file_.max_buf = input_file_.buf;
+    if (read_ahead_pool_) {
+        input_file_.read_ahead.reset(new read_ahead_t(
+            read_ahead_pool_, read_ahead_options_,
+            [file](void *buf, size_t size, uint64_t *position) -> int64_t {
+                return file->read(static_cast<char *>(buf), size).gcount();
+            },
+            sizeof(trace_entry_t)));
+    }
+    return true;
+}
+
+template <>
+bool
+file_reader_t<lz4_reader_t>::accepts_seek_codec(seek_index_codec_t codec)
+{
+    return codec == SEEK_INDEX_CODEC_LZ4;
+}
+
+template <>
+bool
+file_reader_t<lz4_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                             const seek_index_restart_t &restart,
+                                             uint64_t out_offset)
+{
+    // Stop reading ahead before repositioning.
+    input_file_.read_ahead.reset();
+    if (!input_file_.seek_input) {
+        auto input = std::unique_ptr<lz4_seekable_input_t>(
+            new lz4_seekable_input_t(input_path_));
+        if (!*input)
+            return false;
+        input_file_.seek_input = std::move(input);
+    }
+    if (!input_file_.seek_input->restart(restart) ||
+        !input_file_.seek_input->discard(out_offset - restart.out_offset))
+        return false;
+    input_file_.cur_buf = input_file_.buf;
+    input_file_.max_buf = input_file_.buf;
+    if (read_ahead_pool_) {
+        seekable_input_t *input = input_file_.seek_input.get();
+        input_file_.read_ahead.reset(new read_ahead_t(
+            read_ahead_pool_, read_ahead_options_,
+            [input](void *buf, size_t size, uint64_t *position) -> int64_t {
+                return input->read(buf, size);
+            },
+            sizeof(trace_entry_t)));
+    }
     return true;
 }
 
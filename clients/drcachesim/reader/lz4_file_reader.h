@@ -35,9 +35,16 @@
 #ifndef _LZ4_FILE_READER_H_
 #define _LZ4_FILE_READER_H_ 1
 
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "common/lz4_istream.h"
 #include "file_reader.h"
+#include "read_ahead.h"
 #include "record_file_reader.h"
+#include "seek_index.h"
 
 namespace dynamorio {
 namespace drmemtrace {
@@ -53,10 +60,81 @@ struct lz4_reader_t {
     trace_entry_t buf[4096];
     trace_entry_t *cur_buf = buf;
     trace_entry_t *max_buf = buf;
+    // When set, the file is read on a background thread and cur_buf and
+    // max_buf point into read_ahead's buffers rather than buf.
+    std::unique_ptr<read_ahead_t> read_ahead;
+    // Once we have used a seek index, we read from this rather than file.
+    std::unique_ptr<seekable_input_t> seek_input;
+};
+
+/**
+ * A #dynamorio::drmemtrace::seekable_input_t for an lz4 frame file, which can
+ * restart at block boundaries given the preceding 64K of output from the same
+ * frame.  The lz4frame library cannot start in the middle of a frame, so this
+ * parses the frames itself and decodes their blocks with the block library.
+ */
+class lz4_seekable_input_t : public seekable_input_t {
+public:
+    explicit lz4_seekable_input_t(const std::string &path);
+    bool
+    operator!()
+    {
+        return !file_;
+    }
+    int64_t
+    read(void *buf, size_t size) override;
+    bool
+    restart(const seek_index_restart_t &restart) override;
+
+private:
+    // Returns 1 when a block was decoded, 0 at the end of the file, or -1 on an
+    // error.
+    int
+    next_block();
+    bool
+    read_frame_descriptor();
+    bool
+    set_frame_state(uint64_t state);
+    // Returns the number of bytes read, which is only short at the end of the file.
+    size_t
+    read_input(void *buf, size_t size);
+    bool
+    skip_input(uint64_t size);
+
+    static constexpr size_t kWindowSize = 64 * 1024;
+    std::ifstream file_;
+    bool failed_ = false;
+    uint64_t in_offset_ = 0;
+    uint64_t out_offset_ = 0;
+    bool in_frame_ = false;
+    // The frame descriptor, packed as stored in seek_index_restart_t.state.
+    uint64_t frame_state_ = 0;
+    bool independent_blocks_ = false;
+    bool block_checksum_ = false;
+    bool content_checksum_ = false;
+    size_t block_max_size_ = 0;
+    // The output of the frame so far that later blocks may refer to, followed by
+    // the last block decoded, which is returned from out_pos_ up to out_end_.
+    std::vector<char> out_buf_;
+    size_t out_pos_ = 0;
+    size_t out_end_ = 0;
+    std::vector<char> in_buf_;
 };
 
 typedef file_reader_t<lz4_reader_t> lz4_file_reader_t;
 
+/* Declare these so the compiler knows not to use the default implementations in the
+ * class declaration.
+ */
+template <>
+bool
+file_reader_t<lz4_reader_t>::accepts_seek_codec(seek_index_codec_t codec);
+template <>
+bool
+file_reader_t<lz4_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                             const seek_index_restart_t &restart,
+                                             uint64_t out_offset);
+
 } // namespace drmemtrace
 } // namespace dynamorio
 
@@ -0,0 +1,211 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "mmap_file_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "reader.h"
+#include "record_file_reader.h"
+#include "seek_index.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+namespace {
+
+bool
+map_file(const std::string &path, mmap_reader_t &reader)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    reader.map_size = static_cast<size_t>(st.st_size);
+    if (reader.map_size > 0) {
+        // The mapping holds its own reference to the file.
+        reader.map = mmap(nullptr, reader.map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                          fd, 0);
+    }
+    close(fd);
+    if (reader.map == MAP_FAILED) {
+        reader.map = nullptr;
+        return false;
+    }
+    if (reader.map != nullptr) {
+        // These are only hints: failure just loses the read-ahead or the larger
+        // pages, which are not available for files on every kernel.
+        madvise(reader.map, reader.map_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        madvise(reader.map, reader.map_size, MADV_HUGEPAGE);
+#endif
+    }
+    reader.start = static_cast<trace_entry_t *>(reader.map);
+    reader.cur = reader.start;
+    reader.end = reader.start + reader.map_size / sizeof(trace_entry_t);
+    return true;
+}
+
+void
+unmap_file(mmap_reader_t &reader)
+{
+    if (reader.map != nullptr) {
+        munmap(reader.map, reader.map_size);
+        reader.map = nullptr;
+    }
+    reader.start = nullptr;
+    reader.cur = nullptr;
+    reader.end = nullptr;
+}
+
+} // namespace
+
+/**************************************************
+ * mmap_reader_t specializations for file_reader_t.
+ */
+
+/* clang-format off */ /* (make vera++ newline-after-type check happy) */
+template <>
+/* clang-format on */
+file_reader_t<mmap_reader_t>::file_reader_t()
+{
+}
+
+/* clang-format off */ /* (make vera++ newline-after-type check happy) */
+template <>
+/* clang-format on */
+file_reader_t<mmap_reader_t>::~file_reader_t<mmap_reader_t>()
+{
+    unmap_file(input_file_);
+}
+
+template <>
+bool
+file_reader_t<mmap_reader_t>::open_single_file(const std::string &path)
+{
+    if (!map_file(path, input_file_))
+        return false;
+    VPRINT(this, 1, "Mapped input file %s\n", path.c_str());
+    return true;
+}
+
+template <>
+bool
+file_reader_t<mmap_reader_t>::accepts_seek_codec(seek_index_codec_t codec)
+{
+    return codec == SEEK_INDEX_CODEC_NONE;
+}
+
+template <>
+bool
+file_reader_t<mmap_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                              const seek_index_restart_t &restart,
+                                              uint64_t out_offset)
+{
+    // With the whole file mapped, seeking is just moving the pointer.
+    uint64_t index = out_offset / sizeof(trace_entry_t);
+    if (out_offset % sizeof(trace_entry_t) != 0 ||
+        index > static_cast<uint64_t>(input_file_.end - input_file_.start))
+        return false;
+    input_file_.cur = input_file_.start + index;
+    return true;
+}
+
+template <>
+trace_entry_t *
+file_reader_t<mmap_reader_t>::read_next_entry()
+{
+    trace_entry_t *from_queue = read_queued_entry();
+    if (from_queue != nullptr)
+        return from_queue;
+    if (input_file_.cur >= input_file_.end) {
+        at_eof_ = true;
+        return nullptr;
+    }
+    trace_entry_t *entry = input_file_.cur++;
+    VPRINT(this, 4, "Read from file: type=%s (%d), size=%d, addr=%zu\n",
+           trace_type_names[entry->type], entry->type, entry->size, entry->addr);
+    return entry;
+}
+
+/**************************************************
+ * mmap_reader_t specializations for record_file_reader_t.
+ */
+
+/* clang-format off */ /* (make vera++ newline-after-type check happy) */
+template <>
+/* clang-format on */
+record_file_reader_t<mmap_reader_t>::~record_file_reader_t<mmap_reader_t>()
+{
+    if (input_file_ != nullptr)
+        unmap_file(*input_file_);
+}
+
+template <>
+bool
+record_file_reader_t<mmap_reader_t>::open_single_file(const std::string &path)
+{
+    std::unique_ptr<mmap_reader_t> reader(new mmap_reader_t());
+    if (!map_file(path, *reader))
+        return false;
+    VPRINT(this, 1, "Mapped input file %s\n", path.c_str());
+    input_file_ = std::move(reader);
+    return true;
+}
+
+template <>
+bool
+record_file_reader_t<mmap_reader_t>::read_next_entry()
+{
+    if (input_file_->cur >= input_file_->end) {
+        eof_ = true;
+        return false;
+    }
+    in_place_entry_ = input_file_->cur++;
+    VPRINT(this, 4, "Read from file: type=%s (%d), size=%d, addr=%zu\n",
+           trace_type_names[in_place_entry_->type], in_place_entry_->type,
+           in_place_entry_->size, in_place_entry_->addr);
+    return true;
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
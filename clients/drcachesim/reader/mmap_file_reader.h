@@ -0,0 +1,86 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* mmap_file_reader: reads uncompressed trace files by mapping them into memory
+ * and handing out records in place.
+ */
+
+#ifndef _MMAP_FILE_READER_H_
+#define _MMAP_FILE_READER_H_ 1
+
+#include <stddef.h>
+
+#include <string>
+
+#include "file_reader.h"
+#include "record_file_reader.h"
+#include "seek_index.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/**
+ * An uncompressed trace file mapped into memory.  Unlike reading through a
+ * stream, records are not copied: the readers return pointers into the mapping.
+ * The mapping is private and writable as reader_t rewrites a few legacy record
+ * types in place, which touches only the affected pages.
+ */
+struct mmap_reader_t {
+    void *map = nullptr;
+    size_t map_size = 0;
+    trace_entry_t *start = nullptr;
+    trace_entry_t *cur = nullptr;
+    // Any partial record at the end of the file is excluded.
+    trace_entry_t *end = nullptr;
+};
+
+typedef file_reader_t<mmap_reader_t> mmap_file_reader_t;
+typedef dynamorio::drmemtrace::record_file_reader_t<mmap_reader_t>
+    mmap_record_file_reader_t;
+
+/* Declare these so the compiler knows not to use the default implementations in the
+ * class declaration.
+ */
+template <>
+bool
+file_reader_t<mmap_reader_t>::accepts_seek_codec(seek_index_codec_t codec);
+template <>
+bool
+file_reader_t<mmap_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                              const seek_index_restart_t &restart,
+                                              uint64_t out_offset);
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _MMAP_FILE_READER_H_ */
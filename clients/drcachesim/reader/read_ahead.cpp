@@ -0,0 +1,280 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "read_ahead.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "utils.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/**************************************************************************
+ * read_ahead_pool_t
+ */
+
+read_ahead_pool_t::read_ahead_pool_t(int num_threads)
+{
+    threads_.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i)
+        threads_.emplace_back(&read_ahead_pool_t::process_fills, this);
+}
+
+read_ahead_pool_t::~read_ahead_pool_t()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        exiting_ = true;
+    }
+    cond_.notify_all();
+    for (std::thread &thread : threads_)
+        thread.join();
+    // Every stream holds a reference to us, so none can still be queued.
+    assert(queue_.empty());
+}
+
+void
+read_ahead_pool_t::schedule(read_ahead_t *stream)
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        queue_.push_back(stream);
+    }
+    cond_.notify_one();
+}
+
+bool
+read_ahead_pool_t::unschedule(read_ahead_t *stream)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = std::find(queue_.begin(), queue_.end(), stream);
+    if (it == queue_.end())
+        return false;
+    queue_.erase(it);
+    return true;
+}
+
+void
+read_ahead_pool_t::process_fills()
+{
+    while (true) {
+        read_ahead_t *stream;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return exiting_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            stream = queue_.front();
+            queue_.pop_front();
+        }
+        // A stream only has one fill queued at a time, and re-queues itself at
+        // the back when done, so busy streams cannot starve the others.
+        stream->fill_next_buffer();
+    }
+}
+
+/**************************************************************************
+ * read_ahead_t
+ */
+
+read_ahead_t::read_ahead_t(std::shared_ptr<read_ahead_pool_t> pool,
+                           const read_ahead_options_t &options, fill_func_t fill,
+                           size_t record_size)
+    : pool_(std::move(pool))
+    , options_(options)
+    , fill_(std::move(fill))
+{
+    if (options_.depth < 2) {
+        // With a single buffer we could never fill while the consumer reads.
+        options_.depth = 2;
+    }
+    options_.buffer_size =
+        std::max(options_.buffer_size / record_size, static_cast<size_t>(1)) *
+        record_size;
+    ring_.resize(options_.depth);
+    std::lock_guard<std::mutex> guard(mutex_);
+    maybe_schedule_locked();
+}
+
+read_ahead_t::~read_ahead_t()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    exiting_ = true;
+    wait_for_fill_locked(lock);
+}
+
+int
+read_ahead_t::free_buffers_locked() const
+{
+    return options_.depth - filled_ - (held_ ? 1 : 0);
+}
+
+void
+read_ahead_t::maybe_schedule_locked()
+{
+    if (scheduled_ || paused_ || exiting_ || at_end_ || free_buffers_locked() == 0)
+        return;
+    scheduled_ = true;
+    pool_->schedule(this);
+}
+
+void
+read_ahead_t::wait_for_fill_locked(std::unique_lock<std::mutex> &lock)
+{
+    if (scheduled_ && pool_->unschedule(this))
+        scheduled_ = false;
+    // Otherwise a pool thread has already picked us up.
+    cond_.wait(lock, [this] { return !scheduled_; });
+}
+
+void
+read_ahead_t::fill_next_buffer()
+{
+    buffer_t *buffer;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (exiting_ || paused_) {
+            scheduled_ = false;
+            cond_.notify_all();
+            return;
+        }
+        buffer = &ring_[(read_index_ + filled_) % options_.depth];
+    }
+    // Only we touch this buffer and the underlying file until we mark the fill
+    // as done below.
+    if (!buffer->data)
+        buffer->data.reset(new char[options_.buffer_size]);
+    uint64_t position = 0;
+    int64_t res = fill_(buffer->data.get(), options_.buffer_size, &position);
+    std::lock_guard<std::mutex> guard(mutex_);
+    scheduled_ = false;
+    if (res <= 0) {
+        at_end_ = true;
+        failed_ = res < 0;
+    } else {
+        buffer->size = static_cast<size_t>(res);
+        buffer->position = position;
+        ++filled_;
+        pool_->buffers_filled_.fetch_add(1, std::memory_order_relaxed);
+        if (free_buffers_locked() == 0)
+            full_since_ = get_microsecond_timestamp();
+    }
+    maybe_schedule_locked();
+    // The consumer may destroy us as soon as we release the lock.
+    cond_.notify_all();
+}
+
+char *
+read_ahead_t::next_buffer(size_t *size, uint64_t *position)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (held_) {
+        held_ = false;
+        if (full_since_ != 0) {
+            uint64_t stall = get_microsecond_timestamp() - full_since_;
+            producer_stall_us_ += stall;
+            pool_->producer_stall_us_.fetch_add(stall, std::memory_order_relaxed);
+            full_since_ = 0;
+        }
+    }
+    paused_ = false;
+    maybe_schedule_locked();
+    if (filled_ == 0 && !at_end_) {
+        uint64_t start = get_microsecond_timestamp();
+        cond_.wait(lock, [this] { return filled_ > 0 || at_end_; });
+        uint64_t stall = get_microsecond_timestamp() - start;
+        consumer_stall_us_ += stall;
+        pool_->consumer_stall_us_.fetch_add(stall, std::memory_order_relaxed);
+    }
+    if (filled_ == 0) {
+        // We are done with the memory.
+        for (buffer_t &buffer : ring_)
+            buffer.data.reset();
+        *size = 0;
+        return nullptr;
+    }
+    buffer_t &buffer = ring_[read_index_];
+    read_index_ = (read_index_ + 1) % options_.depth;
+    --filled_;
+    held_ = true;
+    *size = buffer.size;
+    if (position != nullptr)
+        *position = buffer.position;
+    return buffer.data.get();
+}
+
+bool
+read_ahead_t::failed()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return failed_;
+}
+
+void
+read_ahead_t::reset()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    paused_ = true;
+    wait_for_fill_locked(lock);
+    read_index_ = 0;
+    filled_ = 0;
+    held_ = false;
+    at_end_ = false;
+    failed_ = false;
+    full_since_ = 0;
+}
+
+uint64_t
+read_ahead_t::get_consumer_stall_us()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return consumer_stall_us_;
+}
+
+uint64_t
+read_ahead_t::get_producer_stall_us()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return producer_stall_us_;
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
@@ -0,0 +1,231 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* read_ahead: reads and decompresses trace files ahead of their consumer on
+ * background threads.
+ */
+
+#ifndef _READ_AHEAD_H_
+#define _READ_AHEAD_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/**
+ * Sizing of the ring of buffers each #dynamorio::drmemtrace::read_ahead_t fills
+ * ahead of its consumer.  Each stream holds up to depth * buffer_size bytes.
+ */
+struct read_ahead_options_t {
+    /** The number of buffers in each stream's ring. */
+    int depth = 4;
+    /** The size in bytes of each buffer. */
+    size_t buffer_size = 1024 * 1024;
+};
+
+class read_ahead_t;
+
+/**
+ * A pool of threads which fill the buffers of any number of
+ * #dynamorio::drmemtrace::read_ahead_t streams.  A stream has at most one fill
+ * in progress at a time, as the underlying decompressors are sequential, and
+ * streams with room in their rings are served in round-robin order.
+ */
+class read_ahead_pool_t {
+public:
+    explicit read_ahead_pool_t(int num_threads);
+    ~read_ahead_pool_t();
+
+    /**
+     * Returns the total time in microseconds that consumers of all streams
+     * spent waiting for a buffer to be filled.  A large value indicates that
+     * more threads (or, for bursty consumers, a deeper ring) would help.
+     */
+    uint64_t
+    get_consumer_stall_us() const
+    {
+        return consumer_stall_us_.load(std::memory_order_relaxed);
+    }
+    /**
+     * Returns the total time in microseconds that streams spent with a full
+     * ring while not at the end of their data.  A large value indicates that
+     * the consumers are the bottleneck and the rings could be smaller.
+     */
+    uint64_t
+    get_producer_stall_us() const
+    {
+        return producer_stall_us_.load(std::memory_order_relaxed);
+    }
+    /** Returns the number of buffers filled across all streams. */
+    uint64_t
+    get_buffers_filled() const
+    {
+        return buffers_filled_.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class read_ahead_t;
+
+    void
+    schedule(read_ahead_t *stream);
+    // Returns whether the stream was removed from the queue before any thread
+    // picked it up.
+    bool
+    unschedule(read_ahead_t *stream);
+    void
+    process_fills();
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<read_ahead_t *> queue_;
+    bool exiting_ = false;
+    std::vector<std::thread> threads_;
+    std::atomic<uint64_t> consumer_stall_us_ { 0 };
+    std::atomic<uint64_t> producer_stall_us_ { 0 };
+    std::atomic<uint64_t> buffers_filled_ { 0 };
+};
+
+/**
+ * Keeps a ring of buffers filled ahead of a single consumer by calling a fill
+ * function on a #dynamorio::drmemtrace::read_ahead_pool_t thread.  The fill
+ * function owns the underlying file: the consumer may only touch the file
+ * after calling reset().
+ */
+class read_ahead_t {
+public:
+    /**
+     * Reads up to "size" bytes into "buf", returning the number of bytes read, 0
+     * at the end of the data, or -1 on an error.  May set "position" to a value
+     * identifying where in the file the data came from, which is returned
+     * alongside the buffer by next_buffer().
+     */
+    typedef std::function<int64_t(void *buf, size_t size, uint64_t *position)>
+        fill_func_t;
+
+    /**
+     * Starts reading ahead immediately.  The buffer size is rounded down to a
+     * multiple of "record_size" so that records never straddle two buffers, as
+     * long as the fill function only returns partial buffers at the end of the
+     * data or at a boundary it knows to be aligned.
+     */
+    read_ahead_t(std::shared_ptr<read_ahead_pool_t> pool,
+                 const read_ahead_options_t &options, fill_func_t fill,
+                 size_t record_size = 1);
+    /** Waits for any fill in progress to finish. */
+    ~read_ahead_t();
+
+    /**
+     * Releases the buffer returned by the prior call, which the caller must no
+     * longer access, and returns the next filled buffer, waiting for it if
+     * necessary.  Returns nullptr once all the data has been returned or on an
+     * error; failed() distinguishes the two.
+     */
+    char *
+    next_buffer(size_t *size, uint64_t *position = nullptr);
+
+    /** Returns whether the fill function reported an error. */
+    bool
+    failed();
+
+    /**
+     * Discards all buffered data and stops reading ahead until the next call to
+     * next_buffer().  This waits for any fill in progress, after which the caller
+     * may reposition the underlying file.
+     */
+    void
+    reset();
+
+    /** Returns the time this stream's consumer spent waiting for data. */
+    uint64_t
+    get_consumer_stall_us();
+    /** Returns the time this stream's ring spent full while not at the end. */
+    uint64_t
+    get_producer_stall_us();
+
+private:
+    friend class read_ahead_pool_t;
+
+    struct buffer_t {
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+        uint64_t position = 0;
+    };
+
+    // Called on a pool thread.
+    void
+    fill_next_buffer();
+    int
+    free_buffers_locked() const;
+    void
+    maybe_schedule_locked();
+    void
+    wait_for_fill_locked(std::unique_lock<std::mutex> &lock);
+
+    std::shared_ptr<read_ahead_pool_t> pool_;
+    read_ahead_options_t options_;
+    fill_func_t fill_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<buffer_t> ring_;
+    // The index of the oldest filled buffer not yet handed to the consumer.
+    int read_index_ = 0;
+    // The number of filled buffers not yet handed to the consumer.
+    int filled_ = 0;
+    // Whether the consumer holds the buffer just before read_index_.
+    bool held_ = false;
+    // Whether a fill is queued in the pool or in progress.
+    bool scheduled_ = false;
+    bool paused_ = false;
+    bool exiting_ = false;
+    bool at_end_ = false;
+    bool failed_ = false;
+    // When the ring last became full, or 0 if it is not full.
+    uint64_t full_since_ = 0;
+    uint64_t consumer_stall_us_ = 0;
+    uint64_t producer_stall_us_ = 0;
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _READ_AHEAD_H_ */
@@ -495,6 +495,8 @@ reader_t::skip_instructions_with_timestamp(uint64_t stop_instruction_count)
         // expose these hidden entries.  It is simpler for us to read the
         // trace_entry_t directly prior to processing by the base class.
         if (next->type == TRACE_TYPE_MARKER) {
+            const bool in_chunk_header =
+                skip_chunk_header_.find(cur_tid_) != skip_chunk_header_.end();
             if (next->size == TRACE_MARKER_TYPE_RECORD_ORDINAL) {
                 cur_ref_count_ = next->addr;
                 prev_was_record_ord = true;
@@ -502,13 +504,15 @@ reader_t::skip_instructions_with_timestamp(uint64_t stop_instruction_count)
                        cur_ref_count_);
             } else if (next->size == TRACE_MARKER_TYPE_TIMESTAMP) {
                 timestamp = *next;
-                if (prev_was_record_ord)
+                // On a linear walk past a chunk footer, process_input_entry() already
+                // leaves these uncounted.
+                if (prev_was_record_ord && !in_chunk_header)
                     --cur_ref_count_; // Invisible to ordinals.
-                else
+                else if (!prev_was_record_ord)
                     found_real_timestamp = true;
             } else if (next->size == TRACE_MARKER_TYPE_CPU_ID) {
                 cpu = *next;
-                if (prev_was_record_ord)
+                if (prev_was_record_ord && !in_chunk_header)
                     --cur_ref_count_; // Invisible to ordinals.
             } else
                 prev_was_record_ord = false;
@@ -40,8 +40,10 @@
 #include <assert.h>
 #include <iterator>
 #include <memory>
+#include <utility>
 
 #include "memtrace_stream.h"
+#include "read_ahead.h"
 #include "reader.h"
 #include "trace_entry.h"
 
@@ -138,11 +140,11 @@ public:
     const trace_entry_t &
     operator*()
     {
-        return cur_entry_;
+        return in_place_entry_ != nullptr ? *in_place_entry_ : cur_entry_;
     }
 
     static bool
-    record_is_pre_instr(trace_entry_t *record)
+    record_is_pre_instr(const trace_entry_t *record)
     {
         return record->type == TRACE_TYPE_ENCODING ||
             // The branch target marker sits between any encodings and the instr.
@@ -157,28 +159,29 @@ public:
         assert(res || eof_);
         UNUSED(res);
         if (!eof_) {
+            const trace_entry_t &cur_entry = **this;
             ++cur_ref_count_;
             // We increment the instr count at the encoding as that avoids multiple
             // problems with separating encodings from instrs when skipping (including
             // for scheduler regions of interest) and when replaying schedules: anything
             // using instr ordinals as boundaries.
             if (!prev_record_was_pre_instr_ &&
-                (record_is_pre_instr(&cur_entry_) ||
-                 type_is_instr(static_cast<trace_type_t>(cur_entry_.type))))
+                (record_is_pre_instr(&cur_entry) ||
+                 type_is_instr(static_cast<trace_type_t>(cur_entry.type))))
                 ++cur_instr_count_;
-            else if (cur_entry_.type == TRACE_TYPE_MARKER) {
-                switch (cur_entry_.size) {
-                case TRACE_MARKER_TYPE_VERSION: version_ = cur_entry_.addr; break;
-                case TRACE_MARKER_TYPE_FILETYPE: filetype_ = cur_entry_.addr; break;
+            else if (cur_entry.type == TRACE_TYPE_MARKER) {
+                switch (cur_entry.size) {
+                case TRACE_MARKER_TYPE_VERSION: version_ = cur_entry.addr; break;
+                case TRACE_MARKER_TYPE_FILETYPE: filetype_ = cur_entry.addr; break;
                 case TRACE_MARKER_TYPE_CACHE_LINE_SIZE:
-                    cache_line_size_ = cur_entry_.addr;
+                    cache_line_size_ = cur_entry.addr;
                     break;
-                case TRACE_MARKER_TYPE_PAGE_SIZE: page_size_ = cur_entry_.addr; break;
+                case TRACE_MARKER_TYPE_PAGE_SIZE: page_size_ = cur_entry.addr; break;
                 case TRACE_MARKER_TYPE_CHUNK_INSTR_COUNT:
-                    chunk_instr_count_ = cur_entry_.addr;
+                    chunk_instr_count_ = cur_entry.addr;
                     break;
                 case TRACE_MARKER_TYPE_TIMESTAMP:
-                    last_timestamp_ = cur_entry_.addr;
+                    last_timestamp_ = cur_entry.addr;
                     if (first_timestamp_ == 0)
                         first_timestamp_ = last_timestamp_;
                     break;
@@ -192,7 +195,7 @@ public:
                     break;
                 }
             }
-            prev_record_was_pre_instr_ = record_is_pre_instr(&cur_entry_);
+            prev_record_was_pre_instr_ = record_is_pre_instr(&cur_entry);
         }
         return *this;
     }
@@ -278,6 +281,9 @@ protected:
     open_input_file() = 0;
 
     trace_entry_t cur_entry_ = {};
+    // Set instead of cur_entry_ by readers which return records in place, such as
+    // from a file mapping, rather than copying them.
+    const trace_entry_t *in_place_entry_ = nullptr;
     int verbosity_;
     const char *output_prefix_;
     // Following typical stream iterator convention, the default constructor
@@ -327,6 +333,19 @@ public:
     }
     virtual ~record_file_reader_t();
 
+    /**
+     * Requests that the file be read and decompressed ahead of use on the
+     * threads of "pool", for the file types which support it (others ignore
+     * this).  Must be called prior to init().
+     */
+    void
+    set_read_ahead(std::shared_ptr<read_ahead_pool_t> pool,
+                   const read_ahead_options_t &options)
+    {
+        read_ahead_pool_ = std::move(pool);
+        read_ahead_options_ = options;
+    }
+
 private:
     bool
     open_input_file() override
@@ -342,6 +361,9 @@ private:
 
     std::unique_ptr<T> input_file_ = nullptr;
     std::string input_path_;
+    // Set when reading ahead.
+    std::shared_ptr<read_ahead_pool_t> read_ahead_pool_;
+    read_ahead_options_t read_ahead_options_;
 
     bool
     open_single_file(const std::string &path) override;
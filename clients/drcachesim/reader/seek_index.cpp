@@ -0,0 +1,401 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "seek_index.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "reader.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+namespace {
+
+// The index file holds this header, the windows of the restart points as they
+// were found, and then the restart, point, and encoding tables.  All values are
+// in the native layout, as are the trace records themselves.
+struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t codec;
+    uint64_t trace_size;
+    uint64_t first_timestamp;
+    uint64_t restart_count;
+    uint64_t restarts_offset;
+    uint64_t point_count;
+    uint64_t points_offset;
+    uint64_t encoding_count;
+    uint64_t encodings_offset;
+};
+
+static const char kMagic[8] = { 'D', 'R', 'S', 'E', 'E', 'K', 'I', 'X' };
+static constexpr uint32_t kVersion = 1;
+
+// Must match seek_index_t::restart_record_t.
+struct restart_record_t {
+    uint64_t in_offset;
+    uint64_t out_offset;
+    uint64_t state;
+    uint64_t window_offset;
+    uint64_t window_size;
+};
+
+uint64_t
+get_file_size(const std::string &path)
+{
+    std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+    if (!file)
+        return 0;
+    return static_cast<uint64_t>(file.tellg());
+}
+
+} // namespace
+
+/**************************************************************************
+ * seekable_input_t.
+ */
+
+bool
+seekable_input_t::discard(uint64_t size)
+{
+    char buf[64 * 1024];
+    while (size > 0) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(size, sizeof(buf)));
+        if (read(buf, chunk) != static_cast<int64_t>(chunk))
+            return false;
+        size -= chunk;
+    }
+    return true;
+}
+
+raw_seekable_input_t::raw_seekable_input_t(const std::string &path)
+    : file_(path, std::ifstream::binary)
+{
+}
+
+int64_t
+raw_seekable_input_t::read(void *buf, size_t size)
+{
+    // Any offset can be restarted from, so there is no need to align these.
+    if (want_restart(offset_)) {
+        seek_index_restart_t restart;
+        restart.in_offset = offset_;
+        restart.out_offset = offset_;
+        restarts_->push_back(std::move(restart));
+    }
+    file_.read(static_cast<char *>(buf), size);
+    if (file_.bad())
+        return -1;
+    offset_ += file_.gcount();
+    return file_.gcount();
+}
+
+bool
+raw_seekable_input_t::restart(const seek_index_restart_t &restart)
+{
+    file_.clear();
+    if (!file_.seekg(restart.in_offset))
+        return false;
+    offset_ = restart.in_offset;
+    return true;
+}
+
+/**************************************************************************
+ * seek_index_t.
+ */
+
+bool
+seek_index_t::open(const std::string &trace_path)
+{
+    file_.open(trace_path + DRMEMTRACE_SEEK_INDEX_SUFFIX, std::ifstream::binary);
+    if (!file_)
+        return false;
+    header_t header;
+    if (!file_.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.codec > SEEK_INDEX_CODEC_SNAPPY)
+        return false;
+    // A trace rewritten after indexing is most likely a different size.
+    if (header.trace_size != get_file_size(trace_path))
+        return false;
+    codec_ = static_cast<seek_index_codec_t>(header.codec);
+    first_timestamp_ = header.first_timestamp;
+    encoding_count_ = header.encoding_count;
+    encodings_offset_ = header.encodings_offset;
+    restarts_.resize(header.restart_count);
+    points_.resize(header.point_count);
+    if (!file_.seekg(header.restarts_offset) ||
+        !file_.read(reinterpret_cast<char *>(restarts_.data()),
+                    restarts_.size() * sizeof(restarts_[0])) ||
+        !file_.seekg(header.points_offset) ||
+        !file_.read(reinterpret_cast<char *>(points_.data()),
+                    points_.size() * sizeof(points_[0])))
+        return false;
+    return true;
+}
+
+bool
+seek_index_t::find(uint64_t stop_instruction_count, uint64_t cur_instruction_count,
+                   seek_index_point_t *point, seek_index_restart_t *restart)
+{
+    auto point_it =
+        std::upper_bound(points_.begin(), points_.end(), stop_instruction_count,
+                         [](uint64_t instr_ordinal, const seek_index_point_t &point) {
+                             return instr_ordinal < point.instr_ordinal;
+                         });
+    if (point_it == points_.begin())
+        return false;
+    --point_it;
+    if (point_it->instr_ordinal <= cur_instruction_count)
+        return false;
+    auto restart_it =
+        std::upper_bound(restarts_.begin(), restarts_.end(), point_it->out_offset,
+                         [](uint64_t out_offset, const restart_record_t &restart) {
+                             return out_offset < restart.out_offset;
+                         });
+    if (restart_it == restarts_.begin())
+        return false;
+    --restart_it;
+    *point = *point_it;
+    restart->in_offset = restart_it->in_offset;
+    restart->out_offset = restart_it->out_offset;
+    restart->state = restart_it->state;
+    restart->window.resize(restart_it->window_size);
+    file_.clear();
+    if (!file_.seekg(restart_it->window_offset) ||
+        !file_.read(restart->window.data(), restart->window.size()))
+        return false;
+    return true;
+}
+
+bool
+seek_index_t::read_encodings(uint64_t count,
+                             std::vector<seek_index_encoding_t> *encodings)
+{
+    if (count > encoding_count_)
+        return false;
+    encodings->resize(count);
+    file_.clear();
+    if (!file_.seekg(encodings_offset_) ||
+        !file_.read(reinterpret_cast<char *>(encodings->data()),
+                    count * sizeof(seek_index_encoding_t)))
+        return false;
+    return true;
+}
+
+/**************************************************************************
+ * seek_index_builder_t.
+ */
+
+seek_index_builder_t::seek_index_builder_t(std::unique_ptr<seekable_input_t> input,
+                                           seek_index_codec_t codec, uint64_t interval,
+                                           uint64_t span, int verbosity)
+    : reader_t(verbosity, "[seek_index]")
+    , input_(std::move(input))
+    , codec_(codec)
+    , interval_(interval)
+    , next_point_instr_(interval)
+{
+    online_ = false;
+    // The table is written out whole, so we clear the padding too.
+    memset(&pending_encoding_, 0, sizeof(pending_encoding_));
+    input_->record_restarts(span, &restarts_);
+}
+
+trace_entry_t *
+seek_index_builder_t::read_next_entry()
+{
+    if (cur_buf_ >= max_buf_) {
+        buf_offset_ += (max_buf_ - buf_) * sizeof(trace_entry_t);
+        int64_t len = input_->read(buf_, sizeof(buf_));
+        if (len < 0)
+            failed_ = true;
+        // A trailing partial record is dropped, as the readers do.
+        if (len < static_cast<int64_t>(sizeof(trace_entry_t))) {
+            at_eof_ = true;
+            return nullptr;
+        }
+        cur_buf_ = buf_;
+        max_buf_ = buf_ + len / sizeof(trace_entry_t);
+        if (!write_windows()) {
+            failed_ = true;
+            at_eof_ = true;
+            return nullptr;
+        }
+    }
+    trace_entry_t *entry = cur_buf_;
+    ++cur_buf_;
+    observe_entry(*entry, buf_offset_ + (entry - buf_) * sizeof(trace_entry_t));
+    return entry;
+}
+
+void
+seek_index_builder_t::observe_entry(const trace_entry_t &entry, uint64_t offset)
+{
+    trace_type_t type = static_cast<trace_type_t>(entry.type);
+    if (type == TRACE_TYPE_THREAD) {
+        ++thread_count_;
+    } else if (type == TRACE_TYPE_ENCODING) {
+        if (pending_encoding_.size + entry.size <= MAX_ENCODING_LENGTH) {
+            memcpy(pending_encoding_.bits + pending_encoding_.size, entry.encoding,
+                   entry.size);
+            pending_encoding_.size += entry.size;
+        }
+    } else if (is_any_instr_type(type) && entry.size > 0 && pending_encoding_.size > 0) {
+        // The reader keeps the latest encoding for each pc, which we mirror in
+        // an append-only table so that each point needs just a count.
+        pending_encoding_.pc = entry.addr;
+        auto it = latest_encoding_.find(pending_encoding_.pc);
+        if (it == latest_encoding_.end() ||
+            encodings_table_[it->second].size != pending_encoding_.size ||
+            memcmp(encodings_table_[it->second].bits, pending_encoding_.bits,
+                   pending_encoding_.size) != 0) {
+            latest_encoding_[pending_encoding_.pc] = encodings_table_.size();
+            encodings_table_.push_back(pending_encoding_);
+        }
+        memset(&pending_encoding_, 0, sizeof(pending_encoding_));
+    } else if (type == TRACE_TYPE_MARKER && entry.size == TRACE_MARKER_TYPE_TIMESTAMP) {
+        // We only resume where the reader carries no state beyond what we record:
+        // not between an instruction and its encoding, not in a kernel trace, not
+        // where a later thread's records have started, and not at a timestamp
+        // which a skip would treat as a duplicate from a prior chunk.
+        if (cur_instr_count_ >= next_point_instr_ && !prev_was_record_ordinal_ &&
+            !in_chunk_header_ && thread_count_ <= 1 && !core_sharded_ &&
+            !is_record_kernel() && pending_encoding_.size == 0 && !restarts_.empty() &&
+            restarts_.front().out_offset <= offset) {
+            seek_index_point_t point;
+            point.out_offset = offset;
+            point.instr_ordinal = cur_instr_count_;
+            point.record_ordinal = cur_ref_count_;
+            point.encoding_count = encodings_table_.size();
+            points_.push_back(point);
+            next_point_instr_ = cur_instr_count_ + interval_;
+            VPRINT(this, 2,
+                   "Point at instr %" PRIu64 " record %" PRIu64 " @%" PRIu64 "\n",
+                   point.instr_ordinal, point.record_ordinal, point.out_offset);
+        }
+    }
+    if (type == TRACE_TYPE_MARKER) {
+        if (entry.size == TRACE_MARKER_TYPE_CHUNK_FOOTER)
+            in_chunk_header_ = true;
+        else if (entry.size == TRACE_MARKER_TYPE_CPU_ID)
+            in_chunk_header_ = false;
+    }
+    prev_was_record_ordinal_ =
+        type == TRACE_TYPE_MARKER && entry.size == TRACE_MARKER_TYPE_RECORD_ORDINAL;
+}
+
+bool
+seek_index_builder_t::write_windows()
+{
+    for (size_t i = window_offsets_.size(); i < restarts_.size(); ++i) {
+        window_offsets_.push_back(static_cast<uint64_t>(out_.tellp()));
+        window_sizes_.push_back(restarts_[i].window.size());
+        if (!out_.write(restarts_[i].window.data(), restarts_[i].window.size()))
+            return false;
+        // Free the memory as there can be many of these.
+        std::vector<char>().swap(restarts_[i].window);
+    }
+    return true;
+}
+
+std::string
+seek_index_builder_t::build(const std::string &trace_path)
+{
+    const std::string index_path = trace_path + DRMEMTRACE_SEEK_INDEX_SUFFIX;
+    out_.open(index_path, std::ofstream::binary | std::ofstream::trunc);
+    if (!out_)
+        return "Failed to open " + index_path;
+    header_t header = {};
+    if (!out_.write(reinterpret_cast<char *>(&header), sizeof(header)))
+        return "Failed to write " + index_path;
+    for (init(); !at_eof_;)
+        ++*this;
+    if (failed_ || !write_windows()) {
+        out_.close();
+        std::remove(index_path.c_str());
+        return "Failed to read " + trace_path;
+    }
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.codec = codec_;
+    header.trace_size = get_file_size(trace_path);
+    header.first_timestamp = get_first_timestamp();
+    std::vector<restart_record_t> restart_records(restarts_.size());
+    for (size_t i = 0; i < restarts_.size(); ++i) {
+        restart_records[i].in_offset = restarts_[i].in_offset;
+        restart_records[i].out_offset = restarts_[i].out_offset;
+        restart_records[i].state = restarts_[i].state;
+        restart_records[i].window_offset = window_offsets_[i];
+        restart_records[i].window_size = window_sizes_[i];
+    }
+    header.restart_count = restart_records.size();
+    header.restarts_offset = static_cast<uint64_t>(out_.tellp());
+    out_.write(reinterpret_cast<char *>(restart_records.data()),
+               restart_records.size() * sizeof(restart_records[0]));
+    header.point_count = points_.size();
+    header.points_offset = static_cast<uint64_t>(out_.tellp());
+    out_.write(reinterpret_cast<char *>(points_.data()),
+               points_.size() * sizeof(points_[0]));
+    header.encoding_count = encodings_table_.size();
+    header.encodings_offset = static_cast<uint64_t>(out_.tellp());
+    out_.write(reinterpret_cast<char *>(encodings_table_.data()),
+               encodings_table_.size() * sizeof(encodings_table_[0]));
+    // The header goes in last so a partially written index is never used.
+    out_.seekp(0);
+    out_.write(reinterpret_cast<char *>(&header), sizeof(header));
+    out_.close();
+    if (!out_) {
+        std::remove(index_path.c_str());
+        return "Failed to write " + index_path;
+    }
+    VPRINT(this, 1,
+           "Indexed %s with %zu points and %zu restarts over %" PRIu64 " instrs\n",
+           trace_path.c_str(), points_.size(), restarts_.size(), cur_instr_count_);
+    return "";
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
@@ -0,0 +1,292 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* seek_index: a side-car index for a single-file trace which lets a reader
+ * resume decompression close to a target instruction rather than decompressing
+ * everything before it.
+ */
+
+#ifndef _SEEK_INDEX_H_
+#define _SEEK_INDEX_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "reader.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/** The compression formats described by a seek index. */
+enum seek_index_codec_t {
+    SEEK_INDEX_CODEC_NONE,   /**< An uncompressed file. */
+    SEEK_INDEX_CODEC_GZIP,   /**< A gzip file, possibly of several members. */
+    SEEK_INDEX_CODEC_LZ4,    /**< An lz4 frame file. */
+    SEEK_INDEX_CODEC_SNAPPY, /**< A snappy framing format file. */
+};
+
+/**
+ * A place in a compressed file from which decompression can start without
+ * reading anything before it.
+ */
+struct seek_index_restart_t {
+    /** The offset in the compressed file. */
+    uint64_t in_offset = 0;
+    /** The offset in the decompressed data. */
+    uint64_t out_offset = 0;
+    /**
+     * Codec-specific decompressor state: the bit offset into the byte before
+     * "in_offset" for gzip, and the frame descriptor for lz4.
+     */
+    uint64_t state = 0;
+    /** The decompressed data preceding "out_offset" which later data may refer to. */
+    std::vector<char> window;
+};
+
+/**
+ * A record in the decompressed data at which a reader can pick up iteration,
+ * along with the reader state the preceding records would have produced.
+ */
+struct seek_index_point_t {
+    /** The offset of a timestamp marker in the decompressed data. */
+    uint64_t out_offset = 0;
+    /** The reader's instruction ordinal prior to the timestamp. */
+    uint64_t instr_ordinal = 0;
+    /** The reader's record ordinal prior to the timestamp. */
+    uint64_t record_ordinal = 0;
+    /** The number of leading entries of the encoding table seen by this point. */
+    uint64_t encoding_count = 0;
+};
+
+/** An instruction encoding recorded in a seek index. */
+struct seek_index_encoding_t {
+    uint64_t pc;
+    uint32_t size;
+    unsigned char bits[MAX_ENCODING_LENGTH];
+};
+
+/**
+ * A decompressed view of a trace file which, unlike the file_reader_t inputs,
+ * can be restarted at a #dynamorio::drmemtrace::seek_index_restart_t.  These are
+ * used to build seek indices and by readers once they have used one.
+ */
+class seekable_input_t {
+public:
+    virtual ~seekable_input_t() = default;
+
+    /**
+     * Reads up to "size" bytes, returning fewer only at the end of the data.
+     * Returns the number of bytes read, or -1 on an error.
+     */
+    virtual int64_t
+    read(void *buf, size_t size) = 0;
+
+    /** Positions the input at "restart", from which read() then continues. */
+    virtual bool
+    restart(const seek_index_restart_t &restart) = 0;
+
+    /** Reads and discards "size" bytes. */
+    bool
+    discard(uint64_t size);
+
+    /**
+     * Asks for restart points at least "span" decompressed bytes apart to be
+     * appended to "restarts" as the input is read from its start.
+     */
+    void
+    record_restarts(uint64_t span, std::vector<seek_index_restart_t> *restarts)
+    {
+        span_ = span;
+        restarts_ = restarts;
+    }
+
+protected:
+    bool
+    want_restart(uint64_t out_offset) const
+    {
+        return restarts_ != nullptr &&
+            (restarts_->empty() || out_offset - restarts_->back().out_offset >= span_);
+    }
+
+    uint64_t span_ = 0;
+    std::vector<seek_index_restart_t> *restarts_ = nullptr;
+};
+
+/** A #dynamorio::drmemtrace::seekable_input_t for an uncompressed file. */
+class raw_seekable_input_t : public seekable_input_t {
+public:
+    explicit raw_seekable_input_t(const std::string &path);
+    bool
+    operator!()
+    {
+        return !file_;
+    }
+    int64_t
+    read(void *buf, size_t size) override;
+    bool
+    restart(const seek_index_restart_t &restart) override;
+
+private:
+    std::ifstream file_;
+    uint64_t offset_ = 0;
+};
+
+/**
+ * The seek index of a trace file, as read by a file_reader_t which was asked to
+ * skip instructions.
+ */
+class seek_index_t {
+public:
+    /**
+     * Opens the index for the trace at "trace_path", returning false if there is
+     * none or it does not describe the current contents of the trace.
+     */
+    bool
+    open(const std::string &trace_path);
+
+    seek_index_codec_t
+    get_codec() const
+    {
+        return codec_;
+    }
+
+    uint64_t
+    get_first_timestamp() const
+    {
+        return first_timestamp_;
+    }
+
+    /**
+     * Finds the last point with an instruction ordinal no larger than
+     * "stop_instruction_count" and larger than "cur_instruction_count", and the
+     * restart point from which to decompress up to it.  Returns false if there is
+     * none.
+     */
+    bool
+    find(uint64_t stop_instruction_count, uint64_t cur_instruction_count,
+         seek_index_point_t *point, seek_index_restart_t *restart);
+
+    /** Reads the first "count" entries of the encoding table. */
+    bool
+    read_encodings(uint64_t count, std::vector<seek_index_encoding_t> *encodings);
+
+private:
+    struct restart_record_t {
+        uint64_t in_offset;
+        uint64_t out_offset;
+        uint64_t state;
+        uint64_t window_offset;
+        uint64_t window_size;
+    };
+
+    std::ifstream file_;
+    seek_index_codec_t codec_ = SEEK_INDEX_CODEC_NONE;
+    uint64_t first_timestamp_ = 0;
+    uint64_t encodings_offset_ = 0;
+    uint64_t encoding_count_ = 0;
+    std::vector<restart_record_t> restarts_;
+    std::vector<seek_index_point_t> points_;
+};
+
+/**
+ * Creates the seek index for a trace file by reading it in full.  Points are
+ * placed at timestamps, which are where the reader's duplication of the prior
+ * timestamp and cpu after a skip would find them anyway, at least "interval"
+ * instructions apart.
+ */
+class seek_index_builder_t : public reader_t {
+public:
+    seek_index_builder_t(std::unique_ptr<seekable_input_t> input,
+                         seek_index_codec_t codec, uint64_t interval, uint64_t span,
+                         int verbosity = 0);
+
+    /** Writes the index for the trace at "trace_path", returning "" on success. */
+    std::string
+    build(const std::string &trace_path);
+
+    bool
+    init() override
+    {
+        at_eof_ = false;
+        return true;
+    }
+
+    std::string
+    get_stream_name() const override
+    {
+        return "seek_index_builder";
+    }
+
+protected:
+    trace_entry_t *
+    read_next_entry() override;
+
+private:
+    void
+    observe_entry(const trace_entry_t &entry, uint64_t offset);
+    bool
+    write_windows();
+
+    std::unique_ptr<seekable_input_t> input_;
+    seek_index_codec_t codec_;
+    uint64_t interval_;
+    std::ofstream out_;
+    bool failed_ = false;
+    trace_entry_t buf_[4096];
+    trace_entry_t *cur_buf_ = buf_;
+    trace_entry_t *max_buf_ = buf_;
+    uint64_t buf_offset_ = 0;
+    // Windows are written out, and dropped from here, as restarts are recorded.
+    std::vector<seek_index_restart_t> restarts_;
+    std::vector<uint64_t> window_offsets_;
+    std::vector<uint64_t> window_sizes_;
+    std::vector<seek_index_point_t> points_;
+    std::vector<seek_index_encoding_t> encodings_table_;
+    std::unordered_map<uint64_t, size_t> latest_encoding_;
+    seek_index_encoding_t pending_encoding_;
+    uint64_t next_point_instr_;
+    int thread_count_ = 0;
+    bool prev_was_record_ordinal_ = false;
+    bool in_chunk_header_ = false;
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _SEEK_INDEX_H_ */
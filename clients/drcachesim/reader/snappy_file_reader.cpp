@@ -32,6 +32,16 @@
 
 #include "snappy_file_reader.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "read_ahead.h"
+#include "seek_index.h"
+
 namespace dynamorio {
 namespace drmemtrace {
 
@@ -149,6 +159,8 @@ snappy_reader_t::read_new_chunk()
     chunk_type_t type = static_cast<chunk_type_t>(buf[0]);
     uint32_t size = 0;
     memcpy(&size, buf + 1, 3);
+    uint64_t chunk_offset = in_offset_;
+    in_offset_ += sizeof(buf) + size;
 
     switch (type) {
     case STREAM_IDENTIFIER: return read_magic(size); break;
@@ -156,9 +168,12 @@ snappy_reader_t::read_new_chunk()
     case UNCOMPRESSED_DATA:
     case COMPRESSED_DATA_NO_CRC:
     case UNCOMPRESSED_DATA_NO_CRC:
-        if (!check_magic())
+        if (!check_magic() || !read_data_chunk(size, type))
             return false;
-        return read_data_chunk(size, type);
+        // All prior data has been returned, so this chunk's starts here.
+        chunk_in_offset_ = chunk_offset;
+        chunk_out_offset_ = out_offset_;
+        return true;
         break;
     case PADDING:
         if (!check_magic())
@@ -196,6 +211,7 @@ snappy_reader_t::read(size_t size, DR_PARAM_OUT void *to)
             src_->Skip(will_read);
             to_read -= will_read;
             to_buf += will_read;
+            out_offset_ += will_read;
             continue;
         }
         if (!read_new_chunk()) {
@@ -205,12 +221,81 @@ snappy_reader_t::read(size_t size, DR_PARAM_OUT void *to)
     return size - to_read;
 }
 
+bool
+snappy_reader_t::seek(uint64_t in_offset, uint64_t out_offset)
+{
+    if (!fstream_)
+        return false;
+    fstream_->clear();
+    if (!fstream_->seekg(in_offset))
+        return false;
+    src_.reset();
+    // We are past the stream identifier.
+    seen_magic_ = true;
+    in_offset_ = in_offset;
+    out_offset_ = out_offset;
+    return true;
+}
+
+snappy_seekable_input_t::snappy_seekable_input_t(const std::string &path)
+    : reader_(new std::ifstream(path, std::ifstream::binary))
+    , ok_(!reader_.eof())
+{
+}
+
+int64_t
+snappy_seekable_input_t::read(void *buf, size_t size)
+{
+    int len = reader_.read(size, buf);
+    // A short read is either the end of the file or an error.
+    if (len < static_cast<int>(size) && !reader_.eof())
+        return -1;
+    if (want_restart(reader_.get_chunk_out_offset()) &&
+        (restarts_->empty() ||
+         reader_.get_chunk_out_offset() > restarts_->back().out_offset)) {
+        seek_index_restart_t restart;
+        restart.in_offset = reader_.get_chunk_in_offset();
+        restart.out_offset = reader_.get_chunk_out_offset();
+        restarts_->push_back(std::move(restart));
+    }
+    return len;
+}
+
+bool
+snappy_seekable_input_t::restart(const seek_index_restart_t &restart)
+{
+    return reader_.seek(restart.in_offset, restart.out_offset);
+}
+
+namespace {
+
+void
+start_read_ahead(snappy_reader_t *reader, std::shared_ptr<read_ahead_pool_t> pool,
+                 const read_ahead_options_t &options)
+{
+    if (!pool)
+        return;
+    reader->read_ahead.reset(new read_ahead_t(
+        std::move(pool), options,
+        [reader](void *buf, size_t size, uint64_t *position) -> int64_t {
+            int len = reader->read(size, buf);
+            // A short read is either the end of the file or an error.
+            if (len == 0 && !reader->eof())
+                return -1;
+            return len;
+        },
+        sizeof(trace_entry_t)));
+}
+
+} // namespace
+
 /* clang-format off */ /* (make vera++ newline-after-type check happy) */
 template <>
 /* clang-format on */
 file_reader_t<snappy_reader_t>::~file_reader_t<snappy_reader_t>()
 {
-    // Empty.
+    // Stop reading ahead before the file is closed out from under it.
+    input_file_.read_ahead.reset();
 }
 
 template <>
@@ -222,6 +307,37 @@ file_reader_t<snappy_reader_t>::open_single_file(const std::string &path)
         return false;
     VPRINT(this, 1, "Opened snappy input file %s\n", path.c_str());
     input_file_ = snappy_reader_t(file);
+    start_read_ahead(&input_file_, read_ahead_pool_, read_ahead_options_);
+    return true;
+}
+
+template <>
+bool
+file_reader_t<snappy_reader_t>::accepts_seek_codec(seek_index_codec_t codec)
+{
+    return codec == SEEK_INDEX_CODEC_SNAPPY;
+}
+
+template <>
+bool
+file_reader_t<snappy_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                                const seek_index_restart_t &restart,
+                                                uint64_t out_offset)
+{
+    // Stop reading ahead before repositioning.
+    input_file_.read_ahead.reset();
+    input_file_.cur_buf = nullptr;
+    input_file_.max_buf = nullptr;
+    if (!input_file_.seek(restart.in_offset, restart.out_offset))
+        return false;
+    char buf[4096];
+    for (uint64_t left = out_offset - restart.out_offset; left > 0;) {
+        size_t size = static_cast<size_t>(std::min<uint64_t>(left, sizeof(buf)));
+        if (input_file_.read(size, buf) != static_cast<int>(size))
+            return false;
+        left -= size;
+    }
+    start_read_ahead(&input_file_, read_ahead_pool_, read_ahead_options_);
     return true;
 }
 
@@ -232,6 +348,26 @@ file_reader_t<snappy_reader_t>::read_next_entry()
     trace_entry_t *from_queue = read_queued_entry();
     if (from_queue != nullptr)
         return from_queue;
+    if (input_file_.read_ahead) {
+        if (input_file_.cur_buf >= input_file_.max_buf) {
+            size_t size;
+            char *buf = input_file_.read_ahead->next_buffer(&size);
+            // A trailing partial record is dropped, as below.
+            if (buf == nullptr || size < sizeof(trace_entry_t)) {
+                at_eof_ = !input_file_.read_ahead->failed();
+                return nullptr;
+            }
+            input_file_.cur_buf = reinterpret_cast<trace_entry_t *>(buf);
+            input_file_.max_buf =
+                input_file_.cur_buf + size / sizeof(*input_file_.max_buf);
+        }
+        entry_copy_ = *input_file_.cur_buf;
+        ++input_file_.cur_buf;
+        VPRINT(this, 4, "Read from file: type=%s (%d), size=%d, addr=%zu\n",
+               trace_type_names[entry_copy_.type], entry_copy_.type, entry_copy_.size,
+               entry_copy_.addr);
+        return &entry_copy_;
+    }
     int len = input_file_.read(sizeof(entry_copy_), &entry_copy_);
     // Returns less than asked-for if at end of file, or –1 for error.
     if (len < (int)sizeof(entry_copy_)) {
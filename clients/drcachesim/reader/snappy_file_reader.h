@@ -47,6 +47,8 @@
 #include <snappy-sinksource.h>
 #include "snappy_consts.h"
 #include "file_reader.h"
+#include "read_ahead.h"
+#include "seek_index.h"
 
 namespace dynamorio {
 namespace drmemtrace {
@@ -68,6 +70,30 @@ public:
         return fstream_->eof();
     }
 
+    // Continues reading from the chunk at "in_offset" in the file, whose data
+    // starts "out_offset" bytes into the uncompressed stream.
+    bool
+    seek(uint64_t in_offset, uint64_t out_offset);
+
+    // Returns the file and uncompressed stream offsets of the most recent data
+    // chunk read.  Chunks are independent, so we can seek to any of these.
+    uint64_t
+    get_chunk_in_offset() const
+    {
+        return chunk_in_offset_;
+    }
+    uint64_t
+    get_chunk_out_offset() const
+    {
+        return chunk_out_offset_;
+    }
+
+    // When set, read() is called on a background thread in large blocks, and
+    // records are taken from read_ahead's buffers between cur_buf and max_buf.
+    std::unique_ptr<read_ahead_t> read_ahead;
+    trace_entry_t *cur_buf = nullptr;
+    trace_entry_t *max_buf = nullptr;
+
 private:
     bool
     read_new_chunk();
@@ -94,10 +120,46 @@ private:
     std::vector<char> compressed_buf_;
 
     bool seen_magic_;
+
+    uint64_t in_offset_ = 0;
+    uint64_t out_offset_ = 0;
+    uint64_t chunk_in_offset_ = 0;
+    uint64_t chunk_out_offset_ = 0;
+};
+
+/** A #dynamorio::drmemtrace::seekable_input_t for a snappy framing format file. */
+class snappy_seekable_input_t : public seekable_input_t {
+public:
+    explicit snappy_seekable_input_t(const std::string &path);
+    bool
+    operator!()
+    {
+        return !ok_;
+    }
+    int64_t
+    read(void *buf, size_t size) override;
+    bool
+    restart(const seek_index_restart_t &restart) override;
+
+private:
+    snappy_reader_t reader_;
+    bool ok_;
 };
 
 typedef file_reader_t<snappy_reader_t> snappy_file_reader_t;
 
+/* Declare these so the compiler knows not to use the default implementations in the
+ * class declaration.
+ */
+template <>
+bool
+file_reader_t<snappy_reader_t>::accepts_seek_codec(seek_index_codec_t codec);
+template <>
+bool
+file_reader_t<snappy_reader_t>::seek_input_file(seek_index_codec_t codec,
+                                                const seek_index_restart_t &restart,
+                                                uint64_t out_offset);
+
 } // namespace drmemtrace
 } // namespace dynamorio
 
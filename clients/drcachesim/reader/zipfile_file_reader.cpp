@@ -31,7 +31,16 @@
  */
 
 #include "zipfile_file_reader.h"
+
 #include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <utility>
+
+#include "read_ahead.h"
 
 namespace dynamorio {
 namespace drmemtrace {
@@ -66,66 +75,160 @@ open_single_file_common(const std::string &path, zipfile_reader_t &zread)
     unzFile file = unzOpen(path.c_str());
     if (file == nullptr)
         return false;
-    zread = zipfile_reader_t(file, path);
+    // We set the fields in place rather than assigning a temporary, which would
+    // copy its uninitialized buffer.
+    zread.file = file;
+    zread.path = path;
+    zread.cur_buf = zread.buf;
+    zread.max_buf = zread.buf;
     if (unzGoToFirstFile(file) != UNZ_OK || unzOpenCurrentFile(file) != UNZ_OK)
         return false;
     return true;
 }
 
-bool
-read_if_at_end_of_buffer(zipfile_reader_t &zipfile, bool &at_eof,
-                         trace_entry_t last_entry)
+// Reads from the current component into buf, moving on to the next component if
+// the current one is exhausted, in which case new_component is set to true.
+// Returns the number of bytes read, which does not span components, or 0 at the
+// end of the last component (in which case at_eof is set) or on an error.
+// last_entry is the final record read from the current component.
+int
+read_next_data(zipfile_reader_t &zipfile, void *buf, unsigned int size,
+               const trace_entry_t &last_entry, bool &at_eof, bool &new_component)
 {
-    if (zipfile.cur_buf >= zipfile.max_buf) {
-        int num_read = unzReadCurrentFile(zipfile.file, zipfile.buf, sizeof(zipfile.buf));
-        if (num_read == 0) {
+    int num_read = unzReadCurrentFile(zipfile.file, buf, size);
+    if (num_read == 0) {
 #ifdef DEBUG
-            if (zipfile.verbosity >= 3) {
-                zipfile.name[0] = '\0'; /* Just in case. */
-                // This call is expensive if we do it every time.
-                unzGetCurrentFileInfo64(zipfile.file, nullptr, zipfile.name,
-                                        sizeof(zipfile.name), nullptr, 0, nullptr, 0);
-                ZPRINT(zipfile.verbosity, 3,
-                       "Hit end of component %s; opening next component in %s\n",
-                       zipfile.name, zipfile.path.c_str());
-            }
+        if (zipfile.verbosity >= 3) {
+            zipfile.name[0] = '\0'; /* Just in case. */
+            // This call is expensive if we do it every time.
+            unzGetCurrentFileInfo64(zipfile.file, nullptr, zipfile.name,
+                                    sizeof(zipfile.name), nullptr, 0, nullptr, 0);
+            ZPRINT(zipfile.verbosity, 3,
+                   "Hit end of component %s; opening next component in %s\n",
+                   zipfile.name, zipfile.path.c_str());
+        }
 #endif
-            if ((last_entry.type != TRACE_TYPE_MARKER ||
-                 last_entry.size != TRACE_MARKER_TYPE_CHUNK_FOOTER) &&
-                last_entry.type != TRACE_TYPE_FOOTER) {
-                zipfile.name[0] = '\0'; /* Just in case. */
-                unzGetCurrentFileInfo64(zipfile.file, nullptr, zipfile.name,
-                                        sizeof(zipfile.name), nullptr, 0, nullptr, 0);
-                ZPRINT(zipfile.verbosity, 1,
-                       "Chunk is missing footer: truncation detected in %s %s\n",
-                       zipfile.path.c_str(), zipfile.name);
-                return false;
-            }
-            if (unzCloseCurrentFile(zipfile.file) != UNZ_OK)
-                return false;
-            int res = unzGoToNextFile(zipfile.file);
-            if (res != UNZ_OK) {
-                if (res == UNZ_END_OF_LIST_OF_FILE) {
-                    ZPRINT(zipfile.verbosity, 2, "Hit EOF in %s\n", zipfile.path.c_str());
-                    at_eof = true;
-                }
-                return false;
+        if ((last_entry.type != TRACE_TYPE_MARKER ||
+             last_entry.size != TRACE_MARKER_TYPE_CHUNK_FOOTER) &&
+            last_entry.type != TRACE_TYPE_FOOTER) {
+            zipfile.name[0] = '\0'; /* Just in case. */
+            unzGetCurrentFileInfo64(zipfile.file, nullptr, zipfile.name,
+                                    sizeof(zipfile.name), nullptr, 0, nullptr, 0);
+            ZPRINT(zipfile.verbosity, 1,
+                   "Chunk is missing footer: truncation detected in %s %s\n",
+                   zipfile.path.c_str(), zipfile.name);
+            return 0;
+        }
+        if (unzCloseCurrentFile(zipfile.file) != UNZ_OK)
+            return 0;
+        int res = unzGoToNextFile(zipfile.file);
+        if (res != UNZ_OK) {
+            if (res == UNZ_END_OF_LIST_OF_FILE) {
+                ZPRINT(zipfile.verbosity, 2, "Hit EOF in %s\n", zipfile.path.c_str());
+                at_eof = true;
             }
-            if (unzOpenCurrentFile(zipfile.file) != UNZ_OK)
-                return false;
-            num_read = unzReadCurrentFile(zipfile.file, zipfile.buf, sizeof(zipfile.buf));
+            return 0;
         }
-        if (num_read < static_cast<int>(sizeof(trace_entry_t))) {
-            ZPRINT(zipfile.verbosity, 1, "Failed to read: returned %d in %s\n", num_read,
-                   zipfile.path.c_str());
+        if (unzOpenCurrentFile(zipfile.file) != UNZ_OK)
+            return 0;
+        new_component = true;
+        num_read = unzReadCurrentFile(zipfile.file, buf, size);
+    }
+    if (num_read < static_cast<int>(sizeof(trace_entry_t))) {
+        ZPRINT(zipfile.verbosity, 1, "Failed to read: returned %d in %s\n", num_read,
+               zipfile.path.c_str());
+        return 0;
+    }
+    return num_read;
+}
+
+bool
+read_if_at_end_of_buffer(zipfile_reader_t &zipfile, bool &at_eof,
+                         trace_entry_t last_entry)
+{
+    if (zipfile.cur_buf < zipfile.max_buf)
+        return true;
+    if (zipfile.read_ahead) {
+        size_t size;
+        uint64_t component;
+        trace_entry_t *start = reinterpret_cast<trace_entry_t *>(
+            zipfile.read_ahead->next_buffer(&size, &component));
+        if (start == nullptr) {
+            // The reading thread only fails without reaching the end on an error.
+            at_eof = !zipfile.read_ahead->failed();
             return false;
         }
-        zipfile.cur_buf = zipfile.buf;
-        zipfile.max_buf = zipfile.buf + (num_read / sizeof(*zipfile.max_buf));
+        zipfile.cur_component = component;
+        zipfile.cur_buf = start;
+        zipfile.max_buf = start + (size / sizeof(*zipfile.max_buf));
+        return true;
     }
+    bool new_component = false;
+    int num_read = read_next_data(zipfile, zipfile.buf, sizeof(zipfile.buf), last_entry,
+                                  at_eof, new_component);
+    if (num_read == 0)
+        return false;
+    zipfile.cur_buf = zipfile.buf;
+    zipfile.max_buf = zipfile.buf + (num_read / sizeof(*zipfile.max_buf));
     return true;
 }
 
+// Records the location of the component the reading thread just opened.
+bool
+record_component_pos(zipfile_reader_t &zipfile)
+{
+    unz64_file_pos pos;
+    if (unzGetFilePos64(zipfile.file, &pos) != UNZ_OK)
+        return false;
+    zipfile.component_pos.resize(zipfile.fill_component);
+    zipfile.component_pos.push_back(pos);
+    return true;
+}
+
+// Runs on a read_ahead_pool_t thread.
+int64_t
+fill_read_ahead_buffer(zipfile_reader_t *zipfile, void *buf, size_t size,
+                       uint64_t *position)
+{
+    bool at_eof = false;
+    bool new_component = false;
+    int num_read =
+        read_next_data(*zipfile, buf, static_cast<unsigned int>(size),
+                       zipfile->fill_last_entry, at_eof, new_component);
+    if (new_component) {
+        ++zipfile->fill_component;
+        if (!record_component_pos(*zipfile))
+            return -1;
+    }
+    if (num_read == 0)
+        return at_eof ? 0 : -1;
+    // Components hold whole records, so a buffer never ends mid-record.
+    memcpy(&zipfile->fill_last_entry,
+           static_cast<char *>(buf) + num_read - sizeof(trace_entry_t),
+           sizeof(trace_entry_t));
+    *position = zipfile->fill_component;
+    return num_read;
+}
+
+void
+start_read_ahead(zipfile_reader_t &zipfile, std::shared_ptr<read_ahead_pool_t> pool,
+                 const read_ahead_options_t &options)
+{
+    if (!pool)
+        return;
+    zipfile.fill_component = 0;
+    zipfile.fill_last_entry = {};
+    if (!record_component_pos(zipfile))
+        return;
+    zipfile_reader_t *zipfile_ptr = &zipfile;
+    zipfile.read_ahead.reset(new read_ahead_t(
+        std::move(pool), options,
+        [zipfile_ptr](void *buf, size_t size, uint64_t *position) {
+            return fill_read_ahead_buffer(zipfile_ptr, buf, size, position);
+        },
+        sizeof(trace_entry_t)));
+}
+
 } // namespace
 
 /**************************************************
@@ -145,6 +248,8 @@ template <>
 /* clang-format on */
 file_reader_t<zipfile_reader_t>::~file_reader_t<zipfile_reader_t>()
 {
+    // Stop reading ahead before closing the file out from under it.
+    input_file_.read_ahead.reset();
     if (input_file_.file != nullptr) {
         unzClose(input_file_.file);
         input_file_.file = nullptr;
@@ -159,6 +264,7 @@ file_reader_t<zipfile_reader_t>::open_single_file(const std::string &path)
         return false;
     VPRINT(this, 1, "Opened input file %s\n", path.c_str());
     input_file_.verbosity = verbosity_;
+    start_read_ahead(input_file_, read_ahead_pool_, read_ahead_options_);
     return true;
 }
 
@@ -198,6 +304,24 @@ file_reader_t<zipfile_reader_t>::skip_instructions(uint64_t instruction_count)
     // We assume our unzGoToNextFile loop is plenty performant and we don't need to
     // know the chunk names to use with a single unzLocateFile.
     uint64_t stop_count = cur_instr_count_ + instruction_count + 1;
+    bool skip_chunks = cur_instr_count_ +
+            (chunk_instr_count_ - (cur_instr_count_ % chunk_instr_count_)) <
+        stop_count;
+    if (skip_chunks && zipfile->read_ahead) {
+        // The reading thread may be several components ahead of us.  Stop it and
+        // return to the component we are in.
+        zipfile->read_ahead->reset();
+        unzCloseCurrentFile(zipfile->file);
+        if (zipfile->cur_component >= zipfile->component_pos.size() ||
+            unzGoToFilePos64(zipfile->file,
+                             &zipfile->component_pos[zipfile->cur_component]) != UNZ_OK ||
+            unzOpenCurrentFile(zipfile->file) != UNZ_OK) {
+            VPRINT(this, 1, "Failed to return to the current zip subfile\n");
+            at_eof_ = true;
+            return *this;
+        }
+        zipfile->fill_component = zipfile->cur_component;
+    }
     VPRINT(this, 2,
            "stop=%" PRIi64 " cur=%" PRIi64 " chunk=%" PRIi64 " est=%" PRIi64 "\n",
            stop_count, cur_instr_count_, chunk_instr_count_,
@@ -227,6 +351,7 @@ file_reader_t<zipfile_reader_t>::skip_instructions(uint64_t instruction_count)
             return *this;
         }
         cur_instr_count_ += chunk_instr_count_ - (cur_instr_count_ % chunk_instr_count_);
+        ++zipfile->fill_component;
         VPRINT(this, 2, "At %" PRIi64 " instrs at start of new chunk\n",
                cur_instr_count_);
         VPRINT(this, 2,
@@ -238,6 +363,15 @@ file_reader_t<zipfile_reader_t>::skip_instructions(uint64_t instruction_count)
         // Clear cached data from the prior chunk.
         zipfile->cur_buf = zipfile->max_buf;
     }
+    if (skip_chunks && zipfile->read_ahead) {
+        // Resume reading ahead from the start of the new component.
+        zipfile->fill_last_entry = {};
+        if (!record_component_pos(*zipfile)) {
+            VPRINT(this, 1, "Failed to record zip subfile position\n");
+            at_eof_ = true;
+            return *this;
+        }
+    }
     // Now do a linear walk the rest of the way, remembering timestamps (we have
     // duplicated timestamps at the start of the chunk to cover any skipped in
     // the fast chunk jumps we just did).
@@ -260,6 +394,8 @@ record_file_reader_t<zipfile_reader_t>::record_file_reader_t()
 template <>
 record_file_reader_t<zipfile_reader_t>::~record_file_reader_t<zipfile_reader_t>()
 {
+    // Stop reading ahead before closing the file out from under it.
+    input_file_->read_ahead.reset();
     if (input_file_->file != nullptr) {
         unzClose(input_file_->file);
         input_file_->file = nullptr;
@@ -270,12 +406,13 @@ template <>
 bool
 record_file_reader_t<zipfile_reader_t>::open_single_file(const std::string &path)
 {
-    zipfile_reader_t zread;
-    if (!open_single_file_common(path, zread))
+    std::unique_ptr<zipfile_reader_t> zread(new zipfile_reader_t());
+    if (!open_single_file_common(path, *zread))
         return false;
-    input_file_ = std::unique_ptr<zipfile_reader_t>(new zipfile_reader_t(zread));
+    input_file_ = std::move(zread);
     VPRINT(this, 1, "Opened input file %s\n", path.c_str());
     input_file_->verbosity = verbosity_;
+    start_read_ahead(*input_file_, read_ahead_pool_, read_ahead_options_);
     return true;
 }
 
@@ -36,8 +36,14 @@
 #define _ZIPFILE_FILE_READER_H_ 1
 
 #include <zlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "minizip/unzip.h"
 #include "file_reader.h"
+#include "read_ahead.h"
 #include "record_file_reader.h"
 
 namespace dynamorio {
@@ -68,6 +74,17 @@ struct zipfile_reader_t {
     std::string path;
     char name[128];
     int verbosity = 0;
+    // When set, the components are read on a background thread and cur_buf and
+    // max_buf point into read_ahead's buffers rather than buf.
+    std::unique_ptr<read_ahead_t> read_ahead;
+    // The ordinal of the component holding cur_buf, when reading ahead.
+    uint64_t cur_component = 0;
+    // The reading thread's state: the ordinal of the component it is reading,
+    // the last record it read, and the location of each component it opened,
+    // which we use to return to the consumer's component when skipping.
+    uint64_t fill_component = 0;
+    trace_entry_t fill_last_entry = {};
+    std::vector<unz64_file_pos> component_pos;
 };
 
 typedef file_reader_t<zipfile_reader_t> zipfile_file_reader_t;
@@ -39,6 +39,7 @@
 #include <cassert>
 #include <cinttypes>
 #include <cstdio>
+#include <fstream>
 #include <iomanip>
 #include <limits>
 #include <memory>
@@ -55,6 +56,10 @@
 #include "reader.h"
 #include "record_file_reader.h"
 #include "trace_entry.h"
+#include "columnar_file_reader.h"
+#ifdef UNIX
+#    include "mmap_file_reader.h"
+#endif
 #ifdef HAS_LZ4
 #    include "lz4_file_reader.h"
 #endif
@@ -106,6 +111,22 @@ typedef dynamorio::drmemtrace::record_file_reader_t<std::ifstream>
     default_record_file_reader_t;
 #endif
 
+#ifdef UNIX
+// Returns whether "path" is an uncompressed trace file, which we map into memory
+// rather than read through a stream.  We look for the header record rather than
+// trust the file name.
+static bool
+is_uncompressed_trace_file(const std::string &path)
+{
+    if (directory_iterator_t::is_directory(path))
+        return false;
+    std::ifstream file(path, std::ifstream::binary);
+    trace_entry_t header;
+    return file.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+        header.type == TRACE_TYPE_HEADER;
+}
+#endif
+
 std::string
 replay_file_checker_t::check(archive_istream_t *infile)
 {
@@ -138,19 +159,26 @@ template <>
 std::unique_ptr<reader_t>
 scheduler_tmpl_t<memref_t, reader_t>::get_reader(const std::string &path, int verbosity)
 {
+    if (ends_with(path, ".col")) {
+        return std::unique_ptr<reader_t>(
+            with_read_ahead(new columnar_file_reader_t(path, verbosity)));
+    }
 #if defined(HAS_SNAPPY) || defined(HAS_ZIP) || defined(HAS_LZ4)
 #    ifdef HAS_LZ4
     if (ends_with(path, ".lz4")) {
-        return std::unique_ptr<reader_t>(new lz4_file_reader_t(path, verbosity));
+        return std::unique_ptr<reader_t>(
+            with_read_ahead(new lz4_file_reader_t(path, verbosity)));
     }
 #    endif
 #    ifdef HAS_SNAPPY
     if (ends_with(path, ".sz"))
-        return std::unique_ptr<reader_t>(new snappy_file_reader_t(path, verbosity));
+        return std::unique_ptr<reader_t>(
+            with_read_ahead(new snappy_file_reader_t(path, verbosity)));
 #    endif
 #    ifdef HAS_ZIP
     if (ends_with(path, ".zip"))
-        return std::unique_ptr<reader_t>(new zipfile_file_reader_t(path, verbosity));
+        return std::unique_ptr<reader_t>(
+            with_read_ahead(new zipfile_file_reader_t(path, verbosity)));
 #    endif
     // If path is a directory, and any file in it ends in .sz, return a snappy reader.
     if (directory_iterator_t::is_directory(path)) {
@@ -170,30 +198,39 @@ scheduler_tmpl_t<memref_t, reader_t>::get_reader(const std::string &path, int ve
             // Skip the auxiliary files.
             if (fname == DRMEMTRACE_MODULE_LIST_FILENAME ||
                 fname == DRMEMTRACE_FUNCTION_LIST_FILENAME ||
-                fname == DRMEMTRACE_ENCODING_FILENAME)
+                fname == DRMEMTRACE_ENCODING_FILENAME ||
+                ends_with(fname, DRMEMTRACE_SEEK_INDEX_SUFFIX))
                 continue;
 #    ifdef HAS_SNAPPY
             if (ends_with(*iter, ".sz")) {
                 return std::unique_ptr<reader_t>(
-                    new snappy_file_reader_t(path, verbosity));
+                    with_read_ahead(new snappy_file_reader_t(path, verbosity)));
             }
 #    endif
 #    ifdef HAS_ZIP
             if (ends_with(*iter, ".zip")) {
                 return std::unique_ptr<reader_t>(
-                    new zipfile_file_reader_t(path, verbosity));
+                    with_read_ahead(new zipfile_file_reader_t(path, verbosity)));
             }
 #    endif
 #    ifdef HAS_LZ4
             if (ends_with(path, ".lz4")) {
-                return std::unique_ptr<reader_t>(new lz4_file_reader_t(path, verbosity));
+                return std::unique_ptr<reader_t>(
+                    with_read_ahead(new lz4_file_reader_t(path, verbosity)));
             }
 #    endif
         }
     }
 #endif
     // No snappy/zlib support, or didn't find a .sz/.zip file.
-    return std::unique_ptr<reader_t>(new default_file_reader_t(path, verbosity));
+#ifdef UNIX
+    if (is_uncompressed_trace_file(path)) {
+        // The kernel reads the mapping ahead, so we do not.
+        return std::unique_ptr<reader_t>(new mmap_file_reader_t(path, verbosity));
+    }
+#endif
+    return std::unique_ptr<reader_t>(
+        with_read_ahead(new default_file_reader_t(path, verbosity)));
 }
 
 template <>
@@ -357,14 +394,24 @@ scheduler_tmpl_t<trace_entry_t, record_reader_t>::get_reader(const std::string &
     // TODO i#5675: Add support for other file formats.
     if (ends_with(path, ".sz"))
         return nullptr;
+    if (ends_with(path, ".col")) {
+        return std::unique_ptr<dynamorio::drmemtrace::record_reader_t>(
+            with_read_ahead(new columnar_record_file_reader_t(path, verbosity)));
+    }
 #ifdef HAS_ZIP
     if (ends_with(path, ".zip")) {
         return std::unique_ptr<dynamorio::drmemtrace::record_reader_t>(
-            new zipfile_record_file_reader_t(path, verbosity));
+            with_read_ahead(new zipfile_record_file_reader_t(path, verbosity)));
+    }
+#endif
+#ifdef UNIX
+    if (is_uncompressed_trace_file(path)) {
+        return std::unique_ptr<dynamorio::drmemtrace::record_reader_t>(
+            new mmap_record_file_reader_t(path, verbosity));
     }
 #endif
     return std::unique_ptr<dynamorio::drmemtrace::record_reader_t>(
-        new default_record_file_reader_t(path, verbosity));
+        with_read_ahead(new default_record_file_reader_t(path, verbosity)));
 }
 
 template <>
@@ -550,14 +597,57 @@ typename scheduler_tmpl_t<RecordType, ReaderType>::stream_status_t
 scheduler_tmpl_t<RecordType, ReaderType>::stream_t::next_record(RecordType &record,
                                                                 uint64_t cur_time)
 {
+    if (pending_status_ != sched_type_t::STATUS_OK) {
+        sched_type_t::stream_status_t res = pending_status_;
+        pending_status_ = sched_type_t::STATUS_OK;
+        return res;
+    }
     if (max_ordinal_ > 0) {
         ++ordinal_;
         if (ordinal_ >= max_ordinal_)
             ordinal_ = 0;
     }
+    return advance(record, cur_time, /*stop_at_switch=*/false);
+}
+
+template <typename RecordType, typename ReaderType>
+typename scheduler_tmpl_t<RecordType, ReaderType>::stream_status_t
+scheduler_tmpl_t<RecordType, ReaderType>::stream_t::next_record_batch(
+    RecordType *records, int max_records, int &num_records, uint64_t cur_time)
+{
+    num_records = 0;
+    if (max_records <= 0)
+        return sched_type_t::STATUS_INVALID;
+    sched_type_t::stream_status_t res = next_record(records[0], cur_time);
+    if (res != sched_type_t::STATUS_OK)
+        return res;
+    num_records = 1;
+    // A lockstep stream moves to another output on every record.
+    if (max_ordinal_ > 0)
+        return sched_type_t::STATUS_OK;
+    while (num_records < max_records) {
+        res = advance(records[num_records], cur_time, /*stop_at_switch=*/true);
+        if (res == sched_type_t::STATUS_SKIPPED)
+            break; // The next record is from a different input.
+        if (res != sched_type_t::STATUS_OK) {
+            // Hand back what we have first.
+            pending_status_ = res;
+            break;
+        }
+        ++num_records;
+    }
+    return sched_type_t::STATUS_OK;
+}
+
+template <typename RecordType, typename ReaderType>
+typename scheduler_tmpl_t<RecordType, ReaderType>::stream_status_t
+scheduler_tmpl_t<RecordType, ReaderType>::stream_t::advance(RecordType &record,
+                                                            uint64_t cur_time,
+                                                            bool stop_at_switch)
+{
     input_info_t *input = nullptr;
     sched_type_t::stream_status_t res =
-        scheduler_->next_record(ordinal_, record, input, cur_time);
+        scheduler_->next_record(ordinal_, record, input, cur_time, stop_at_switch);
     if (res != sched_type_t::STATUS_OK)
         return res;
 
@@ -655,6 +745,16 @@ scheduler_tmpl_t<RecordType, ReaderType>::init(
 {
     options_ = std::move(options);
     verbosity_ = options_.verbosity;
+    // Per-output queues only apply to dynamic scheduling.
+    if (options_.mapping != MAP_TO_ANY_OUTPUT)
+        options_.per_output_ready_queues = false;
+    if (options_.read_ahead_threads > 0) {
+        read_ahead_pool_ =
+            std::make_shared<read_ahead_pool_t>(options_.read_ahead_threads);
+        read_ahead_options_.depth = options_.read_ahead_depth;
+        read_ahead_options_.buffer_size =
+            static_cast<size_t>(options_.read_ahead_buffer_size);
+    }
     // workload_inputs is not const so we can std::move readers out of it.
     std::unordered_map<int, std::vector<int>> workload2inputs(workload_inputs.size());
     for (int workload_idx = 0; workload_idx < static_cast<int>(workload_inputs.size());
@@ -913,7 +1013,12 @@ scheduler_tmpl_t<RecordType, ReaderType>::set_initial_schedule(
             // inputs in the queue in any case so it is simplest to insert all and
             // remove the first N rather than sorting the first N separately.
             for (int i = 0; i < static_cast<input_ordinal_t>(inputs_.size()); ++i) {
-                add_to_ready_queue(&inputs_[i]);
+                add_to_ready_queue(INVALID_OUTPUT_ORDINAL, &inputs_[i]);
+            }
+            if (options_.per_output_ready_queues) {
+                // Deal the inputs out in timestamp order so that each output's queue
+                // starts with one of the globally-first inputs.
+                rebalance_queues(INVALID_OUTPUT_ORDINAL);
             }
             for (int i = 0; i < static_cast<output_ordinal_t>(outputs_.size()); ++i) {
                 if (i < static_cast<input_ordinal_t>(inputs_.size())) {
@@ -940,7 +1045,7 @@ scheduler_tmpl_t<RecordType, ReaderType>::set_initial_schedule(
             }
             for (int i = static_cast<output_ordinal_t>(outputs_.size());
                  i < static_cast<input_ordinal_t>(inputs_.size()); ++i) {
-                add_to_ready_queue(&inputs_[i]);
+                add_to_ready_queue(INVALID_OUTPUT_ORDINAL, &inputs_[i]);
             }
         }
     }
@@ -1631,7 +1736,8 @@ scheduler_tmpl_t<RecordType, ReaderType>::open_readers(
         // Skip the auxiliary files.
         if (fname == DRMEMTRACE_MODULE_LIST_FILENAME ||
             fname == DRMEMTRACE_FUNCTION_LIST_FILENAME ||
-            fname == DRMEMTRACE_ENCODING_FILENAME)
+            fname == DRMEMTRACE_ENCODING_FILENAME ||
+            ends_with(fname, DRMEMTRACE_SEEK_INDEX_SUFFIX))
             continue;
         const std::string file = path + DIRSEP + fname;
         sched_type_t::scheduler_status_t res =
@@ -1733,6 +1839,24 @@ scheduler_tmpl_t<RecordType, ReaderType>::get_output_cpuid(output_ordinal_t outp
     return output;
 }
 
+template <typename RecordType, typename ReaderType>
+int64_t
+scheduler_tmpl_t<RecordType, ReaderType>::get_read_ahead_statistic(
+    read_ahead_statistic_t stat) const
+{
+    if (!read_ahead_pool_)
+        return -1;
+    switch (stat) {
+    case READ_AHEAD_STAT_CONSUMER_STALL_US:
+        return static_cast<int64_t>(read_ahead_pool_->get_consumer_stall_us());
+    case READ_AHEAD_STAT_PRODUCER_STALL_US:
+        return static_cast<int64_t>(read_ahead_pool_->get_producer_stall_us());
+    case READ_AHEAD_STAT_BUFFERS_FILLED:
+        return static_cast<int64_t>(read_ahead_pool_->get_buffers_filled());
+    default: return -1;
+    }
+}
+
 template <typename RecordType, typename ReaderType>
 memtrace_stream_t *
 scheduler_tmpl_t<RecordType, ReaderType>::get_input_stream(output_ordinal_t output)
@@ -2051,47 +2175,192 @@ scheduler_tmpl_t<RecordType, ReaderType>::close_schedule_segment(output_ordinal_
     return sched_type_t::STATUS_OK;
 }
 
+template <typename RecordType, typename ReaderType>
+int64_t
+scheduler_tmpl_t<RecordType, ReaderType>::get_statistic(
+    output_ordinal_t output, memtrace_stream_t::schedule_statistic_t stat) const
+{
+    if (output < 0 || output >= static_cast<output_ordinal_t>(outputs_.size()) ||
+        stat < 0 || stat >= memtrace_stream_t::SCHED_STAT_TYPE_COUNT)
+        return -1;
+    return outputs_[output].stats[stat];
+}
+
+template <typename RecordType, typename ReaderType>
+std::unique_lock<std::mutex>
+scheduler_tmpl_t<RecordType, ReaderType>::acquire_scheduler_lock(
+    output_ordinal_t for_output, std::mutex &lock)
+{
+    std::unique_lock<std::mutex> guard(lock, std::try_to_lock);
+    if (!guard.owns_lock()) {
+        if (for_output != INVALID_OUTPUT_ORDINAL)
+            ++outputs_[for_output].stats[memtrace_stream_t::SCHED_STAT_LOCK_CONTENTION];
+        guard.lock();
+    }
+    return guard;
+}
+
+template <typename RecordType, typename ReaderType>
+typename scheduler_tmpl_t<RecordType, ReaderType>::input_queue_t &
+scheduler_tmpl_t<RecordType, ReaderType>::get_ready_queue(output_ordinal_t output)
+{
+    if (!options_.per_output_ready_queues)
+        return ready_priority_;
+    assert(output >= 0 && output < static_cast<output_ordinal_t>(outputs_.size()));
+    return *outputs_[output].ready_queue;
+}
+
+template <typename RecordType, typename ReaderType>
+std::unique_lock<std::mutex>
+scheduler_tmpl_t<RecordType, ReaderType>::lock_ready_queue(output_ordinal_t for_output,
+                                                           input_queue_t &queue)
+{
+    if (!options_.per_output_ready_queues) {
+        // The caller holds sched_lock_.
+        return std::unique_lock<std::mutex>();
+    }
+    return acquire_scheduler_lock(for_output, queue.lock);
+}
+
 template <typename RecordType, typename ReaderType>
 bool
 scheduler_tmpl_t<RecordType, ReaderType>::ready_queue_empty()
 {
-    return ready_priority_.empty();
+    if (!options_.per_output_ready_queues)
+        return ready_priority_.queue.empty();
+    for (const auto &output : outputs_) {
+        if (output.ready_queue->size_hint.load(std::memory_order_acquire) > 0)
+            return false;
+    }
+    return true;
 }
 
 template <typename RecordType, typename ReaderType>
 void
-scheduler_tmpl_t<RecordType, ReaderType>::add_to_ready_queue(input_info_t *input)
+scheduler_tmpl_t<RecordType, ReaderType>::update_queue_hints(input_queue_t &queue)
+{
+    queue.size_hint.store(static_cast<int>(queue.queue.size()),
+                          std::memory_order_release);
+    queue.top_priority_hint.store(queue.queue.empty()
+                                      ? (std::numeric_limits<int>::min)()
+                                      : queue.queue.top()->priority,
+                                  std::memory_order_release);
+}
+
+template <typename RecordType, typename ReaderType>
+void
+scheduler_tmpl_t<RecordType, ReaderType>::add_to_ready_queue_hold_locks(
+    input_queue_t &queue, input_info_t *input)
 {
     VPRINT(
         this, 4,
         "add_to_ready_queue (pre-size %zu): input %d priority %d timestamp delta %" PRIu64
         " block time %" PRIu64 " start time %" PRIu64 "\n",
-        ready_priority_.size(), input->index, input->priority,
+        queue.queue.size(), input->index, input->priority,
         input->reader->get_last_timestamp() - input->base_timestamp, input->blocked_time,
         input->blocked_start_time);
     if (input->blocked_time > 0)
-        ++num_blocked_;
+        ++queue.num_blocked;
     input->queue_counter = ++ready_counter_;
-    ready_priority_.push(input);
+    queue.queue.push(input);
+    update_queue_hints(queue);
 }
 
 template <typename RecordType, typename ReaderType>
-typename scheduler_tmpl_t<RecordType, ReaderType>::stream_status_t
-scheduler_tmpl_t<RecordType, ReaderType>::pop_from_ready_queue(
-    output_ordinal_t for_output, input_info_t *&new_input)
+void
+scheduler_tmpl_t<RecordType, ReaderType>::add_to_ready_queue(output_ordinal_t for_output,
+                                                             input_info_t *input)
+{
+    if (!options_.per_output_ready_queues) {
+        add_to_ready_queue_hold_locks(ready_priority_, input);
+        return;
+    }
+    // We prefer to keep the input on the queue of the output it last ran on.
+    // Otherwise, we spread inputs across the active outputs they are allowed on.
+    output_ordinal_t target = INVALID_OUTPUT_ORDINAL;
+    if (for_output != INVALID_OUTPUT_ORDINAL &&
+        outputs_[for_output].active->load(std::memory_order_acquire) &&
+        (input->binding.empty() ||
+         input->binding.find(for_output) != input->binding.end()))
+        target = for_output;
+    else {
+        int num_outputs = static_cast<int>(outputs_.size());
+        int start = next_queue_placement_.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < num_outputs; ++i) {
+            output_ordinal_t candidate = (start + i) % num_outputs;
+            if (outputs_[candidate].active->load(std::memory_order_acquire) &&
+                (input->binding.empty() ||
+                 input->binding.find(candidate) != input->binding.end())) {
+                target = candidate;
+                break;
+            }
+        }
+        if (target == INVALID_OUTPUT_ORDINAL) {
+            // Every allowed output is inactive.  Park the input on an allowed output
+            // for when it is re-activated.
+            target = input->binding.empty() ? start % num_outputs
+                                            : *input->binding.begin();
+        }
+    }
+    input_queue_t &queue = *outputs_[target].ready_queue;
+    auto lock = lock_ready_queue(for_output, queue);
+    VPRINT(this, 4, "add_to_ready_queue: adding input %d to output %d's queue\n",
+           input->index, target);
+    add_to_ready_queue_hold_locks(queue, input);
+}
+
+template <typename RecordType, typename ReaderType>
+bool
+scheduler_tmpl_t<RecordType, ReaderType>::remove_from_ready_queue(
+    output_ordinal_t for_output, input_info_t *input)
+{
+    auto remove_from = [&](input_queue_t &queue) {
+        if (!queue.queue.find(input))
+            return false;
+        queue.queue.erase(input);
+        if (input->blocked_time > 0)
+            --queue.num_blocked;
+        update_queue_hints(queue);
+        return true;
+    };
+    if (!options_.per_output_ready_queues)
+        return remove_from(ready_priority_);
+    for (auto &output : outputs_) {
+        input_queue_t &queue = *output.ready_queue;
+        if (queue.size_hint.load(std::memory_order_acquire) == 0)
+            continue;
+        auto lock = lock_ready_queue(for_output, queue);
+        if (remove_from(queue))
+            return true;
+    }
+    return false;
+}
+
+template <typename RecordType, typename ReaderType>
+void
+scheduler_tmpl_t<RecordType, ReaderType>::pop_from_one_queue(output_ordinal_t for_output,
+                                                             input_queue_t &queue,
+                                                             int min_priority,
+                                                             input_info_t *&new_input,
+                                                             bool &saw_blocked)
 {
+    auto lock = lock_ready_queue(for_output, queue);
     std::set<input_info_t *> skipped;
     std::set<input_info_t *> blocked;
     input_info_t *res = nullptr;
-    sched_type_t::stream_status_t status = STATUS_OK;
-    uint64_t cur_time = (num_blocked_ > 0) ? get_output_time(for_output) : 0;
-    while (!ready_priority_.empty()) {
+    uint64_t cur_time = (queue.num_blocked > 0) ? get_output_time(for_output) : 0;
+    while (!queue.queue.empty()) {
         if (options_.randomize_next_input) {
-            res = ready_priority_.get_random_entry();
-            ready_priority_.erase(res);
+            res = queue.queue.get_random_entry();
+            queue.queue.erase(res);
         } else {
-            res = ready_priority_.top();
-            ready_priority_.pop();
+            res = queue.queue.top();
+            if (res->priority < min_priority) {
+                // The rest of the queue is lower priority still.
+                res = nullptr;
+                break;
+            }
+            queue.queue.pop();
         }
         if (res->binding.empty() || res->binding.find(for_output) != res->binding.end()) {
             // For blocked inputs, as we don't have interrupts or other regular
@@ -2099,7 +2368,7 @@ scheduler_tmpl_t<RecordType, ReaderType>::pop_from_ready_queue(
             // would be chosen to run.  We thus keep blocked inputs in the ready queue.
             if (res->blocked_time > 0) {
                 assert(cur_time > 0);
-                --num_blocked_;
+                --queue.num_blocked;
             }
             if (res->blocked_time > 0 &&
                 cur_time - res->blocked_start_time < res->blocked_time) {
@@ -2116,39 +2385,190 @@ scheduler_tmpl_t<RecordType, ReaderType>::pop_from_ready_queue(
         }
         res = nullptr;
     }
-    if (res == nullptr && !blocked.empty()) {
-        // Do not hand out EOF thinking we're done: we still have inputs blocked
-        // on i/o, so just wait and retry.
-        status = STATUS_IDLE;
-    }
+    if (!blocked.empty())
+        saw_blocked = true;
     // Re-add the ones we skipped, but without changing their counters so we preserve
     // the prior FIFO order.
     for (input_info_t *save : skipped)
-        ready_priority_.push(save);
+        queue.queue.push(save);
     // Re-add the blocked ones to the back.
     for (input_info_t *save : blocked)
-        add_to_ready_queue(save);
+        add_to_ready_queue_hold_locks(queue, save);
+    update_queue_hints(queue);
     VDO(this, 1, {
         static int heartbeat;
         // We are ok with races as the cadence is approximate.
         if (++heartbeat % 500 == 0) {
-            VPRINT(this, 1, "heartbeat[%d] %zd in queue; %d blocked => %d %d\n",
-                   for_output, ready_priority_.size(), num_blocked_,
-                   res == nullptr ? -1 : res->index, status);
+            VPRINT(this, 1, "heartbeat[%d] %zd in queue; %d blocked => %d\n",
+                   for_output, queue.queue.size(), queue.num_blocked,
+                   res == nullptr ? -1 : res->index);
         }
     });
     if (res != nullptr) {
         VPRINT(this, 4,
                "pop_from_ready_queue[%d] (post-size %zu): input %d priority %d timestamp "
                "delta %" PRIu64 "\n",
-               for_output, ready_priority_.size(), res->index, res->priority,
+               for_output, queue.queue.size(), res->index, res->priority,
                res->reader->get_last_timestamp() - res->base_timestamp);
         res->blocked_time = 0;
     }
     new_input = res;
+}
+
+template <typename RecordType, typename ReaderType>
+typename scheduler_tmpl_t<RecordType, ReaderType>::stream_status_t
+scheduler_tmpl_t<RecordType, ReaderType>::pop_from_ready_queue(
+    output_ordinal_t for_output, input_info_t *&new_input)
+{
+    static constexpr int ANY_PRIORITY = (std::numeric_limits<int>::min)();
+    input_info_t *res = nullptr;
+    bool saw_blocked = false;
+    if (options_.per_output_ready_queues)
+        rebalance_queues_if_due(for_output);
+    input_queue_t &local = get_ready_queue(for_output);
+    pop_from_one_queue(for_output, local, ANY_PRIORITY, res, saw_blocked);
+    if (options_.per_output_ready_queues && outputs_.size() > 1) {
+        // Look for a higher-priority input elsewhere, or for any input if we have
+        // nothing, preferring the queue with the highest-priority top entry.
+        // XXX: For inputs of the same priority, we do not compare timestamps across
+        // queues here as that would require locking every queue: we rely on periodic
+        // rebalancing to approximate a global timestamp order.
+        int min_priority = ANY_PRIORITY;
+        if (res != nullptr) {
+            if (res->priority == (std::numeric_limits<int>::max)())
+                min_priority = res->priority;
+            else
+                min_priority = res->priority + 1;
+        }
+        int num_outputs = static_cast<int>(outputs_.size());
+        std::vector<output_ordinal_t> victims;
+        for (int i = 1; i < num_outputs; ++i) {
+            output_ordinal_t victim = (for_output + i) % num_outputs;
+            const input_queue_t &queue = *outputs_[victim].ready_queue;
+            if (queue.size_hint.load(std::memory_order_acquire) > 0 &&
+                (res == nullptr ||
+                 queue.top_priority_hint.load(std::memory_order_acquire) >=
+                     min_priority))
+                victims.push_back(victim);
+        }
+        std::stable_sort(victims.begin(), victims.end(),
+                         [&](output_ordinal_t a, output_ordinal_t b) {
+                             return outputs_[a].ready_queue->top_priority_hint.load(
+                                        std::memory_order_acquire) >
+                                 outputs_[b].ready_queue->top_priority_hint.load(
+                                     std::memory_order_acquire);
+                         });
+        for (output_ordinal_t victim : victims) {
+            input_info_t *stolen = nullptr;
+            pop_from_one_queue(for_output, *outputs_[victim].ready_queue, min_priority,
+                               stolen, saw_blocked);
+            if (stolen != nullptr) {
+                VPRINT(this, 2,
+                       "pop_from_ready_queue[%d]: stole input %d from output %d\n",
+                       for_output, stolen->index, victim);
+                ++outputs_[for_output]
+                      .stats[memtrace_stream_t::SCHED_STAT_RUNQUEUE_STEALS];
+                if (res != nullptr) {
+                    // Put back our lower-priority input, without changing its counter
+                    // so we preserve the prior FIFO order.
+                    auto lock = lock_ready_queue(for_output, local);
+                    local.queue.push(res);
+                    update_queue_hints(local);
+                }
+                res = stolen;
+                break;
+            }
+        }
+    }
+    sched_type_t::stream_status_t status = STATUS_OK;
+    if (res == nullptr && saw_blocked) {
+        // Do not hand out EOF thinking we're done: we still have inputs blocked
+        // on i/o, so just wait and retry.
+        status = STATUS_IDLE;
+    }
+    new_input = res;
     return status;
 }
 
+template <typename RecordType, typename ReaderType>
+void
+scheduler_tmpl_t<RecordType, ReaderType>::rebalance_queues_if_due(
+    output_ordinal_t for_output)
+{
+    if (options_.rebalance_period == 0 || outputs_.size() <= 1 ||
+        for_output == INVALID_OUTPUT_ORDINAL)
+        return;
+    uint64_t now = get_output_time(for_output);
+    uint64_t last = last_rebalance_time_.load(std::memory_order_acquire);
+    if (last == 0) {
+        // Start the clock on our first call.
+        last_rebalance_time_.compare_exchange_strong(last, now,
+                                                     std::memory_order_acq_rel);
+        return;
+    }
+    // Output times are not globally synchronized, so "now" may be behind "last".
+    if (now <= last || now - last < options_.rebalance_period)
+        return;
+    // Only one output performs each rebalance.
+    if (!last_rebalance_time_.compare_exchange_strong(last, now,
+                                                      std::memory_order_acq_rel))
+        return;
+    rebalance_queues(for_output);
+}
+
+template <typename RecordType, typename ReaderType>
+void
+scheduler_tmpl_t<RecordType, ReaderType>::rebalance_queues(output_ordinal_t for_output)
+{
+    assert(options_.per_output_ready_queues);
+    // We acquire every queue lock, always in output order to avoid deadlocks.
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(outputs_.size());
+    for (auto &output : outputs_)
+        locks.push_back(lock_ready_queue(for_output, *output.ready_queue));
+    // Gather all queued inputs into their global order.  We do not change the
+    // queue counters so we preserve the prior FIFO order.
+    flexible_queue_t<input_info_t *, InputTimestampComparator> all;
+    for (auto &output : outputs_) {
+        input_queue_t &queue = *output.ready_queue;
+        while (!queue.queue.empty()) {
+            all.push(queue.queue.top());
+            queue.queue.pop();
+        }
+        queue.num_blocked = 0;
+    }
+    VPRINT(this, 2, "rebalance_queues[%d]: redistributing %zu inputs\n", for_output,
+           all.size());
+    // Deal the inputs out in order to whichever allowed active output has the fewest,
+    // so each queue's top entries are among the globally best.
+    std::vector<int> counts(outputs_.size(), 0);
+    while (!all.empty()) {
+        input_info_t *input = all.top();
+        all.pop();
+        output_ordinal_t target = INVALID_OUTPUT_ORDINAL;
+        for (output_ordinal_t i = 0; i < static_cast<output_ordinal_t>(outputs_.size());
+             ++i) {
+            if (!outputs_[i].active->load(std::memory_order_acquire) ||
+                (!input->binding.empty() &&
+                 input->binding.find(i) == input->binding.end()))
+                continue;
+            if (target == INVALID_OUTPUT_ORDINAL || counts[i] < counts[target])
+                target = i;
+        }
+        if (target == INVALID_OUTPUT_ORDINAL)
+            target = input->binding.empty() ? 0 : *input->binding.begin();
+        ++counts[target];
+        input_queue_t &queue = *outputs_[target].ready_queue;
+        if (input->blocked_time > 0)
+            ++queue.num_blocked;
+        queue.queue.push(input);
+    }
+    for (auto &output : outputs_)
+        update_queue_hints(*output.ready_queue);
+    if (for_output != INVALID_OUTPUT_ORDINAL)
+        ++outputs_[for_output].stats[memtrace_stream_t::SCHED_STAT_RUNQUEUE_REBALANCES];
+}
+
 template <typename RecordType, typename ReaderType>
 bool
 scheduler_tmpl_t<RecordType, ReaderType>::syscall_incurs_switch(input_info_t *input,
@@ -2200,10 +2620,8 @@ scheduler_tmpl_t<RecordType, ReaderType>::set_cur_input(output_ordinal_t output,
     // 'input' might be INVALID_INPUT_ORDINAL.
     assert(input < static_cast<input_ordinal_t>(inputs_.size()));
     int prev_input = outputs_[output].cur_input;
+    outputs_[output].switch_deferred = false;
     if (prev_input >= 0) {
-        if (options_.mapping == MAP_TO_ANY_OUTPUT && prev_input != input &&
-            !inputs_[prev_input].at_eof)
-            add_to_ready_queue(&inputs_[prev_input]);
         if (prev_input != input && options_.schedule_record_ostream != nullptr) {
             input_info_t &prev_info = inputs_[prev_input];
             std::lock_guard<std::mutex> lock(*prev_info.lock);
@@ -2212,6 +2630,11 @@ scheduler_tmpl_t<RecordType, ReaderType>::set_cur_input(output_ordinal_t output,
             if (status != sched_type_t::STATUS_OK)
                 return status;
         }
+        // We add to the ready queue only once we are done with the input, as with
+        // per-output queues another output may pick it up immediately.
+        if (options_.mapping == MAP_TO_ANY_OUTPUT && prev_input != input &&
+            !inputs_[prev_input].at_eof)
+            add_to_ready_queue(output, &inputs_[prev_input]);
     } else if (options_.schedule_record_ostream != nullptr &&
                outputs_[output].record.back().type == schedule_record_t::IDLE) {
         input_info_t unused;
@@ -2235,6 +2658,11 @@ scheduler_tmpl_t<RecordType, ReaderType>::set_cur_input(output_ordinal_t output,
 
     std::lock_guard<std::mutex> lock(*inputs_[input].lock);
 
+    if (inputs_[input].prev_output != INVALID_OUTPUT_ORDINAL &&
+        inputs_[input].prev_output != output)
+        ++outputs_[output].stats[memtrace_stream_t::SCHED_STAT_MIGRATIONS];
+    inputs_[input].prev_output = output;
+
     if (prev_input < 0 && outputs_[output].stream->filetype_ == 0) {
         // Set the version and filetype up front, to let the user query at init time
         // as documented.
@@ -2435,9 +2863,10 @@ scheduler_tmpl_t<RecordType, ReaderType>::pick_next_input(output_ordinal_t outpu
                                                           uint64_t blocked_time)
 {
     sched_type_t::stream_status_t res = sched_type_t::STATUS_OK;
-    bool need_lock =
-        options_.mapping == MAP_TO_ANY_OUTPUT || options_.mapping == MAP_AS_PREVIOUSLY;
-    auto scoped_lock = need_lock ? std::unique_lock<std::mutex>(sched_lock_)
+    // With per-output ready queues, each queue has its own lock instead.
+    bool need_lock = options_.mapping == MAP_AS_PREVIOUSLY ||
+        (options_.mapping == MAP_TO_ANY_OUTPUT && !options_.per_output_ready_queues);
+    auto scoped_lock = need_lock ? acquire_scheduler_lock(output, sched_lock_)
                                  : std::unique_lock<std::mutex>();
     input_ordinal_t prev_index = outputs_[output].cur_input;
     input_ordinal_t index = INVALID_INPUT_ORDINAL;
@@ -2490,10 +2919,9 @@ scheduler_tmpl_t<RecordType, ReaderType>::pick_next_input(output_ordinal_t outpu
                     inputs_[prev_index].switch_to_input = INVALID_INPUT_ORDINAL;
                     // XXX i#5843: Add an invariant check that the next timestamp of the
                     // target is later than the pre-switch-syscall timestamp?
-                    if (ready_priority_.find(target)) {
+                    if (remove_from_ready_queue(output, target)) {
                         VPRINT(this, 2, "next_record[%d]: direct switch to input %d\n",
                                output, target->index);
-                        ready_priority_.erase(target);
                         index = target->index;
                         // Erase any remaining wait time for the target.
                         if (target->blocked_time > 0) {
@@ -2501,7 +2929,6 @@ scheduler_tmpl_t<RecordType, ReaderType>::pick_next_input(output_ordinal_t outpu
                                    "next_record[%d]: direct switch erasing blocked time "
                                    "for input %d\n",
                                    output, target->index);
-                            --num_blocked_;
                             target->blocked_time = 0;
                         }
                     } else {
@@ -2619,7 +3046,8 @@ typename scheduler_tmpl_t<RecordType, ReaderType>::stream_status_t
 scheduler_tmpl_t<RecordType, ReaderType>::next_record(output_ordinal_t output,
                                                       RecordType &record,
                                                       input_info_t *&input,
-                                                      uint64_t cur_time)
+                                                      uint64_t cur_time,
+                                                      bool stop_at_switch)
 {
     // We do not enforce a globally increasing time to avoid the synchronization cost; we
     // do return an error on a time smaller than an input's current start time when we
@@ -2631,7 +3059,7 @@ scheduler_tmpl_t<RecordType, ReaderType>::next_record(output_ordinal_t output,
         cur_time = get_time_micros();
     }
     outputs_[output].cur_time = cur_time; // Invalid values are checked below.
-    if (!outputs_[output].active)
+    if (!outputs_[output].active->load(std::memory_order_acquire))
         return sched_type_t::STATUS_IDLE;
     if (outputs_[output].waiting) {
         if (options_.mapping == MAP_AS_PREVIOUSLY &&
@@ -2705,6 +3133,11 @@ scheduler_tmpl_t<RecordType, ReaderType>::next_record(output_ordinal_t output,
                 input->needs_advance = true;
             }
             if (input->at_eof || *input->reader == *input->reader_end) {
+                if (stop_at_switch) {
+                    // We will come back here on the next call.
+                    input->needs_advance = false;
+                    return sched_type_t::STATUS_SKIPPED;
+                }
                 if (!input->at_eof)
                     mark_input_eof(*input);
                 lock.unlock();
@@ -2732,7 +3165,16 @@ scheduler_tmpl_t<RecordType, ReaderType>::next_record(output_ordinal_t output,
         bool preempt = false;
         uint64_t blocked_time = 0;
         uint64_t prev_time_in_quantum = 0;
-        if (options_.mapping == MAP_AS_PREVIOUSLY) {
+        if (outputs_[output].switch_deferred) {
+            // Complete the switch we deferred to end the prior batch on the record we
+            // queued then.
+            VPRINT(this, 5, "next_record[%d]: resuming deferred switch\n", output);
+            outputs_[output].switch_deferred = false;
+            need_new_input = true;
+            preempt = outputs_[output].deferred_preempt;
+            blocked_time = outputs_[output].deferred_blocked_time;
+            prev_time_in_quantum = cur_time - outputs_[output].deferred_quantum_time;
+        } else if (options_.mapping == MAP_AS_PREVIOUSLY) {
             assert(outputs_[output].record_index >= 0);
             if (outputs_[output].record_index >=
                 static_cast<int>(outputs_[output].record.size())) {
@@ -2902,6 +3344,18 @@ scheduler_tmpl_t<RecordType, ReaderType>::next_record(output_ordinal_t output,
             options_.mapping != MAP_TO_ANY_OUTPUT &&
             record_type_is_timestamp(record, input->next_timestamp))
             need_new_input = true;
+        if (need_new_input && stop_at_switch) {
+            // End the caller's batch here: the candidate record is re-read and the
+            // switch completed on the next call.
+            VPRINT(this, 5, "next_record[%d]: deferring switch (cur=%d)\n", output,
+                   outputs_[output].cur_input);
+            input->queue.push_front(record);
+            outputs_[output].switch_deferred = true;
+            outputs_[output].deferred_preempt = preempt;
+            outputs_[output].deferred_blocked_time = blocked_time;
+            outputs_[output].deferred_quantum_time = cur_time - prev_time_in_quantum;
+            return sched_type_t::STATUS_SKIPPED;
+        }
         if (need_new_input) {
             int prev_input = outputs_[output].cur_input;
             VPRINT(this, 5, "next_record[%d]: need new input (cur=%d)\n", output,
@@ -3110,12 +3564,14 @@ scheduler_tmpl_t<RecordType, ReaderType>::set_output_active(output_ordinal_t out
 {
     if (options_.mapping != MAP_TO_ANY_OUTPUT)
         return sched_type_t::STATUS_INVALID;
-    if (outputs_[output].active == active)
+    if (outputs_[output].active->load(std::memory_order_acquire) == active)
         return sched_type_t::STATUS_OK;
-    outputs_[output].active = active;
+    outputs_[output].active->store(active, std::memory_order_release);
     VPRINT(this, 2, "Output stream %d is now %s\n", output,
            active ? "active" : "inactive");
-    std::lock_guard<std::mutex> guard(sched_lock_);
+    auto scoped_lock = options_.per_output_ready_queues
+        ? std::unique_lock<std::mutex>()
+        : acquire_scheduler_lock(output, sched_lock_);
     if (!active) {
         // Make the now-inactive output's input available for other cores.
         // This will reset its quantum too.
@@ -3124,6 +3580,10 @@ scheduler_tmpl_t<RecordType, ReaderType>::set_output_active(output_ordinal_t out
         if (inputs_[outputs_[output].cur_input].queue.empty())
             inputs_[outputs_[output].cur_input].switching_pre_instruction = true;
         set_cur_input(output, INVALID_INPUT_ORDINAL);
+        if (options_.per_output_ready_queues) {
+            // Hand the inputs waiting on this output's queue to the active outputs.
+            rebalance_queues(output);
+        }
     } else {
         outputs_[output].waiting = true;
     }
@@ -63,6 +63,7 @@
 #include "flexible_queue.h"
 #include "memref.h"
 #include "memtrace_stream.h"
+#include "read_ahead.h"
 #include "reader.h"
 #include "record_file_reader.h"
 #include "speculator.h"
@@ -482,6 +483,26 @@ public:
         SWITCH_PROCESS,
     };
 
+    /**
+     * Statistics on reading ahead for
+     * #dynamorio::drmemtrace::scheduler_tmpl_t::scheduler_options_t::
+     * read_ahead_threads, summed over all inputs.
+     * Retrievable via get_read_ahead_statistic().
+     */
+    enum read_ahead_statistic_t {
+        /** Microseconds outputs spent waiting for an input's data to be read. */
+        READ_AHEAD_STAT_CONSUMER_STALL_US,
+        /**
+         * Microseconds inputs spent with all their read-ahead buffers full, waiting
+         * for outputs to consume them.
+         */
+        READ_AHEAD_STAT_PRODUCER_STALL_US,
+        /** Count of read-ahead buffers filled. */
+        READ_AHEAD_STAT_BUFFERS_FILLED,
+        /** Count of statistic types. */
+        READ_AHEAD_STAT_TYPE_COUNT,
+    };
+
     /**
      * Collects the parameters specifying how the scheduler should behave, outside
      * of the workload inputs and the output count.
@@ -648,6 +669,51 @@ public:
          * are not removed from the trace).
          */
         bool honor_direct_switches = true;
+        /**
+         * If true, enables a mode for #MAP_TO_ANY_OUTPUT where each output stream has
+         * its own ready queue of inputs rather than all outputs sharing one global
+         * queue under one global lock.  An output whose queue has no runnable input
+         * steals one from another output's queue, respecting output bindings.
+         * Relative priorities are honored across all queues: an output will steal a
+         * higher-priority input from another queue rather than run a lower-priority
+         * input from its own queue.  Timestamp ordering (for #DEPENDENCY_TIMESTAMPS)
+         * and FIFO ordering among same-priority inputs are honored within each queue,
+         * and approximately across queues by periodically rebalancing the queues
+         * (see #rebalance_period).  This reduces lock contention among output
+         * threads when there are many outputs and short quanta.  Statistics on
+         * stealing, rebalancing, and lock contention are available via
+         * #dynamorio::drmemtrace::memtrace_stream_t::get_schedule_statistic().
+         */
+        bool per_output_ready_queues = false;
+        /**
+         * For #per_output_ready_queues, the period between rebalancing the ready queues
+         * across all outputs, in the units explained by #block_time_scale (either
+         * #QUANTUM_TIME simulator time or wall-clock microseconds for
+         * #QUANTUM_INSTRUCTIONS).  A rebalance redistributes all queued inputs in their
+         * global priority and timestamp order evenly among the active outputs.  A value
+         * of 0 disables periodic rebalancing.
+         */
+        uint64_t rebalance_period = 50000;
+        /**
+         * If non-zero, the number of background threads which read and decompress
+         * file inputs ahead of the outputs consuming them, overlapping decompression
+         * with analysis.  As each input file's decompression stream is sequential,
+         * this helps the most when there are at least as many inputs being actively
+         * read as threads.  Each input uses up to #read_ahead_depth times
+         * #read_ahead_buffer_size bytes of memory for its buffers.  Statistics on
+         * stalls are available via get_read_ahead_statistic().  A value of 0
+         * disables reading ahead.  This applies only to inputs the scheduler opens
+         * from paths; it does not apply to readers passed in by the user.
+         */
+        int read_ahead_threads = 0;
+        /**
+         * For #read_ahead_threads, the number of buffers read ahead for each input.
+         */
+        int read_ahead_depth = 4;
+        /**
+         * For #read_ahead_threads, the size in bytes of each read-ahead buffer.
+         */
+        uint64_t read_ahead_buffer_size = 1024 * 1024;
     };
 
     /**
@@ -722,6 +788,24 @@ public:
         virtual stream_status_t
         next_record(RecordType &record, uint64_t cur_time);
 
+        /**
+         * Advances by up to "max_records" records, storing them into "records" and
+         * their count into "num_records".  This avoids the per-record call overhead
+         * for consumers which need not examine this stream's state between records:
+         * the #memtrace_stream_t queries reflect the final record of the batch.  All
+         * records in a batch come from the same input, as a batch ends just before a
+         * context switch.  When #STATUS_OK is returned "num_records" is at least 1;
+         * otherwise it is 0, with a status encountered after the first record of a
+         * batch being returned by the subsequent call instead.  The "cur_time" is as
+         * for next_record(), with the same time used for every record in the batch.
+         * Finding the end of a batch may read one record ahead, so ordinal queries on
+         * the input stream (see get_input_stream_interface()) can be off by one until
+         * the next call, as with unread_last_record().
+         */
+        virtual stream_status_t
+        next_record_batch(RecordType *records, int max_records, int &num_records,
+                          uint64_t cur_time = 0);
+
         /**
          * Queues the last-read record returned by next_record() such that it will be
          * returned on the subsequent call to next_record() when this same input is
@@ -961,6 +1045,16 @@ public:
             return scheduler_->get_output_cpuid(ordinal_);
         }
 
+        /**
+         * Returns the number of output streams in the scheduler which owns this
+         * stream.
+         */
+        int
+        get_output_count() const override
+        {
+            return scheduler_->get_output_stream_count();
+        }
+
         /**
          * Returns the ordinal for the current
          * #dynamorio::drmemtrace::scheduler_tmpl_t::input_workload_t.
@@ -1038,7 +1132,23 @@ public:
             return scheduler_->is_record_kernel(ordinal_);
         }
 
+        /**
+         * Returns the value of the specified statistic for this output stream.
+         * The values for all output streams must be summed to obtain global counts.
+         */
+        int64_t
+        get_schedule_statistic(
+            memtrace_stream_t::schedule_statistic_t stat) const override
+        {
+            return scheduler_->get_statistic(ordinal_, stat);
+        }
+
     protected:
+        // Reads the next record and updates our memtrace_stream_t state.
+        // See the scheduler's next_record() for stop_at_switch.
+        stream_status_t
+        advance(RecordType &record, uint64_t cur_time, bool stop_at_switch);
+
         scheduler_tmpl_t<RecordType, ReaderType> *scheduler_ = nullptr;
         int ordinal_ = -1;
         // If max_ordinal_ >= 0, ordinal_ is incremented modulo max_ordinal_ at the start
@@ -1056,6 +1166,8 @@ public:
         uint64_t chunk_instr_count_ = 0;
         uint64_t page_size_ = 0;
         RecordType prev_record_ = {};
+        // A status deferred by next_record_batch().
+        stream_status_t pending_status_ = STATUS_OK;
 
         // Let the outer class update our state.
         friend class scheduler_tmpl_t<RecordType, ReaderType>;
@@ -1094,6 +1206,13 @@ public:
         return static_cast<input_ordinal_t>(inputs_.size());
     }
 
+    /** Returns the number of output streams. */
+    virtual int
+    get_output_stream_count() const
+    {
+        return static_cast<output_ordinal_t>(outputs_.size());
+    }
+
     /**
      * Returns the #dynamorio::drmemtrace::memtrace_stream_t interface for the
      * 'ordinal'-th input stream.
@@ -1133,6 +1252,15 @@ public:
         return error_string_;
     }
 
+    /**
+     * Returns the value of the specified statistic, or -1 if reading ahead was not
+     * enabled via
+     * #dynamorio::drmemtrace::scheduler_tmpl_t::scheduler_options_t::
+     * read_ahead_threads.
+     */
+    int64_t
+    get_read_ahead_statistic(read_ahead_statistic_t stat) const;
+
     /**
      * Writes out the recorded schedule.  Requires that
      * #dynamorio::drmemtrace::scheduler_tmpl_t::
@@ -1214,6 +1342,8 @@ protected:
         // Use for special kernel features where one thread specifies a target
         // thread to replace it.
         input_ordinal_t switch_to_input = INVALID_INPUT_ORDINAL;
+        // The output this input last ran on, used to identify migrations.
+        output_ordinal_t prev_output = INVALID_OUTPUT_ORDINAL;
         // Used to switch before we've read the next instruction.
         bool switching_pre_instruction = false;
         // Used for time-based quanta.
@@ -1225,6 +1355,51 @@ protected:
         uint64_t blocked_start_time = 0;
     };
 
+    // I tried using a lambda where we could capture "this" and so use int indices
+    // in the queues instead of pointers but hit problems (weird crash while running)
+    // so I'm sticking with this solution of a separate struct.
+    struct InputTimestampComparator {
+        bool
+        operator()(input_info_t *a, input_info_t *b) const
+        {
+            if (a->priority != b->priority)
+                return a->priority < b->priority; // Higher is better.
+            if (a->order_by_timestamp &&
+                (a->reader->get_last_timestamp() - a->base_timestamp) !=
+                    (b->reader->get_last_timestamp() - b->base_timestamp)) {
+                // Lower is better.
+                return (a->reader->get_last_timestamp() - a->base_timestamp) >
+                    (b->reader->get_last_timestamp() - b->base_timestamp);
+            }
+            // We use a counter to provide FIFO order for same-priority inputs.
+            return a->queue_counter > b->queue_counter; // Lower is better.
+        }
+    };
+
+    // A queue of inputs ready to be scheduled, sorted by priority and then timestamp if
+    // timestamp dependencies are requested.  We use the timestamp delta from the first
+    // observed timestamp in each workload in order to mix inputs from different
+    // workloads in the same queue.  FIFO ordering is used for same-priority entries.
+    struct input_queue_t {
+        explicit input_queue_t(int rand_seed = 0)
+            : queue(rand_seed)
+        {
+        }
+        // Protects the fields below for per_output_ready_queues.  The single global
+        // queue is instead protected by sched_lock_ and does not use this lock.
+        std::mutex lock;
+        flexible_queue_t<input_info_t *, InputTimestampComparator> queue;
+        // Tracks the count of blocked inputs in the queue.
+        int num_blocked = 0;
+        // These mirror the queue size and the priority of the top entry (which is
+        // the highest priority in the queue) for other outputs to examine without
+        // acquiring the lock.  They are updated while holding the lock.
+        std::atomic<int> size_hint { 0 };
+        // Wrap min in parens to work around Visual Studio compiler issues with the
+        // min macro (even despite NOMINMAX defined above).
+        std::atomic<int> top_priority_hint { (std::numeric_limits<int>::min)() };
+    };
+
     // Format for recording a schedule to disk.  A separate sequence of these records
     // is stored per output stream; each output stream's sequence is in one component
     // (subfile) of an archive file.
@@ -1299,6 +1474,8 @@ protected:
             , stream(&self_stream)
             , speculator(speculator_flags, verbosity)
             , last_record(last_record_init)
+            , active(new std::atomic<bool>(true))
+            , ready_queue(new input_queue_t(ordinal))
         {
         }
         stream_t self_stream;
@@ -1329,10 +1506,18 @@ protected:
         std::vector<schedule_record_t> record;
         int record_index = 0;
         bool waiting = false; // Waiting or idling.
-        bool active = true;
+        // This is examined by other outputs when choosing where to place inputs.
+        // It is indirected so that output_info_t remains movable for vector storage.
+        std::unique_ptr<std::atomic<bool>> active;
         bool in_kernel_code = false;
         bool in_context_switch_code = false;
         bool hit_switch_code_end = false;
+        // Set when next_record() ended a batch rather than switching away from
+        // cur_input, whose queue then holds the candidate record at its front.
+        bool switch_deferred = false;
+        bool deferred_preempt = false;
+        uint64_t deferred_blocked_time = 0;
+        uint64_t deferred_quantum_time = 0;
         // Used for time-based quanta.
         uint64_t cur_time = 0;
         // Used for MAP_TO_RECORDED_OUTPUT get_output_cpuid().
@@ -1341,6 +1526,12 @@ protected:
         bool at_eof = false;
         // Used for replaying wait periods.
         uint64_t wait_start_time = 0;
+        // This output's own ready queue for per_output_ready_queues.
+        // It is indirected so that output_info_t remains movable for vector storage.
+        std::unique_ptr<input_queue_t> ready_queue;
+        // Values for get_schedule_statistic().  These are only updated by the thread
+        // owning this output.
+        int64_t stats[memtrace_stream_t::SCHED_STAT_TYPE_COUNT] = {};
     };
 
     // Used for reading as-traced schedules.
@@ -1406,14 +1597,25 @@ protected:
     std::unique_ptr<ReaderType>
     get_default_reader();
 
+    // Turns on reading ahead for a newly created file reader if requested.
+    template <typename T>
+    T *
+    with_read_ahead(T *reader)
+    {
+        if (read_ahead_pool_)
+            reader->set_read_ahead(read_ahead_pool_, read_ahead_options_);
+        return reader;
+    }
+
     // Creates a reader for the specific file type at (non-directory) 'path'.
     std::unique_ptr<ReaderType>
     get_reader(const std::string &path, int verbosity);
 
-    // Advances the 'output_ordinal'-th output stream.
+    // Advances the 'output_ordinal'-th output stream.  If stop_at_switch is true,
+    // returns STATUS_SKIPPED instead of switching to another input.
     stream_status_t
     next_record(output_ordinal_t output, RecordType &record, input_info_t *&input,
-                uint64_t cur_time = 0);
+                uint64_t cur_time = 0, bool stop_at_switch = false);
 
     // Undoes the last read.  May only be called once between next_record() calls.
     // Is not supported during speculation nor prior to speculation with queueing,
@@ -1621,49 +1823,88 @@ protected:
     // to kernel execution.
     bool
     is_record_kernel(output_ordinal_t output);
+
+    // Returns the value of the given statistic for the 'output_ordinal'-th output
+    // stream.
+    int64_t
+    get_statistic(output_ordinal_t output,
+                  memtrace_stream_t::schedule_statistic_t stat) const;
+
+    // Acquires 'lock' on behalf of 'for_output', which may be INVALID_OUTPUT_ORDINAL,
+    // recording whether it was contended.
+    std::unique_lock<std::mutex>
+    acquire_scheduler_lock(output_ordinal_t for_output, std::mutex &lock);
     ///////////////////////////////////////////////////////////////////////////
     // Support for ready queues for who to schedule next:
 
-    // I tried using a lambda where we could capture "this" and so use int indices
-    // in the queues instead of pointers but hit problems (weird crash while running)
-    // so I'm sticking with this solution of a separate struct.
-    struct InputTimestampComparator {
-        bool
-        operator()(input_info_t *a, input_info_t *b) const
-        {
-            if (a->priority != b->priority)
-                return a->priority < b->priority; // Higher is better.
-            if (a->order_by_timestamp &&
-                (a->reader->get_last_timestamp() - a->base_timestamp) !=
-                    (b->reader->get_last_timestamp() - b->base_timestamp)) {
-                // Lower is better.
-                return (a->reader->get_last_timestamp() - a->base_timestamp) >
-                    (b->reader->get_last_timestamp() - b->base_timestamp);
-            }
-            // We use a counter to provide FIFO order for same-priority inputs.
-            return a->queue_counter > b->queue_counter; // Lower is better.
-        }
-    };
+    // Returns the queue that 'output' pulls inputs from.
+    input_queue_t &
+    get_ready_queue(output_ordinal_t output);
 
-    // sched_lock_ must be held by the caller.
+    // For per_output_ready_queues, acquires the lock for 'queue'.  For the
+    // global queue, returns an empty lock, as sched_lock_ must instead be held by
+    // the caller.
+    std::unique_lock<std::mutex>
+    lock_ready_queue(output_ordinal_t for_output, input_queue_t &queue);
+
+    // For the global queue, sched_lock_ must be held by the caller.
     bool
     ready_queue_empty();
 
-    // sched_lock_ must be held by the caller.
+    // Adds 'input' to the queue of 'for_output', which is typically the output the
+    // input last ran on, or if that output cannot accept it to some other output's
+    // queue for per_output_ready_queues.  'for_output' may be INVALID_OUTPUT_ORDINAL.
+    // For the global queue, sched_lock_ must be held by the caller.
+    void
+    add_to_ready_queue(output_ordinal_t for_output, input_info_t *input);
+
+    // The queue's lock (or sched_lock_ for the global queue) must be held by the
+    // caller.
     void
-    add_to_ready_queue(input_info_t *input);
+    add_to_ready_queue_hold_locks(input_queue_t &queue, input_info_t *input);
+
+    // The queue's lock (or sched_lock_ for the global queue) must be held by the
+    // caller.  Updates the lock-free hints after the queue is modified.
+    void
+    update_queue_hints(input_queue_t &queue);
+
+    // Removes 'input' from whichever ready queue holds it.  Returns whether it was
+    // found.  For the global queue, sched_lock_ must be held by the caller.
+    bool
+    remove_from_ready_queue(output_ordinal_t for_output, input_info_t *input);
 
     // The input's lock must be held by the caller.
     // Returns a multiplier for how long the input should be considered blocked.
     bool
     syscall_incurs_switch(input_info_t *input, uint64_t &blocked_time);
 
-    // sched_lock_ must be held by the caller.
+    // For the global queue, sched_lock_ must be held by the caller.
     // "for_output" is which output stream is looking for a new input; only an
     // input which is able to run on that output will be selected.
+    // For per_output_ready_queues, if the output's own queue has no suitable input,
+    // or another queue holds a higher-priority input, an input is stolen from
+    // another output's queue.
     stream_status_t
     pop_from_ready_queue(output_ordinal_t for_output, input_info_t *&new_input);
 
+    // Helper for pop_from_ready_queue() which pops from one particular queue.
+    // No queue lock can be held on entry.  Only inputs with a priority of at
+    // least 'min_priority' are considered.  Sets 'saw_blocked' if any candidate
+    // input was skipped because it was blocked.
+    void
+    pop_from_one_queue(output_ordinal_t for_output, input_queue_t &queue,
+                       int min_priority, input_info_t *&new_input, bool &saw_blocked);
+
+    // For per_output_ready_queues, calls rebalance_queues() if rebalance_period has
+    // elapsed since the last rebalance.  No queue lock can be held on entry.
+    void
+    rebalance_queues_if_due(output_ordinal_t for_output);
+
+    // For per_output_ready_queues, redistributes all queued inputs evenly among the
+    // active outputs, honoring bindings.  No queue lock can be held on entry.
+    void
+    rebalance_queues(output_ordinal_t for_output);
+
     ///
     ///////////////////////////////////////////////////////////////////////////
 
@@ -1672,6 +1913,10 @@ protected:
     const char *output_prefix_ = "[scheduler]";
     std::string error_string_;
     scheduler_options_t options_;
+    // Shared by the readers of all inputs for read_ahead_threads.  Each reader
+    // holds a reference, so this outlives any reader handed back to the user.
+    std::shared_ptr<read_ahead_pool_t> read_ahead_pool_;
+    read_ahead_options_t read_ahead_options_;
     // Each vector element has a mutex which should be held when accessing its fields.
     std::vector<input_info_t> inputs_;
     // Each vector element is accessed only by its owning thread, except the
@@ -1679,18 +1924,22 @@ protected:
     std::vector<output_info_t> outputs_;
     // We use a central lock for global scheduling.  We assume the synchronization
     // cost is outweighed by the simulator's overhead.  This protects concurrent
-    // access to inputs_.size(), outputs_.size(), ready_priority_, and
-    // ready_counter_.
+    // access to inputs_.size(), outputs_.size(), and ready_priority_.
+    // For per_output_ready_queues, this lock is not used for MAP_TO_ANY_OUTPUT
+    // scheduling decisions: each output's ready_queue has its own lock instead.
     std::mutex sched_lock_;
-    // Inputs ready to be scheduled, sorted by priority and then timestamp if timestamp
-    // dependencies are requested.  We use the timestamp delta from the first observed
-    // timestamp in each workload in order to mix inputs from different workloads in the
-    // same queue.  FIFO ordering is used for same-priority entries.
-    flexible_queue_t<input_info_t *, InputTimestampComparator> ready_priority_;
-    // Trackes the count of blocked inputs.  Protected by sched_lock_.
-    int num_blocked_ = 0;
+    // The global queue of inputs ready to be scheduled, used unless
+    // per_output_ready_queues is set.
+    input_queue_t ready_priority_;
     // Global ready queue counter used to provide FIFO for same-priority inputs.
-    uint64_t ready_counter_ = 0;
+    // This is shared among all queues for per_output_ready_queues so that FIFO order
+    // is preserved when inputs move between queues.
+    std::atomic<uint64_t> ready_counter_ { 0 };
+    // For per_output_ready_queues, the output time of the last rebalance.
+    std::atomic<uint64_t> last_rebalance_time_ { 0 };
+    // For per_output_ready_queues, used to spread inputs placed without an
+    // eligible originating output.
+    std::atomic<int> next_queue_placement_ { 0 };
     // Count of inputs not yet at eof.
     std::atomic<int> live_input_count_;
     // In replay mode, count of outputs not yet at the end of the replay sequence.
@@ -71,7 +71,7 @@ cache_fifo_t::init(int associativity, int block_size, int total_size,
     // Create a replacement pointer for each set, and
     // initialize it to point to the first block.
     for (int i = 0; i < blocks_per_way_; i++) {
-        get_caching_device_block(i * associativity_, 0).counter_ = 1;
+        counters_[i * associativity_] = 1;
     }
     return true;
 }
@@ -93,10 +93,9 @@ cache_fifo_t::replace_which_way(int block_idx)
 {
     int victim_way = get_next_way_to_replace(block_idx);
     // clear the counter of the victim block
-    get_caching_device_block(block_idx, victim_way).counter_ = 0;
+    counters_[block_idx + victim_way] = 0;
     // set the next block as victim
-    get_caching_device_block(block_idx, (victim_way + 1) & (associativity_ - 1))
-        .counter_ = 1;
+    counters_[block_idx + ((victim_way + 1) & (associativity_ - 1))] = 1;
     return victim_way;
 }
 
@@ -105,9 +104,10 @@ cache_fifo_t::replace_which_way(int block_idx)
 int
 cache_fifo_t::get_next_way_to_replace(const int block_idx) const
 {
+    const int *set_counters = &counters_[block_idx];
     for (int i = 0; i < associativity_; i++) {
         // We return the block whose counter is 1.
-        if (get_caching_device_block(block_idx, i).counter_ == 1) {
+        if (set_counters[i] == 1) {
             return i;
         }
     }
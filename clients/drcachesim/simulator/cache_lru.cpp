@@ -68,7 +68,7 @@ cache_lru_t::init(int associativity, int block_size, int total_size,
     // Initialize line counters with 0, 1, 2, ..., associativity - 1.
     for (int i = 0; i < blocks_per_way_; i++) {
         for (int way = 0; way < associativity_; ++way) {
-            get_caching_device_block(i * associativity_, way).counter_ = way;
+            counters_[i * associativity_ + way] = way;
         }
     }
     return true;
@@ -77,17 +77,18 @@ cache_lru_t::init(int associativity, int block_size, int total_size,
 void
 cache_lru_t::access_update(int block_idx, int way)
 {
-    int cnt = get_caching_device_block(block_idx, way).counter_;
+    int *set_counters = &counters_[block_idx];
+    int cnt = set_counters[way];
     // Optimization: return early if it is a repeated access.
     if (cnt == 0)
         return;
-    // We inc all the counters that are not larger than cnt for LRU.
-    for (int i = 0; i < associativity_; ++i) {
-        if (i != way && get_caching_device_block(block_idx, i).counter_ <= cnt)
-            get_caching_device_block(block_idx, i).counter_++;
-    }
+    // We inc all the counters that are not larger than cnt for LRU.  Including
+    // "way" itself, which we clear below, keeps the loop branch-free so the
+    // compiler can vectorize it.
+    for (int i = 0; i < associativity_; ++i)
+        set_counters[i] += set_counters[i] <= cnt;
     // Clear the counter for LRU.
-    get_caching_device_block(block_idx, way).counter_ = 0;
+    set_counters[way] = 0;
 }
 
 int
@@ -100,15 +101,17 @@ int
 cache_lru_t::get_next_way_to_replace(int block_idx) const
 {
     // We implement LRU by picking the slot with the largest counter value.
+    const addr_t *set_tags = &tags_[block_idx];
+    const int *set_counters = &counters_[block_idx];
     int max_counter = 0;
     int max_way = 0;
     for (int way = 0; way < associativity_; ++way) {
-        if (get_caching_device_block(block_idx, way).tag_ == TAG_INVALID) {
+        if (set_tags[way] == TAG_INVALID) {
             max_way = way;
             break;
         }
-        if (get_caching_device_block(block_idx, way).counter_ > max_counter) {
-            max_counter = get_caching_device_block(block_idx, way).counter_;
+        if (set_counters[way] > max_counter) {
+            max_counter = set_counters[way];
             max_way = way;
         }
     }
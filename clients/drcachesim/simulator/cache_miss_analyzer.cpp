@@ -161,6 +161,9 @@ cache_miss_analyzer_t::cache_miss_analyzer_t(const cache_simulator_knobs_t &knob
     if (!success_) {
         return;
     }
+    // The per-pc miss statistics below are not supported by the sliced LLC
+    // used in parallel mode.
+    knobs_.parallel = false;
     bool warmup_enabled_ = (knobs.warmup_refs > 0 || knobs.warmup_fraction > 0.0);
 
     delete llcaches_["LL"]->get_stats();
@@ -35,11 +35,16 @@
 #include <stddef.h>
 #include <stdint.h> /* for supporting 64-bit integers*/
 
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -58,6 +63,7 @@
 #include "caching_device.h"
 #include "caching_device_stats.h"
 #include "prefetcher.h"
+#include "shared_cache_proxy.h"
 #include "simulator.h"
 #include "snoop_filter.h"
 #include "utils.h"
@@ -416,6 +422,10 @@ cache_simulator_t::~cache_simulator_t()
     if (snoop_filter_ != NULL) {
         delete snoop_filter_;
     }
+    for (cache_t *slice : llc_slices_) {
+        delete slice->get_stats();
+        delete slice;
+    }
 }
 
 uint64_t
@@ -424,6 +434,447 @@ cache_simulator_t::remaining_sim_refs() const
     return knobs_.sim_refs;
 }
 
+std::string
+cache_simulator_t::initialize_shard_type(shard_type_t shard_type)
+{
+    std::string error = simulator_t::initialize_shard_type(shard_type);
+    if (!error.empty())
+        return error;
+    // The analyzer provides no serial stream when it runs us in parallel.
+    if (!knobs_.parallel || serial_stream_ != nullptr)
+        return "";
+    if (shard_type != SHARD_BY_CORE)
+        return "Usage error: -cache_parallel requires -core_sharded";
+    error = init_parallel();
+    if (!error.empty())
+        return "Usage error: -cache_parallel " + error;
+    parallel_ = true;
+    return "";
+}
+
+bool
+cache_simulator_t::parallel_shard_supported()
+{
+    // The shard type is not known yet: initialize_shard_type() rejects
+    // anything but SHARD_BY_CORE.
+    return knobs_.parallel;
+}
+
+std::string
+cache_simulator_t::init_parallel()
+{
+    if (knobs_.skip_refs > 0 || knobs_.warmup_refs > 0 || knobs_.warmup_fraction > 0.0 ||
+        knobs_.sim_refs != cache_simulator_knobs_t().sim_refs) {
+        return "does not support -skip_refs, -warmup_refs, -warmup_fraction, or "
+               "-sim_refs";
+    }
+    if (knobs_.cpu_scheduling || knobs_.use_physical)
+        return "does not support -cpu_scheduling or -use_physical";
+
+    // Find which cores each cache serves.
+    std::unordered_map<caching_device_t *, std::set<int>> cache_cores;
+    for (unsigned int i = 0; i < knobs_.num_cores; i++) {
+        for (caching_device_t *cache = l1_icaches_[i]; cache != nullptr;
+             cache = cache->get_parent())
+            cache_cores[cache].insert(i);
+        for (caching_device_t *cache = l1_dcaches_[i]; cache != nullptr;
+             cache = cache->get_parent())
+            cache_cores[cache].insert(i);
+    }
+    for (auto &caches_it : all_caches_) {
+        cache_t *cache = caches_it.second;
+        if (cache_cores[cache].size() <= 1)
+            continue;
+        if (shared_llc_ != nullptr)
+            return "supports only one cache shared by multiple cores";
+        if (cache->get_parent() != nullptr)
+            return "requires the shared cache to be the last level";
+        if (cache->get_prefetcher() != nullptr)
+            return "does not support a prefetcher on the shared cache";
+        if (cache->get_stats()->dumps_misses())
+            return "does not support a miss file for the shared cache";
+        shared_llc_ = cache;
+    }
+
+    // The private caches below the shared cache and the snooped caches talk to
+    // the shared level through proxies.  We visit them in core order to keep
+    // the setup deterministic.
+    std::unordered_set<caching_device_t *> snooped;
+    if (snoop_filter_ != nullptr) {
+        for (int i = 0; i < snoop_filter_->get_num_snooped_caches(); i++)
+            snooped.insert(snooped_caches_[i]);
+    }
+    std::vector<std::pair<caching_device_t *, int>> boundary;
+    std::unordered_set<caching_device_t *> visited;
+    for (unsigned int i = 0; i < knobs_.num_cores; i++) {
+        for (caching_device_t *l1 : { static_cast<caching_device_t *>(l1_icaches_[i]),
+                                      static_cast<caching_device_t *>(l1_dcaches_[i]) }) {
+            for (caching_device_t *cache = l1;
+                 cache != nullptr && cache != shared_llc_ && visited.insert(cache).second;
+                 cache = cache->get_parent()) {
+                if ((shared_llc_ != nullptr && cache->get_parent() == shared_llc_) ||
+                    snooped.find(cache) != snooped.end())
+                    boundary.emplace_back(cache, i);
+            }
+        }
+    }
+
+    // Use at least as many slices as cores, if the shared cache has enough sets,
+    // so the replay at each epoch end can use every worker.
+    int num_slices = 1;
+    while (num_slices < static_cast<int>(knobs_.num_cores))
+        num_slices *= 2;
+    int shift = 0;
+    if (shared_llc_ != nullptr) {
+        int num_sets = shared_llc_->get_num_blocks() / shared_llc_->get_associativity();
+        while (num_slices > num_sets)
+            num_slices /= 2;
+        shift = compute_log2(num_sets / num_slices);
+    }
+    slicing_.num_slices = num_slices;
+    slicing_.shift = shift;
+    replay_order_.resize(num_slices);
+
+    parallel_cores_.resize(knobs_.num_cores);
+    for (unsigned int i = 0; i < knobs_.num_cores; i++) {
+        parallel_cores_[i].core = i;
+        parallel_cores_[i].log.reset(new shared_op_log_t(num_slices));
+        parallel_cores_[i].snoop_logger.reset(
+            new shared_snoop_logger_t(parallel_cores_[i].log.get(), &slicing_));
+    }
+    std::unordered_map<caching_device_t *, shared_cache_proxy_t *> cache2proxy;
+    for (auto &entry : boundary) {
+        parallel_core_t &core = parallel_cores_[entry.second];
+        proxies_.emplace_back(
+            new shared_cache_proxy_t(entry.first, core.log.get(), &slicing_));
+        shared_cache_proxy_t *proxy = proxies_.back().get();
+        if (!proxy->init_proxy(entry.first->get_block_size()))
+            return "failed to initialize a shared cache proxy";
+        core.proxies.push_back(proxy);
+        cache2proxy[entry.first] = proxy;
+    }
+
+    if (shared_llc_ != nullptr) {
+        std::vector<caching_device_t *> children;
+        for (caching_device_t *child : shared_llc_->get_children())
+            children.push_back(cache2proxy[child]);
+        cache_inclusion_policy_t inclusion_policy = shared_llc_->is_inclusive()
+            ? cache_inclusion_policy_t::INCLUSIVE
+            : (shared_llc_->is_exclusive() ? cache_inclusion_policy_t::EXCLUSIVE
+                                           : cache_inclusion_policy_t::NON_INC_NON_EXC);
+        int line_size = shared_llc_->get_block_size();
+        for (int i = 0; i < num_slices; i++) {
+            cache_t *slice =
+                create_cache(shared_llc_->get_name() + "." + std::to_string(i),
+                             shared_llc_->get_replace_policy());
+            if (slice == nullptr)
+                return "failed to create the shared cache slices";
+            llc_slices_.push_back(slice);
+            if (!slice->init(shared_llc_->get_associativity(), line_size,
+                             shared_llc_->get_size_bytes() / num_slices, nullptr,
+                             new cache_stats_t(line_size, "", false,
+                                               shared_llc_->is_coherent()),
+                             nullptr, inclusion_policy, shared_llc_->is_coherent(), -1,
+                             nullptr, children))
+                return "failed to initialize the shared cache slices";
+            // Match the hashtable choice made for the full hierarchy.
+            if (other_caches_.size() > 0 &&
+                (knobs_.model_coherence || knobs_.num_cores >= 32))
+                slice->set_hashtable_use(true);
+        }
+    }
+
+    if (snoop_filter_ != nullptr) {
+        int num_snooped = static_cast<int>(snoop_filter_->get_num_snooped_caches());
+        snooped_proxies_.resize(num_snooped);
+        for (int i = 0; i < num_snooped; i++) {
+            auto it = cache2proxy.find(snooped_caches_[i]);
+            if (it == cache2proxy.end())
+                return "requires the snooped caches to be private";
+            snooped_proxies_[i] = it->second;
+        }
+        for (int i = 0; i < num_slices; i++) {
+            snoop_filter_slices_.emplace_back(new sliced_snoop_filter_t);
+            snoop_filter_slices_.back()->init(snooped_proxies_.data(), num_snooped);
+        }
+    }
+    return "";
+}
+
+void
+cache_simulator_t::install_parallel_hierarchy()
+{
+    for (parallel_core_t &core : parallel_cores_) {
+        for (shared_cache_proxy_t *proxy : core.proxies)
+            proxy->install(shared_llc_, snoop_filter_, core.snoop_logger.get());
+    }
+    hierarchy_installed_ = true;
+}
+
+void
+cache_simulator_t::uninstall_parallel_hierarchy()
+{
+    // Restore the original hierarchy and fold the statistics gathered by the
+    // proxies and slices into it, so results and get_cache_metric() look the same
+    // as for a serial run.  The stats objects are replaced so that a later
+    // install and uninstall does not count anything twice.
+    for (auto &proxy : proxies_) {
+        proxy->uninstall();
+        if (shared_llc_ != nullptr)
+            shared_llc_->get_stats()->merge(*proxy->get_stats());
+        delete proxy->get_stats();
+        proxy->set_stats(new cache_stats_t(proxy->get_block_size()));
+    }
+    for (cache_t *slice : llc_slices_) {
+        shared_llc_->get_stats()->merge(*slice->get_stats());
+        delete slice->get_stats();
+        slice->set_stats(new cache_stats_t(slice->get_block_size(), "", false,
+                                           slice->is_coherent()));
+    }
+    for (auto &filter : snoop_filter_slices_)
+        snoop_filter_->merge_stats(*filter);
+    hierarchy_installed_ = false;
+}
+
+void *
+cache_simulator_t::parallel_worker_init(int worker_index)
+{
+    // For SHARD_BY_CORE each worker handles the shard with its own index.
+    if (!parallel_ || worker_index < 0 ||
+        worker_index >= static_cast<int>(parallel_cores_.size()))
+        return nullptr;
+    return &parallel_cores_[worker_index];
+}
+
+std::string
+cache_simulator_t::parallel_worker_exit(void *worker_data)
+{
+    parallel_core_t *core = reinterpret_cast<parallel_core_t *>(worker_data);
+    if (core == nullptr)
+        return "";
+    if (core->registered) {
+        // In case parallel_shard_exit() was not called.
+        end_parallel_epoch(core, true);
+    } else {
+        // This worker never had any records for its core.
+        std::lock_guard<std::mutex> guard(sync_mutex_);
+        if (!core->exited)
+            retire_core(core);
+    }
+    return "";
+}
+
+void *
+cache_simulator_t::parallel_shard_init_stream(int shard_index, void *worker_data,
+                                              memtrace_stream_t *shard_stream)
+{
+    std::lock_guard<std::mutex> guard(sync_mutex_);
+    if (expected_cores_ < 0) {
+        // Cores the scheduler does not have will never show up.
+        expected_cores_ = static_cast<int>(parallel_cores_.size());
+        int outputs = shard_stream->get_output_count();
+        if (outputs > 0 && outputs < expected_cores_)
+            expected_cores_ = outputs;
+    }
+    // An out-of-range core is reported by parallel_shard_error(nullptr).
+    if (shard_index < 0 || shard_index >= expected_cores_)
+        return nullptr;
+    parallel_core_t *core = &parallel_cores_[shard_index];
+    core->stream = shard_stream;
+    // Track the cpuid<->ordinal relationship for our results printout.
+    int64_t cpu = shard_stream->get_output_cpuid();
+    if (cpu2core_.find(cpu) == cpu2core_.end())
+        cpu2core_[cpu] = shard_index;
+    if (!hierarchy_installed_)
+        install_parallel_hierarchy();
+    core->registered = true;
+    return core;
+}
+
+bool
+cache_simulator_t::parallel_shard_exit(void *shard_data)
+{
+    parallel_core_t *core = reinterpret_cast<parallel_core_t *>(shard_data);
+    if (core != nullptr)
+        end_parallel_epoch(core, true);
+    return true;
+}
+
+bool
+cache_simulator_t::parallel_shard_memref(void *shard_data, const memref_t &memref)
+{
+    parallel_core_t *core = reinterpret_cast<parallel_core_t *>(shard_data);
+    if (core == nullptr || core->exited)
+        return false;
+    if (memref.marker.type == TRACE_TYPE_MARKER) {
+        if (knobs_.verbose >= 3) {
+            std::cerr << "::" << memref.data.pid << "." << memref.data.tid << ":: "
+                      << "marker type " << memref.marker.marker_type << " value "
+                      << memref.marker.marker_value << "\n";
+        }
+    } else if (memref.exit.type == TRACE_TYPE_THREAD_EXIT) {
+        // Nothing to do when sharding by core.
+    } else if (!simulate_access(core->core, memref)) {
+        core->error = "Unhandled memref type " + std::to_string(memref.data.type);
+        // Retire so the other cores are not left waiting for us.
+        end_parallel_epoch(core, true);
+        return false;
+    }
+    // Markers count as well, including the idle and wait records, so every
+    // core keeps reaching epoch boundaries.
+    if (++core->log->position >= knobs_.parallel_epoch)
+        end_parallel_epoch(core, false);
+    return true;
+}
+
+std::string
+cache_simulator_t::parallel_shard_error(void *shard_data)
+{
+    parallel_core_t *core = reinterpret_cast<parallel_core_t *>(shard_data);
+    if (core == nullptr) {
+        return "Too-small core count " + std::to_string(knobs_.num_cores) +
+            " for the trace's cores";
+    }
+    return core->error;
+}
+
+int
+cache_simulator_t::remaining_cores() const
+{
+    int limit = expected_cores_ < 0 ? static_cast<int>(parallel_cores_.size())
+                                    : expected_cores_;
+    int count = 0;
+    for (int i = 0; i < limit; i++) {
+        if (!parallel_cores_[i].exited)
+            ++count;
+    }
+    return count;
+}
+
+void
+cache_simulator_t::retire_core(parallel_core_t *core)
+{
+    core->exited = true;
+    int remaining = remaining_cores();
+    if (remaining == 0) {
+        if (hierarchy_installed_)
+            uninstall_parallel_hierarchy();
+    } else if (arrived_cores_ > 0 && arrived_cores_ == remaining) {
+        // The rest were only waiting for us.
+        start_shared_replay();
+    }
+}
+
+void
+cache_simulator_t::end_parallel_epoch(parallel_core_t *core, bool exiting)
+{
+    std::unique_lock<std::mutex> lock(sync_mutex_);
+    if (core->exited)
+        return;
+    if (llc_slices_.empty() && snoop_filter_slices_.empty()) {
+        // Nothing is shared, so there is nothing to synchronize.
+        core->log->position = 0;
+    } else {
+        ++arrived_cores_;
+        uint64_t started = epochs_started_;
+        if (arrived_cores_ == remaining_cores())
+            start_shared_replay();
+        else
+            sync_cond_.wait(lock, [&] { return epochs_started_ != started; });
+        uint64_t finished = epochs_finished_;
+        lock.unlock();
+        int slice;
+        while ((slice = next_slice_.fetch_add(1)) < slicing_.num_slices)
+            replay_shared_slice(slice);
+        lock.lock();
+        if (++replay_finished_ == replay_workers_)
+            finish_shared_replay();
+        else
+            sync_cond_.wait(lock, [&] { return epochs_finished_ != finished; });
+        // Only we touch our own caches and log from here until we next arrive.
+        lock.unlock();
+        for (shared_cache_proxy_t *proxy : core->proxies)
+            proxy->apply_pending_invalidations();
+        core->log->clear();
+        lock.lock();
+    }
+    if (exiting)
+        retire_core(core);
+}
+
+void
+cache_simulator_t::start_shared_replay()
+{
+    replaying_ = true;
+    replay_workers_ = arrived_cores_;
+    replay_finished_ = 0;
+    arrived_cores_ = 0;
+    next_slice_.store(0);
+    ++epochs_started_;
+    sync_cond_.notify_all();
+}
+
+void
+cache_simulator_t::finish_shared_replay()
+{
+    // Retired cores cannot apply their own invalidations.
+    for (parallel_core_t &core : parallel_cores_) {
+        if (!core.exited)
+            continue;
+        for (shared_cache_proxy_t *proxy : core.proxies)
+            proxy->apply_pending_invalidations();
+    }
+    replaying_ = false;
+    ++epochs_finished_;
+    sync_cond_.notify_all();
+}
+
+void
+cache_simulator_t::replay_shared_slice(int slice)
+{
+    // Each core's log is already in order.  A stable sort on the record position
+    // interleaves the cores deterministically, breaking ties by core.
+    std::vector<const shared_op_t *> &order = replay_order_[slice];
+    order.clear();
+    for (const parallel_core_t &core : parallel_cores_) {
+        for (const shared_op_t &op : core.log->ops[slice])
+            order.push_back(&op);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const shared_op_t *a, const shared_op_t *b) {
+                         return a->position < b->position;
+                     });
+    cache_t *llc = llc_slices_.empty() ? nullptr : llc_slices_[slice];
+    snoop_filter_t *snoop_filter =
+        snoop_filter_slices_.empty() ? nullptr : snoop_filter_slices_[slice].get();
+    for (const shared_op_t *op : order) {
+        switch (op->type) {
+        case SHARED_OP_REQUEST: llc->request(op->memref); break;
+        case SHARED_OP_PROPAGATE_EVICTION:
+            llc->propagate_eviction(op->tag, op->requester);
+            break;
+        case SHARED_OP_PROPAGATE_WRITE:
+            llc->propagate_write(op->tag, op->requester);
+            break;
+        case SHARED_OP_FLUSH:
+            if (op->owns_stats)
+                llc->flush(op->memref);
+            else {
+                // Only one slice counts a flush that spans several.
+                caching_device_stats_t *stats = llc->get_stats();
+                llc->set_stats(nullptr);
+                llc->flush(op->memref);
+                llc->set_stats(stats);
+            }
+            break;
+        case SHARED_OP_SNOOP: snoop_filter->snoop(op->tag, op->id, op->is_write); break;
+        case SHARED_OP_SNOOP_EVICTION:
+            snoop_filter->snoop_eviction(op->tag, op->id);
+            break;
+        }
+    }
+}
+
 bool
 cache_simulator_t::process_memref(const memref_t &memref)
 {
@@ -485,54 +936,13 @@ cache_simulator_t::process_memref(const memref_t &memref)
         simref = &phys_memref;
     }
 
-    if (type_is_instr(simref->instr.type) ||
-        simref->instr.type == TRACE_TYPE_PREFETCH_INSTR) {
-        if (knobs_.verbose >= 3) {
-            std::cerr << "::" << simref->data.pid << "." << simref->data.tid << ":: "
-                      << " @" << (void *)simref->instr.addr << " instr x"
-                      << simref->instr.size << "\n";
-        }
-        l1_icaches_[core_index]->request(*simref);
-    } else if (simref->data.type == TRACE_TYPE_READ ||
-               simref->data.type == TRACE_TYPE_WRITE ||
-               // We may potentially handle prefetches differently.
-               // TRACE_TYPE_PREFETCH_INSTR is handled above.
-               type_is_prefetch(simref->data.type)) {
-        if (knobs_.verbose >= 3) {
-            std::cerr << "::" << simref->data.pid << "." << simref->data.tid << ":: "
-                      << " @" << (void *)simref->data.pc << " "
-                      << trace_type_names[simref->data.type] << " "
-                      << (void *)simref->data.addr << " x" << simref->data.size << "\n";
-        }
-        l1_dcaches_[core_index]->request(*simref);
-    } else if (simref->flush.type == TRACE_TYPE_INSTR_FLUSH) {
-        if (knobs_.verbose >= 3) {
-            std::cerr << "::" << simref->data.pid << "." << simref->data.tid << ":: "
-                      << " @" << (void *)simref->data.pc << " iflush "
-                      << (void *)simref->data.addr << " x" << simref->data.size << "\n";
-        }
-        l1_icaches_[core_index]->flush(*simref);
-    } else if (simref->flush.type == TRACE_TYPE_DATA_FLUSH) {
-        if (knobs_.verbose >= 3) {
-            std::cerr << "::" << simref->data.pid << "." << simref->data.tid << ":: "
-                      << " @" << (void *)simref->data.pc << " dflush "
-                      << (void *)simref->data.addr << " x" << simref->data.size << "\n";
-        }
-        l1_dcaches_[core_index]->flush(*simref);
-    } else if (simref->exit.type == TRACE_TYPE_THREAD_EXIT) {
+    if (simref->exit.type == TRACE_TYPE_THREAD_EXIT) {
         handle_thread_exit(simref->exit.tid);
         last_thread_ = 0;
     } else if (memref.marker.type == TRACE_TYPE_MARKER &&
                memref.marker.marker_type == TRACE_MARKER_TYPE_CPU_ID) {
         last_thread_ = 0;
-    } else if (simref->marker.type == TRACE_TYPE_INSTR_NO_FETCH) {
-        // Just ignore.
-        if (knobs_.verbose >= 3) {
-            std::cerr << "::" << simref->data.pid << "." << simref->data.tid << ":: "
-                      << " @" << (void *)simref->instr.addr << " non-fetched instr x"
-                      << simref->instr.size << "\n";
-        }
-    } else {
+    } else if (!simulate_access(core_index, *simref)) {
         error_string_ = "Unhandled memref type " + std::to_string(simref->data.type);
         return false;
     }
@@ -553,6 +963,55 @@ cache_simulator_t::process_memref(const memref_t &memref)
     return true;
 }
 
+bool
+cache_simulator_t::simulate_access(int core_index, const memref_t &simref)
+{
+    if (type_is_instr(simref.instr.type) ||
+        simref.instr.type == TRACE_TYPE_PREFETCH_INSTR) {
+        if (knobs_.verbose >= 3) {
+            std::cerr << "::" << simref.data.pid << "." << simref.data.tid << ":: "
+                      << " @" << (void *)simref.instr.addr << " instr x"
+                      << simref.instr.size << "\n";
+        }
+        l1_icaches_[core_index]->request(simref);
+    } else if (simref.data.type == TRACE_TYPE_READ ||
+               simref.data.type == TRACE_TYPE_WRITE ||
+               // We may potentially handle prefetches differently.
+               // TRACE_TYPE_PREFETCH_INSTR is handled above.
+               type_is_prefetch(simref.data.type)) {
+        if (knobs_.verbose >= 3) {
+            std::cerr << "::" << simref.data.pid << "." << simref.data.tid << ":: "
+                      << " @" << (void *)simref.data.pc << " "
+                      << trace_type_names[simref.data.type] << " "
+                      << (void *)simref.data.addr << " x" << simref.data.size << "\n";
+        }
+        l1_dcaches_[core_index]->request(simref);
+    } else if (simref.flush.type == TRACE_TYPE_INSTR_FLUSH) {
+        if (knobs_.verbose >= 3) {
+            std::cerr << "::" << simref.data.pid << "." << simref.data.tid << ":: "
+                      << " @" << (void *)simref.data.pc << " iflush "
+                      << (void *)simref.data.addr << " x" << simref.data.size << "\n";
+        }
+        l1_icaches_[core_index]->flush(simref);
+    } else if (simref.flush.type == TRACE_TYPE_DATA_FLUSH) {
+        if (knobs_.verbose >= 3) {
+            std::cerr << "::" << simref.data.pid << "." << simref.data.tid << ":: "
+                      << " @" << (void *)simref.data.pc << " dflush "
+                      << (void *)simref.data.addr << " x" << simref.data.size << "\n";
+        }
+        l1_dcaches_[core_index]->flush(simref);
+    } else if (simref.marker.type == TRACE_TYPE_INSTR_NO_FETCH) {
+        // Just ignore.
+        if (knobs_.verbose >= 3) {
+            std::cerr << "::" << simref.data.pid << "." << simref.data.tid << ":: "
+                      << " @" << (void *)simref.instr.addr << " non-fetched instr x"
+                      << simref.instr.size << "\n";
+        }
+    } else
+        return false;
+    return true;
+}
+
 // Return true if the number of warmup references have been executed or if
 // specified fraction of the llcaches_ has been loaded. Also return true if the
 // cache has already been warmed up. When there are multiple last level caches
@@ -39,13 +39,19 @@
 #include <limits.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <istream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "cache.h"
 #include "cache_simulator_create.h"
 #include "cache_stats.h"
+#include "shared_cache_proxy.h"
 #include "simulator.h"
 #include "snoop_filter.h"
 
@@ -77,11 +83,31 @@ public:
     cache_simulator_t(std::istream *config_file);
 
     virtual ~cache_simulator_t();
+    std::string
+    initialize_shard_type(shard_type_t shard_type) override;
     bool
     process_memref(const memref_t &memref) override;
     bool
     print_results() override;
 
+    // With knobs.parallel, cores are simulated in parallel for SHARD_BY_CORE.
+    // See the -cache_parallel option for the supported configurations.
+    bool
+    parallel_shard_supported() override;
+    void *
+    parallel_worker_init(int worker_index) override;
+    std::string
+    parallel_worker_exit(void *worker_data) override;
+    void *
+    parallel_shard_init_stream(int shard_index, void *worker_data,
+                               memtrace_stream_t *shard_stream) override;
+    bool
+    parallel_shard_exit(void *shard_data) override;
+    bool
+    parallel_shard_memref(void *shard_data, const memref_t &memref) override;
+    std::string
+    parallel_shard_error(void *shard_data) override;
+
     int64_t
     get_cache_metric(metric_name_t metric, unsigned level, unsigned core = 0,
                      cache_split_t split = cache_split_t::DATA) const;
@@ -108,10 +134,55 @@ public:
     get_knobs() const;
 
 protected:
+    // Per-core state for parallel simulation.
+    struct parallel_core_t {
+        int core = -1;
+        memtrace_stream_t *stream = nullptr;
+        std::unique_ptr<shared_op_log_t> log;
+        std::unique_ptr<shared_snoop_logger_t> snoop_logger;
+        // The proxies for this core's caches at the shared boundary.
+        std::vector<shared_cache_proxy_t *> proxies;
+        bool registered = false;
+        // Set once the core has no more records.  Until then every core below
+        // expected_cores_ takes part in each epoch, even before it registers,
+        // so that epochs line up the same way regardless of thread timing.
+        bool exited = false;
+        std::string error;
+    };
+
     // Create a cache_t object with a specific replacement policy.
     virtual cache_t *
     create_cache(const std::string &name, const std::string &policy);
 
+    // Sends one access or flush to the given core's L1 caches.  Returns false if
+    // simref is not such a record.
+    bool
+    simulate_access(int core_index, const memref_t &simref);
+
+    // Builds the address slices of the shared level and the proxies.
+    std::string
+    init_parallel();
+    // Called with sync_mutex_ held.
+    void
+    install_parallel_hierarchy();
+    void
+    uninstall_parallel_hierarchy();
+    int
+    remaining_cores() const;
+    void
+    retire_core(parallel_core_t *core);
+    void
+    start_shared_replay();
+    void
+    finish_shared_replay();
+    // Replays all cores' logged operations for one slice.
+    void
+    replay_shared_slice(int slice);
+    // Synchronizes with the other cores at the end of an epoch.  If exiting, the
+    // core then retires from synchronization.
+    void
+    end_parallel_epoch(parallel_core_t *core, bool exiting);
+
     cache_simulator_knobs_t knobs_;
 
     // Implement a set of ICaches and DCaches with pointer arrays.
@@ -132,6 +203,36 @@ protected:
     // Snoop filter tracks ownership of cache lines across private caches.
     snoop_filter_t *snoop_filter_ = nullptr;
 
+    // Parallel simulation state.
+    bool parallel_ = false;
+    std::vector<parallel_core_t> parallel_cores_;
+    shared_cache_slicing_t slicing_;
+    // The shared last-level cache, if any.  Its slices do the simulating while in
+    // parallel mode, with their statistics merged back into it at the end.
+    cache_t *shared_llc_ = nullptr;
+    std::vector<cache_t *> llc_slices_;
+    std::vector<std::unique_ptr<sliced_snoop_filter_t>> snoop_filter_slices_;
+    // Indexed by snoop filter id, for snoop_filter_slices_.
+    std::vector<cache_t *> snooped_proxies_;
+    std::vector<std::unique_ptr<shared_cache_proxy_t>> proxies_;
+    // Scratch space for replay_shared_slice(), per slice.
+    std::vector<std::vector<const shared_op_t *>> replay_order_;
+    // Epoch synchronization.  Cores that are done with an epoch wait for the
+    // rest; the last to arrive starts the replay, which all of them then
+    // share by claiming slices through next_slice_.
+    std::mutex sync_mutex_;
+    std::condition_variable sync_cond_;
+    // The number of cores the scheduler will run, once known.
+    int expected_cores_ = -1;
+    int arrived_cores_ = 0;
+    int replay_workers_ = 0;
+    int replay_finished_ = 0;
+    uint64_t epochs_started_ = 0;
+    uint64_t epochs_finished_ = 0;
+    bool replaying_ = false;
+    bool hierarchy_installed_ = false;
+    std::atomic<int> next_slice_;
+
 private:
     bool is_warmed_up_;
 };
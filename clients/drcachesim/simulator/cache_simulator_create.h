@@ -72,6 +72,8 @@ struct cache_simulator_knobs_t {
         , cpu_scheduling(false)
         , use_physical(false)
         , verbose(0)
+        , parallel(false)
+        , parallel_epoch(10000)
     {
     }
     unsigned int num_cores;
@@ -93,6 +95,8 @@ struct cache_simulator_knobs_t {
     bool cpu_scheduling;
     bool use_physical;
     unsigned int verbose;
+    bool parallel;
+    uint64_t parallel_epoch;
 };
 
 /** Creates an instance of a cache simulator with a 2-level hierarchy. */
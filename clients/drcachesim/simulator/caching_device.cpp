@@ -35,7 +35,6 @@
 #include <assert.h>
 #include <stddef.h>
 
-#include <functional>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -56,10 +55,7 @@ caching_device_t::caching_device_t(const std::string &name)
     : blocks_(NULL)
     , stats_(NULL)
     , prefetcher_(NULL)
-    // The tag being hashed is already right-shifted to the cache line and
-    // an identity hash is plenty good enough and nice and fast.
     // We set the size and load factor only if being used, in set_hashtable_use().
-    , tag2block(0, [](addr_t key) { return static_cast<unsigned long>(key); })
     , name_(name)
 {
 }
@@ -114,6 +110,10 @@ caching_device_t::init(int associativity, int block_size, int num_blocks,
 
     blocks_ = new caching_device_block_t *[num_blocks_];
     init_blocks();
+    // Initializing the counters to 0 is just to be safe and to make it easier to
+    // write new replacement algorithms without errors.
+    tags_.assign(num_blocks_, TAG_INVALID);
+    counters_.assign(num_blocks_, 0);
 
     last_tag_ = TAG_INVALID; // sentinel
 
@@ -143,14 +143,14 @@ caching_device_t::find_caching_device_block(addr_t tag)
         auto it = tag2block.find(tag);
         if (it == tag2block.end())
             return std::make_pair(nullptr, 0);
-        assert(it->second.first->tag_ == tag);
+        assert(get_tag(compute_block_idx(tag), it->second.second) == tag);
         return it->second;
     }
     int block_idx = compute_block_idx(tag);
+    const addr_t *set_tags = &tags_[block_idx];
     for (int way = 0; way < associativity_; ++way) {
-        caching_device_block_t &block = get_caching_device_block(block_idx, way);
-        if (block.tag_ == tag)
-            return std::make_pair(&block, way);
+        if (set_tags[way] == tag)
+            return std::make_pair(blocks_[block_idx + way], way);
     }
     return std::make_pair(nullptr, 0);
 }
@@ -173,7 +173,7 @@ caching_device_t::request(const memref_t &memref_in)
         // Make sure last_tag_ is properly in sync.
         caching_device_block_t *cache_block =
             &get_caching_device_block(last_block_idx_, last_way_);
-        assert(tag != TAG_INVALID && tag == cache_block->tag_);
+        assert(tag != TAG_INVALID && tag == get_tag(last_block_idx_, last_way_));
         record_access_stats(memref_in, true /*hit*/, cache_block);
         access_update(last_block_idx_, last_way_);
         return;
@@ -260,7 +260,7 @@ void
 caching_device_t::access_update(int block_idx, int way)
 {
     // We just inc the counter for LFU.  We live with any blip on overflow.
-    get_caching_device_block(block_idx, way).counter_++;
+    counters_[block_idx + way]++;
 }
 
 int
@@ -268,7 +268,7 @@ caching_device_t::replace_which_way(int block_idx)
 {
     int min_way = get_next_way_to_replace(block_idx);
     // Clear the counter for LFU.
-    get_caching_device_block(block_idx, min_way).counter_ = 0;
+    counters_[block_idx + min_way] = 0;
     return min_way;
 }
 
@@ -278,15 +278,17 @@ caching_device_t::get_next_way_to_replace(const int block_idx) const
     // The base caching device class only implements LFU.
     // A subclass can override this and access_update() to implement
     // some other scheme.
+    const addr_t *set_tags = &tags_[block_idx];
+    const int *set_counters = &counters_[block_idx];
     int min_counter = 0; /* avoid "may be used uninitialized" with GCC 4.4.7 */
     int min_way = 0;
     for (int way = 0; way < associativity_; ++way) {
-        if (get_caching_device_block(block_idx, way).tag_ == TAG_INVALID) {
+        if (set_tags[way] == TAG_INVALID) {
             min_way = way;
             break;
         }
-        if (way == 0 || get_caching_device_block(block_idx, way).counter_ < min_counter) {
-            min_counter = get_caching_device_block(block_idx, way).counter_;
+        if (way == 0 || set_counters[way] < min_counter) {
+            min_counter = set_counters[way];
             min_way = way;
         }
     }
@@ -298,7 +300,7 @@ caching_device_t::invalidate(addr_t tag, invalidation_type_t invalidation_type)
 {
     auto block_way = find_caching_device_block(tag);
     if (block_way.first != nullptr) {
-        invalidate_caching_device_block(block_way.first);
+        invalidate_caching_device_block(compute_block_idx(tag), block_way.second);
         loaded_blocks_--;
         stats_->invalidate(invalidation_type);
         // Invalidate last_tag_ if it was this tag.
@@ -448,12 +450,11 @@ caching_device_t::record_access_stats(const memref_t &memref, bool hit,
 void
 caching_device_t::insert_tag(addr_t tag, bool is_write, int way, int block_idx)
 {
-    caching_device_block_t *cache_block = &get_caching_device_block(block_idx, way);
     if (snoop_filter_ != nullptr) {
         // Update snoop filter to mark tag as present in this cache.
         snoop_filter_->snoop(tag, id_, is_write);
     }
-    addr_t victim_tag = cache_block->tag_;
+    addr_t victim_tag = get_tag(block_idx, way);
     if (victim_tag == TAG_INVALID) {
         // Lucky for us, nothing needs to be evicted.
         loaded_blocks_++;
@@ -516,7 +517,7 @@ caching_device_t::insert_tag(addr_t tag, bool is_write, int way, int block_idx)
             }
         }
     }
-    update_tag(cache_block, way, tag);
+    update_tag(block_idx, way, tag);
 }
 
 } // namespace drmemtrace
@@ -36,7 +36,8 @@
 #ifndef _CACHING_DEVICE_H_
 #define _CACHING_DEVICE_H_ 1
 
-#include <functional>
+#include <stddef.h>
+
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -80,11 +81,11 @@ public:
     request(const memref_t &memref);
     virtual void
     invalidate(addr_t tag, invalidation_type_t invalidation_type_);
-    bool
+    virtual bool
     contains_tag(addr_t tag);
-    void
+    virtual void
     propagate_eviction(addr_t tag, const caching_device_t *requester);
-    void
+    virtual void
     propagate_write(addr_t tag, const caching_device_t *requester);
 
     caching_device_stats_t *
@@ -110,6 +111,29 @@ public:
     {
         return parent_;
     }
+    // The parent and snoop filter are normally fixed by init(); these allow them
+    // to be redirected, e.g., to route a private cache's shared-level traffic
+    // through a proxy during parallel simulation.
+    void
+    set_parent(caching_device_t *parent)
+    {
+        parent_ = parent;
+    }
+    const std::vector<caching_device_t *> &
+    get_children() const
+    {
+        return children_;
+    }
+    snoop_filter_t *
+    get_snoop_filter() const
+    {
+        return snoop_filter_;
+    }
+    void
+    set_snoop_filter(snoop_filter_t *snoop_filter)
+    {
+        snoop_filter_ = snoop_filter;
+    }
     inline double
     get_loaded_fraction() const
     {
@@ -215,24 +239,32 @@ protected:
     {
         return *(blocks_[block_idx + way]);
     }
+    // Returns the tag held in the given way, or TAG_INVALID.
+    inline addr_t
+    get_tag(int block_idx, int way) const
+    {
+        return tags_[block_idx + way];
+    }
 
     inline void
-    invalidate_caching_device_block(caching_device_block_t *block)
+    invalidate_caching_device_block(int block_idx, int way)
     {
+        addr_t &tag = tags_[block_idx + way];
         if (use_tag2block_table_)
-            tag2block.erase(block->tag_);
-        block->tag_ = TAG_INVALID;
+            tag2block.erase(tag);
+        tag = TAG_INVALID;
     }
 
     inline void
-    update_tag(caching_device_block_t *block, int way, addr_t new_tag)
+    update_tag(int block_idx, int way, addr_t new_tag)
     {
+        addr_t &tag = tags_[block_idx + way];
         if (use_tag2block_table_) {
-            if (block->tag_ != TAG_INVALID)
-                tag2block.erase(block->tag_);
-            tag2block[new_tag] = std::make_pair(block, way);
+            if (tag != TAG_INVALID)
+                tag2block.erase(tag);
+            tag2block[new_tag] = std::make_pair(blocks_[block_idx + way], way);
         }
-        block->tag_ = new_tag;
+        tag = new_tag;
     }
 
     // Returns the block (and its way) whose tag equals `tag`.
@@ -267,6 +299,14 @@ protected:
     // an extended block class which has its own member variables cannot be indexed
     // correctly by base class pointers.
     caching_device_block_t **blocks_;
+    // The tag and the replacement policy counter of each block, indexed like
+    // blocks_ so that the ways of a set are adjacent.  A set of up to 8 ways
+    // thus fits its tags in a single 64-byte host cache line, and lookups avoid
+    // dereferencing the block pointers.
+    std::vector<addr_t> tags_;
+    // XXX: using int64_t here results in a ~4% slowdown for 32-bit apps.
+    // A 32-bit counter should be sufficient but we may want to revisit.
+    std::vector<int> counters_;
     int blocks_per_way_;
     // Optimization fields for fast bit operations
     int blocks_per_way_mask_;
@@ -286,8 +326,16 @@ protected:
     // We can't easily remove the blocks_ array and replace with just
     // the hashtable as replace_which_way(), etc. want quick access to
     // every way for a given line index.
-    std::unordered_map<addr_t, std::pair<caching_device_block_t *, int>,
-                       std::function<unsigned long(addr_t)>>
+    struct tag_hash_t {
+        // The tag being hashed is already right-shifted to the cache line and
+        // an identity hash is plenty good enough and nice and fast.
+        size_t
+        operator()(addr_t tag) const
+        {
+            return static_cast<size_t>(tag);
+        }
+    };
+    std::unordered_map<addr_t, std::pair<caching_device_block_t *, int>, tag_hash_t>
         tag2block;
     bool use_tag2block_table_ = false;
 
@@ -48,26 +48,16 @@ namespace drmemtrace {
 // block status.
 static const addr_t TAG_INVALID = (addr_t)-1; // block is invalid
 
+// The tag and replacement state of each block are kept by caching_device_t in
+// arrays packed by set, so that looking up a set touches as few host cache lines
+// as possible.  This class holds any further per-block state, such as the
+// process of a TLB entry, and is what is passed to the statistics.
 class caching_device_block_t {
 public:
-    // Initializing counter to 0 is just to be safe and to make it easier to write new
-    // replacement algorithms without errors (and we expect negligible perf cost).
-    caching_device_block_t()
-        : tag_(TAG_INVALID)
-        , counter_(0)
-    {
-    }
     // Destructor must be virtual and default is not.
     virtual ~caching_device_block_t()
     {
     }
-
-    addr_t tag_;
-
-    // XXX: using int64_t here results in a ~4% slowdown for 32-bit apps.
-    // A 32-bit counter should be sufficient but we may want to revisit.
-    // We already have stdint.h so we can reinstate int64_t easily.
-    int counter_; // for use by replacement policies
 };
 
 } // namespace drmemtrace
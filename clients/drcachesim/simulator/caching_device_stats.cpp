@@ -246,6 +246,16 @@ caching_device_stats_t::print_stats(std::string prefix)
     std::cerr.imbue(std::locale("C")); // Reset to avoid affecting later prints.
 }
 
+void
+caching_device_stats_t::merge(const caching_device_stats_t &other)
+{
+    for (auto &metric : stats_map_) {
+        auto it = other.stats_map_.find(metric.first);
+        if (it != other.stats_map_.end())
+            metric.second += it->second;
+    }
+}
+
 void
 caching_device_stats_t::reset()
 {
@@ -189,6 +189,11 @@ public:
     virtual void
     reset();
 
+    // Adds all of the counters of "other" into this object's counters.  This is
+    // used to combine the statistics of the slices of an address-partitioned cache.
+    virtual void
+    merge(const caching_device_stats_t &other);
+
     virtual bool
     operator!()
     {
@@ -225,6 +230,12 @@ public:
         caching_device_ = caching_device;
     }
 
+    bool
+    dumps_misses() const
+    {
+        return dump_misses_;
+    }
+
 protected:
     bool success_;
 
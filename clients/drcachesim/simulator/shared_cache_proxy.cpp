@@ -0,0 +1,231 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "shared_cache_proxy.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cache.h"
+#include "cache_stats.h"
+#include "caching_device.h"
+#include "caching_device_stats.h"
+#include "memref.h"
+#include "snoop_filter.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+shared_cache_proxy_t::shared_cache_proxy_t(caching_device_t *child,
+                                           shared_op_log_t *log,
+                                           const shared_cache_slicing_t *slicing)
+    : cache_t(child->get_name() + " shared proxy")
+    , child_(child)
+    , log_(log)
+    , slicing_(slicing)
+    , pending_(slicing->num_slices)
+{
+}
+
+shared_cache_proxy_t::~shared_cache_proxy_t()
+{
+    delete get_stats();
+}
+
+bool
+shared_cache_proxy_t::init_proxy(int line_size)
+{
+    return cache_t::init(1, line_size, line_size, nullptr, new cache_stats_t(line_size));
+}
+
+void
+shared_cache_proxy_t::log_op(const shared_op_t &op, int slice)
+{
+    log_->ops[slice].push_back(op);
+    log_->ops[slice].back().position = log_->position;
+}
+
+void
+shared_cache_proxy_t::request(const memref_t &memref)
+{
+    // Our child only passes up one line at a time.
+    addr_t tag = compute_tag(memref.data.addr);
+    shared_op_t op = {};
+    op.type = SHARED_OP_REQUEST;
+    op.requester = this;
+    op.tag = tag;
+    op.memref = memref;
+    log_op(op, slicing_->slice_of(tag));
+}
+
+void
+shared_cache_proxy_t::flush(const memref_t &memref)
+{
+    addr_t tag = compute_tag(memref.flush.addr);
+    addr_t final_tag =
+        compute_tag(memref.flush.addr + memref.flush.size - 1 /*no overflow*/);
+    shared_op_t op = {};
+    op.type = SHARED_OP_FLUSH;
+    op.requester = this;
+    op.memref = memref;
+    op.owns_stats = true;
+    // Visit each slice the range overlaps once: the slice only changes every
+    // 1 << shift tags.
+    for (int i = 0; i < slicing_->num_slices && tag <= final_tag; ++i) {
+        op.tag = tag;
+        log_op(op, slicing_->slice_of(tag));
+        op.owns_stats = false;
+        addr_t next_tag = ((tag >> slicing_->shift) + 1) << slicing_->shift;
+        if (next_tag <= tag)
+            break;
+        tag = next_tag;
+    }
+}
+
+void
+shared_cache_proxy_t::invalidate(addr_t tag, invalidation_type_t invalidation_type)
+{
+    // This is called while replaying the slice that holds tag.
+    pending_[slicing_->slice_of(tag)].emplace_back(tag, invalidation_type);
+}
+
+bool
+shared_cache_proxy_t::contains_tag(addr_t tag)
+{
+    // The child is quiescent while the shared level is being updated.
+    return child_->contains_tag(tag);
+}
+
+void
+shared_cache_proxy_t::propagate_eviction(addr_t tag, const caching_device_t *requester)
+{
+    shared_op_t op = {};
+    op.type = SHARED_OP_PROPAGATE_EVICTION;
+    op.requester = this;
+    op.tag = tag;
+    log_op(op, slicing_->slice_of(tag));
+}
+
+void
+shared_cache_proxy_t::propagate_write(addr_t tag, const caching_device_t *requester)
+{
+    shared_op_t op = {};
+    op.type = SHARED_OP_PROPAGATE_WRITE;
+    op.requester = this;
+    op.tag = tag;
+    log_op(op, slicing_->slice_of(tag));
+}
+
+bool
+shared_cache_proxy_t::is_exclusive() const
+{
+    return shared_parent_ != nullptr && shared_parent_->is_exclusive();
+}
+
+void
+shared_cache_proxy_t::install(caching_device_t *shared_parent,
+                              snoop_filter_t *shared_snoop_filter,
+                              snoop_filter_t *snoop_logger)
+{
+    shared_parent_ = shared_parent;
+    shared_snoop_filter_ = shared_snoop_filter;
+    redirected_parent_ =
+        shared_parent != nullptr && child_->get_parent() == shared_parent;
+    redirected_snoop_filter_ = shared_snoop_filter != nullptr &&
+        child_->get_snoop_filter() == shared_snoop_filter;
+    if (redirected_parent_)
+        child_->set_parent(this);
+    if (redirected_snoop_filter_)
+        child_->set_snoop_filter(snoop_logger);
+}
+
+void
+shared_cache_proxy_t::uninstall()
+{
+    if (redirected_parent_)
+        child_->set_parent(shared_parent_);
+    if (redirected_snoop_filter_)
+        child_->set_snoop_filter(shared_snoop_filter_);
+    redirected_parent_ = false;
+    redirected_snoop_filter_ = false;
+}
+
+void
+shared_cache_proxy_t::apply_pending_invalidations()
+{
+    for (auto &slice_pending : pending_) {
+        for (const auto &inval : slice_pending)
+            child_->invalidate(inval.first, inval.second);
+        slice_pending.clear();
+    }
+}
+
+void
+shared_snoop_logger_t::snoop(addr_t tag, int id, bool is_write)
+{
+    shared_op_t op = {};
+    op.type = SHARED_OP_SNOOP;
+    op.position = log_->position;
+    op.tag = tag;
+    op.id = id;
+    op.is_write = is_write;
+    log_->ops[slicing_->slice_of(tag)].push_back(op);
+}
+
+void
+shared_snoop_logger_t::snoop_eviction(addr_t tag, int id)
+{
+    shared_op_t op = {};
+    op.type = SHARED_OP_SNOOP_EVICTION;
+    op.position = log_->position;
+    op.tag = tag;
+    op.id = id;
+    log_->ops[slicing_->slice_of(tag)].push_back(op);
+}
+
+void
+sliced_snoop_filter_t::snoop_eviction(addr_t tag, int id)
+{
+    auto it = coherence_table_.find(tag);
+    if (it == coherence_table_.end() || it->second.sharers.empty() ||
+        !it->second.sharers[id])
+        return;
+    snoop_filter_t::snoop_eviction(tag, id);
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
@@ -0,0 +1,219 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* shared_cache_proxy: support for simulating a cache hierarchy in parallel,
+ * one analysis worker per core.
+ *
+ * Each core's private caches run on that core's worker thread.  The caches
+ * at the boundary with the shared level (the children of a shared last-level
+ * cache and any snooped caches) are given a shared_cache_proxy_t as their
+ * parent and a shared_snoop_logger_t as their snoop filter.  These record
+ * every operation on shared state into the core's shared_op_log_t instead of
+ * performing it.  At the end of each epoch the logs of all cores are replayed
+ * in a deterministic order onto address slices of the shared cache and snoop
+ * filter, with each slice updated independently and thus in parallel.
+ * Invalidations which the shared level sends back down to a private cache are
+ * queued in its proxy and applied by the owning core once the replay is done.
+ */
+
+#ifndef _SHARED_CACHE_PROXY_H_
+#define _SHARED_CACHE_PROXY_H_ 1
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cache.h"
+#include "caching_device.h"
+#include "caching_device_stats.h"
+#include "memref.h"
+#include "snoop_filter.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+// Partitions cache line tags into a power-of-two number of slices.  Taking the
+// bits just above a cache's set index bits keeps whole sets within one slice,
+// so a slice holding 1/num_slices of the sets and the same associativity
+// behaves exactly like the corresponding part of the unsliced cache.
+struct shared_cache_slicing_t {
+    int num_slices = 1;
+    int shift = 0;
+    int
+    slice_of(addr_t tag) const
+    {
+        return static_cast<int>((tag >> shift) & (num_slices - 1));
+    }
+};
+
+enum shared_op_type_t {
+    SHARED_OP_REQUEST,
+    SHARED_OP_PROPAGATE_EVICTION,
+    SHARED_OP_PROPAGATE_WRITE,
+    SHARED_OP_FLUSH,
+    SHARED_OP_SNOOP,
+    SHARED_OP_SNOOP_EVICTION,
+};
+
+struct shared_op_t {
+    shared_op_type_t type;
+    // The index within the current epoch of the trace record on the issuing
+    // core which produced this operation.  Replay is ordered by this value.
+    uint64_t position;
+    // The proxy of the private cache issuing the operation, for cache operations.
+    caching_device_t *requester;
+    addr_t tag;
+    // The snoop filter id of the issuing cache, for snoop operations.
+    int id;
+    bool is_write;
+    // For a flush spanning several slices, only one slice records the flush in
+    // its statistics.
+    bool owns_stats;
+    // The request or flush, for SHARED_OP_REQUEST and SHARED_OP_FLUSH.
+    memref_t memref;
+};
+
+// The shared-level operations issued by one core during one epoch, binned by
+// the slice they target.  This is only written by the core's own worker and
+// only read by others while all cores are stopped at an epoch boundary.
+struct shared_op_log_t {
+    explicit shared_op_log_t(int num_slices)
+        : ops(num_slices)
+    {
+    }
+    void
+    clear()
+    {
+        for (auto &slice_ops : ops)
+            slice_ops.clear();
+        position = 0;
+    }
+    std::vector<std::vector<shared_op_t>> ops;
+    uint64_t position = 0;
+};
+
+// Stands in for the shared parent of one private cache during parallel simulation.
+class shared_cache_proxy_t : public cache_t {
+public:
+    shared_cache_proxy_t(caching_device_t *child, shared_op_log_t *log,
+                         const shared_cache_slicing_t *slicing);
+    ~shared_cache_proxy_t() override;
+
+    // The proxy has a single line, which is never used, plus statistics which
+    // collect the child-hit counts that would otherwise go to the shared parent.
+    bool
+    init_proxy(int line_size);
+
+    void
+    request(const memref_t &memref) override;
+    void
+    flush(const memref_t &memref) override;
+    void
+    invalidate(addr_t tag, invalidation_type_t invalidation_type) override;
+    bool
+    contains_tag(addr_t tag) override;
+    void
+    propagate_eviction(addr_t tag, const caching_device_t *requester) override;
+    void
+    propagate_write(addr_t tag, const caching_device_t *requester) override;
+    bool
+    is_exclusive() const override;
+
+    // Points the child at this proxy in place of its shared parent and/or
+    // snoop filter.  The originals are remembered for uninstall().
+    void
+    install(caching_device_t *shared_parent, snoop_filter_t *shared_snoop_filter,
+            snoop_filter_t *snoop_logger);
+    void
+    uninstall();
+    caching_device_t *
+    get_child() const
+    {
+        return child_;
+    }
+
+    // Applies the invalidations queued by the shared level to the child.
+    // Must be called by the child's core while no replay is in progress.
+    void
+    apply_pending_invalidations();
+
+private:
+    void
+    log_op(const shared_op_t &op, int slice);
+
+    caching_device_t *child_;
+    shared_op_log_t *log_;
+    const shared_cache_slicing_t *slicing_;
+    // The child's shared parent and snoop filter when installed.
+    caching_device_t *shared_parent_ = nullptr;
+    snoop_filter_t *shared_snoop_filter_ = nullptr;
+    bool redirected_parent_ = false;
+    bool redirected_snoop_filter_ = false;
+    // Queued invalidations, binned by slice so that replay of different slices
+    // on different threads never touches the same vector.
+    std::vector<std::vector<std::pair<addr_t, invalidation_type_t>>> pending_;
+};
+
+// Takes the place of the snoop filter for one core's snooped caches.
+class shared_snoop_logger_t : public snoop_filter_t {
+public:
+    shared_snoop_logger_t(shared_op_log_t *log, const shared_cache_slicing_t *slicing)
+        : log_(log)
+        , slicing_(slicing)
+    {
+    }
+    void
+    snoop(addr_t tag, int id, bool is_write) override;
+    void
+    snoop_eviction(addr_t tag, int id) override;
+
+private:
+    shared_op_log_t *log_;
+    const shared_cache_slicing_t *slicing_;
+};
+
+// One address slice of the snoop filter.  As an eviction and a remote write to
+// the same line within one epoch can be replayed in either order, an eviction
+// from a cache which is no longer a sharer is tolerated rather than asserted on.
+class sliced_snoop_filter_t : public snoop_filter_t {
+public:
+    void
+    snoop_eviction(addr_t tag, int id) override;
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _SHARED_CACHE_PROXY_H_ */
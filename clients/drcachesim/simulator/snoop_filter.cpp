@@ -136,6 +136,17 @@ snoop_filter_t::snoop_eviction(addr_t tag, int id)
     coherence_entry->sharers[id] = false;
 }
 
+void
+snoop_filter_t::merge_stats(snoop_filter_t &other)
+{
+    num_writes_ += other.num_writes_;
+    num_writebacks_ += other.num_writebacks_;
+    num_invalidates_ += other.num_invalidates_;
+    other.num_writes_ = 0;
+    other.num_writebacks_ = 0;
+    other.num_invalidates_ = 0;
+}
+
 void
 snoop_filter_t::print_stats(void)
 {
@@ -63,6 +63,9 @@ public:
     snoop_eviction(addr_t tag, int id);
     void
     print_stats(void);
+    // Adds the statistics of "other" into this filter's and clears them in "other".
+    void
+    merge_stats(snoop_filter_t &other);
     int64_t
     get_num_snooped_caches(void)
     {
@@ -86,6 +86,11 @@ public:
             worker_data_.push_back(analyzer_worker_data_t(i, scheduler_.get_stream(i)));
         }
     }
+    void
+    set_records_per_batch(int records_per_batch)
+    {
+        records_per_batch_ = records_per_batch;
+    }
 };
 
 bool
@@ -479,10 +484,130 @@ test_tool_errors()
     return true;
 }
 
+bool
+test_record_batches()
+{
+    std::cerr << "\n----------------\nTesting record batches\n";
+    static constexpr int NUM_INPUTS = 5;
+    static constexpr int NUM_OUTPUTS = 2;
+    static constexpr int NUM_INSTRS = 9;
+    static constexpr int QUANTUM_DURATION = 3;
+    static constexpr memref_tid_t TID_BASE = 100;
+
+    class batch_tool_t : public analysis_tool_t {
+    public:
+        bool
+        process_memref(const memref_t &memref) override
+        {
+            assert(false); // Only expect parallel mode.
+            return false;
+        }
+        bool
+        print_results() override
+        {
+            return true;
+        }
+        bool
+        parallel_shard_supported() override
+        {
+            return true;
+        }
+        bool
+        parallel_shard_batch_supported() override
+        {
+            return true;
+        }
+        void *
+        parallel_shard_init_stream(int shard_index, void *worker_data,
+                                   memtrace_stream_t *stream) override
+        {
+            return nullptr;
+        }
+        bool
+        parallel_shard_exit(void *shard_data) override
+        {
+            return true;
+        }
+        bool
+        parallel_shard_memref(void *shard_data, const memref_t &memref) override
+        {
+            if (type_is_instr(memref.instr.type))
+                ++instrs;
+            else if (memref.marker.type == TRACE_TYPE_THREAD_EXIT)
+                ++exits;
+            return true;
+        }
+        bool
+        parallel_shard_memref_batch(void *shard_data, const memref_t *memrefs,
+                                    size_t num_memrefs) override
+        {
+            if (memrefs[0].marker.type != TRACE_TYPE_MARKER ||
+                (memrefs[0].marker.marker_type != TRACE_MARKER_TYPE_CORE_WAIT &&
+                 memrefs[0].marker.marker_type != TRACE_MARKER_TYPE_CORE_IDLE))
+                ++batches;
+            for (size_t i = 0; i < num_memrefs; ++i) {
+                // A batch never spans a context switch.
+                if (memrefs[i].marker.type != TRACE_TYPE_MARKER)
+                    assert(memrefs[i].instr.tid == memrefs[0].instr.tid);
+                // A thread exit always ends a batch.
+                if (memrefs[i].marker.type == TRACE_TYPE_THREAD_EXIT)
+                    assert(i == num_memrefs - 1);
+                parallel_shard_memref(shard_data, memrefs[i]);
+            }
+            return true;
+        }
+        std::atomic<int> instrs { 0 };
+        std::atomic<int> exits { 0 };
+        std::atomic<int> batches { 0 };
+    };
+
+    for (int records_per_batch : { 0, 1, 4, 256 }) {
+        std::vector<scheduler_t::input_workload_t> sched_inputs;
+        for (int i = 0; i < NUM_INPUTS; i++) {
+            memref_tid_t tid = TID_BASE + i;
+            std::vector<trace_entry_t> inputs;
+            inputs.push_back(make_thread(tid));
+            inputs.push_back(make_pid(1));
+            for (int j = 0; j < NUM_INSTRS; j++)
+                inputs.push_back(make_instr(42 + j * 4));
+            inputs.push_back(make_exit(tid));
+            std::vector<scheduler_t::input_reader_t> readers;
+            readers.emplace_back(
+                std::unique_ptr<mock_reader_t>(new mock_reader_t(inputs)),
+                std::unique_ptr<mock_reader_t>(new mock_reader_t()), tid);
+            sched_inputs.emplace_back(std::move(readers));
+        }
+        scheduler_t::scheduler_options_t sched_ops(scheduler_t::MAP_TO_ANY_OUTPUT,
+                                                   scheduler_t::DEPENDENCY_IGNORE,
+                                                   scheduler_t::SCHEDULER_DEFAULTS,
+                                                   /*verbosity=*/1);
+        sched_ops.quantum_duration = QUANTUM_DURATION;
+        std::vector<analysis_tool_t *> tools;
+        auto test_tool = std::unique_ptr<batch_tool_t>(new batch_tool_t);
+        tools.push_back(test_tool.get());
+        mock_analyzer_t analyzer(sched_inputs, &tools[0], (int)tools.size(),
+                                 /*parallel=*/true, NUM_OUTPUTS, &sched_ops);
+        assert(!!analyzer);
+        analyzer.set_records_per_batch(records_per_batch);
+        bool res = analyzer.run();
+        assert(res);
+        assert(test_tool->instrs == NUM_INPUTS * NUM_INSTRS);
+        assert(test_tool->exits == NUM_INPUTS);
+        // With a batch size of 0 batches are disabled.  Waits are not counted.
+        assert((test_tool->batches == 0) == (records_per_batch == 0));
+        if (records_per_batch > 1) {
+            // Each quantum's worth of instructions should be delivered together.
+            assert(test_tool->batches < NUM_INPUTS * (NUM_INSTRS + 1));
+        }
+    }
+    return true;
+}
+
 int
 test_main(int argc, const char *argv[])
 {
-    if (!test_queries() || !test_wait_records() || !test_tool_errors())
+    if (!test_queries() || !test_wait_records() || !test_tool_errors() ||
+        !test_record_batches())
         return 1;
     std::cerr << "All done!\n";
     return 0;
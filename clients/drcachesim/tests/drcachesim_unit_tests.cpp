@@ -34,13 +34,17 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <memory>
 #include <regex>
+#include <thread>
+#include <vector>
 
 #undef NDEBUG
 #include <assert.h>
 #include "config_reader_unit_test.h"
 #include "cache_replacement_policy_unit_test.h"
 #include "simulator/cache.h"
+#include "simulator/cache_fifo.h"
 #include "simulator/cache_lru.h"
 #include "simulator/cache_simulator.h"
 #include "../common/memref.h"
@@ -767,6 +771,57 @@ unit_test_cache_accessors()
     }
 }
 
+// Checks that lookups through the packed per-set tags and through the
+// tag-to-block hashtable agree for every replacement policy.
+void
+unit_test_cache_hashtable_lookup()
+{
+    static const int LINE_SIZE = 64;
+    static const int ASSOCIATIVITY = 8;
+    static const int TOTAL_SIZE = 64 * ASSOCIATIVITY * LINE_SIZE;
+    static const int NUM_REFS = 100000;
+    for (int policy = 0; policy < 3; ++policy) {
+        std::unique_ptr<cache_t> caches[2];
+        std::unique_ptr<caching_device_stats_t> stats[2];
+        for (int i = 0; i < 2; ++i) {
+            if (policy == 0)
+                caches[i].reset(new cache_lru_t);
+            else if (policy == 1)
+                caches[i].reset(new cache_fifo_t);
+            else
+                caches[i].reset(new cache_t);
+            stats[i].reset(new caching_device_stats_t(/*miss_file=*/"", LINE_SIZE));
+            bool initialized = caches[i]->init(ASSOCIATIVITY, LINE_SIZE, TOTAL_SIZE,
+                                               /*parent=*/nullptr, stats[i].get());
+            assert(initialized);
+            caches[i]->set_hashtable_use(i == 1);
+        }
+        // A simple LCG over 4x the cache's footprint yields a mix of hits,
+        // misses, and evictions in every set.
+        uint32_t seed = 42;
+        for (int i = 0; i < NUM_REFS; ++i) {
+            seed = seed * 1103515245 + 12345;
+            addr_t addr = (seed >> 8) % (4 * TOTAL_SIZE);
+            memref_t ref = make_memref(addr);
+            caches[0]->request(ref);
+            caches[1]->request(ref);
+            addr_t tag = addr / LINE_SIZE;
+            assert(caches[0]->contains_tag(tag) && caches[1]->contains_tag(tag));
+            if (i % 1000 == 0) {
+                caches[0]->invalidate(tag, INVALIDATION_INCLUSIVE);
+                caches[1]->invalidate(tag, INVALIDATION_INCLUSIVE);
+                assert(!caches[0]->contains_tag(tag) && !caches[1]->contains_tag(tag));
+            }
+        }
+        TEST_EQ(stats[0]->get_metric(metric_name_t::HITS),
+                stats[1]->get_metric(metric_name_t::HITS));
+        TEST_EQ(stats[0]->get_metric(metric_name_t::MISSES),
+                stats[1]->get_metric(metric_name_t::MISSES));
+        assert(stats[0]->get_metric(metric_name_t::HITS) > 0);
+        assert(stats[0]->get_metric(metric_name_t::MISSES) > 0);
+    }
+}
+
 void
 unit_test_core_sharded()
 {
@@ -833,6 +888,165 @@ Core #1 \(traced CPU\(s\): #567800\)
     }
 }
 
+// Simulates refs[i] on core i, with one thread per core as the analyzer does for
+// -core_sharded.
+static void
+run_parallel_cache_sim(cache_simulator_t &sim,
+                       const std::vector<std::vector<memref_t>> &refs)
+{
+    sim.initialize_stream(nullptr);
+    std::string error = sim.initialize_shard_type(SHARD_BY_CORE);
+    if (!error.empty()) {
+        std::cerr << "drcachesim run_parallel_cache_sim failed: " << error << "\n";
+        exit(1);
+    }
+    assert(sim.parallel_shard_supported());
+    std::vector<default_memtrace_stream_t> streams(refs.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < refs.size(); i++) {
+        threads.emplace_back([&, i]() {
+            streams[i].set_shard_index(static_cast<int>(i));
+            streams[i].set_output_cpuid(static_cast<int64_t>(i));
+            void *worker_data = sim.parallel_worker_init(static_cast<int>(i));
+            void *shard_data = sim.parallel_shard_init_stream(static_cast<int>(i),
+                                                              worker_data, &streams[i]);
+            for (const memref_t &ref : refs[i]) {
+                if (!sim.parallel_shard_memref(shard_data, ref)) {
+                    std::cerr << "drcachesim run_parallel_cache_sim failed: "
+                              << sim.parallel_shard_error(shard_data) << "\n";
+                    exit(1);
+                }
+            }
+            sim.parallel_shard_exit(shard_data);
+            assert(sim.parallel_worker_exit(worker_data).empty());
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+void
+unit_test_parallel()
+{
+    static constexpr int NUM_CORES = 4;
+    {
+        // Test usage errors.
+        cache_simulator_knobs_t knobs = make_test_knobs();
+        knobs.parallel = true;
+        cache_simulator_t sim_thread_sharded(knobs);
+        sim_thread_sharded.initialize_stream(nullptr);
+        assert(!sim_thread_sharded.initialize_shard_type(SHARD_BY_THREAD).empty());
+        knobs.warmup_refs = 10;
+        cache_simulator_t sim_warmup(knobs);
+        sim_warmup.initialize_stream(nullptr);
+        assert(!sim_warmup.initialize_shard_type(SHARD_BY_CORE).empty());
+    }
+    {
+        // Without any conflicts in the LLC, every count should match a serial run.
+        cache_simulator_knobs_t knobs = make_test_knobs();
+        knobs.num_cores = NUM_CORES;
+        knobs.LL_size = 64 * 1024;
+        knobs.LL_assoc = 16;
+        std::vector<std::vector<memref_t>> refs(NUM_CORES);
+        for (int core = 0; core < NUM_CORES; core++) {
+            // 64 lines each, twice the L1 size, all mapping to distinct LLC ways.
+            for (int pass = 0; pass < 8; pass++) {
+                for (int line = 0; line < 64; line++) {
+                    refs[core].push_back(make_memref(
+                        (static_cast<addr_t>(core) << 20) + line * 64,
+                        line % 3 == 0 ? TRACE_TYPE_WRITE : TRACE_TYPE_READ));
+                }
+            }
+        }
+        cache_simulator_t serial(knobs);
+        default_memtrace_stream_t stream;
+        serial.initialize_stream(&stream);
+        assert(serial.initialize_shard_type(SHARD_BY_CORE).empty());
+        for (size_t i = 0; i < refs[0].size(); i++) {
+            for (int core = 0; core < NUM_CORES; core++) {
+                stream.set_shard_index(core);
+                stream.set_output_cpuid(core);
+                assert(serial.process_memref(refs[core][i]));
+            }
+        }
+        knobs.parallel = true;
+        knobs.parallel_epoch = 16;
+        cache_simulator_t parallel(knobs);
+        run_parallel_cache_sim(parallel, refs);
+        for (int core = 0; core < NUM_CORES; core++) {
+            for (unsigned level = 1; level <= 2; level++) {
+                for (metric_name_t metric : { metric_name_t::HITS, metric_name_t::MISSES,
+                                              metric_name_t::CHILD_HITS,
+                                              metric_name_t::COMPULSORY_MISSES }) {
+                    TEST_EQ(parallel.get_cache_metric(metric, level, core),
+                            serial.get_cache_metric(metric, level, core));
+                }
+            }
+        }
+        assert(parallel.get_cache_metric(metric_name_t::MISSES, 2) == NUM_CORES * 64);
+    }
+    {
+        // With sharing, coherence, and LLC evictions the results depend on the
+        // epoch length but must not depend on thread timing.
+        std::string config = R"MYCONFIG(
+num_cores       4
+line_size       64
+coherence       true
+parallel        true
+parallel_epoch  8
+L1I0 { type instruction core 0 size 256 assoc 4 prefetcher none parent L2_0 }
+L1D0 { type data core 0 size 256 assoc 4 prefetcher none parent L2_0 }
+L1I1 { type instruction core 1 size 256 assoc 4 prefetcher none parent L2_1 }
+L1D1 { type data core 1 size 256 assoc 4 prefetcher none parent L2_1 }
+L1I2 { type instruction core 2 size 256 assoc 4 prefetcher none parent L2_2 }
+L1D2 { type data core 2 size 256 assoc 4 prefetcher none parent L2_2 }
+L1I3 { type instruction core 3 size 256 assoc 4 prefetcher none parent L2_3 }
+L1D3 { type data core 3 size 256 assoc 4 prefetcher none parent L2_3 }
+L2_0 { size 1K assoc 4 inclusive true prefetcher none parent LLC }
+L2_1 { size 1K assoc 4 inclusive true prefetcher none parent LLC }
+L2_2 { size 1K assoc 4 inclusive true prefetcher none parent LLC }
+L2_3 { size 1K assoc 4 inclusive true prefetcher none parent LLC }
+LLC { size 4K assoc 4 inclusive true prefetcher none parent memory }
+)MYCONFIG";
+        std::vector<std::vector<memref_t>> refs(NUM_CORES);
+        for (int core = 0; core < NUM_CORES; core++) {
+            uint32_t seed = 1 + core;
+            for (int i = 0; i < 2000; i++) {
+                // A simple LCG picks from 96 lines shared by all cores.
+                seed = seed * 1103515245 + 12345;
+                addr_t line = (seed >> 16) % 96;
+                trace_type_t type =
+                    (seed >> 8) % 4 == 0 ? TRACE_TYPE_WRITE : TRACE_TYPE_READ;
+                refs[core].push_back(make_memref(line * 64, type));
+            }
+        }
+        std::vector<int64_t> results[2];
+        for (int run = 0; run < 2; run++) {
+            std::istringstream config_in(config);
+            cache_simulator_t sim(&config_in);
+            run_parallel_cache_sim(sim, refs);
+            for (int core = 0; core < NUM_CORES; core++) {
+                for (unsigned level = 1; level <= 3; level++) {
+                    results[run].push_back(
+                        sim.get_cache_metric(metric_name_t::HITS, level, core));
+                    results[run].push_back(
+                        sim.get_cache_metric(metric_name_t::MISSES, level, core));
+                    results[run].push_back(sim.get_cache_metric(
+                        metric_name_t::INCLUSIVE_INVALIDATES, level, core));
+                    results[run].push_back(sim.get_cache_metric(
+                        metric_name_t::COHERENCE_INVALIDATES, level, core));
+                }
+            }
+            results[run].push_back(sim.get_num_snoop_writes());
+            results[run].push_back(sim.get_num_snoop_writebacks());
+            results[run].push_back(sim.get_num_snoop_invalidates());
+            assert(sim.get_num_snoop_invalidates() > 0);
+            assert(sim.get_cache_metric(metric_name_t::INCLUSIVE_INVALIDATES, 2) > 0);
+        }
+        assert(results[0] == results[1]);
+    }
+}
+
 int
 test_main(int argc, const char *argv[])
 {
@@ -841,6 +1055,7 @@ test_main(int argc, const char *argv[])
 
     unit_test_exclusive_cache();
     unit_test_cache_accessors();
+    unit_test_cache_hashtable_lookup();
     unit_test_config_reader(argv[1]);
     unit_test_cache_associativity();
     unit_test_cache_size();
@@ -854,6 +1069,7 @@ test_main(int argc, const char *argv[])
     unit_test_child_hits();
     unit_test_cache_replacement_policy();
     unit_test_core_sharded();
+    unit_test_parallel();
     return 0;
 }
 
@@ -36,7 +36,10 @@
 #include "memref_gen.h"
 #include "tracer/raw2trace.h"
 #include "tracer/raw2trace_directory.h"
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 namespace dynamorio {
@@ -125,6 +128,23 @@ public:
             new test_module_mapper_t(&instrs, drcontext));
         set_modmap_(module_mapper_.get());
     }
+    raw2trace_test_t(const std::vector<std::istream *> &input,
+                     const std::vector<archive_ostream_t *> &output, instrlist_t &instrs,
+                     void *drcontext, uint64_t chunk_instr_count, int worker_count,
+                     uint64_t thread_segment_size,
+                     const std::string &decode_cache_file = "")
+        : raw2trace_t(nullptr, input, {}, output, INVALID_FILE, nullptr, nullptr,
+                      drcontext,
+                      // These sequences are long so we print less.
+                      1, worker_count, /*alt_module_dir=*/"", chunk_instr_count,
+                      /*kthread_files_map=*/ {}, /*kcore_path=*/"",
+                      /*kallsyms_path=*/"", /*syscall_template_file=*/nullptr,
+                      thread_segment_size, decode_cache_file)
+    {
+        module_mapper_ = std::unique_ptr<module_mapper_t>(
+            new test_module_mapper_t(&instrs, drcontext));
+        set_modmap_(module_mapper_.get());
+    }
     raw2trace_test_t(const std::vector<std::istream *> &input,
                      const std::vector<std::ostream *> &output,
                      const std::vector<test_multi_module_mapper_t::bounds_t> &modules,
@@ -3156,6 +3176,337 @@ test_ifiltered(void *drcontext)
 #endif
 }
 
+// Converts each of "raw" as a separate thread into "results".
+bool
+run_raw2trace_archives(void *drcontext,
+                       const std::vector<std::vector<offline_entry_t>> &raw,
+                       instrlist_t *ilist, uint64_t chunk_instr_count, int worker_count,
+                       uint64_t thread_segment_size, std::vector<std::string> &results,
+                       std::vector<uint64_t> &stats,
+                       const std::string &decode_cache_file = "")
+{
+    std::vector<std::unique_ptr<std::istringstream>> raw_in;
+    std::vector<std::istream *> input;
+    std::vector<std::unique_ptr<archive_ostream_test_t>> result_streams;
+    std::vector<archive_ostream_t *> output;
+    for (const auto &thread : raw) {
+        raw_in.emplace_back(new std::istringstream(
+            std::string(reinterpret_cast<const char *>(thread.data()),
+                        reinterpret_cast<const char *>(thread.data() + thread.size()))));
+        input.push_back(raw_in.back().get());
+        result_streams.emplace_back(new archive_ostream_test_t);
+        output.push_back(result_streams.back().get());
+    }
+    raw2trace_test_t raw2trace(input, output, *ilist, drcontext, chunk_instr_count,
+                               worker_count, thread_segment_size, decode_cache_file);
+    std::string error = raw2trace.do_conversion();
+    CHECK(error.empty(), error);
+    results.clear();
+    for (const auto &stream : result_streams)
+        results.push_back(stream->str());
+    stats.clear();
+    populate_all_stats(raw2trace, &stats);
+    return true;
+}
+
+bool
+test_thread_segments(void *drcontext)
+{
+    std::cerr << "\n===============\nTesting thread segments\n";
+    instrlist_t *ilist = instrlist_create(drcontext);
+    // raw2trace doesn't like offsets of 0 so we shift with a nop.
+    instr_t *nop = XINST_CREATE_nop(drcontext);
+    instr_t *move1 =
+        XINST_CREATE_move(drcontext, opnd_create_reg(REG1), opnd_create_reg(REG2));
+    instr_t *load = XINST_CREATE_load(drcontext, opnd_create_reg(REG1),
+                                      OPND_CREATE_MEMPTR(REG2, 0));
+    instr_t *move2 =
+        XINST_CREATE_move(drcontext, opnd_create_reg(REG2), opnd_create_reg(REG1));
+    instr_t *jmp = XINST_CREATE_jump(drcontext, opnd_create_instr(move1));
+    instr_t *jcc =
+        XINST_CREATE_jump_cond(drcontext, DR_PRED_EQ, opnd_create_instr(move1));
+    instr_t *ret = XINST_CREATE_return(drcontext);
+#ifdef X86
+    instr_t *sys = INSTR_CREATE_syscall(drcontext);
+#elif defined(AARCHXX)
+    instr_t *sys = INSTR_CREATE_svc(drcontext, opnd_create_immed_int((sbyte)0x0, OPSZ_1));
+#elif defined(RISCV64)
+    instr_t *sys = INSTR_CREATE_ecall(drcontext);
+#else
+#    error Unsupported architecture.
+#endif
+    instrlist_append(ilist, nop);
+    instrlist_append(ilist, move1);
+    instrlist_append(ilist, load);
+    instrlist_append(ilist, jmp);
+    instrlist_append(ilist, jcc);
+    instrlist_append(ilist, ret);
+    instrlist_append(ilist, move2);
+    instrlist_append(ilist, sys);
+    size_t offs_move1 = instr_length(drcontext, nop);
+    size_t offs_load = offs_move1 + instr_length(drcontext, move1);
+    size_t offs_jmp = offs_load + instr_length(drcontext, load);
+    size_t offs_jcc = offs_jmp + instr_length(drcontext, jmp);
+    size_t offs_ret = offs_jcc + instr_length(drcontext, jcc);
+    size_t offs_move2 = offs_ret + instr_length(drcontext, ret);
+    size_t offs_sys = offs_move2 + instr_length(drcontext, move2);
+
+    // We synthesize threads with many buffers whose final blocks end in delayed
+    // branches, window changes, and syscall sequences which read ahead across
+    // buffers, so that segment boundaries land in all of those.
+    static constexpr int SYSCALL_NUM = 42;
+    std::vector<std::vector<offline_entry_t>> raw(2);
+    for (size_t thread = 0; thread < raw.size(); ++thread) {
+        std::vector<offline_entry_t> &entries = raw[thread];
+        entries.push_back(make_header());
+        entries.push_back(make_tid(static_cast<memref_tid_t>(thread + 1)));
+        entries.push_back(make_pid());
+        entries.push_back(make_line_size());
+        uint64_t timestamp = 100 * (thread + 1);
+        uint64_t window = 0;
+        uint32_t seed = static_cast<uint32_t>(thread + 1);
+        for (int buffer = 0; buffer < 200; ++buffer) {
+            entries.push_back(make_timestamp(++timestamp));
+            entries.push_back(make_core());
+            if (buffer % 37 == 36)
+                entries.push_back(make_window_id(++window));
+            int blocks = 1 + buffer % 5;
+            for (int block = 0; block < blocks; ++block) {
+                seed = seed * 1103515245 + 12345;
+                switch ((seed >> 16) % 7) {
+                case 0:
+                    entries.push_back(make_block(offs_move1, 2));
+                    entries.push_back(make_memref(42 + buffer));
+                    break;
+                case 1:
+                    entries.push_back(make_block(offs_load, 2));
+                    entries.push_back(make_memref(42));
+                    break;
+                case 2: entries.push_back(make_block(offs_jmp, 1)); break;
+                case 3: entries.push_back(make_block(offs_jcc, 1)); break;
+                case 4: entries.push_back(make_block(offs_ret, 1)); break;
+                case 5:
+                    entries.push_back(make_block(offs_move2, 2));
+                    entries.push_back(
+                        make_marker(TRACE_MARKER_TYPE_SYSCALL, SYSCALL_NUM));
+                    if (block == blocks - 1 && buffer % 3 == 0) {
+                        // A duplicate syscall in the next buffer.
+                        entries.push_back(make_timestamp(++timestamp));
+                        entries.push_back(make_core());
+                        entries.push_back(make_block(offs_sys, 1));
+                    }
+                    break;
+                case 6:
+                    // Without a marker this is a false syscall, unless the next
+                    // buffer starts with one.
+                    entries.push_back(make_block(offs_move2, 2));
+                    break;
+                }
+            }
+        }
+        entries.push_back(make_block(offs_move1, 2));
+        entries.push_back(make_memref(42));
+        entries.push_back(make_exit());
+    }
+
+    bool res = true;
+    for (uint64_t chunk_instr_count : std::vector<uint64_t> { 7, 1000 * 1000 }) {
+        std::vector<std::string> expected, results;
+        std::vector<uint64_t> expected_stats, stats;
+        if (!run_raw2trace_archives(drcontext, raw, ilist, chunk_instr_count, 0, 0,
+                                    expected, expected_stats)) {
+            res = false;
+            break;
+        }
+        // A size of 1 splits at every buffer.
+        for (uint64_t segment_size : std::vector<uint64_t> {
+                 1, 16 * sizeof(offline_entry_t), 100 * sizeof(offline_entry_t) }) {
+            for (int worker_count : { 2, 4 }) {
+                if (!run_raw2trace_archives(drcontext, raw, ilist, chunk_instr_count,
+                                            worker_count, segment_size, results,
+                                            stats)) {
+                    res = false;
+                    break;
+                }
+                if (results != expected || stats != expected_stats) {
+                    std::cerr << "Segmented conversion with chunk count "
+                              << chunk_instr_count << ", segment size " << segment_size
+                              << ", and " << worker_count
+                              << " workers differs from serial conversion\n";
+                    res = false;
+                }
+            }
+        }
+    }
+    instrlist_clear_and_destroy(drcontext, ilist);
+    return res;
+}
+
+bool
+test_decode_cache_file(void *drcontext)
+{
+    std::cerr << "\n===============\nTesting decode cache file\n";
+    instrlist_t *ilist = instrlist_create(drcontext);
+    // raw2trace doesn't like offsets of 0 so we shift with a nop.
+    instr_t *nop = XINST_CREATE_nop(drcontext);
+    instr_t *move =
+        XINST_CREATE_move(drcontext, opnd_create_reg(REG1), opnd_create_reg(REG2));
+    // The second load's address is elided, so the cached blocks must carry the
+    // elision flags.
+    instr_t *load1 = XINST_CREATE_load(drcontext, opnd_create_reg(REG1),
+                                       OPND_CREATE_MEMPTR(REG2, 0));
+    instr_t *load2 = XINST_CREATE_load(drcontext, opnd_create_reg(REG1),
+                                       OPND_CREATE_MEMPTR(REG2, 8));
+#ifdef X86_64
+    // A pc-relative address is stored relative to the block.
+    instr_t *load_rel = XINST_CREATE_load(
+        drcontext, opnd_create_reg(REG1),
+        opnd_create_rel_addr(reinterpret_cast<void *>(0x100), OPSZ_PTR));
+#endif
+    instr_t *jmp = XINST_CREATE_jump(drcontext, opnd_create_instr(move));
+    instr_t *ret = XINST_CREATE_return(drcontext);
+    instrlist_append(ilist, nop);
+    instrlist_append(ilist, move);
+    instrlist_append(ilist, load1);
+    instrlist_append(ilist, load2);
+#ifdef X86_64
+    instrlist_append(ilist, load_rel);
+    static constexpr int BLOCK_COUNT = 5;
+#else
+    static constexpr int BLOCK_COUNT = 4;
+#endif
+    instrlist_append(ilist, jmp);
+    instrlist_append(ilist, ret);
+    size_t offs_move = instr_length(drcontext, nop);
+    size_t offs_ret = offs_move;
+    for (instr_t *inst = move; inst != ret; inst = instr_get_next(inst))
+        offs_ret += instr_length(drcontext, inst);
+
+    std::vector<std::vector<offline_entry_t>> raw(1);
+    std::vector<offline_entry_t> &entries = raw[0];
+    entries.push_back(make_header());
+    entries.push_back(make_tid());
+    entries.push_back(make_pid());
+    entries.push_back(make_line_size());
+    for (int i = 0; i < 3; ++i) {
+        entries.push_back(make_timestamp());
+        entries.push_back(make_core());
+        entries.push_back(make_block(offs_move, BLOCK_COUNT));
+        entries.push_back(make_memref(42 + i));
+        entries.push_back(make_block(offs_ret, 1));
+    }
+    entries.push_back(make_exit());
+
+    const std::string path = "raw2trace_unit_tests.decode_cache";
+    std::remove(path.c_str());
+    std::vector<std::string> expected, results;
+    std::vector<uint64_t> stats;
+    bool res = run_raw2trace_archives(drcontext, raw, ilist, 1000, 0, 0, expected, stats);
+    // The first run creates the file and the second uses it.  We then add a torn
+    // record, as a crash mid-append would leave, which must be ignored.
+    for (int run = 0; res && run < 3; ++run) {
+        if (run == 2) {
+            std::ofstream file(path, std::ios::binary | std::ios::app);
+            file << "torn";
+        }
+        for (int worker_count : { 0, 2 }) {
+            if (!run_raw2trace_archives(drcontext, raw, ilist, 1000, worker_count, 0,
+                                        results, stats, path)) {
+                res = false;
+                break;
+            }
+            uint64_t hits = stats[RAW2TRACE_STAT_DECODE_CACHE_FILE_HITS];
+            if (results != expected || (run == 0 && worker_count == 0 && hits != 0) ||
+                (run > 0 && hits == 0)) {
+                std::cerr << "Conversion run " << run << " with " << worker_count
+                          << " workers and " << hits
+                          << " decode cache file hits differs from expected\n";
+                res = false;
+            }
+        }
+    }
+    std::remove(path.c_str());
+    instrlist_clear_and_destroy(drcontext, ilist);
+    return res;
+}
+
+bool
+test_decode_cache_file_rebuild(void *drcontext)
+{
+    std::cerr << "\n===============\nTesting decode cache file with a rebuilt block\n";
+    // The rebuilt ilist swaps the move's operands, which keeps the layout and
+    // module key but changes the block's bytes.
+    auto create_ilist = [drcontext](bool rebuilt) {
+        instrlist_t *ilist = instrlist_create(drcontext);
+        // raw2trace doesn't like offsets of 0 so we shift with a nop.
+        instr_t *nop = XINST_CREATE_nop(drcontext);
+        instr_t *move = XINST_CREATE_move(drcontext,
+                                          opnd_create_reg(rebuilt ? REG2 : REG1),
+                                          opnd_create_reg(rebuilt ? REG1 : REG2));
+        instr_t *load = XINST_CREATE_load(drcontext, opnd_create_reg(REG1),
+                                          OPND_CREATE_MEMPTR(REG2, 0));
+        instr_t *jmp = XINST_CREATE_jump(drcontext, opnd_create_instr(move));
+        instr_t *ret = XINST_CREATE_return(drcontext);
+        instrlist_append(ilist, nop);
+        instrlist_append(ilist, move);
+        instrlist_append(ilist, load);
+        instrlist_append(ilist, jmp);
+        instrlist_append(ilist, ret);
+        return ilist;
+    };
+    instrlist_t *ilist = create_ilist(false);
+    instrlist_t *rebuilt = create_ilist(true);
+    instr_t *move = instr_get_next(instrlist_first(ilist));
+    size_t offs_move = instr_length(drcontext, instrlist_first(ilist));
+    size_t offs_ret = offs_move;
+    for (instr_t *inst = move; inst != instrlist_last(ilist);
+         inst = instr_get_next(inst))
+        offs_ret += instr_length(drcontext, inst);
+
+    std::vector<std::vector<offline_entry_t>> raw(1);
+    std::vector<offline_entry_t> &entries = raw[0];
+    entries.push_back(make_header());
+    entries.push_back(make_tid());
+    entries.push_back(make_pid());
+    entries.push_back(make_line_size());
+    for (int i = 0; i < 3; ++i) {
+        entries.push_back(make_timestamp());
+        entries.push_back(make_core());
+        entries.push_back(make_block(offs_move, 3));
+        entries.push_back(make_memref(42 + i));
+        entries.push_back(make_block(offs_ret, 1));
+    }
+    entries.push_back(make_exit());
+
+    const std::string path = "raw2trace_unit_tests.decode_cache_rebuild";
+    std::remove(path.c_str());
+    std::vector<std::string> expected, results;
+    std::vector<uint64_t> stats;
+    bool res =
+        run_raw2trace_archives(drcontext, raw, rebuilt, 1000, 0, 0, expected, stats);
+    // The first run caches the original blocks.  The second sees different bytes
+    // for the first block and must miss it, and the third must then hit the
+    // replacement record.
+    for (int run = 0; res && run < 3; ++run) {
+        if (!run_raw2trace_archives(drcontext, raw, run == 0 ? ilist : rebuilt,
+                                    1000, 0, 0, results, stats, path)) {
+            res = false;
+            break;
+        }
+        uint64_t hits = stats[RAW2TRACE_STAT_DECODE_CACHE_FILE_HITS];
+        // Only the unchanged return block hits in the second run.
+        if ((run > 0 && results != expected) || hits != static_cast<uint64_t>(run)) {
+            std::cerr << "Conversion run " << run << " with " << hits
+                      << " decode cache file hits differs from expected\n";
+            res = false;
+        }
+    }
+    std::remove(path.c_str());
+    instrlist_clear_and_destroy(drcontext, rebuilt);
+    instrlist_clear_and_destroy(drcontext, ilist);
+    return res;
+}
+
 int
 test_main(int argc, const char *argv[])
 {
@@ -3177,7 +3528,9 @@ test_main(int argc, const char *argv[])
         !test_xfer_modoffs(drcontext) || !test_xfer_absolute(drcontext) ||
         !test_branch_decoration(drcontext) ||
         !test_stats_timestamp_instr_count(drcontext) ||
-        !test_is_maybe_blocking_syscall(drcontext) || !test_ifiltered(drcontext))
+        !test_is_maybe_blocking_syscall(drcontext) || !test_ifiltered(drcontext) ||
+        !test_thread_segments(drcontext) || !test_decode_cache_file(drcontext) ||
+        !test_decode_cache_file_rebuild(drcontext))
         return 1;
     return 0;
 }
@@ -36,6 +36,10 @@
 #include "archive_ostream.h"
 #include "dr_api.h"
 #include "droption.h"
+#include "columnar_file_reader.h"
+#include "columnar_ostream.h"
+#include "compressed_file_reader.h"
+#include "directory_iterator.h"
 #include "tools/basic_counts.h"
 #include "tools/filter/null_filter.h"
 #include "tools/filter/cache_filter.h"
@@ -45,8 +49,13 @@
 #include "tools/filter/encodings2regdeps_filter.h"
 #include "trace_entry.h"
 #include "zipfile_ostream.h"
+#ifdef HAS_ZIP
+#    include "parallel_zipfile_ostream.h"
+#    include "zipfile_istream.h"
+#endif
 
 #include <inttypes.h>
+#include <string.h>
 #include <fstream>
 #include <set>
 #include <vector>
@@ -1194,6 +1203,96 @@ test_null_filter()
     return true;
 }
 
+// Tests that the columnar encoding reproduces the legacy trace exactly in a
+// fraction of its uncompressed size, and that the record_filter reads it and
+// writes its output in it.
+static bool
+test_columnar_output()
+{
+    std::string input_dir = op_tmp_output_dir.get_value() + DIRSEP + "columnar_input";
+    std::string output_dir = op_tmp_output_dir.get_value() + DIRSEP + "columnar_output";
+    if (!local_create_dir(input_dir.c_str()) || !local_create_dir(output_dir.c_str())) {
+        FATAL_ERROR("Failed to create columnar trace dirs %s and %s", input_dir.c_str(),
+                    output_dir.c_str());
+    }
+    uint64_t raw_size = 0;
+    uint64_t columnar_size = 0;
+    directory_iterator_t end_iter;
+    directory_iterator_t iter(op_trace_dir.get_value());
+    CHECK(!!iter, "Failed to list the input trace dir\n");
+    for (; iter != end_iter; ++iter) {
+        const std::string fname = *iter;
+        if (!ends_with(fname, ".trace.gz"))
+            continue;
+        std::vector<trace_entry_t> entries;
+        compressed_record_file_reader_t reader(op_trace_dir.get_value() + DIRSEP + fname);
+        compressed_record_file_reader_t end;
+        CHECK(reader.init(), "Failed to read the input trace\n");
+        for (; reader != end; ++reader)
+            entries.push_back(*reader);
+        std::string path =
+            input_dir + DIRSEP + fname.substr(0, fname.size() - strlen(".gz")) + ".col";
+        {
+            columnar_ostream_t writer(path);
+            writer.write(reinterpret_cast<const char *>(entries.data()),
+                         entries.size() * sizeof(trace_entry_t));
+            CHECK(!!writer, "Failed to write the columnar trace\n");
+        }
+        raw_size += entries.size() * sizeof(trace_entry_t);
+        columnar_size += std::ifstream(path, std::ifstream::ate).tellg();
+        columnar_record_file_reader_t columnar_reader(path);
+        columnar_record_file_reader_t columnar_end;
+        CHECK(columnar_reader.init(), "Failed to read the columnar trace\n");
+        size_t count = 0;
+        for (; columnar_reader != columnar_end; ++columnar_reader, ++count) {
+            CHECK(count < entries.size() &&
+                      memcmp(&*columnar_reader, &entries[count], sizeof(trace_entry_t)) ==
+                          0,
+                  "Columnar trace differs from its input\n");
+        }
+        CHECK(count == entries.size(), "Columnar trace is missing records\n");
+    }
+    CHECK(raw_size > 0, "Bad input trace\n");
+    CHECK(columnar_size * 3 <= raw_size, "Columnar trace is too large\n");
+
+    auto null_filter =
+        std::unique_ptr<record_filter_func_t>(new dynamorio::drmemtrace::null_filter_t());
+    std::vector<std::unique_ptr<record_filter_func_t>> filter_funcs;
+    filter_funcs.push_back(std::move(null_filter));
+    // As in test_null_filter, the small stop_timestamp adds one endpoint marker per
+    // thread.
+    static constexpr uint64_t stop_timestamp_us = 1;
+    auto record_filter = std::unique_ptr<dynamorio::drmemtrace::record_filter_t>(
+        new dynamorio::drmemtrace::record_filter_t(output_dir, std::move(filter_funcs),
+                                                   stop_timestamp_us,
+                                                   /*verbosity=*/0));
+    std::vector<record_analysis_tool_t *> tools;
+    tools.push_back(record_filter.get());
+    record_analyzer_t record_analyzer(input_dir, &tools[0],
+                                      static_cast<int>(tools.size()));
+    if (!record_analyzer) {
+        FATAL_ERROR("Failed to initialize record filter: %s",
+                    record_analyzer.get_error_string().c_str());
+    }
+    if (!record_analyzer.run()) {
+        FATAL_ERROR("Failed to run record filter: %s",
+                    record_analyzer.get_error_string().c_str());
+    }
+    int64_t output_files = 0;
+    for (directory_iterator_t out_iter(output_dir); out_iter != end_iter; ++out_iter) {
+        if (ends_with(*out_iter, ".trace.col"))
+            ++output_files;
+    }
+    basic_counts_t::counters_t c1 = get_basic_counts(op_trace_dir.get_value());
+    c1.other_markers += c1.shard_count;
+    basic_counts_t::counters_t c2 = get_basic_counts(output_dir);
+    CHECK(output_files == c1.shard_count,
+          "Record filter did not write columnar output\n");
+    CHECK(c1 == c2, "Columnar null filter returned different counts\n");
+    fprintf(stderr, "test_columnar_output passed\n");
+    return true;
+}
+
 static bool
 test_wait_filter()
 {
@@ -1236,6 +1335,68 @@ test_wait_filter()
     return true;
 }
 
+#ifdef HAS_ZIP
+// Tests that zipfile components compressed on a pool of threads are written in
+// order, with their names and contents intact.
+static bool
+test_parallel_zip_output()
+{
+    std::vector<trace_entry_t> entries;
+    directory_iterator_t end_iter;
+    directory_iterator_t iter(op_trace_dir.get_value());
+    CHECK(!!iter, "Failed to list the input trace dir\n");
+    for (; iter != end_iter; ++iter) {
+        if (!ends_with(*iter, ".trace.gz"))
+            continue;
+        compressed_record_file_reader_t reader(op_trace_dir.get_value() + DIRSEP +
+                                               *iter);
+        compressed_record_file_reader_t end;
+        CHECK(reader.init(), "Failed to read the input trace\n");
+        for (; reader != end; ++reader)
+            entries.push_back(*reader);
+    }
+    CHECK(!entries.empty(), "Bad input trace\n");
+    // Small components of varying size give the pool plenty to reorder.
+    std::vector<std::pair<std::string, size_t>> components;
+    for (size_t start = 0, size = 1; start < entries.size(); start += size) {
+        size = (components.size() % 5) * 997 + 1;
+        if (start + size > entries.size())
+            size = entries.size() - start;
+        components.emplace_back("chunk." + std::to_string(components.size()), size);
+    }
+    std::string path = op_tmp_output_dir.get_value() + DIRSEP + "parallel.zip";
+    {
+        auto pool = std::make_shared<zipfile_compression_pool_t>(3);
+        parallel_zipfile_ostream_t writer(path, pool);
+        size_t start = 0;
+        for (const auto &component : components) {
+            CHECK(writer.open_new_component(component.first).empty(),
+                  "Failed to open a component\n");
+            writer.write(reinterpret_cast<const char *>(&entries[start]),
+                         component.second * sizeof(trace_entry_t));
+            start += component.second;
+        }
+        CHECK(writer.close().empty(), "Failed to write the zipfile\n");
+    }
+    // Read the components back out of order.
+    zipfile_istream_t reader(path);
+    std::vector<trace_entry_t> buf;
+    size_t end = entries.size();
+    for (auto it = components.rbegin(); it != components.rend(); ++it) {
+        CHECK(reader.open_component(it->first).empty(), "Missing component\n");
+        buf.resize(it->second);
+        CHECK(reader.read(reinterpret_cast<char *>(buf.data()),
+                          buf.size() * sizeof(trace_entry_t)),
+              "Component is too short\n");
+        end -= it->second;
+        CHECK(memcmp(buf.data(), &entries[end], it->second * sizeof(trace_entry_t)) == 0,
+              "Component differs from its input\n");
+    }
+    fprintf(stderr, "test_parallel_zip_output passed\n");
+    return true;
+}
+#endif
+
 int
 test_main(int argc, const char *argv[])
 {
@@ -1247,8 +1408,13 @@ test_main(int argc, const char *argv[])
                     droption_parser_t::usage_short(DROPTION_SCOPE_ALL).c_str());
     }
     if (!test_cache_and_type_filter() || !test_chunk_update() || !test_trim_filter() ||
-        !test_null_filter() || !test_wait_filter() || !test_encodings2regdeps_filter())
+        !test_null_filter() || !test_columnar_output() || !test_wait_filter() ||
+        !test_encodings2regdeps_filter())
+        return 1;
+#ifdef HAS_ZIP
+    if (!test_parallel_zip_output())
         return 1;
+#endif
     fprintf(stderr, "All done!\n");
     return 0;
 }
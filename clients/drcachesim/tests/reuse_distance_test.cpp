@@ -30,7 +30,9 @@
  * DAMAGE.
  */
 
+#include <cmath>
 #include <iostream>
+#include <memory>
 #undef NDEBUG
 #include <assert.h>
 
@@ -86,6 +88,7 @@ public:
     // Make these methods public for testing.
     using reuse_distance_t::get_aggregated_results;
     using reuse_distance_t::print_histogram;
+    using reuse_distance_t::shard_data_t;
 
     std::unordered_map<int, shard_data_t *> &
     get_shard_map()
@@ -507,6 +510,124 @@ data_histogram_test()
     }
 }
 
+// Feeds a pseudo-random mix of short and long reuses to a new reuse_distance
+// test object and returns it.
+static std::unique_ptr<reuse_distance_test_t>
+run_random_stream(const reuse_distance_knobs_t &knobs, int num_refs)
+{
+    constexpr uint32_t NEAR_LINES = 300;
+    constexpr uint32_t FAR_LINES = 5000;
+    std::unique_ptr<reuse_distance_test_t> reuse_distance(
+        new reuse_distance_test_t(knobs));
+    uint32_t seed = 42;
+    for (int i = 0; i < num_refs; ++i) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t rand = seed >> 8;
+        addr_t line = (rand % 4 == 0) ? rand % FAR_LINES : rand % NEAR_LINES;
+        trace_type_t type = (rand % 3 == 0) ? TRACE_TYPE_INSTR : TRACE_TYPE_READ;
+        bool success =
+            reuse_distance->process_memref(generate_memref(line * knobs.line_size, type));
+        assert(success);
+    }
+    return reuse_distance;
+}
+
+static void
+compare_shard_results(const reuse_distance_test_t::shard_data_t *expect,
+                      const reuse_distance_test_t::shard_data_t *actual)
+{
+    assert(actual->total_refs == expect->total_refs);
+    assert(actual->dist_map == expect->dist_map);
+    assert(actual->dist_map_data == expect->dist_map_data);
+    assert(actual->pruned_address_count == expect->pruned_address_count);
+    assert(actual->pruned_address_hits == expect->pruned_address_hits);
+    assert(actual->cache_map.size() == expect->cache_map.size());
+    for (const auto &entry : expect->cache_map) {
+        const auto it = actual->cache_map.find(entry.first);
+        assert(it != actual->cache_map.end());
+        assert(it->second->total_refs == entry.second->total_refs);
+        assert(it->second->distant_refs == entry.second->distant_refs);
+    }
+}
+
+// Test that the order tree produces the same results as the skip list.
+void
+order_tree_test()
+{
+    std::cerr << "order_tree_test()\n";
+    // Enough to renumber the tree's slots several times.
+    constexpr int NUM_REFS = 300000;
+    for (unsigned int distance_limit : { 0, 1000 }) {
+        reuse_distance_knobs_t knobs;
+        knobs.distance_limit = distance_limit;
+        knobs.verify_skip = true;
+        auto skip_list = run_random_stream(knobs, NUM_REFS);
+        knobs.use_order_tree = true;
+        auto order_tree = run_random_stream(knobs, NUM_REFS);
+        compare_shard_results(skip_list->get_aggregated_results(),
+                              order_tree->get_aggregated_results());
+        if (distance_limit > 0) {
+            assert(order_tree->get_aggregated_results()->cache_map.size() ==
+                   distance_limit);
+        }
+    }
+}
+
+// Test sampling's scaled distances and bounded memory.
+void
+sampling_test()
+{
+    std::cerr << "sampling_test()\n";
+    constexpr uint32_t LINE_SIZE = 64;
+    constexpr int NUM_LINES = 20000;
+    constexpr int NUM_PASSES = 4;
+    constexpr unsigned int MAX_LINES = 500;
+    for (bool use_order_tree : { false, true }) {
+        // Every reuse in a cyclic pass over the lines has the same distance.
+        reuse_distance_knobs_t knobs;
+        knobs.line_size = LINE_SIZE;
+        knobs.use_order_tree = use_order_tree;
+        knobs.sample_rate = 0.1;
+        reuse_distance_test_t reuse_distance(knobs);
+        for (int pass = 0; pass < NUM_PASSES; ++pass) {
+            for (int i = 0; i < NUM_LINES; ++i) {
+                bool success =
+                    reuse_distance.process_memref(generate_memref(i * LINE_SIZE));
+                assert(success);
+            }
+        }
+        if (TEST_VERBOSE(1))
+            reuse_distance.print_results();
+        auto *shard = reuse_distance.get_aggregated_results();
+        assert(shard->total_refs == NUM_LINES * NUM_PASSES);
+        assert(shard->sampled_refs < shard->total_refs / 5);
+        double sum = 0.;
+        int64_t count = 0;
+        for (const auto &entry : shard->dist_map) {
+            sum += static_cast<double>(entry.first) * entry.second;
+            count += entry.second;
+        }
+        assert(count > 0);
+        double mean = sum / count;
+        assert(std::abs(mean - (NUM_LINES - 1)) < NUM_LINES * 0.1);
+        assert(std::abs(shard->unique_lines_estimate - NUM_LINES) < NUM_LINES * 0.1);
+        assert(shard->unique_lines_variance > 0.);
+    }
+    // A bound on the lines lowers the rate, and removing the lines dropped
+    // must keep the skip list consistent with the order tree.
+    reuse_distance_knobs_t knobs;
+    knobs.verify_skip = true;
+    knobs.sample_max_lines = MAX_LINES;
+    auto skip_list = run_random_stream(knobs, 100000);
+    knobs.use_order_tree = true;
+    auto order_tree = run_random_stream(knobs, 100000);
+    auto *shard = order_tree->get_aggregated_results();
+    compare_shard_results(skip_list->get_aggregated_results(), shard);
+    assert(shard->cache_map.size() <= MAX_LINES);
+    assert(shard->sample_rate < 1.0);
+    assert(shard->sampled_refs > 0);
+}
+
 int
 test_main(int argc, const char *argv[])
 {
@@ -516,6 +637,8 @@ test_main(int argc, const char *argv[])
     simple_reuse_distance_test();
     reuse_distance_limit_test();
     data_histogram_test();
+    order_tree_test();
+    sampling_test();
     return 0;
 }
 
@@ -0,0 +1,136 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+// Unit tests for the reuse_time tool.
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+#undef NDEBUG
+#include <assert.h>
+
+#include "../tools/reuse_time.h"
+#include "../tools/reuse_time_create.h"
+#include "../common/memref.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+static memref_t
+generate_memref(const addr_t addr)
+{
+    memref_t memref = {};
+    memref.data.type = TRACE_TYPE_READ;
+    memref.data.pid = 1;
+    memref.data.tid = 2;
+    memref.data.addr = addr;
+    memref.data.size = 4;
+    return memref;
+}
+
+class reuse_time_test_t : public reuse_time_t {
+public:
+    reuse_time_test_t(unsigned int line_size, double sample_rate,
+                      unsigned int sample_max_lines)
+        : reuse_time_t(line_size, 0, sample_rate, sample_max_lines)
+    {
+        stream_ = std::unique_ptr<memtrace_stream_t>(new default_memtrace_stream_t);
+        serial_stream_ = stream_.get();
+    }
+
+    const shard_data_t *
+    get_shard()
+    {
+        assert(shard_map_.size() == 1);
+        return shard_map_.begin()->second;
+    }
+
+private:
+    std::unique_ptr<memtrace_stream_t> stream_;
+};
+
+static void
+sampling_test()
+{
+    std::cerr << "sampling_test()\n";
+    constexpr uint32_t LINE_SIZE = 64;
+    constexpr int NUM_LINES = 20000;
+    constexpr int NUM_PASSES = 4;
+    constexpr unsigned int MAX_LINES = 500;
+    // Every reuse in a cyclic pass over the lines has the same time.
+    for (unsigned int max_lines : { 0u, MAX_LINES }) {
+        reuse_time_test_t reuse_time(LINE_SIZE, 0.1, max_lines);
+        for (int pass = 0; pass < NUM_PASSES; ++pass) {
+            for (int i = 0; i < NUM_LINES; ++i) {
+                bool success = reuse_time.process_memref(generate_memref(i * LINE_SIZE));
+                assert(success);
+            }
+        }
+        const auto *shard = reuse_time.get_shard();
+        assert(shard->time_stamp == NUM_LINES * NUM_PASSES);
+        assert(shard->sampled_refs < shard->time_stamp / 5);
+        assert(shard->reuse_time_histogram.size() == 1);
+        const auto &entry = *shard->reuse_time_histogram.begin();
+        // The times are exact and only the count is scaled.
+        assert(entry.first == NUM_LINES);
+        double estimate = shard->sampler.scale(static_cast<double>(entry.second));
+        const double expected = NUM_LINES * (NUM_PASSES - 1);
+        if (max_lines == 0) {
+            assert(std::abs(estimate - expected) < expected * 0.1);
+        } else {
+            assert(shard->time_map.size() <= MAX_LINES);
+            assert(shard->sampler.get_rate() < 0.1);
+        }
+    }
+    // Without sampling every reuse is counted.
+    reuse_time_test_t reuse_time(LINE_SIZE, 1.0, 0);
+    for (int pass = 0; pass < NUM_PASSES; ++pass) {
+        for (int i = 0; i < NUM_LINES; ++i) {
+            bool success = reuse_time.process_memref(generate_memref(i * LINE_SIZE));
+            assert(success);
+        }
+    }
+    const auto *shard = reuse_time.get_shard();
+    assert(shard->sampled_refs == 0);
+    assert(shard->time_map.size() == NUM_LINES);
+    assert(shard->reuse_time_histogram.at(NUM_LINES) == NUM_LINES * (NUM_PASSES - 1));
+}
+
+int
+test_main(int argc, const char *argv[])
+{
+    sampling_test();
+    return 0;
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
@@ -36,6 +36,7 @@
 #include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -1495,6 +1496,131 @@ test_synthetic_with_bindings_weighted()
     assert(sched_as_string[4] == ".BB.BB.BB.BB.B._______________");
 }
 
+static void
+test_synthetic_per_output_queues()
+{
+    std::cerr << "\n----------------\nTesting synthetic with per-output queues\n";
+    static constexpr memref_tid_t TID_BASE = 100;
+    static constexpr char THREAD_LETTER_START = 'A';
+    {
+        // Test that bindings are honored across the separate queues.
+        static constexpr int NUM_INPUTS = 9;
+        static constexpr int NUM_OUTPUTS = 5;
+        static constexpr int NUM_INSTRS = 9;
+        std::vector<scheduler_t::input_workload_t> sched_inputs;
+        std::vector<std::set<scheduler_t::output_ordinal_t>> bindings(NUM_INPUTS);
+        for (int i = 0; i < NUM_INPUTS; i++) {
+            memref_tid_t tid = TID_BASE + i;
+            std::vector<trace_entry_t> inputs;
+            inputs.push_back(make_thread(tid));
+            inputs.push_back(make_pid(1));
+            for (int instr_idx = 0; instr_idx < NUM_INSTRS; instr_idx++) {
+                if (instr_idx % 2 == 0)
+                    inputs.push_back(make_timestamp(10 * (instr_idx + 1) + i));
+                inputs.push_back(make_instr(42 + instr_idx * 4));
+            }
+            inputs.push_back(make_exit(tid));
+            std::vector<scheduler_t::input_reader_t> readers;
+            readers.emplace_back(
+                std::unique_ptr<mock_reader_t>(new mock_reader_t(inputs)),
+                std::unique_ptr<mock_reader_t>(new mock_reader_t()), tid);
+            sched_inputs.emplace_back(std::move(readers));
+            switch (i % 3) {
+            case 0: bindings[i].insert({ 2, 4 }); break;
+            case 1: bindings[i].insert({ 0, 1 }); break;
+            case 2: bindings[i].insert({ 1, 2, 3 }); break;
+            default: assert(false);
+            }
+            sched_inputs.back().thread_modifiers.emplace_back(bindings[i]);
+        }
+        scheduler_t::scheduler_options_t sched_ops(scheduler_t::MAP_TO_ANY_OUTPUT,
+                                                   scheduler_t::DEPENDENCY_TIMESTAMPS,
+                                                   scheduler_t::SCHEDULER_DEFAULTS,
+                                                   /*verbosity=*/3);
+        sched_ops.quantum_duration = 3;
+        sched_ops.per_output_ready_queues = true;
+        scheduler_t scheduler;
+        if (scheduler.init(sched_inputs, NUM_OUTPUTS, std::move(sched_ops)) !=
+            scheduler_t::STATUS_SUCCESS)
+            assert(false);
+        std::vector<std::string> sched_as_string =
+            run_lockstep_simulation(scheduler, NUM_OUTPUTS, TID_BASE);
+        std::vector<int> instr_count(NUM_INPUTS, 0);
+        for (int i = 0; i < NUM_OUTPUTS; i++) {
+            std::cerr << "cpu #" << i << " schedule: " << sched_as_string[i] << "\n";
+            for (char c : sched_as_string[i]) {
+                if (c < 'A' || c > 'Z')
+                    continue;
+                int input = c - THREAD_LETTER_START;
+                assert(bindings[input].find(i) != bindings[input].end());
+                ++instr_count[input];
+            }
+        }
+        for (int i = 0; i < NUM_INPUTS; i++)
+            assert(instr_count[i] == NUM_INSTRS);
+    }
+    {
+        // Test that an output whose queue runs dry steals from the others.
+        // The initial deal places the even inputs, which are short, on output #0
+        // and the odd, long inputs on output #1.
+        static constexpr int NUM_INPUTS = 6;
+        static constexpr int NUM_OUTPUTS = 2;
+        static constexpr int SHORT_INSTRS = 1;
+        static constexpr int LONG_INSTRS = 20;
+        std::vector<scheduler_t::input_workload_t> sched_inputs;
+        for (int i = 0; i < NUM_INPUTS; i++) {
+            memref_tid_t tid = TID_BASE + i;
+            std::vector<trace_entry_t> inputs;
+            inputs.push_back(make_thread(tid));
+            inputs.push_back(make_pid(1));
+            inputs.push_back(make_timestamp(10 + i));
+            int num_instrs = (i % 2 == 0) ? SHORT_INSTRS : LONG_INSTRS;
+            for (int instr_idx = 0; instr_idx < num_instrs; instr_idx++)
+                inputs.push_back(make_instr(42 + instr_idx * 4));
+            inputs.push_back(make_exit(tid));
+            std::vector<scheduler_t::input_reader_t> readers;
+            readers.emplace_back(
+                std::unique_ptr<mock_reader_t>(new mock_reader_t(inputs)),
+                std::unique_ptr<mock_reader_t>(new mock_reader_t()), tid);
+            sched_inputs.emplace_back(std::move(readers));
+        }
+        scheduler_t::scheduler_options_t sched_ops(scheduler_t::MAP_TO_ANY_OUTPUT,
+                                                   scheduler_t::DEPENDENCY_TIMESTAMPS,
+                                                   scheduler_t::SCHEDULER_DEFAULTS,
+                                                   /*verbosity=*/3);
+        sched_ops.quantum_duration = 3;
+        sched_ops.per_output_ready_queues = true;
+        // Disable the wall-clock-based rebalancing to keep the test deterministic.
+        sched_ops.rebalance_period = 0;
+        scheduler_t scheduler;
+        if (scheduler.init(sched_inputs, NUM_OUTPUTS, std::move(sched_ops)) !=
+            scheduler_t::STATUS_SUCCESS)
+            assert(false);
+        std::vector<std::string> sched_as_string =
+            run_lockstep_simulation(scheduler, NUM_OUTPUTS, TID_BASE);
+        int instrs = 0;
+        for (int i = 0; i < NUM_OUTPUTS; i++) {
+            std::cerr << "cpu #" << i << " schedule: " << sched_as_string[i] << "\n";
+            instrs += static_cast<int>(
+                std::count_if(sched_as_string[i].begin(), sched_as_string[i].end(),
+                              [](char c) { return c >= 'A' && c <= 'Z'; }));
+        }
+        assert(instrs == NUM_INPUTS / 2 * (SHORT_INSTRS + LONG_INSTRS));
+        // The short inputs finish quickly on #0 which then steals long ones from #1.
+        assert(sched_as_string[0][1] == 'A' && sched_as_string[1][1] == 'B');
+        assert(scheduler.get_stream(0)->get_schedule_statistic(
+                   memtrace_stream_t::SCHED_STAT_RUNQUEUE_STEALS) > 0);
+        assert(scheduler.get_stream(0)->get_schedule_statistic(
+                   memtrace_stream_t::SCHED_STAT_RUNQUEUE_REBALANCES) == 0);
+        int64_t migrations = 0;
+        for (int i = 0; i < NUM_OUTPUTS; i++) {
+            migrations += scheduler.get_stream(i)->get_schedule_statistic(
+                memtrace_stream_t::SCHED_STAT_MIGRATIONS);
+        }
+        assert(migrations > 0);
+    }
+}
+
 static void
 test_synthetic_with_syscalls_multiple()
 {
@@ -4346,6 +4472,249 @@ test_record_scheduler()
     check_next(stream0, record_scheduler_t::STATUS_EOF);
 }
 
+// Returns a description of each record, or an empty vector on failure.
+static std::vector<std::string>
+read_with_read_ahead(const std::string &path, int read_ahead_threads,
+                     uint64_t skip_instrs, int64_t *buffers_filled)
+{
+    scheduler_t scheduler;
+    std::vector<scheduler_t::input_workload_t> sched_inputs;
+    sched_inputs.emplace_back(path);
+    if (skip_instrs > 0) {
+        std::vector<scheduler_t::range_t> regions;
+        regions.emplace_back(skip_instrs, 0);
+        sched_inputs[0].thread_modifiers.push_back(
+            scheduler_t::input_thread_info_t(regions));
+    }
+    scheduler_t::scheduler_options_t sched_ops(scheduler_t::MAP_TO_ANY_OUTPUT,
+                                               scheduler_t::DEPENDENCY_TIMESTAMPS,
+                                               scheduler_t::SCHEDULER_DEFAULTS);
+    sched_ops.read_ahead_threads = read_ahead_threads;
+    // Use tiny buffers to exercise many refills.
+    sched_ops.read_ahead_depth = 2;
+    sched_ops.read_ahead_buffer_size = 4096;
+    if (scheduler.init(sched_inputs, 1, std::move(sched_ops)) !=
+        scheduler_t::STATUS_SUCCESS)
+        return {};
+    std::vector<std::string> records;
+    auto *stream = scheduler.get_stream(0);
+    memref_t memref;
+    for (scheduler_t::stream_status_t status = stream->next_record(memref);
+         status != scheduler_t::STATUS_EOF; status = stream->next_record(memref)) {
+        if (status == scheduler_t::STATUS_WAIT || status == scheduler_t::STATUS_IDLE)
+            continue;
+        assert(status == scheduler_t::STATUS_OK);
+        records.push_back(std::to_string(memref.data.tid) + ":" +
+                          std::to_string(memref.data.type) + ":" +
+                          std::to_string(memref.data.addr) + ":" +
+                          std::to_string(memref.data.size));
+    }
+    *buffers_filled =
+        scheduler.get_read_ahead_statistic(scheduler_t::READ_AHEAD_STAT_BUFFERS_FILLED);
+    for (int i = 0; i < scheduler_t::READ_AHEAD_STAT_TYPE_COUNT; ++i) {
+        int64_t value = scheduler.get_read_ahead_statistic(
+            static_cast<scheduler_t::read_ahead_statistic_t>(i));
+        assert(read_ahead_threads > 0 ? value >= 0 : value == -1);
+    }
+    return records;
+}
+
+static std::vector<std::string>
+read_records_with_read_ahead(const std::string &path, int read_ahead_threads)
+{
+    record_scheduler_t scheduler;
+    std::vector<record_scheduler_t::input_workload_t> sched_inputs;
+    sched_inputs.emplace_back(path);
+    record_scheduler_t::scheduler_options_t sched_ops =
+        record_scheduler_t::make_scheduler_parallel_options();
+    sched_ops.read_ahead_threads = read_ahead_threads;
+    sched_ops.read_ahead_depth = 3;
+    sched_ops.read_ahead_buffer_size = 1000;
+    static constexpr int NUM_OUTPUTS = 2;
+    if (scheduler.init(sched_inputs, NUM_OUTPUTS, std::move(sched_ops)) !=
+        record_scheduler_t::STATUS_SUCCESS)
+        return {};
+    std::vector<std::string> records;
+    for (int i = 0; i < NUM_OUTPUTS; ++i) {
+        auto *stream = scheduler.get_stream(i);
+        trace_entry_t entry;
+        for (record_scheduler_t::stream_status_t status = stream->next_record(entry);
+             status != record_scheduler_t::STATUS_EOF;
+             status = stream->next_record(entry)) {
+            if (status == record_scheduler_t::STATUS_WAIT ||
+                status == record_scheduler_t::STATUS_IDLE)
+                continue;
+            assert(status == record_scheduler_t::STATUS_OK);
+            records.push_back(std::to_string(stream->get_input_stream_ordinal()) + ":" +
+                              std::to_string(entry.type) + ":" +
+                              std::to_string(entry.size) + ":" +
+                              std::to_string(entry.addr));
+        }
+    }
+    if (read_ahead_threads > 0) {
+        assert(scheduler.get_read_ahead_statistic(
+                   record_scheduler_t::READ_AHEAD_STAT_BUFFERS_FILLED) > 0);
+    }
+    return records;
+}
+
+static void
+test_read_ahead(const char *testdir)
+{
+    std::cerr << "\n----------------\nTesting read-ahead\n";
+#ifdef HAS_ZLIB
+    std::string gz_path =
+        std::string(testdir) + "/drmemtrace.legacy-for-record-filter.x64.tracedir";
+    for (uint64_t skip : { 0, 20 }) {
+        int64_t filled_without, filled_with;
+        std::vector<std::string> without =
+            read_with_read_ahead(gz_path, 0, skip, &filled_without);
+        std::vector<std::string> with =
+            read_with_read_ahead(gz_path, 2, skip, &filled_with);
+        assert(!without.empty());
+        assert(with == without);
+        assert(filled_without == -1);
+        assert(filled_with > 0);
+    }
+    {
+        std::vector<std::string> without = read_records_with_read_ahead(gz_path, 0);
+        std::vector<std::string> with = read_records_with_read_ahead(gz_path, 3);
+        assert(!without.empty());
+        assert(with == without);
+    }
+#endif
+#if (defined(X86_64) || defined(ARM_64)) && defined(HAS_ZIP)
+    // Zipfiles are split into chunks, which skipping jumps over.
+    std::string zip_path = std::string(testdir) + "/drmemtrace.threadsig.x64.tracedir";
+    for (uint64_t skip : { 0, 50000 }) {
+        int64_t filled_without, filled_with;
+        std::vector<std::string> without =
+            read_with_read_ahead(zip_path, 0, skip, &filled_without);
+        std::vector<std::string> with =
+            read_with_read_ahead(zip_path, 4, skip, &filled_with);
+        assert(!without.empty());
+        assert(with == without);
+        assert(filled_with > 0);
+    }
+#endif
+}
+
+static std::vector<memref_t>
+run_record_batches(int max_records, std::vector<std::string> *batch_strings,
+                   std::vector<uint64_t> *ordinals)
+{
+    static constexpr int NUM_INPUTS = 3;
+    static constexpr int NUM_INSTRS = 9;
+    static constexpr int QUANTUM_DURATION = 3;
+    static constexpr memref_tid_t TID_BASE = 100;
+    std::vector<scheduler_t::input_workload_t> sched_inputs;
+    for (int i = 0; i < NUM_INPUTS; i++) {
+        memref_tid_t tid = TID_BASE + i;
+        std::vector<trace_entry_t> inputs;
+        inputs.push_back(make_thread(tid));
+        inputs.push_back(make_pid(1));
+        inputs.push_back(make_version(TRACE_ENTRY_VERSION));
+        inputs.push_back(make_timestamp(10));
+        for (int j = 0; j < NUM_INSTRS; j++)
+            inputs.push_back(make_instr(42 + j * 4));
+        inputs.push_back(make_exit(tid));
+        std::vector<scheduler_t::input_reader_t> readers;
+        readers.emplace_back(std::unique_ptr<mock_reader_t>(new mock_reader_t(inputs)),
+                             std::unique_ptr<mock_reader_t>(new mock_reader_t()), tid);
+        sched_inputs.emplace_back(std::move(readers));
+    }
+    // Skipping happens inside a batch, so include a region of interest.
+    std::vector<scheduler_t::range_t> regions;
+    regions.emplace_back(4, 7);
+    sched_inputs[1].thread_modifiers.push_back(scheduler_t::input_thread_info_t(regions));
+    scheduler_t::scheduler_options_t sched_ops(scheduler_t::MAP_TO_ANY_OUTPUT,
+                                               scheduler_t::DEPENDENCY_IGNORE,
+                                               scheduler_t::SCHEDULER_DEFAULTS,
+                                               /*verbosity=*/3);
+    sched_ops.quantum_duration = QUANTUM_DURATION;
+    scheduler_t scheduler;
+    if (scheduler.init(sched_inputs, 1, std::move(sched_ops)) !=
+        scheduler_t::STATUS_SUCCESS)
+        assert(false);
+    auto *stream = scheduler.get_stream(0);
+    std::vector<memref_t> records;
+    std::vector<memref_t> batch(max_records > 0 ? max_records : 1);
+    while (true) {
+        scheduler_t::stream_status_t status;
+        int num_records = 0;
+        if (max_records > 0) {
+            status = stream->next_record_batch(batch.data(), max_records, num_records);
+        } else {
+            status = stream->next_record(batch[0]);
+            if (status == scheduler_t::STATUS_OK)
+                num_records = 1;
+        }
+        if (status == scheduler_t::STATUS_EOF)
+            break;
+        assert(status == scheduler_t::STATUS_OK);
+        assert(num_records > 0);
+        std::string batch_string;
+        for (int i = 0; i < num_records; ++i) {
+            // A batch never spans a context switch.
+            assert(batch[i].instr.tid == batch[0].instr.tid);
+            // The stream state reflects the final record.
+            if (i == num_records - 1)
+                assert(stream->get_tid() == batch[i].instr.tid);
+            batch_string += type_is_instr(batch[i].instr.type)
+                ? static_cast<char>('A' + batch[i].instr.tid - TID_BASE)
+                : '.';
+            records.push_back(batch[i]);
+        }
+        batch_strings->push_back(batch_string);
+        ordinals->push_back(stream->get_record_ordinal());
+        ordinals->push_back(stream->get_instruction_ordinal());
+    }
+    return records;
+}
+
+static void
+test_record_batches()
+{
+    std::cerr << "\n----------------\nTesting record batches\n";
+    std::vector<std::string> single_strings;
+    std::vector<uint64_t> single_ordinals;
+    std::vector<memref_t> single =
+        run_record_batches(0, &single_strings, &single_ordinals);
+    std::string single_string;
+    for (const std::string &str : single_strings)
+        single_string += str;
+    std::cerr << "per-record schedule: " << single_string << "\n";
+    for (int max_records : { 1, 2, 5, 256 }) {
+        std::vector<std::string> batch_strings;
+        std::vector<uint64_t> batch_ordinals;
+        std::vector<memref_t> batched =
+            run_record_batches(max_records, &batch_strings, &batch_ordinals);
+        // The same records are delivered in the same order.
+        assert(batched.size() == single.size());
+        for (size_t i = 0; i < single.size(); ++i) {
+            assert(batched[i].instr.tid == single[i].instr.tid);
+            assert(batched[i].instr.type == single[i].instr.type);
+            assert(batched[i].instr.addr == single[i].instr.addr);
+        }
+        // The stream ordinals after each batch match those after the same
+        // record when reading one at a time.
+        size_t index = 0;
+        std::string batch_string;
+        for (size_t i = 0; i < batch_strings.size(); ++i) {
+            assert(static_cast<int>(batch_strings[i].size()) <= max_records);
+            batch_string += batch_strings[i];
+            index += batch_strings[i].size();
+            for (int j = 0; j < 2; ++j)
+                assert(batch_ordinals[i * 2 + j] == single_ordinals[(index - 1) * 2 + j]);
+        }
+        std::cerr << "batch size " << max_records << " schedule: " << batch_string
+                  << " in " << batch_strings.size() << " batches\n";
+        assert(batch_string == single_string);
+        if (max_records > 1)
+            assert(batch_strings.size() < single_strings.size());
+    }
+}
+
 int
 test_main(int argc, const char *argv[])
 {
@@ -4366,6 +4735,7 @@ test_main(int argc, const char *argv[])
     test_synthetic_with_priorities();
     test_synthetic_with_bindings();
     test_synthetic_with_bindings_weighted();
+    test_synthetic_per_output_queues();
     test_synthetic_with_syscalls();
     test_synthetic_multi_threaded(argv[1]);
     test_speculation();
@@ -4385,6 +4755,8 @@ test_main(int argc, const char *argv[])
     test_kernel_switch_sequences();
     test_random_schedule();
     test_record_scheduler();
+    test_read_ahead(argv[1]);
+    test_record_batches();
 
     dr_standalone_exit();
     return 0;
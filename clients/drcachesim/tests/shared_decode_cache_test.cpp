@@ -0,0 +1,209 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Unit tests for shared_decode_cache_t. */
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "dr_api.h"
+#include "../tools/shared_decode_cache.h"
+#include "memref_gen.h"
+#include "test_helpers.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+namespace {
+
+struct encoded_instr_t {
+    int opcode;
+    size_t length;
+    unsigned char bits[MAX_ENCODING_LENGTH];
+};
+
+encoded_instr_t
+encode(instr_t *instr, app_pc pc)
+{
+    encoded_instr_t encoded;
+    encoded.opcode = instr_get_opcode(instr);
+    byte *end = instr_encode_to_copy(GLOBAL_DCONTEXT, instr, encoded.bits, pc);
+    assert(end != nullptr);
+    encoded.length = end - encoded.bits;
+    instr_destroy(GLOBAL_DCONTEXT, instr);
+    return encoded;
+}
+
+bool
+test_hits_and_misses(void *dcontext)
+{
+    const app_pc pc = reinterpret_cast<app_pc>(0x1000);
+    std::vector<encoded_instr_t> instrs = {
+        encode(XINST_CREATE_nop(GLOBAL_DCONTEXT), pc),
+        encode(XINST_CREATE_move(GLOBAL_DCONTEXT, opnd_create_reg(REG1),
+                                 opnd_create_reg(REG2)),
+               pc),
+        encode(XINST_CREATE_load(GLOBAL_DCONTEXT, opnd_create_reg(REG1),
+                                 OPND_CREATE_MEMPTR(REG2, 0)),
+               pc),
+    };
+    shared_decode_cache_t cache(dcontext);
+    decode_cache_stats_t stats;
+    for (int round = 0; round < 2; ++round) {
+        // Each instruction is at the same pc, as code which changes would be.
+        for (const auto &instr : instrs) {
+            decode_info_t info;
+            if (!cache.lookup(pc, instr.bits, instr.length, &info, &stats)) {
+                std::cerr << "Failed to decode opcode " << instr.opcode << "\n";
+                return false;
+            }
+            assert(info.opcode == instr.opcode);
+        }
+    }
+    if (stats.misses != 3 || stats.hits != 3 || stats.uncached != 0 ||
+        cache.get_entry_count() != 3) {
+        std::cerr << "Unexpected counts: " << stats.misses << " misses "
+                  << stats.hits << " hits " << stats.uncached << " uncached "
+                  << cache.get_entry_count() << " entries\n";
+        return false;
+    }
+    decode_info_t info;
+    assert(cache.lookup(pc, instrs[2].bits, instrs[2].length, &info, &stats));
+    assert(info.reads_memory && !info.writes_memory && !info.is_cti);
+    // An invalid length is rejected rather than decoded.
+    assert(!cache.lookup(pc, instrs[0].bits, 0, &info, &stats));
+    return true;
+}
+
+bool
+test_memory_cap(void *dcontext)
+{
+    const app_pc base = reinterpret_cast<app_pc>(0x1000);
+    encoded_instr_t nop = encode(XINST_CREATE_nop(GLOBAL_DCONTEXT), base);
+    // The smallest cache possible.
+    shared_decode_cache_t cache(dcontext, 0);
+    const size_t count = cache.get_max_entries() * 2;
+    decode_cache_stats_t stats;
+    for (size_t i = 0; i < count; ++i) {
+        decode_info_t info;
+        assert(cache.lookup(base + i * 16, nop.bits, nop.length, &info, &stats));
+        assert(info.opcode == nop.opcode);
+    }
+    if (cache.get_entry_count() != cache.get_max_entries() ||
+        stats.misses != static_cast<int64_t>(cache.get_max_entries()) ||
+        stats.uncached != static_cast<int64_t>(count - cache.get_max_entries())) {
+        std::cerr << "Cap not enforced: " << cache.get_entry_count() << " entries "
+                  << stats.misses << " misses " << stats.uncached << " uncached\n";
+        return false;
+    }
+    return true;
+}
+
+bool
+test_concurrent_lookups(void *dcontext)
+{
+    const app_pc base = reinterpret_cast<app_pc>(0x1000);
+    std::vector<encoded_instr_t> instrs = {
+        encode(XINST_CREATE_nop(GLOBAL_DCONTEXT), base),
+        encode(XINST_CREATE_move(GLOBAL_DCONTEXT, opnd_create_reg(REG1),
+                                 opnd_create_reg(REG2)),
+               base),
+    };
+    constexpr int kThreads = 8;
+    constexpr int kPcs = 512;
+    constexpr int kRounds = 50;
+    shared_decode_cache_t cache(dcontext);
+    std::vector<decode_cache_stats_t> stats(kThreads);
+    // Not vector<bool>, whose elements cannot be written concurrently.
+    std::vector<char> ok(kThreads, true);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int round = 0; round < kRounds; ++round) {
+                // Each thread walks the pcs from a different place so that they
+                // race to insert different entries.
+                for (int i = 0; i < kPcs; ++i) {
+                    int index = (i + t * kPcs / kThreads) % kPcs;
+                    const encoded_instr_t &instr = instrs[index % instrs.size()];
+                    decode_info_t info;
+                    if (!cache.lookup(base + index * 16, instr.bits, instr.length,
+                                      &info, &stats[t]) ||
+                        info.opcode != instr.opcode)
+                        ok[t] = false;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    decode_cache_stats_t total;
+    for (int t = 0; t < kThreads; ++t) {
+        if (!ok[t]) {
+            std::cerr << "Thread " << t << " saw a wrong decoding\n";
+            return false;
+        }
+        total += stats[t];
+    }
+    // Racing inserts of one instruction may each decode it and count a miss, but
+    // only one entry is kept.
+    if (cache.get_entry_count() != kPcs || total.misses < kPcs ||
+        total.hits + total.misses != kThreads * kPcs * kRounds || total.uncached != 0) {
+        std::cerr << "Unexpected concurrent counts: " << cache.get_entry_count()
+                  << " entries " << total.misses << " misses " << total.hits
+                  << " hits\n";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int
+test_main(int argc, const char *argv[])
+{
+    void *dcontext = dr_standalone_init();
+    bool res = test_hits_and_misses(dcontext) && test_memory_cap(dcontext) &&
+        test_concurrent_lookups(dcontext);
+    dr_standalone_exit();
+    if (res) {
+        std::cerr << "shared_decode_cache_test passed\n";
+        return 0;
+    }
+    std::cerr << "shared_decode_cache_test FAILED\n";
+    exit(1);
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
@@ -33,11 +33,24 @@
 /* Unit tests for the skip feature. */
 
 #include "droption.h"
+#include "compressed_file_reader.h"
+#ifdef UNIX
+#    include "mmap_file_reader.h"
+#endif
+#include "record_file_reader.h"
+#include "seek_index.h"
 #include "zipfile_file_reader.h"
 #include "tools/view_create.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace dynamorio {
 namespace drmemtrace {
@@ -160,6 +173,216 @@ test_skip_initial()
     return true;
 }
 
+// Writes the concatenation of the components of the zipfile trace at "zip_path",
+// which is the same trace in single-file form, both uncompressed to "raw_path" and
+// gzipped to "gz_path".
+bool
+write_single_file_traces(const std::string &zip_path, const std::string &raw_path,
+                         const std::string &gz_path)
+{
+    unzFile zip = unzOpen(zip_path.c_str());
+    CHECK(zip != nullptr, "failed to open zipfile");
+    std::ofstream raw(raw_path, std::ofstream::binary);
+    gzFile gz = gzopen(gz_path.c_str(), "wb");
+    CHECK(raw && gz != nullptr, "failed to create single-file traces");
+    char buf[4096];
+    for (int res = unzGoToFirstFile(zip); res == UNZ_OK; res = unzGoToNextFile(zip)) {
+        CHECK(unzOpenCurrentFile(zip) == UNZ_OK, "failed to open component");
+        int len;
+        while ((len = unzReadCurrentFile(zip, buf, sizeof(buf))) > 0) {
+            raw.write(buf, len);
+            CHECK(gzwrite(gz, buf, len) == len, "failed to write gzip file");
+        }
+        CHECK(len == 0 && unzCloseCurrentFile(zip) == UNZ_OK,
+              "failed to read component");
+        // End the deflate block, so this small file has restart points past its
+        // start which depend on the prior window.
+        CHECK(gzflush(gz, Z_SYNC_FLUSH) == Z_OK, "failed to flush gzip file");
+    }
+    unzClose(zip);
+    CHECK(gzclose(gz) == Z_OK, "failed to finish gzip file");
+    raw.close();
+    return !!raw;
+}
+
+std::unique_ptr<reader_t>
+open_single_file_reader(const std::string &path, bool gzipped, bool mapped = false)
+{
+#ifdef UNIX
+    if (mapped) {
+        if (path.empty())
+            return std::unique_ptr<reader_t>(new mmap_file_reader_t());
+        return std::unique_ptr<reader_t>(new mmap_file_reader_t(path));
+    }
+#endif
+    if (path.empty()) {
+        if (gzipped)
+            return std::unique_ptr<reader_t>(new compressed_file_reader_t());
+        return std::unique_ptr<reader_t>(new file_reader_t<std::ifstream *>());
+    }
+    if (gzipped)
+        return std::unique_ptr<reader_t>(new compressed_file_reader_t(path));
+    return std::unique_ptr<reader_t>(new file_reader_t<std::ifstream *>(path));
+}
+
+// Returns the view tool output after skipping "skip_instrs" instructions and then,
+// if "mid_skip" is non-zero, a few records later skipping "mid_skip" more.
+bool
+view_with_skips(const std::string &path, bool gzipped, uint64_t skip_instrs,
+                uint64_t mid_skip, std::string *output, bool mapped = false)
+{
+    std::stringstream capture;
+    std::streambuf *prior = std::cerr.rdbuf(capture.rdbuf());
+    std::unique_ptr<reader_t> iter = open_single_file_reader(path, gzipped, mapped);
+    CHECK(!!iter, "failed to open single-file trace");
+    CHECK(iter->init(), "failed to initialize reader");
+    std::unique_ptr<reader_t> iter_end = open_single_file_reader("", gzipped, mapped);
+    std::unique_ptr<analysis_tool_t> tool = std::unique_ptr<analysis_tool_t>(
+        view_tool_create("", /*skip_refs=*/0, /*sim_refs=*/0, "att"));
+    std::string error = tool->initialize_stream(iter.get());
+    CHECK(error.empty(), error.c_str());
+    iter->skip_instructions(skip_instrs);
+    for (int count = 0; *iter != *iter_end; ++count) {
+        if (mid_skip > 0 && count == 3)
+            iter->skip_instructions(mid_skip);
+        else {
+            CHECK(tool->process_memref(**iter), tool->get_error_string().c_str());
+            ++(*iter);
+        }
+    }
+    std::cerr.rdbuf(prior);
+    *output = capture.str();
+    return true;
+}
+
+// Checks that skipping via a seek index produces exactly what skipping by reading
+// through the trace does, for single-file traces of each codec we can write here.
+bool
+test_skip_with_seek_index()
+{
+    const std::string raw_path = "skip_unit_tests.trace";
+    const std::string gz_path = "skip_unit_tests.trace.gz";
+    if (!write_single_file_traces(op_trace_file.get_value(), raw_path, gz_path))
+        return false;
+    constexpr uint64_t MAX_SKIP = 140;
+    constexpr uint64_t MID_SKIP = 37;
+    for (bool gzipped : { false, true }) {
+        const std::string &path = gzipped ? gz_path : raw_path;
+        const std::string index_path = path + DRMEMTRACE_SEEK_INDEX_SUFFIX;
+        remove(index_path.c_str());
+        std::vector<std::string> expect;
+        for (uint64_t skip_instrs = 0; skip_instrs < MAX_SKIP; skip_instrs++) {
+            for (uint64_t mid_skip : { static_cast<uint64_t>(0), MID_SKIP }) {
+                expect.emplace_back();
+                if (!view_with_skips(path, gzipped, skip_instrs, mid_skip,
+                                     &expect.back()))
+                    return false;
+            }
+        }
+        // Use tiny spacing so most skips resume from an index point, and gzip
+        // restarts from mid-file.
+        std::unique_ptr<seekable_input_t> input;
+        if (gzipped)
+            input.reset(new gzip_seekable_input_t(path));
+        else
+            input.reset(new raw_seekable_input_t(path));
+        seek_index_builder_t builder(
+            std::move(input), gzipped ? SEEK_INDEX_CODEC_GZIP : SEEK_INDEX_CODEC_NONE,
+            /*interval=*/5, /*span=*/64);
+        std::string error = builder.build(path);
+        CHECK(error.empty(), error.c_str());
+        seek_index_t index;
+        seek_index_point_t point;
+        seek_index_restart_t restart;
+        CHECK(index.open(path), "failed to open seek index");
+        CHECK(index.find(MAX_SKIP, 0, &point, &restart) && point.instr_ordinal > 0,
+              "seek index has no points");
+        size_t i = 0;
+        for (uint64_t skip_instrs = 0; skip_instrs < MAX_SKIP; skip_instrs++) {
+            for (uint64_t mid_skip : { static_cast<uint64_t>(0), MID_SKIP }) {
+                if (op_verbose.get_value()) {
+                    std::cout << "Testing " << path << " skip " << skip_instrs
+                              << " then " << mid_skip << "\n";
+                }
+                std::string res;
+                if (!view_with_skips(path, gzipped, skip_instrs, mid_skip, &res))
+                    return false;
+                if (res != expect[i]) {
+                    std::cerr << "Expected:\n"
+                              << expect[i] << "\nGot:\n"
+                              << res << "\n";
+                }
+                CHECK(res == expect[i], "seek index skip mismatch");
+                ++i;
+            }
+        }
+        remove(index_path.c_str());
+    }
+    remove(raw_path.c_str());
+    remove(gz_path.c_str());
+    return true;
+}
+
+// Checks that the mapped readers produce exactly what the stream readers do, for
+// both reader_t and record_reader_t, and with and without a seek index.
+bool
+test_mmap_reader()
+{
+#ifdef UNIX
+    const std::string raw_path = "skip_unit_tests_mmap.trace";
+    const std::string gz_path = "skip_unit_tests_mmap.trace.gz";
+    if (!write_single_file_traces(op_trace_file.get_value(), raw_path, gz_path))
+        return false;
+    constexpr uint64_t MAX_SKIP = 140;
+    constexpr uint64_t MID_SKIP = 37;
+    const std::string index_path = raw_path + DRMEMTRACE_SEEK_INDEX_SUFFIX;
+    remove(index_path.c_str());
+    for (bool indexed : { false, true }) {
+        if (indexed) {
+            seek_index_builder_t builder(
+                std::unique_ptr<seekable_input_t>(new raw_seekable_input_t(raw_path)),
+                SEEK_INDEX_CODEC_NONE, /*interval=*/5, /*span=*/64);
+            std::string error = builder.build(raw_path);
+            CHECK(error.empty(), error.c_str());
+        }
+        for (uint64_t skip_instrs = 0; skip_instrs < MAX_SKIP; skip_instrs++) {
+            for (uint64_t mid_skip : { static_cast<uint64_t>(0), MID_SKIP }) {
+                std::string expect, res;
+                if (!view_with_skips(raw_path, false, skip_instrs, mid_skip, &expect) ||
+                    !view_with_skips(raw_path, false, skip_instrs, mid_skip, &res,
+                                     /*mapped=*/true))
+                    return false;
+                if (res != expect) {
+                    std::cerr << "Expected:\n"
+                              << expect << "\nGot:\n"
+                              << res << "\n";
+                }
+                CHECK(res == expect, "mapped reader skip mismatch");
+            }
+        }
+    }
+    remove(index_path.c_str());
+    record_file_reader_t<std::ifstream> expect(raw_path);
+    mmap_record_file_reader_t mapped(raw_path);
+    CHECK(expect.init() && mapped.init(), "failed to initialize record readers");
+    record_file_reader_t<std::ifstream> expect_end;
+    mmap_record_file_reader_t mapped_end;
+    while (expect != expect_end) {
+        CHECK(mapped != mapped_end, "mapped record reader ended early");
+        CHECK(memcmp(&*expect, &*mapped, sizeof(trace_entry_t)) == 0 &&
+                  expect.get_record_ordinal() == mapped.get_record_ordinal() &&
+                  expect.get_instruction_ordinal() == mapped.get_instruction_ordinal(),
+              "mapped record reader mismatch");
+        ++expect;
+        ++mapped;
+    }
+    CHECK(mapped == mapped_end, "mapped record reader did not end");
+    remove(raw_path.c_str());
+    remove(gz_path.c_str());
+#endif
+    return true;
+}
+
 int
 test_main(int argc, const char *argv[])
 {
@@ -170,7 +393,7 @@ test_main(int argc, const char *argv[])
         FATAL_ERROR("Usage error: %s\nUsage:\n%s", parse_err.c_str(),
                     droption_parser_t::usage_short(DROPTION_SCOPE_ALL).c_str());
     }
-    if (!test_skip_initial())
+    if (!test_skip_initial() || !test_skip_with_seek_index() || !test_mmap_reader())
         return 1;
     // TODO i#5538: Add tests that skip from the middle once we have full support
     // for duplicating the timestamp,cpu in that scenario.
@@ -244,6 +244,24 @@ basic_counts_t::parallel_shard_memref(void *shard_data, const memref_t &memref)
     return true;
 }
 
+bool
+basic_counts_t::parallel_shard_batch_supported()
+{
+    return true;
+}
+
+bool
+basic_counts_t::parallel_shard_memref_batch(void *shard_data, const memref_t *memrefs,
+                                            size_t num_memrefs)
+{
+    for (size_t i = 0; i < num_memrefs; ++i) {
+        // A direct call, which the compiler can inline.
+        if (!basic_counts_t::parallel_shard_memref(shard_data, memrefs[i]))
+            return false;
+    }
+    return true;
+}
+
 bool
 basic_counts_t::process_memref(const memref_t &memref)
 {
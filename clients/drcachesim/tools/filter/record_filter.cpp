@@ -45,10 +45,12 @@
 #include <utility>
 #include <vector>
 
+#include "common/columnar_ostream.h"
 #ifdef HAS_ZLIB
 #    include "common/gzip_ostream.h"
 #endif
 #ifdef HAS_ZIP
+#    include "common/parallel_zipfile_ostream.h"
 #    include "common/zipfile_ostream.h"
 #endif
 #include "memref.h"
@@ -107,7 +109,8 @@ record_filter_tool_create(const std::string &output_dir, uint64_t stop_timestamp
                           int cache_filter_size, const std::string &remove_trace_types,
                           const std::string &remove_marker_types,
                           uint64_t trim_before_timestamp, uint64_t trim_after_timestamp,
-                          bool encodings2regdeps, unsigned int verbose)
+                          bool encodings2regdeps, unsigned int verbose,
+                          int compress_threads, int compress_level)
 {
     std::vector<
         std::unique_ptr<dynamorio::drmemtrace::record_filter_t::record_filter_func_t>>
@@ -146,20 +149,29 @@ record_filter_tool_create(const std::string &output_dir, uint64_t stop_timestamp
     // TODO i#5675: Add other filters.
 
     return new dynamorio::drmemtrace::record_filter_t(output_dir, std::move(filter_funcs),
-                                                      stop_timestamp, verbose);
+                                                      stop_timestamp, verbose,
+                                                      compress_threads, compress_level);
 }
 
 record_filter_t::record_filter_t(
     const std::string &output_dir,
     std::vector<std::unique_ptr<record_filter_func_t>> filters, uint64_t stop_timestamp,
-    unsigned int verbose)
+    unsigned int verbose, int compress_threads, int compress_level)
     : output_dir_(output_dir)
     , filters_(std::move(filters))
     , stop_timestamp_(stop_timestamp)
     , verbosity_(verbose)
+    , compress_level_(compress_level)
 {
     UNUSED(verbosity_);
     UNUSED(output_prefix_);
+#ifdef HAS_ZIP
+    // The pool is idle unless the output is zipfiles.
+    if (compress_threads > 0) {
+        compression_pool_ =
+            std::make_shared<zipfile_compression_pool_t>(compress_threads);
+    }
+#endif
 }
 
 record_filter_t::~record_filter_t()
@@ -270,12 +282,26 @@ record_filter_t::get_writer(per_shard_t *per_shard, memtrace_stream_t *shard_str
 #ifdef HAS_ZIP
     if (ends_with(per_shard->output_path, ".zip")) {
         VPRINT(this, 3, "Using the zip writer for %s\n", per_shard->output_path.c_str());
-        per_shard->archive_writer = std::unique_ptr<archive_ostream_t>(
-            new zipfile_ostream_t(per_shard->output_path));
+        if (compression_pool_) {
+            per_shard->archive_writer =
+                std::unique_ptr<archive_ostream_t>(new parallel_zipfile_ostream_t(
+                    per_shard->output_path, compression_pool_, compress_level_));
+        } else {
+            per_shard->archive_writer = std::unique_ptr<archive_ostream_t>(
+                new zipfile_ostream_t(per_shard->output_path, compress_level_));
+        }
         per_shard->writer = per_shard->archive_writer.get();
         return open_new_chunk(per_shard);
     }
 #endif
+    if (ends_with(per_shard->output_path, ".col")) {
+        VPRINT(this, 3, "Using the columnar writer for %s\n",
+               per_shard->output_path.c_str());
+        per_shard->file_writer =
+            std::unique_ptr<std::ostream>(new columnar_ostream_t(per_shard->output_path));
+        per_shard->writer = per_shard->file_writer.get();
+        return "";
+    }
     VPRINT(this, 3, "Using the default writer for %s\n", per_shard->output_path.c_str());
     per_shard->file_writer = std::unique_ptr<std::ostream>(
         new std::ofstream(per_shard->output_path, std::ofstream::binary));
@@ -411,6 +437,19 @@ record_filter_t::parallel_shard_exit(void *shard_data)
             return false;
         }
     }
+#ifdef HAS_ZIP
+    // The parallel writer still holds chunks being compressed: closing it is the
+    // only way to hear about failures to write them.
+    auto parallel_writer =
+        dynamic_cast<parallel_zipfile_ostream_t *>(per_shard->archive_writer.get());
+    if (parallel_writer != nullptr) {
+        std::string error = parallel_writer->close();
+        if (!error.empty()) {
+            per_shard->error = "Failed to write output: " + error;
+            res = false;
+        }
+    }
+#endif
     // Destroy the writer since we do not need it anymore. This also makes sure
     // that data is written out to the file; curiously, a simple flush doesn't
     // do it.
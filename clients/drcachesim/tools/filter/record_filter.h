@@ -53,6 +53,8 @@
 namespace dynamorio {
 namespace drmemtrace {
 
+class zipfile_compression_pool_t;
+
 /**
  * Analysis tool that filters the #trace_entry_t records of an offline
  * trace. Streams through each shard independenty and parallelly, and
@@ -144,9 +146,12 @@ public:
     };
 
     // stop_timestamp sets a point beyond which no filtering will occur.
+    // A positive compress_threads compresses zipfile output chunks on a pool of
+    // that many threads; compress_level is the zlib level for zipfile output.
     record_filter_t(const std::string &output_dir,
                     std::vector<std::unique_ptr<record_filter_func_t>> filters,
-                    uint64_t stop_timestamp, unsigned int verbose);
+                    uint64_t stop_timestamp, unsigned int verbose,
+                    int compress_threads = 0, int compress_level = -1);
     ~record_filter_t() override;
     bool
     process_memref(const trace_entry_t &entry) override;
@@ -298,6 +303,9 @@ private:
     // XXX: We could use a read-write lock but C++11 doesn't have a ready-made one.
     // If we had the input count we could use an array and atomic reads.
     std::unordered_map<int64_t, std::unique_ptr<per_input_t>> input2info_;
+    int compress_level_;
+    // Shared by the writers of all shards.
+    std::shared_ptr<zipfile_compression_pool_t> compression_pool_;
 };
 
 } // namespace drmemtrace
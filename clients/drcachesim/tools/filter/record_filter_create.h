@@ -65,13 +65,19 @@ namespace drmemtrace {
  * @param[in] encodings2regdeps  If true, converts instruction encodings from the real ISA
  *   of the input trace to the #DR_ISA_REGDEPS synthetic ISA.
  * @param[in] verbose  Verbosity level for notifications.
+ * @param[in] compress_threads  If positive, the chunks of zipfile output are
+ *   compressed on a pool of this many threads shared by all shards, rather than by
+ *   each shard's worker as it writes them.
+ * @param[in] compress_level  The zlib compression level, from 0 to 9 or -1 for the
+ *   zlib default, for zipfile output.
  */
 record_analysis_tool_t *
 record_filter_tool_create(const std::string &output_dir, uint64_t stop_timestamp,
                           int cache_filter_size, const std::string &remove_trace_types,
                           const std::string &remove_marker_types,
                           uint64_t trim_before_timestamp, uint64_t trim_after_timestamp,
-                          bool encodings2regdeps, unsigned int verbose);
+                          bool encodings2regdeps, unsigned int verbose,
+                          int compress_threads = 0, int compress_level = -1);
 
 } // namespace drmemtrace
 } // namespace dynamorio
@@ -0,0 +1,136 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* line_sampler: spatially hashed sampling of cache lines for the reuse tools.
+ */
+
+#ifndef _LINE_SAMPLER_H_
+#define _LINE_SAMPLER_H_ 1
+
+#include <stdint.h>
+
+#include <iterator>
+#include <set>
+#include <utility>
+
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+// We follow the SHARDS approach (Waldspurger et al., FAST '15): a line is either
+// tracked on every access or never, according to a hash of its tag, so statistics
+// over the tracked lines are those of the full trace scaled by the rate.  With a
+// maximum line count the rate is lowered as needed to bound the lines tracked by
+// dropping those with the highest hashes, keeping memory constant regardless of the
+// trace's working set.
+class line_sampler_t {
+public:
+    static constexpr uint64_t MODULUS = 1 << 24;
+
+    // A "rate" of 1 and "max_lines" of 0 track every line.
+    explicit line_sampler_t(double rate = 1.0, unsigned int max_lines = 0)
+        : max_lines_(max_lines)
+    {
+        if (rate < 1.0) {
+            threshold_ = static_cast<uint64_t>(rate * MODULUS);
+            if (threshold_ == 0)
+                threshold_ = 1;
+        }
+    }
+
+    // Returns whether the line with the given tag is tracked.  Should the rate be
+    // lowered, evict(tag) is called for each previously tracked line which no
+    // longer is.
+    template <typename evict_func_t>
+    bool
+    sample(addr_t tag, evict_func_t evict)
+    {
+        uint64_t hash = hash_tag(tag) % MODULUS;
+        if (hash >= threshold_)
+            return false;
+        if (max_lines_ > 0 && lines_.emplace(hash, tag).second &&
+            lines_.size() > max_lines_) {
+            threshold_ = lines_.rbegin()->first;
+            while (!lines_.empty() && lines_.rbegin()->first >= threshold_) {
+                evict(lines_.rbegin()->second);
+                lines_.erase(std::prev(lines_.end()));
+            }
+            if (hash >= threshold_)
+                return false;
+        }
+        return true;
+    }
+
+    uint64_t
+    get_threshold() const
+    {
+        return threshold_;
+    }
+
+    double
+    get_rate() const
+    {
+        return static_cast<double>(threshold_) / MODULUS;
+    }
+
+    // Scales a count of tracked lines to an estimate for all lines.
+    double
+    scale(double value) const
+    {
+        return value * MODULUS / threshold_;
+    }
+
+private:
+    static uint64_t
+    hash_tag(addr_t tag)
+    {
+        // The MurmurHash3 finalizer: consecutive lines need well-mixed low bits.
+        uint64_t hash = tag;
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    unsigned int max_lines_;
+    uint64_t threshold_ = MODULUS;
+    // The hash and tag of each line tracked, only with max_lines_.
+    std::set<std::pair<uint64_t, addr_t>> lines_;
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _LINE_SAMPLER_H_ */
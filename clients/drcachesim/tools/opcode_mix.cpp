@@ -58,6 +58,7 @@
 #include "raw2trace.h"
 #include "raw2trace_directory.h"
 #include "reader.h"
+#include "shared_decode_cache.h"
 #include "trace_entry.h"
 #include "utils.h"
 
@@ -84,8 +85,8 @@ opcode_mix_t::opcode_mix_t(const std::string &module_file_path, unsigned int ver
 std::string
 opcode_mix_t::initialize()
 {
-    serial_shard_.worker = &serial_worker_;
     dcontext_.dcontext = dr_standalone_init();
+    decode_cache_.reset(new shared_decode_cache_t(dcontext_.dcontext));
     // The module_file_path is optional and unused for traces with
     // OFFLINE_FILE_TYPE_ENCODINGS.
     if (module_file_path_.empty())
@@ -121,23 +122,19 @@ opcode_mix_t::parallel_shard_supported()
 void *
 opcode_mix_t::parallel_worker_init(int worker_index)
 {
-    auto worker = new worker_data_t;
-    return reinterpret_cast<void *>(worker);
+    return nullptr;
 }
 
 std::string
 opcode_mix_t::parallel_worker_exit(void *worker_data)
 {
-    worker_data_t *worker = reinterpret_cast<worker_data_t *>(worker_data);
-    delete worker;
     return "";
 }
 
 void *
 opcode_mix_t::parallel_shard_init(int shard_index, void *worker_data)
 {
-    worker_data_t *worker = reinterpret_cast<worker_data_t *>(worker_data);
-    auto shard = new shard_data_t(worker);
+    auto shard = new shard_data_t;
     std::lock_guard<std::mutex> guard(shard_map_mutex_);
     shard_map_[shard_index] = shard;
     return reinterpret_cast<void *>(shard);
@@ -195,12 +192,9 @@ opcode_mix_t::parallel_shard_memref(void *shard_data, const memref_t &memref)
     app_pc decode_pc;
     const app_pc trace_pc = reinterpret_cast<app_pc>(memref.instr.addr);
     if (TESTANY(OFFLINE_FILE_TYPE_ENCODINGS, shard->filetype)) {
-        // The trace has instruction encodings inside it.
+        // The trace has instruction encodings inside it.  The cache is keyed by
+        // them as well as the PC, so changed code needs no invalidation.
         decode_pc = const_cast<app_pc>(memref.instr.encoding);
-        if (memref.instr.encoding_is_new) {
-            // The code may have changed: invalidate the cache.
-            shard->worker->opcode_data_cache.erase(trace_pc);
-        }
     } else {
         // Legacy trace support where we need the binaries.
         if (!module_mapper_) {
@@ -230,30 +224,32 @@ opcode_mix_t::parallel_shard_memref(void *shard_data, const memref_t &memref)
                 trace_pc - (decode_pc - shard->last_mapped_module_start);
         }
     }
-    int opcode;
-    uint category;
-    auto cached_opcode_category = shard->worker->opcode_data_cache.find(trace_pc);
-    if (cached_opcode_category != shard->worker->opcode_data_cache.end()) {
-        opcode = cached_opcode_category->second.opcode;
-        category = cached_opcode_category->second.category;
-    } else {
-        instr_t instr;
-        instr_init(dcontext_.dcontext, &instr);
-        app_pc next_pc =
-            decode_from_copy(dcontext_.dcontext, decode_pc, trace_pc, &instr);
-        if (next_pc == NULL || !instr_valid(&instr)) {
-            instr_free(dcontext_.dcontext, &instr);
-            shard->error =
-                "Failed to decode instruction " + to_hex_string(memref.instr.addr);
+    decode_info_t info;
+    if (!decode_cache_->lookup(trace_pc, decode_pc, memref.instr.size, &info,
+                               &shard->decode_stats)) {
+        shard->error = "Failed to decode instruction " + to_hex_string(memref.instr.addr);
+        return false;
+    }
+    ++shard->opcode_counts[info.opcode];
+    ++shard->category_counts[info.category];
+    return true;
+}
+
+bool
+opcode_mix_t::parallel_shard_batch_supported()
+{
+    return true;
+}
+
+bool
+opcode_mix_t::parallel_shard_memref_batch(void *shard_data, const memref_t *memrefs,
+                                          size_t num_memrefs)
+{
+    for (size_t i = 0; i < num_memrefs; ++i) {
+        // A direct call, which the compiler can inline.
+        if (!opcode_mix_t::parallel_shard_memref(shard_data, memrefs[i]))
             return false;
-        }
-        opcode = instr_get_opcode(&instr);
-        category = instr_get_category(&instr);
-        shard->worker->opcode_data_cache[trace_pc] = opcode_data_t(opcode, category);
-        instr_free(dcontext_.dcontext, &instr);
     }
-    ++shard->opcode_counts[opcode];
-    ++shard->category_counts[category];
     return true;
 }
 
@@ -313,12 +309,13 @@ opcode_mix_t::get_category_names(uint category)
 bool
 opcode_mix_t::print_results()
 {
-    shard_data_t total(0);
+    shard_data_t total;
     if (shard_map_.empty()) {
         total = serial_shard_;
     } else {
         for (const auto &shard : shard_map_) {
             total.instr_count += shard.second->instr_count;
+            total.decode_stats += shard.second->decode_stats;
             for (const auto &keyvals : shard.second->opcode_counts) {
                 total.opcode_counts[keyvals.first] += keyvals.second;
             }
@@ -346,6 +343,13 @@ opcode_mix_t::print_results()
         std::cerr << std::setw(15) << keyvals.second << " : " << std::setw(9)
                   << get_category_names(keyvals.first) << "\n";
     }
+    if (knob_verbose_ > 0) {
+        std::cerr << "\nDecode cache: " << total.decode_stats.hits << " hits, "
+                  << total.decode_stats.misses << " misses, "
+                  << total.decode_stats.uncached << " uncached, "
+                  << decode_cache_->get_entry_count() << " of "
+                  << decode_cache_->get_max_entries() << " entries used\n";
+    }
 
     return true;
 }
@@ -47,6 +47,7 @@
 #include "memref.h"
 #include "raw2trace.h"
 #include "raw2trace_directory.h"
+#include "shared_decode_cache.h"
 #include "trace_entry.h"
 
 namespace dynamorio {
@@ -79,6 +80,11 @@ public:
     parallel_shard_exit(void *shard_data) override;
     bool
     parallel_shard_memref(void *shard_data, const memref_t &memref) override;
+    bool
+    parallel_shard_batch_supported() override;
+    bool
+    parallel_shard_memref_batch(void *shard_data, const memref_t *memrefs,
+                                size_t num_memrefs) override;
     std::string
     parallel_shard_error(void *shard_data) override;
 
@@ -106,27 +112,6 @@ protected:
     std::string
     get_category_names(uint category);
 
-    struct opcode_data_t {
-        opcode_data_t()
-            : opcode(OP_INVALID)
-            , category(DR_INSTR_CATEGORY_UNCATEGORIZED)
-        {
-        }
-        opcode_data_t(int opcode, uint category)
-            : opcode(opcode)
-            , category(category)
-        {
-        }
-        int opcode;
-        /*
-         * The category field is a uint instead of a dr_instr_category_t because
-         * multiple category bits can be set when an instruction belongs to more
-         * than one category.  We assume 32 bits (i.e., 32 categories) is enough
-         * to be future-proof.
-         */
-        uint category;
-    };
-
     class snapshot_t : public interval_state_snapshot_t {
     public:
         // Snapshot the counts as cumulative stats, and then converted them to deltas in
@@ -135,28 +120,18 @@ protected:
         std::unordered_map<uint, int64_t> category_counts_;
     };
 
-    struct worker_data_t {
-        std::unordered_map<app_pc, opcode_data_t> opcode_data_cache;
-    };
-
     struct shard_data_t {
         shard_data_t()
-            : worker(nullptr)
-            , instr_count(0)
-        {
-        }
-        shard_data_t(worker_data_t *worker)
-            : worker(worker)
-            , instr_count(0)
+            : instr_count(0)
             , last_trace_module_start(nullptr)
             , last_trace_module_size(0)
             , last_mapped_module_start(nullptr)
         {
         }
-        worker_data_t *worker;
         int64_t instr_count;
         std::unordered_map<int, int64_t> opcode_counts;
         std::unordered_map<uint, int64_t> category_counts;
+        decode_cache_stats_t decode_stats;
         std::string error;
         app_pc last_trace_module_start;
         size_t last_trace_module_size;
@@ -185,6 +160,9 @@ protected:
     std::string module_file_path_;
     std::unique_ptr<module_mapper_t> module_mapper_;
     std::mutex mapper_mutex_;
+    // Shared by all shards, so each instruction is decoded once rather than once
+    // per worker.
+    std::unique_ptr<shared_decode_cache_t> decode_cache_;
     // We reference directory.modfile_bytes throughout operation, so its lifetime
     // must match ours.
     raw2trace_directory_t directory_;
@@ -197,7 +175,6 @@ protected:
     std::string knob_alt_module_dir_;
     static const std::string TOOL_NAME;
     // For serial operation.
-    worker_data_t serial_worker_;
     shard_data_t serial_shard_;
 };
 
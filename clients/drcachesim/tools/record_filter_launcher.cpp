@@ -130,6 +130,20 @@ droption_t<bool> op_encodings2regdeps(
     "Enable converting the encoding of instructions to synthetic ISA DR_ISA_REGDEPS.",
     "This option is for -simulator_type record_filter. When present, it converts "
     "the encoding of instructions from a real ISA to the DR_ISA_REGDEPS synthetic ISA.");
+
+static droption_t<int> op_compress_threads(
+    DROPTION_SCOPE_FRONTEND, "compress_threads", 0, 0, 256,
+    "Threads compressing zipfile output chunks.",
+    "When positive, the chunks of zipfile output are compressed on a pool of this many "
+    "threads shared by all shards while each shard's worker goes on to filter its next "
+    "chunk, rather than by the shard's worker itself. Chunk order and boundaries are "
+    "unchanged.");
+
+static droption_t<int> op_compress_level(
+    DROPTION_SCOPE_FRONTEND, "compress_level", -1, -1, 9,
+    "zlib compression level for zipfile output.",
+    "Sets the zlib compression level, from 0 (none) to 9 (best), of zipfile output "
+    "chunks. The default of -1 uses zlib's default level.");
 } // namespace
 
 int
@@ -160,7 +174,8 @@ _tmain(int argc, const TCHAR *targv[])
             op_cache_filter_size.get_value(), op_remove_trace_types.get_value(),
             op_remove_marker_types.get_value(), op_trim_before_timestamp.get_value(),
             op_trim_after_timestamp.get_value(), op_encodings2regdeps.get_value(),
-            op_verbose.get_value()));
+            op_verbose.get_value(), op_compress_threads.get_value(),
+            op_compress_level.get_value()));
     std::vector<record_analysis_tool_t *> tools;
     tools.push_back(record_filter.get());
 
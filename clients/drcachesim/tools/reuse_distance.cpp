@@ -40,8 +40,10 @@
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -70,6 +72,7 @@ reuse_distance_tool_create(const reuse_distance_knobs_t &knobs)
 reuse_distance_t::reuse_distance_t(const reuse_distance_knobs_t &knobs)
     : knobs_(knobs)
     , line_size_bits_(compute_log2((int)knobs_.line_size))
+    , sampling_(knobs.sample_rate < 1.0 || knobs.sample_max_lines > 0)
 {
     reuse_distance_t::knob_verbose = knobs.verbose;
     IF_DEBUG_VERBOSE(2,
@@ -100,11 +103,61 @@ reuse_distance_t::initialize_shard_type(shard_type_t shard_type)
 }
 
 reuse_distance_t::shard_data_t::shard_data_t(uint64_t reuse_threshold, uint64_t skip_dist,
-                                             uint32_t distance_limit, bool verify)
+                                             uint32_t distance_limit, bool verify,
+                                             bool use_tree)
     : distance_limit(distance_limit)
 {
     ref_list = std::unique_ptr<line_ref_list_t>(
-        new line_ref_list_t(reuse_threshold, skip_dist, verify));
+        new line_ref_list_t(reuse_threshold, skip_dist, verify, use_tree));
+}
+
+reuse_distance_t::shard_data_t *
+reuse_distance_t::create_shard_data()
+{
+    uint64_t reuse_threshold = knobs_.distance_threshold;
+    if (knobs_.sample_rate < 1.0) {
+        // Distant references are identified among the sampled lines only, so we
+        // scale the threshold by the initial rate.
+        reuse_threshold = std::max(
+            static_cast<uint64_t>(std::llround(reuse_threshold * knobs_.sample_rate)),
+            uint64_t(1));
+    }
+    auto shard = new shard_data_t(reuse_threshold, knobs_.skip_list_distance,
+                                  knobs_.distance_limit, knobs_.verify_skip,
+                                  knobs_.use_order_tree);
+    shard->sampler = line_sampler_t(knobs_.sample_rate, knobs_.sample_max_lines);
+    return shard;
+}
+
+// The distances among the sampled lines are the full distances scaled by the rate.
+bool
+reuse_distance_t::sample_line(shard_data_t *shard, addr_t tag)
+{
+    if (!shard->sampler.sample(tag, [shard](addr_t evict_tag) {
+            auto it = shard->cache_map.find(evict_tag);
+            if (it != shard->cache_map.end()) {
+                shard->ref_list->remove(it->second);
+                delete it->second;
+                shard->cache_map.erase(it);
+            }
+            shard->pruned_addresses.erase(evict_tag);
+        }))
+        return false;
+    ++shard->sampled_refs;
+    return true;
+}
+
+void
+reuse_distance_t::update_sampling_estimate(shard_data_t *shard)
+{
+    // Each line is sampled independently, so the count of sampled lines is
+    // binomial.
+    double rate = shard->sampler.get_rate();
+    double lines =
+        static_cast<double>(shard->cache_map.size() + shard->pruned_addresses.size());
+    shard->sample_rate = rate;
+    shard->unique_lines_estimate = lines / rate;
+    shard->unique_lines_variance = lines * (1. - rate) / (rate * rate);
 }
 
 bool
@@ -117,8 +170,7 @@ void *
 reuse_distance_t::parallel_shard_init_stream(int shard_index, void *worker_data,
                                              memtrace_stream_t *stream)
 {
-    auto shard = new shard_data_t(knobs_.distance_threshold, knobs_.skip_list_distance,
-                                  knobs_.distance_limit, knobs_.verify_skip);
+    auto shard = create_shard_data();
     std::lock_guard<std::mutex> guard(shard_map_mutex_);
     shard->core = stream->get_output_cpuid();
     shard->tid = stream->get_tid();
@@ -166,6 +218,8 @@ reuse_distance_t::parallel_shard_memref(void *shard_data, const memref_t &memref
             ++shard->data_refs;
         }
         addr_t tag = memref.data.addr >> line_size_bits_;
+        if (sampling_ && !sample_line(shard, tag))
+            return true;
         std::unordered_map<addr_t, line_ref_t *>::iterator it =
             shard->cache_map.find(tag);
         if (it == shard->cache_map.end()) {
@@ -196,6 +250,8 @@ reuse_distance_t::parallel_shard_memref(void *shard_data, const memref_t &memref
             }
         } else {
             int64_t dist = shard->ref_list->move_to_front(it->second);
+            if (sampling_)
+                dist = static_cast<int64_t>(shard->sampler.scale(dist));
             auto &dist_map = is_instr_type ? shard->dist_map : shard->dist_map_data;
             distance_histogram_t::iterator dist_it = dist_map.find(dist);
             if (dist_it == dist_map.end())
@@ -215,8 +271,7 @@ reuse_distance_t::process_memref(const memref_t &memref)
     int shard_index = serial_stream_->get_shard_index();
     const auto &lookup = shard_map_.find(shard_index);
     if (lookup == shard_map_.end()) {
-        shard = new shard_data_t(knobs_.distance_threshold, knobs_.skip_list_distance,
-                                 knobs_.distance_limit, knobs_.verify_skip);
+        shard = create_shard_data();
         shard->core = serial_stream_->get_output_cpuid();
         shard->tid = serial_stream_->get_tid();
         shard_map_[shard_index] = shard;
@@ -282,6 +337,14 @@ reuse_distance_t::print_shard_results(const shard_data_t *shard)
     std::cerr << "Distance limit: " << shard->distance_limit << "\n";
     std::cerr << "Pruned addresses: " << shard->pruned_address_count << "\n";
     std::cerr << "Pruned address hits: " << shard->pruned_address_hits << "\n";
+    if (sampling_) {
+        std::cerr << "Sampling rate: " << shard->sample_rate << "\n";
+        std::cerr << "Sampled accesses: " << shard->sampled_refs << "\n";
+        std::cerr << "Estimated unique cache lines: "
+                  << std::llround(shard->unique_lines_estimate) << " +- "
+                  << std::llround(1.96 * std::sqrt(shard->unique_lines_variance))
+                  << " (95% confidence)\n";
+    }
     std::cerr << "\n";
 
     std::cerr.precision(2);
@@ -314,6 +377,13 @@ reuse_distance_t::print_shard_results(const shard_data_t *shard)
     }
     double stddev = std::sqrt(sum_of_squares / count);
     std::cerr << "Reuse distance standard deviation: " << stddev << "\n";
+    if (sampling_ && mean > 0) {
+        // A distance d is estimated from the binomially distributed count of
+        // sampled lines among the d lines accessed since.
+        double rate = shard->sample_rate;
+        std::cerr << "Reuse distance sampling error at the mean (95% confidence): +- "
+                  << 100. * 1.96 * std::sqrt((1. - rate) / (mean * rate)) << "%\n";
+    }
 
     if (knobs_.report_histogram) {
         print_histogram(std::cerr, count, sorted, shard->dist_map_data);
@@ -455,6 +525,16 @@ reuse_distance_t::get_aggregated_results()
         new shard_data_t(knobs_.distance_threshold, knobs_.skip_list_distance,
                          knobs_.distance_limit, knobs_.verify_skip));
     for (auto &shard : shard_map_) {
+        if (sampling_) {
+            update_sampling_estimate(shard.second);
+            aggregated_results_->sampled_refs += shard.second->sampled_refs;
+            aggregated_results_->sample_rate =
+                std::min(aggregated_results_->sample_rate, shard.second->sample_rate);
+            aggregated_results_->unique_lines_estimate +=
+                shard.second->unique_lines_estimate;
+            aggregated_results_->unique_lines_variance +=
+                shard.second->unique_lines_variance;
+        }
         aggregated_results_->total_refs += shard.second->total_refs;
         aggregated_results_->data_refs += shard.second->data_refs;
         aggregated_results_->pruned_address_hits += shard.second->pruned_address_hits;
@@ -43,6 +43,7 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -50,6 +51,7 @@
 #include <vector>
 
 #include "analysis_tool.h"
+#include "line_sampler.h"
 #include "memref.h"
 #include "reuse_distance_create.h"
 #include "trace_entry.h"
@@ -115,7 +117,7 @@ protected:
     // for computing over different units if for some reason that was desired.
     struct shard_data_t {
         shard_data_t(uint64_t reuse_threshold, uint64_t skip_dist,
-                     unsigned int distance_limit, bool verify);
+                     unsigned int distance_limit, bool verify, bool use_tree = false);
         std::unordered_map<addr_t, line_ref_t *> cache_map;
         std::unordered_set<addr_t> pruned_addresses;
         // These are our reuse distance histograms: one for all accesses and one
@@ -143,8 +145,24 @@ protected:
         // (pruned_address_hits) from the pruned_addresses set.
         uint64_t pruned_address_count = 0;
         uint64_t pruned_address_hits = 0;
+        // Chooses the lines tracked for sampled operation.
+        line_sampler_t sampler;
+        int64_t sampled_refs = 0;
+        // For the aggregated results: the lowest sampling rate of any shard, and
+        // the sum of the per-shard unique line estimates and their variances.
+        double sample_rate = 1.0;
+        double unique_lines_estimate = 0.;
+        double unique_lines_variance = 0.;
     };
 
+    shard_data_t *
+    create_shard_data();
+    // Returns whether the line with the given tag is tracked when sampling.
+    bool
+    sample_line(shard_data_t *shard, addr_t tag);
+    void
+    update_sampling_estimate(shard_data_t *shard);
+
     void
     print_histogram(std::ostream &out, int64_t total_count,
                     const std::vector<distance_map_pair_t> &sorted,
@@ -167,6 +185,7 @@ protected:
     std::mutex shard_map_mutex_;
     shard_type_t shard_type_ = SHARD_BY_THREAD;
     memtrace_stream_t *serial_stream_ = nullptr;
+    const bool sampling_;
 };
 
 /* A doubly linked list node for the cache line reference info */
@@ -183,6 +202,7 @@ struct line_ref_t {
     struct line_ref_t *prev_skip; // the prev line_ref in the skip list
     struct line_ref_t *next_skip; // the next line_ref in the skip list
     int64_t depth;                // only valid for skip list nodes; -1 for others
+    uint64_t slot;                // the position in line_ref_order_tree_t, if used
 
     line_ref_t(addr_t val)
         : prev(NULL)
@@ -193,10 +213,63 @@ struct line_ref_t {
         , prev_skip(NULL)
         , next_skip(NULL)
         , depth(-1)
+        , slot(0)
     {
     }
 };
 
+// A Fenwick tree counting the cache lines present at each slot, where slots are
+// handed out in access order.  The number of lines accessed more recently than
+// a given line is thus found in O(log n) regardless of the distance, unlike with
+// the skip list.  Slots of lines which are accessed again are left empty until
+// line_ref_list_t renumbers the lines once all slots are used.
+struct line_ref_order_tree_t {
+    explicit line_ref_order_tree_t(size_t capacity)
+        : counts_(capacity, 0)
+    {
+    }
+
+    size_t
+    capacity() const
+    {
+        return counts_.size();
+    }
+
+    void
+    add(uint64_t slot, int delta)
+    {
+        for (size_t i = slot + 1; i <= counts_.size(); i += i & (0 - i))
+            counts_[i - 1] += delta;
+    }
+
+    // Returns the number of lines at slots up to and including "slot".
+    uint64_t
+    prefix_count(uint64_t slot) const
+    {
+        uint64_t count = 0;
+        for (size_t i = slot + 1; i > 0; i -= i & (0 - i))
+            count += counts_[i - 1];
+        return count;
+    }
+
+    // Resizes to "capacity" slots with just the first "num_present" occupied.
+    void
+    reset(size_t capacity, uint64_t num_present)
+    {
+        counts_.assign(capacity, 0);
+        for (uint64_t i = 0; i < num_present; ++i)
+            counts_[i] = 1;
+        // Build bottom-up in linear time.
+        for (size_t i = 1; i <= capacity; ++i) {
+            size_t parent = i + (i & (0 - i));
+            if (parent <= capacity)
+                counts_[parent - 1] += counts_[i - 1];
+        }
+    }
+
+    std::vector<uint32_t> counts_;
+};
+
 // We use a doubly linked list to keep track of the cache line reuse distance.
 // The head of the list is the most recently accessed cache line.
 // The earlier a cache line was accessed last time, the deeper that cache line
@@ -211,7 +284,9 @@ struct line_ref_t {
 //
 // We have a second doubly-linked list, a one-layer skip list, for
 // more efficient computation of the depth.  Each node in the skip
-// list stores its depth from the front.
+// list stores its depth from the front.  Alternatively, an order tree
+// computes the depth in logarithmic time, which is much faster once
+// distances reach the millions of lines.
 struct line_ref_list_t {
     line_ref_t *head_;       // the most recently accessed cache line
     line_ref_t *gate_;       // the earliest cache line refs within the threshold
@@ -221,8 +296,15 @@ struct line_ref_list_t {
     uint64_t threshold_;     // the reuse distance threshold
     uint64_t skip_distance_; // distance between skip list nodes
     bool verify_skip_;       // check results using brute-force walks
+    uint64_t num_lines_;     // the number of cache lines in the list
+    // Used in place of the skip list if non-NULL.
+    std::unique_ptr<line_ref_order_tree_t> tree_;
+    uint64_t next_slot_; // the next free tree slot
+
+    static constexpr size_t INITIAL_TREE_CAPACITY = 1 << 16;
 
-    line_ref_list_t(uint64_t reuse_threshold_, uint64_t skip_dist, bool verify)
+    line_ref_list_t(uint64_t reuse_threshold_, uint64_t skip_dist, bool verify,
+                    bool use_tree = false)
         : head_(NULL)
         , gate_(NULL)
         , tail_(NULL)
@@ -231,7 +313,11 @@ struct line_ref_list_t {
         , threshold_(reuse_threshold_)
         , skip_distance_(skip_dist)
         , verify_skip_(verify)
+        , num_lines_(0)
+        , next_slot_(0)
     {
+        if (use_tree)
+            tree_.reset(new line_ref_order_tree_t(INITIAL_TREE_CAPACITY));
     }
 
     virtual ~line_ref_list_t()
@@ -287,6 +373,29 @@ struct line_ref_list_t {
         src->depth = -1;
     }
 
+    // Gives head_, which was just added or moved there, the most recent tree slot.
+    void
+    assign_slot(line_ref_t *ref)
+    {
+        assert(ref == head_);
+        if (next_slot_ < tree_->capacity()) {
+            ref->slot = next_slot_++;
+            tree_->add(ref->slot, 1);
+            return;
+        }
+        // Renumber all lines in list order to reclaim the slots left empty.
+        // Keeping the tree at most half full after this bounds the amortized cost.
+        size_t capacity = tree_->capacity();
+        while (num_lines_ > capacity / 2)
+            capacity *= 2;
+        uint64_t slot = 0;
+        for (line_ref_t *node = tail_; node != NULL; node = node->prev)
+            node->slot = slot++;
+        assert(slot == num_lines_);
+        tree_->reset(capacity, num_lines_);
+        next_slot_ = num_lines_;
+    }
+
     // Add a new cache line to the front of the list.
     // We may need to move gate_ forward if there are more cache lines
     // than the threshold so that the gate points to the earliest
@@ -308,7 +417,13 @@ struct line_ref_list_t {
         if (tail_ == NULL)
             tail_ = ref;
         unique_lines_++;
+        num_lines_++;
         head_->time_stamp = cur_time_++;
+        if (tree_) {
+            assign_slot(ref);
+            IF_DEBUG_VERBOSE(3, print_list());
+            return;
+        }
 
         // Add a new skip node if necessary.
         // We don't bother keeping one right at the front: too much overhead_.
@@ -363,11 +478,71 @@ struct line_ref_list_t {
             // move gate_ if tail_ was the gate_.
             gate_ = gate_->prev;
         }
+        if (tree_)
+            tree_->add(tail_->slot, -1);
+        num_lines_--;
 
         // And finally, update tail_.
         tail_ = new_tail;
     }
 
+    // Remove an arbitrary entry from the distance list.
+    void
+    remove(line_ref_t *ref)
+    {
+        IF_DEBUG_VERBOSE(3, std::cerr << "Remove tag 0x" << std::hex << ref->tag << "\n");
+        if (ref == tail_ && ref != head_) {
+            prune_tail();
+            return;
+        }
+        // The lines behind ref each move up by one, and so does the gate if it
+        // was not in front of ref.
+        if (gate_ != NULL && ref->time_stamp >= gate_->time_stamp) {
+            if (gate_->next != NULL)
+                gate_ = gate_->next;
+            else if (ref == gate_)
+                gate_ = gate_->prev;
+        }
+        if (tree_)
+            tree_->add(ref->slot, -1);
+        else {
+            // Keep ref's skip node position if we can, and decrement the depths of
+            // all skip nodes behind it.
+            line_ref_t *skip;
+            if (ref->depth != -1) {
+                if (ref->next != NULL && ref->next->depth == -1) {
+                    move_skip_fields(ref, ref->next);
+                    skip = ref->next->next_skip;
+                } else {
+                    skip = ref->next_skip;
+                    if (ref->prev_skip != NULL)
+                        ref->prev_skip->next_skip = ref->next_skip;
+                    if (ref->next_skip != NULL)
+                        ref->next_skip->prev_skip = ref->prev_skip;
+                    ref->prev_skip = NULL;
+                    ref->next_skip = NULL;
+                    ref->depth = -1;
+                }
+            } else {
+                for (skip = ref->next; skip != NULL && skip->depth == -1;
+                     skip = skip->next) {
+                }
+            }
+            for (; skip != NULL; skip = skip->next_skip)
+                --skip->depth;
+        }
+        if (ref->prev != NULL)
+            ref->prev->next = ref->next;
+        else
+            head_ = ref->next;
+        if (ref->next != NULL)
+            ref->next->prev = ref->prev;
+        else
+            tail_ = ref->prev;
+        num_lines_--;
+        IF_DEBUG_VERBOSE(3, print_list());
+    }
+
     // Move a referenced cache line to the front of the list.
     // We need to move the gate_ pointer forward if the referenced cache
     // line is the gate_ cache line or any cache line after.
@@ -396,13 +571,17 @@ struct line_ref_list_t {
 
         // Compute reuse distance.
         int64_t dist = 0;
-        line_ref_t *skip;
-        for (skip = ref; skip != NULL && skip->depth == -1; skip = skip->prev)
-            ++dist;
-        if (skip != NULL)
-            dist += skip->depth;
-        else
-            --dist; // Don't count self.
+        line_ref_t *skip = NULL;
+        if (tree_) {
+            dist = num_lines_ - tree_->prefix_count(ref->slot);
+        } else {
+            for (skip = ref; skip != NULL && skip->depth == -1; skip = skip->prev)
+                ++dist;
+            if (skip != NULL)
+                dist += skip->depth;
+            else
+                --dist; // Don't count self.
+        }
 
         IF_DEBUG_VERBOSE(
             0, if (verify_skip_) {
@@ -430,6 +609,8 @@ struct line_ref_list_t {
             }
         } else
             assert(ref->depth == -1);
+        if (tree_)
+            tree_->add(ref->slot, -1);
 
         // remove ref from the list
         prev = ref->prev;
@@ -444,6 +625,8 @@ struct line_ref_list_t {
         head_->prev = ref;
         head_ = ref;
         head_->time_stamp = cur_time_++;
+        if (tree_)
+            assign_slot(ref);
 
         IF_DEBUG_VERBOSE(3, print_list());
         // XXX: we should keep a running mean of the distance, and adjust
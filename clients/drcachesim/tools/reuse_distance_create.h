@@ -61,6 +61,9 @@ struct reuse_distance_knobs_t {
         , verify_skip(false)
         , verbose(0)
         , histogram_bin_multiplier(1.00)
+        , use_order_tree(false)
+        , sample_rate(1.00)
+        , sample_max_lines(0)
     {
     }
     unsigned int line_size;
@@ -72,6 +75,9 @@ struct reuse_distance_knobs_t {
     bool verify_skip;
     unsigned int verbose;
     double histogram_bin_multiplier;
+    bool use_order_tree;
+    double sample_rate;
+    unsigned int sample_max_lines;
 };
 
 /** Creates an analysis tool which computes reuse distance. */
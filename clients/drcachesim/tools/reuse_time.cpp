@@ -35,6 +35,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <memory>
@@ -61,15 +62,20 @@ namespace drmemtrace {
 const std::string reuse_time_t::TOOL_NAME = "Reuse time tool";
 
 analysis_tool_t *
-reuse_time_tool_create(unsigned int line_size, unsigned int verbose)
+reuse_time_tool_create(unsigned int line_size, unsigned int verbose, double sample_rate,
+                       unsigned int sample_max_lines)
 {
-    return new reuse_time_t(line_size, verbose);
+    return new reuse_time_t(line_size, verbose, sample_rate, sample_max_lines);
 }
 
-reuse_time_t::reuse_time_t(unsigned int line_size, unsigned int verbose)
+reuse_time_t::reuse_time_t(unsigned int line_size, unsigned int verbose,
+                           double sample_rate, unsigned int sample_max_lines)
     : knob_verbose_(verbose)
     , knob_line_size_(line_size)
+    , knob_sample_rate_(sample_rate)
+    , knob_sample_max_lines_(sample_max_lines)
     , line_size_bits_(compute_log2((int)knob_line_size_))
+    , sampling_(sample_rate < 1.0 || sample_max_lines > 0)
 {
 }
 
@@ -94,6 +100,14 @@ reuse_time_t::initialize_shard_type(shard_type_t shard_type)
     return "";
 }
 
+reuse_time_t::shard_data_t *
+reuse_time_t::create_shard_data()
+{
+    auto shard = new shard_data_t();
+    shard->sampler = line_sampler_t(knob_sample_rate_, knob_sample_max_lines_);
+    return shard;
+}
+
 bool
 reuse_time_t::parallel_shard_supported()
 {
@@ -104,7 +118,7 @@ void *
 reuse_time_t::parallel_shard_init_stream(int shard_index, void *worker_data,
                                          memtrace_stream_t *stream)
 {
-    auto shard = new shard_data_t();
+    auto shard = create_shard_data();
     std::lock_guard<std::mutex> guard(shard_map_mutex_);
     shard->core = stream->get_output_cpuid();
     shard->tid = stream->get_tid();
@@ -157,6 +171,12 @@ reuse_time_t::parallel_shard_memref(void *shard_data, const memref_t &memref)
 
     shard->time_stamp++;
     addr_t line = memref.data.addr >> line_size_bits_;
+    if (sampling_) {
+        if (!shard->sampler.sample(
+                line, [shard](addr_t evict_line) { shard->time_map.erase(evict_line); }))
+            return true;
+        ++shard->sampled_refs;
+    }
     if (shard->time_map.count(line) > 0) {
         int64_t reuse_time = shard->time_stamp - shard->time_map[line];
         if (DEBUG_VERBOSE(3)) {
@@ -175,7 +195,7 @@ reuse_time_t::process_memref(const memref_t &memref)
     int shard_index = serial_stream_->get_shard_index();
     const auto &lookup = shard_map_.find(shard_index);
     if (lookup == shard_map_.end()) {
-        shard = new shard_data_t();
+        shard = create_shard_data();
         shard->core = serial_stream_->get_output_cpuid();
         shard->tid = serial_stream_->get_tid();
         shard_map_[shard_index] = shard;
@@ -201,6 +221,10 @@ reuse_time_t::print_shard_results(const shard_data_t *shard)
     std::cerr << "Total instructions: " << shard->total_instructions << "\n";
     std::cerr.precision(2);
     std::cerr.setf(std::ios::fixed);
+    if (sampling_) {
+        std::cerr << "Sampling rate: " << shard->sample_rate << "\n";
+        std::cerr << "Sampled accesses: " << shard->sampled_refs << "\n";
+    }
 
     int64_t count = 0;
     int64_t sum = 0;
@@ -230,7 +254,10 @@ reuse_time_t::print_shard_results(const shard_data_t *shard)
         }
         double percent = it->second / static_cast<double>(count);
         cum_percent += percent;
-        std::cerr << std::setw(8) << it->first << std::setw(12) << it->second
+        // The per-shard counts are scaled up to estimate the full trace; the
+        // aggregate's were scaled as they were merged.
+        std::cerr << std::setw(8) << it->first << std::setw(12)
+                  << std::llround(shard->sampler.scale(static_cast<double>(it->second)))
                   << std::setw(8) << percent * 100.0 << "%" << std::setw(11)
                   << cum_percent * 100.0 << "%";
         std::cerr << std::endl;
@@ -246,10 +273,15 @@ reuse_time_t::print_results()
         aggregate->total_instructions += shard.second->total_instructions;
         // We simply sum the accesses.
         aggregate->time_stamp += shard.second->time_stamp;
-        // Merge the histograms.
+        // Merge the histograms, scaling each shard's counts by its own final rate.
         for (const auto &entry : shard.second->reuse_time_histogram) {
-            aggregate->reuse_time_histogram[entry.first] += entry.second;
+            aggregate->reuse_time_histogram[entry.first] += std::llround(
+                shard.second->sampler.scale(static_cast<double>(entry.second)));
         }
+        shard.second->sample_rate = shard.second->sampler.get_rate();
+        aggregate->sampled_refs += shard.second->sampled_refs;
+        aggregate->sample_rate =
+            std::min(aggregate->sample_rate, shard.second->sample_rate);
     }
 
     std::cerr << TOOL_NAME << " aggregated results:\n";
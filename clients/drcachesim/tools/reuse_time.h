@@ -40,6 +40,7 @@
 #include <unordered_map>
 
 #include "analysis_tool.h"
+#include "line_sampler.h"
 #include "memref.h"
 #include "trace_entry.h"
 
@@ -48,7 +49,8 @@ namespace drmemtrace {
 
 class reuse_time_t : public analysis_tool_t {
 public:
-    reuse_time_t(unsigned int line_size, unsigned int verbose);
+    reuse_time_t(unsigned int line_size, unsigned int verbose, double sample_rate = 1.0,
+                 unsigned int sample_max_lines = 0);
     ~reuse_time_t() override;
     std::string
     initialize_stream(memtrace_stream_t *serial_stream) override;
@@ -78,17 +80,28 @@ protected:
         int64_t time_stamp = 0;
         int64_t total_instructions = 0;
         std::unordered_map<int64_t, int64_t> reuse_time_histogram;
+        // With sampling, only the accesses to the lines chosen by the sampler are
+        // in time_map and the histogram.  The times themselves are exact as
+        // time_stamp counts every access; only the counts need scaling.
+        line_sampler_t sampler;
+        int64_t sampled_refs = 0;
+        double sample_rate = 1.0;
         memref_tid_t tid = 0; // For SHARD_BY_THREAD.
         int64_t core = 0;     // For SHARD_BY_CORE.
         std::string error;
     };
 
+    shard_data_t *
+    create_shard_data();
     void
     print_shard_results(const shard_data_t *shard);
 
     const unsigned int knob_verbose_;
     const unsigned int knob_line_size_;
+    const double knob_sample_rate_;
+    const unsigned int knob_sample_max_lines_;
     const unsigned int line_size_bits_;
+    const bool sampling_;
 
     static const std::string TOOL_NAME;
 
@@ -53,7 +53,8 @@ namespace drmemtrace {
  */
 // These options are currently documented in ../common/options.cpp.
 analysis_tool_t *
-reuse_time_tool_create(unsigned int line_size = 64, unsigned int verbose = 0);
+reuse_time_tool_create(unsigned int line_size = 64, unsigned int verbose = 0,
+                       double sample_rate = 1.0, unsigned int sample_max_lines = 0);
 
 } // namespace drmemtrace
 } // namespace dynamorio
@@ -141,6 +141,7 @@ schedule_stats_t::parallel_shard_exit(void *shard_data)
     per_shard_t *shard = reinterpret_cast<per_shard_t *>(shard_data);
     if (!update_state_time(shard, shard->cur_state))
         return false;
+    update_scheduler_stats(shard);
     return true;
 }
 
@@ -174,6 +175,24 @@ schedule_stats_t::update_state_time(per_shard_t *shard, state_t state)
     return true;
 }
 
+void
+schedule_stats_t::update_scheduler_stats(per_shard_t *shard)
+{
+    // The scheduler's values are cumulative for this output.  A negative value means
+    // the statistic is not supported (e.g., not a dynamic schedule).
+    auto get_stat = [shard](memtrace_stream_t::schedule_statistic_t stat) {
+        int64_t value = shard->stream->get_schedule_statistic(stat);
+        return value < 0 ? 0 : value;
+    };
+    shard->counters.migrations = get_stat(memtrace_stream_t::SCHED_STAT_MIGRATIONS);
+    shard->counters.runqueue_steals =
+        get_stat(memtrace_stream_t::SCHED_STAT_RUNQUEUE_STEALS);
+    shard->counters.runqueue_rebalances =
+        get_stat(memtrace_stream_t::SCHED_STAT_RUNQUEUE_REBALANCES);
+    shard->counters.lock_contention =
+        get_stat(memtrace_stream_t::SCHED_STAT_LOCK_CONTENTION);
+}
+
 void
 schedule_stats_t::record_context_switch(per_shard_t *shard, int64_t tid, int64_t input_id,
                                         int64_t letter_ord)
@@ -192,6 +211,7 @@ schedule_stats_t::record_context_switch(per_shard_t *shard, int64_t tid, int64_t
     shard->thread_sequence +=
         THREAD_LETTER_INITIAL_START + static_cast<char>(letter_ord % 26);
     shard->cur_segment_instrs = 0;
+    update_scheduler_stats(shard);
     if (knob_verbose_ >= 2) {
         std::ostringstream line;
         line << "Core #" << std::setw(2) << shard->core << " @" << std::setw(9)
@@ -402,6 +422,12 @@ schedule_stats_t::print_counters(const counters_t &counters)
                      static_cast<double>(counters.cpu_microseconds +
                                          counters.idle_micros_at_last_instr),
                      "% cpu busy by time, ignoring idle past last instr\n");
+    std::cerr << std::setw(12) << counters.migrations << " migrations\n";
+    std::cerr << std::setw(12) << counters.runqueue_steals << " run queue steals\n";
+    std::cerr << std::setw(12) << counters.runqueue_rebalances
+              << " run queue rebalances\n";
+    std::cerr << std::setw(12) << counters.lock_contention
+              << " scheduler lock contentions\n";
     std::cerr << "  Instructions per context switch histogram:\n";
     counters.instrs_per_switch->print();
 }
@@ -149,6 +149,10 @@ public:
             idle_micros_at_last_instr += rhs.idle_micros_at_last_instr;
             cpu_microseconds += rhs.cpu_microseconds;
             wait_microseconds += rhs.wait_microseconds;
+            migrations += rhs.migrations;
+            runqueue_steals += rhs.runqueue_steals;
+            runqueue_rebalances += rhs.runqueue_rebalances;
+            lock_contention += rhs.lock_contention;
             for (const memref_tid_t tid : rhs.threads) {
                 threads.insert(tid);
             }
@@ -168,6 +172,11 @@ public:
         uint64_t idle_micros_at_last_instr = 0;
         uint64_t cpu_microseconds = 0;
         uint64_t wait_microseconds = 0;
+        // These are read from the scheduler via get_schedule_statistic().
+        int64_t migrations = 0;
+        int64_t runqueue_steals = 0;
+        int64_t runqueue_rebalances = 0;
+        int64_t lock_contention = 0;
         std::unordered_set<memref_tid_t> threads;
         std::unique_ptr<histogram_interface_t> instrs_per_switch;
     };
@@ -220,6 +229,10 @@ protected:
     bool
     update_state_time(per_shard_t *shard, state_t state);
 
+    // Refreshes the counters maintained by the scheduler itself.
+    void
+    update_scheduler_stats(per_shard_t *shard);
+
     void
     record_context_switch(per_shard_t *shard, int64_t tid, int64_t input_id,
                           int64_t letter_ord);
@@ -0,0 +1,265 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Standalone launcher which writes the seek index for each single-file trace
+ * given to it, so later skips into those traces need not decompress everything
+ * before their targets.
+ */
+
+#ifdef WINDOWS
+#    define UNICODE
+#    define _UNICODE
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "columnar_codec.h"
+#include "droption.h"
+#include "dr_frontend.h"
+#include "directory_iterator.h"
+#include "seek_index.h"
+#include "trace_entry.h"
+#include "utils.h"
+#ifdef HAS_ZLIB
+#    include "compressed_file_reader.h"
+#endif
+#ifdef HAS_LZ4
+#    include "lz4_file_reader.h"
+#endif
+#ifdef HAS_SNAPPY
+#    include "snappy_file_reader.h"
+#endif
+
+using ::dynamorio::drmemtrace::columnar_codec_t;
+using ::dynamorio::drmemtrace::directory_iterator_t;
+using ::dynamorio::drmemtrace::ends_with;
+using ::dynamorio::drmemtrace::raw_seekable_input_t;
+using ::dynamorio::drmemtrace::seek_index_builder_t;
+using ::dynamorio::drmemtrace::seek_index_codec_t;
+using ::dynamorio::drmemtrace::seekable_input_t;
+using ::dynamorio::drmemtrace::SEEK_INDEX_CODEC_GZIP;
+using ::dynamorio::drmemtrace::SEEK_INDEX_CODEC_LZ4;
+using ::dynamorio::drmemtrace::SEEK_INDEX_CODEC_NONE;
+using ::dynamorio::drmemtrace::SEEK_INDEX_CODEC_SNAPPY;
+using ::dynamorio::drmemtrace::starts_with;
+using ::dynamorio::droption::bytesize_t;
+using ::dynamorio::droption::droption_parser_t;
+using ::dynamorio::droption::DROPTION_SCOPE_ALL;
+using ::dynamorio::droption::DROPTION_SCOPE_FRONTEND;
+using ::dynamorio::droption::droption_t;
+
+namespace {
+
+#define FATAL_ERROR(msg, ...)                               \
+    do {                                                    \
+        fprintf(stderr, "ERROR: " msg "\n", ##__VA_ARGS__); \
+        fflush(stderr);                                     \
+        exit(1);                                            \
+    } while (0)
+
+droption_t<std::string> op_trace(
+    DROPTION_SCOPE_FRONTEND, "trace", "", "[Required] Trace file or directory",
+    "Specifies a single-file trace, or a directory of them, to index.  Each index "
+    "is written alongside its trace file with the suffix " DRMEMTRACE_SEEK_INDEX_SUFFIX
+    ".  Zipfile traces are skipped, as they support fast seeking already.");
+
+droption_t<bytesize_t> op_interval(
+    DROPTION_SCOPE_FRONTEND, "interval", 100000,
+    "Instructions between seek points",
+    "Seek points are placed at the first timestamp at least this many instructions "
+    "past the prior seek point.  Smaller values make skips more precise at the cost "
+    "of a larger index.");
+
+droption_t<bytesize_t> op_restart_span(
+    DROPTION_SCOPE_FRONTEND, "restart_span", 1 << 20,
+    "Decompressed bytes between restart points",
+    "Decompression resumes from restart points, which are recorded at least this many "
+    "decompressed bytes apart.  For gzip and linked-block lz4 files, each restart "
+    "point stores the decompressor's window, so smaller values make a larger index "
+    "in exchange for less decompression per skip.");
+
+droption_t<unsigned int> op_verbose(DROPTION_SCOPE_ALL, "verbose", 0, 0, 64,
+                                    "Verbosity level",
+                                    "Verbosity level for notifications.");
+
+// Identifies the compression of "path" from its leading bytes.  Returns false for
+// files which cannot or need not be indexed.
+bool
+detect_codec(const std::string &path, seek_index_codec_t *codec)
+{
+    std::ifstream file(path, std::ifstream::binary);
+    unsigned char magic[10] = {};
+    file.read(reinterpret_cast<char *>(magic), sizeof(magic));
+    if (file.gcount() < 2)
+        return false;
+    if (magic[0] == 'P' && magic[1] == 'K')
+        return false;
+    // The columnar encoding's predictions run from the start of the file, so it
+    // has no restart points.
+    if (file.gcount() == sizeof(magic) &&
+        memcmp(magic, columnar_codec_t::get_magic(), columnar_codec_t::kMagicSize) == 0)
+        return false;
+    if (magic[0] == 0x1f && magic[1] == 0x8b)
+        *codec = SEEK_INDEX_CODEC_GZIP;
+    else if (file.gcount() >= 4 && magic[0] == 0x04 && magic[1] == 0x22 &&
+             magic[2] == 0x4d && magic[3] == 0x18)
+        *codec = SEEK_INDEX_CODEC_LZ4;
+    else if (file.gcount() == sizeof(magic) && magic[0] == 0xff &&
+             memcmp(magic + 4, "sNaPpY", 6) == 0)
+        *codec = SEEK_INDEX_CODEC_SNAPPY;
+    else
+        *codec = SEEK_INDEX_CODEC_NONE;
+    return true;
+}
+
+std::unique_ptr<seekable_input_t>
+open_input(const std::string &path, seek_index_codec_t codec)
+{
+    switch (codec) {
+    case SEEK_INDEX_CODEC_NONE: {
+        std::unique_ptr<raw_seekable_input_t> input(new raw_seekable_input_t(path));
+        if (!*input)
+            return nullptr;
+        return input;
+    }
+#ifdef HAS_ZLIB
+    case SEEK_INDEX_CODEC_GZIP: {
+        using ::dynamorio::drmemtrace::gzip_seekable_input_t;
+        std::unique_ptr<gzip_seekable_input_t> input(new gzip_seekable_input_t(path));
+        if (!*input)
+            return nullptr;
+        return input;
+    }
+#endif
+#ifdef HAS_LZ4
+    case SEEK_INDEX_CODEC_LZ4: {
+        using ::dynamorio::drmemtrace::lz4_seekable_input_t;
+        std::unique_ptr<lz4_seekable_input_t> input(new lz4_seekable_input_t(path));
+        if (!*input)
+            return nullptr;
+        return input;
+    }
+#endif
+#ifdef HAS_SNAPPY
+    case SEEK_INDEX_CODEC_SNAPPY: {
+        using ::dynamorio::drmemtrace::snappy_seekable_input_t;
+        std::unique_ptr<snappy_seekable_input_t> input(
+            new snappy_seekable_input_t(path));
+        if (!*input)
+            return nullptr;
+        return input;
+    }
+#endif
+    default: return nullptr;
+    }
+}
+
+// Returns false if "path" should have been indexed but was not.
+bool
+index_file(const std::string &path)
+{
+    seek_index_codec_t codec;
+    if (!detect_codec(path, &codec)) {
+        if (op_verbose.get_value() > 0)
+            fprintf(stderr, "Skipping %s\n", path.c_str());
+        return true;
+    }
+    std::unique_ptr<seekable_input_t> input = open_input(path, codec);
+    if (!input) {
+        fprintf(stderr, "Failed to open %s or its compression is unsupported\n",
+                path.c_str());
+        return false;
+    }
+    seek_index_builder_t builder(std::move(input), codec, op_interval.get_value(),
+                                 op_restart_span.get_value(), op_verbose.get_value());
+    std::string error = builder.build(path);
+    if (!error.empty()) {
+        fprintf(stderr, "Failed to index %s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int
+_tmain(int argc, const TCHAR *targv[])
+{
+    // Convert to UTF-8 if necessary
+    char **argv;
+    drfront_status_t sc = drfront_convert_args(targv, &argv, argc);
+    if (sc != DRFRONT_SUCCESS)
+        FATAL_ERROR("Failed to process args: %d", sc);
+
+    std::string parse_err;
+    if (!droption_parser_t::parse_argv(DROPTION_SCOPE_FRONTEND, argc, (const char **)argv,
+                                       &parse_err, NULL) ||
+        op_trace.get_value().empty()) {
+        FATAL_ERROR("Usage error: %s\nUsage:\n%s", parse_err.c_str(),
+                    droption_parser_t::usage_short(DROPTION_SCOPE_ALL).c_str());
+    }
+
+    const std::string &path = op_trace.get_value();
+    bool success = true;
+    if (directory_iterator_t::is_directory(path)) {
+        directory_iterator_t end;
+        directory_iterator_t iter(path);
+        if (!iter) {
+            FATAL_ERROR("Failed to list directory %s: %s", path.c_str(),
+                        iter.error_string().c_str());
+        }
+        for (; iter != end; ++iter) {
+            const std::string fname = *iter;
+            // Skip the auxiliary files, which are not read via file_reader_t.
+            if (fname == "." || fname == ".." ||
+                fname == DRMEMTRACE_MODULE_LIST_FILENAME ||
+                fname == DRMEMTRACE_FUNCTION_LIST_FILENAME ||
+                fname == DRMEMTRACE_ENCODING_FILENAME ||
+                starts_with(fname, DRMEMTRACE_SERIAL_SCHEDULE_FILENAME) ||
+                fname == DRMEMTRACE_CPU_SCHEDULE_FILENAME ||
+                ends_with(fname, DRMEMTRACE_SEEK_INDEX_SUFFIX))
+                continue;
+            if (!index_file(path + DIRSEP + fname))
+                success = false;
+        }
+    } else if (!index_file(path))
+        success = false;
+    return success ? 0 : 1;
+}
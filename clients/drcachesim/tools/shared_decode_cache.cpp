@@ -0,0 +1,159 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "shared_decode_cache.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+
+#include "dr_api.h"
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+shared_decode_cache_t::shared_decode_cache_t(void *dcontext, size_t max_bytes)
+    : dcontext_(dcontext)
+    , entry_count_(0)
+{
+    // We keep the table at most half full so probe sequences stay short, which
+    // also guarantees every probe reaches an empty slot.  A table of N slots thus
+    // costs N pointers plus N/2 entries.
+    size_t slots = 16;
+    while (slots * 2 * sizeof(std::atomic<entry_t *>) + slots * sizeof(entry_t) <=
+           max_bytes)
+        slots *= 2;
+    mask_ = slots - 1;
+    max_entries_ = slots / 2;
+    table_.reset(new std::atomic<entry_t *>[slots]);
+    for (size_t i = 0; i < slots; ++i)
+        table_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+shared_decode_cache_t::~shared_decode_cache_t()
+{
+    for (size_t i = 0; i <= mask_; ++i)
+        delete table_[i].load(std::memory_order_relaxed);
+}
+
+size_t
+shared_decode_cache_t::hash(app_pc pc, const unsigned char *encoding, size_t length)
+{
+    uint64_t key = reinterpret_cast<uint64_t>(pc) ^ length;
+    uint64_t bytes = 0;
+    memcpy(&bytes, encoding, length < sizeof(bytes) ? length : sizeof(bytes));
+    key = (key ^ bytes) * 0x9e3779b97f4a7c15ULL;
+    return static_cast<size_t>(key ^ (key >> 29));
+}
+
+bool
+shared_decode_cache_t::decode(app_pc pc, const unsigned char *encoding,
+                              decode_info_t *info)
+{
+    instr_t instr;
+    instr_init(dcontext_, &instr);
+    app_pc next_pc =
+        decode_from_copy(dcontext_, const_cast<unsigned char *>(encoding), pc, &instr);
+    if (next_pc == nullptr || !instr_valid(&instr)) {
+        instr_free(dcontext_, &instr);
+        return false;
+    }
+    info->opcode = instr_get_opcode(&instr);
+    info->category = instr_get_category(&instr);
+    info->num_srcs = instr_num_srcs(&instr);
+    info->num_dsts = instr_num_dsts(&instr);
+    info->reads_memory = instr_reads_memory(&instr);
+    info->writes_memory = instr_writes_memory(&instr);
+    info->is_cti = instr_is_cti(&instr);
+    instr_free(dcontext_, &instr);
+    return true;
+}
+
+bool
+shared_decode_cache_t::lookup(app_pc pc, const unsigned char *encoding, size_t length,
+                              decode_info_t *info, decode_cache_stats_t *stats)
+{
+    if (length == 0 || length > MAX_ENCODING_LENGTH)
+        return false;
+    size_t start = hash(pc, encoding, length) & mask_;
+    size_t slot = start;
+    // The acquire loads pair with the release publication below, so an entry's
+    // contents are visible before its pointer is.
+    entry_t *entry;
+    while ((entry = table_[slot].load(std::memory_order_acquire)) != nullptr) {
+        if (entry->pc == pc && entry->length == length &&
+            memcmp(entry->encoding, encoding, length) == 0) {
+            *info = entry->info;
+            ++stats->hits;
+            return true;
+        }
+        slot = (slot + 1) & mask_;
+    }
+    if (!decode(pc, encoding, info))
+        return false;
+    if (entry_count_.fetch_add(1, std::memory_order_relaxed) >= max_entries_) {
+        entry_count_.fetch_sub(1, std::memory_order_relaxed);
+        ++stats->uncached;
+        return true;
+    }
+    std::unique_ptr<entry_t> new_entry(new entry_t);
+    new_entry->pc = pc;
+    new_entry->length = static_cast<unsigned char>(length);
+    memcpy(new_entry->encoding, encoding, length);
+    new_entry->info = *info;
+    // Continue probing from the empty slot we found.  Another thread may fill it
+    // first, perhaps with this same instruction.
+    while (true) {
+        entry_t *expected = nullptr;
+        if (table_[slot].compare_exchange_strong(expected, new_entry.get(),
+                                                 std::memory_order_release,
+                                                 std::memory_order_acquire)) {
+            new_entry.release();
+            ++stats->misses;
+            return true;
+        }
+        if (expected->pc == pc && expected->length == length &&
+            memcmp(expected->encoding, encoding, length) == 0) {
+            entry_count_.fetch_sub(1, std::memory_order_relaxed);
+            ++stats->misses;
+            return true;
+        }
+        slot = (slot + 1) & mask_;
+    }
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
@@ -0,0 +1,156 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* shared_decode_cache: a cache of instruction decode results which is shared by
+ * all shards and workers of an analysis tool.
+ */
+
+#ifndef _SHARED_DECODE_CACHE_H_
+#define _SHARED_DECODE_CACHE_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+#include "dr_api.h" // Must be before trace_entry.h.
+#include "trace_entry.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/** The properties of a decoded instruction which the cache holds. */
+struct decode_info_t {
+    int opcode = OP_INVALID;
+    /* The category is a uint rather than a dr_instr_category_t as an instruction
+     * may belong to several categories.
+     */
+    uint category = DR_INSTR_CATEGORY_UNCATEGORIZED;
+    int num_srcs = 0;
+    int num_dsts = 0;
+    bool reads_memory = false;
+    bool writes_memory = false;
+    bool is_cti = false;
+};
+
+/**
+ * Lookup counts for a #dynamorio::drmemtrace::shared_decode_cache_t.  These are
+ * kept by each caller rather than by the cache so that lookups from different
+ * threads do not contend on them.
+ */
+struct decode_cache_stats_t {
+    /** Lookups which found the instruction in the cache. */
+    int64_t hits = 0;
+    /** Lookups which decoded the instruction and added it to the cache. */
+    int64_t misses = 0;
+    /** Lookups which decoded the instruction but found the cache full. */
+    int64_t uncached = 0;
+
+    decode_cache_stats_t &
+    operator+=(const decode_cache_stats_t &rhs)
+    {
+        hits += rhs.hits;
+        misses += rhs.misses;
+        uncached += rhs.uncached;
+        return *this;
+    }
+};
+
+/**
+ * A cache of instruction decodings keyed by both the PC and the encoding of each
+ * instruction, so that code which changes simply produces new entries.  Lookups
+ * take no locks: the cache is an open-addressed table of pointers to entries
+ * which, once published, are never modified or freed until the cache is
+ * destroyed.  This keeps hot instructions from being decoded again by every
+ * shard and worker, at the cost of the cache never shrinking: once it reaches
+ * its memory cap, further instructions are decoded on each lookup.
+ */
+class shared_decode_cache_t {
+public:
+    static constexpr size_t kDefaultMaxBytes = 64 * 1024 * 1024;
+
+    /**
+     * Creates a cache which decodes with "dcontext", which must remain valid for
+     * the life of the cache, and which uses about "max_bytes" of memory at most.
+     */
+    explicit shared_decode_cache_t(void *dcontext, size_t max_bytes = kDefaultMaxBytes);
+    ~shared_decode_cache_t();
+
+    /**
+     * Sets "info" to the properties of the instruction at "pc" whose "length"
+     * bytes of encoding are at "encoding", decoding it if it is not in the cache.
+     * Returns false if the instruction is invalid.  Adds to "stats".
+     * May be called concurrently from any number of threads.
+     */
+    bool
+    lookup(app_pc pc, const unsigned char *encoding, size_t length, decode_info_t *info,
+           decode_cache_stats_t *stats);
+
+    /** Returns the number of instructions in the cache. */
+    size_t
+    get_entry_count() const
+    {
+        return entry_count_.load(std::memory_order_relaxed);
+    }
+
+    /** Returns the number of instructions the cache can hold. */
+    size_t
+    get_max_entries() const
+    {
+        return max_entries_;
+    }
+
+private:
+    struct entry_t {
+        app_pc pc;
+        unsigned char length;
+        unsigned char encoding[MAX_ENCODING_LENGTH];
+        decode_info_t info;
+    };
+
+    static size_t
+    hash(app_pc pc, const unsigned char *encoding, size_t length);
+    bool
+    decode(app_pc pc, const unsigned char *encoding, decode_info_t *info);
+
+    void *dcontext_;
+    size_t mask_;
+    size_t max_entries_;
+    std::unique_ptr<std::atomic<entry_t *>[]> table_;
+    std::atomic<size_t> entry_count_;
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _SHARED_DECODE_CACHE_H_ */
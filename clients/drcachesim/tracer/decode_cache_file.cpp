@@ -0,0 +1,495 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "decode_cache_file.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "dr_api.h"
+#include "raw2trace.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+#undef VPRINT
+#define VPRINT(level, ...)                     \
+    do {                                       \
+        if (this->verbosity_ >= (level)) {     \
+            fprintf(stderr, "[drmemtrace]: "); \
+            fprintf(stderr, __VA_ARGS__);      \
+            fflush(stderr);                    \
+        }                                      \
+    } while (0)
+
+namespace {
+
+static const char kMagic[8] = { 'D', 'R', 'D', 'E', 'C', 'O', 'D', 'E' };
+static const uint32_t kFormatVersion = 1;
+
+#if defined(X86)
+static const uint32_t kArch = 1;
+#elif defined(AARCH64)
+static const uint32_t kArch = 2;
+#elif defined(ARM)
+static const uint32_t kArch = 3;
+#elif defined(RISCV64)
+static const uint32_t kArch = 4;
+#else
+#    error Unsupported architecture.
+#endif
+
+// We store operands as their raw bytes, so the file is tied to this layout.
+static const uint32_t kLayout = static_cast<uint32_t>(sizeof(opnd_t)) |
+    (static_cast<uint32_t>(sizeof(void *)) << 8) | (kArch << 16);
+
+struct file_header_t {
+    char magic[sizeof(kMagic)];
+    uint32_t version;
+    uint32_t layout;
+};
+
+// Each record is a record_header_t, the block's instruction bytes, an
+// instr_record_t per instruction, and then a memref_record_t per memory operand of
+// those instructions in order, padded to 8 bytes.
+struct record_header_t {
+    uint32_t size;
+    // Covers everything after the header, to catch records torn by a full disk or
+    // a crash.
+    uint32_t checksum;
+    uint64_t module_key;
+    uint64_t modoffs;
+    uint64_t flavor;
+    uint32_t instr_count;
+    uint32_t code_size;
+};
+
+struct instr_record_t {
+    // Relative to the original block start.
+    int64_t branch_target;
+    uint16_t type;
+    uint16_t prefetch_type;
+    uint16_t flush_type;
+    uint8_t length;
+    uint8_t packed;
+    uint8_t num_mem_srcs;
+    uint8_t num_memrefs;
+    uint8_t has_branch_target;
+};
+
+struct memref_record_t {
+    // Relative to the original block start, for pc-relative operands.
+    int64_t rel_addr;
+    byte opnd[sizeof(opnd_t)];
+    uint8_t flags;
+};
+
+static const uint8_t kRememberBase = 0x1;
+static const uint8_t kUseRememberedBase = 0x2;
+static const uint8_t kRelAddr = 0x4;
+
+static const size_t kAlign = 8;
+
+size_t
+align_up(size_t size)
+{
+    return (size + kAlign - 1) & ~(kAlign - 1);
+}
+
+uint32_t
+checksum(const byte *data, size_t size)
+{
+    // FNV-1a.
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+} // namespace
+
+decode_cache_file_t::decode_cache_file_t(const std::string &path,
+                                         unsigned int verbosity)
+    : path_(path)
+    , verbosity_(verbosity)
+{
+}
+
+decode_cache_file_t::~decode_cache_file_t()
+{
+    unmap();
+}
+
+void
+decode_cache_file_t::unmap()
+{
+    index_.clear();
+    if (map_ != nullptr) {
+        dr_unmap_file(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+}
+
+uint64
+decode_cache_file_t::module_key(const char *path, uint64 offset, size_t size)
+{
+    // We have no build id for every platform, so we use the name and layout, and
+    // rely on the instruction bytes check in lookup() for the rest.
+    const char *name = path;
+    for (const char *c = path; *c != '\0'; ++c) {
+        if (*c == '/' || *c == '\\')
+            name = c + 1;
+    }
+    // FNV-1a.
+    uint64 hash = 14695981039346656037ULL;
+    for (const char *c = name; *c != '\0'; ++c) {
+        hash ^= static_cast<byte>(*c);
+        hash *= 1099511628211ULL;
+    }
+    hash ^= offset * 0xff51afd7ed558ccdULL;
+    return hash ^ (static_cast<uint64>(size) * 0x9e3779b97f4a7c15ULL);
+}
+
+size_t
+decode_cache_file_t::validate_record(const byte *record, size_t available)
+{
+    if (available < sizeof(record_header_t))
+        return 0;
+    record_header_t header;
+    memcpy(&header, record, sizeof(header));
+    if (header.size < sizeof(header) || header.size > available ||
+        header.size % kAlign != 0 || header.instr_count == 0)
+        return 0;
+    size_t fixed = sizeof(header) + static_cast<size_t>(header.code_size) +
+        static_cast<size_t>(header.instr_count) * sizeof(instr_record_t);
+    if (fixed > header.size)
+        return 0;
+    if (checksum(record + sizeof(header), header.size - sizeof(header)) !=
+        header.checksum)
+        return 0;
+    size_t memrefs = 0;
+    const byte *instr_at = record + sizeof(header) + header.code_size;
+    for (uint32_t i = 0; i < header.instr_count; ++i) {
+        instr_record_t instr;
+        memcpy(&instr, instr_at + i * sizeof(instr), sizeof(instr));
+        if (instr.num_mem_srcs > instr.num_memrefs)
+            return 0;
+        memrefs += instr.num_memrefs;
+    }
+    if (fixed + memrefs * sizeof(memref_record_t) > header.size)
+        return 0;
+    return header.size;
+}
+
+decode_cache_file_t::key_t
+decode_cache_file_t::record_key(const byte *record)
+{
+    record_header_t header;
+    memcpy(&header, record, sizeof(header));
+    return { header.module_key, header.modoffs, header.flavor };
+}
+
+bool
+decode_cache_file_t::same_code(const byte *record1, const byte *record2)
+{
+    record_header_t header1, header2;
+    memcpy(&header1, record1, sizeof(header1));
+    memcpy(&header2, record2, sizeof(header2));
+    return header1.code_size == header2.code_size &&
+        memcmp(record1 + sizeof(header1), record2 + sizeof(header2),
+               header1.code_size) == 0;
+}
+
+std::string
+decode_cache_file_t::load()
+{
+    unmap();
+    replace_ = true;
+    file_t file = dr_open_file(path_.c_str(), DR_FILE_READ);
+    if (file == INVALID_FILE) {
+        VPRINT(1, "Creating new decode cache file %s\n", path_.c_str());
+        return "";
+    }
+    uint64 file_size;
+    if (!dr_file_size(file, &file_size)) {
+        dr_close_file(file);
+        return "Failed to obtain size of decode cache file";
+    }
+    if (file_size < sizeof(file_header_t)) {
+        dr_close_file(file);
+        VPRINT(1, "Replacing empty decode cache file %s\n", path_.c_str());
+        return "";
+    }
+    map_size_ = static_cast<size_t>(file_size);
+    map_ = reinterpret_cast<byte *>(
+        dr_map_file(file, &map_size_, 0, nullptr, DR_MEMPROT_READ, 0));
+    dr_close_file(file);
+    if (map_ == nullptr || map_size_ < file_size) {
+        map_ = nullptr;
+        map_size_ = 0;
+        return "Failed to map decode cache file";
+    }
+    file_header_t header;
+    memcpy(&header, map_, sizeof(header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kFormatVersion || header.layout != kLayout) {
+        VPRINT(1, "Replacing decode cache file %s written by another build\n",
+               path_.c_str());
+        unmap();
+        return "";
+    }
+    replace_ = false;
+    const byte *at = map_ + sizeof(header);
+    const byte *end = map_ + static_cast<size_t>(file_size);
+    while (at < end) {
+        size_t size = validate_record(at, end - at);
+        if (size == 0) {
+            // A concurrent conversion may be mid-append, or an earlier one died
+            // mid-write.  Either way there is nothing usable past here.
+            VPRINT(1, "Ignoring invalid decode cache record at offset %zu\n",
+                   static_cast<size_t>(at - map_));
+            break;
+        }
+        // Later records replace earlier ones for the same key, so a rebuilt
+        // binary's blocks take over once converted once.
+        index_[record_key(at)] = at;
+        at += size;
+    }
+    VPRINT(1, "Loaded %zu blocks from decode cache file %s\n", index_.size(),
+           path_.c_str());
+    return "";
+}
+
+const byte *
+decode_cache_file_t::lookup(uint64 module_key, uint64 modoffs, uint64 flavor,
+                            int instr_count, app_pc map_start, size_t max_size)
+{
+    auto it = index_.find({ module_key, modoffs, flavor });
+    if (it != index_.end()) {
+        record_header_t header;
+        memcpy(&header, it->second, sizeof(header));
+        if (header.instr_count == static_cast<uint32_t>(instr_count) &&
+            header.code_size <= max_size &&
+            memcmp(it->second + sizeof(header), map_start, header.code_size) == 0) {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return it->second;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+void
+decode_cache_file_t::materialize(const byte *record, app_pc map_start,
+                                 app_pc orig_start,
+                                 std::vector<instr_summary_t> &instrs) const
+{
+    record_header_t header;
+    memcpy(&header, record, sizeof(header));
+    DR_ASSERT(header.instr_count == instrs.size());
+    const byte *instr_at = record + sizeof(header) + header.code_size;
+    const byte *memref_at = instr_at + header.instr_count * sizeof(instr_record_t);
+    app_pc pc = map_start;
+    for (instr_summary_t &desc : instrs) {
+        instr_record_t instr;
+        memcpy(&instr, instr_at, sizeof(instr));
+        instr_at += sizeof(instr);
+        desc.pc_ = pc;
+        desc.length_ = instr.length;
+        desc.type_ = instr.type;
+        desc.prefetch_type_ = instr.prefetch_type;
+        desc.flush_type_ = instr.flush_type;
+        desc.packed_ = instr.packed;
+        desc.branch_target_pc_ =
+            instr.has_branch_target ? orig_start + instr.branch_target : nullptr;
+        desc.num_mem_srcs_ = instr.num_mem_srcs;
+        desc.mem_srcs_and_dests_.clear();
+        desc.mem_srcs_and_dests_.reserve(instr.num_memrefs);
+        for (uint8_t i = 0; i < instr.num_memrefs; ++i) {
+            memref_record_t memref;
+            memcpy(&memref, memref_at, sizeof(memref));
+            memref_at += sizeof(memref);
+            opnd_t opnd;
+            memcpy(&opnd, memref.opnd, sizeof(opnd));
+#if defined(X64) || defined(ARM)
+            if (TESTANY(kRelAddr, memref.flags)) {
+                opnd = opnd_create_rel_addr(orig_start + memref.rel_addr,
+                                            opnd_get_size(opnd));
+            }
+#endif
+            desc.mem_srcs_and_dests_.emplace_back(opnd);
+            desc.mem_srcs_and_dests_.back().remember_base =
+                TESTANY(kRememberBase, memref.flags);
+            desc.mem_srcs_and_dests_.back().use_remembered_base =
+                TESTANY(kUseRememberedBase, memref.flags);
+        }
+        pc += instr.length;
+    }
+}
+
+void
+decode_cache_file_t::serialize(uint64 module_key, uint64 modoffs, uint64 flavor,
+                               app_pc map_start, app_pc orig_start,
+                               const std::vector<instr_summary_t> &instrs,
+                               std::string &out)
+{
+    size_t code_size = 0;
+    size_t memrefs = 0;
+    for (const instr_summary_t &desc : instrs) {
+        code_size += desc.length_;
+        memrefs += desc.mem_srcs_and_dests_.size();
+#if defined(X64)
+        for (const auto &memref : desc.mem_srcs_and_dests_) {
+            // We would need the segment to rebase these.  They are rare enough
+            // that we just leave such blocks out.
+            if (opnd_is_far_rel_addr(memref.opnd))
+                return;
+        }
+#endif
+    }
+    size_t unpadded = sizeof(record_header_t) + code_size +
+        instrs.size() * sizeof(instr_record_t) + memrefs * sizeof(memref_record_t);
+    size_t start = out.size();
+    out.resize(start + align_up(unpadded), '\0');
+    byte *record = reinterpret_cast<byte *>(&out[start]);
+    byte *at = record + sizeof(record_header_t);
+    memcpy(at, map_start, code_size);
+    at += code_size;
+    byte *memref_at = at + instrs.size() * sizeof(instr_record_t);
+    for (const instr_summary_t &desc : instrs) {
+        instr_record_t instr;
+        memset(&instr, 0, sizeof(instr));
+        instr.length = desc.length_;
+        instr.type = desc.type_;
+        instr.prefetch_type = desc.prefetch_type_;
+        instr.flush_type = desc.flush_type_;
+        instr.packed = desc.packed_;
+        instr.num_mem_srcs = desc.num_mem_srcs_;
+        instr.num_memrefs = static_cast<uint8_t>(desc.mem_srcs_and_dests_.size());
+        if (desc.branch_target_pc_ != nullptr) {
+            instr.has_branch_target = 1;
+            instr.branch_target = desc.branch_target_pc_ - orig_start;
+        }
+        memcpy(at, &instr, sizeof(instr));
+        at += sizeof(instr);
+        for (const auto &summary : desc.mem_srcs_and_dests_) {
+            memref_record_t memref;
+            memset(&memref, 0, sizeof(memref));
+            memcpy(memref.opnd, &summary.opnd, sizeof(memref.opnd));
+            if (summary.remember_base)
+                memref.flags |= kRememberBase;
+            if (summary.use_remembered_base)
+                memref.flags |= kUseRememberedBase;
+#if defined(X64) || defined(ARM)
+            if (opnd_is_rel_addr(summary.opnd)) {
+                memref.flags |= kRelAddr;
+                memref.rel_addr =
+                    reinterpret_cast<app_pc>(opnd_get_addr(summary.opnd)) - orig_start;
+            }
+#endif
+            memcpy(memref_at, &memref, sizeof(memref));
+            memref_at += sizeof(memref);
+        }
+    }
+    record_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.size = static_cast<uint32_t>(out.size() - start);
+    header.module_key = module_key;
+    header.modoffs = modoffs;
+    header.flavor = flavor;
+    header.instr_count = static_cast<uint32_t>(instrs.size());
+    header.code_size = static_cast<uint32_t>(code_size);
+    header.checksum = checksum(record + sizeof(header), header.size - sizeof(header));
+    memcpy(record, &header, sizeof(header));
+}
+
+std::string
+decode_cache_file_t::append(const std::string &records)
+{
+    std::string out;
+    if (replace_) {
+        file_header_t header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kFormatVersion;
+        header.layout = kLayout;
+        out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+    std::unordered_set<key_t, key_hash_t> added;
+    size_t count = 0;
+    const byte *at = reinterpret_cast<const byte *>(records.data());
+    const byte *end = at + records.size();
+    while (at < end) {
+        size_t size = validate_record(at, end - at);
+        DR_ASSERT(size > 0);
+        if (size == 0)
+            return "Invalid decode cache record";
+        key_t key = record_key(at);
+        // A record for a block whose bytes changed since the file was loaded (a
+        // rebuilt binary) is appended so that it replaces the stale one on the
+        // next load.
+        auto existing = index_.find(key);
+        if ((existing == index_.end() || !same_code(existing->second, at)) &&
+            added.insert(key).second) {
+            out.append(reinterpret_cast<const char *>(at), size);
+            ++count;
+        }
+        at += size;
+    }
+    if (count == 0 && !replace_)
+        return "";
+    // The index points into the mapping, which we may be about to overwrite.
+    unmap();
+    file_t file = dr_open_file(path_.c_str(),
+                               replace_ ? DR_FILE_WRITE_OVERWRITE : DR_FILE_WRITE_APPEND);
+    if (file == INVALID_FILE)
+        return "Failed to open decode cache file " + path_;
+    ssize_t wrote = dr_write_file(file, out.data(), out.size());
+    dr_close_file(file);
+    if (wrote != static_cast<ssize_t>(out.size()))
+        return "Failed to write decode cache file " + path_;
+    replace_ = false;
+    VPRINT(1, "Added %zu blocks to decode cache file %s\n", count, path_.c_str());
+    return "";
+}
+
+} // namespace drmemtrace
+} // namespace dynamorio
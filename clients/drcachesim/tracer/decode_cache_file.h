@@ -0,0 +1,178 @@
+/* **********************************************************
+ * Copyright (c) 2024 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* decode_cache_file: an on-disk cache of raw2trace's block decodings which is
+ * shared across conversions of traces of the same binaries.
+ */
+
+#ifndef _DECODE_CACHE_FILE_H_
+#define _DECODE_CACHE_FILE_H_ 1
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dr_api.h"
+#include "raw2trace.h"
+
+namespace dynamorio {
+namespace drmemtrace {
+
+/**
+ * Holds the block decodings raw2trace persisted in a file by earlier conversions and
+ * collects new ones to append to it.  The file is mapped read-only and indexed on
+ * load, after which lookups are safe to make concurrently from any number of
+ * workers.  Each block is keyed by an identifier of its module, its offset in the
+ * module, and the trace properties that affect how raw2trace annotates it; its
+ * instruction bytes are stored alongside and compared on lookup, so a rebuilt
+ * binary with the same name simply misses.  Code addresses are stored relative to
+ * the block start so that a block's decoding applies wherever its module is loaded.
+ * The file is only usable with the same build of raw2trace that wrote it: any other
+ * file is ignored and replaced.
+ */
+class decode_cache_file_t {
+public:
+    decode_cache_file_t(const std::string &path, unsigned int verbosity);
+    ~decode_cache_file_t();
+
+    /**
+     * Maps and indexes the file, if it exists.  Returns an empty string on success.
+     * A file with an unknown header, or truncated records at its end, is not an
+     * error: the unusable parts are ignored.
+     */
+    std::string
+    load();
+
+    /**
+     * Returns the record for the "instr_count"-instruction block at "map_start",
+     * which is "modoffs" into the module identified by "module_key", or nullptr if
+     * there is none whose instruction bytes match.  "max_size" bounds how many bytes
+     * may be read at "map_start".
+     */
+    const byte *
+    lookup(uint64 module_key, uint64 modoffs, uint64 flavor, int instr_count,
+           app_pc map_start, size_t max_size);
+
+    /**
+     * Fills in "instrs" from a record returned by lookup(), rebasing its addresses
+     * to a block at "map_start" which was at "orig_start" when traced.
+     */
+    void
+    materialize(const byte *record, app_pc map_start, app_pc orig_start,
+                std::vector<instr_summary_t> &instrs) const;
+
+    /**
+     * Appends to "out" a record for a fully decoded block to be passed to append().
+     */
+    static void
+    serialize(uint64 module_key, uint64 modoffs, uint64 flavor, app_pc map_start,
+              app_pc orig_start, const std::vector<instr_summary_t> &instrs,
+              std::string &out);
+
+    /**
+     * Adds the records in "records", which holds the output of serialize() calls, to
+     * the end of the file, skipping any for blocks already present.  Concurrent
+     * conversions sharing the file are fine as each record is self-checking and is
+     * written in a single append.  Returns an empty string on success.
+     */
+    std::string
+    append(const std::string &records);
+
+    /**
+     * Returns an identifier for a module segment from properties stable across runs:
+     * the base name of its file and its offset and size in that file.
+     */
+    static uint64
+    module_key(const char *path, uint64 offset, size_t size);
+
+    /** Returns the number of lookups which found a record. */
+    uint64
+    get_hits() const
+    {
+        return hits_.load(std::memory_order_relaxed);
+    }
+    /** Returns the number of lookups which found no record. */
+    uint64
+    get_misses() const
+    {
+        return misses_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct key_t {
+        uint64 module_key;
+        uint64 modoffs;
+        uint64 flavor;
+        bool
+        operator==(const key_t &other) const
+        {
+            return module_key == other.module_key && modoffs == other.modoffs &&
+                flavor == other.flavor;
+        }
+    };
+    struct key_hash_t {
+        size_t
+        operator()(const key_t &key) const
+        {
+            return static_cast<size_t>(key.module_key ^
+                                       (key.modoffs * 0x9e3779b97f4a7c15ULL) ^
+                                       (key.flavor << 1));
+        }
+    };
+
+    // Returns the size of the valid record at "record", or 0 if it is invalid.
+    static size_t
+    validate_record(const byte *record, size_t available);
+    static key_t
+    record_key(const byte *record);
+    // Returns whether two valid records hold the same instruction bytes.
+    static bool
+    same_code(const byte *record1, const byte *record2);
+    void
+    unmap();
+
+    std::string path_;
+    unsigned int verbosity_;
+    // Whether the file's header was missing or not ours, in which case we rewrite it.
+    bool replace_ = true;
+    byte *map_ = nullptr;
+    size_t map_size_ = 0;
+    std::unordered_map<key_t, const byte *, key_hash_t> index_;
+    std::atomic<uint64> hits_ { 0 };
+    std::atomic<uint64> misses_ { 0 };
+};
+
+} // namespace drmemtrace
+} // namespace dynamorio
+
+#endif /* _DECODE_CACHE_FILE_H_ */
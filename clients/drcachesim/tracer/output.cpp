@@ -334,10 +334,299 @@ open_new_window_dir(ptr_int_t window_num)
     NOTIFY(2, "Created new window dir %s\n", windir);
 }
 
+// Compresses (per -raw_compress) and writes out the given data to the thread's
+// file.  Returns the number of bytes of input consumed.
+static ssize_t
+compress_and_write(per_thread_t *data, byte *towrite_start, ssize_t size)
+{
+    ssize_t wrote;
+#ifdef HAS_SNAPPY
+    if (snappy_enabled())
+        wrote = data->snappy_writer->compress_and_write(towrite_start, size);
+    else
+#endif
+#ifdef HAS_ZLIB
+        if (op_raw_compress.get_value() == "zlib" ||
+            op_raw_compress.get_value() == "gzip") {
+        data->zstream.next_in = (Bytef *)towrite_start;
+        data->zstream.avail_in = static_cast<uInt>(size);
+        int res;
+        do {
+            data->zstream.next_out = (Bytef *)data->buf_compressed;
+            data->zstream.avail_out = static_cast<uInt>(max_buf_size);
+            res = deflate(&data->zstream, Z_NO_FLUSH);
+            NOTIFY(3, "deflate => %d in=%d out=%d => in=%d, out=%d, write=%d\n", res,
+                   size, size, data->zstream.avail_in, data->zstream.avail_out,
+                   max_buf_size - data->zstream.avail_out);
+            DR_ASSERT(res != Z_STREAM_ERROR);
+            wrote = file_ops_func.write_file(data->file, data->buf_compressed,
+                                             max_buf_size - data->zstream.avail_out);
+        } while (data->zstream.avail_out == 0);
+        DR_ASSERT(data->zstream.avail_in == 0);
+        wrote = size;
+    } else
+#endif
+#ifdef HAS_LZ4
+        if (op_raw_compress.get_value() == "lz4") {
+        size_t res = LZ4F_compressUpdate(data->lzcxt, data->buf_lz4, data->buf_lz4_size,
+                                         towrite_start, size, nullptr);
+        DR_ASSERT(!LZ4F_isError(res));
+        wrote = file_ops_func.write_file(data->file, data->buf_lz4, res);
+        DR_ASSERT(static_cast<size_t>(wrote) == res);
+        wrote = size;
+    } else
+#endif
+        wrote = file_ops_func.write_file(data->file, towrite_start, size);
+    return wrote;
+}
+
+/***************************************************************************
+ * Background writer threads for -raw_writer_threads.
+ *
+ * Each application thread is assigned to one writer thread, which compresses and
+ * writes that thread's buffers in the order they were handed off.  A full trace
+ * buffer is handed off as a whole and the application thread continues with a
+ * clean buffer; any other data (from the stack or the v2p buffer) is copied.
+ */
+
+struct pending_write_t {
+    per_thread_t *data;
+    thread_id_t tid;
+    ptr_int_t window;
+    byte *start;
+    size_t size;
+    // Either a trace buffer to return to the thread's free list once written, or
+    // for a non-zero alloc_size, a copy of the data to free.
+    byte *buf;
+    size_t alloc_size;
+    pending_write_t *next;
+};
+
+struct writer_t {
+    void *lock;
+    void *work_event;
+    void *exited_event;
+    // Protected by lock.
+    pending_write_t *head;
+    pending_write_t *tail;
+    bool exiting;
+};
+
+static writer_t *writers;
+static uint num_writers;
+static std::atomic<uint> next_writer_index;
+
+static inline bool
+writers_enabled(per_thread_t *data)
+{
+    return data->writer_lock != nullptr;
+}
+
+static void
+finish_write(writer_t *writer, pending_write_t *write)
+{
+    per_thread_t *data = write->data;
+    ssize_t wrote = compress_and_write(data, write->start, write->size);
+    if (wrote < static_cast<ssize_t>(write->size)) {
+        FATAL("Fatal error: failed to write trace for T%d window %zd: wrote %zd "
+              "of %zd\n",
+              write->tid, write->window, wrote, write->size);
+    }
+    if (write->alloc_size > 0)
+        dr_global_free(write->buf, write->alloc_size);
+    else {
+        // Clear the buffer for reuse just like process_and_output_buffer() does.
+        memset(write->buf, 0, trace_buf_size);
+        memset(write->buf + trace_buf_size, -1, redzone_size);
+    }
+    // We hold the writer lock so that an exiting thread can ensure we are done
+    // with its lock before destroying it: see exit_thread_writer().
+    dr_mutex_lock(writer->lock);
+    dr_mutex_lock(data->writer_lock);
+    if (write->alloc_size == 0) {
+        *(byte **)write->buf = data->free_bufs;
+        data->free_bufs = write->buf;
+    }
+    --data->writes_pending;
+    dr_event_signal(data->writer_event);
+    dr_mutex_unlock(data->writer_lock);
+    dr_mutex_unlock(writer->lock);
+    dr_global_free(write, sizeof(*write));
+}
+
+static void
+writer_thread_main(void *arg)
+{
+    writer_t *writer = reinterpret_cast<writer_t *>(arg);
+    // Application threads wait for us in their exit events, including those
+    // invoked while DR has the other threads suspended at process exit.
+    dr_client_thread_set_suspendable(false);
+    while (true) {
+        dr_mutex_lock(writer->lock);
+        pending_write_t *write = writer->head;
+        if (write == nullptr) {
+            bool exiting = writer->exiting;
+            dr_mutex_unlock(writer->lock);
+            if (exiting)
+                break;
+            dr_event_wait(writer->work_event);
+            continue;
+        }
+        writer->head = write->next;
+        if (writer->head == nullptr)
+            writer->tail = nullptr;
+        dr_mutex_unlock(writer->lock);
+        finish_write(writer, write);
+    }
+    dr_event_signal(writer->exited_event);
+}
+
+// The caller must ensure that no writer threads are running.
+static void
+start_writers()
+{
+    for (uint i = 0; i < num_writers; ++i) {
+        writer_t *writer = &writers[i];
+        writer->lock = dr_mutex_create();
+        writer->work_event = dr_event_create();
+        writer->exited_event = dr_event_create();
+        writer->head = nullptr;
+        writer->tail = nullptr;
+        writer->exiting = false;
+        if (!dr_create_client_thread(writer_thread_main, writer))
+            FATAL("Fatal error: failed to create raw writer thread\n");
+    }
+}
+
+// Returns a clean trace buffer, waiting for one to be written out if the thread
+// already has the maximum number in flight.
+static byte *
+acquire_writer_buffer(per_thread_t *data)
+{
+    byte *buf;
+    dr_mutex_lock(data->writer_lock);
+    while (data->free_bufs == nullptr &&
+           data->writer_bufs >= op_raw_writer_buffers.get_value()) {
+        dr_mutex_unlock(data->writer_lock);
+        // The event is left signaled by a write finishing after we unlock.
+        dr_event_wait(data->writer_event);
+        dr_mutex_lock(data->writer_lock);
+    }
+    buf = data->free_bufs;
+    if (buf != nullptr) {
+        data->free_bufs = *(byte **)buf;
+        *(byte **)buf = nullptr;
+    } else
+        ++data->writer_bufs;
+    dr_mutex_unlock(data->writer_lock);
+    if (buf == nullptr) {
+        buf = (byte *)dr_raw_mem_alloc(max_buf_size, DR_MEMPROT_READ | DR_MEMPROT_WRITE,
+                                       NULL);
+        if (buf == NULL)
+            FATAL("Fatal error: out of memory for raw writer buffers.\n");
+        memset(buf + trace_buf_size, -1, redzone_size);
+    }
+    return buf;
+}
+
+static void
+queue_write(void *drcontext, per_thread_t *data, byte *towrite_start, byte *towrite_end)
+{
+    pending_write_t *write =
+        static_cast<pending_write_t *>(dr_global_alloc(sizeof(*write)));
+    write->data = data;
+    write->tid = dr_get_thread_id(drcontext);
+    write->window = get_local_window(data);
+    write->size = towrite_end - towrite_start;
+    write->next = nullptr;
+    // We can only hand off a trace buffer we allocated (the L0 filter switch in
+    // process_and_output_buffer() moves buf_base within it), and only once the
+    // write extends to the end of its data, meaning it is finished.
+    if (data->buf_base == data->writer_buf && towrite_start >= data->buf_base &&
+        towrite_end == BUF_PTR(data->seg_base)) {
+        byte *fresh = acquire_writer_buffer(data);
+        write->buf = data->buf_base;
+        write->start = towrite_start;
+        write->alloc_size = 0;
+        data->buf_base = fresh;
+        data->writer_buf = fresh;
+    } else {
+        write->buf = static_cast<byte *>(dr_global_alloc(write->size));
+        write->alloc_size = write->size;
+        memcpy(write->buf, towrite_start, write->size);
+        write->start = write->buf;
+    }
+    dr_mutex_lock(data->writer_lock);
+    ++data->writes_pending;
+    dr_mutex_unlock(data->writer_lock);
+    writer_t *writer = &writers[data->writer_index];
+    dr_mutex_lock(writer->lock);
+    if (writer->tail == nullptr)
+        writer->head = write;
+    else
+        writer->tail->next = write;
+    writer->tail = write;
+    dr_event_signal(writer->work_event);
+    dr_mutex_unlock(writer->lock);
+}
+
+// Waits for all of the thread's handed-off writes to finish, after which the
+// thread may operate on its file and compression state again.
+static void
+wait_for_pending_writes(per_thread_t *data)
+{
+    if (!writers_enabled(data))
+        return;
+    dr_mutex_lock(data->writer_lock);
+    while (data->writes_pending > 0) {
+        dr_mutex_unlock(data->writer_lock);
+        dr_event_wait(data->writer_event);
+        dr_mutex_lock(data->writer_lock);
+    }
+    dr_mutex_unlock(data->writer_lock);
+}
+
+static void
+init_thread_writer(per_thread_t *data)
+{
+    // We reset every field as after a fork we inherit the parent's values.
+    data->writer_lock = nullptr;
+    data->writes_pending = 0;
+    data->writer_bufs = 0;
+    data->free_bufs = nullptr;
+    if (num_writers == 0 || file_ops_func.handoff_buf != NULL)
+        return;
+    data->writer_index = next_writer_index.fetch_add(1, std::memory_order_relaxed) %
+        num_writers;
+    data->writer_lock = dr_mutex_create();
+    data->writer_event = dr_event_create();
+}
+
+static void
+exit_thread_writer(per_thread_t *data)
+{
+    if (!writers_enabled(data))
+        return;
+    wait_for_pending_writes(data);
+    // Ensure the writer thread has released our lock in finish_write().
+    writer_t *writer = &writers[data->writer_index];
+    dr_mutex_lock(writer->lock);
+    dr_mutex_unlock(writer->lock);
+    while (data->free_bufs != nullptr) {
+        byte *next = *(byte **)data->free_bufs;
+        dr_raw_mem_free(data->free_bufs, max_buf_size);
+        data->free_bufs = next;
+    }
+    dr_mutex_destroy(data->writer_lock);
+    dr_event_destroy(data->writer_event);
+    data->writer_lock = nullptr;
+}
+
 static void
 close_thread_file(void *drcontext)
 {
     per_thread_t *data = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
+    wait_for_pending_writes(data);
 #ifdef HAS_SNAPPY
     if (op_offline.get_value() && snappy_enabled()) {
         data->snappy_writer->~snappy_file_writer_t();
@@ -550,49 +839,10 @@ write_trace_data(void *drcontext, byte *towrite_start, byte *towrite_end,
                                            max_buf_size)) {
                 FATAL("Fatal error: failed to hand off trace\n");
             }
+        } else if (writers_enabled(data)) {
+            queue_write(drcontext, data, towrite_start, towrite_end);
         } else {
-            ssize_t wrote;
-#ifdef HAS_SNAPPY
-            if (op_offline.get_value() && snappy_enabled())
-                wrote = data->snappy_writer->compress_and_write(towrite_start, size);
-            else
-#endif
-#ifdef HAS_ZLIB
-                if (op_offline.get_value() &&
-                    (op_raw_compress.get_value() == "zlib" ||
-                     op_raw_compress.get_value() == "gzip")) {
-                data->zstream.next_in = (Bytef *)towrite_start;
-                data->zstream.avail_in = static_cast<uInt>(size);
-                int res;
-                do {
-                    data->zstream.next_out = (Bytef *)data->buf_compressed;
-                    data->zstream.avail_out = static_cast<uInt>(max_buf_size);
-                    res = deflate(&data->zstream, Z_NO_FLUSH);
-                    NOTIFY(3, "deflate => %d in=%d out=%d => in=%d, out=%d, write=%d\n",
-                           res, size, size, data->zstream.avail_in,
-                           data->zstream.avail_out,
-                           max_buf_size - data->zstream.avail_out);
-                    DR_ASSERT(res != Z_STREAM_ERROR);
-                    wrote =
-                        file_ops_func.write_file(data->file, data->buf_compressed,
-                                                 max_buf_size - data->zstream.avail_out);
-                } while (data->zstream.avail_out == 0);
-                DR_ASSERT(data->zstream.avail_in == 0);
-                wrote = size;
-            } else
-#endif
-#ifdef HAS_LZ4
-                if (op_offline.get_value() && op_raw_compress.get_value() == "lz4") {
-                size_t res =
-                    LZ4F_compressUpdate(data->lzcxt, data->buf_lz4, data->buf_lz4_size,
-                                        towrite_start, size, nullptr);
-                DR_ASSERT(!LZ4F_isError(res));
-                wrote = file_ops_func.write_file(data->file, data->buf_lz4, res);
-                DR_ASSERT(static_cast<size_t>(wrote) == res);
-                wrote = size;
-            } else
-#endif
-                wrote = file_ops_func.write_file(data->file, towrite_start, size);
+            ssize_t wrote = compress_and_write(data, towrite_start, size);
             if (wrote < size) {
                 FATAL("Fatal error: failed to write trace for T%d window %zd: wrote %zd "
                       "of %zd\n",
@@ -684,6 +934,7 @@ create_buffer(per_thread_t *data)
     /* dr_raw_mem_alloc guarantees to give us zeroed memory, so no need for a memset */
     /* set sentinel (non-zero) value in redzone */
     memset(data->buf_base + trace_buf_size, -1, redzone_size);
+    data->writer_buf = data->buf_base;
     data->num_buffers++;
     if (data->num_buffers == 2) {
         /* Create a "reserve" buffer so we can continue after hitting OOM later.
@@ -1153,6 +1404,9 @@ process_and_output_buffer(void *drcontext, bool skip_size_cap)
         }
         set_local_mode(data, mode);
     }
+    // If the buffer is handed off to a -raw_writer_threads thread, that thread
+    // clears it, and we receive a clean one.
+    byte *buf_base_before_output = data->buf_base;
     // When -L0_filter_until_instrs is used with -max_trace_size/-max_global_trace_refs,
     // the max size/refs limit applies to the full trace and not the filtered trace so we
     // can skip the check in filter mode.
@@ -1238,7 +1492,7 @@ process_and_output_buffer(void *drcontext, bool skip_size_cap)
             output_buffer(drcontext, data, data->buf_base + skip, buf_ptr, header_size);
     }
 
-    if (file_ops_func.handoff_buf == NULL) {
+    if (file_ops_func.handoff_buf == NULL && data->buf_base == buf_base_before_output) {
         // Our instrumentation reads from buffer and skips the clean call if the
         // content is 0, so we need set zero in the trace buffer and set non-zero
         // in redzone.
@@ -1297,6 +1551,8 @@ init_thread_io(void *drcontext)
     byte *proc_info;
 
     NOTIFY(2, "T" TIDFMT " in init_thread_io.\n", dr_get_thread_id(drcontext));
+    if (op_offline.get_value())
+        init_thread_writer(data);
 #ifdef HAS_ZLIB
     if (op_offline.get_value() &&
         (op_raw_compress.get_value() == "zlib" ||
@@ -1419,6 +1675,8 @@ exit_thread_io(void *drcontext)
     }
     if (op_offline.get_value() && data->file != INVALID_FILE)
         close_thread_file(drcontext);
+    if (op_offline.get_value())
+        exit_thread_writer(data);
 
 #ifdef HAS_ZLIB
     if (op_offline.get_value() &&
@@ -1479,12 +1737,51 @@ init_io()
 #endif
 
     DR_ASSERT(cur_window_instr_count.is_lock_free());
+
+    if (op_offline.get_value() && op_raw_writer_threads.get_value() > 0 &&
+        file_ops_func.handoff_buf == NULL && writers == nullptr) {
+        num_writers = op_raw_writer_threads.get_value();
+        writers =
+            static_cast<writer_t *>(dr_global_alloc(num_writers * sizeof(*writers)));
+        start_writers();
+    }
+}
+
+#ifdef UNIX
+void
+fork_init_io()
+{
+    if (writers == nullptr)
+        return;
+    // The child has none of the writer threads, and any of their locks may have
+    // been held at the fork.  The queued writes are the parent's to perform, so
+    // we simply leak them.
+    start_writers();
 }
+#endif
 
 void
 exit_io()
 {
     notify_beyond_global_max_once = 0;
+    if (writers != nullptr) {
+        for (uint i = 0; i < num_writers; ++i) {
+            writer_t *writer = &writers[i];
+            dr_mutex_lock(writer->lock);
+            writer->exiting = true;
+            dr_event_signal(writer->work_event);
+            dr_mutex_unlock(writer->lock);
+            dr_event_wait(writer->exited_event);
+            // All threads have drained their writes in exit_thread_io().
+            DR_ASSERT(writer->head == nullptr);
+            dr_mutex_destroy(writer->lock);
+            dr_event_destroy(writer->work_event);
+            dr_event_destroy(writer->exited_event);
+        }
+        dr_global_free(writers, num_writers * sizeof(*writers));
+        writers = nullptr;
+        num_writers = 0;
+    }
 }
 
 } // namespace drmemtrace
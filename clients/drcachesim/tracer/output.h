@@ -64,6 +64,12 @@ init_io();
 void
 exit_io();
 
+#ifdef UNIX
+// Restarts the -raw_writer_threads in a fork child.
+void
+fork_init_io();
+#endif
+
 // Returns true for an empty new (non-initial) buffer for a tracing window
 // with no instructions traced yet in the window.
 inline bool
@@ -36,6 +36,7 @@
 
 #define NOMINMAX // Avoid windows.h messing up std::min.
 #include "archive_ostream.h"
+#include "decode_cache_file.h"
 #include "dr_api.h"
 #include "drcovlib.h"
 #include "raw2trace.h"
@@ -63,8 +64,11 @@
 #include <cstring>
 #include <deque>
 #include <iomanip>
+#include <istream>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <streambuf>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -1260,6 +1264,29 @@ raw2trace_t::process_syscall_pt(raw2trace_thread_data_t *tdata, uint64_t syscall
 }
 #endif
 
+bool
+raw2trace_t::process_thread_start(raw2trace_thread_data_t *tdata,
+                                  const offline_entry_t *in_entry)
+{
+    // We look for the initial header here rather than the top of
+    // process_thread_file() to support use cases where buffers are passed from
+    // another source.
+    tdata->saw_header = trace_metadata_reader_t::is_thread_start(
+        in_entry, &tdata->error, &tdata->version, &tdata->file_type);
+    VPRINT(2, "Trace file version is %d; type is %d\n", tdata->version,
+           tdata->file_type);
+    if (!tdata->error.empty())
+        return false;
+    // We do not complain if tdata->version >= OFFLINE_FILE_VERSION_ENCODINGS
+    // and encoding_file_ == INVALID_FILE since we have several tests with
+    // that setup.  We do complain during processing about unknown instructions.
+    if (tdata->saw_header) {
+        if (!process_header(tdata))
+            return false;
+    }
+    return true;
+}
+
 bool
 raw2trace_t::process_next_thread_buffer(raw2trace_thread_data_t *tdata,
                                         DR_PARAM_OUT bool *end_of_record)
@@ -1268,111 +1295,108 @@ raw2trace_t::process_next_thread_buffer(raw2trace_thread_data_t *tdata,
     // We fill in instr entries and memref type and size.
     const offline_entry_t *in_entry = get_next_entry(tdata);
     if (!tdata->saw_header) {
-        // We look for the initial header here rather than the top of
-        // process_thread_file() to support use cases where buffers are passed from
-        // another source.
-        tdata->saw_header = trace_metadata_reader_t::is_thread_start(
-            in_entry, &tdata->error, &tdata->version, &tdata->file_type);
-        VPRINT(2, "Trace file version is %d; type is %d\n", tdata->version,
-               tdata->file_type);
-        if (!tdata->error.empty())
+        if (!process_thread_start(tdata, in_entry))
             return false;
-        // We do not complain if tdata->version >= OFFLINE_FILE_VERSION_ENCODINGS
-        // and encoding_file_ == INVALID_FILE since we have several tests with
-        // that setup.  We do complain during processing about unknown instructions.
-        if (tdata->saw_header) {
-            if (!process_header(tdata))
-                return false;
-        }
         in_entry = get_next_entry(tdata);
     }
-    byte *buf_base = reinterpret_cast<byte *>(get_write_buffer(tdata));
     bool last_bb_handled = true;
     for (; in_entry != nullptr; in_entry = get_next_entry(tdata)) {
-        // Make a copy to avoid clobbering the entry we pass to process_offline_entry()
-        // when it calls get_next_entry() on its own.
-        offline_entry_t entry = *in_entry;
-        if (entry.timestamp.type == OFFLINE_TYPE_TIMESTAMP) {
-            VPRINT(2, "Thread %u timestamp 0x" ZHEX64_FORMAT_STRING "\n",
-                   (uint)tdata->tid, (uint64)entry.timestamp.usec);
-            accumulate_to_statistic(tdata, RAW2TRACE_STAT_EARLIEST_TRACE_TIMESTAMP,
-                                    static_cast<uint64>(entry.timestamp.usec));
-            accumulate_to_statistic(tdata, RAW2TRACE_STAT_LATEST_TRACE_TIMESTAMP,
-                                    static_cast<uint64>(entry.timestamp.usec));
-            byte *buf = buf_base +
-                trace_metadata_writer_t::write_timestamp(buf_base,
-                                                         (uintptr_t)entry.timestamp.usec);
-            tdata->last_timestamp_ = entry.timestamp.usec;
-            if ((uint)(buf - buf_base) >= WRITE_BUFFER_SIZE) {
-                tdata->error = "Too many entries";
-                return false;
-            }
-            if (!write(tdata, reinterpret_cast<trace_entry_t *>(buf_base),
-                       reinterpret_cast<trace_entry_t *>(buf)))
-                return false;
-            continue;
+        if (!process_top_level_entry(tdata, in_entry, end_of_record, &last_bb_handled))
+            return false;
+    }
+    return true;
+}
+
+bool
+raw2trace_t::process_top_level_entry(raw2trace_thread_data_t *tdata,
+                                     const offline_entry_t *in_entry,
+                                     DR_PARAM_OUT bool *end_of_record,
+                                     DR_PARAM_INOUT bool *last_bb_handled)
+{
+    byte *buf_base = reinterpret_cast<byte *>(get_write_buffer(tdata));
+    // Make a copy to avoid clobbering the entry we pass to process_offline_entry()
+    // when it calls get_next_entry() on its own.
+    offline_entry_t entry = *in_entry;
+    if (entry.timestamp.type == OFFLINE_TYPE_TIMESTAMP) {
+        VPRINT(2, "Thread %u timestamp 0x" ZHEX64_FORMAT_STRING "\n", (uint)tdata->tid,
+               (uint64)entry.timestamp.usec);
+        accumulate_to_statistic(tdata, RAW2TRACE_STAT_EARLIEST_TRACE_TIMESTAMP,
+                                static_cast<uint64>(entry.timestamp.usec));
+        accumulate_to_statistic(tdata, RAW2TRACE_STAT_LATEST_TRACE_TIMESTAMP,
+                                static_cast<uint64>(entry.timestamp.usec));
+        byte *buf = buf_base +
+            trace_metadata_writer_t::write_timestamp(buf_base,
+                                                     (uintptr_t)entry.timestamp.usec);
+        tdata->last_timestamp_ = entry.timestamp.usec;
+        if ((uint)(buf - buf_base) >= WRITE_BUFFER_SIZE) {
+            tdata->error = "Too many entries";
+            return false;
         }
+        return write(tdata, reinterpret_cast<trace_entry_t *>(buf_base),
+                     reinterpret_cast<trace_entry_t *>(buf));
+    }
 #ifdef BUILD_PT_POST_PROCESSOR
-        if (entry.extended.type == OFFLINE_TYPE_EXTENDED &&
-            entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
-            entry.extended.valueB == TRACE_MARKER_TYPE_SYSCALL_IDX) {
-            if (!process_syscall_pt(tdata, entry.extended.valueA))
-                return false;
-            continue;
-        }
+    if (entry.extended.type == OFFLINE_TYPE_EXTENDED &&
+        entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
+        entry.extended.valueB == TRACE_MARKER_TYPE_SYSCALL_IDX) {
+        return process_syscall_pt(tdata, entry.extended.valueA);
+    }
 #endif
-        // Append delayed branches at the end or before xfer or window-change
-        // markers; else, delay until we see a non-cti inside a block, to handle
-        // double branches (i#5141) and to group all (non-xfer) markers with a new
-        // timestamp.
-        if (entry.extended.type == OFFLINE_TYPE_EXTENDED &&
-            (entry.extended.ext == OFFLINE_EXT_TYPE_FOOTER ||
-             (entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
-              (entry.extended.valueB == TRACE_MARKER_TYPE_KERNEL_EVENT ||
-               entry.extended.valueB == TRACE_MARKER_TYPE_KERNEL_XFER ||
-               (entry.extended.valueB == TRACE_MARKER_TYPE_WINDOW_ID &&
-                entry.extended.valueA != tdata->last_window))))) {
-            app_pc next_pc = nullptr;
-            // Get the next instr's pc from the interruption value in the marker
-            // (a record for the next instr itself won't appear until the signal
-            // returns, if that happens).
-            if (entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
-                entry.extended.valueB == TRACE_MARKER_TYPE_KERNEL_EVENT) {
-                uintptr_t marker_val = 0;
-                if (!get_marker_value(tdata, &in_entry, &marker_val))
-                    return false;
-                next_pc = reinterpret_cast<app_pc>(marker_val);
-                // Restore in case it was a two-record value.
-                unread_last_entry(tdata);
-                in_entry = get_next_entry(tdata);
-                entry = *in_entry;
-            } // Else we will delete the final branch in append_delayed_branch().
-            if (!append_delayed_branch(tdata, next_pc))
-                return false;
-        }
+    // Append delayed branches at the end or before xfer or window-change
+    // markers; else, delay until we see a non-cti inside a block, to handle
+    // double branches (i#5141) and to group all (non-xfer) markers with a new
+    // timestamp.
+    if (entry.extended.type == OFFLINE_TYPE_EXTENDED &&
+        (entry.extended.ext == OFFLINE_EXT_TYPE_FOOTER ||
+         (entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
+          (entry.extended.valueB == TRACE_MARKER_TYPE_KERNEL_EVENT ||
+           entry.extended.valueB == TRACE_MARKER_TYPE_KERNEL_XFER ||
+           (entry.extended.valueB == TRACE_MARKER_TYPE_WINDOW_ID &&
+            entry.extended.valueA != tdata->last_window))))) {
+        app_pc next_pc = nullptr;
+        // Get the next instr's pc from the interruption value in the marker
+        // (a record for the next instr itself won't appear until the signal
+        // returns, if that happens).
         if (entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
-            entry.extended.valueB == TRACE_MARKER_TYPE_WINDOW_ID)
-            tdata->last_window = entry.extended.valueA;
-        bool flush_decode_cache = false;
-        bool success = process_offline_entry(tdata, &entry, tdata->tid, end_of_record,
-                                             &last_bb_handled, &flush_decode_cache);
-        if (flush_decode_cache)
-            decode_cache_[tdata->worker].clear();
-        if (!success)
+            entry.extended.valueB == TRACE_MARKER_TYPE_KERNEL_EVENT) {
+            uintptr_t marker_val = 0;
+            if (!get_marker_value(tdata, &in_entry, &marker_val))
+                return false;
+            next_pc = reinterpret_cast<app_pc>(marker_val);
+            // Restore in case it was a two-record value.
+            unread_last_entry(tdata);
+            in_entry = get_next_entry(tdata);
+            entry = *in_entry;
+        } // Else we will delete the final branch in append_delayed_branch().
+        if (!append_delayed_branch(tdata, next_pc))
             return false;
     }
-    return true;
+    if (entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
+        entry.extended.valueB == TRACE_MARKER_TYPE_WINDOW_ID)
+        tdata->last_window = entry.extended.valueA;
+    bool flush_decode_cache = false;
+    bool success = process_offline_entry(tdata, &entry, tdata->tid, end_of_record,
+                                         last_bb_handled, &flush_decode_cache);
+    if (flush_decode_cache)
+        decode_cache_[tdata->worker].clear();
+    return success;
 }
 
 bool
 raw2trace_t::process_thread_file(raw2trace_thread_data_t *tdata)
 {
     bool end_of_file = false;
+    bool try_segments = thread_segment_size_ > 0;
     while (!end_of_file) {
         VPRINT(4, "About to read thread #%d==%d at pos %d\n", tdata->index,
                (uint)tdata->tid, (int)tdata->thread_file->tellg());
-        if (!process_next_thread_buffer(tdata, &end_of_file) ||
-            (!end_of_file && thread_file_at_eof(tdata))) {
+        bool success;
+        if (try_segments) {
+            try_segments = false;
+            success = process_thread_segments(tdata, &end_of_file);
+        } else
+            success = process_next_thread_buffer(tdata, &end_of_file);
+        if (!success || (!end_of_file && thread_file_at_eof(tdata))) {
             if (thread_file_at_eof(tdata)) {
                 // Rather than a fatal error we try to continue to provide partial
                 // results in case the disk was full or there was some other issue.
@@ -1405,6 +1429,650 @@ raw2trace_t::process_thread_file(raw2trace_thread_data_t *tdata)
     return true;
 }
 
+namespace {
+
+// Presents the given ranges of entries, followed by an optional stream, as a single
+// stream of offline_entry_t, so that a thread's raw file can be converted from an
+// arbitrary segment boundary.
+class segment_streambuf_t : public std::streambuf {
+public:
+    explicit segment_streambuf_t(std::istream *fallback = nullptr)
+        : fallback_(fallback)
+    {
+    }
+    void
+    add_range(const std::vector<offline_entry_t> &entries, size_t start)
+    {
+        if (start < entries.size())
+            ranges_.emplace_back(&entries, start);
+    }
+    // Returns the number of entries handed out so far.
+    uint64
+    delivered() const
+    {
+        return delivered_ + (gptr() - eback()) / sizeof(offline_entry_t);
+    }
+
+protected:
+    int_type
+    underflow() override
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        delivered_ += (egptr() - eback()) / sizeof(offline_entry_t);
+        char *data;
+        std::streamsize size;
+        if (next_range_ < ranges_.size()) {
+            const auto &range = ranges_[next_range_++];
+            data = reinterpret_cast<char *>(
+                const_cast<offline_entry_t *>(range.first->data() + range.second));
+            size = (range.first->size() - range.second) * sizeof(offline_entry_t);
+        } else if (fallback_ != nullptr) {
+            // We only read one entry at a time to not take from the underlying
+            // stream anything our caller will not consume.
+            data = reinterpret_cast<char *>(&fallback_entry_);
+            fallback_->read(data, sizeof(fallback_entry_));
+            size = fallback_->gcount();
+        } else
+            size = 0;
+        if (size == 0) {
+            setg(nullptr, nullptr, nullptr);
+            return traits_type::eof();
+        }
+        setg(data, data, data + size);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::vector<std::pair<const std::vector<offline_entry_t> *, size_t>> ranges_;
+    size_t next_range_ = 0;
+    std::istream *fallback_;
+    offline_entry_t fallback_entry_;
+    uint64 delivered_ = 0;
+};
+
+// Returns whether converting "entry" involves state we do not carry across segment
+// boundaries, in which case the rest of the thread is converted serially.
+bool
+entry_needs_serial_conversion(const offline_entry_t &entry)
+{
+    if (entry.extended.type != OFFLINE_TYPE_EXTENDED)
+        return false;
+    // The footer calls on_thread_end(), which subclasses may override.
+    if (entry.extended.ext == OFFLINE_EXT_TYPE_FOOTER)
+        return true;
+    if (entry.extended.ext != OFFLINE_EXT_TYPE_MARKER)
+        return false;
+    switch (entry.extended.valueB) {
+    case TRACE_MARKER_TYPE_RSEQ_ENTRY:
+    case TRACE_MARKER_TYPE_RSEQ_ABORT:
+    case TRACE_MARKER_TYPE_FILTER_ENDPOINT:
+    case TRACE_MARKER_TYPE_VECTOR_LENGTH:
+    case TRACE_MARKER_TYPE_SYSCALL_IDX: return true;
+    default: return false;
+    }
+}
+
+bool
+delayed_branches_match(const std::vector<trace_entry_t> &a,
+                       const std::vector<trace_entry_t> &b)
+{
+    // Which encodings are present depends on what was converted before, which
+    // redecide_encodings() accounts for.
+    auto a_it = a.begin(), b_it = b.begin();
+    while (true) {
+        while (a_it != a.end() && a_it->type == TRACE_TYPE_ENCODING)
+            ++a_it;
+        while (b_it != b.end() && b_it->type == TRACE_TYPE_ENCODING)
+            ++b_it;
+        if (a_it == a.end() || b_it == b.end())
+            return a_it == a.end() && b_it == b.end();
+        if (a_it->type != b_it->type || a_it->size != b_it->size ||
+            a_it->addr != b_it->addr)
+            return false;
+        ++a_it;
+        ++b_it;
+    }
+}
+
+} // namespace
+
+// A run of a traced thread's raw entries which one worker converts speculatively,
+// starting from an empty conversion state, while the thread's own worker converts
+// the runs before it.  The thread's worker then converts the start of the run
+// itself until its state matches one recorded by the speculative conversion and
+// replays the speculative output from there on.
+struct raw2trace_t::thread_segment_t {
+    // The state which, besides the encodings emitted so far, determines the
+    // conversion of the entries that follow.
+    struct state_t {
+        // The number of entries of the segment consumed.
+        uint64 consumed = 0;
+        // The number of write() calls made.
+        size_t write_count = 0;
+        std::vector<trace_entry_t> delayed_branch;
+        std::vector<app_pc> delayed_branch_decode_pcs;
+        std::vector<app_pc> delayed_branch_target_pcs;
+        bool prev_instr_was_rep_string = false;
+        app_pc last_pc_if_syscall = nullptr;
+        uint64 last_window = 0;
+        uint64 count_elided = 0;
+        uint64 count_duplicate_syscall = 0;
+        uint64 count_false_syscall = 0;
+
+        void
+        save(const raw2trace_thread_data_t *tdata, uint64 consumed_in, size_t writes)
+        {
+            consumed = consumed_in;
+            write_count = writes;
+            delayed_branch = tdata->delayed_branch;
+            delayed_branch_decode_pcs = tdata->delayed_branch_decode_pcs;
+            delayed_branch_target_pcs = tdata->delayed_branch_target_pcs;
+            prev_instr_was_rep_string = tdata->prev_instr_was_rep_string;
+            last_pc_if_syscall = tdata->last_pc_if_syscall_;
+            last_window = tdata->last_window;
+            count_elided = tdata->count_elided;
+            count_duplicate_syscall = tdata->count_duplicate_syscall;
+            count_false_syscall = tdata->count_false_syscall;
+        }
+        bool
+        matches(const raw2trace_thread_data_t *tdata) const
+        {
+            return prev_instr_was_rep_string == tdata->prev_instr_was_rep_string &&
+                last_pc_if_syscall == tdata->last_pc_if_syscall_ &&
+                last_window == tdata->last_window &&
+                delayed_branch_decode_pcs == tdata->delayed_branch_decode_pcs &&
+                delayed_branch_target_pcs == tdata->delayed_branch_target_pcs &&
+                delayed_branches_match(delayed_branch, tdata->delayed_branch);
+        }
+    };
+
+    // Input, set up before the segment is dispatched.
+    raw2trace_thread_data_t *thread = nullptr;
+    std::vector<offline_entry_t> entries;
+    // Whether the segment holds an entry for which
+    // entry_needs_serial_conversion() is true.
+    bool serial = false;
+    bool dispatched = false;
+    // The window id in effect at the start of the segment, as far as we can tell
+    // without converting.
+    uint64 start_window = 0;
+    // The final record of the segment may continue into the next one.  We drop this
+    // once converted.
+    std::shared_ptr<thread_segment_t> next;
+
+    // Output, valid once "done" is set under segment_mutex_.
+    bool done = false;
+    bool failed = false;
+    // The records and decode pcs passed to write(), with the ends of each call's
+    // range in "writes".
+    std::vector<trace_entry_t> records;
+    std::vector<app_pc> decode_pcs;
+    std::vector<std::pair<size_t, size_t>> writes;
+    // The state prior to each of the first top-level entries.
+    std::vector<state_t> checkpoints;
+    // The position and value of each top-level timestamp.
+    std::vector<std::pair<uint64, uint64>> timestamps;
+    state_t end;
+};
+
+bool
+raw2trace_t::thread_can_be_segmented(raw2trace_thread_data_t *tdata)
+{
+    // Filtered traces change how blocks are decoded partway through, and kernel
+    // traces and syscall templates carry per-thread state we do not replicate.
+    return tdata->version >= OFFLINE_FILE_VERSION_ENCODINGS &&
+        !TESTANY(OFFLINE_FILE_TYPE_FILTERED | OFFLINE_FILE_TYPE_IFILTERED |
+                     OFFLINE_FILE_TYPE_DFILTERED |
+                     OFFLINE_FILE_TYPE_BIMODAL_FILTERED_WARMUP |
+                     OFFLINE_FILE_TYPE_KERNEL_SYSCALLS |
+                     OFFLINE_FILE_TYPE_KERNEL_SYSCALL_INSTR_ONLY,
+                 tdata->file_type) &&
+        syscall_template_file_reader_ == nullptr;
+}
+
+bool
+raw2trace_t::process_thread_segments(raw2trace_thread_data_t *tdata,
+                                     DR_PARAM_OUT bool *end_of_file)
+{
+    if (thread_segment_size_ == 0 || worker_count_ < 2 || tdata->saw_header)
+        return true;
+    const offline_entry_t *in_entry = get_next_entry(tdata);
+    if (in_entry == nullptr)
+        return true;
+    if (!process_thread_start(tdata, in_entry))
+        return false;
+    if (!tdata->saw_header) {
+        // Let process_next_thread_buffer() handle the unexpected start.
+        unread_last_entry(tdata);
+        return true;
+    }
+    if (!thread_can_be_segmented(tdata))
+        return true;
+    std::vector<offline_entry_t> carry(tdata->pre_read.begin(), tdata->pre_read.end());
+    tdata->pre_read.clear();
+    // We bound how far we read ahead of the segment we are stitching.
+    const size_t max_window = static_cast<size_t>(worker_count_) + 1;
+    std::deque<std::shared_ptr<thread_segment_t>> window;
+    uint64 window_id = tdata->last_window;
+    uint64 skip = 0;
+    bool input_done = false;
+    bool success = true;
+    while (true) {
+        while (!input_done && window.size() < max_window) {
+            auto segment = std::make_shared<thread_segment_t>();
+            read_thread_segment(tdata, carry, segment.get(), &window_id, &input_done);
+            if (segment->entries.empty())
+                break;
+            if (!window.empty() && !window.back()->serial &&
+                !window.back()->dispatched)
+                dispatch_thread_segment(window.back(), segment);
+            window.push_back(segment);
+        }
+        if (input_done && !window.empty() && !window.back()->serial &&
+            !window.back()->dispatched)
+            dispatch_thread_segment(window.back(), nullptr);
+        if (window.empty() || window.front()->serial)
+            break;
+        wait_for_thread_segment(tdata, window.front().get());
+        success = stitch_thread_segment(tdata, window, carry, &skip, end_of_file);
+        if (!success || *end_of_file)
+            break;
+    }
+    // Hand what is left to the serial conversion.
+    for (size_t i = 0; i < window.size(); ++i) {
+        const std::vector<offline_entry_t> &entries = window[i]->entries;
+        tdata->pre_read.insert(tdata->pre_read.end(),
+                               entries.begin() + (i == 0 ? skip : 0), entries.end());
+    }
+    tdata->pre_read.insert(tdata->pre_read.end(), carry.begin(), carry.end());
+    return success;
+}
+
+void
+raw2trace_t::read_thread_segment(raw2trace_thread_data_t *tdata,
+                                 std::vector<offline_entry_t> &carry,
+                                 thread_segment_t *segment,
+                                 DR_PARAM_INOUT uint64 *window,
+                                 DR_PARAM_OUT bool *input_done)
+{
+    static const size_t kReadEntries = 4096;
+    const size_t target = std::max<size_t>(
+        static_cast<size_t>(thread_segment_size_ / sizeof(offline_entry_t)), 1);
+    std::vector<offline_entry_t> &entries = segment->entries;
+    entries.swap(carry);
+    carry.clear();
+    segment->thread = tdata;
+    segment->start_window = *window;
+    size_t scanned = 0;
+    bool at_end = false;
+    while (true) {
+        for (; scanned < entries.size(); ++scanned) {
+            const offline_entry_t &entry = entries[scanned];
+            // Every buffer starts with a timestamp, so these are where a fresh
+            // conversion state is most likely to match the real one soonest.
+            if (scanned >= target && entry.timestamp.type == OFFLINE_TYPE_TIMESTAMP) {
+                carry.assign(entries.begin() + scanned, entries.end());
+                entries.resize(scanned);
+                return;
+            }
+            if (entry_needs_serial_conversion(entry)) {
+                segment->serial = true;
+                *input_done = true;
+                return;
+            }
+            if (entry.extended.type == OFFLINE_TYPE_EXTENDED &&
+                entry.extended.ext == OFFLINE_EXT_TYPE_MARKER &&
+                entry.extended.valueB == TRACE_MARKER_TYPE_WINDOW_ID)
+                *window = entry.extended.valueA;
+        }
+        if (at_end) {
+            *input_done = true;
+            return;
+        }
+        size_t count = scanned < target ? target - scanned : kReadEntries;
+        entries.resize(scanned + count);
+        tdata->thread_file->read(reinterpret_cast<char *>(entries.data() + scanned),
+                                 count * sizeof(offline_entry_t));
+        // Like get_next_entry(), we drop any truncated final entry.
+        size_t got =
+            static_cast<size_t>(tdata->thread_file->gcount()) / sizeof(offline_entry_t);
+        entries.resize(scanned + got);
+        at_end = got < count;
+    }
+}
+
+void
+raw2trace_t::dispatch_thread_segment(std::shared_ptr<thread_segment_t> segment,
+                                     std::shared_ptr<thread_segment_t> next)
+{
+    segment->next = std::move(next);
+    segment->dispatched = true;
+    {
+        std::lock_guard<std::mutex> guard(segment_mutex_);
+        segment_queue_.push_back(std::move(segment));
+    }
+    segment_cond_.notify_all();
+}
+
+void
+raw2trace_t::convert_thread_segment(thread_segment_t *segment, int worker)
+{
+    // We convert on a scratch copy of the thread's data which write()s into the
+    // segment rather than the output file.
+    raw2trace_thread_data_t tdata;
+    const raw2trace_thread_data_t *thread = segment->thread;
+    tdata.index = thread->index;
+    tdata.tid = thread->tid;
+    tdata.worker = worker;
+    tdata.version = thread->version;
+    tdata.file_type = thread->file_type;
+    tdata.cache_line_size = thread->cache_line_size;
+    tdata.rseq_want_rollback_ = thread->rseq_want_rollback_;
+    tdata.saw_header = true;
+    tdata.last_window = segment->start_window;
+    tdata.segment = segment;
+    segment_streambuf_t buf;
+    buf.add_range(segment->entries, 0);
+    if (segment->next != nullptr)
+        buf.add_range(segment->next->entries, 0);
+    std::istream stream(&buf);
+    tdata.thread_file = &stream;
+    bool end_of_record = false;
+    bool last_bb_handled = true;
+    uint64 consumed = 0;
+    while (!end_of_record) {
+        consumed = buf.delivered() - tdata.pre_read.size();
+        if (consumed >= segment->entries.size())
+            break;
+        if (tdata.pre_read.empty() &&
+            segment->checkpoints.size() < static_cast<size_t>(kMaxSegmentCheckpoints)) {
+            segment->checkpoints.emplace_back();
+            segment->checkpoints.back().save(&tdata, consumed, segment->writes.size());
+        }
+        const offline_entry_t *in_entry = get_next_entry(&tdata);
+        if (in_entry == nullptr) {
+            segment->failed = segment->next != nullptr;
+            break;
+        }
+        if (in_entry->timestamp.type == OFFLINE_TYPE_TIMESTAMP)
+            segment->timestamps.emplace_back(consumed, in_entry->timestamp.usec);
+        if (!process_top_level_entry(&tdata, in_entry, &end_of_record,
+                                     &last_bb_handled)) {
+            VPRINT(2, "Speculative conversion of thread %d failed: %s\n", tdata.index,
+                   tdata.error.c_str());
+            segment->failed = true;
+            break;
+        }
+        consumed = buf.delivered() - tdata.pre_read.size();
+    }
+    if (!segment->failed && end_of_record) {
+        // Only the footer ends a record and we never hand it to a segment.
+        segment->failed = true;
+    }
+    segment->end.save(&tdata, consumed, segment->writes.size());
+    {
+        std::lock_guard<std::mutex> guard(segment_mutex_);
+        segment->next.reset();
+        segment->done = true;
+    }
+    segment_cond_.notify_all();
+}
+
+void
+raw2trace_t::wait_for_thread_segment(raw2trace_thread_data_t *tdata,
+                                     thread_segment_t *segment)
+{
+    std::unique_lock<std::mutex> lock(segment_mutex_);
+    while (!segment->done) {
+        if (segment_queue_.empty()) {
+            segment_cond_.wait(lock);
+            continue;
+        }
+        // Rather than idling we convert whatever is queued, which is most likely
+        // our own segments.
+        std::shared_ptr<thread_segment_t> queued = std::move(segment_queue_.front());
+        segment_queue_.pop_front();
+        lock.unlock();
+        convert_thread_segment(queued.get(), tdata->worker);
+        lock.lock();
+    }
+}
+
+void
+raw2trace_t::help_convert_thread_segments(int worker)
+{
+    std::unique_lock<std::mutex> lock(segment_mutex_);
+    --workers_with_tasks_;
+    segment_cond_.notify_all();
+    while (true) {
+        if (!segment_queue_.empty()) {
+            std::shared_ptr<thread_segment_t> queued =
+                std::move(segment_queue_.front());
+            segment_queue_.pop_front();
+            lock.unlock();
+            convert_thread_segment(queued.get(), worker);
+            lock.lock();
+        } else if (workers_with_tasks_ == 0)
+            return;
+        else
+            segment_cond_.wait(lock);
+    }
+}
+
+bool
+raw2trace_t::stitch_thread_segment(raw2trace_thread_data_t *tdata,
+                                   std::deque<std::shared_ptr<thread_segment_t>> &window,
+                                   std::vector<offline_entry_t> &carry,
+                                   DR_PARAM_INOUT uint64 *skip,
+                                   DR_PARAM_OUT bool *end_of_record)
+{
+    thread_segment_t *segment = window.front().get();
+    DEBUG_ASSERT(segment->done && tdata->pre_read.empty());
+    // We read exactly what a serial conversion would, from the window on into the
+    // file.
+    segment_streambuf_t buf(tdata->thread_file);
+    uint64 buffered = 0;
+    for (size_t i = 0; i < window.size(); ++i) {
+        size_t start = i == 0 ? static_cast<size_t>(*skip) : 0;
+        buf.add_range(window[i]->entries, start);
+        buffered += window[i]->entries.size() - start;
+    }
+    buf.add_range(carry, 0);
+    buffered += carry.size();
+    std::istream stream(&buf);
+    std::istream *file = tdata->thread_file;
+    tdata->thread_file = &stream;
+    bool success = true;
+    bool last_bb_handled = true;
+    const thread_segment_t::state_t *match = nullptr;
+    size_t checkpoint = 0;
+    uint64 consumed = *skip;
+    while (!*end_of_record) {
+        consumed = *skip + buf.delivered() - tdata->pre_read.size();
+        if (consumed >= segment->entries.size())
+            break;
+        if (!segment->failed) {
+            while (checkpoint < segment->checkpoints.size() &&
+                   segment->checkpoints[checkpoint].consumed < consumed)
+                ++checkpoint;
+            if (checkpoint < segment->checkpoints.size() &&
+                segment->checkpoints[checkpoint].consumed == consumed &&
+                tdata->pre_read.empty() &&
+                segment->checkpoints[checkpoint].matches(tdata)) {
+                match = &segment->checkpoints[checkpoint];
+                break;
+            }
+        }
+        const offline_entry_t *in_entry = get_next_entry(tdata);
+        if (in_entry == nullptr)
+            break;
+        if (!process_top_level_entry(tdata, in_entry, end_of_record,
+                                     &last_bb_handled)) {
+            success = false;
+            break;
+        }
+    }
+    consumed = *skip + buf.delivered() - tdata->pre_read.size();
+    tdata->thread_file = file;
+    // Entries the stream took from the file are no longer there for the window.
+    std::vector<offline_entry_t> from_file;
+    uint64 delivered = buf.delivered();
+    if (delivered > buffered) {
+        size_t count = std::min<size_t>(tdata->pre_read.size(),
+                                        static_cast<size_t>(delivered - buffered));
+        from_file.assign(tdata->pre_read.end() - count, tdata->pre_read.end());
+    }
+    if (match != nullptr) {
+        VPRINT(3, "Thread %d segment matched at entry " UINT64_FORMAT_STRING "\n",
+               tdata->index, match->consumed);
+        forget_delayed_encodings(tdata);
+        if (!replay_thread_segment(tdata, segment, match->write_count))
+            success = false;
+        tdata->count_elided += segment->end.count_elided - match->count_elided;
+        tdata->count_duplicate_syscall +=
+            segment->end.count_duplicate_syscall - match->count_duplicate_syscall;
+        tdata->count_false_syscall +=
+            segment->end.count_false_syscall - match->count_false_syscall;
+        for (const auto &timestamp : segment->timestamps) {
+            if (timestamp.first < match->consumed)
+                continue;
+            accumulate_to_statistic(tdata, RAW2TRACE_STAT_EARLIEST_TRACE_TIMESTAMP,
+                                    timestamp.second);
+            accumulate_to_statistic(tdata, RAW2TRACE_STAT_LATEST_TRACE_TIMESTAMP,
+                                    timestamp.second);
+            tdata->last_timestamp_ = timestamp.second;
+        }
+        const thread_segment_t::state_t &end = segment->end;
+        std::vector<trace_entry_t> delayed;
+        if (success &&
+            !redecide_encodings(tdata, end.delayed_branch.data(),
+                                end.delayed_branch.data() + end.delayed_branch.size(),
+                                end.delayed_branch_decode_pcs.data(),
+                                end.delayed_branch_decode_pcs.size(), delayed))
+            success = false;
+        tdata->delayed_branch.swap(delayed);
+        tdata->delayed_branch_empty_ = tdata->delayed_branch.empty();
+        tdata->delayed_branch_decode_pcs = end.delayed_branch_decode_pcs;
+        tdata->delayed_branch_target_pcs = end.delayed_branch_target_pcs;
+        tdata->prev_instr_was_rep_string = end.prev_instr_was_rep_string;
+        tdata->last_pc_if_syscall_ = end.last_pc_if_syscall;
+        tdata->last_window = end.last_window;
+        consumed = end.consumed;
+    } else
+        VPRINT(3, "Thread %d segment did not match\n", tdata->index);
+    tdata->pre_read.clear();
+    // Drop what was consumed from the window.
+    if (consumed - *skip >= buffered) {
+        window.clear();
+        carry.swap(from_file);
+        *skip = 0;
+        return success;
+    }
+    *skip = consumed;
+    while (!window.empty() && *skip >= window.front()->entries.size()) {
+        *skip -= window.front()->entries.size();
+        window.pop_front();
+    }
+    if (window.empty()) {
+        carry.erase(carry.begin(), carry.begin() + static_cast<size_t>(*skip));
+        *skip = 0;
+    }
+    carry.insert(carry.end(), from_file.begin(), from_file.end());
+    return success;
+}
+
+bool
+raw2trace_t::replay_thread_segment(raw2trace_thread_data_t *tdata,
+                                   thread_segment_t *segment, size_t first_write)
+{
+    std::vector<trace_entry_t> records;
+    for (size_t i = first_write; i < segment->writes.size(); ++i) {
+        size_t records_start = i == 0 ? 0 : segment->writes[i - 1].first;
+        size_t pcs_start = i == 0 ? 0 : segment->writes[i - 1].second;
+        size_t pcs_count = segment->writes[i].second - pcs_start;
+        app_pc *decode_pcs =
+            pcs_count == 0 ? nullptr : segment->decode_pcs.data() + pcs_start;
+        if (!redecide_encodings(tdata, segment->records.data() + records_start,
+                                segment->records.data() + segment->writes[i].first,
+                                decode_pcs, pcs_count, records) ||
+            !write(tdata, records.data(), records.data() + records.size(), decode_pcs,
+                   pcs_count))
+            return false;
+    }
+    return true;
+}
+
+bool
+raw2trace_t::redecide_encodings(raw2trace_thread_data_t *tdata,
+                                const trace_entry_t *start, const trace_entry_t *end,
+                                const app_pc *decode_pcs, size_t decode_pcs_size,
+                                std::vector<trace_entry_t> &out)
+{
+    out.clear();
+    // Encodings precede their instruction, with only an indirect branch target
+    // marker possibly in between.
+    size_t encoding_pos = 0;
+    int instr_ordinal = -1;
+    for (const trace_entry_t *it = start; it < end; ++it) {
+        if (!type_is_instr(static_cast<trace_type_t>(it->type))) {
+            out.push_back(*it);
+            if (it->type != TRACE_TYPE_ENCODING &&
+                (it->type != TRACE_TYPE_MARKER ||
+                 it->size != TRACE_MARKER_TYPE_BRANCH_TARGET))
+                encoding_pos = out.size();
+            continue;
+        }
+        ++instr_ordinal;
+        if (it->size > 0 && static_cast<size_t>(instr_ordinal) < decode_pcs_size) {
+            bool want = record_encoding_emitted(tdata, decode_pcs[instr_ordinal]);
+            bool have = encoding_pos < out.size() &&
+                out[encoding_pos].type == TRACE_TYPE_ENCODING;
+            if (want && !have) {
+                trace_entry_t encodings[WRITE_BUFFER_SIZE];
+                trace_entry_t *buf = encodings;
+                if (!append_encoding(tdata, decode_pcs[instr_ordinal], it->size, buf,
+                                     encodings))
+                    return false;
+                out.insert(out.begin() + encoding_pos, encodings, buf);
+            } else if (!want && have) {
+                size_t encoding_end = encoding_pos;
+                while (encoding_end < out.size() &&
+                       out[encoding_end].type == TRACE_TYPE_ENCODING)
+                    ++encoding_end;
+                out.erase(out.begin() + encoding_pos, out.begin() + encoding_end);
+            }
+        }
+        out.push_back(*it);
+        encoding_pos = out.size();
+    }
+    return true;
+}
+
+void
+raw2trace_t::forget_delayed_encodings(raw2trace_thread_data_t *tdata)
+{
+    // The replayed output includes these instructions again.
+    int instr_ordinal = -1;
+    bool prev_was_encoding = false;
+    for (const trace_entry_t &entry : tdata->delayed_branch) {
+        if (type_is_instr(static_cast<trace_type_t>(entry.type))) {
+            ++instr_ordinal;
+            if (prev_was_encoding &&
+                static_cast<size_t>(instr_ordinal) <
+                    tdata->delayed_branch_decode_pcs.size()) {
+                tdata->encoding_emitted.erase(
+                    tdata->delayed_branch_decode_pcs[instr_ordinal]);
+            }
+        }
+        if (entry.type == TRACE_TYPE_ENCODING)
+            prev_was_encoding = true;
+        else if (entry.type != TRACE_TYPE_MARKER ||
+                 entry.size != TRACE_MARKER_TYPE_BRANCH_TARGET)
+            prev_was_encoding = false;
+    }
+}
+
 std::string
 raw2trace_t::check_thread_file(std::istream *f)
 {
@@ -1452,13 +2120,13 @@ raw2trace_t::check_kthread_file(std::istream *f)
 #endif
 
 void
-raw2trace_t::process_tasks(std::vector<raw2trace_thread_data_t *> *tasks)
+raw2trace_t::process_tasks(int worker)
 {
-    if (tasks->empty()) {
+    std::vector<raw2trace_thread_data_t *> *tasks = &worker_tasks_[worker];
+    if (tasks->empty())
         VPRINT(1, "Worker has no tasks\n");
-        return;
-    }
-    VPRINT(1, "Worker %d assigned %zd task(s)\n", (*tasks)[0]->worker, tasks->size());
+    else
+        VPRINT(1, "Worker %d assigned %zd task(s)\n", worker, tasks->size());
     for (raw2trace_thread_data_t *tdata : *tasks) {
         VPRINT(1, "Worker %d starting on trace thread %d\n", tdata->worker, tdata->index);
         if (!process_thread_file(tdata)) {
@@ -1468,11 +2136,51 @@ raw2trace_t::process_tasks(std::vector<raw2trace_thread_data_t *> *tasks)
         }
         VPRINT(1, "Worker %d finished trace thread %d\n", tdata->worker, tdata->index);
     }
+    // Other workers may still be splitting up their threads.
+    if (thread_segment_size_ > 0)
+        help_convert_thread_segments(worker);
 }
 
 // XXX i#6495: This assumes that all contents of the file can easily fit into memory.
 // With zipfile support we can potentially stream only the required component (the one
 // with the trace template we want) when needed in write_syscall_template().
+std::string
+raw2trace_t::read_decode_cache_file()
+{
+    if (decode_cache_file_path_.empty())
+        return "";
+    decode_cache_file_.reset(
+        new decode_cache_file_t(decode_cache_file_path_, verbosity_));
+    std::string error = decode_cache_file_->load();
+    if (!error.empty()) {
+        decode_cache_file_.reset();
+        return error;
+    }
+    decode_cache_file_module_keys_.clear();
+    for (const module_t &module : modvec_()) {
+        decode_cache_file_module_keys_.push_back(decode_cache_file_t::module_key(
+            module.path, module.seg_offs, module.seg_size));
+    }
+    return "";
+}
+
+std::string
+raw2trace_t::write_decode_cache_file()
+{
+    if (decode_cache_file_ == nullptr)
+        return "";
+    VPRINT(1, "Used " UINT64_FORMAT_STRING " of " UINT64_FORMAT_STRING
+              " block lookups from the decode cache file.\n",
+           decode_cache_file_->get_hits(),
+           decode_cache_file_->get_hits() + decode_cache_file_->get_misses());
+    std::string records;
+    for (std::string &worker_records : decode_cache_file_records_) {
+        records += worker_records;
+        std::string().swap(worker_records);
+    }
+    return decode_cache_file_->append(records);
+}
+
 std::string
 raw2trace_t::read_syscall_template_file()
 {
@@ -1535,6 +2243,9 @@ raw2trace_t::do_conversion()
     if (thread_data_.empty())
         return "No thread files found.";
     error = read_syscall_template_file();
+    if (!error.empty())
+        return error;
+    error = read_decode_cache_file();
     if (!error.empty())
         return error;
     // XXX i#3286: Add a %-completed progress message by looking at the file sizes.
@@ -1562,10 +2273,9 @@ raw2trace_t::do_conversion()
         std::vector<std::thread> threads;
         VPRINT(1, "Creating %d worker threads\n", worker_count_);
         threads.reserve(worker_count_);
-        for (int i = 0; i < worker_count_; ++i) {
-            threads.push_back(
-                std::thread(&raw2trace_t::process_tasks, this, &worker_tasks_[i]));
-        }
+        workers_with_tasks_ = worker_count_;
+        for (int i = 0; i < worker_count_; ++i)
+            threads.push_back(std::thread(&raw2trace_t::process_tasks, this, i));
         for (std::thread &thread : threads)
             thread.join();
         for (auto &tdata : thread_data_) {
@@ -1589,6 +2299,11 @@ raw2trace_t::do_conversion()
     error = aggregate_and_write_schedule_files();
     if (!error.empty())
         return error;
+    error = write_decode_cache_file();
+    if (!error.empty()) {
+        // The trace itself is complete, so we do not fail the conversion.
+        WARN("%s", error.c_str());
+    }
     VPRINT(1, "Omitted " UINT64_FORMAT_STRING " duplicate system calls.\n",
            count_duplicate_syscall_);
     VPRINT(1, "Omitted " UINT64_FORMAT_STRING " false system calls.\n",
@@ -1895,6 +2610,11 @@ raw2trace_t::append_bb_entries(raw2trace_thread_data_t *tdata,
         // OFFLINE_FILE_TYPE_IFILTERED.
         DR_ASSERT(instrs_are_separate);
     } else {
+        if (decode_cache_file_ != nullptr) {
+            load_block_from_decode_cache_file(tdata, in_entry->pc.modidx,
+                                              in_entry->pc.modoffs, start_pc,
+                                              instr_count);
+        }
         if (!instr_summary_exists(tdata, in_entry->pc.modidx, in_entry->pc.modoffs,
                                   start_pc, 0, decode_pc)) {
             if (!analyze_elidable_addresses(tdata, in_entry->pc.modidx,
@@ -2160,6 +2880,10 @@ raw2trace_t::append_bb_entries(raw2trace_thread_data_t *tdata,
         if (interrupted)
             break;
     }
+    if (decode_cache_file_ != nullptr && !skip_icache) {
+        save_block_to_decode_cache_file(tdata, in_entry->pc.modidx,
+                                        in_entry->pc.modoffs, start_pc);
+    }
     *handled = true;
     return true;
 }
@@ -2346,23 +3070,27 @@ raw2trace_t::should_omit_syscall(raw2trace_thread_data_t *tdata)
     // than this relatively simple solution.)
     const offline_entry_t *in_entry = get_next_entry(tdata);
     std::vector<offline_entry_t> saved;
-    while (in_entry->timestamp.type == OFFLINE_TYPE_TIMESTAMP ||
-           (in_entry->extended.type == OFFLINE_TYPE_EXTENDED &&
-            in_entry->extended.ext == OFFLINE_EXT_TYPE_MARKER &&
-            in_entry->extended.valueB == TRACE_MARKER_TYPE_CPU_ID)) {
+    while (in_entry != nullptr &&
+           (in_entry->timestamp.type == OFFLINE_TYPE_TIMESTAMP ||
+            (in_entry->extended.type == OFFLINE_TYPE_EXTENDED &&
+             in_entry->extended.ext == OFFLINE_EXT_TYPE_MARKER &&
+             in_entry->extended.valueB == TRACE_MARKER_TYPE_CPU_ID))) {
         saved.push_back(*in_entry);
         in_entry = get_next_entry(tdata);
     }
     bool omit = false;
-    if (in_entry->extended.type != OFFLINE_TYPE_EXTENDED ||
+    // A segment being converted speculatively can end here.
+    if (in_entry == nullptr ||
+        in_entry->extended.type != OFFLINE_TYPE_EXTENDED ||
         in_entry->extended.ext != OFFLINE_EXT_TYPE_MARKER ||
         in_entry->extended.valueB != TRACE_MARKER_TYPE_SYSCALL) {
         omit = true;
     }
-    saved.push_back(*in_entry);
-    for (auto &entry : saved) {
-        queue_entry(tdata, entry);
-    }
+    if (in_entry != nullptr)
+        saved.push_back(*in_entry);
+    // The read queue may hold entries past these, such as when handed over from
+    // segmented conversion, so we put these back at its front.
+    tdata->pre_read.insert(tdata->pre_read.begin(), saved.begin(), saved.end());
     return omit;
 #endif
 }
@@ -2932,6 +3660,84 @@ raw2trace_t::get_instr_summary(raw2trace_thread_data_t *tdata, uint64 modidx,
     return ret;
 }
 
+uint64
+raw2trace_t::decode_cache_file_flavor(raw2trace_thread_data_t *tdata)
+{
+    int file_type = get_file_type(tdata);
+    // Filtered traces decode instructions one at a time rather than as blocks.
+    if (TESTANY(OFFLINE_FILE_TYPE_FILTERED | OFFLINE_FILE_TYPE_IFILTERED, file_type))
+        return 0;
+    // The version and these types determine which addresses are elided.
+    uint64 flavor =
+        (static_cast<uint64>(file_type &
+                             (OFFLINE_FILE_TYPE_NO_OPTIMIZATIONS |
+                              OFFLINE_FILE_TYPE_INSTRUCTION_ONLY |
+                              OFFLINE_FILE_TYPE_ARCH_ALL))
+         << 32) |
+        static_cast<uint16_t>(get_version(tdata));
+#ifdef AARCH64
+    // Some SVE operands are scaled by the vector length.
+    flavor |= static_cast<uint64>(dr_get_sve_vector_length() & 0x7fff) << 16;
+#endif
+    // We keep 0 for "none".
+    return flavor | (1ULL << 31);
+}
+
+void
+raw2trace_t::load_block_from_decode_cache_file(raw2trace_thread_data_t *tdata,
+                                               uint64 modidx, uint64 modoffs,
+                                               app_pc block_start, int instr_count)
+{
+    if (modidx >= decode_cache_file_module_keys_.size())
+        return;
+    uint64 flavor = decode_cache_file_flavor(tdata);
+    if (flavor == 0 ||
+        lookup_block_summary(tdata, modidx, modoffs, block_start) != nullptr)
+        return;
+    const module_t &module = modvec_()[static_cast<size_t>(modidx)];
+    if (block_start < module.map_seg_base ||
+        block_start >= module.map_seg_base + module.seg_size)
+        return;
+    const byte *record = decode_cache_file_->lookup(
+        decode_cache_file_module_keys_[static_cast<size_t>(modidx)], modoffs, flavor,
+        instr_count, block_start, module.map_seg_base + module.seg_size - block_start);
+    if (record == nullptr)
+        return;
+    block_summary_t *block = new block_summary_t(block_start, instr_count);
+    decode_cache_file_->materialize(record, block_start,
+                                    modmap_().get_orig_pc(modidx, modoffs),
+                                    block->instrs);
+    block->in_decode_cache_file = true;
+    decode_cache_[tdata->worker].add(modidx, modoffs, block);
+    VPRINT(5, "Loaded block summary for " PFX " from the decode cache file\n",
+           block_start);
+}
+
+void
+raw2trace_t::save_block_to_decode_cache_file(raw2trace_thread_data_t *tdata,
+                                             uint64 modidx, uint64 modoffs,
+                                             app_pc block_start)
+{
+    if (modidx >= decode_cache_file_module_keys_.size())
+        return;
+    uint64 flavor = decode_cache_file_flavor(tdata);
+    if (flavor == 0)
+        return;
+    block_summary_t *block = lookup_block_summary(tdata, modidx, modoffs, block_start);
+    if (block == nullptr || block->in_decode_cache_file)
+        return;
+    // A block cut short by a signal may not have been decoded in full.
+    for (const instr_summary_t &instr : block->instrs) {
+        if (instr.pc() == nullptr)
+            return;
+    }
+    block->in_decode_cache_file = true;
+    decode_cache_file_t::serialize(
+        decode_cache_file_module_keys_[static_cast<size_t>(modidx)], modoffs, flavor,
+        block_start, modmap_().get_orig_pc(modidx, modoffs), block->instrs,
+        decode_cache_file_records_[tdata->worker]);
+}
+
 // These flags are difficult to set on construction: because one instr_t may have
 // multiple flags, we'd need get_instr_summary() to take in a vector or sthg.
 // Instead we set after the fact.
@@ -3448,6 +4254,16 @@ raw2trace_t::write(raw2trace_thread_data_t *tdata, const trace_entry_t *start,
                                        decode_pcs + decode_pcs_size);
         return true;
     }
+    if (tdata->segment != nullptr) {
+        // We are converting speculatively: the thread's worker replays this later.
+        thread_segment_t *segment = tdata->segment;
+        segment->records.insert(segment->records.end(), start, end);
+        segment->decode_pcs.insert(segment->decode_pcs.end(), decode_pcs,
+                                   decode_pcs + decode_pcs_size);
+        segment->writes.emplace_back(segment->records.size(),
+                                     segment->decode_pcs.size());
+        return true;
+    }
     if (tdata->out_archive != nullptr) {
         bool prev_was_encoding = false;
         int instr_ordinal = -1;
@@ -3744,7 +4560,8 @@ raw2trace_t::raw2trace_t(
     const std::string &alt_module_dir, uint64_t chunk_instr_count,
     const std::unordered_map<thread_id_t, std::istream *> &kthread_files_map,
     const std::string &kcore_path, const std::string &kallsyms_path,
-    std::unique_ptr<dynamorio::drmemtrace::record_reader_t> syscall_template_file_reader)
+    std::unique_ptr<dynamorio::drmemtrace::record_reader_t> syscall_template_file_reader,
+    uint64_t thread_segment_size, const std::string &decode_cache_file)
     : dcontext_(dcontext == nullptr ? dr_standalone_init() : dcontext)
     , passed_dcontext_(dcontext != nullptr)
     , worker_count_(worker_count)
@@ -3757,6 +4574,7 @@ raw2trace_t::raw2trace_t(
     , verbosity_(verbosity)
     , alt_module_dir_(alt_module_dir)
     , chunk_instr_count_(chunk_instr_count)
+    , thread_segment_size_(thread_segment_size)
     , kthread_files_map_(kthread_files_map)
     , kcore_path_(kcore_path)
     , kallsyms_path_(kallsyms_path)
@@ -3815,6 +4633,8 @@ raw2trace_t::raw2trace_t(
     decode_cache_.reserve(cache_count);
     for (int i = 0; i < cache_count; ++i)
         decode_cache_.emplace_back(cache_count);
+    decode_cache_file_path_ = decode_cache_file;
+    decode_cache_file_records_.resize(cache_count);
 }
 
 raw2trace_t::~raw2trace_t()
@@ -3871,6 +4691,8 @@ raw2trace_t::get_statistic(raw2trace_statistic_t stat)
     case RAW2TRACE_STAT_KERNEL_INSTR_COUNT: return kernel_instr_count_;
     case RAW2TRACE_STAT_SYSCALL_TRACES_DECODED: return syscall_traces_decoded_;
     case RAW2TRACE_STAT_SYSCALL_TRACES_INJECTED: return syscall_traces_injected_;
+    case RAW2TRACE_STAT_DECODE_CACHE_FILE_HITS:
+        return decode_cache_file_ == nullptr ? 0 : decode_cache_file_->get_hits();
     case RAW2TRACE_STAT_MAX:
     default: DR_ASSERT(false); return 0;
     }
@@ -48,12 +48,14 @@
 #include <array>
 #include <atomic>
 #include <bitset>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
 #include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <string>
@@ -98,6 +100,8 @@ namespace drmemtrace {
 #    define TRACE_SUFFIX_GZ "trace.gz"
 #endif
 
+#define TRACE_SUFFIX_COLUMNAR "trace.col"
+
 #define TRACE_SUFFIX "trace"
 
 typedef enum {
@@ -112,6 +116,7 @@ typedef enum {
     RAW2TRACE_STAT_KERNEL_INSTR_COUNT,
     RAW2TRACE_STAT_SYSCALL_TRACES_DECODED,
     RAW2TRACE_STAT_SYSCALL_TRACES_INJECTED,
+    RAW2TRACE_STAT_DECODE_CACHE_FILE_HITS,
     // We add a MAX member so that we can iterate over all stats in unit tests.
     RAW2TRACE_STAT_MAX,
 } raw2trace_statistic_t;
@@ -142,6 +147,8 @@ struct module_t {
     bool is_external; // If true, the data is embedded in drmodtrack custom fields.
 };
 
+class decode_cache_file_t;
+
 /**
  * instr_summary_t is a compact encapsulation of the information needed by trace
  * conversion from decoded instructions.
@@ -235,6 +242,7 @@ struct instr_summary_t final {
 
 private:
     friend class raw2trace_t;
+    friend class decode_cache_file_t;
 
     byte
     length() const
@@ -792,6 +800,15 @@ public:
     // and out_files are all owned and opened/closed by the caller.  module_map is not a
     // string and can contain binary data.
     // If a nullptr dcontext is passed, creates a new DR context va dr_standalone_init().
+    // A non-zero thread_segment_size splits each traced thread's raw file into
+    // segments of at least that many bytes which are converted concurrently by all
+    // workers and then stitched together in order.  The output is identical to that
+    // of a serial conversion.  This only helps when a few traced threads hold most of
+    // the data and worker_count is above 1.  Each worker holds the converted records
+    // of a segment in memory until it is stitched.
+    // A non-empty decode_cache_file names a file holding block decodings from prior
+    // conversions, which is used in place of decoding where the code matches and
+    // to which the blocks decoded by this conversion are appended.
     raw2trace_t(
         const char *module_map, const std::vector<std::istream *> &thread_files,
         const std::vector<std::ostream *> &out_files,
@@ -804,7 +821,8 @@ public:
         const std::unordered_map<thread_id_t, std::istream *> &kthread_files_map = {},
         const std::string &kcore_path = "", const std::string &kallsyms_path = "",
         std::unique_ptr<dynamorio::drmemtrace::record_reader_t> syscall_template_file =
-            nullptr);
+            nullptr,
+        uint64_t thread_segment_size = 0, const std::string &decode_cache_file = "");
     // If a nullptr dcontext_in was passed to the constructor, calls dr_standalone_exit().
     virtual ~raw2trace_t();
 
@@ -937,6 +955,8 @@ protected:
         }
         app_pc start_pc;
         std::vector<instr_summary_t> instrs;
+        // Whether the block came from or has been queued for the decode cache file.
+        bool in_decode_cache_file = false;
     };
 
     struct branch_info_t {
@@ -957,6 +977,10 @@ protected:
         int buf_idx; // Index into rseq_buffer_.
     };
 
+    // A piece of a traced thread's raw file converted ahead of the thread's own
+    // processing thread.
+    struct thread_segment_t;
+
     // Per-traced-thread data is stored here and accessed without locks by having each
     // traced thread processed by only one processing thread.
     struct raw2trace_thread_data_t {
@@ -1067,6 +1091,10 @@ protected:
         std::vector<branch_info_t> rseq_branch_targets_;
         std::vector<app_pc> rseq_decode_pcs_;
 
+        // When set, this is a throwaway copy converting a segment and write() records
+        // its output in the segment for later replay into the real thread's data.
+        thread_segment_t *segment = nullptr;
+
 #ifdef BUILD_PT_POST_PROCESSOR
         std::unique_ptr<drir_t> pt_decode_state_ = nullptr;
         std::istream *kthread_file;
@@ -1380,6 +1408,28 @@ private:
                          block_summary_t *block, app_pc block_start, int instr_count,
                          int index, DR_PARAM_INOUT app_pc *pc, app_pc orig);
 
+    // Maps the decode cache file, if one was requested.
+    std::string
+    read_decode_cache_file();
+    // Appends the blocks decoded by this conversion to the decode cache file.
+    std::string
+    write_decode_cache_file();
+    // Returns a value identifying the trace properties which affect how blocks are
+    // summarized, or 0 if blocks in this thread are not to use the decode cache file.
+    uint64
+    decode_cache_file_flavor(raw2trace_thread_data_t *tdata);
+    // Adds the block to the decode cache if it is not there and the decode cache
+    // file has it.
+    void
+    load_block_from_decode_cache_file(raw2trace_thread_data_t *tdata, uint64 modidx,
+                                      uint64 modoffs, app_pc block_start,
+                                      int instr_count);
+    // Queues the block for appending to the decode cache file if it is new and
+    // fully decoded.
+    void
+    save_block_to_decode_cache_file(raw2trace_thread_data_t *tdata, uint64 modidx,
+                                    uint64 modoffs, app_pc block_start);
+
     // Return the #instr_summary_t representation of the index-th instruction (at *pc)
     // inside the block that begins at block_start_pc and contains instr_count
     // instructions in the specified module.  Updates the value at pc to the PC of the
@@ -1447,11 +1497,77 @@ private:
     bool
     process_header(raw2trace_thread_data_t *tdata);
 
+    bool
+    process_thread_start(raw2trace_thread_data_t *tdata,
+                         const offline_entry_t *in_entry);
+
+    // Converts the top-level entry "in_entry", reading further entries as required.
+    bool
+    process_top_level_entry(raw2trace_thread_data_t *tdata,
+                            const offline_entry_t *in_entry,
+                            DR_PARAM_OUT bool *end_of_record,
+                            DR_PARAM_INOUT bool *last_bb_handled);
+
     bool
     process_thread_file(raw2trace_thread_data_t *tdata);
 
     void
-    process_tasks(std::vector<raw2trace_thread_data_t *> *tasks);
+    process_tasks(int worker);
+
+    // Converts as much of the thread as possible in segments, leaving the rest
+    // (if any) to the serial loop in process_thread_file().
+    bool
+    process_thread_segments(raw2trace_thread_data_t *tdata,
+                            DR_PARAM_OUT bool *end_of_file);
+
+    bool
+    thread_can_be_segmented(raw2trace_thread_data_t *tdata);
+
+    void
+    read_thread_segment(raw2trace_thread_data_t *tdata,
+                        std::vector<offline_entry_t> &carry, thread_segment_t *segment,
+                        DR_PARAM_INOUT uint64 *window, DR_PARAM_OUT bool *input_done);
+
+    void
+    dispatch_thread_segment(std::shared_ptr<thread_segment_t> segment,
+                            std::shared_ptr<thread_segment_t> next);
+
+    void
+    convert_thread_segment(thread_segment_t *segment, int worker);
+
+    // Converts queued segments of any thread until "segment" is done.
+    void
+    wait_for_thread_segment(raw2trace_thread_data_t *tdata, thread_segment_t *segment);
+
+    // Converts queued segments of any thread until no worker can queue more.
+    void
+    help_convert_thread_segments(int worker);
+
+    // Converts the entries of window[0] from *skip onward on "tdata" itself until its
+    // state matches a checkpoint of the segment's speculative conversion, from which
+    // point it takes the segment's output.  Advances the window past what was
+    // consumed.
+    bool
+    stitch_thread_segment(raw2trace_thread_data_t *tdata,
+                          std::deque<std::shared_ptr<thread_segment_t>> &window,
+                          std::vector<offline_entry_t> &carry,
+                          DR_PARAM_INOUT uint64 *skip, DR_PARAM_OUT bool *end_of_record);
+
+    bool
+    replay_thread_segment(raw2trace_thread_data_t *tdata, thread_segment_t *segment,
+                          size_t first_write);
+
+    // Decides afresh which instructions in [start, end) need encoding records on
+    // "tdata", as append_bb_entries() would have had they been converted there,
+    // and places the adjusted records in "out".
+    bool
+    redecide_encodings(raw2trace_thread_data_t *tdata, const trace_entry_t *start,
+                       const trace_entry_t *end, const app_pc *decode_pcs,
+                       size_t decode_pcs_size, std::vector<trace_entry_t> &out);
+
+    // Undoes the record_encoding_emitted() calls for the delayed branches.
+    void
+    forget_delayed_encodings(raw2trace_thread_data_t *tdata);
 
     bool
     emit_new_chunk_header(raw2trace_thread_data_t *tdata);
@@ -1601,6 +1717,14 @@ private:
     // We use a per-worker cache to avoid locks.
     std::vector<block_hashtable_t> decode_cache_;
 
+    // Block decodings shared across conversions, if requested.  New blocks are
+    // queued per worker and appended once all workers are done.
+    std::string decode_cache_file_path_;
+    std::unique_ptr<decode_cache_file_t> decode_cache_file_;
+    std::vector<std::string> decode_cache_file_records_;
+    // The decode cache file's key for each entry of modvec_().
+    std::vector<uint64> decode_cache_file_module_keys_;
+
     // Store optional parameters for the module_mapper_t until we need to construct it.
     const char *(*user_parse_)(const char *src, DR_PARAM_OUT void **data) = nullptr;
     void (*user_free_)(void *data) = nullptr;
@@ -1624,6 +1748,18 @@ private:
     // Chunking for seeking support in compressed files.
     uint64_t chunk_instr_count_ = 0;
 
+    // Intra-thread parallelism.  Segments are queued in the order read and any
+    // worker converts them; the owning worker stitches its own in order.
+    uint64_t thread_segment_size_ = 0;
+    std::mutex segment_mutex_;
+    std::condition_variable segment_cond_;
+    std::deque<std::shared_ptr<thread_segment_t>> segment_queue_;
+    // Workers still on their own task lists, which may queue more segments.
+    int workers_with_tasks_ = 0;
+    // We only record the state at the start of this many entries of a segment for
+    // resynchronizing with the state its prior segment actually ended in.
+    static const int kMaxSegmentCheckpoints = 256;
+
     offline_instru_t instru_offline_;
     const std::vector<module_t> *modvec_ptr_ = nullptr;
 
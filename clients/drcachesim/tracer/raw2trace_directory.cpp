@@ -52,6 +52,7 @@
 #include <vector>
 
 #include "archive_ostream.h"
+#include "columnar_ostream.h"
 #include "directory_iterator.h"
 #include "dr_api.h"              // Must be after windows.h.
 #include "raw2trace_directory.h" // Includes dr_api.h which must be after windows.h.
@@ -144,6 +145,8 @@ raw2trace_directory_t::trace_suffix()
 #ifdef HAS_LZ4
         return TRACE_SUFFIX_LZ4;
 #endif
+    } else if (compress_type_ == "columnar") {
+        return TRACE_SUFFIX_COLUMNAR;
     }
     return TRACE_SUFFIX;
 }
@@ -282,6 +285,8 @@ raw2trace_directory_t::open_thread_log_file(const char *basename)
 #ifdef HAS_LZ4
         ofile = new lz4_ostream_t(path);
 #endif
+    } else if (compress_type_ == "columnar") {
+        ofile = new columnar_ostream_t(path);
     }
     if (!ofile) {
         ofile = new std::ofstream(path, std::ofstream::binary);
@@ -79,6 +79,25 @@ static droption_t<bytesize_t> op_chunk_instr_count(
     "is split inside a zipfile.  This is the granularity of a fast seek. "
     "For 32-bit this cannot exceed 4G.");
 
+static droption_t<bytesize_t> op_thread_segment_size(
+    DROPTION_SCOPE_FRONTEND, "thread_segment_size", 0,
+    "Size of concurrently converted pieces of a thread",
+    "If non-zero, each thread's raw file is split into segments of at least this many "
+    "bytes which all of the -jobs workers convert concurrently, rather than one worker "
+    "converting the whole thread.  This speeds up traces where a few threads hold "
+    "most of the data.  The output is identical to that without this option.  Each "
+    "worker holds the converted records of about one segment in memory.");
+
+static droption_t<std::string> op_decode_cache_file(
+    DROPTION_SCOPE_FRONTEND, "decode_cache_file", "",
+    "File of block decodings shared across conversions",
+    "If non-empty, names a file holding the decodings of code blocks from earlier "
+    "runs, which are used in place of decoding blocks whose code is unchanged.  Blocks "
+    "decoded by this run are appended to the file, which is created if it does not "
+    "exist.  This speeds up repeated conversions of traces of the same binaries.  "
+    "Concurrent runs may share the file.  A file written by a different build of this "
+    "tool is replaced.");
+
 static droption_t<unsigned int> op_verbose(DROPTION_SCOPE_FRONTEND, "verbose", 0,
                                            "Verbosity level for diagnostic output",
                                            "Verbosity level for diagnostic output.");
@@ -92,14 +111,18 @@ static droption_t<int>
 
 static droption_t<std::string> op_trace_compress(
     DROPTION_SCOPE_FRONTEND, "compress", DEFAULT_TRACE_COMPRESSION_TYPE,
-    "Trace compression: \"zip\",\"gzip\",\"zlib\",\"lz4\",\"none\"",
+    "Trace compression: \"zip\",\"gzip\",\"zlib\",\"lz4\",\"columnar\",\"none\"",
     "Specifies the compression type to use for trace files: \"zip\", "
-    "\"gzip\", \"zlib\", \"lz4\", or \"none\". "
+    "\"gzip\", \"zlib\", \"lz4\", \"columnar\", or \"none\". "
     "In most cases where fast skipping by instruction count is not needed "
     "lz4 compression generally improves performance and is recommended. "
     "When it comes to storage types, the impact on overhead varies: "
     "for SSDs, zip and gzip often increase overhead and should only be chosen "
-    "if space is limited.");
+    "if space is limited.  The \"columnar\" format encodes each field of the "
+    "trace records separately, predicting instruction addresses from control flow "
+    "and data addresses from their prior strides.  Its output is typically 4 to 6 "
+    "times smaller than uncompressed output and, while larger than gzip output, "
+    "is faster to decode.");
 
 droption_t<std::string> op_syscall_template_file(
     DROPTION_SCOPE_FRONTEND, "syscall_template_file", "",
@@ -144,7 +167,9 @@ _tmain(int argc, const TCHAR *targv[])
                           dir.serial_schedule_file_, dir.cpu_schedule_file_, nullptr,
                           op_verbose.get_value(), op_jobs.get_value(),
                           op_alt_module_dir.get_value(), op_chunk_instr_count.get_value(),
-                          dir.in_kfiles_map_, dir.kcoredir_, dir.kallsymsdir_);
+                          dir.in_kfiles_map_, dir.kcoredir_, dir.kallsymsdir_,
+                          nullptr, op_thread_segment_size.get_value(),
+                          op_decode_cache_file.get_value());
     std::string error = raw2trace.do_conversion();
     if (!error.empty())
         FATAL_ERROR("Conversion failed: %s", error.c_str());
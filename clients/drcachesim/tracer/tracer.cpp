@@ -2077,6 +2077,7 @@ fork_init(void *drcontext)
         if (!init_offline_dir()) {
             FATAL("Failed to create a subdir in %s\n", op_outdir.get_value().c_str());
         }
+        fork_init_io();
     }
     init_thread_in_process(drcontext);
 }
@@ -108,6 +108,14 @@ typedef struct {
     size_t buf_lz4_size;
     byte *buf_lz4;
 #endif
+    /* For -raw_writer_threads. */
+    int writer_index;
+    byte *writer_buf;    /* buf_base if it is a whole buffer we may hand off. */
+    void *writer_lock;   /* Protects the fields below. */
+    void *writer_event;  /* Signaled whenever a write completes. */
+    uint writes_pending; /* Writes handed to the writer thread. */
+    uint writer_bufs;    /* Trace buffers in flight or free beyond buf_base. */
+    byte *free_bufs;     /* Linked through the first pointer of each buffer. */
     bool has_thread_header;
     // The physaddr_t class is designed to be per-thread.
     physaddr_t physaddr;
@@ -42,6 +42,7 @@
  * The runtime options for this client include:
  * -dump_text         Dumps the log file in text format
  * -dump_binary       Dumps the log file in binary format
+ * -hit_counts        Also records how many times each basic block executed
  * -[no_]nudge_kills  On by default.
  *                    Uses nudge to notify a child process being terminated
  *                    by its parent, so that the exit event will be called.
@@ -132,6 +133,8 @@ options_init(client_id_t id, int argc, const char *argv[], drcovlib_options_t *o
             ops->flags |= DRCOVLIB_DUMP_AS_TEXT;
         else if (strcmp(token, "-dump_binary") == 0)
             ops->flags &= ~DRCOVLIB_DUMP_AS_TEXT;
+        else if (strcmp(token, "-hit_counts") == 0)
+            ops->flags |= DRCOVLIB_HIT_COUNTS;
         else if (strcmp(token, "-no_nudge_kills") == 0)
             nudge_kills = false;
         else if (strcmp(token, "-nudge_kills") == 0)
@@ -45,7 +45,15 @@
 #include "drsyms.h"
 #include "hashtable.h"
 #include "dr_frontend.h"
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "../../common/utils.h"
@@ -176,7 +184,9 @@ static droption_t<std::string> op_reduce_set(
     DROPTION_SCOPE_FRONTEND, "reduce_set", "", "Output minimal inputs with same coverage",
     "Results in drcov2lcov identifying a smaller set of log files from the inputs that "
     "have the same code coverage as the full set.  The smaller set's file paths are "
-    "written to the given output file path.");
+    "written to the given output file path.  Each input is kept if it covers code that "
+    "no earlier input did, so the set depends on the order of the inputs; to keep it "
+    "stable, the inputs are read in order by a single thread.");
 
 static droption_t<twostring_t> op_pathmap(
     DROPTION_SCOPE_FRONTEND, "pathmap", 0, twostring_t("", ""),
@@ -192,6 +202,22 @@ static droption_t<bool> op_include_tool(
     "coverage output.  Normally such execution is excluded and the output focuses on "
     "the application only.");
 
+static droption_t<std::string> op_merged_output(
+    DROPTION_SCOPE_FRONTEND, "merged_output", "", "Write merged coverage to this file",
+    "Writes the coverage merged from all of the inputs to the given file in a compact "
+    "binary format.  Such a file can be passed back in as an input, e.g., via -input or "
+    "-list, to merge new logs into it incrementally rather than re-reading every log.  "
+    "Unless -output is also specified, no lcov output is produced, which avoids the "
+    "cost of looking up line information.  Not supported with -test_pattern.");
+
+static droption_t<unsigned int> op_jobs(
+    DROPTION_SCOPE_FRONTEND, "jobs", 0, "Number of threads reading the inputs",
+    "Specifies the number of threads which read and merge the input files in parallel.  "
+    "The default of 0 uses one per hardware thread.  With -test_pattern, whose "
+    "attribution of code to tests depends on the order of blocks within each log, and "
+    "with -reduce_set, whose choice of inputs depends on the order they are read in, "
+    "the inputs are always read by a single thread.");
+
 static droption_t<bool> op_help(DROPTION_SCOPE_FRONTEND, "help", false,
                                 "Print this message", "Prints the usage message.");
 
@@ -213,8 +239,10 @@ static char input_dir_buf[MAXIMUM_PATH];
 static char input_list_buf[MAXIMUM_PATH];
 static char output_file_buf[MAXIMUM_PATH];
 static char set_file_buf[MAXIMUM_PATH];
+static char merged_file_buf[MAXIMUM_PATH];
 
 static file_t set_log = INVALID_FILE;
+static std::mutex set_log_lock;
 
 /****************************************************************************
  * Utility Functions
@@ -233,6 +261,18 @@ move_to_next_line(const char *ptr)
     return ptr;
 }
 
+/* Unlike move_to_next_line(), this does not skip any further newlines, for a
+ * line followed by binary data which may well start with a newline byte.
+ */
+static inline const char *
+move_past_line(const char *ptr)
+{
+    const char *end = strchr(ptr, '\n');
+    if (end == NULL)
+        return ptr + strlen(ptr);
+    return end + 1;
+}
+
 /* the path may contain newlines, so we remove them and null terminate it */
 static inline void
 null_terminate_path(char *path)
@@ -271,6 +311,11 @@ null_terminate_path(char *path)
 static hashtable_t line_htable;
 static uint num_line_htable_entries;
 
+/* Whether any input had per-block hit counts, in which case we report per-line
+ * hit counts rather than just whether each line was executed.
+ */
+static std::atomic<bool> have_hit_counts(false);
+
 enum {
     SOURCE_LINE_STATUS_NONE = 0,  /* not compiled to object file */
     SOURCE_LINE_STATUS_SKIP = -1, /* not executed */
@@ -294,6 +339,7 @@ struct _line_chunk_t {
         byte *exec;        /* array of the execution info on the line */
         const char **test; /* array of the test name ptr on the line */
     } info;
+    uint64 *hits; /* array of the hit counts on the line, if have_hit_counts */
     line_chunk_t *next;
 };
 
@@ -325,6 +371,11 @@ line_chunk_alloc(uint num_lines)
         chunk->info.exec = (byte *)line_info;
     }
     ASSERT(line_info != NULL, "Failed to alloc line info array\n");
+    chunk->hits = NULL;
+    if (have_hit_counts && !op_test_pattern.specified()) {
+        chunk->hits = (uint64 *)calloc(num_lines, sizeof(chunk->hits[0]));
+        ASSERT(chunk->hits != NULL, "Failed to alloc line hits array\n");
+    }
     return chunk;
 }
 
@@ -335,6 +386,7 @@ line_chunk_free(line_chunk_t *chunk)
         free((void *)chunk->info.test); /* cast from "const char **" to "void *" */
     else
         free(chunk->info.exec);
+    free(chunk->hits);
     free(chunk);
 }
 
@@ -364,9 +416,15 @@ line_chunk_print(line_chunk_t *chunk, char *start)
             }
         } else {
             if (chunk->info.exec[i] != (byte)SOURCE_LINE_STATUS_NONE) {
-                res = dr_snprintf(
-                    start, MAX_CHAR_PER_LINE, "DA:%u,%u\n", line_num,
-                    chunk->info.exec[i] == (byte)SOURCE_LINE_STATUS_SKIP ? 0 : 1);
+                uint64 hits = 0;
+                if (chunk->info.exec[i] != (byte)SOURCE_LINE_STATUS_SKIP) {
+                    /* A line from a log without counts was still executed. */
+                    hits = (chunk->hits == NULL || chunk->hits[i] == 0)
+                        ? 1
+                        : chunk->hits[i];
+                }
+                res = dr_snprintf(start, MAX_CHAR_PER_LINE,
+                                  "DA:%u," UINT64_FORMAT_STRING "\n", line_num, hits);
             }
         }
         ASSERT(res < MAX_CHAR_PER_LINE && res != -1, "Error on printing\n");
@@ -439,7 +497,8 @@ line_table_delete(void *p)
 }
 
 static inline void
-line_table_add(line_table_t *line_table, uint line, byte status, const char *test_info)
+line_table_add(line_table_t *line_table, uint line, byte status, const char *test_info,
+               uint64 hits)
 {
     line_chunk_t *chunk = line_table->chunk;
 
@@ -496,6 +555,11 @@ line_table_add(line_table_t *line_table, uint line, byte status, const char *tes
                     chunk->info.exec[line - chunk->first_num] !=
                         (byte)SOURCE_LINE_STATUS_EXEC)
                     chunk->info.exec[line - chunk->first_num] = status;
+                /* A line spanning several addresses is reported with the count
+                 * of its most-executed address.
+                 */
+                if (chunk->hits != NULL && hits > chunk->hits[line - chunk->first_num])
+                    chunk->hits[line - chunk->first_num] = hits;
             }
             return;
         }
@@ -511,6 +575,14 @@ line_table_add(line_table_t *line_table, uint line, byte status, const char *tes
 #define MODULE_TABLE_IGNORE ((void *)(ptr_int_t)(-1))
 #define MIN_LOG_FILE_SIZE 20
 
+/* The merged coverage file format written by -merged_output: after this header
+ * and the flavor and module count lines, each module segment has a line with its
+ * offset, size, and number of hit ranges, a line with its path, and then its bb
+ * bitmap and hit ranges in binary.
+ */
+#define MERGED_FILE_HEADER "DRCOV MERGED VERSION: %u\n"
+#define MERGED_FILE_VERSION 1
+
 /* when use bitmap as bb_table */
 #define BITS_PER_BYTE 8
 #define BITMAP_INDEX(x) ((x) / BITS_PER_BYTE)
@@ -538,6 +610,13 @@ enum {
     BB_TABLE_ENTRY_SET = 1,
 };
 
+/* A stretch of a module segment's code over which the hit count is the same. */
+typedef struct _hit_range_t {
+    uint start;
+    uint end; /* exclusive */
+    uint64 hits;
+} hit_range_t;
+
 typedef struct _module_table_t {
     char *path;
     uintptr_t seg_start;
@@ -548,8 +627,22 @@ typedef struct _module_table_t {
         const char **array;  /* store test info (char *) for each app byte */
     } bb_table;              /* data structure storing which bb is seen */
     hashtable_t test_htable; /* hashtable for test functions found in the module */
+    /* The hit counts read for this segment: one range per block until
+     * hit_ranges_finalize() turns them into sorted and disjoint ranges with the
+     * counts of overlapping blocks added up.
+     */
+    std::vector<hit_range_t> hit_ranges;
+    /* Guards bb_table and hit_ranges while input files are read in parallel. */
+    std::mutex lock;
 } module_table_t;
 
+/* A module segment's table is shared by every input file that lists the same
+ * segment, so that the coverage of all the files is merged as they are read
+ * and each segment's line information is only enumerated once.
+ */
+static std::map<std::tuple<std::string, size_t, size_t>, module_table_t *> module_map;
+static std::mutex module_map_lock;
+
 #define MODULE_HASH_TABLE_BITS 6
 static std::vector<module_table_t *> module_vec;
 
@@ -563,7 +656,7 @@ module_vec_delete()
             free(table->bb_table.bitmap);
             if (op_test_pattern.specified())
                 hashtable_delete(&table->test_htable);
-            free(table);
+            delete table;
         }
     }
 }
@@ -668,6 +761,22 @@ module_table_bb_lookup(module_table_t *table, uint64 addr_from_abs_base,
         return bb_bitmap_lookup(table, addr);
 }
 
+static uint64
+module_table_hits_lookup(const module_table_t *table, uint64 addr_from_abs_base)
+{
+    if (table->hit_ranges.empty() || addr_from_abs_base - table->seg_offs > UINT_MAX)
+        return 0;
+    uint addr = (uint)(addr_from_abs_base - table->seg_offs);
+    const std::vector<hit_range_t> &ranges = table->hit_ranges;
+    auto it = std::upper_bound(
+        ranges.begin(), ranges.end(), addr,
+        [](uint addr, const hit_range_t &range) { return addr < range.start; });
+    if (it == ranges.begin())
+        return 0;
+    --it;
+    return addr < it->end ? it->hits : 0;
+}
+
 static inline bool
 module_table_bb_add(module_table_t *table, bb_entry_t *entry)
 {
@@ -739,8 +848,7 @@ module_table_create(const char *module, uintptr_t seg_start, size_t seg_offs, si
     module_table_t *table;
     ASSERT(ALIGNED(size, dr_page_size()), "Module size is not aligned");
 
-    table = (module_table_t *)calloc(1, sizeof(*table));
-    ASSERT(table != NULL, "Failed to allocate module table");
+    table = new module_table_t();
     table->path = my_strdup(module);
     table->seg_start = seg_start;
     table->seg_offs = seg_offs;
@@ -773,6 +881,60 @@ module_is_from_tool(const char *path)
             strstr(path, DRCOV_LIB_NAME) != NULL || strstr(path, DRMEM_LIB_NAME) != NULL);
 }
 
+/* Returns the table shared by all inputs for the given module segment, creating
+ * it if this is the first input to list the segment.
+ */
+static module_table_t *
+module_table_lookup_or_create(const char *module, uintptr_t seg_start, size_t seg_offs,
+                              size_t size)
+{
+    std::lock_guard<std::mutex> guard(module_map_lock);
+    auto key = std::make_tuple(std::string(module), seg_offs, size);
+    auto it = module_map.find(key);
+    if (it != module_map.end())
+        return it->second;
+    module_table_t *table = module_table_create(module, seg_start, seg_offs, size);
+    module_map[key] = table;
+    module_vec.push_back(table);
+    return table;
+}
+
+static bool
+module_is_ignored(const char *path)
+{
+    /* FIXME i#1445: we have seen the pdb convert paths to all-lowercase,
+     * so these should be case-insensitive on Windows.
+     */
+    return (strstr(path, "<unknown>") != NULL ||
+            (op_mod_filter.specified() &&
+             strstr(path, op_mod_filter.get_value().c_str()) == NULL) ||
+            (op_mod_skip_filter.specified() &&
+             strstr(path, op_mod_skip_filter.get_value().c_str()) != NULL) ||
+            (!op_include_tool.get_value() && module_is_from_tool(path)));
+}
+
+/* Returns the path to look for "path"'s debug information at, which is either
+ * "path" itself or "subst" holding the -pathmap substitution.
+ */
+static const char *
+module_path_map(const char *path, char *subst, size_t subst_size)
+{
+    if (!op_pathmap.specified())
+        return path;
+    const char *tofind = op_pathmap.get_value().first.c_str();
+    const char *match = strstr(path, tofind);
+    if (match == NULL)
+        return path;
+    if (dr_snprintf(subst, subst_size, "%.*s%s%s", match - path, path,
+                    op_pathmap.get_value().second.c_str(), match + strlen(tofind)) <= 0) {
+        WARN(1, "Failed to replace %s in %s\n", tofind, path);
+        return path;
+    }
+    subst[subst_size - 1] = '\0';
+    PRINT(2, "Substituting |%s| for |%s|\n", subst, path);
+    return subst;
+}
+
 static const char *
 read_module_list(const char *buf, module_table_t ***tables, uint *num_mods)
 {
@@ -790,6 +952,10 @@ read_module_list(const char *buf, module_table_t ***tables, uint *num_mods)
     }
 
     *tables = (module_table_t **)calloc(*num_mods, sizeof(*tables));
+    /* The tables are shared with other inputs, where the modules may have been
+     * loaded elsewhere, so we keep our own segment starts.
+     */
+    std::vector<uintptr_t> seg_starts(*num_mods);
     for (i = 0; i < *num_mods; i++) {
         module_table_t *mod_table;
         drmodtrack_info_t info = {
@@ -802,47 +968,20 @@ read_module_list(const char *buf, module_table_t ***tables, uint *num_mods)
         modpath = info.path;
         if (info.size >= UINT_MAX)
             ASSERT(false, "module size is too large");
-        /* FIXME i#1445: we have seen the pdb convert paths to all-lowercase,
-         * so these should be case-insensitive on Windows.
-         */
-        if (strstr(info.path, "<unknown>") != NULL ||
-            (op_mod_filter.specified() &&
-             strstr(info.path, op_mod_filter.get_value().c_str()) == NULL) ||
-            (op_mod_skip_filter.specified() &&
-             strstr(info.path, op_mod_skip_filter.get_value().c_str()) != NULL) ||
-            (!op_include_tool.get_value() && module_is_from_tool(info.path)))
+        seg_starts[i] = (uintptr_t)info.start;
+        if (module_is_ignored(info.path))
             mod_table = (module_table_t *)MODULE_TABLE_IGNORE;
         else {
-            if (op_pathmap.specified()) {
-                const char *tofind = op_pathmap.get_value().first.c_str();
-                const char *match = strstr(info.path, tofind);
-                if (match != NULL) {
-                    if (dr_snprintf(subst, BUFFER_SIZE_ELEMENTS(subst), "%.*s%s%s",
-                                    match - info.path, info.path,
-                                    op_pathmap.get_value().second.c_str(),
-                                    match + strlen(tofind)) <= 0) {
-                        WARN(1, "Failed to replace %s in %s\n", tofind, info.path);
-                    } else {
-                        NULL_TERMINATE_BUFFER(subst);
-                        PRINT(2, "Substituting |%s| for |%s|\n", subst, info.path);
-                        modpath = subst;
-                    }
-                }
-            }
+            modpath = module_path_map(info.path, subst, BUFFER_SIZE_ELEMENTS(subst));
             size_t seg_offs = 0;
             if (info.containing_index != i) {
                 ASSERT(info.containing_index <= i, "invalid containing index");
-                seg_offs =
-                    (uintptr_t)info.start - (*tables)[info.containing_index]->seg_start;
+                seg_offs = (uintptr_t)info.start - seg_starts[info.containing_index];
             }
-            mod_table =
-                module_table_create(modpath, (uintptr_t)info.start, seg_offs, info.size);
+            mod_table = module_table_lookup_or_create(modpath, (uintptr_t)info.start,
+                                                      seg_offs, info.size);
         }
-        PRINT(4, "Create module table " PFX " for module %s\n", mod_table, modpath);
-        module_vec.push_back(mod_table);
-        /* XXX: We could just use module_vec in the caller instead of this extra
-         * array, now that module_vec is a vector instead of a hashtable.
-         */
+        PRINT(4, "Use module table " PFX " for module %s\n", mod_table, modpath);
         (*tables)[i] = mod_table;
     }
     if (drmodtrack_offline_exit(handle) != DRCOVLIB_SUCCESS)
@@ -850,12 +989,27 @@ read_module_list(const char *buf, module_table_t ***tables, uint *num_mods)
     return buf;
 }
 
+/* Switches "guard" to holding the lock of "table".  The blocks of a module tend
+ * to be adjacent in a log, so we hold each table's lock across runs of them.  We
+ * never hold two at once, which could deadlock with another input's thread.
+ */
+static inline void
+module_table_switch_lock(std::unique_lock<std::mutex> &guard, module_table_t *table)
+{
+    if (table == MODULE_TABLE_IGNORE || guard.mutex() == &table->lock)
+        return;
+    if (guard.owns_lock())
+        guard.unlock();
+    guard = std::unique_lock<std::mutex>(table->lock);
+}
+
 static bool
 read_bb_list(const char *buf, module_table_t **tables, uint num_mods, uint num_bbs)
 {
     uint i;
     bb_entry_t *entry;
     bool add_new_bb = false;
+    std::unique_lock<std::mutex> guard;
 
     PRINT(4, "Reading %u basic blocks\n", num_bbs);
     if (op_test_pattern.specified()) {
@@ -867,17 +1021,104 @@ read_bb_list(const char *buf, module_table_t **tables, uint num_mods, uint num_b
     for (i = 0, entry = (bb_entry_t *)buf; i < num_bbs; i++, entry++) {
         PRINT(6, "BB: 0x%x, %u, %u\n", entry->start, entry->size, entry->mod_id);
         /* we could have mod id USHRT_MAX for unknown module e.g., [vdso] */
-        if (entry->mod_id < num_mods)
+        if (entry->mod_id < num_mods) {
+            module_table_switch_lock(guard, tables[entry->mod_id]);
             add_new_bb = module_table_bb_add(tables[entry->mod_id], entry) || add_new_bb;
+        }
     }
     free(tables);
     return add_new_bb;
 }
 
+/* Reads the optional per-block hit counts that follow the bb list at "buf". */
+static void
+read_hit_counts(const char *buf, const char *map_end, const char *bb_list,
+                module_table_t **tables, uint num_mods, uint num_bbs)
+{
+    uint i, num_hits;
+    bb_entry_t *entry;
+    std::unique_lock<std::mutex> guard;
+
+    if (buf >= map_end || dr_sscanf(buf, DRCOV_HIT_COUNTS_HEADER, &num_hits) != 1)
+        return;
+    buf = move_past_line(buf);
+    if (num_hits != num_bbs || (size_t)(map_end - buf) < num_hits * sizeof(uint64)) {
+        WARN(1, "Wrong number of hit counts: ignoring them\n");
+        return;
+    }
+    PRINT(4, "Reading %u hit counts\n", num_hits);
+    have_hit_counts = true;
+    for (i = 0, entry = (bb_entry_t *)bb_list; i < num_hits; i++, entry++) {
+        uint64 hits;
+        module_table_t *table;
+        /* The counts follow a text header, so they may be unaligned. */
+        memcpy(&hits, buf + i * sizeof(hits), sizeof(hits));
+        if (hits == 0 || entry->mod_id >= num_mods)
+            continue;
+        table = tables[entry->mod_id];
+        if (table == MODULE_TABLE_IGNORE || table->size <= entry->start + entry->size)
+            continue;
+        module_table_switch_lock(guard, table);
+        table->hit_ranges.push_back({ entry->start, entry->start + entry->size, hits });
+    }
+}
+
+/* Turns each segment's list of per-block counts into sorted disjoint ranges.
+ * A block may be listed many times, e.g. when it was rebuilt or made part of
+ * a trace, with the executions split among its copies, and blocks may overlap
+ * where one jumps into the middle of another; the count of each byte is the
+ * sum of the counts of all blocks covering it.
+ */
+static void
+hit_ranges_finalize(void)
+{
+    for (auto *table : module_vec) {
+        if (table == MODULE_TABLE_IGNORE || table->hit_ranges.empty())
+            continue;
+        std::vector<hit_range_t> &ranges = table->hit_ranges;
+        std::vector<std::pair<uint, int64>> bounds;
+        bounds.reserve(ranges.size() * 2);
+        for (const hit_range_t &range : ranges) {
+            bounds.emplace_back(range.start, (int64)range.hits);
+            bounds.emplace_back(range.end, -(int64)range.hits);
+        }
+        std::sort(bounds.begin(), bounds.end());
+        ranges.clear();
+        int64 hits = 0;
+        for (size_t i = 0; i < bounds.size(); i++) {
+            hits += bounds[i].second;
+            if (hits > 0 && i + 1 < bounds.size() &&
+                bounds[i + 1].first > bounds[i].first)
+                ranges.push_back({ bounds[i].first, bounds[i + 1].first, (uint64)hits });
+        }
+        PRINT(4, "%zu hit ranges for %s+0x%zx\n", ranges.size(), table->path,
+              table->seg_offs);
+    }
+}
+
 static const char *
-read_file_header(const char *buf)
+read_file_flavor(const char *buf)
 {
     char str[MAXIMUM_PATH];
+
+    /* flavor */
+    PRINT(4, "Reading flavor\n");
+    if (dr_sscanf(buf, "DRCOV FLAVOR: %[^\n\r]\n", str) != 1) {
+        WARN(1, "Failed to read version number");
+        return NULL;
+    }
+    if (strcmp(str, DRCOV_FLAVOR) != 0) {
+        WARN(1, "Fatal file mismatch: file %s vs tool %s\n", str, DRCOV_FLAVOR);
+        return NULL;
+    }
+    buf = move_to_next_line(buf);
+
+    return buf;
+}
+
+static const char *
+read_file_header(const char *buf)
+{
     uint version;
 
     PRINT(3, "Reading file header...\n");
@@ -904,20 +1145,7 @@ read_file_header(const char *buf)
         }
     }
     buf = move_to_next_line(buf);
-
-    /* flavor */
-    PRINT(4, "Reading flavor\n");
-    if (dr_sscanf(buf, "DRCOV FLAVOR: %[^\n\r]\n", str) != 1) {
-        WARN(1, "Failed to read version number");
-        return NULL;
-    }
-    if (strcmp(str, DRCOV_FLAVOR) != 0) {
-        WARN(1, "Fatal file mismatch: file %s vs tool %s\n", str, DRCOV_FLAVOR);
-        return NULL;
-    }
-    buf = move_to_next_line(buf);
-
-    return buf;
+    return read_file_flavor(buf);
 }
 
 static file_t
@@ -964,6 +1192,87 @@ close_input_file(file_t f, const char *map, size_t map_size)
     dr_close_file(f);
 }
 
+/* Reads a file written by write_merged_output(), OR-ing the coverage of each
+ * of its module segments into ours.
+ */
+static bool
+read_merged_file(const char *input, const char *map, size_t map_size, bool *add_new_bb)
+{
+    const char *ptr, *map_end = map + map_size;
+    uint version, num_mods, i;
+
+    PRINT(3, "Reading merged coverage...\n");
+    if (op_test_pattern.specified()) {
+        WARN(1, "Merged coverage cannot be used with -test_pattern: skipping %s\n",
+             input);
+        return false;
+    }
+    if (dr_sscanf(map, MERGED_FILE_HEADER, &version) != 1 ||
+        version != MERGED_FILE_VERSION) {
+        WARN(1, "Unsupported merged coverage version in %s\n", input);
+        return false;
+    }
+    ptr = read_file_flavor(move_to_next_line(map));
+    if (ptr == NULL || dr_sscanf(ptr, "Module Count: %u\n", &num_mods) != 1) {
+        WARN(1, "Failed to read module count from %s\n", input);
+        return false;
+    }
+    ptr = move_to_next_line(ptr);
+    for (i = 0; i < num_mods; i++) {
+        size_t seg_offs, size, num_ranges, j;
+        char path[MAXIMUM_PATH], subst[MAXIMUM_PATH];
+        const char *modpath, *end;
+        if (ptr >= map_end ||
+            dr_sscanf(ptr, "Module: %" SZFC ", %" SZFC ", %" SZFC "\n", &seg_offs,
+                      &size, &num_ranges) != 3) {
+            WARN(1, "Failed to read module %u from %s\n", i, input);
+            return false;
+        }
+        ptr = move_to_next_line(ptr);
+        /* The path has a line to itself as it may contain any character. */
+        end = strchr(ptr, '\n');
+        if (strncmp(ptr, "Path: ", 6) != 0 || end == NULL ||
+            end - (ptr + 6) >= (ptrdiff_t)BUFFER_SIZE_ELEMENTS(path)) {
+            WARN(1, "Failed to read path of module %u from %s\n", i, input);
+            return false;
+        }
+        memcpy(path, ptr + 6, end - (ptr + 6));
+        path[end - (ptr + 6)] = '\0';
+        ptr = end + 1;
+        if ((size_t)(map_end - ptr) < size / BITS_PER_BYTE ||
+            (size_t)(map_end - ptr - size / BITS_PER_BYTE) <
+                num_ranges * sizeof(hit_range_t) ||
+            !ALIGNED(size, dr_page_size())) {
+            WARN(1, "Corrupt coverage for %s in %s\n", path, input);
+            return false;
+        }
+        const char *bitmap = ptr;
+        const char *ranges = bitmap + size / BITS_PER_BYTE;
+        ptr = ranges + num_ranges * sizeof(hit_range_t);
+        if (module_is_ignored(path))
+            continue;
+        modpath = module_path_map(path, subst, BUFFER_SIZE_ELEMENTS(subst));
+        module_table_t *table = module_table_lookup_or_create(modpath, 0, seg_offs, size);
+        std::lock_guard<std::mutex> guard(table->lock);
+        for (j = 0; j < size / BITS_PER_BYTE; j++) {
+            byte bits = (byte)bitmap[j];
+            if ((bits & ~table->bb_table.bitmap[j]) != 0) {
+                table->bb_table.bitmap[j] |= bits;
+                *add_new_bb = true;
+            }
+        }
+        if (num_ranges > 0) {
+            have_hit_counts = true;
+            size_t old_size = table->hit_ranges.size();
+            table->hit_ranges.resize(old_size + num_ranges);
+            /* The ranges follow a text line, so they may be unaligned. */
+            memcpy(&table->hit_ranges[old_size], ranges,
+                   num_ranges * sizeof(hit_range_t));
+        }
+    }
+    return true;
+}
+
 static bool
 read_drcov_file(const char *input)
 {
@@ -971,8 +1280,8 @@ read_drcov_file(const char *input)
     const char *map, *ptr;
     size_t map_size;
     module_table_t **tables;
-    uint num_mods, num_bbs;
-    bool res;
+    uint num_mods, num_bbs, version;
+    bool res = false;
 
     PRINT(2, "Reading drcov log file: %s\n", input);
     log = open_input_file(input, &map, &map_size, NULL);
@@ -980,29 +1289,47 @@ read_drcov_file(const char *input)
         WARN(1, "Failed to read drcov log file %s\n", input);
         return false;
     }
-    ptr = read_file_header(map);
-    if (ptr == NULL) {
-        WARN(1, "Invalid version or bitwidth in drcov log file %s\n", input);
-        return false;
-    }
+    if (dr_sscanf(map, MERGED_FILE_HEADER, &version) == 1) {
+        if (!read_merged_file(input, map, map_size, &res)) {
+            close_input_file(log, map, map_size);
+            return false;
+        }
+    } else {
+        ptr = read_file_header(map);
+        if (ptr == NULL) {
+            WARN(1, "Invalid version or bitwidth in drcov log file %s\n", input);
+            close_input_file(log, map, map_size);
+            return false;
+        }
 
-    ptr = read_module_list(ptr, &tables, &num_mods);
-    if (ptr == NULL)
-        return false;
+        ptr = read_module_list(ptr, &tables, &num_mods);
+        if (ptr == NULL) {
+            close_input_file(log, map, map_size);
+            return false;
+        }
 
-    if (dr_sscanf(ptr, "BB Table: %u bbs\n", &num_bbs) != 1) {
-        WARN(1, "Failed to read bb list from %s\n", input);
-        return false;
-    }
-    ptr = move_to_next_line(ptr);
-    if (num_bbs * sizeof(bb_entry_t) > map_size) {
-        WARN(1, "Wrong number of bbs, corrupt log file %s\n", input);
-        close_input_file(log, map, map_size);
-        return false;
+        if (dr_sscanf(ptr, "BB Table: %u bbs\n", &num_bbs) != 1) {
+            WARN(1, "Failed to read bb list from %s\n", input);
+            free(tables);
+            close_input_file(log, map, map_size);
+            return false;
+        }
+        /* The binary entries may start with a newline byte. */
+        ptr = move_past_line(ptr);
+        if (num_bbs * sizeof(bb_entry_t) > (size_t)(map + map_size - ptr)) {
+            WARN(1, "Wrong number of bbs, corrupt log file %s\n", input);
+            free(tables);
+            close_input_file(log, map, map_size);
+            return false;
+        }
+        read_hit_counts(ptr + num_bbs * sizeof(bb_entry_t), map + map_size, ptr, tables,
+                        num_mods, num_bbs);
+        res = read_bb_list(ptr, tables, num_mods, num_bbs);
     }
-    res = read_bb_list(ptr, tables, num_mods, num_bbs);
-    if (res && set_log != INVALID_FILE)
+    if (res && set_log != INVALID_FILE) {
+        std::lock_guard<std::mutex> guard(set_log_lock);
         dr_fprintf(set_log, "%s\n", input);
+    }
     close_input_file(log, map, map_size);
     return true;
 }
@@ -1021,7 +1348,7 @@ is_drcov_log_file(const char *fname)
 
 #ifdef UNIX
 static bool
-read_drcov_dir(void)
+collect_drcov_dir(std::vector<std::string> *files)
 {
     DIR *dir;
     struct dirent *ent;
@@ -1039,7 +1366,7 @@ read_drcov_dir(void)
                     WARN(1, "Fail to get full path of log file %s\n", ent->d_name);
                 } else {
                     NULL_TERMINATE_BUFFER(path);
-                    read_drcov_file(path);
+                    files->push_back(path);
                     found_logs = true;
                 }
             }
@@ -1056,7 +1383,7 @@ read_drcov_dir(void)
 }
 #else
 static bool
-read_drcov_dir(void)
+collect_drcov_dir(std::vector<std::string> *files)
 {
     HANDLE hFind = INVALID_HANDLE_VALUE;
     WIN32_FIND_DATA ffd;
@@ -1086,7 +1413,8 @@ read_drcov_dir(void)
             if (!has_sep)
                 strcat(path, "\\");
             strcat(path, ffd.cFileName);
-            found_logs = read_drcov_file(path) || found_logs;
+            files->push_back(path);
+            found_logs = true;
         }
     } while (FindNextFile(hFind, &ffd) != 0);
     FindClose(hFind);
@@ -1097,14 +1425,13 @@ read_drcov_dir(void)
 #endif
 
 static bool
-read_drcov_list(void)
+collect_drcov_list(std::vector<std::string> *files)
 {
     file_t list;
     const char *map, *ptr;
     char path[MAXIMUM_PATH];
     size_t map_size;
     uint64 file_size;
-    bool found_logs = false;
 
     PRINT(2, "Reading list %s\n", input_list_buf);
     list = open_input_file(input_list_buf, &map, &map_size, &file_size);
@@ -1119,24 +1446,72 @@ read_drcov_list(void)
         NULL_TERMINATE_BUFFER(path);
         ptr = move_to_next_line(ptr);
         null_terminate_path(path);
-        found_logs = read_drcov_file(path) || found_logs;
+        files->push_back(path);
     }
     close_input_file(list, map, map_size);
-    if (!found_logs)
-        WARN(1, "Failed to find log files on list %s\n", input_list_buf);
-    return found_logs;
+    return true;
+}
+
+/* Reads the given input files, with several threads when there are many of
+ * them, and returns which of them were read successfully.  The files' tables
+ * are merged into the shared module tables as they are read.
+ */
+static std::vector<char>
+read_drcov_files(const std::vector<std::string> &files)
+{
+    std::vector<char> read_ok(files.size(), false);
+    std::atomic<size_t> next_file(0);
+    uint num_jobs = op_jobs.get_value();
+    if (num_jobs == 0)
+        num_jobs = std::thread::hardware_concurrency();
+    if (num_jobs == 0 || op_test_pattern.specified() || op_reduce_set.specified())
+        num_jobs = 1;
+    if (num_jobs > files.size())
+        num_jobs = (uint)files.size();
+    auto read_files = [&]() {
+        for (size_t i = next_file++; i < files.size(); i = next_file++)
+            read_ok[i] = read_drcov_file(files[i].c_str());
+    };
+    if (num_jobs <= 1) {
+        read_files();
+        return read_ok;
+    }
+    PRINT(2, "Reading %zu input files with %u threads\n", files.size(), num_jobs);
+    std::vector<std::thread> threads;
+    threads.reserve(num_jobs);
+    for (uint i = 0; i < num_jobs; i++)
+        threads.emplace_back(read_files);
+    for (std::thread &thread : threads)
+        thread.join();
+    return read_ok;
 }
 
 static bool
 read_drcov_input(void)
 {
-    bool res = true;
+    std::vector<std::string> files;
+    size_t list_start, list_end;
+    bool res = true, list_ok = false;
     if (op_input.specified())
-        res = read_drcov_file(input_file_buf) && res;
-    if (op_list.specified())
-        res = read_drcov_list() && res;
+        files.push_back(input_file_buf);
+    list_start = files.size();
+    if (op_list.specified()) {
+        list_ok = collect_drcov_list(&files);
+        res = list_ok && res;
+    }
+    list_end = files.size();
     if (op_dir.specified())
-        res = read_drcov_dir() && res;
+        res = collect_drcov_dir(&files) && res;
+
+    std::vector<char> read_ok = read_drcov_files(files);
+    if (op_input.specified())
+        res = read_ok[0] && res;
+    if (list_ok &&
+        std::find(read_ok.begin() + list_start, read_ok.begin() + list_end, true) ==
+            read_ok.begin() + list_end) {
+        WARN(1, "Failed to find log files on list %s\n", input_list_buf);
+        res = false;
+    }
     return res;
 }
 
@@ -1169,11 +1544,11 @@ enum_line_cb(drsym_line_info_t *info, void *data)
     if (status == BB_TABLE_ENTRY_SET) {
         PRINT(5, "exec: ");
         line_table_add(line_table, (uint)info->line, (byte)SOURCE_LINE_STATUS_EXEC,
-                       test_info);
+                       test_info, module_table_hits_lookup(table, info->line_addr));
     } else if (status == BB_TABLE_ENTRY_CLEAR) {
         PRINT(5, "skip: ");
         line_table_add(line_table, (uint)info->line, (byte)SOURCE_LINE_STATUS_SKIP,
-                       test_info);
+                       test_info, 0);
     } else {
         WARN(2, "Invalid bb lookup, Table: " PFX ", Addr: " PIFX "\n", table,
              IF_NOT_X64((uint)) info->line);
@@ -1274,6 +1649,34 @@ write_lcov_output(void)
     return true;
 }
 
+static bool
+write_merged_output(void)
+{
+    file_t merged;
+
+    PRINT(2, "Writing merged coverage file: %s\n", merged_file_buf);
+    merged = dr_open_file(merged_file_buf, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+    if (merged == INVALID_FILE) {
+        ASSERT(false, "Failed to open merged output file %s\n", merged_file_buf);
+        return false;
+    }
+    dr_fprintf(merged, MERGED_FILE_HEADER, MERGED_FILE_VERSION);
+    dr_fprintf(merged, "DRCOV FLAVOR: %s\n", DRCOV_FLAVOR);
+    dr_fprintf(merged, "Module Count: %u\n", (uint)module_vec.size());
+    for (const auto *table : module_vec) {
+        dr_fprintf(merged, "Module: %" SZFC ", %" SZFC ", %" SZFC "\n", table->seg_offs,
+                   table->size, table->hit_ranges.size());
+        dr_fprintf(merged, "Path: %s\n", table->path);
+        dr_write_file(merged, table->bb_table.bitmap, table->size / BITS_PER_BYTE);
+        if (!table->hit_ranges.empty()) {
+            dr_write_file(merged, table->hit_ranges.data(),
+                          table->hit_ranges.size() * sizeof(hit_range_t));
+        }
+    }
+    dr_close_file(merged);
+    return true;
+}
+
 /****************************************************************************
  * Options Handling
  */
@@ -1349,7 +1752,7 @@ option_init(int argc, const char *argv[])
         PRINT(2, "Input dir: %s\n", input_dir_buf);
     }
 
-    if (!op_output.specified())
+    if (!op_output.specified() && !op_merged_output.specified())
         WARN(1, "No output file name specified: using default %s\n", DEFAULT_OUTPUT_FILE);
     if (drfront_get_absolute_path(
             !op_output.specified() ? DEFAULT_OUTPUT_FILE : op_output.get_value().c_str(),
@@ -1360,6 +1763,22 @@ option_init(int argc, const char *argv[])
     NULL_TERMINATE_BUFFER(output_file_buf);
     PRINT(2, "Output file: %s\n", output_file_buf);
 
+    if (op_merged_output.specified()) {
+        if (op_test_pattern.specified()) {
+            WARN(0, "-merged_output is not supported with -test_pattern\n");
+            return false;
+        }
+        if (drfront_get_absolute_path(op_merged_output.get_value().c_str(),
+                                      merged_file_buf,
+                                      BUFFER_SIZE_ELEMENTS(merged_file_buf)) !=
+            DRFRONT_SUCCESS) {
+            WARN(1, "Failed to get full path of merged output file\n");
+            return false;
+        }
+        NULL_TERMINATE_BUFFER(merged_file_buf);
+        PRINT(2, "Merged output file: %s\n", merged_file_buf);
+    }
+
     if (op_reduce_set.specified()) {
         if (drfront_get_absolute_path(op_reduce_set.get_value().c_str(), set_file_buf,
                                       BUFFER_SIZE_ELEMENTS(set_file_buf)) !=
@@ -1408,16 +1827,29 @@ main(int argc, const char *argv[])
         return 1;
     }
 
-    PRINT(1, "Enumerating line info...\n");
-    if (!dynamorio::drcov::enumerate_line_info()) {
-        ASSERT(false, "Failed to enumerate line info\n");
-        return 1;
+    dynamorio::drcov::hit_ranges_finalize();
+
+    if (dynamorio::drcov::op_merged_output.specified()) {
+        PRINT(1, "Writing merged coverage file...\n");
+        if (!dynamorio::drcov::write_merged_output()) {
+            ASSERT(false, "Failed to write merged coverage file\n");
+            return 1;
+        }
     }
 
-    PRINT(1, "Writing output file...\n");
-    if (!dynamorio::drcov::write_lcov_output()) {
-        ASSERT(false, "Failed to write output file\n");
-        return 1;
+    if (dynamorio::drcov::op_output.specified() ||
+        !dynamorio::drcov::op_merged_output.specified()) {
+        PRINT(1, "Enumerating line info...\n");
+        if (!dynamorio::drcov::enumerate_line_info()) {
+            ASSERT(false, "Failed to enumerate line info\n");
+            return 1;
+        }
+
+        PRINT(1, "Writing output file...\n");
+        if (!dynamorio::drcov::write_lcov_output()) {
+            ASSERT(false, "Failed to write output file\n");
+            return 1;
+        }
     }
 
     dynamorio::drcov::module_vec_delete();
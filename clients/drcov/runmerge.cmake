@@ -0,0 +1,137 @@
+# **********************************************************
+# Copyright (c) 2026 Google, Inc.    All rights reserved.
+# **********************************************************
+
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# * Redistributions of source code must retain the above copyright notice,
+#   this list of conditions and the following disclaimer.
+#
+# * Redistributions in binary form must reproduce the above copyright notice,
+#   this list of conditions and the following disclaimer in the documentation
+#   and/or other materials provided with the distribution.
+#
+# * Neither the name of Google, Inc. nor the names of its contributors may be
+#   used to endorse or promote products derived from this software without
+#   specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+
+# Invoked by the test suite for testing how drcov2lcov merges several logs.
+# Runs the app three times, the second time with an argument which cuts it
+# short, and checks that:
+# * Reading the logs with one thread and with several gives the same output
+#   and the same -reduce_set list.
+# * Merging the first log into a -merged_output file and then merging the
+#   rest into that file gives the same output as reading all the logs at once.
+# * That output matches cmp, with the hit counts of all the runs added up.
+
+# input:
+# * cmd = command to run
+#     should have intra-arg space=@@ and inter-arg space=@ and ;=!
+#     and must pass -logdir to the client
+# * cmp = file containing the expected lcov output
+# * postcmd = drcov2lcov
+# * postcmd2 = argument which cuts the app short
+
+string(REGEX REPLACE "@@" " " cmd "${cmd}")
+string(REGEX REPLACE "@" ";" cmd "${cmd}")
+string(REGEX REPLACE "!" "\\\;" cmd "${cmd}")
+
+if (NOT "${cmd}" MATCHES ";-logdir;([^;]+)")
+  message(FATAL_ERROR "*** ${cmd} must pass -logdir ***\n")
+endif ()
+set(logdir "${CMAKE_MATCH_1}")
+file(REMOVE_RECURSE "${logdir}")
+file(MAKE_DIRECTORY "${logdir}")
+
+foreach (args "" "${postcmd2}" "")
+  execute_process(COMMAND ${cmd} ${args}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${cmd} ${args} failed (${cmd_result}): ${cmd_err}***\n")
+  endif (cmd_result)
+endforeach ()
+
+# tool.drcov.fib-merge.expect => fib
+get_filename_component(test_name "${cmp}" NAME)
+string(REGEX REPLACE "\\.[^.]+$" "" test_name ${test_name})
+string(REGEX REPLACE "^.+\\.([^.]+)$" "\\1" test_name ${test_name})
+string(REGEX REPLACE "-.*$" "" app_name ${test_name})
+
+file(GLOB drcov_logs "${logdir}/drcov.*${app_name}*.log")
+list(LENGTH drcov_logs num_logs)
+if (NOT num_logs EQUAL 3)
+  message(FATAL_ERROR "*** expected 3 logs in ${logdir} but found ${num_logs} ***\n")
+endif ()
+
+function (run_postcmd)
+  execute_process(COMMAND ${postcmd}
+    -mod_filter ${app_name}
+    -src_filter ${app_name}
+    ${ARGN}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${postcmd} ${ARGN} failed (${cmd_result}): "
+      "${cmd_err} ${cmd_out}***\n")
+  endif (cmd_result)
+endfunction ()
+
+function (compare_outputs file1 file2)
+  file(READ "${file1}" contents1)
+  file(READ "${file2}" contents2)
+  if (NOT "${contents1}" STREQUAL "${contents2}")
+    message(FATAL_ERROR "${file1}:\n${contents1}\ndiffers from ${file2}:\n${contents2}")
+  endif ()
+endfunction ()
+
+set(out "${logdir}/${test_name}")
+run_postcmd(-dir ${logdir} -jobs 1 -output ${out}.seq.info)
+run_postcmd(-dir ${logdir} -jobs 3 -output ${out}.par.info)
+compare_outputs(${out}.seq.info ${out}.par.info)
+run_postcmd(-dir ${logdir} -jobs 1 -output ${out}.seq.reduce.info
+  -reduce_set ${out}.seq.set)
+run_postcmd(-dir ${logdir} -jobs 3 -output ${out}.par.reduce.info
+  -reduce_set ${out}.par.set)
+compare_outputs(${out}.seq.set ${out}.par.set)
+
+# Merge the first log, then the other two into the same file in place.
+list(GET drcov_logs 0 first_log)
+list(REMOVE_AT drcov_logs 0)
+string(REPLACE ";" "\n" later_logs "${drcov_logs}")
+file(WRITE ${out}.list "${later_logs}\n")
+run_postcmd(-input ${first_log} -merged_output ${out}.merged)
+run_postcmd(-input ${out}.merged -list ${out}.list -jobs 2
+  -merged_output ${out}.merged -output ${out}.inc.info)
+compare_outputs(${out}.seq.info ${out}.inc.info)
+# The merged file alone gives the same output again.
+run_postcmd(-input ${out}.merged -output ${out}.final.info)
+compare_outputs(${out}.seq.info ${out}.final.info)
+
+file(READ ${cmp} expect)
+if (WIN32)
+  # our test prep turned \n into \r?\n so revert
+  string(REGEX REPLACE "\r\\?" "" expect "${expect}")
+endif (WIN32)
+file(READ ${out}.seq.info cov_out)
+
+file(REMOVE_RECURSE "${logdir}")
+
+if (NOT "${cov_out}" MATCHES "${expect}")
+  message(FATAL_ERROR "tool output ${cov_out} failed to match expected ${expect}")
+endif ()
@@ -1,5 +1,5 @@
 # **********************************************************
-# Copyright (c) 2014-2015 Google, Inc.    All rights reserved.
+# Copyright (c) 2014-2026 Google, Inc.    All rights reserved.
 # Copyright (c) 2010 VMware, Inc.    All rights reserved.
 # **********************************************************
 
@@ -44,6 +44,15 @@ string(REGEX REPLACE "@@" " " cmd "${cmd}")
 string(REGEX REPLACE "@" ";" cmd "${cmd}")
 string(REGEX REPLACE "!" "\\\;" cmd "${cmd}")
 
+# A variant of a test passes -logdir to keep its logs apart from other runs of
+# the same app.
+set(logdir ".")
+if ("${cmd}" MATCHES ";-logdir;([^;]+)")
+  set(logdir "${CMAKE_MATCH_1}")
+  file(REMOVE_RECURSE "${logdir}")
+  file(MAKE_DIRECTORY "${logdir}")
+endif ()
+
 # run the cmd
 execute_process(COMMAND ${cmd}
   RESULT_VARIABLE cmd_result
@@ -59,10 +68,12 @@ endif (cmd_result)
 get_filename_component(test_name "${cmp}" NAME)
 # tool.drcov.fib.expect => tool.drcov.fib
 string(REGEX REPLACE "\\.[^.]+$" "" test_name ${test_name})
-# tool.drcov.fib => fib
+# tool.drcov.fib-hit_counts => fib-hit_counts
 string(REGEX REPLACE "^.+\\.([^.]+)$" "\\1" test_name ${test_name})
+# fib-hit_counts => fib
+string(REGEX REPLACE "-.*$" "" app_name ${test_name})
 
-FILE(GLOB drcov_logs "drcov.*${test_name}*.log")
+FILE(GLOB drcov_logs "${logdir}/drcov.*${app_name}*.log")
 set(cov_file "coverage.${test_name}")
 
 file(READ ${cmp} expect)
@@ -72,9 +83,9 @@ if (WIN32)
 endif (WIN32)
 
 execute_process(COMMAND ${postcmd}
-  -dir        ./
-  -mod_filter ${test_name}
-  -src_filter ${test_name}
+  -dir        ${logdir}
+  -mod_filter ${app_name}
+  -src_filter ${app_name}
   -output     ${cov_file}
   RESULT_VARIABLE cmd_result
   ERROR_VARIABLE cmd_err
@@ -89,6 +100,9 @@ file(READ ${cov_file} cov_out)
 foreach(logfile ${drcov_logs})
   file(REMOVE ${logfile})
 endforeach(logfile)
+if (NOT "${logdir}" STREQUAL ".")
+  file(REMOVE_RECURSE "${logdir}")
+endif ()
 file(REMOVE ${cov_file})
 
 if (NOT "${cov_out}" MATCHES "${expect}")
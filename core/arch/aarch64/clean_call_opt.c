@@ -172,6 +172,50 @@ find_nzcv_spill_reg(callee_info_t *ci)
     return spill_reg;
 }
 
+void
+analyze_callee_simd_instr(dcontext_t *dcontext, callee_info_t *ci, instr_t *instr)
+{
+    int i;
+    for (i = 0; i < MCXT_NUM_SIMD_SVE_SLOTS; i++) {
+        if (!ci->simd_used[i] &&
+            instr_uses_reg(instr,
+                           (proc_has_feature(FEATURE_SVE) ? DR_REG_Z0 : DR_REG_Q0) +
+                               (reg_id_t)i)) {
+            LOG(THREAD, LOG_CLEANCALL, 2,
+                "CLEANCALL: callee " PFX " uses VREG%d at " PFX "\n", ci->start, i,
+                instr_get_app_pc(instr));
+            ci->simd_used[i] = true;
+            ci->num_simd_used++;
+        }
+    }
+
+    if (proc_has_feature(FEATURE_SVE)) {
+        /* SVE predicate register usage */
+        for (i = MCXT_NUM_SIMD_SVE_SLOTS;
+             i < (MCXT_NUM_SIMD_SVE_SLOTS + MCXT_NUM_SVEP_SLOTS); i++) {
+            const uint reg_idx = i - MCXT_NUM_SIMD_SVE_SLOTS;
+            if (!ci->simd_used[i] &&
+                instr_uses_reg(instr, DR_REG_P0 + (reg_id_t)reg_idx)) {
+                LOG(THREAD, LOG_CLEANCALL, 2,
+                    "CLEANCALL: callee " PFX " uses P%d at " PFX "\n", ci->start,
+                    reg_idx, instr_get_app_pc(instr));
+                ci->simd_used[i] = true;
+                ci->num_simd_used++;
+            }
+        }
+
+        /* SVE FFR register usage */
+        const uint ffr_index = MCXT_NUM_SIMD_SVE_SLOTS + MCXT_NUM_SVEP_SLOTS;
+        if (!ci->simd_used[ffr_index] && instr_uses_reg(instr, DR_REG_FFR)) {
+            LOG(THREAD, LOG_CLEANCALL, 2,
+                "CLEANCALL: callee " PFX " uses FFR at " PFX "\n", ci->start,
+                instr_get_app_pc(instr));
+            ci->simd_used[ffr_index] = true;
+            ci->num_simd_used++;
+        }
+    }
+}
+
 void
 analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
 {
@@ -212,44 +256,7 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
         }
 
         /* SIMD/SVE register usage. */
-        for (i = 0; i < MCXT_NUM_SIMD_SVE_SLOTS; i++) {
-            if (!ci->simd_used[i] &&
-                instr_uses_reg(instr,
-                               (proc_has_feature(FEATURE_SVE) ? DR_REG_Z0 : DR_REG_Q0) +
-                                   (reg_id_t)i)) {
-                LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: callee " PFX " uses VREG%d at " PFX "\n", ci->start, i,
-                    instr_get_app_pc(instr));
-                ci->simd_used[i] = true;
-                ci->num_simd_used++;
-            }
-        }
-
-        if (proc_has_feature(FEATURE_SVE)) {
-            /* SVE predicate register usage */
-            for (i = MCXT_NUM_SIMD_SVE_SLOTS;
-                 i < (MCXT_NUM_SIMD_SVE_SLOTS + MCXT_NUM_SVEP_SLOTS); i++) {
-                const uint reg_idx = i - MCXT_NUM_SIMD_SVE_SLOTS;
-                if (!ci->simd_used[i] &&
-                    instr_uses_reg(instr, DR_REG_P0 + (reg_id_t)reg_idx)) {
-                    LOG(THREAD, LOG_CLEANCALL, 2,
-                        "CLEANCALL: callee " PFX " uses P%d at " PFX "\n", ci->start,
-                        reg_idx, instr_get_app_pc(instr));
-                    ci->simd_used[i] = true;
-                    ci->num_simd_used++;
-                }
-            }
-
-            /* SVE FFR register usage */
-            const uint ffr_index = MCXT_NUM_SIMD_SVE_SLOTS + MCXT_NUM_SVEP_SLOTS;
-            if (!ci->simd_used[ffr_index] && instr_uses_reg(instr, DR_REG_FFR)) {
-                LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: callee " PFX " uses FFR at " PFX "\n", ci->start,
-                    instr_get_app_pc(instr));
-                ci->simd_used[ffr_index] = true;
-                ci->num_simd_used++;
-            }
-        }
+        analyze_callee_simd_instr(dcontext, ci, instr);
 
         /* NZCV register usage */
         if (!ci->write_flags &&
@@ -477,6 +484,8 @@ check_callee_ilist_inline(dcontext_t *dcontext, callee_info_t *ci)
         }
     }
     ASSERT(instr == NULL || opt_inline == false);
+    if (!opt_inline)
+        callee_info_reject_inline(ci, CALLEE_REJECT_STACK);
     return opt_inline;
 }
 
@@ -1499,7 +1499,7 @@ typedef byte slot_kind_t;
 
 /* If kind is:
  * SLOT_REG: value is a reg_id_t
- * SLOT_LOCAL: value is meaningless, may change to support multiple locals
+ * SLOT_LOCAL: value is the index of the stack location, in order of first access
  * SLOT_FLAGS: value is meaningless
  */
 typedef struct _slot_t {
@@ -1507,6 +1507,25 @@ typedef struct _slot_t {
     reg_id_t value;
 } slot_t;
 
+/* The first reason found for not inlining a callee, for logging and stats. */
+enum {
+    CALLEE_REJECT_NONE = 0,
+    CALLEE_REJECT_OPTION,   /* -opt_cleancall is below 2 */
+    CALLEE_REJECT_DECODE,   /* crash or invalid instruction while decoding */
+    CALLEE_REJECT_CALL,     /* calls other routines */
+    CALLEE_REJECT_SYSCALL,  /* system call or interrupt */
+    CALLEE_REJECT_INDIRECT, /* indirect branch other than a return */
+    CALLEE_REJECT_BRANCH,   /* direct branch we cannot follow or rewrite */
+    CALLEE_REJECT_LOOP,     /* backward branch */
+    CALLEE_REJECT_SIZE,     /* too many instructions */
+    CALLEE_REJECT_SIMD,     /* uses [xyz]mm or mask registers */
+    CALLEE_REJECT_TLS,      /* accesses the app's TLS */
+    CALLEE_REJECT_SLOTS,    /* not enough scratch slots */
+    CALLEE_REJECT_STACK,    /* stack usage we cannot rewrite */
+    CALLEE_REJECT_LAST,
+};
+typedef byte callee_reject_t;
+
 /* data structure of clean call callee information. */
 typedef struct _callee_info_t {
     bool bailout;      /* if we bail out on function analysis */
@@ -1514,12 +1533,20 @@ typedef struct _callee_info_t {
     int num_instrs;    /* total number of instructions of a function */
     app_pc start;      /* entry point of a function  */
     app_pc bwd_tgt;    /* earliest backward branch target */
-    app_pc fwd_tgt;    /* last forward branch target */
+    app_pc fwd_tgt;    /* last forward branch target of the current routine */
+    /* Start of the routine being decoded: start, or a routine tail-called from it. */
+    app_pc routine_start;
+    uint num_tail_calls; /* number of tail calls followed while decoding */
+    uint num_exits;      /* number of returns */
     int num_simd_used; /* number of SIMD registers (xmms) used by callee */
     /* SIMD ([xyz]mm) registers usage. Part of the array might be left
      * uninitialized if proc_num_simd_registers() < MCXT_NUM_SIMD_SLOTS.
      */
     bool simd_used[MCXT_NUM_SIMD_SLOTS];
+    /* if analyze_callee_simd_usage() found the SIMD registers used by a callee
+     * which bailed out of the full analysis
+     */
+    bool simd_scanned;
 #ifdef X86
     int num_opmask_used; /* number of mask registers used by callee */
     /* AVX-512 mask register usage. */
@@ -1531,6 +1558,7 @@ typedef struct _callee_info_t {
     bool has_locals;                        /* if reference local via stack */
     bool standard_fp;   /* if standard reg (xbp/x29) is used as frame pointer */
     bool opt_inline;    /* can be inlined or not */
+    callee_reject_t inline_reject; /* why it cannot be inlined */
     bool write_flags;   /* if the function changes flags */
     bool read_flags;    /* if the function reads flags from caller */
     bool tls_used;      /* application accesses TLS (errno, etc.) */
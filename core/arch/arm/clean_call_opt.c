@@ -41,6 +41,12 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
     ASSERT_NOT_IMPLEMENTED(false); /* FIXME i#2094: NYI on ARM */
 }
 
+void
+analyze_callee_simd_instr(dcontext_t *dcontext, callee_info_t *ci, instr_t *instr)
+{
+    ASSERT_NOT_IMPLEMENTED(false); /* FIXME i#2094: NYI on ARM */
+}
+
 void
 analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
 {
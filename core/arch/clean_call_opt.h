@@ -45,6 +45,10 @@ callee_info_reserve_slot(callee_info_t *ci, slot_kind_t kind, reg_id_t value);
 opnd_t
 callee_info_slot_opnd(callee_info_t *ci, slot_kind_t kind, reg_id_t value);
 
+/* Records reason as why ci cannot be inlined, unless a reason was already found. */
+void
+callee_info_reject_inline(callee_info_t *ci, callee_reject_t reason);
+
 /****************************************************************************
  * Functions implemented in arch-specific clean_call_opt.c.
  */
@@ -52,6 +56,12 @@ callee_info_slot_opnd(callee_info_t *ci, slot_kind_t kind, reg_id_t value);
 void
 analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci);
 
+/* Marks the SIMD registers (and mask registers on x86) read or written by instr,
+ * including implicitly, as used by ci.
+ */
+void
+analyze_callee_simd_instr(dcontext_t *dcontext, callee_info_t *ci, instr_t *instr);
+
 void
 analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci);
 
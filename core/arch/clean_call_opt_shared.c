@@ -85,9 +85,34 @@ callee_info_init(callee_info_t *ci)
     ci->spill_reg = DR_REG_INVALID;
 }
 
+#ifdef DEBUG
+static const char *const callee_reject_names[] = {
+    "none",
+    "opt_cleancall is below 2",
+    "undecodable instruction",
+    "calls out",
+    "system call",
+    "indirect branch",
+    "unsupported branch",
+    "loop",
+    "too many instructions",
+    "uses SIMD registers",
+    "accesses TLS",
+    "not enough scratch slots",
+    "unsupported stack usage",
+};
+#endif
+
 static void
 callee_info_free(dcontext_t *dcontext, callee_info_t *ci)
 {
+    DOLOG(1, LOG_CLEANCALL, {
+        if (callee_info_table_exit && !ci->opt_inline) {
+            ASSERT(ci->inline_reject < CALLEE_REJECT_LAST);
+            LOG(GLOBAL, LOG_CLEANCALL, 1, "CLEANCALL: callee " PFX " not inlined: %s\n",
+                ci->start, callee_reject_names[ci->inline_reject]);
+        }
+    });
     if (ci->ilist != NULL) {
         ASSERT(ci->opt_inline);
         instrlist_clear_and_destroy(GLOBAL_DCONTEXT, ci->ilist);
@@ -125,6 +150,34 @@ callee_info_reserve_slot(callee_info_t *ci, slot_kind_t kind, reg_id_t value)
     ci->slots_used++;
 }
 
+void
+callee_info_reject_inline(callee_info_t *ci, callee_reject_t reason)
+{
+    if (ci->inline_reject == CALLEE_REJECT_NONE)
+        ci->inline_reject = reason;
+}
+
+static void
+callee_info_count_reject(callee_info_t *ci)
+{
+    STATS_INC(cleancall_inline_rejected);
+    switch (ci->inline_reject) {
+    case CALLEE_REJECT_OPTION: STATS_INC(cleancall_reject_option); break;
+    case CALLEE_REJECT_DECODE: STATS_INC(cleancall_reject_decode); break;
+    case CALLEE_REJECT_CALL: STATS_INC(cleancall_reject_call); break;
+    case CALLEE_REJECT_SYSCALL: STATS_INC(cleancall_reject_syscall); break;
+    case CALLEE_REJECT_INDIRECT: STATS_INC(cleancall_reject_indirect); break;
+    case CALLEE_REJECT_BRANCH: STATS_INC(cleancall_reject_branch); break;
+    case CALLEE_REJECT_LOOP: STATS_INC(cleancall_reject_loop); break;
+    case CALLEE_REJECT_SIZE: STATS_INC(cleancall_reject_size); break;
+    case CALLEE_REJECT_SIMD: STATS_INC(cleancall_reject_simd); break;
+    case CALLEE_REJECT_TLS: STATS_INC(cleancall_reject_tls); break;
+    case CALLEE_REJECT_SLOTS: STATS_INC(cleancall_reject_slots); break;
+    case CALLEE_REJECT_STACK: STATS_INC(cleancall_reject_stack); break;
+    default: break;
+    }
+}
+
 opnd_t
 callee_info_slot_opnd(callee_info_t *ci, slot_kind_t kind, reg_id_t value)
 {
@@ -202,6 +255,8 @@ callee_info_table_add(callee_info_t *ci)
 
 /* The max number of instructions the callee can have for inline. */
 #define MAX_NUM_INLINE_INSTRS 20
+/* The max number of tail calls to follow while decoding the callee. */
+#define MAX_NUM_TAIL_CALLS 2
 
 /* Decode instruction from callee and return the next_pc to be decoded. */
 static app_pc
@@ -221,12 +276,14 @@ decode_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc instr_pc)
               "CLEANCALL: crash on decoding callee instruction at: " PFX "\n", instr_pc);
           ASSERT_CURIOSITY(false && "crashed while decoding clean call");
           ci->bailout = true;
+          callee_info_reject_inline(ci, CALLEE_REJECT_DECODE);
           return NULL;
         });
     if (!instr_valid(instr)) {
         LOG(THREAD, LOG_CLEANCALL, 2,
             "CLEANCALL: decoding invalid instruction at: " PFX "\n", instr_pc);
         ci->bailout = true;
+        callee_info_reject_inline(ci, CALLEE_REJECT_DECODE);
         return NULL;
     }
     instr_set_translation(instr, instr_pc);
@@ -234,6 +291,52 @@ decode_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc instr_pc)
     return next_pc;
 }
 
+#ifdef X86
+/* Follows a jump to code not yet decoded which no branch in the current routine
+ * targets anything beyond, as compilers emit for tail calls, by decoding its
+ * target next.  The jump is replaced by a label for branches to it to target.
+ */
+static app_pc
+check_callee_tail_call(dcontext_t *dcontext, callee_info_t *ci, instr_t *jmp,
+                       app_pc cur_pc, app_pc tgt_pc)
+{
+    instr_t *instr, *label;
+
+    for (instr = instrlist_first(ci->ilist); instr != NULL;
+         instr = instr_get_next(instr)) {
+        app_pc pc = instr_get_app_pc(instr);
+        if (!instr_is_label(instr) && tgt_pc >= pc &&
+            tgt_pc < pc + instr_length(dcontext, instr)) {
+            LOG(THREAD, LOG_CLEANCALL, 2,
+                "CLEANCALL: bail out on jump back into the callee at: " PFX
+                " to " PFX "\n",
+                cur_pc, tgt_pc);
+            ci->bailout = true;
+            callee_info_reject_inline(ci, CALLEE_REJECT_BRANCH);
+            return NULL;
+        }
+    }
+    if (ci->num_tail_calls >= MAX_NUM_TAIL_CALLS) {
+        LOG(THREAD, LOG_CLEANCALL, 2,
+            "CLEANCALL: bail out on too many tail calls at: " PFX "\n", cur_pc);
+        ci->bailout = true;
+        callee_info_reject_inline(ci, CALLEE_REJECT_BRANCH);
+        return NULL;
+    }
+    LOG(THREAD, LOG_CLEANCALL, 2,
+        "CLEANCALL: following tail call at: " PFX " to " PFX "\n", cur_pc, tgt_pc);
+    label = INSTR_CREATE_label(GLOBAL_DCONTEXT);
+    instr_set_translation(label, cur_pc);
+    instrlist_replace(ci->ilist, jmp, label);
+    instr_destroy(GLOBAL_DCONTEXT, jmp);
+    ci->num_instrs--;
+    ci->num_tail_calls++;
+    ci->routine_start = tgt_pc;
+    ci->fwd_tgt = NULL;
+    return tgt_pc;
+}
+#endif
+
 /* check newly decoded instruction from callee */
 static app_pc
 check_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc next_pc)
@@ -247,22 +350,52 @@ check_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc next_pc)
     instr = instrlist_last(ilist);
     cur_pc = instr_get_app_pc(instr);
     ASSERT(next_pc == cur_pc + instr_length(dcontext, instr));
+    if (ci->num_tail_calls > 0 && ci->num_instrs > MAX_NUM_INLINE_INSTRS) {
+        /* We only follow tail calls to find small callees to inline. */
+        LOG(THREAD, LOG_CLEANCALL, 2,
+            "CLEANCALL: bail out on long tail-called routine at: " PFX "\n", cur_pc);
+        ci->bailout = true;
+        callee_info_reject_inline(ci, CALLEE_REJECT_SIZE);
+        return NULL;
+    }
     if (!instr_is_cti(instr)) {
         /* special instructions, bail out. */
         if (instr_is_syscall(instr) || instr_is_interrupt(instr)) {
             LOG(THREAD, LOG_CLEANCALL, 2,
                 "CLEANCALL: bail out on syscall or interrupt at: " PFX "\n", cur_pc);
             ci->bailout = true;
+            callee_info_reject_inline(ci, CALLEE_REJECT_SYSCALL);
             return NULL;
         }
+        if (instr_is_nop(instr) && instr_get_prev(instr) != NULL &&
+            instr_is_return(instr_get_prev(instr))) {
+            /* Drop the padding after an early return, which nothing targets. */
+            instrlist_remove(ilist, instr);
+            instr_destroy(GLOBAL_DCONTEXT, instr);
+            ci->num_instrs--;
+        }
         return next_pc;
     } else { /* cti instruc */
         if (instr_is_mbr(instr)) {
-            /* check if instr is return, and if return is the last instr. */
-            if (!instr_is_return(instr) || ci->fwd_tgt > cur_pc) {
+            if (!instr_is_return(instr)) {
                 LOG(THREAD, LOG_CLEANCALL, 2,
                     "CLEANCALL: bail out on indirect branch at: " PFX "\n", cur_pc);
                 ci->bailout = true;
+                callee_info_reject_inline(ci, CALLEE_REJECT_INDIRECT);
+                return NULL;
+            }
+            ci->num_exits++;
+            /* Check if the return is the last instr. */
+            if (ci->fwd_tgt > cur_pc) {
+#ifdef X86
+                /* A forward branch skips this return: keep going. */
+                return next_pc;
+#else
+                LOG(THREAD, LOG_CLEANCALL, 2,
+                    "CLEANCALL: bail out on early return at: " PFX "\n", cur_pc);
+                ci->bailout = true;
+                callee_info_reject_inline(ci, CALLEE_REJECT_BRANCH);
+#endif
             }
             return NULL;
         } else if (instr_is_call(instr)) {
@@ -281,17 +414,28 @@ check_callee_instr(dcontext_t *dcontext, callee_info_t *ci, app_pc next_pc)
              * 2. call pic_func;
              *    and in pic_func: mov [%xsp] %r1; ret;
              */
-            if (INTERNAL_OPTION(opt_cleancall) >= 1)
-                return check_callee_instr_level2(dcontext, ci, next_pc, cur_pc, tgt_pc);
+            if (INTERNAL_OPTION(opt_cleancall) >= 1) {
+                next_pc =
+                    check_callee_instr_level2(dcontext, ci, next_pc, cur_pc, tgt_pc);
+            }
+            if (ci->bailout)
+                callee_info_reject_inline(ci, CALLEE_REJECT_CALL);
+            return next_pc;
         } else { /* ubr or cbr */
             tgt_pc = opnd_get_pc(instr_get_target(instr));
+#ifdef X86
+            if (instr_is_ubr(instr) && (ci->fwd_tgt == NULL || ci->fwd_tgt <= cur_pc) &&
+                (tgt_pc < ci->routine_start || tgt_pc >= next_pc))
+                return check_callee_tail_call(dcontext, ci, instr, cur_pc, tgt_pc);
+#endif
             if (tgt_pc < cur_pc) { /* backward branch */
-                if (tgt_pc < ci->start) {
+                if (tgt_pc < ci->routine_start) {
                     LOG(THREAD, LOG_CLEANCALL, 2,
                         "CLEANCALL: bail out on out-of-range branch at: " PFX "to " PFX
                         "\n",
                         cur_pc, tgt_pc);
                     ci->bailout = true;
+                    callee_info_reject_inline(ci, CALLEE_REJECT_BRANCH);
                     return NULL;
                 } else if (ci->bwd_tgt == NULL || tgt_pc < ci->bwd_tgt) {
                     ci->bwd_tgt = tgt_pc;
@@ -320,7 +464,7 @@ check_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
         /* must be RETURN, otherwise, bugs in decode_callee_ilist */
         ASSERT(instr_is_return(ret));
         for (cti = instrlist_first(ilist); cti != ret; cti = instr_get_next(cti)) {
-            if (!instr_is_cti(cti))
+            if (!instr_is_cti(cti) || instr_is_return(cti))
                 continue;
             ASSERT(!instr_is_mbr(cti));
             tgt_pc = opnd_get_pc(instr_get_target(cti));
@@ -335,6 +479,7 @@ check_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
                     "\n",
                     instr_get_app_pc(cti), tgt_pc);
                 ci->bailout = true;
+                callee_info_reject_inline(ci, CALLEE_REJECT_BRANCH);
                 break;
             }
         }
@@ -359,6 +504,7 @@ decode_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
     LOG(THREAD, LOG_CLEANCALL, 2, "CLEANCALL: decoding callee starting at: " PFX "\n",
         ci->start);
     ci->bailout = false;
+    ci->routine_start = ci->start;
     while (cur_pc != NULL) {
         cur_pc = decode_callee_instr(dcontext, ci, cur_pc);
         cur_pc = check_callee_instr(dcontext, ci, cur_pc);
@@ -366,6 +512,116 @@ decode_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
     check_callee_ilist(dcontext, ci);
 }
 
+/* The limits on the code examined by analyze_callee_simd_usage(). */
+#define MAX_NUM_SIMD_SCAN_INSTRS 1024
+#define MAX_NUM_SIMD_SCAN_BLOCKS 64
+#define MAX_SIMD_SCAN_CALL_DEPTH 4
+
+static bool
+simd_scan_add_block(app_pc *blocks, uint *depths, uint *num_blocks, app_pc pc,
+                    uint depth)
+{
+    uint i;
+    for (i = 0; i < *num_blocks; i++) {
+        if (blocks[i] == pc)
+            return true;
+    }
+    if (*num_blocks >= MAX_NUM_SIMD_SCAN_BLOCKS)
+        return false;
+    blocks[*num_blocks] = pc;
+    depths[*num_blocks] = depth;
+    (*num_blocks)++;
+    return true;
+}
+
+/* For a callee which could not be analyzed in full, typically because it calls
+ * other routines, finds the SIMD registers used by the callee and by the routines
+ * it calls directly, following every direct branch and call.  Leaves all
+ * registers marked as used and returns false if any code reached cannot be
+ * followed: indirect branches other than returns (including calls through a PLT),
+ * system calls, calls into DR itself (which might read the mcontext), or more
+ * code than the limits above.
+ */
+static bool
+analyze_callee_simd_usage(dcontext_t *dcontext, callee_info_t *ci)
+{
+    app_pc blocks[MAX_NUM_SIMD_SCAN_BLOCKS];
+    uint depths[MAX_NUM_SIMD_SCAN_BLOCKS];
+    uint num_blocks = 0, next_block = 0, num_instrs = 0;
+    bool ok = true;
+    app_pc start = ci->start;
+    instr_t instr;
+
+    ci->num_simd_used = 0;
+    memset(ci->simd_used, 0, sizeof(ci->simd_used));
+#ifdef X86
+    ci->num_opmask_used = 0;
+    memset(ci->opmask_used, 0, sizeof(ci->opmask_used));
+#endif
+    simd_scan_add_block(blocks, depths, &num_blocks, ci->start, 0);
+    instr_init(GLOBAL_DCONTEXT, &instr);
+    while (ok && next_block < num_blocks) {
+        app_pc pc = blocks[next_block];
+        uint depth = depths[next_block];
+        next_block++;
+        while (true) {
+            app_pc cur_pc = pc, tgt_pc;
+            if (++num_instrs > MAX_NUM_SIMD_SCAN_INSTRS || is_in_dynamo_dll(cur_pc)) {
+                ok = false;
+                break;
+            }
+            instr_reset(GLOBAL_DCONTEXT, &instr);
+            TRY_EXCEPT(
+                dcontext, { pc = decode(GLOBAL_DCONTEXT, cur_pc, &instr); },
+                { /* EXCEPT */
+                  pc = NULL;
+                });
+            instr_set_translation(&instr, cur_pc);
+            if (pc == NULL || !instr_valid(&instr) || instr_is_syscall(&instr) ||
+                instr_is_interrupt(&instr)) {
+                ok = false;
+                break;
+            }
+            analyze_callee_simd_instr(dcontext, ci, &instr);
+            if (!instr_is_cti(&instr))
+                continue;
+            if (instr_is_return(&instr))
+                break;
+            if (instr_is_mbr(&instr) || !opnd_is_pc(instr_get_target(&instr))) {
+                ok = false;
+                break;
+            }
+            tgt_pc = opnd_get_pc(instr_get_target(&instr));
+            if (instr_is_call(&instr)) {
+                /* We assume the routine returns here. */
+                if (depth >= MAX_SIMD_SCAN_CALL_DEPTH ||
+                    !simd_scan_add_block(blocks, depths, &num_blocks, tgt_pc,
+                                         depth + 1))
+                    ok = false;
+            } else if (!simd_scan_add_block(blocks, depths, &num_blocks, tgt_pc, depth))
+                ok = false;
+            if (!ok || instr_is_ubr(&instr))
+                break;
+        }
+    }
+    instr_free(GLOBAL_DCONTEXT, &instr);
+    if (!ok) {
+        callee_reject_t reject = ci->inline_reject;
+        LOG(THREAD, LOG_CLEANCALL, 2,
+            "CLEANCALL: unable to find SIMD registers used by callee " PFX "\n",
+            ci->start);
+        callee_info_init(ci);
+        ci->start = start;
+        ci->inline_reject = reject;
+        return false;
+    }
+    LOG(THREAD, LOG_CLEANCALL, 2,
+        "CLEANCALL: callee " PFX " and its callees (%d blocks) use %d SIMD registers\n",
+        ci->start, num_blocks, ci->num_simd_used);
+    ci->simd_scanned = true;
+    return true;
+}
+
 /* Pick a register to use as a base register pointing to our spill slots.
  * We can't use a register that is:
  * - DR_XSP (need a valid stack in case of fault)
@@ -404,29 +660,50 @@ static void
 analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
 {
     bool opt_inline = true;
+    instr_t *instr;
+    int num_instrs = 0;
 
     /* a set of condition checks */
     if (INTERNAL_OPTION(opt_cleancall) < 2) {
         LOG(THREAD, LOG_CLEANCALL, 1,
             "CLEANCALL: callee " PFX " cannot be inlined: opt_cleancall: %d.\n",
             ci->start, INTERNAL_OPTION(opt_cleancall));
+        callee_info_reject_inline(ci, CALLEE_REJECT_OPTION);
         opt_inline = false;
     }
-    if (ci->num_instrs > MAX_NUM_INLINE_INSTRS) {
+    /* Count what is left after removing the frame setup and register saves. */
+    for (instr = instrlist_first(ci->ilist); instr != NULL;
+         instr = instr_get_next(instr)) {
+        if (!instr_is_label(instr))
+            num_instrs++;
+    }
+    if (num_instrs > MAX_NUM_INLINE_INSTRS) {
         LOG(THREAD, LOG_CLEANCALL, 1,
             "CLEANCALL: callee " PFX " cannot be inlined: num of instrs: %d.\n",
-            ci->start, ci->num_instrs);
+            ci->start, num_instrs);
+        callee_info_reject_inline(ci, CALLEE_REJECT_SIZE);
+        opt_inline = false;
+    }
+    if (ci->bwd_tgt != NULL) {
+        LOG(THREAD, LOG_CLEANCALL, 1,
+            "CLEANCALL: callee " PFX " cannot be inlined: has a loop.\n", ci->start);
+        callee_info_reject_inline(ci, CALLEE_REJECT_LOOP);
         opt_inline = false;
     }
-    if (ci->bwd_tgt != NULL || ci->fwd_tgt != NULL) {
+#ifndef X86
+    /* Only x86 rewrites the callee's forward branches for inlining. */
+    if (ci->fwd_tgt != NULL) {
         LOG(THREAD, LOG_CLEANCALL, 1,
             "CLEANCALL: callee " PFX " cannot be inlined: has control flow.\n",
             ci->start);
+        callee_info_reject_inline(ci, CALLEE_REJECT_BRANCH);
         opt_inline = false;
     }
+#endif
     if (ci->num_simd_used != 0) {
         LOG(THREAD, LOG_CLEANCALL, 1,
             "CLEANCALL: callee " PFX " cannot be inlined: uses SIMD.\n", ci->start);
+        callee_info_reject_inline(ci, CALLEE_REJECT_SIMD);
         opt_inline = false;
     }
 #ifdef X86
@@ -434,12 +711,14 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
         LOG(THREAD, LOG_CLEANCALL, 1,
             "CLEANCALL: callee " PFX " cannot be inlined: uses mask register.\n",
             ci->start);
+        callee_info_reject_inline(ci, CALLEE_REJECT_SIMD);
         opt_inline = false;
     }
 #endif
     if (ci->tls_used) {
         LOG(THREAD, LOG_CLEANCALL, 1,
             "CLEANCALL: callee " PFX " cannot be inlined: accesses TLS.\n", ci->start);
+        callee_info_reject_inline(ci, CALLEE_REJECT_TLS);
         opt_inline = false;
     }
     if (ci->spill_reg == DR_REG_INVALID) {
@@ -447,6 +726,7 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
             "CLEANCALL: callee " PFX " cannot be inlined:"
             " unable to pick spill reg.\n",
             ci->start);
+        callee_info_reject_inline(ci, CALLEE_REJECT_SLOTS);
         opt_inline = false;
     }
     if (!SCRATCH_ALWAYS_TLS() || ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
@@ -454,6 +734,7 @@ analyze_callee_inline(dcontext_t *dcontext, callee_info_t *ci)
             "CLEANCALL: callee " PFX " cannot be inlined:"
             " not enough scratch slots.\n",
             ci->start);
+        callee_info_reject_inline(ci, CALLEE_REJECT_SLOTS);
         opt_inline = false;
     }
     if (!opt_inline) {
@@ -489,6 +770,7 @@ analyze_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
     }
     analyze_callee_regs_usage(dcontext, ci);
     if (INTERNAL_OPTION(opt_cleancall) < 1) {
+        callee_info_reject_inline(ci, CALLEE_REJECT_OPTION);
         instrlist_clear_and_destroy(GLOBAL_DCONTEXT, ci->ilist);
         ci->ilist = NULL;
     } else {
@@ -499,12 +781,11 @@ analyze_callee_ilist(dcontext_t *dcontext, callee_info_t *ci)
 }
 
 static void
-analyze_clean_call_regs(dcontext_t *dcontext, clean_call_info_t *cci)
+analyze_clean_call_simd(dcontext_t *dcontext, clean_call_info_t *cci)
 {
-    int i, num_regparm;
+    int i;
     callee_info_t *info = cci->callee_info;
 
-    /* 1. xmm registers */
     for (i = 0; i < proc_num_simd_registers(); i++) {
         if (info->simd_used[i]) {
             cci->simd_skip[i] = false;
@@ -529,6 +810,16 @@ analyze_clean_call_regs(dcontext_t *dcontext, clean_call_info_t *cci)
         }
     }
 #endif
+}
+
+static void
+analyze_clean_call_regs(dcontext_t *dcontext, clean_call_info_t *cci)
+{
+    int i, num_regparm;
+    callee_info_t *info = cci->callee_info;
+
+    /* 1. xmm registers */
+    analyze_clean_call_simd(dcontext, cci);
     if (INTERNAL_OPTION(opt_cleancall) > 2 &&
         cci->num_simd_skip != proc_num_simd_registers())
         cci->should_align = false;
@@ -719,10 +1010,16 @@ analyze_clean_call(dcontext_t *dcontext, clean_call_info_t *cci, instr_t *where,
             decode_callee_ilist(dcontext, ci);
             /* 4.3. analyze the instrlist */
             if (ci->bailout) {
+                callee_reject_t reject = ci->inline_reject;
                 callee_info_init(ci);
                 ci->start = (app_pc)callee;
+                ci->inline_reject = reject;
+                if (analyze_callee_simd_usage(dcontext, ci))
+                    STATS_INC(cleancall_simd_chain_analyzed);
             } else
                 analyze_callee_ilist(dcontext, ci);
+            if (!ci->opt_inline)
+                callee_info_count_reject(ci);
             /* 4.4. add info into callee list */
             ci = callee_info_table_add(ci);
         }
@@ -736,6 +1033,13 @@ analyze_clean_call(dcontext_t *dcontext, clean_call_info_t *cci, instr_t *where,
             analyze_clean_call_args(dcontext, cci, args);
             /* 8. inline optimization analysis */
             should_inline = analyze_clean_call_inline(dcontext, cci);
+        } else {
+            /* We still know which SIMD registers a callee with calls uses if
+             * analyze_callee_simd_usage() succeeded.
+             */
+            analyze_clean_call_simd(dcontext, cci);
+            if (cci->num_simd_skip == proc_num_simd_registers())
+                STATS_INC(cleancall_simd_skipped);
         }
     }
 
@@ -749,8 +1053,13 @@ analyze_clean_call(dcontext_t *dcontext, clean_call_info_t *cci, instr_t *where,
 #    define SIMD_SAVE_THRESHOLD 3
 #    define OPMASK_SAVE_THRESHOLD 3
 #    ifdef X64
-    /* Use out-of-line calls if more than 3 GP registers need to be saved. */
-#        define GPR_SAVE_THRESHOLD 3
+    /* Use out-of-line calls if more than 3 GP registers need to be saved, unless
+     * we know which SIMD registers a callee with calls uses: pushing the GPRs
+     * inline then costs far less than the out-of-line context switch, which saves
+     * every [xyz]mm register.
+     */
+#        define GPR_SAVE_THRESHOLD \
+            (((callee_info_t *)cci->callee_info)->simd_scanned ? DR_NUM_GPR_REGS : 3)
 #    else
     /* On X86, a single pusha instruction is used to save the GPRs, so we do not take
      * the number of GPRs that need saving into account.
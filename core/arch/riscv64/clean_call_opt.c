@@ -40,6 +40,13 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
     ASSERT_NOT_IMPLEMENTED(false);
 }
 
+void
+analyze_callee_simd_instr(dcontext_t *dcontext, callee_info_t *ci, instr_t *instr)
+{
+    /* FIXME i#3544: Not implemented */
+    ASSERT_NOT_IMPLEMENTED(false);
+}
+
 void
 analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
 {
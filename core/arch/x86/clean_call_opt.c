@@ -53,6 +53,63 @@
 #define POST instrlist_meta_postinsert
 #define PRE instrlist_meta_preinsert
 
+static void
+callee_info_mark_simd_used(dcontext_t *dcontext, callee_info_t *ci, instr_t *instr,
+                           int i)
+{
+    if (!ci->simd_used[i]) {
+        LOG(THREAD, LOG_CLEANCALL, 2, "CLEANCALL: callee " PFX " uses XMM%d at " PFX "\n",
+            ci->start, i, instr_get_app_pc(instr));
+        ci->simd_used[i] = true;
+        ci->num_simd_used++;
+    }
+}
+
+void
+analyze_callee_simd_instr(dcontext_t *dcontext, callee_info_t *ci, instr_t *instr)
+{
+    int i;
+    int opc = instr_get_opcode(instr);
+    if (opc == OP_vzeroupper || opc == OP_vzeroall) {
+        /* These have no operands but clobber (the upper parts of) every register
+         * with a VEX encoding.
+         */
+        for (i = 0; i < proc_num_simd_sse_avx_registers(); i++)
+            callee_info_mark_simd_used(dcontext, ci, instr, i);
+        return;
+    }
+    if (opc == OP_fxrstor32 || opc == OP_fxrstor64 || opc == OP_xrstor32 ||
+        opc == OP_xrstor64 || opc == OP_xrstors32 || opc == OP_xrstors64) {
+        /* These do not list the registers they write. */
+        for (i = 0; i < proc_num_simd_registers(); i++)
+            callee_info_mark_simd_used(dcontext, ci, instr, i);
+        for (i = 0; i < proc_num_opmask_registers(); i++) {
+            if (!ci->opmask_used[i]) {
+                ci->opmask_used[i] = true;
+                ci->num_opmask_used++;
+            }
+        }
+        return;
+    }
+    for (i = 0; i < proc_num_simd_registers(); i++) {
+        if (!ci->simd_used[i] &&
+            (instr_uses_reg(instr, (DR_REG_START_XMM + (reg_id_t)i)) ||
+             instr_uses_reg(instr, (DR_REG_START_YMM + (reg_id_t)i)) ||
+             instr_uses_reg(instr, (DR_REG_START_ZMM + (reg_id_t)i))))
+            callee_info_mark_simd_used(dcontext, ci, instr, i);
+    }
+    for (i = 0; i < proc_num_opmask_registers(); i++) {
+        if (!ci->opmask_used[i] &&
+            instr_uses_reg(instr, (DR_REG_START_OPMASK + (reg_id_t)i))) {
+            LOG(THREAD, LOG_CLEANCALL, 2,
+                "CLEANCALL: callee " PFX " uses k%d at " PFX "\n", ci->start, i,
+                instr_get_app_pc(instr));
+            ci->opmask_used[i] = true;
+            ci->num_opmask_used++;
+        }
+    }
+}
+
 void
 analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
 {
@@ -76,29 +133,8 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
          * once for each clean call callee, it will have little performance
          * impact unless there are a lot of different clean call callees.
          */
-        /* XMM registers usage */
-        for (i = 0; i < proc_num_simd_registers(); i++) {
-            if (!ci->simd_used[i] &&
-                (instr_uses_reg(instr, (DR_REG_START_XMM + (reg_id_t)i)) ||
-                 instr_uses_reg(instr, (DR_REG_START_YMM + (reg_id_t)i)) ||
-                 instr_uses_reg(instr, (DR_REG_START_ZMM + (reg_id_t)i)))) {
-                LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: callee " PFX " uses XMM%d at " PFX "\n", ci->start, i,
-                    instr_get_app_pc(instr));
-                ci->simd_used[i] = true;
-                ci->num_simd_used++;
-            }
-        }
-        for (i = 0; i < proc_num_opmask_registers(); i++) {
-            if (!ci->opmask_used[i] &&
-                instr_uses_reg(instr, (DR_REG_START_OPMASK + (reg_id_t)i))) {
-                LOG(THREAD, LOG_CLEANCALL, 2,
-                    "CLEANCALL: callee " PFX " uses k%d at " PFX "\n", ci->start, i,
-                    instr_get_app_pc(instr));
-                ci->opmask_used[i] = true;
-                ci->num_opmask_used++;
-            }
-        }
+        /* XMM and mask registers usage */
+        analyze_callee_simd_instr(dcontext, ci, instr);
         /* General purpose registers */
         for (i = 0; i < DR_NUM_GPR_REGS; i++) {
             reg_id_t reg = DR_REG_XAX + (reg_id_t)i;
@@ -184,6 +220,57 @@ analyze_callee_regs_usage(dcontext_t *dcontext, callee_info_t *ci)
     }
 }
 
+/* The max number of returns before the last one whose epilogues we remove. */
+#define MAX_NUM_EARLY_RETURNS 4
+
+/* Finds the returns which are not at the end of the callee, returning their
+ * number, or a number larger than max if there are too many.
+ */
+static uint
+find_early_returns(callee_info_t *ci, instr_t **rets, uint max)
+{
+    instr_t *instr;
+    uint num = 0;
+    for (instr = instrlist_first(ci->ilist); instr != NULL;
+         instr = instr_get_next(instr)) {
+        if (instr_is_return(instr)) {
+            if (num == max)
+                return max + 1;
+            rets[num++] = instr;
+        }
+    }
+    return num;
+}
+
+/* Returns whether each of the early returns is preceded by the same epilogue
+ * instruction as the one at the end of the callee, like, or by a leave if
+ * allow_leave.
+ */
+static bool
+early_returns_match(instr_t **rets, uint num_rets, instr_t *like, bool allow_leave)
+{
+    uint i;
+    for (i = 0; i < num_rets; i++) {
+        instr_t *prev = instr_get_prev(rets[i]);
+        if (prev == NULL ||
+            (!instr_same(prev, like) &&
+             (!allow_leave || instr_get_opcode(prev) != OP_leave)))
+            return false;
+    }
+    return true;
+}
+
+static void
+remove_early_return_epilogues(callee_info_t *ci, instr_t **rets, uint num_rets)
+{
+    uint i;
+    for (i = 0; i < num_rets; i++) {
+        instr_t *prev = instr_get_prev(rets[i]);
+        instrlist_remove(ci->ilist, prev);
+        instr_destroy(GLOBAL_DCONTEXT, prev);
+    }
+}
+
 /* We use push/pop pattern to detect callee saved registers,
  * and assume that the code later won't change those saved value
  * on the stack.
@@ -193,6 +280,9 @@ analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
 {
     instrlist_t *ilist = ci->ilist;
     instr_t *top, *bot, *push_xbp, *pop_xbp, *instr, *enter, *leave;
+    /* Returns other than the last one, whose epilogues must match the last one. */
+    instr_t *rets[MAX_NUM_EARLY_RETURNS];
+    uint num_rets;
 
     ASSERT(ilist != NULL);
     ci->num_callee_save_regs = 0;
@@ -202,6 +292,7 @@ analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
         /* zero or one instruction only, no callee save */
         return;
     }
+    num_rets = find_early_returns(ci, rets, MAX_NUM_EARLY_RETURNS);
     /* 1. frame pointer usage analysis. */
     /* i#392-c#4: frame pointer code might be in the middle
      * 0xf771f390 <compiler_inscount>:      call   0xf7723a19 <get_pc_thunk>
@@ -236,7 +327,9 @@ analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
     /* Check enter/leave pair  */
     if (enter != NULL && leave != NULL &&
         (ci->bwd_tgt == NULL || instr_get_app_pc(enter) < ci->bwd_tgt) &&
-        (ci->fwd_tgt == NULL || instr_get_app_pc(leave) >= ci->fwd_tgt)) {
+        (ci->fwd_tgt == NULL || instr_get_app_pc(leave) >= ci->fwd_tgt) &&
+        num_rets <= MAX_NUM_EARLY_RETURNS &&
+        early_returns_match(rets, num_rets, pop_xbp, true)) {
         /* check if xbp is fp */
         if (instr_get_opcode(enter) == OP_enter) {
             ci->standard_fp = true;
@@ -278,6 +371,7 @@ analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
         instrlist_remove(ilist, leave);
         instr_destroy(GLOBAL_DCONTEXT, enter);
         instr_destroy(GLOBAL_DCONTEXT, leave);
+        remove_early_return_epilogues(ci, rets, num_rets);
         top = instrlist_first(ilist);
         bot = instrlist_last(ilist);
     }
@@ -291,7 +385,9 @@ analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
         /* if not in the first/last bb, break */
         if ((ci->bwd_tgt != NULL && instr_get_app_pc(top) >= ci->bwd_tgt) ||
             (ci->fwd_tgt != NULL && instr_get_app_pc(bot) < ci->fwd_tgt) ||
-            instr_is_cti(top) || instr_is_cti(bot))
+            instr_is_cti(top) || instr_is_cti(bot) || instr_is_label(top) ||
+            num_rets > MAX_NUM_EARLY_RETURNS ||
+            !early_returns_match(rets, num_rets, bot, false))
             break;
         /* XXX: I saw some compiler inserts nop, need to handle. */
         /* push/pop pair check */
@@ -312,6 +408,7 @@ analyze_callee_save_reg(dcontext_t *dcontext, callee_info_t *ci)
         instr_destroy(GLOBAL_DCONTEXT, top);
         instrlist_remove(ilist, bot);
         instr_destroy(GLOBAL_DCONTEXT, bot);
+        remove_early_return_epilogues(ci, rets, num_rets);
         /* get next pair */
         top = instrlist_first(ilist);
         bot = instrlist_last(ilist);
@@ -406,21 +503,192 @@ check_callee_instr_level2(dcontext_t *dcontext, callee_info_t *ci, app_pc next_p
         return next_pc;
 }
 
+/* The max number of distinct stack locations an inlined callee can access.  On
+ * 32-bit the only one is expected to be the argument, see insert_inline_arg_setup().
+ */
+#define MAX_NUM_INLINE_LOCALS IF_X64_ELSE(CLEANCALL_NUM_INLINE_SLOTS, 1)
+
+/* Finds the instruction a forward branch from cti to tgt_pc reaches: the first
+ * remaining instruction at or after tgt_pc in the same routine, as frame setup in
+ * between may have been removed.  That is the label left by a tail call if the
+ * branch leaves the routine that way, or NULL if it reaches the end of the callee.
+ */
+static instr_t *
+find_branch_target(instr_t *cti, app_pc tgt_pc)
+{
+    instr_t *instr;
+    for (instr = instr_get_next(cti); instr != NULL; instr = instr_get_next(instr)) {
+        if (instr_is_label(instr) || instr_get_app_pc(instr) >= tgt_pc)
+            return instr;
+    }
+    return NULL;
+}
+
+/* Rewrites the callee's control flow for inlining: branches target labels rather
+ * than callee pcs, returns jump to a label at the end, and short branches become
+ * near ones as the code between them grows.
+ */
+static bool
+rewrite_callee_branches(dcontext_t *dcontext, callee_info_t *ci)
+{
+    instr_t *instr, *next_instr, *tgt, *label, *exit_label = NULL;
+
+    /* Find all targets before adding or removing anything. */
+    for (instr = instrlist_first(ci->ilist); instr != NULL;
+         instr = instr_get_next(instr)) {
+        if (!instr_is_cti(instr) || instr_is_return(instr))
+            continue;
+        if (instr_is_cti_loop(instr)) {
+            LOG(THREAD, LOG_CLEANCALL, 1,
+                "CLEANCALL: callee " PFX " cannot be inlined: loop or jecxz at " PFX
+                ".\n",
+                ci->start, instr_get_app_pc(instr));
+            callee_info_reject_inline(ci, CALLEE_REJECT_BRANCH);
+            return false;
+        }
+        /* Backward branches prevent inlining before we get here. */
+        ASSERT(opnd_get_pc(instr_get_target(instr)) > instr_get_app_pc(instr));
+        instr_set_note(instr,
+                       find_branch_target(instr, opnd_get_pc(instr_get_target(instr))));
+    }
+    for (instr = instrlist_first(ci->ilist); instr != NULL; instr = next_instr) {
+        next_instr = instr_get_next(instr);
+        if (!instr_is_cti(instr))
+            continue;
+        if (exit_label == NULL) {
+            exit_label = INSTR_CREATE_label(GLOBAL_DCONTEXT);
+            instrlist_append(ci->ilist, exit_label);
+        }
+        if (instr_is_return(instr)) {
+            label = INSTR_CREATE_jmp(GLOBAL_DCONTEXT, opnd_create_instr(exit_label));
+            instr_set_translation(label, instr_get_app_pc(instr));
+            instrlist_replace(ci->ilist, instr, label);
+            instr_destroy(GLOBAL_DCONTEXT, instr);
+            continue;
+        }
+        tgt = (instr_t *)instr_get_note(instr);
+        instr_set_note(instr, NULL);
+        if (tgt == NULL)
+            tgt = exit_label;
+        else if (!instr_is_label(tgt)) {
+            /* The label stays in place if tgt is removed as a stack adjustment. */
+            label = INSTR_CREATE_label(GLOBAL_DCONTEXT);
+            instrlist_preinsert(ci->ilist, tgt, label);
+            tgt = label;
+        }
+        if (instr_is_cti_short(instr))
+            convert_to_near_rel(dcontext, instr);
+        instr_set_target(instr, opnd_create_instr(tgt));
+    }
+    return true;
+}
+
+/* Returns whether the callee is left right after instr, skipping labels. */
+static bool
+callee_exits_after(callee_info_t *ci, instr_t *instr)
+{
+    instr_t *next = instr_get_next(instr);
+    while (next != NULL && instr_is_label(next) && next != instrlist_last(ci->ilist))
+        next = instr_get_next(next);
+    return next == NULL || next == instrlist_last(ci->ilist) ||
+        (instr_is_ubr(next) && opnd_is_instr(instr_get_target(next)) &&
+         opnd_get_instr(instr_get_target(next)) == instrlist_last(ci->ilist));
+}
+
+/* Replaces opnd, an access to a stack location of the callee, with a scratch
+ * slot, returning false if it cannot be.  Each distinct location gets its own
+ * slot, and locals holds the first access to each.
+ */
+static bool
+replace_callee_local(dcontext_t *dcontext, callee_info_t *ci, opnd_t *locals,
+                     uint *num_locals, opnd_t *opnd)
+{
+    int disp = opnd_get_disp(*opnd);
+    int size = (int)opnd_size_in_bytes(opnd_get_size(*opnd));
+    opnd_t slot;
+    uint i;
+    if (opnd_get_index(*opnd) != DR_REG_NULL || size > (int)sizeof(reg_t)) {
+        LOG(THREAD, LOG_CLEANCALL, 1,
+            "CLEANCALL: callee " PFX " cannot be inlined: "
+            "complicated stack location access.\n",
+            ci->start);
+        return false;
+    }
+    for (i = 0; i < *num_locals; i++) {
+        int local_disp = opnd_get_disp(locals[i]);
+        int local_size = (int)opnd_size_in_bytes(opnd_get_size(locals[i]));
+        if (opnd_same(*opnd, locals[i]))
+            break;
+        /* Different locations must not overlap. */
+        if (opnd_get_base(*opnd) != opnd_get_base(locals[i]) ||
+            (disp < local_disp + local_size && local_disp < disp + size)) {
+            LOG(THREAD, LOG_CLEANCALL, 1,
+                "CLEANCALL: callee " PFX " cannot be inlined: "
+                "overlapping stack locations are accessed.\n",
+                ci->start);
+            return false;
+        }
+    }
+    if (i == *num_locals) {
+        if (*num_locals == MAX_NUM_INLINE_LOCALS) {
+            LOG(THREAD, LOG_CLEANCALL, 1,
+                "CLEANCALL: callee " PFX " cannot be inlined: "
+                "more than %d stack locations are accessed.\n",
+                ci->start, MAX_NUM_INLINE_LOCALS);
+            return false;
+        }
+        callee_info_reserve_slot(ci, SLOT_LOCAL, (reg_id_t)i);
+        if (ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
+            LOG(THREAD, LOG_CLEANCALL, 1,
+                "CLEANCALL: callee " PFX " cannot be inlined: "
+                "not enough slots for local.\n",
+                ci->start);
+            callee_info_reject_inline(ci, CALLEE_REJECT_SLOTS);
+            return false;
+        }
+        locals[(*num_locals)++] = *opnd;
+        ci->has_locals = true;
+    }
+    /* replace the stack location with the scratch slot. */
+    slot = callee_info_slot_opnd(ci, SLOT_LOCAL, (reg_id_t)i);
+    opnd_set_size(&slot, opnd_get_size(*opnd));
+    *opnd = slot;
+    return true;
+}
+
+static bool
+opnd_is_callee_local(callee_info_t *ci, opnd_t opnd)
+{
+    return opnd_is_base_disp(opnd) &&
+        (opnd_get_base(opnd) == DR_REG_XSP ||
+         (opnd_get_base(opnd) == DR_REG_XBP && ci->standard_fp));
+}
+
 bool
 check_callee_ilist_inline(dcontext_t *dcontext, callee_info_t *ci)
 {
-    instr_t *instr, *next_instr;
-    opnd_t opnd, mem_ref, slot;
-    bool opt_inline = true;
+    instr_t *instr, *next_instr, *tail_call = NULL;
+    opnd_t opnd, locals[MAX_NUM_INLINE_LOCALS];
+    uint num_locals = 0;
+    bool opt_inline = true, in_tail_call = false;
     int i;
     /* Now we need scan instructions in the list,
      * check if possible for inline, and convert memory reference
      */
-    mem_ref = opnd_create_null();
     ci->has_locals = false;
+    /* The only labels so far are those left by following tail calls. */
+    for (instr = instrlist_first(ci->ilist); instr != NULL && tail_call == NULL;
+         instr = instr_get_next(instr)) {
+        if (instr_is_label(instr))
+            tail_call = instr;
+    }
+    if (!rewrite_callee_branches(dcontext, ci))
+        return false;
     for (instr = instrlist_first(ci->ilist); instr != NULL; instr = next_instr) {
         uint opc = instr_get_opcode(instr);
         next_instr = instr_get_next(instr);
+        if (instr == tail_call)
+            in_tail_call = true;
         /* sanity checks on stack usage */
         if (instr_writes_to_reg(instr, DR_REG_XBP, DR_QUERY_INCLUDE_ALL) &&
             ci->standard_fp) {
@@ -436,8 +704,10 @@ check_callee_ilist_inline(dcontext_t *dcontext, callee_info_t *ci)
              * xsp + imm_int => xsp
              * xsp - imm_int => xsp
              */
-            if (ci->has_locals) {
-                /* we do not allow stack adjustment after accessing the stack */
+            if (ci->has_locals && !callee_exits_after(ci, instr)) {
+                /* We do not allow stack adjustment after accessing the stack,
+                 * other than tearing down the frame before a return.
+                 */
                 opt_inline = false;
             }
             if (opc == OP_lea) {
@@ -492,43 +762,19 @@ check_callee_ilist_inline(dcontext_t *dcontext, callee_info_t *ci)
                 break;
             }
         }
-        /* Check how many stack variables the callee has.
-         * We will not inline the callee if it has more than one stack variable.
+        /* Map each stack location the callee accesses to a scratch slot.  Those
+         * of a tail-called routine are relative to a different stack pointer, so
+         * we do not try.
          */
         if (instr_reads_memory(instr)) {
             for (i = 0; i < instr_num_srcs(instr); i++) {
                 opnd = instr_get_src(instr, i);
-                if (!opnd_is_base_disp(opnd))
+                if (!opnd_is_callee_local(ci, opnd))
                     continue;
-                if (opnd_get_base(opnd) != DR_REG_XSP &&
-                    (opnd_get_base(opnd) != DR_REG_XBP || !ci->standard_fp))
-                    continue;
-                if (!ci->has_locals) {
-                    /* We see the first one, remember it. */
-                    mem_ref = opnd;
-                    callee_info_reserve_slot(ci, SLOT_LOCAL, 0);
-                    if (ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
-                        LOG(THREAD, LOG_CLEANCALL, 1,
-                            "CLEANCALL: callee " PFX " cannot be inlined: "
-                            "not enough slots for local.\n",
-                            ci->start);
-                        break;
-                    }
-                    ci->has_locals = true;
-                } else if (!opnd_same(opnd, mem_ref)) {
-                    /* Check if it is the same stack var as the one we saw.
-                     * If different, no inline.
-                     */
-                    LOG(THREAD, LOG_CLEANCALL, 1,
-                        "CLEANCALL: callee " PFX " cannot be inlined: "
-                        "more than one stack location is accessed " PFX ".\n",
-                        ci->start, instr_get_app_pc(instr));
+                if (in_tail_call ||
+                    !replace_callee_local(dcontext, ci, locals, &num_locals, &opnd))
                     break;
-                }
-                /* replace the stack location with the scratch slot. */
-                slot = callee_info_slot_opnd(ci, SLOT_LOCAL, 0);
-                opnd_set_size(&slot, opnd_get_size(mem_ref));
-                instr_set_src(instr, i, slot);
+                instr_set_src(instr, i, opnd);
             }
             if (i != instr_num_srcs(instr)) {
                 opt_inline = false;
@@ -538,34 +784,12 @@ check_callee_ilist_inline(dcontext_t *dcontext, callee_info_t *ci)
         if (instr_writes_memory(instr)) {
             for (i = 0; i < instr_num_dsts(instr); i++) {
                 opnd = instr_get_dst(instr, i);
-                if (!opnd_is_base_disp(opnd))
+                if (!opnd_is_callee_local(ci, opnd))
                     continue;
-                if (opnd_get_base(opnd) != DR_REG_XSP &&
-                    (opnd_get_base(opnd) != DR_REG_XBP || !ci->standard_fp))
-                    continue;
-                if (!ci->has_locals) {
-                    mem_ref = opnd;
-                    callee_info_reserve_slot(ci, SLOT_LOCAL, 0);
-                    if (ci->slots_used > CLEANCALL_NUM_INLINE_SLOTS) {
-                        LOG(THREAD, LOG_CLEANCALL, 1,
-                            "CLEANCALL: callee " PFX " cannot be inlined: "
-                            "not enough slots for local.\n",
-                            ci->start);
-                        break;
-                    }
-                    ci->has_locals = true;
-                } else if (!opnd_same(opnd, mem_ref)) {
-                    /* currently we only allows one stack refs */
-                    LOG(THREAD, LOG_CLEANCALL, 1,
-                        "CLEANCALL: callee " PFX " cannot be inlined: "
-                        "more than one stack location is accessed " PFX ".\n",
-                        ci->start, instr_get_app_pc(instr));
+                if (in_tail_call ||
+                    !replace_callee_local(dcontext, ci, locals, &num_locals, &opnd))
                     break;
-                }
-                /* replace the stack location with the scratch slot. */
-                slot = callee_info_slot_opnd(ci, SLOT_LOCAL, 0);
-                opnd_set_size(&slot, opnd_get_size(mem_ref));
-                instr_set_dst(instr, i, slot);
+                instr_set_dst(instr, i, opnd);
             }
             if (i != instr_num_dsts(instr)) {
                 opt_inline = false;
@@ -574,8 +798,10 @@ check_callee_ilist_inline(dcontext_t *dcontext, callee_info_t *ci)
         }
     }
 
-    if (instr != NULL)
+    if (instr != NULL) {
+        callee_info_reject_inline(ci, CALLEE_REJECT_STACK);
         opt_inline = false;
+    }
     return opt_inline;
 }
 
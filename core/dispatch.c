@@ -880,6 +880,19 @@ dispatch_enter_dynamorio(dcontext_t *dcontext)
                         LOG(THREAD, LOG_INTERP, 3, "adjusted shifted-coarse tag to %p\n",
                             dcontext->next_tag);
                     }
+                    /* The shifted unit's trace head prefix also goes through the
+                     * fcache return, so recover the trace head exit here or the
+                     * head is never marked and every hit comes back to us.
+                     */
+                    if (info->frozen && info->mod_shift != 0 &&
+                        !DYNAMO_OPTION(disable_traces)) {
+                        cache_pc stub = coarse_stub_lookup_by_target(dcontext, info,
+                                                                     dcontext->next_tag);
+                        if (stub != NULL && coarse_is_trace_head(stub)) {
+                            dcontext->last_exit = (linkstub_t *)
+                                get_coarse_trace_head_exit_linkstub();
+                        }
+                    }
                 }
             }
         }
@@ -336,6 +336,8 @@ static client_lib_t client_libs[MAX_CLIENT_LIBS] = { {
 static size_t num_client_libs = 0;
 
 static void *persist_user_data[MAX_CLIENT_LIBS];
+/* Hash of the client paths and options, computed once the clients are loaded. */
+static uint persist_client_hash;
 
 #ifdef WINDOWS
 /* private kernel32 lib, used to print to console */
@@ -641,6 +643,23 @@ add_client_lib(const char *path, const char *id_str, const char *options)
     }
 }
 
+/* Returns a hash of the client libraries and their options, or 0 if there are no
+ * clients.  See instrument_persist_ro_size() for how pcaches use it.
+ */
+static uint
+compute_persist_client_hash(void)
+{
+    uint hash = 0;
+    size_t i;
+    for (i = 0; i < num_client_libs; i++) {
+        /* Order matters, as for the path list in the pcache. */
+        hash = (hash << 1 | hash >> 31) ^
+            d_r_crc32(client_libs[i].path, (uint)strlen(client_libs[i].path));
+        hash ^= d_r_crc32(client_libs[i].options, (uint)strlen(client_libs[i].options));
+    }
+    return hash;
+}
+
 void
 instrument_load_client_libs(void)
 {
@@ -691,6 +710,7 @@ instrument_load_client_libs(void)
             add_client_lib(path, id, options);
             path = next_path;
         } while (path != NULL);
+        persist_client_hash = compute_persist_client_hash();
     }
 }
 
@@ -7552,6 +7572,13 @@ dr_get_stats(dr_stats_t *drstats)
  * PERSISTENCE
  */
 
+/* Returns 0 if there are no clients. */
+uint
+instrument_persist_hash(void)
+{
+    return persist_client_hash;
+}
+
 /* Up to caller to synchronize. */
 uint
 instrument_persist_ro_size(dcontext_t *dcontext, void *perscxt, size_t file_offs)
@@ -7569,10 +7596,12 @@ instrument_persist_ro_size(dcontext_t *dcontext, void *perscxt, size_t file_offs
      * XXX: we could go further and store client library checksum, etc. hashes,
      * but that precludes clients from doing their own proper versioning.
      *
-     * XXX: we could also put the set of clients into the pcache namespace to allow
-     * simultaneous use of pcaches with different sets of clients (empty set
-     * vs under tool, in particular): but doesn't really seem useful enough
-     * for the trouble
+     * The paths do not cover client options, which commonly select different
+     * instrumentation, so the header also holds instrument_persist_hash() of the
+     * paths and options.  It is only a hash of what the user passed, not of the
+     * client's contents, so clients still do their own versioning.  It is also
+     * part of the pcache namespace, so pcaches for different sets of clients
+     * (empty set vs under tool, in particular) coexist.
      */
     for (i = 0; i < num_client_libs; i++) {
         sz += strlen(client_libs[i].path) + 1 /*NULL*/;
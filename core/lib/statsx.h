@@ -416,6 +416,21 @@ STATS_DEF("Shared trace links shifted back to trace head", links_shared_trace_to
 STATS_DEF("Shadowed trace head deleted", shadowed_trace_head_deleted)
 STATS_DEF("Trace head counters reset on trace deletion", th_counter_reset)
 STATS_DEF("Trace heads re-marked", trace_head_remark)
+#ifdef UNIX
+RSTATS_DEF("Trace profile samples", trace_profile_samples)
+RSTATS_DEF("Trace profile samples in traces", trace_profile_samples_in_traces)
+RSTATS_DEF("Trace profile samples in bbs", trace_profile_samples_in_bbs)
+STATS_DEF("Trace profile exit sampling windows", trace_profile_windows)
+STATS_DEF("Trace profile exit sampling windows abandoned",
+          trace_profile_windows_abandoned)
+STATS_DEF("Trace profile exits sampled", trace_profile_exits)
+STATS_DEF("Trace profile side exits sampled", trace_profile_side_exits)
+STATS_DEF("Trace head thresholds raised", th_threshold_raised)
+STATS_DEF("Trace head thresholds lowered", th_threshold_lowered)
+STATS_DEF("Traces re-formed for dominant side exits", num_traces_reformed)
+STATS_DEF("Trace re-formations skipped: shared IBT tables needed",
+          num_trace_reforms_skipped)
+#endif
 STATS_DEF("Future fragments generated", num_future_fragments)
 STATS_DEF("Shared fragments generated", num_shared_fragments)
 STATS_DEF("Shared bbs generated", num_shared_bbs)
@@ -655,6 +670,7 @@ STATS_DEF("Persisted cache load error: modinfo mismatch", perscache_modinfo_mism
 STATS_DEF("Persisted cache load error: modbase mismatch", perscache_base_mismatch)
 STATS_DEF("Persisted cache load error: region mismatch", perscache_region_mismatch)
 STATS_DEF("Persisted cache load error: tls offs mismatch", perscache_tls_mismatch)
+STATS_DEF("Persisted cache load error: client mismatch", perscache_client_mismatch)
 STATS_DEF("Persisted cache load error: no trace support", perscache_trace_mismatch)
 STATS_DEF("Persisted cache load error: no RAC/RCT support", perscache_rct_mismatch)
 STATS_DEF("Persisted cache load error: option mismatch", perscache_options_mismatch)
@@ -1234,7 +1250,21 @@ STATS_DEF("Doubled-up nudges", num_pending_nudges)
 STATS_DEF("Clean Call analyzed", cleancall_analyzed)
 STATS_DEF("Clean Call inserted", cleancall_inserted)
 STATS_DEF("Clean Call inlined", cleancall_inlined)
+STATS_DEF("Clean Call callees not inlined", cleancall_inline_rejected)
+STATS_DEF("Clean Call not inlined: opt_cleancall < 2", cleancall_reject_option)
+STATS_DEF("Clean Call not inlined: undecodable", cleancall_reject_decode)
+STATS_DEF("Clean Call not inlined: calls out", cleancall_reject_call)
+STATS_DEF("Clean Call not inlined: system call", cleancall_reject_syscall)
+STATS_DEF("Clean Call not inlined: indirect branch", cleancall_reject_indirect)
+STATS_DEF("Clean Call not inlined: unsupported branch", cleancall_reject_branch)
+STATS_DEF("Clean Call not inlined: loop", cleancall_reject_loop)
+STATS_DEF("Clean Call not inlined: too large", cleancall_reject_size)
+STATS_DEF("Clean Call not inlined: uses SIMD", cleancall_reject_simd)
+STATS_DEF("Clean Call not inlined: accesses TLS", cleancall_reject_tls)
+STATS_DEF("Clean Call not inlined: out of scratch slots", cleancall_reject_slots)
+STATS_DEF("Clean Call not inlined: stack usage", cleancall_reject_stack)
 STATS_DEF("Clean Call [xyz]mm skipped", cleancall_simd_skipped)
+STATS_DEF("Clean Call [xyz]mm use found across calls", cleancall_simd_chain_analyzed)
 #ifdef X86
 STATS_DEF("Clean Call mask skipped", cleancall_opmask_skipped)
 #endif
@@ -97,7 +97,21 @@ DECLARE_CXTSWPROT_VAR(mutex_t trace_building_lock, INIT_LOCK_FREE(trace_building
 /* For clearing counters on trace deletion we follow a lazy strategy
  * using a sentinel value to determine whether we've built a trace or not
  */
-#define TH_COUNTER_CREATED_TRACE_VALUE() (INTERNAL_OPTION(trace_threshold) + 1U)
+#define TH_COUNTER_CREATED_TRACE_VALUE(ctr) (thcounter_threshold(ctr) + 1U)
+
+#ifdef UNIX
+/* -trace_profile_ms keeps each head's threshold within this factor of
+ * -trace_threshold.
+ */
+#    define TRACE_PROFILE_THRESHOLD_SCALE 8
+/* A sampling window is abandoned once this thread has exited the cache this many
+ * times per exit it wanted to observe.
+ */
+#    define TRACE_PROFILE_WINDOW_SLACK 4
+
+static void
+trace_profile_close(dcontext_t *dcontext);
+#endif
 
 static void
 delete_private_copy(dcontext_t *dcontext)
@@ -280,6 +294,11 @@ void
 monitor_thread_reset_free(dcontext_t *dcontext)
 {
     trace_abort_and_delete(dcontext);
+#ifdef UNIX
+    /* the sampled trace is going away along with the rest of the cache */
+    memset(&((monitor_data_t *)dcontext->monitor_field)->profile, 0,
+           sizeof(trace_profile_t));
+#endif
 }
 
 void
@@ -298,6 +317,26 @@ d_r_monitor_exit()
 {
     LOG(GLOBAL, LOG_MONITOR | LOG_STATS, 1, "Trace fragments generated: %d\n",
         GLOBAL_STAT(num_traces));
+#ifdef UNIX
+    DOSTATS({
+        if (GLOBAL_STAT(trace_profile_samples) > 0) {
+            LOG(GLOBAL, LOG_MONITOR | LOG_STATS, 1,
+                "Trace profile: %d%% of samples in traces (peak %d KB of cache), "
+                "%d%% in bbs (peak %d KB of cache)\n",
+                (int)(GLOBAL_STAT(trace_profile_samples_in_traces) * 100 /
+                      GLOBAL_STAT(trace_profile_samples)),
+                (int)((GLOBAL_STAT(fcache_trace_capacity_peak) +
+                       GLOBAL_STAT(fcache_shared_trace_capacity_peak)) /
+                      1024),
+                (int)(GLOBAL_STAT(trace_profile_samples_in_bbs) * 100 /
+                      GLOBAL_STAT(trace_profile_samples)),
+                (int)((GLOBAL_STAT(fcache_bb_capacity_peak) +
+                       GLOBAL_STAT(fcache_shared_bb_capacity_peak) +
+                       GLOBAL_STAT(fcache_coarse_bb_capacity_peak)) /
+                      1024));
+        }
+    });
+#endif
     DELETE_LOCK(trace_building_lock);
 }
 
@@ -348,6 +387,17 @@ monitor_thread_exit(dcontext_t *dcontext)
      * can never be built from that particular trace head.
      */
     trace_abort(dcontext);
+#ifdef UNIX
+    /* Relink the trace whose exits we were sampling, as it may be shared. */
+    if (((monitor_data_t *)dcontext->monitor_field)->profile.tag != NULL) {
+        bool waslinking = is_couldbelinking(dcontext);
+        if (!waslinking)
+            enter_couldbelinking(dcontext, NULL, false);
+        trace_profile_close(dcontext);
+        if (!waslinking)
+            enter_nolinking(dcontext, NULL, false);
+    }
+#endif
 #ifdef DEBUG
     if (md->trace_buf != NULL) {
         heap_reachable_free(dcontext, md->trace_buf,
@@ -381,11 +431,39 @@ thcounter_add(dcontext_t *dcontext, app_pc tag)
                           sizeof(trace_head_counter_t) HEAPACCT(ACCT_THCOUNTER));
         e->tag = tag;
         e->counter = 0;
+        e->threshold = 0;
         generic_hash_add(dcontext, md->thead_table, (ptr_uint_t)tag, e);
     }
     return e;
 }
 
+/* Returns the counter value at which ctr's trace head is hot. */
+static inline uint
+thcounter_threshold(trace_head_counter_t *ctr)
+{
+    return ctr->threshold == 0 ? INTERNAL_OPTION(trace_threshold) : ctr->threshold;
+}
+
+#ifdef UNIX
+/* Sets ctr's hot threshold while preserving both the created-trace sentinel and
+ * the counter < threshold invariant that monitor_cache_enter() asserts.
+ */
+static void
+thcounter_set_threshold(trace_head_counter_t *ctr, uint threshold)
+{
+    uint min = MAX(INTERNAL_OPTION(trace_threshold) / TRACE_PROFILE_THRESHOLD_SCALE,
+                   INTERNAL_OPTION(trace_counter_on_delete) + 1);
+    uint max = MIN(INTERNAL_OPTION(trace_threshold) * TRACE_PROFILE_THRESHOLD_SCALE,
+                   USHRT_MAX);
+    bool created = (ctr->counter == TH_COUNTER_CREATED_TRACE_VALUE(ctr));
+    ctr->threshold = MIN(MAX(threshold, min), max);
+    if (created)
+        ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE(ctr);
+    else if (ctr->counter >= ctr->threshold)
+        ctr->counter = ctr->threshold - 1;
+}
+#endif
+
 /* Deletes all trace head entries in [start,end) */
 void
 thcounter_range_remove(dcontext_t *dcontext, app_pc start, app_pc end)
@@ -1758,6 +1836,202 @@ internal_restore_last(dcontext_t *dcontext)
         md->last_fragment = NULL;
 }
 
+#ifdef UNIX
+/* Returns whether exit l of trace f is a side exit: neither the trace's final exit
+ * nor a branch back to the trace's own head.
+ */
+static bool
+trace_exit_is_side_exit(dcontext_t *dcontext, fragment_t *f, linkstub_t *l)
+{
+    if (LINKSTUB_FINAL(l))
+        return false;
+    return !LINKSTUB_DIRECT(l->flags) || EXIT_TARGET_TAG(dcontext, f, l) != f->tag;
+}
+
+/* Unlinks the outgoing exits of trace f so that this thread sees each of them in
+ * monitor_cache_exit().
+ */
+static void
+trace_profile_open(dcontext_t *dcontext, fragment_t *f)
+{
+    monitor_data_t *md = (monitor_data_t *)dcontext->monitor_field;
+    bool opened = false;
+    SHARED_FLAGS_RECURSIVE_LOCK(f->flags, acquire, change_linking_lock);
+    /* The trace may already be unlinked by another thread's window, for signal
+     * delivery, or for a flush.
+     */
+    if (TEST(FRAG_LINKED_OUTGOING, f->flags) && !TEST(FRAG_WAS_DELETED, f->flags)) {
+        unlink_fragment_outgoing(dcontext, f);
+        opened = true;
+    }
+    SHARED_FLAGS_RECURSIVE_LOCK(f->flags, release, change_linking_lock);
+    /* link routines will unprotect as necessary, we then re-protect entire fcache */
+    SELF_PROTECT_CACHE(dcontext, NULL, READONLY);
+    if (!opened)
+        return;
+    memset(&md->profile, 0, sizeof(md->profile));
+    md->profile.tag = f->tag;
+    STATS_INC(trace_profile_windows);
+    LOG(THREAD, LOG_MONITOR, 3, "Sampling exits of trace F%d (tag " PFX ")\n", f->id,
+        f->tag);
+}
+
+void
+monitor_trace_profile_alarm(dcontext_t *dcontext, priv_mcontext_t *mcontext)
+{
+    monitor_data_t *md = (monitor_data_t *)dcontext->monitor_field;
+    fragment_t wrapper;
+    fragment_t *f;
+    if (md == NULL || md->thead_table == NULL)
+        return;
+    RSTATS_INC(trace_profile_samples);
+    if (dcontext->whereami != DR_WHERE_FCACHE)
+        return;
+    /* Like fcache_refine_whereami(), this lookup is safe in a signal handler. */
+    f = fragment_pclookup(dcontext, (cache_pc)mcontext->pc, &wrapper);
+    if (f == NULL)
+        return;
+    if (!TEST(FRAG_IS_TRACE, f->flags)) {
+        RSTATS_INC(trace_profile_samples_in_bbs);
+        return;
+    }
+    RSTATS_INC(trace_profile_samples_in_traces);
+    /* A hot trace may loop in the cache indefinitely, so we open the window here
+     * rather than at the next cache exit.  As in unlink_fragment_for_signal(), we
+     * interrupted this thread in the cache, where its DR state is safe, so it is
+     * ok to acquire the linking lock.  We must not enter and leave couldbelinking
+     * though: leaving it acts on pending shared deletions as though this thread
+     * were out of the cache, which would free a re-formed trace we are still
+     * executing.  The change_linking_lock alone only synchronizes shared traces,
+     * as a flusher may unlink our private ones while we are in the cache.
+     */
+    if (md->profile.tag == NULL && md->trace_tag == NULL &&
+        TEST(FRAG_SHARED, f->flags) &&
+        !TESTANY(FRAG_COARSE_GRAIN | FRAG_FAKE, f->flags))
+        trace_profile_open(dcontext, f);
+}
+
+/* Relinks the trace whose exits this thread has been sampling. */
+static void
+trace_profile_close(dcontext_t *dcontext)
+{
+    monitor_data_t *md = (monitor_data_t *)dcontext->monitor_field;
+    fragment_t *f = fragment_lookup_trace(dcontext, md->profile.tag);
+    md->profile.tag = NULL;
+    if (f == NULL) /* flushed while we were sampling */
+        return;
+    /* We relink unconditionally, without knowing whether another thread has since
+     * unlinked this shared trace.  This widens the race described in
+     * unlink_fragment_for_signal() (xref PR 596069): a thread that received a
+     * signal in the trace while our window was open found it already unlinked and
+     * so relies on our unlinking, which we now undo before it exits.  That thread
+     * may then loop in the trace and delay its signal until the trace next exits.
+     * As there, we live with the chance of a delay rather than refcount unlinks.
+     */
+    SHARED_FLAGS_RECURSIVE_LOCK(f->flags, acquire, change_linking_lock);
+    if (!TEST(FRAG_LINKED_OUTGOING, f->flags) && !TEST(FRAG_WAS_DELETED, f->flags))
+        link_fragment_outgoing(dcontext, f, false);
+    SHARED_FLAGS_RECURSIVE_LOCK(f->flags, release, change_linking_lock);
+    SELF_PROTECT_CACHE(dcontext, NULL, READONLY);
+}
+
+/* Deletes the trace with the given tag so that its head, whose counter is lazily
+ * reset, builds a new trace along the path that is hot now.
+ */
+static void
+trace_profile_reform(dcontext_t *dcontext, app_pc tag)
+{
+    fragment_t *f = fragment_lookup_trace(dcontext, tag);
+    /* Only shared traces are sampled: see monitor_trace_profile_alarm(). */
+    if (f == NULL || !TEST(FRAG_SHARED, f->flags) ||
+        TESTANY(FRAG_CANNOT_DELETE | FRAG_WAS_DELETED, f->flags))
+        return;
+    if (!DYNAMO_OPTION(shared_trace_ibt_tables)) {
+        /* Removing a shared trace from every thread's private IBT tables requires
+         * a flush, which is too costly to spend on a sample.  The side exit's
+         * lowered threshold lets a secondary trace take over instead.
+         */
+        STATS_INC(num_trace_reforms_skipped);
+        return;
+    }
+    LOG(THREAD, LOG_MONITOR, 2, "Re-forming trace F%d (tag " PFX ")\n", f->id, tag);
+    if (f == dcontext->last_fragment)
+        last_exit_deleted(dcontext);
+    fragment_remove_shared_no_flush(dcontext, f);
+    STATS_INC(num_traces_reformed);
+}
+
+/* Tunes trace head thresholds from the exits sampled for the trace with the
+ * given tag.
+ */
+static void
+trace_profile_evaluate(dcontext_t *dcontext, app_pc tag, trace_profile_t *prof)
+{
+    trace_head_counter_t *ctr = thcounter_add(dcontext, tag);
+    uint side_pct = prof->side_exits * 100 / prof->exits;
+    LOG(THREAD, LOG_MONITOR, 2, "Trace " PFX ": %d of %d sampled exits are side exits\n",
+        tag, prof->side_exits, prof->exits);
+    if (side_pct > DYNAMO_OPTION(trace_reform_side_exit_pct)) {
+        /* The trace no longer follows the hot path.  Doubling the head's threshold
+         * keeps a head whose hot path keeps moving from churning the trace cache,
+         * while halving the dominant side exit target's threshold lets it become
+         * a trace of its own sooner.
+         */
+        thcounter_set_threshold(ctr, thcounter_threshold(ctr) * 2);
+        STATS_INC(th_threshold_raised);
+        if (prof->side_target_votes > 0 && prof->side_target != tag) {
+            trace_head_counter_t *side = thcounter_add(dcontext, prof->side_target);
+            thcounter_set_threshold(side, thcounter_threshold(side) / 2);
+            STATS_INC(th_threshold_lowered);
+        }
+        trace_profile_reform(dcontext, tag);
+    } else if (side_pct <= DYNAMO_OPTION(trace_reform_side_exit_pct) / 4) {
+        /* A stable trace: let it be rebuilt quickly if it is flushed. */
+        thcounter_set_threshold(ctr, thcounter_threshold(ctr) / 2);
+        STATS_INC(th_threshold_lowered);
+    }
+}
+
+/* Feeds and closes this thread's -trace_profile_ms sampling window. */
+static void
+trace_profile_cache_exit(dcontext_t *dcontext)
+{
+    monitor_data_t *md = (monitor_data_t *)dcontext->monitor_field;
+    trace_profile_t *prof = &md->profile;
+    fragment_t *f = dcontext->last_fragment;
+    linkstub_t *l = dcontext->last_exit;
+    prof->cache_exits++;
+    if (f->tag == prof->tag && TEST(FRAG_IS_TRACE, f->flags) && !LINKSTUB_FAKE(l)) {
+        prof->exits++;
+        STATS_INC(trace_profile_exits);
+        if (trace_exit_is_side_exit(dcontext, f, l)) {
+            prof->side_exits++;
+            STATS_INC(trace_profile_side_exits);
+            if (prof->side_target == dcontext->next_tag)
+                prof->side_target_votes++;
+            else if (prof->side_target_votes == 0) {
+                prof->side_target = dcontext->next_tag;
+                prof->side_target_votes = 1;
+            } else
+                prof->side_target_votes--;
+        }
+    }
+    if (prof->exits >= DYNAMO_OPTION(trace_profile_exits)) {
+        trace_profile_t sampled = *prof;
+        trace_profile_close(dcontext);
+        trace_profile_evaluate(dcontext, sampled.tag, &sampled);
+    } else if (TESTANY(LINK_NI_SYSCALL_ALL, l->flags) ||
+               prof->cache_exits >=
+                   DYNAMO_OPTION(trace_profile_exits) * TRACE_PROFILE_WINDOW_SLACK) {
+        /* Do not leave the trace unlinked while this thread may block in a
+         * system call or has moved on to other code.
+         */
+        STATS_INC(trace_profile_windows_abandoned);
+        trace_profile_close(dcontext);
+    }
+}
+#endif
+
 /* if we are building a trace, unfreezes and relinks the last_fragment */
 void
 monitor_cache_exit(dcontext_t *dcontext)
@@ -1795,6 +2069,10 @@ monitor_cache_exit(dcontext_t *dcontext)
         dcontext->trace_sysenter_exit =
             (TEST(FRAG_IS_TRACE, dcontext->last_fragment->flags) &&
              TEST(LINK_NI_SYSCALL, dcontext->last_exit->flags));
+#ifdef UNIX
+        if (md->profile.tag != NULL)
+            trace_profile_cache_exit(dcontext);
+#endif
     }
     dcontext->whereami = DR_WHERE_DISPATCH;
 }
@@ -2110,7 +2388,7 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
         ctr = thcounter_add(dcontext, f->tag);
     ASSERT(ctr != NULL);
 
-    if (ctr->counter == TH_COUNTER_CREATED_TRACE_VALUE()) {
+    if (ctr->counter == TH_COUNTER_CREATED_TRACE_VALUE(ctr)) {
         /* trace_t head counter values are persistent, so we do not remove them on
          * deletion.  However, when a trace is deleted we clear the counter, to
          * prevent the new bb from immediately being considered hot, to help
@@ -2125,7 +2403,7 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
 
     ctr->counter++;
     /* Should never be > here (assert is down below) but we check just in case */
-    if (ctr->counter >= INTERNAL_OPTION(trace_threshold)) {
+    if (ctr->counter >= thcounter_threshold(ctr)) {
         /* if cannot delete fragment, do not start trace -- wait until
          * can delete it (w/ exceptions, deletion status changes). */
         if (!TEST(FRAG_CANNOT_DELETE, f->flags)) {
@@ -2187,7 +2465,7 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
         /* operate on new f from here on */
         f = md->last_fragment;
     }
-    if (!start_trace && ctr->counter >= INTERNAL_OPTION(trace_threshold)) {
+    if (!start_trace && ctr->counter >= thcounter_threshold(ctr)) {
         /* Back up the counter by one. This ensures that the
          * counter will be == trace_threshold if this thread is later
          * able to start building a trace w/this tag and ensures
@@ -2196,13 +2474,13 @@ monitor_cache_enter(dcontext_t *dcontext, fragment_t *f)
         LOG(THREAD, LOG_MONITOR, 3, "Backing up F%d counter from %d\n", f->id,
             ctr->counter);
         ctr->counter--;
-        ASSERT(ctr->counter < INTERNAL_OPTION(trace_threshold));
+        ASSERT(ctr->counter < thcounter_threshold(ctr));
     }
     if (start_trace) {
         KSTART(trace_building);
         /* ensure our sentinel counter value for counter clearing will work */
-        ASSERT(ctr->counter == INTERNAL_OPTION(trace_threshold));
-        ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE();
+        ASSERT(ctr->counter == thcounter_threshold(ctr));
+        ctr->counter = TH_COUNTER_CREATED_TRACE_VALUE(ctr);
         /* Found a hot trace head.  Switch this thread into trace
            selection mode, and initialize the instrlist_t for the new
            trace fragment with this block fragment.  Leave the
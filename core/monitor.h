@@ -95,6 +95,11 @@ fragment_t *
 monitor_cache_enter(dcontext_t *dcontext, fragment_t *f);
 void
 monitor_cache_exit(dcontext_t *dcontext);
+#ifdef UNIX
+/* The -trace_profile_ms itimer callback.  Safe to call from a signal handler. */
+void
+monitor_trace_profile_alarm(dcontext_t *dcontext, priv_mcontext_t *mcontext);
+#endif
 bool
 is_building_trace(dcontext_t *dcontext);
 app_pc
@@ -135,8 +140,27 @@ mangle_trace_at_end(void);
 typedef struct _trace_head_counter_t {
     app_pc tag;
     uint counter;
+    /* Hot threshold for this head as tuned by -trace_profile_ms.
+     * 0 means -trace_threshold.
+     */
+    uint threshold;
 } trace_head_counter_t;
 
+#ifdef UNIX
+/* State for -trace_profile_ms.  While tag is non-NULL the outgoing links of the
+ * trace with that tag are removed so that this thread sees each of its exits.
+ */
+typedef struct _trace_profile_t {
+    app_pc tag;
+    uint exits;
+    uint side_exits;
+    uint cache_exits; /* all of this thread's cache exits since the window opened */
+    /* Majority vote over side-exit targets. */
+    app_pc side_target;
+    uint side_target_votes;
+} trace_profile_t;
+#endif
+
 typedef struct _trace_bb_build_t {
     trace_bb_info_t info;
     /* PR 299808: we need to check bb bounds at emit time.  Also used
@@ -191,6 +215,10 @@ typedef struct _monitor_data_t {
     uint final_exit_flags;
 
     fragment_t wrapper; /* for creating new shadowed trace heads */
+
+#ifdef UNIX
+    trace_profile_t profile;
+#endif
 } monitor_data_t;
 
 /* PR 204770: use trace component bb tag for RCT source address */
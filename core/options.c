@@ -1285,6 +1285,18 @@ check_option_compatibility_helper(int recurse_count)
         SET_DEFAULT_VALUE(trace_counter_on_delete);
         changed_options = true;
     }
+#ifdef UNIX
+    if (DYNAMO_OPTION(trace_profile_ms) > 0 && DYNAMO_OPTION(trace_profile_exits) == 0) {
+        USAGE_ERROR("-trace_profile_exits must be > 0 with -trace_profile_ms");
+        SET_DEFAULT_VALUE(trace_profile_exits);
+        changed_options = true;
+    }
+    if (DYNAMO_OPTION(trace_reform_side_exit_pct) > 100) {
+        USAGE_ERROR("-trace_reform_side_exit_pct must be <= 100");
+        SET_DEFAULT_VALUE(trace_reform_side_exit_pct);
+        changed_options = true;
+    }
+#endif
     if (INTERNAL_OPTION(alt_hash_func) >= HASH_FUNCTION_ENUM_MAX) {
         USAGE_ERROR("Invalid selection (%d) for shared cache hash func, must be < %d",
                     INTERNAL_OPTION(alt_hash_func), HASH_FUNCTION_ENUM_MAX);
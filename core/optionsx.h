@@ -910,6 +910,22 @@ OPTION_COMMAND(
 OPTION_DEFAULT_INTERNAL(
     uint, trace_counter_on_delete, 0U,
     "trace head counter will be reset to this value upon trace deletion")
+#ifdef UNIX
+/* Sampled trace profiling: an ITIMER_PROF sample that lands in a shared trace causes
+ * that trace's outgoing links to be removed until -trace_profile_exits of its exits
+ * have been observed.  The exit ratios tune per-head thresholds and re-form traces
+ * whose side exits dominate.  A client using dr_set_itimer(ITIMER_PROF) replaces it.
+ */
+OPTION_DEFAULT(uint, trace_profile_ms, 0,
+               "sample the code cache every N ms of cpu time to adapt trace selection "
+               "(0 disables)")
+OPTION_DEFAULT(uint, trace_profile_exits, 64,
+               "number of exits of a sampled trace to observe, "
+               "requires -trace_profile_ms")
+OPTION_DEFAULT(uint, trace_reform_side_exit_pct, 50,
+               "re-form a trace when more than this percentage of its sampled exits are "
+               "side exits, requires -trace_profile_ms")
+#endif
 
 OPTION_DEFAULT(uint, max_elide_jmp, 16, "maximum direct jumps to elide in a basic block")
 OPTION_DEFAULT(uint, max_elide_call, 16, "maximum direct calls to elide in a basic block")
@@ -2312,7 +2312,11 @@ get_persist_filename(char *filename /*OUT*/, uint filename_max /* max #chars */,
      */
     /* should we go to a 64-bit hash? */
     IF_X64(ASSERT(CHECK_TRUNCATE_TYPE_uint(size)));
-    hash = checksum ^ timestamp ^ (uint)size;
+    /* On Linux the checksum is the module's build-id hash when it has one.
+     * Keying by client as well lets caches built under different clients coexist
+     * rather than replacing each other.
+     */
+    hash = checksum ^ timestamp ^ (uint)size ^ instrument_persist_hash();
     /* case 9799: make options part of namespace */
     if (option_string != NULL) {
         uint i;
@@ -2320,8 +2324,9 @@ get_persist_filename(char *filename /*OUT*/, uint filename_max /* max #chars */,
         for (i = 0; i < strlen(option_string); i++)
             hash ^= option_string[i] << ((i % 4) * 8);
     }
-    LOG(GLOBAL, LOG_CACHE, 2, "\thash = 0x%08x^0x%08x^" PFX " ^ %s = " PFX "\n", checksum,
-        timestamp, size, option_string == NULL ? "" : option_string, hash);
+    LOG(GLOBAL, LOG_CACHE, 2, "\thash = 0x%08x^0x%08x^" PFX "^0x%08x ^ %s = " PFX "\n",
+        checksum, timestamp, size, instrument_persist_hash(),
+        option_string == NULL ? "" : option_string, hash);
     ASSERT_CURIOSITY(hash != 0);
 
     if (DYNAMO_OPTION(persist_per_app)) {
@@ -2965,6 +2970,7 @@ coarse_unit_set_persist_data(dcontext_t *dcontext, coarse_info_t *info,
     pers->start_offs = info->base_pc - modbase;
     pers->end_offs = info->end_pc - modbase;
     pers->tls_offs_base = os_tls_offset(0);
+    pers->client_hash = instrument_persist_hash();
 
     /* We need to go in forward order so we can tell the client the current offset */
     x_offs += pers->header_len;
@@ -3566,6 +3572,17 @@ persist_check_option_compat(dcontext_t *dcontext, coarse_persisted_info_t *pers,
         return false;
     }
 
+    if (instrument_persist_hash() != pers->client_hash) {
+        /* A different client, client build, or client options: the persisted
+         * instrumentation cannot be trusted to match what the clients would emit.
+         */
+        LOG(THREAD, LOG_CACHE, 1, "  client hash mismatch 0x%08x vs persisted 0x%08x\n",
+            instrument_persist_hash(), pers->client_hash);
+        STATS_INC(perscache_client_mismatch);
+        SYSLOG_INTERNAL_WARNING_ONCE("persistent cache client mismatch");
+        return false;
+    }
+
     if (!TEST(PERSCACHE_SUPPORT_TRACES, pers->flags) && !DYNAMO_OPTION(disable_traces)) {
         /* We bail out; the consequences of continuing are huge performance
          * problems akin to -no_link_ibl.
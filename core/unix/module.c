@@ -190,7 +190,8 @@ os_module_area_init(module_area_t *ma, app_pc base, size_t view_size, bool at_ma
 
     /* Fields for pcaches (PR 295534).  These entries are not present in
      * all libs: I see DT_CHECKSUM and the prelink field on FC12 but not
-     * on Ubuntu 9.04.
+     * on Ubuntu 9.04.  The checksum is a hash of the GNU build-id when the
+     * module has one.
      */
     if (ma->os_data.checksum == 0 &&
         (DYNAMO_OPTION(coarse_enable_freeze) || DYNAMO_OPTION(use_persisted))) {
@@ -207,6 +207,42 @@ elf_dt_abs_addr(ELF_DYNAMIC_ENTRY_TYPE *dyn, app_pc base, size_t size, size_t vi
     return tgt;
 }
 
+/* Returns a hash of the NT_GNU_BUILD_ID note in the PT_NOTE segment prog_hdr, or 0
+ * if it has none.  The linker derives the build-id from the module's contents, so
+ * unlike the first-page checksum it changes whenever the code does.  At map time
+ * only the first segment is guaranteed to be backed by the file, so we only look
+ * for notes there (where linkers place them).
+ */
+static uint
+module_note_build_id_hash(ELF_PROGRAM_HEADER_TYPE *prog_hdr, /* PT_NOTE entry */
+                          app_pc mod_base, app_pc first_end, app_pc base, bool at_map,
+                          ptr_int_t load_delta)
+{
+    app_pc note, note_end;
+    ASSERT(prog_hdr->p_type == PT_NOTE);
+    if (at_map) {
+        if (first_end == NULL ||
+            prog_hdr->p_offset + prog_hdr->p_filesz > (size_t)(first_end - mod_base))
+            return 0;
+        note = base + prog_hdr->p_offset;
+    } else
+        note = (app_pc)prog_hdr->p_vaddr + load_delta;
+    note_end = note + prog_hdr->p_filesz;
+    while (note + sizeof(ELF_NOTE_HEADER_TYPE) <= note_end) {
+        ELF_NOTE_HEADER_TYPE *nhdr = (ELF_NOTE_HEADER_TYPE *)note;
+        app_pc name = note + sizeof(*nhdr);
+        app_pc desc = name + ALIGN_FORWARD(nhdr->n_namesz, 4);
+        app_pc next = desc + ALIGN_FORWARD(nhdr->n_descsz, 4);
+        if (next > note_end || next <= note)
+            break;
+        if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == sizeof("GNU") &&
+            strcmp((const char *)name, "GNU") == 0 && nhdr->n_descsz > 0)
+            return d_r_crc32((const char *)desc, nhdr->n_descsz);
+        note = next;
+    }
+    return 0;
+}
+
 /* common code to fill os_module_data_t for loader and module_area_t */
 static bool
 module_fill_os_data(ELF_PROGRAM_HEADER_TYPE *prog_hdr, /* PT_DYNAMIC entry */
@@ -358,6 +394,7 @@ module_walk_program_headers(app_pc base, size_t view_size, bool at_map, bool dyn
     ELF_HEADER_TYPE *elf_hdr = (ELF_HEADER_TYPE *)base;
     ptr_int_t load_delta; /* delta loaded at relative to base */
     uint last_seg_align = 0;
+    uint build_id_hash = 0;
     ASSERT(is_elf_so_header(base, view_size));
 
     /* On adjusting virtual address in the elf headers -
@@ -397,6 +434,11 @@ module_walk_program_headers(app_pc base, size_t view_size, bool at_map, bool dyn
                 }
                 found_load = true;
             }
+            if (out_data != NULL && prog_hdr->p_type == PT_NOTE && build_id_hash == 0 &&
+                (DYNAMO_OPTION(coarse_enable_freeze) || DYNAMO_OPTION(use_persisted))) {
+                build_id_hash = module_note_build_id_hash(prog_hdr, mod_base, first_end,
+                                                          base, at_map, load_delta);
+            }
             if ((out_soname != NULL || out_data != NULL) &&
                 prog_hdr->p_type == PT_DYNAMIC) {
                 module_fill_os_data(prog_hdr, mod_base, max_end, base, view_size, at_map,
@@ -437,6 +479,11 @@ module_walk_program_headers(app_pc base, size_t view_size, bool at_map, bool dyn
             }
             max_end = base + view_size;
         }
+        /* The build-id identifies the module's contents better than DT_CHECKSUM,
+         * which is only present in prelinked modules.
+         */
+        if (out_data != NULL && build_id_hash != 0)
+            out_data->checksum = build_id_hash;
     }
     ASSERT_CURIOSITY(found_load && mod_base != (app_pc)POINTER_MAX &&
                      max_end != (app_pc)0);
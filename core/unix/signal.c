@@ -1297,6 +1297,8 @@ signal_thread_inherit(dcontext_t *dcontext, void *clone_record)
             if (INTERNAL_OPTION(profile_pcs)) {
                 info->sighand->we_intercept[SIGVTALRM] = true;
             }
+            if (DYNAMO_OPTION(trace_profile_ms) > 0)
+                info->sighand->we_intercept[SIGPROF] = true;
             info->sighand->we_intercept[SIGALRM] = true;
 #ifdef SIDELINE
             info->sighand->we_intercept[SIGCHLD] = true;
@@ -1319,6 +1321,10 @@ signal_thread_inherit(dcontext_t *dcontext, void *clone_record)
         pcprofile_thread_init(dcontext, info->shared_itimer,
                               (record == NULL) ? NULL : record->pcprofile_info);
     }
+    if (DYNAMO_OPTION(trace_profile_ms) > 0 && !DYNAMO_OPTION(disable_traces)) {
+        set_itimer_callback(dcontext, ITIMER_PROF, DYNAMO_OPTION(trace_profile_ms),
+                            monitor_trace_profile_alarm, NULL);
+    }
 
     info->pre_syscall_app_sigprocmask_valid = false;
 
@@ -1425,6 +1431,11 @@ signal_fork_init(dcontext_t *dcontext)
     if (INTERNAL_OPTION(profile_pcs)) {
         pcprofile_fork_init(dcontext);
     }
+    if (DYNAMO_OPTION(trace_profile_ms) > 0 && !DYNAMO_OPTION(disable_traces)) {
+        /* itimers are not inherited across fork */
+        set_itimer_callback(dcontext, ITIMER_PROF, DYNAMO_OPTION(trace_profile_ms),
+                            monitor_trace_profile_alarm, NULL);
+    }
 
     info->pre_syscall_app_sigprocmask_valid = false;
 
@@ -8061,7 +8072,9 @@ handle_alarm(dcontext_t *dcontext, int sig, kernel_ucontext_t *ucxt)
         void (*cb)(dcontext_t *, priv_mcontext_t *) = (*info->itimer)[which].cb;
         void (*cb_api)(dcontext_t *, dr_mcontext_t *) = (*info->itimer)[which].cb_api;
 
-        if (which == ITIMER_VIRTUAL && info->shared_itimer && should_release_lock) {
+        /* The -profile_pcs and -trace_profile_ms callbacks acquire DR locks. */
+        if ((which == ITIMER_VIRTUAL || which == ITIMER_PROF) && info->shared_itimer &&
+            should_release_lock) {
             release_recursive_lock(&(*info->itimer)[which].lock);
             should_release_lock = false;
         }
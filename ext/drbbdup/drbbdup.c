@@ -72,6 +72,13 @@
 #    define MAX_IMMED_IN_CMP 255
 #endif
 
+/* The default for drbbdup_options_t.dispatch_search_min_cases. */
+#define DISPATCH_SEARCH_MIN_CASES 8
+/* A binary search dispatch compares against this many encodings in turn, rather than
+ * splitting further, once the remaining range is this small.
+ */
+#define DISPATCH_SEARCH_LINEAR_CASES 3
+
 typedef enum {
     DRBBDUP_ENCODING_SLOT = 0, /* Used as a spill slot for dynamic case generation. */
     DRBBDUP_SCRATCH_REG_SLOT = 1,
@@ -1128,6 +1135,65 @@ drbbdup_encode_runtime_case(void *drcontext, drbbdup_per_thread *pt, void *tag,
 #endif
 }
 
+/* Compares the runtime encoding in reg_encoding with current_case->encoding,
+ * setting the flags as for reg_encoding minus the case encoding.
+ */
+static void
+drbbdup_insert_compare_encoding(void *drcontext, instrlist_t *bb, instr_t *where,
+                                drbbdup_manager_t *manager, drbbdup_case_t *current_case,
+                                reg_id_t reg_encoding)
+{
+#ifdef X86
+#    ifdef X86_64
+    if (current_case->encoding <= INT_MAX) {
+        /* It fits in an immediate so we can avoid the load. */
+        opnd_t opnd = opnd_create_immed_uint(current_case->encoding, OPSZ_4);
+        instrlist_meta_preinsert(
+            bb, where, XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding), opnd));
+    } else {
+        /* The case data is in unreachable heap, so we cannot compare against it
+         * in memory.  Without a second scratch register, we instead stash the
+         * runtime encoding in a slot, compare the slot against the encoding loaded
+         * as an immediate, and reload the runtime encoding.
+         */
+        opnd_t slot = drbbdup_get_tls_raw_slot_opnd(drcontext, DRBBDUP_ENCODING_SLOT);
+        instrlist_meta_preinsert(
+            bb, where,
+            XINST_CREATE_store(drcontext, slot, opnd_create_reg(reg_encoding)));
+        instrlist_insert_mov_immed_ptrsz(drcontext, current_case->encoding,
+                                         opnd_create_reg(reg_encoding), bb, where, NULL,
+                                         NULL);
+        instrlist_meta_preinsert(
+            bb, where, XINST_CREATE_cmp(drcontext, slot, opnd_create_reg(reg_encoding)));
+        instrlist_meta_preinsert(
+            bb, where, XINST_CREATE_load(drcontext, opnd_create_reg(reg_encoding), slot));
+    }
+#    elif defined(X86_32)
+    opnd_t opnd = opnd_create_immed_uint(current_case->encoding, OPSZ_PTR);
+    instrlist_meta_preinsert(
+        bb, where, XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding), opnd));
+#    endif
+#elif defined(AARCHXX)
+    if (current_case->encoding <= MAX_IMMED_IN_CMP) {
+        /* Various larger immediates can be handled but it varies by ISA and mode.
+         * XXX: Should DR provide utilities to help figure out whether an integer
+         * will fit in a compare immediate?
+         */
+        opnd_t opnd = opnd_create_immed_uint(current_case->encoding, OPSZ_PTR);
+        instrlist_meta_preinsert(
+            bb, where, XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding), opnd));
+        return;
+    }
+    DR_ASSERT_MSG(manager->is_scratch_reg2_needed, "scratch2 was not saved");
+    instrlist_insert_mov_immed_ptrsz(drcontext, current_case->encoding,
+                                     opnd_create_reg(DRBBDUP_SCRATCH_REG2), bb, where,
+                                     NULL, NULL);
+    instrlist_meta_preinsert(bb, where,
+                             XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding),
+                                              opnd_create_reg(DRBBDUP_SCRATCH_REG2)));
+#endif
+}
+
 /* If avoid_flags and current_case->encoding == 0, uses a compare that does not
  * affect the flags.
  */
@@ -1177,22 +1243,8 @@ drbbdup_insert_compare_encoding_and_branch(void *drcontext, instrlist_t *bb,
         }
         return;
     }
-#    ifdef X86_64
-    if (current_case->encoding <= INT_MAX) {
-        /* It fits in an immediate so we can avoid the load. */
-        opnd_t opnd = opnd_create_immed_uint(current_case->encoding, OPSZ_4);
-        instrlist_meta_preinsert(
-            bb, where, XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding), opnd));
-    } else {
-        opnd_t opnd = opnd_create_abs_addr(&current_case->encoding, OPSZ_PTR);
-        instrlist_meta_preinsert(
-            bb, where, XINST_CREATE_cmp(drcontext, opnd, opnd_create_reg(reg_encoding)));
-    }
-#    elif defined(X86_32)
-    opnd_t opnd = opnd_create_immed_uint(current_case->encoding, OPSZ_PTR);
-    instrlist_meta_preinsert(
-        bb, where, XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding), opnd));
-#    endif
+    drbbdup_insert_compare_encoding(drcontext, bb, where, manager, current_case,
+                                    reg_encoding);
     instrlist_meta_preinsert(bb, where,
                              INSTR_CREATE_jcc(drcontext, jmp_if_equal ? OP_jz : OP_jnz,
                                               opnd_create_instr(jmp_label)));
@@ -1234,27 +1286,8 @@ drbbdup_insert_compare_encoding_and_branch(void *drcontext, instrlist_t *bb,
         }
 #    endif
     }
-    if (current_case->encoding <= MAX_IMMED_IN_CMP) {
-        /* Various larger immediates can be handled but it varies by ISA and mode.
-         * XXX: Should DR provide utilities to help figure out whether an integer
-         * will fit in a compare immediate?
-         */
-        opnd_t opnd = opnd_create_immed_uint(current_case->encoding, OPSZ_PTR);
-        instrlist_meta_preinsert(
-            bb, where, XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding), opnd));
-        instrlist_meta_preinsert(
-            bb, where,
-            XINST_CREATE_jump_cond(drcontext, jmp_if_equal ? DR_PRED_EQ : DR_PRED_NE,
-                                   opnd_create_instr(jmp_label)));
-        return;
-    }
-    DR_ASSERT_MSG(manager->is_scratch_reg2_needed, "scratch2 was not saved");
-    instrlist_insert_mov_immed_ptrsz(drcontext, current_case->encoding,
-                                     opnd_create_reg(DRBBDUP_SCRATCH_REG2), bb, where,
-                                     NULL, NULL);
-    instrlist_meta_preinsert(bb, where,
-                             XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_encoding),
-                                              opnd_create_reg(DRBBDUP_SCRATCH_REG2)));
+    drbbdup_insert_compare_encoding(drcontext, bb, where, manager, current_case,
+                                    reg_encoding);
     instrlist_meta_preinsert(
         bb, where,
         XINST_CREATE_jump_cond(drcontext, jmp_if_equal ? DR_PRED_EQ : DR_PRED_NE,
@@ -1295,6 +1328,117 @@ drbbdup_insert_dispatch(void *drcontext, instrlist_t *bb, instr_t *where,
     drbbdup_insert_landing_restoration(drcontext, bb, where, manager);
 }
 
+/* Returns whether the dispatcher locates the bb copy to execute with a binary search
+ * over the case encodings rather than by comparing against each encoding in turn.
+ */
+static bool
+drbbdup_use_search_dispatch(drbbdup_manager_t *manager)
+{
+#if defined(X86) || defined(AARCHXX)
+    if (drbbdup_case_zero_vs_nonzero(manager))
+        return false;
+    return drbbdup_count(manager) >= opts.dispatch_search_min_cases;
+#else
+    return false;
+#endif
+}
+
+typedef struct {
+    drbbdup_case_t *drbbdup_case;
+    instr_t *target; /* The start of the bb copy handling the case. */
+} drbbdup_search_entry_t;
+
+/* Inserts a binary search over entries[lo, hi), which are sorted by encoding, that
+ * jumps to the target of the entry matching the runtime encoding or else to
+ * default_label.
+ */
+static void
+drbbdup_insert_search(void *drcontext, instrlist_t *bb, instr_t *where,
+                      drbbdup_manager_t *manager, drbbdup_search_entry_t *entries, int lo,
+                      int hi, instr_t *default_label)
+{
+    if (hi - lo <= DISPATCH_SEARCH_LINEAR_CASES) {
+        for (int i = lo; i < hi; i++) {
+            drbbdup_insert_compare_encoding(drcontext, bb, where, manager,
+                                            entries[i].drbbdup_case,
+                                            manager->scratch_reg);
+            instrlist_meta_preinsert(
+                bb, where,
+                XINST_CREATE_jump_cond(drcontext, DR_PRED_EQ,
+                                       opnd_create_instr(entries[i].target)));
+        }
+        instrlist_meta_preinsert(
+            bb, where, XINST_CREATE_jump(drcontext, opnd_create_instr(default_label)));
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    instr_t *lower = INSTR_CREATE_label(drcontext);
+    drbbdup_insert_compare_encoding(drcontext, bb, where, manager,
+                                    entries[mid].drbbdup_case, manager->scratch_reg);
+    instrlist_meta_preinsert(
+        bb, where,
+        XINST_CREATE_jump_cond(drcontext, DR_PRED_EQ,
+                               opnd_create_instr(entries[mid].target)));
+    /* Encodings are unsigned. */
+    instrlist_meta_preinsert(bb, where,
+                             XINST_CREATE_jump_cond(drcontext,
+                                                    IF_X86_ELSE(DR_PRED_B, DR_PRED_LO),
+                                                    opnd_create_instr(lower)));
+    drbbdup_insert_search(drcontext, bb, where, manager, entries, mid + 1, hi,
+                          default_label);
+    instrlist_meta_preinsert(bb, where, lower);
+    drbbdup_insert_search(drcontext, bb, where, manager, entries, lo, mid,
+                          default_label);
+}
+
+/* Inserts, after the START label first_start of the first bb copy, a dispatcher that
+ * jumps directly to the START label of the copy whose case matches the runtime
+ * encoding, or to that of the default case copy.  The copies then need no dispatch
+ * code of their own beyond the landing restoration.
+ */
+static void
+drbbdup_insert_search_dispatch(void *drcontext, instrlist_t *bb, instr_t *where,
+                               drbbdup_manager_t *manager, instr_t *first_start)
+{
+    uint count = drbbdup_count(manager);
+    drbbdup_search_entry_t *entries =
+        dr_thread_alloc(drcontext, sizeof(drbbdup_search_entry_t) * count);
+    instr_t *first_copy = INSTR_CREATE_label(drcontext);
+    instr_t *start = first_start;
+    uint num_entries = 0;
+    for (int i = 0; i < opts.non_default_case_limit; i++) {
+        if (!manager->cases[i].is_defined)
+            continue;
+        ASSERT(num_entries < count && start != NULL, "bb copy count mismatch");
+        entries[num_entries].drbbdup_case = &manager->cases[i];
+        /* Falling through to the first copy avoids jumping back to its START label,
+         * which precedes this dispatcher.
+         */
+        entries[num_entries].target = num_entries == 0 ? first_copy : start;
+        num_entries++;
+        start = drbbdup_next_start(instr_get_next(start));
+    }
+    /* The last copy handles the default case. */
+    ASSERT(start != NULL && drbbdup_next_start(instr_get_next(start)) == NULL,
+           "bb copy count mismatch");
+
+    /* Sort by encoding.  There are few enough cases that insertion sort suffices. */
+    for (uint i = 1; i < num_entries; i++) {
+        drbbdup_search_entry_t entry = entries[i];
+        uint j = i;
+        for (; j > 0 && entries[j - 1].drbbdup_case->encoding >
+                 entry.drbbdup_case->encoding;
+             j--)
+            entries[j] = entries[j - 1];
+        entries[j] = entry;
+    }
+
+    drbbdup_insert_search(drcontext, bb, where, manager, entries, 0, (int)num_entries,
+                          start);
+    instrlist_meta_preinsert(bb, where, first_copy);
+    dr_thread_free(drcontext, entries, sizeof(drbbdup_search_entry_t) * count);
+}
+
 /* Returns whether or not additional cases should be handled by checking if the
  * copy limit, defined by the user, has been reached.
  */
@@ -1577,10 +1721,20 @@ drbbdup_instrument_dups(void *drcontext, void *tag, instrlist_t *bb, instr_t *in
             ASSERT(drbbdup_case->is_defined, "the found case cannot be undefined");
             ASSERT(pt->case_index + 1 == i,
                    "the next case considered should be the next increment");
+            bool is_first_copy = pt->case_index == DRBBDUP_DEFAULT_INDEX;
             pt->case_index = i; /* Move on to the next case. */
-            drbbdup_insert_dispatch(drcontext, bb,
-                                    next_instr /* insert after START label. */, manager,
-                                    next_bb_label, drbbdup_case);
+            if (drbbdup_use_search_dispatch(manager)) {
+                /* A single dispatcher at the top jumps straight to this copy. */
+                if (is_first_copy) {
+                    drbbdup_insert_search_dispatch(drcontext, bb, next_instr, manager,
+                                                   instr);
+                }
+                drbbdup_insert_landing_restoration(drcontext, bb, next_instr, manager);
+            } else {
+                drbbdup_insert_dispatch(drcontext, bb,
+                                        next_instr /* insert after START label. */,
+                                        manager, next_bb_label, drbbdup_case);
+            }
         }
 
         /* XXX i#4134: statistics -- insert code that tracks the number of times the
@@ -2375,6 +2529,8 @@ drbbdup_init(drbbdup_options_t *ops_in)
      * above.  Fields beyond ops_in will be left zero.
      */
     memcpy(&opts, ops_in, ops_in->struct_size);
+    if (opts.dispatch_search_min_cases == 0)
+        opts.dispatch_search_min_cases = DISPATCH_SEARCH_MIN_CASES;
 
     drreg_options_t drreg_ops = { sizeof(drreg_ops), 0 /* no regs needed */, false, NULL,
                                   true };
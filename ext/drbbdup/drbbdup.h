@@ -313,6 +313,8 @@ typedef struct {
      * encountered, control is directed to the default case.  If this is set to 0,
      * no duplication is performed on any block, and 0 is passed as the encoding to the
      * \p analyze_case and \p instrument_instr (and their extended version) callbacks.
+     * Blocks with many cases are dispatched with a binary search (see
+     * \p dispatch_search_min_cases), so large limits remain practical.
      */
     ushort non_default_case_limit;
     /**
@@ -351,6 +353,14 @@ typedef struct {
      * usage by not allocating bookkeeping data needed for dynamic handling.
      */
     bool never_enable_dynamic_handling;
+    /**
+     * The number of non-default cases at which a basic block's dispatcher switches
+     * from comparing the runtime encoding against each case encoding in turn to a
+     * binary search over the case encodings, which jumps directly to the matching
+     * copy.  Set to 0 for the default of 8.  Set to USHRT_MAX to always compare
+     * against each case in turn.
+     */
+    ushort dispatch_search_min_cases;
 } drbbdup_options_t;
 
 /**
@@ -35,7 +35,8 @@
  * Collects information about basic blocks that have been executed.
  * It simply stores the information of basic blocks seen in bb callback event
  * into a table without any instrumentation, and dumps the buffer into log files
- * on thread/process exit.
+ * on thread/process exit.  With DRCOVLIB_HIT_COUNTS, each block is also given an
+ * inline execution counter which is dumped alongside the table.
  *
  * There are pros and cons to creating this coverage library as opposed to other
  * tools using the drcov client straight-up as a 2nd client: DR has support for
@@ -78,6 +79,7 @@ static char logdir[MAXIMUM_PATH];
 
 typedef struct _per_thread_t {
     void *bb_table;
+    void *hit_table; /* one uint64 per bb_table entry, for DRCOVLIB_HIT_COUNTS */
     file_t log;
     char logname[MAXIMUM_PATH];
 } per_thread_t;
@@ -133,6 +135,25 @@ bb_table_entry_print(ptr_uint_t idx, void *entry, void *iter_data)
     return true; /* continue iteration */
 }
 
+static bool
+hit_table_entry_print(ptr_uint_t idx, void *entry, void *iter_data)
+{
+    per_thread_t *data = iter_data;
+    dr_fprintf(data->log, "bb[%6u]: " UINT64_FORMAT_STRING "\n", (uint)idx,
+               *(uint64 *)entry);
+    return true; /* continue iteration */
+}
+
+/* With hit counts, the process-wide tables are created unsynchronized and are
+ * instead guarded together by the bb table's lock, so that each entry and its
+ * counter are allocated at the same index.
+ */
+static inline bool
+tables_need_lock(per_thread_t *data)
+{
+    return data->hit_table != NULL && !drcov_per_thread;
+}
+
 static void
 bb_table_print(void *drcontext, per_thread_t *data)
 {
@@ -147,6 +168,8 @@ bb_table_print(void *drcontext, per_thread_t *data)
      */
     ASSERT(drtable_num_entries(data->bb_table) <= UINT_MAX,
            "block count exceeds 32-bit max");
+    if (tables_need_lock(data))
+        drtable_lock(data->bb_table);
     dr_fprintf(data->log, "BB Table: %u bbs\n",
                (uint)drtable_num_entries(data->bb_table));
     if (TEST(DRCOVLIB_DUMP_AS_TEXT, options.flags)) {
@@ -154,16 +177,45 @@ bb_table_print(void *drcontext, per_thread_t *data)
         drtable_iterate(data->bb_table, data, bb_table_entry_print);
     } else
         drtable_dump_entries(data->bb_table, data->log);
+    if (data->hit_table != NULL) {
+        ASSERT(drtable_num_entries(data->hit_table) ==
+                   drtable_num_entries(data->bb_table),
+               "hit table is out of sync with bb table");
+        /* The counters of blocks still in the cache keep changing while we write
+         * them out, so a dump is only a snapshot.
+         */
+        dr_fprintf(data->log, DRCOV_HIT_COUNTS_HEADER,
+                   (uint)drtable_num_entries(data->hit_table));
+        if (TEST(DRCOVLIB_DUMP_AS_TEXT, options.flags)) {
+            dr_fprintf(data->log, "bb index, hits:\n");
+            drtable_iterate(data->hit_table, data, hit_table_entry_print);
+        } else
+            drtable_dump_entries(data->hit_table, data->log);
+    }
+    if (tables_need_lock(data))
+        drtable_unlock(data->bb_table);
 }
 
-static void
+/* Returns the block's execution counter, or NULL if hit counts are not enabled. */
+static uint64 *
 bb_table_entry_add(void *drcontext, per_thread_t *data, app_pc start, uint size)
 {
-    bb_entry_t *bb_entry = drtable_alloc(data->bb_table, 1, NULL);
+    bb_entry_t *bb_entry;
+    uint64 *hits = NULL;
     uint mod_id;
     app_pc mod_seg_start;
     drcovlib_status_t res =
         drmodtrack_lookup_segment(drcontext, start, &mod_id, &mod_seg_start);
+    if (data->hit_table != NULL) {
+        if (tables_need_lock(data))
+            drtable_lock(data->bb_table);
+        bb_entry = drtable_alloc(data->bb_table, 1, NULL);
+        hits = drtable_alloc(data->hit_table, 1, NULL);
+        if (tables_need_lock(data))
+            drtable_unlock(data->bb_table);
+        *hits = 0;
+    } else
+        bb_entry = drtable_alloc(data->bb_table, 1, NULL);
     /* we do not de-duplicate repeated bbs */
     ASSERT(size < USHRT_MAX, "size overflow");
     bb_entry->size = (ushort)size;
@@ -181,6 +233,7 @@ bb_table_entry_add(void *drcontext, per_thread_t *data, app_pc start, uint size)
         bb_entry->mod_id = UNKNOWN_MODULE_ID;
         bb_entry->start = (uint)(ptr_uint_t)start;
     }
+    return hits;
 }
 
 #define INIT_BB_TABLE_ENTRIES 4096
@@ -197,6 +250,13 @@ bb_table_destroy(void *table, void *data)
     drtable_destroy(table, data);
 }
 
+static void *
+hit_table_create(void)
+{
+    return drtable_create(INIT_BB_TABLE_ENTRIES, sizeof(uint64), 0 /* flags */,
+                          false /* !synch */, NULL);
+}
+
 static void
 version_print(file_t log)
 {
@@ -257,7 +317,13 @@ thread_data_create(void *drcontext)
     /* XXX: can we assume bb create event is serialized,
      * if so, no lock is required for bb_table operation.
      */
-    data->bb_table = bb_table_create(drcontext == NULL ? true : false);
+    if (TEST(DRCOVLIB_HIT_COUNTS, options.flags)) {
+        data->bb_table = bb_table_create(false);
+        data->hit_table = hit_table_create();
+    } else {
+        data->bb_table = bb_table_create(drcontext == NULL ? true : false);
+        data->hit_table = NULL;
+    }
     log_file_create(drcontext, data);
     return data;
 }
@@ -267,6 +333,8 @@ thread_data_destroy(void *drcontext, per_thread_t *data)
 {
     /* destroy the bb table */
     bb_table_destroy(data->bb_table, data);
+    if (data->hit_table != NULL)
+        drtable_destroy(data->hit_table, data);
     dr_close_file(data->log);
     /* free thread data */
     if (drcontext == NULL) {
@@ -339,8 +407,12 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb, bool for
     per_thread_t *data;
     instr_t *instr;
     app_pc tag_pc, start_pc, end_pc;
+    dr_emit_flags_t flags = DR_EMIT_DEFAULT;
 
-    /* do nothing for translation */
+    *user_data = NULL;
+    /* Do nothing for translation.  With hit counts we store translations
+     * instead, as we would otherwise need to find the block's prior counter.
+     */
     if (translating)
         return DR_EMIT_DEFAULT;
 
@@ -376,12 +448,34 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb, bool for
      * 4. The duplication can be easily handled in a post-processing step,
      *    which is required anyway.
      */
-    bb_table_entry_add(drcontext, data, tag_pc, (uint)(end_pc - start_pc));
+    *user_data = bb_table_entry_add(drcontext, data, tag_pc, (uint)(end_pc - start_pc));
+    if (*user_data != NULL)
+        flags |= DR_EMIT_STORE_TRANSLATIONS;
 
     if (go_native)
-        return DR_EMIT_GO_NATIVE;
-    else
+        flags |= DR_EMIT_GO_NATIVE;
+    return flags;
+}
+
+/* For DRCOVLIB_HIT_COUNTS, bumps the counter handed to us by the analysis event
+ * at the top of the block.  Each copy of a block (e.g., one rebuilt after a flush
+ * or as part of a trace) gets its own entry and counter, and the post-processing
+ * tools add them up.
+ */
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                      bool for_trace, bool translating, void *user_data)
+{
+    if (user_data == NULL || !drmgr_is_first_instr(drcontext, inst))
         return DR_EMIT_DEFAULT;
+    /* ARM 32-bit has no 64-bit counter update, so there we only update the low
+     * half of the little-endian counter.
+     */
+    if (!drx_insert_counter_update(drcontext, bb, inst, SPILL_SLOT_MAX + 1,
+                                   IF_AARCHXX_OR_RISCV64_(SPILL_SLOT_MAX + 1) user_data,
+                                   1, IF_ARM_ELSE(0, DRX_COUNTER_64BIT)))
+        ASSERT(false, "failed to insert hit counter update");
+    return DR_EMIT_DEFAULT;
 }
 
 static void
@@ -556,7 +650,8 @@ drcovlib_init(drcovlib_options_t *ops)
 
     if (ops->struct_size != sizeof(options))
         return DRCOVLIB_ERROR_INVALID_PARAMETER;
-    if ((ops->flags & (~(DRCOVLIB_DUMP_AS_TEXT | DRCOVLIB_THREAD_PRIVATE))) != 0)
+    if ((ops->flags &
+         (~(DRCOVLIB_DUMP_AS_TEXT | DRCOVLIB_THREAD_PRIVATE | DRCOVLIB_HIT_COUNTS))) != 0)
         return DRCOVLIB_ERROR_INVALID_PARAMETER;
     if (TEST(DRCOVLIB_THREAD_PRIVATE, ops->flags)) {
         if (!dr_using_all_private_caches())
@@ -588,7 +683,9 @@ drcovlib_init(drcovlib_options_t *ops)
 
     drmgr_register_thread_init_event(event_thread_init);
     drmgr_register_thread_exit_event(event_thread_exit);
-    drmgr_register_bb_instrumentation_event(event_basic_block_analysis, NULL, NULL);
+    drmgr_register_bb_instrumentation_event(
+        event_basic_block_analysis,
+        TEST(DRCOVLIB_HIT_COUNTS, options.flags) ? event_app_instruction : NULL, NULL);
     dr_register_filter_syscall_event(event_filter_syscall);
     drmgr_register_pre_syscall_event(event_pre_syscall);
 #ifdef UNIX
@@ -78,6 +78,18 @@ typedef enum {
      * drcovlib's own thread exit events rather than in drcovlib_exit().
      */
     DRCOVLIB_THREAD_PRIVATE = 0x0002,
+    /**
+     * By default, only which basic blocks were executed is recorded, with no
+     * instrumentation added to the blocks themselves.  This flag requests that
+     * each block additionally be instrumented with an inline counter of how many
+     * times it was executed, and that these counts be appended to the log file.
+     * The counters are updated without atomic operations, so when the coverage
+     * is process-wide and several threads run the same block the counts are
+     * approximate; combine with #DRCOVLIB_THREAD_PRIVATE for exact counts.
+     * The post-processing tool \ref sec_drcov2lcov reports the counts as
+     * per-line hit counts.
+     */
+    DRCOVLIB_HIT_COUNTS = 0x0004,
 } drcovlib_flags_t;
 
 /** Specifies the options when initializing drcovlib. */
@@ -121,6 +133,12 @@ typedef struct _drcovlib_options_t {
 #define DRCOV_VERSION_SEGMENT_OFFSETS 3
 #define DRCOV_VERSION DRCOV_VERSION_SEGMENT_OFFSETS
 
+/* With DRCOVLIB_HIT_COUNTS, the BB table is followed by this header and then one
+ * uint64 execution count per BB table entry, in the same order.  Readers which
+ * stop after the BB table are unaffected, so the version is unchanged.
+ */
+#define DRCOV_HIT_COUNTS_HEADER "BB Hit Counts: %u bbs\n"
+
 /* i#1532: drsyms can't mix arch for ELF */
 #ifdef LINUX
 #    ifdef X64
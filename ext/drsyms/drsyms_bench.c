@@ -32,8 +32,9 @@
 
 /* DRSyms benchmarking standalone app. */
 
-/* This is a standalone app for benchmarking drsyms.  Currently we just time
- * symbol enumeration of an arbitrary object file.
+/* This is a standalone app for benchmarking drsyms.  We time symbol
+ * enumeration of an arbitrary object file, and then the throughput of address
+ * lookups of its symbols from one and from several threads.
  */
 
 #include <stdio.h>
@@ -43,8 +44,22 @@
 #include "dr_api.h"
 #include "drsyms.h"
 
+#ifdef UNIX
+#    include <pthread.h>
+#endif
+
 static char sym_buf[4096];
 
+/* Symbol offsets gathered during enumeration, for timing address lookups. */
+#define MAX_LOOKUP_OFFS 65536
+static size_t lookup_offs[MAX_LOOKUP_OFFS];
+static uint num_lookup_offs;
+
+#define LOOKUPS_PER_THREAD 200000
+#define MAX_THREADS 64
+
+static const char *lookup_modpath;
+
 static int
 usage(const char *msg)
 {
@@ -58,7 +73,7 @@ usage(const char *msg)
     if (msg != NULL && msg[0] != '\0') {
         dr_fprintf(STDERR, "%s\n", msg);
     }
-    dr_fprintf(STDERR, "usage: bench <modpath>\n");
+    dr_fprintf(STDERR, "usage: bench <modpath> [num_threads]\n");
     return 1;
 }
 
@@ -70,6 +85,8 @@ sym_callback(const char *name, size_t modoffs, void *data)
 {
     uint64 *count = (uint64 *)data;
     *count += 1;
+    if (num_lookup_offs < MAX_LOOKUP_OFFS)
+        lookup_offs[num_lookup_offs++] = modoffs;
     if (*count % 50000 == 0) {
         dr_printf("{\"%s\",\n", name);
         memset(sym_buf, 0, sizeof(sym_buf));
@@ -103,10 +120,76 @@ enumerate_with_flags(const char *modpath, drsym_flags_t flags)
     dr_printf("Took %d.%03d seconds.\n", (int)(time / 1000), (int)(time % 1000));
 }
 
+/* Looks up LOOKUPS_PER_THREAD addresses, starting at a different point in
+ * lookup_offs for each thread so they do not all ask for the same one at once.
+ */
+#ifdef WINDOWS
+static DWORD WINAPI
+#else
+static void *
+#endif
+lookup_thread(void *arg)
+{
+    uint start = (uint)(ptr_uint_t)arg;
+    char name[256];
+    drsym_info_t info;
+    uint i;
+    for (i = 0; i < LOOKUPS_PER_THREAD; i++) {
+        info.struct_size = sizeof(info);
+        info.name = name;
+        info.name_size = sizeof(name);
+        info.file = NULL;
+        info.file_size = 0;
+        drsym_lookup_address(lookup_modpath, lookup_offs[(start + i) % num_lookup_offs],
+                             &info, DRSYM_DEFAULT_FLAGS);
+    }
+    return 0;
+}
+
+static void
+lookup_with_threads(const char *modpath, uint num_threads)
+{
+    uint64 start, end, time, lookups;
+#ifdef WINDOWS
+    HANDLE threads[MAX_THREADS];
+#else
+    pthread_t threads[MAX_THREADS];
+#endif
+    uint i;
+
+    lookup_modpath = modpath;
+    dr_printf("Beginning address lookups on %d thread(s)\n", num_threads);
+    start = dr_get_milliseconds();
+    for (i = 0; i < num_threads; i++) {
+        void *arg = (void *)(ptr_uint_t)(i * (num_lookup_offs / num_threads));
+#ifdef WINDOWS
+        threads[i] = CreateThread(NULL, 0, lookup_thread, arg, 0, NULL);
+#else
+        pthread_create(&threads[i], NULL, lookup_thread, arg);
+#endif
+    }
+    for (i = 0; i < num_threads; i++) {
+#ifdef WINDOWS
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    end = dr_get_milliseconds();
+    dr_printf("Finished address lookups.\n");
+
+    time = end - start;
+    lookups = (uint64)num_threads * LOOKUPS_PER_THREAD;
+    dr_printf("Took %d.%03d seconds: %d lookups/ms.\n", (int)(time / 1000),
+              (int)(time % 1000), (int)(lookups / (time == 0 ? 1 : time)));
+}
+
 int
 main(int argc, char **argv)
 {
     const char *modpath;
+    uint num_threads = 4;
 #ifdef WINDOWS
     char full_path[2048];
 #endif
@@ -114,10 +197,15 @@ main(int argc, char **argv)
     dr_standalone_init();
     drsym_init(0);
 
-    if (argc != 2) {
+    if (argc != 2 && argc != 3) {
         return usage(NULL);
     }
     modpath = argv[1];
+    if (argc == 3) {
+        num_threads = (uint)atoi(argv[2]);
+        if (num_threads == 0 || num_threads > MAX_THREADS)
+            return usage("Invalid thread count.");
+    }
 #ifdef WINDOWS
     /* Work around i#289. */
     if (GetFullPathName(modpath, sizeof(full_path), full_path, NULL) == 0) {
@@ -133,8 +221,18 @@ main(int argc, char **argv)
      * about how long the second enumeration takes.
      */
     enumerate_with_flags(modpath, DRSYM_DEFAULT_FLAGS);
+    num_lookup_offs = 0;
     enumerate_with_flags(modpath, DRSYM_DEFAULT_FLAGS);
 
+    /* The first lookup builds the address indexes, which we leave out of the
+     * timing by doing it on one thread before comparing with several.
+     */
+    if (num_lookup_offs > 0) {
+        lookup_with_threads(modpath, 1);
+        if (num_threads > 1)
+            lookup_with_threads(modpath, num_threads);
+    }
+
     drsym_exit();
     dr_standalone_exit();
 }
@@ -55,6 +55,18 @@ static bool verbose = false;
         }                                                                      \
     } while (0)
 
+/* A line table row in the module-wide index built by drsym_dwarf_index_lines(). */
+typedef struct _line_entry_t {
+    Dwarf_Addr addr;
+    /* From .debug_str or .debug_line: lives until dwarf_end(). */
+    const char *file;
+    int line;
+    /* The row ends a sequence: its address is past the last instruction. */
+    bool end_sequence;
+    /* The row's position in the module, used to keep the sort stable. */
+    size_t ordinal;
+} line_entry_t;
+
 typedef struct _dwarf_module_t {
     byte *load_base;
     dwarf_lib_handle_t dbg;
@@ -64,6 +76,10 @@ typedef struct _dwarf_module_t {
     size_t num_lines;
     /* Amount to adjust all offsets for __PAGEZERO + PIE (i#1365) */
     ssize_t offs_adjust;
+    /* Every line in the module sorted by address, or NULL if not yet built. */
+    line_entry_t *line_index;
+    size_t line_index_size;
+    size_t line_index_capacity;
 } dwarf_module_t;
 
 typedef enum {
@@ -76,6 +92,10 @@ static search_result_t
 search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, Dwarf_Die *cu_die,
                        drsym_info_t *sym_info DR_PARAM_OUT);
 
+static bool
+search_addr2line_in_index(dwarf_module_t *mod, Dwarf_Addr pc,
+                          drsym_info_t *sym_info DR_PARAM_OUT);
+
 /******************************************************************************
  * DWARF parsing code.
  */
@@ -189,6 +209,9 @@ drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc,
     sym_info->line = 0;
     sym_info->line_offs = 0;
 
+    if (mod->line_index != NULL)
+        return search_addr2line_in_index(mod, pc, sym_info);
+
     /* First try cutting down the search space by finding the CU (i.e., the .c
      * file) that this function belongs to.
      */
@@ -416,6 +439,161 @@ drsym_dwarf_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, voi
     return success;
 }
 
+/* Calls "callback" on each CU with line information, stopping early if it
+ * returns false.
+ */
+static void
+iterate_cu_lines(dwarf_module_t *mod,
+                 bool (*callback)(Dwarf_Lines *lines, size_t num_lines, void *data),
+                 void *data)
+{
+    Dwarf_Die cu_die;
+    Dwarf_Off cu_offset = 0, prev_offset = 0;
+    size_t hsize;
+
+    while (dwarf_nextcu(mod->dbg, cu_offset, &cu_offset, &hsize, NULL, NULL, NULL) == 0) {
+        if (dwarf_offdie(mod->dbg, prev_offset + hsize, &cu_die) != NULL) {
+            Dwarf_Lines *lines;
+            size_t num_lines;
+            /* We do not go through get_lines_from_cu(): libdw keeps each CU's
+             * lines itself and we have no use for the single-CU cache here.
+             */
+            if (dwarf_getsrclines(&cu_die, &lines, &num_lines) == 0 &&
+                !(*callback)(lines, num_lines, data))
+                break;
+        }
+        prev_offset = cu_offset;
+    }
+
+    while (dwarf_nextcu(mod->dbg, cu_offset, &cu_offset, &hsize, NULL, NULL, NULL) == 0) {
+        /* Reset the internal CU header state. */
+    }
+}
+
+static bool
+count_lines_cb(Dwarf_Lines *lines, size_t num_lines, void *data)
+{
+    *(size_t *)data += num_lines;
+    return true;
+}
+
+typedef struct _index_lines_data_t {
+    line_entry_t *index;
+    size_t capacity;
+    size_t count;
+    bool failed;
+} index_lines_data_t;
+
+static bool
+index_lines_cb(Dwarf_Lines *lines, size_t num_lines, void *data_in)
+{
+    index_lines_data_t *data = (index_lines_data_t *)data_in;
+    size_t i;
+    for (i = 0; i < num_lines; i++) {
+        Dwarf_Line *line = dwarf_onesrcline(lines, i);
+        line_entry_t *entry;
+        bool end_sequence;
+        if (data->count >= data->capacity) {
+            /* libdw changed its mind about the line count: give up. */
+            data->failed = true;
+            return false;
+        }
+        entry = &data->index[data->count];
+        if (line == NULL || dwarf_lineaddr(line, &entry->addr) != 0 ||
+            dwarf_lineendsequence(line, &end_sequence) != 0) {
+            NOTIFY_DWARF();
+            continue;
+        }
+        entry->end_sequence = end_sequence;
+        entry->file = dwarf_linesrc(line, NULL, NULL);
+        if (dwarf_lineno(line, &entry->line) != 0)
+            entry->line = 0;
+        entry->ordinal = data->count;
+        data->count++;
+    }
+    return true;
+}
+
+static int
+compare_line_entries(const void *a_in, const void *b_in)
+{
+    const line_entry_t *a = (const line_entry_t *)a_in;
+    const line_entry_t *b = (const line_entry_t *)b_in;
+    if (a->addr != b->addr)
+        return a->addr < b->addr ? -1 : 1;
+    /* A sequence may end where the next one starts: the end goes first so that
+     * the address maps to the start of the new sequence.
+     */
+    if (a->end_sequence != b->end_sequence)
+        return a->end_sequence ? -1 : 1;
+    return a->ordinal < b->ordinal ? -1 : (a->ordinal > b->ordinal ? 1 : 0);
+}
+
+bool
+drsym_dwarf_index_lines(void *mod_in)
+{
+    dwarf_module_t *mod = (dwarf_module_t *)mod_in;
+    index_lines_data_t data;
+    size_t total = 0;
+
+    if (mod->line_index != NULL)
+        return true;
+    iterate_cu_lines(mod, count_lines_cb, &total);
+    if (total == 0)
+        return false;
+    data.index = (line_entry_t *)dr_global_alloc(total * sizeof(*data.index));
+    data.capacity = total;
+    data.count = 0;
+    data.failed = false;
+    iterate_cu_lines(mod, index_lines_cb, &data);
+    if (data.failed || data.count == 0) {
+        dr_global_free(data.index, total * sizeof(*data.index));
+        return false;
+    }
+    qsort(data.index, data.count, sizeof(*data.index), compare_line_entries);
+    mod->line_index_size = data.count;
+    mod->line_index_capacity = total;
+    mod->line_index = data.index;
+    return true;
+}
+
+/* Finds the last row at or below "pc".  Rows with equal addresses are ordered as
+ * in the per-CU search, which also took the last of them.
+ */
+static bool
+search_addr2line_in_index(dwarf_module_t *mod, Dwarf_Addr pc,
+                          drsym_info_t *sym_info DR_PARAM_OUT)
+{
+    size_t lo = 0, hi = mod->line_index_size;
+    const line_entry_t *entry;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (mod->line_index[mid].addr <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return false;
+    entry = &mod->line_index[lo - 1];
+    NOTIFY("%s: pc " PFX " vs line " PFX "\n", __FUNCTION__, (ptr_uint_t)pc,
+           (ptr_uint_t)entry->addr);
+    /* Like the per-CU search we report a row that ends a sequence rather than
+     * failing: a return address just past a final noreturn call lands there.
+     */
+    if (entry->file == NULL)
+        return false;
+    sym_info->file_available_size = strlen(entry->file);
+    if (sym_info->file != NULL) {
+        strncpy(sym_info->file, entry->file, sym_info->file_size);
+        sym_info->file[sym_info->file_size - 1] = '\0';
+    }
+    sym_info->line = entry->line;
+    sym_info->line_offs = (size_t)(pc - entry->addr);
+    return true;
+}
+
 void *
 drsym_dwarf_init(dwarf_lib_handle_t dbg)
 {
@@ -429,6 +607,10 @@ void
 drsym_dwarf_exit(void *mod_in)
 {
     dwarf_module_t *mod = (dwarf_module_t *)mod_in;
+    if (mod->line_index != NULL) {
+        dr_global_free(mod->line_index,
+                       mod->line_index_capacity * sizeof(*mod->line_index));
+    }
     dwarf_end(mod->dbg);
     dr_global_free(mod, sizeof(*mod));
 }
@@ -463,6 +463,13 @@ drsym_dwarf_exit(void *mod_in)
     dr_global_free(mod, sizeof(*mod));
 }
 
+bool
+drsym_dwarf_index_lines(void *mod_in)
+{
+    /* XXX: Not implemented for libelftc: searches go through its per-CU state. */
+    return false;
+}
+
 void
 drsym_dwarf_set_obj_offs(void *mod_in, ssize_t adjust)
 {
@@ -47,6 +47,7 @@
 #    include "libdwarf.h"
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -128,11 +129,26 @@ static int verbose = 0;
 #    endif
 #endif
 
+/* An entry in the address-sorted view of the symbol table.  "max_hi" is the
+ * greatest "hi" of this and all prior entries, which bounds how far back a
+ * search for a symbol containing an address needs to look.
+ */
+typedef struct _addr_entry_t {
+    size_t lo;
+    size_t hi;
+    size_t max_hi;
+    uint idx;
+} addr_entry_t;
+
 typedef struct _elf_info_t {
     Elf *elf;
     Elf_Sym *syms;
     int strtab_idx;
     int num_syms;
+    /* Sorted by (lo, idx).  Built when the module is loaded and never modified
+     * afterward, so searches need no synchronization.
+     */
+    addr_entry_t *addr_index;
     byte *map_base;
     ptr_uint_t load_base;
     drsym_debug_kind_t debug_kind;
@@ -323,12 +339,70 @@ drsym_obj_mod_init_pre(byte *map_base, size_t map_size)
     return (void *)mod;
 }
 
+static int
+compare_addr_entries(const void *a_in, const void *b_in)
+{
+    const addr_entry_t *a = (const addr_entry_t *)a_in;
+    const addr_entry_t *b = (const addr_entry_t *)b_in;
+    if (a->lo != b->lo)
+        return a->lo < b->lo ? -1 : 1;
+    /* Keep symtab order among equal starts: the linear search we replaced
+     * returned the first match, and callers may depend on that choice.
+     */
+    return a->idx < b->idx ? -1 : (a->idx > b->idx ? 1 : 0);
+}
+
+static void
+build_addr_index(elf_info_t *mod)
+{
+    int i;
+    size_t max_hi = 0;
+    if (mod->syms == NULL || mod->num_syms <= 0)
+        return;
+    mod->addr_index = dr_global_alloc(mod->num_syms * sizeof(*mod->addr_index));
+    for (i = 0; i < mod->num_syms; i++) {
+        /* Imports are included, with the same wraparound as the offsets the
+         * search has always compared against.
+         */
+        mod->addr_index[i].lo = mod->syms[i].st_value - mod->load_base;
+        mod->addr_index[i].hi = mod->addr_index[i].lo + mod->syms[i].st_size;
+        mod->addr_index[i].idx = i;
+    }
+    qsort(mod->addr_index, mod->num_syms, sizeof(*mod->addr_index),
+          compare_addr_entries);
+    for (i = 0; i < mod->num_syms; i++) {
+        if (mod->addr_index[i].hi > max_hi)
+            max_hi = mod->addr_index[i].hi;
+        mod->addr_index[i].max_hi = max_hi;
+    }
+    /* libelf reads in the string table on its first use, so do that now rather
+     * than from concurrent lookups.
+     */
+    elf_strptr(mod->elf, mod->strtab_idx, 0);
+}
+
+/* Returns the number of index entries with lo <= modoffs. */
+static int
+addr_index_upper_bound(elf_info_t *mod, size_t modoffs)
+{
+    int lo = 0, hi = mod->num_syms;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (mod->addr_index[mid].lo <= modoffs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 bool
 drsym_obj_mod_init_post(void *mod_in, byte *map_base, void *dwarf_info)
 {
     elf_info_t *mod = (elf_info_t *)mod_in;
     mod->map_base = map_base; /* shouldn't change, though */
     mod->load_base = find_load_base(mod->elf);
+    build_addr_index(mod);
     return true;
 }
 
@@ -361,6 +435,8 @@ drsym_obj_mod_exit(void *mod_in)
         return;
     if (mod->elf != NULL)
         elf_end(mod->elf);
+    if (mod->addr_index != NULL)
+        dr_global_free(mod->addr_index, mod->num_syms * sizeof(*mod->addr_index));
     dr_global_free(mod, sizeof(*mod));
 }
 
@@ -453,44 +529,60 @@ drsym_error_t
 drsym_obj_addrsearch_symtab(void *mod_in, size_t modoffs, uint *idx DR_PARAM_OUT)
 {
     elf_info_t *mod = (elf_info_t *)mod_in;
-    int i;
-    int closest_idx = -1;
-    size_t closest_diff = SIZE_T_MAX;
+    int count, i, lo, hi;
+    int found_idx = -1;
+    size_t closest_lo;
 
     if (mod == NULL || mod->syms == NULL || idx == NULL)
         return DRSYM_ERROR;
+    if (mod->addr_index == NULL)
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
 
     NOTIFY(1, "%s: +" PIFX "\n", __FUNCTION__, modoffs);
     /* XXX: if a function is split into non-contiguous pieces, will it
      * have multiple entries?
      */
-    for (i = 0; i < mod->num_syms; i++) {
-        size_t lo_offs = mod->syms[i].st_value - mod->load_base;
-        size_t hi_offs = lo_offs + mod->syms[i].st_size;
-        NOTIFY(3, "\tcomparing +" PIFX " to " PIFX "-" PIFX "\n", modoffs, lo_offs,
-               hi_offs);
-        if (lo_offs <= modoffs && modoffs < hi_offs) {
-            NOTIFY(2, "\tfound +" PIFX " in " PIFX "-" PIFX "\n", modoffs, lo_offs,
-                   hi_offs);
-            *idx = i;
-            return DRSYM_SUCCESS;
-        }
-        /* i#1337: handle st_size==0 asm routines */
-        if (modoffs >= lo_offs) {
-            if (modoffs - lo_offs < closest_diff) {
-                closest_idx = i;
-                closest_diff = modoffs - lo_offs;
-                NOTIFY(3, "\tclosest diff is now " PIFX "\n", closest_diff);
-            }
-        }
+    count = addr_index_upper_bound(mod, modoffs);
+    /* Every symbol containing modoffs starts at or below it, and we can stop
+     * walking back once no earlier symbol reaches past it.  As symbols may
+     * overlap, pick the one earliest in the symtab among those containing it.
+     */
+    for (i = count - 1; i >= 0 && mod->addr_index[i].max_hi > modoffs; i--) {
+        NOTIFY(3, "\tcomparing +" PIFX " to " PIFX "-" PIFX "\n", modoffs,
+               mod->addr_index[i].lo, mod->addr_index[i].hi);
+        if (modoffs < mod->addr_index[i].hi &&
+            (found_idx < 0 || mod->addr_index[i].idx < (uint)found_idx))
+            found_idx = mod->addr_index[i].idx;
     }
+    if (found_idx >= 0) {
+        NOTIFY(2, "\tfound +" PIFX " in symbol %d\n", modoffs, found_idx);
+        *idx = found_idx;
+        return DRSYM_SUCCESS;
+    }
+    if (count == 0)
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
 
-    if (closest_idx >= 0 && mod->syms[closest_idx].st_size == 0) {
+    /* i#1337: handle st_size==0 asm routines by using the closest symbol below,
+     * which is the first in symtab order among those sharing the greatest start.
+     */
+    closest_lo = mod->addr_index[count - 1].lo;
+    lo = 0;
+    hi = count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (mod->addr_index[mid].lo < closest_lo)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    found_idx = mod->addr_index[lo].idx;
+    if (mod->syms[found_idx].st_size == 0) {
         /* i#1337: rule out anything without a name */
-        const char *name = drsym_obj_symbol_name(mod_in, closest_idx);
-        NOTIFY(2, "\tusing closest +" PIFX " diff " PIFX "\n", modoffs, closest_diff);
+        const char *name = drsym_obj_symbol_name(mod_in, found_idx);
+        NOTIFY(2, "\tusing closest +" PIFX " diff " PIFX "\n", modoffs,
+               modoffs - closest_lo);
         if (name != NULL && name[0] != '\0') {
-            *idx = closest_idx;
+            *idx = found_idx;
             return DRSYM_SUCCESS;
         }
     }
@@ -139,4 +139,12 @@ drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc,
 drsym_error_t
 drsym_dwarf_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data);
 
+/* Builds an address-sorted table of every line in the module, after which
+ * drsym_dwarf_search_addr2line() only reads that table and so may be called
+ * concurrently.  Returns false if the table is not supported or could not be
+ * built, in which case searches keep using (and updating) per-CU state.
+ */
+bool
+drsym_dwarf_index_lines(void *mod_in);
+
 #endif /* DRSYMS_ARCH_H */
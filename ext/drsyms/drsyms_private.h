@@ -133,4 +133,15 @@ drsym_unix_get_module_debug_kind(void *moddata, drsym_debug_kind_t *kind DR_PARA
 drsym_error_t
 drsym_unix_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data);
 
+/* Builds what drsym_unix_lookup_address() (or, if "by_name",
+ * drsym_unix_lookup_symbol()) needs so that later calls on this module modify no
+ * shared state.  Once drsym_unix_lookup_ready() returns true those calls need
+ * only ensure the module is not unloaded underneath them.
+ */
+void
+drsym_unix_prepare_lookup(void *mod_in, bool by_name);
+
+bool
+drsym_unix_lookup_ready(void *mod_in, bool by_name);
+
 #endif /* DRSYMS_PRIVATE_H */
@@ -73,6 +73,11 @@ typedef struct _dbg_module_t {
     struct _dbg_module_t *mod_with_dwarf;
 #define SYMTABLE_HASH_BITS 12
     hashtable_t symtable;
+    /* Set once drsym_unix_prepare_lookup() has built what address or name
+     * lookups need, after which those lookups modify nothing.
+     */
+    volatile int address_lookup_ready;
+    volatile int symbol_lookup_ready;
 } dbg_module_t;
 
 /******************************************************************************
@@ -697,6 +702,39 @@ drsym_unix_lookup_address(void *mod_in, size_t modoffs, drsym_info_t *out DR_PAR
     return r;
 }
 
+void
+drsym_unix_prepare_lookup(void *mod_in, bool by_name)
+{
+    dbg_module_t *mod = (dbg_module_t *)mod_in;
+    if (drsym_unix_lookup_ready(mod_in, by_name))
+        return;
+    if (by_name) {
+        if (mod->symtable.entries == 0) {
+            symsearch_symtab(mod, drsym_fill_symtable_cb, NULL, sizeof(drsym_info_t), mod,
+                             DRSYM_LEAVE_MANGLED);
+        }
+        dr_atomic_store32(&mod->symbol_lookup_ready, 1);
+    } else {
+        dbg_module_t *mod4line = mod;
+        if (mod->mod_with_dwarf != NULL)
+            mod4line = mod->mod_with_dwarf;
+        /* Without the index, line searches cache per-CU state. */
+        if (mod4line->dwarf_info != NULL &&
+            !drsym_dwarf_index_lines(mod4line->dwarf_info))
+            return;
+        dr_atomic_store32(&mod->address_lookup_ready, 1);
+    }
+}
+
+bool
+drsym_unix_lookup_ready(void *mod_in, bool by_name)
+{
+    dbg_module_t *mod = (dbg_module_t *)mod_in;
+    if (by_name)
+        return dr_atomic_load32(&mod->symbol_lookup_ready) != 0;
+    return dr_atomic_load32(&mod->address_lookup_ready) != 0;
+}
+
 drsym_error_t
 drsym_unix_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data)
 {
@@ -47,11 +47,19 @@
 #include "drsyms_private.h"
 #include "hashtable.h"
 
-/* Guards our internal state and libdwarf's modifications of mod->dbg.
+/* Guards our internal state and libdwarf's modifications of mod->dbg, except
+ * for the lookups described at modtable_lock.
  * We use a recursive lock to allow queries to be called from enumerate callbacks.
  */
 static void *symbol_lock;
 
+/* Guards modtable's membership, and thus each module's lifetime, for lookups
+ * which skip symbol_lock because their module has been prepared for concurrent
+ * use (see drsym_unix_prepare_lookup()).  Anyone adding or removing a module
+ * must hold symbol_lock first and then this lock for writing.
+ */
+static void *modtable_lock;
+
 /* We have to restrict operations when operating in a nested query from a callback */
 static bool recursive_context;
 
@@ -75,12 +83,30 @@ lookup_or_load(const char *modpath)
     if (mod == NULL) {
         mod = drsym_unix_load(modpath);
         if (mod != NULL) {
+            dr_rwlock_write_lock(modtable_lock);
             hashtable_add(&modtable, (void *)modpath, mod);
+            dr_rwlock_write_unlock(modtable_lock);
         }
     }
     return mod;
 }
 
+/* Returns the module for modpath if lookups of the given kind can run on it
+ * without symbol_lock, in which case modtable_lock is held for reading and the
+ * caller must release it.
+ */
+static void *
+lookup_ready(const char *modpath, bool by_name)
+{
+    void *mod;
+    dr_rwlock_read_lock(modtable_lock);
+    mod = hashtable_lookup(&modtable, (void *)modpath);
+    if (mod != NULL && drsym_unix_lookup_ready(mod, by_name))
+        return mod;
+    dr_rwlock_read_unlock(modtable_lock);
+    return NULL;
+}
+
 static drsym_error_t
 drsym_enumerate_symbols_local(const char *modpath, drsym_enumerate_cb callback,
                               drsym_enumerate_ex_cb callback_ex, size_t info_size,
@@ -117,6 +143,13 @@ drsym_lookup_symbol_local(const char *modpath, const char *symbol,
     if (modpath == NULL || symbol == NULL || modoffs == NULL)
         return DRSYM_ERROR_INVALID_PARAMETER;
 
+    mod = lookup_ready(modpath, true /*by name*/);
+    if (mod != NULL) {
+        r = drsym_unix_lookup_symbol(mod, symbol, modoffs, flags);
+        dr_rwlock_read_unlock(modtable_lock);
+        return r;
+    }
+
     dr_recurlock_lock(symbol_lock);
     mod = lookup_or_load(modpath);
     if (mod == NULL) {
@@ -124,6 +157,7 @@ drsym_lookup_symbol_local(const char *modpath, const char *symbol,
         return DRSYM_ERROR_LOAD_FAILED;
     }
 
+    drsym_unix_prepare_lookup(mod, true /*by name*/);
     r = drsym_unix_lookup_symbol(mod, symbol, modoffs, flags);
 
     dr_recurlock_unlock(symbol_lock);
@@ -143,6 +177,13 @@ drsym_lookup_address_local(const char *modpath, size_t modoffs,
     if (out->struct_size != sizeof(*out))
         return DRSYM_ERROR_INVALID_SIZE;
 
+    mod = lookup_ready(modpath, false /*by address*/);
+    if (mod != NULL) {
+        r = drsym_unix_lookup_address(mod, modoffs, out, flags);
+        dr_rwlock_read_unlock(modtable_lock);
+        return r;
+    }
+
     dr_recurlock_lock(symbol_lock);
     mod = lookup_or_load(modpath);
     if (mod == NULL) {
@@ -150,6 +191,7 @@ drsym_lookup_address_local(const char *modpath, size_t modoffs,
         return DRSYM_ERROR_LOAD_FAILED;
     }
 
+    drsym_unix_prepare_lookup(mod, false /*by address*/);
     r = drsym_unix_lookup_address(mod, modoffs, out, flags);
 
     dr_recurlock_unlock(symbol_lock);
@@ -197,6 +239,7 @@ drsym_init(int shmid_in)
     shmid = shmid_in;
 
     symbol_lock = dr_recurlock_create();
+    modtable_lock = dr_rwlock_create();
 
     drsym_unix_init();
 
@@ -229,6 +272,7 @@ drsym_exit(void)
         /* FIXME NYI i#446 */
     }
     hashtable_delete(&modtable);
+    dr_rwlock_destroy(modtable_lock);
     dr_recurlock_destroy(symbol_lock);
     return res;
 }
@@ -364,7 +408,9 @@ drsym_free_resources(const char *modpath)
             return DRSYM_ERROR_RECURSIVE;
 
         dr_recurlock_lock(symbol_lock);
+        dr_rwlock_write_lock(modtable_lock);
         found = hashtable_remove(&modtable, (void *)modpath);
+        dr_rwlock_write_unlock(modtable_lock);
         dr_recurlock_unlock(symbol_lock);
 
         return (found ? DRSYM_SUCCESS : DRSYM_ERROR);
@@ -102,6 +102,15 @@ static uint verbose = 0;
 #    define dr_atomic_add_stat_return_sum dr_atomic_add32_return_sum
 #    define dr_atomic_load_stat dr_atomic_load32
 #endif
+#ifdef X64
+#    define dr_atomic_load_ptr(src) ((void *)dr_atomic_load64((volatile int64 *)(src)))
+#    define dr_atomic_store_ptr(dest, val) \
+        dr_atomic_store64((volatile int64 *)(dest), (int64)(ptr_int_t)(val))
+#else
+#    define dr_atomic_load_ptr(src) ((void *)dr_atomic_load32((volatile int *)(src)))
+#    define dr_atomic_store_ptr(dest, val) \
+        dr_atomic_store32((volatile int *)(dest), (int)(ptr_int_t)(val))
+#endif
 
 /* protected by wrap_lock */
 static drwrap_global_flags_t global_flags;
@@ -131,6 +140,195 @@ byte *
 get_cur_xsp(void);
 #endif
 
+/***************************************************************************
+ * LOCK-FREE PC SETS
+ */
+
+/* An open-addressing set of pcs mirroring the keys of a hashtable, so that the
+ * common "is this pc present" queries on every instruction and every wrapped call
+ * need no lock.  Only one writer at a time may update a set, which it does while
+ * holding the lock of the table it mirrors; readers need nothing.
+ *
+ * A slot only ever goes from empty to a pc, from a pc to a tombstone, and from a
+ * tombstone to a pc, each with a single atomic store, so a reader probing
+ * concurrently sees either the old or the new state of each slot.  When the slots
+ * fill up the writer copies the live pcs to a new array and publishes that.  A
+ * reader may still be probing the old array, and we have no cheap way to know when
+ * all of them are done, so retired arrays are kept until drwrap_exit().  Arrays
+ * never shrink and a same-size copy needs a quarter of the slots to have been
+ * filled since the last copy, so the retired memory stays proportional to the
+ * number of additions.
+ */
+#define PC_SET_TOMBSTONE ((app_pc)~(ptr_uint_t)0)
+
+typedef struct _pc_set_array_t {
+    uint capacity; /* A power of 2. */
+    struct _pc_set_array_t *next_retired;
+    app_pc slots[1]; /* Really "capacity" entries. */
+} pc_set_array_t;
+
+typedef struct _pc_set_t {
+    pc_set_array_t *cur; /* Read via dr_atomic_load_ptr. */
+    uint live;
+    uint used; /* Live pcs plus tombstones. */
+    pc_set_array_t *retired;
+} pc_set_t;
+
+static pc_set_array_t *
+pc_set_array_create(uint capacity)
+{
+    size_t size = offsetof(pc_set_array_t, slots) + capacity * sizeof(app_pc);
+    pc_set_array_t *array = (pc_set_array_t *)dr_global_alloc(size);
+    memset(array, 0, size);
+    array->capacity = capacity;
+    return array;
+}
+
+static void
+pc_set_array_free(pc_set_array_t *array)
+{
+    dr_global_free(array,
+                   offsetof(pc_set_array_t, slots) + array->capacity * sizeof(app_pc));
+}
+
+static inline uint
+pc_set_hash(app_pc pc, uint capacity)
+{
+    ptr_uint_t hash = (ptr_uint_t)pc;
+    hash = (hash ^ (hash >> 16)) * 0x45d9f3b;
+    hash ^= hash >> 16;
+    return (uint)(hash & (capacity - 1));
+}
+
+static void
+pc_set_init(pc_set_t *set, uint hash_bits)
+{
+    set->cur = pc_set_array_create(1U << hash_bits);
+    set->live = 0;
+    set->used = 0;
+    set->retired = NULL;
+}
+
+static void
+pc_set_delete(pc_set_t *set)
+{
+    while (set->retired != NULL) {
+        pc_set_array_t *next = set->retired->next_retired;
+        pc_set_array_free(set->retired);
+        set->retired = next;
+    }
+    pc_set_array_free(set->cur);
+    set->cur = NULL;
+}
+
+/* Safe to call with no lock held. */
+static bool
+pc_set_contains(pc_set_t *set, app_pc pc)
+{
+    pc_set_array_t *array = (pc_set_array_t *)dr_atomic_load_ptr(&set->cur);
+    uint mask = array->capacity - 1;
+    uint i;
+    for (i = pc_set_hash(pc, array->capacity);; i = (i + 1) & mask) {
+        app_pc slot = (app_pc)dr_atomic_load_ptr(&array->slots[i]);
+        if (slot == pc)
+            return true;
+        if (slot == NULL)
+            return false;
+    }
+}
+
+/* Copies the live pcs into a fresh array with room for at least one more. */
+static void
+pc_set_rebuild(pc_set_t *set)
+{
+    pc_set_array_t *old = set->cur, *array;
+    uint capacity = old->capacity;
+    uint i;
+    while ((set->live + 1) * 2 > capacity)
+        capacity *= 2;
+    array = pc_set_array_create(capacity);
+    for (i = 0; i < old->capacity; i++) {
+        app_pc pc = old->slots[i];
+        if (pc != NULL && pc != PC_SET_TOMBSTONE) {
+            uint j = pc_set_hash(pc, capacity);
+            while (array->slots[j] != NULL)
+                j = (j + 1) & (capacity - 1);
+            array->slots[j] = pc;
+        }
+    }
+    set->used = set->live;
+    dr_atomic_store_ptr(&set->cur, array);
+    old->next_retired = set->retired;
+    set->retired = old;
+}
+
+/* Caller must hold the lock of the table the set mirrors. */
+static void
+pc_set_add(pc_set_t *set, app_pc pc)
+{
+    pc_set_array_t *array = set->cur;
+    uint mask = array->capacity - 1;
+    uint i, tombstone = array->capacity;
+    ASSERT(pc != NULL && pc != PC_SET_TOMBSTONE, "invalid pc set key");
+    for (i = pc_set_hash(pc, array->capacity); array->slots[i] != NULL;
+         i = (i + 1) & mask) {
+        if (array->slots[i] == pc)
+            return;
+        if (array->slots[i] == PC_SET_TOMBSTONE && tombstone == array->capacity)
+            tombstone = i;
+    }
+    if (tombstone != array->capacity) {
+        /* The pc is absent so a reader can only be looking for some other pc
+         * here: it will simply probe past this slot.
+         */
+        dr_atomic_store_ptr(&array->slots[tombstone], pc);
+    } else {
+        /* Keep at least a quarter of the slots empty to bound probe lengths. */
+        if ((set->used + 1) * 4 > array->capacity * 3) {
+            pc_set_rebuild(set);
+            pc_set_add(set, pc);
+            return;
+        }
+        dr_atomic_store_ptr(&array->slots[i], pc);
+        set->used++;
+    }
+    set->live++;
+}
+
+/* Caller must hold the lock of the table the set mirrors. */
+static void
+pc_set_remove(pc_set_t *set, app_pc pc)
+{
+    pc_set_array_t *array = set->cur;
+    uint mask = array->capacity - 1;
+    uint i;
+    for (i = pc_set_hash(pc, array->capacity); array->slots[i] != NULL;
+         i = (i + 1) & mask) {
+        if (array->slots[i] == pc) {
+            dr_atomic_store_ptr(&array->slots[i], PC_SET_TOMBSTONE);
+            set->live--;
+            return;
+        }
+    }
+}
+
+/* Removes all pcs in [start, end).  Caller must hold the lock of the table the set
+ * mirrors.
+ */
+static void
+pc_set_remove_range(pc_set_t *set, app_pc start, app_pc end)
+{
+    pc_set_array_t *array = set->cur;
+    uint i;
+    for (i = 0; i < array->capacity; i++) {
+        app_pc pc = array->slots[i];
+        if (pc != NULL && pc != PC_SET_TOMBSTONE && pc >= start && pc < end) {
+            dr_atomic_store_ptr(&array->slots[i], PC_SET_TOMBSTONE);
+            set->live--;
+        }
+    }
+}
+
 /***************************************************************************
  * REQUEST TRACKING
  */
@@ -181,6 +379,10 @@ typedef struct _wrap_entry_t {
 #define WRAP_TABLE_HASH_BITS 6
 /* i#1689: we store the decorated (LSB=1) pc (passed from client) in the table */
 static hashtable_t wrap_table;
+/* The keys of wrap_table, for checking every instruction without wrap_lock.
+ * Written under wrap_lock.
+ */
+static pc_set_t wrap_pcs;
 /* We need recursive locking on the table to support drwrap_unwrap
  * being called from a post event so we use this lock instead of
  * hashtable_lock(&wrap_table)
@@ -285,6 +487,10 @@ fast_safe_read(void *base, size_t size, void *out_buf)
 /* i#1689: we store the aligned (LSB=0) pc here */
 static hashtable_t post_call_table;
 static void *post_call_rwlock;
+/* The keys of post_call_table, for checking every instruction and every wrapped
+ * call's retaddr without post_call_rwlock.  Written under the write lock.
+ */
+static pc_set_t post_call_pcs;
 
 typedef struct _post_call_entry_t {
     /* PR 454616: we need two flags in the post_call_table: one that
@@ -346,6 +552,7 @@ post_call_entry_add(app_pc postcall, bool external)
         post_call_entry_free(e);
         return NULL;
     }
+    pc_set_add(&post_call_pcs, postcall);
     if (!external && post_call_notify_list != NULL) {
         post_call_notify_t *cb = post_call_notify_list;
         while (cb != NULL) {
@@ -381,11 +588,7 @@ post_call_consistent(app_pc postcall, post_call_entry_t *e)
 static bool
 post_call_lookup(app_pc pc)
 {
-    bool res = false;
-    dr_rwlock_read_lock(post_call_rwlock);
-    res = (hashtable_lookup(&post_call_table, (void *)pc) != NULL);
-    dr_rwlock_read_unlock(post_call_rwlock);
-    return res;
+    return pc_set_contains(&post_call_pcs, pc);
 }
 #endif
 
@@ -395,6 +598,9 @@ post_call_lookup_for_instru(app_pc pc)
 {
     bool res = false;
     post_call_entry_t *e;
+    /* Nearly every instruction is not a post-call point: avoid the lock for those. */
+    if (!pc_set_contains(&post_call_pcs, pc))
+        return false;
     dr_rwlock_read_lock(post_call_rwlock);
     e = (post_call_entry_t *)hashtable_lookup(&post_call_table, (void *)pc);
     if (e != NULL) {
@@ -407,7 +613,8 @@ post_call_lookup_for_instru(app_pc pc)
             dr_rwlock_write_lock(post_call_rwlock);
             /* might not be found now if racily removed: but that's fine */
             NOTIFY(2, "%s: removing %p\n", __FUNCTION__, pc);
-            hashtable_remove(&post_call_table, (void *)pc);
+            if (hashtable_remove(&post_call_table, (void *)pc))
+                pc_set_remove(&post_call_pcs, pc);
             /* invalidate cache */
             for (i = 0; i < POSTCALL_CACHE_SIZE; i++) {
                 if (pc == postcall_cache[i])
@@ -985,9 +1192,11 @@ drwrap_init(void)
                       NULL);
     hashtable_init_ex(&wrap_table, WRAP_TABLE_HASH_BITS, HASH_INTPTR, false /*!str_dup*/,
                       false /*!synch*/, wrap_entry_free, NULL, NULL);
+    pc_set_init(&wrap_pcs, WRAP_TABLE_HASH_BITS);
     hashtable_init_ex(&post_call_table, POST_CALL_TABLE_HASH_BITS, HASH_INTPTR,
                       false /*!str_dup*/, false /*!synch*/, post_call_entry_free, NULL,
                       NULL);
+    pc_set_init(&post_call_pcs, POST_CALL_TABLE_HASH_BITS);
     post_call_rwlock = dr_rwlock_create();
     /* This lock may have been set up by drwrap_set_global_flags() (in this thread). */
     if (wrap_lock == NULL)
@@ -1070,7 +1279,9 @@ drwrap_exit(void)
     hashtable_delete(&replace_table);
     hashtable_delete(&replace_native_table);
     hashtable_delete(&wrap_table);
+    pc_set_delete(&wrap_pcs);
     hashtable_delete(&post_call_table);
+    pc_set_delete(&post_call_pcs);
     dr_rwlock_destroy(post_call_rwlock);
     dr_recurlock_destroy(wrap_lock);
     wrap_lock = NULL; /* For early drwrap_set_global_flags() after re-attach. */
@@ -1956,6 +2167,11 @@ drwrap_ensure_postcall(void *drcontext, per_thread_t *pt, wrap_entry_t *wrap,
         if (retaddr == postcall_cache[i])
             return;
     }
+    /* Beyond the cache, a known retaddr still needs no lock.  We only fall through
+     * to the locked path the first time we see each one.
+     */
+    if (pc_set_contains(&post_call_pcs, retaddr))
+        return;
 
     /* to write to the cache we need a write lock */
     dr_rwlock_write_lock(post_call_rwlock);
@@ -2040,7 +2256,15 @@ drwrap_in_callee(void *arg1, reg_t xsp _IF_NOT_X86(reg_t lr))
     if (!TEST(DRWRAP_NO_FRILLS, global_flags)) {
         dr_recurlock_lock(wrap_lock);
         wrap = hashtable_lookup(&wrap_table, (void *)pc);
-        ASSERT(wrap != NULL, "failed to find wrap info");
+        if (wrap == NULL) {
+            /* Another thread's lazy removal purged this unwrapped function but
+             * has not yet flushed the fragment we came from.  There is nothing
+             * to call, and skipping the nesting level also skips the post-call.
+             */
+            NOTIFY(2, "%s: " PFX " was removed\n", __FUNCTION__, pc);
+            dr_recurlock_unlock(wrap_lock);
+            return;
+        }
     }
 
     /* i#1689: after setting wrapcxt.func for caller, clear LSB */
@@ -2281,6 +2505,7 @@ drwrap_after_callee_func(void *drcontext, per_thread_t *pt, dr_mcontext_t *mc, i
                                  * let's flush it
                                  */
                                 drvector_append(&toflush, (void *)wrap->func);
+                                pc_set_remove(&wrap_pcs, wrap->func);
                                 hashtable_remove(&wrap_table, (void *)wrap->func);
                                 wrap = NULL; /* don't double-free */
                             } else {
@@ -2452,8 +2677,16 @@ drwrap_event_bb_insert_where(void *drcontext, void *tag, instrlist_t *bb, instr_
          * callee. By doing both we minimize flushes from the return point having already
          * been reached before the callee hook can mark it.
          */
-        dr_recurlock_lock(wrap_lock);
-        wrap = hashtable_lookup(&wrap_table, (void *)pc);
+        /* Avoid wrap_lock on the vast majority of instructions, which are not
+         * wrapped.  A racing wrap request flushes the function once it is in the
+         * table, just as it would if we had checked under the lock before it.
+         */
+        bool maybe_wrapped = pc_set_contains(&wrap_pcs, pc);
+        if (maybe_wrapped) {
+            dr_recurlock_lock(wrap_lock);
+            wrap = hashtable_lookup(&wrap_table, (void *)pc);
+        } else
+            wrap = NULL;
         if (wrap != NULL) {
             void *arg1 = TEST(DRWRAP_NO_FRILLS, global_flags) ? (void *)wrap : (void *)pc;
             /* i#690: do not bother saving registers that should be scratch at
@@ -2474,7 +2707,8 @@ drwrap_event_bb_insert_where(void *drcontext, void *tag, instrlist_t *bb, instr_
                 /* pass in xsp to avoid dr_get_mcontext */
                 opnd_create_reg(DR_REG_XSP) _IF_AARCHXX(opnd_create_reg(DR_REG_LR)));
         }
-        dr_recurlock_unlock(wrap_lock);
+        if (maybe_wrapped)
+            dr_recurlock_unlock(wrap_lock);
     }
 
     if (post_call_lookup_for_instru(instr_get_app_pc(inst) /*normalized*/)) {
@@ -2501,11 +2735,14 @@ drwrap_event_bb_insert_where(void *drcontext, void *tag, instrlist_t *bb, instr_
     if (instr_is_call(inst) && instr_is_app(inst) && opnd_is_pc(instr_get_target(inst))) {
         app_pc target = dr_app_pc_as_jump_target(instr_get_isa_mode(inst),
                                                  opnd_get_pc(instr_get_target(inst)));
-        dr_recurlock_lock(wrap_lock);
-        wrap = hashtable_lookup(&wrap_table, (void *)target);
-        bool add_post = wrap != NULL && wrap->post_cb != NULL &&
-            !TEST(DRWRAP_REPLACE_RETADDR, wrap->flags);
-        dr_recurlock_unlock(wrap_lock);
+        bool add_post = false;
+        if (pc_set_contains(&wrap_pcs, target)) {
+            dr_recurlock_lock(wrap_lock);
+            wrap = hashtable_lookup(&wrap_table, (void *)target);
+            add_post = wrap != NULL && wrap->post_cb != NULL &&
+                !TEST(DRWRAP_REPLACE_RETADDR, wrap->flags);
+            dr_recurlock_unlock(wrap_lock);
+        }
         if (add_post) {
             /* Add the pc-as-load-target (so *not* "pc"). */
             dr_rwlock_write_lock(post_call_rwlock);
@@ -2537,6 +2774,7 @@ drwrap_event_module_unload(void *drcontext, const module_data_t *info)
     NOTIFY(2, "%s: removing %p..%p\n", __FUNCTION__, info->start, info->end);
     dr_rwlock_write_lock(post_call_rwlock);
     hashtable_remove_range(&post_call_table, (void *)info->start, (void *)info->end);
+    pc_set_remove_range(&post_call_pcs, info->start, info->end);
     /* Invalidate cache. */
     for (int i = 0; i < POSTCALL_CACHE_SIZE; i++) {
         if (postcall_cache[i] >= info->start && postcall_cache[i] < info->end)
@@ -2629,6 +2867,7 @@ drwrap_wrap_ex(app_pc func,
                uint flags)
 {
     wrap_entry_t *wrap_cur, *wrap_new;
+    bool do_flush = false;
 
     /* allow one side to be NULL (i#562) */
     if (func == NULL || (pre_func_cb == NULL && post_func_cb == NULL))
@@ -2689,15 +2928,13 @@ drwrap_wrap_ex(app_pc func,
     } else {
         wrap_new->next = NULL;
         hashtable_add(&wrap_table, (void *)func, (void *)wrap_new);
+        pc_set_add(&wrap_pcs, func);
         /* XXX: we're assuming void* tag == pc */
-        if (dr_fragment_exists_at(dr_get_current_drcontext(), func)) {
-            dr_atomic_add_stat_return_sum(&drwrap_stats.flush_count, 1);
-            /* we do not guarantee faster than a lazy flush */
-            if (!dr_unlink_flush_region(func, 1))
-                ASSERT(false, "wrap update flush failed");
-        }
+        do_flush = dr_fragment_exists_at(dr_get_current_drcontext(), func);
     }
     dr_recurlock_unlock(wrap_lock);
+    if (do_flush)
+        drwrap_flush_func(func);
     return true;
 }
 
@@ -2768,13 +3005,9 @@ DR_EXPORT
 bool
 drwrap_is_post_wrap(app_pc pc)
 {
-    bool res = false;
     if (pc == NULL)
         return false;
-    dr_rwlock_read_lock(post_call_rwlock);
-    res = (hashtable_lookup(&post_call_table, (void *)pc) != NULL);
-    dr_rwlock_read_unlock(post_call_rwlock);
-    return res;
+    return pc_set_contains(&post_call_pcs, pc);
 }
 
 DR_EXPORT
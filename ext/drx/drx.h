@@ -408,6 +408,59 @@ DR_EXPORT
 drx_buf_t *
 drx_buf_create_trace_buffer(size_t buffer_size, drx_buf_full_cb_t full_cb);
 
+DR_EXPORT
+/**
+ * Initializes the drx_buf extension with a buffer which, like a trace
+ * buffer, is handed to \p full_cb when it becomes full, but which does
+ * not stall the application thread while \p full_cb runs.  Each thread
+ * is given \p num_buffers buffers of \p buffer_size bytes.  When one
+ * fills, the buffer pointer moves to the next free one and the full one
+ * is queued for a consumer thread which drx_buf creates with
+ * dr_create_client_thread() and on which \p full_cb is then called.  A
+ * thread only waits if all of its buffers are queued, bounding memory
+ * use at \p num_buffers buffers per thread; such waits are counted in
+ * drx_buf_sideline_stats_t.stalls.
+ *
+ * Buffers are processed in the order they were queued.  \p full_cb
+ * receives the drcontext of the thread which filled the buffer, which
+ * can be used to query that thread's TLS fields but not for allocations
+ * or other operations which must happen on the thread itself.  When a
+ * thread exits, its final partial buffer is queued and the thread's
+ * exit event waits until all of its buffers have been processed.
+ * drx_buf_free() waits for the consumer thread to finish every queued
+ * buffer and exit.
+ *
+ * \return NULL if unsuccessful (including if \p num_buffers is less than
+ * 2), a valid opaque struct pointer if successful.
+ */
+drx_buf_t *
+drx_buf_create_sideline_buffer(size_t buffer_size, uint num_buffers,
+                               drx_buf_full_cb_t full_cb);
+
+/** Statistics on the buffers of a drx_buf_create_sideline_buffer() buffer. */
+typedef struct _drx_buf_sideline_stats_t {
+    /** The caller sets this to the size of this structure. */
+    size_t size;
+    /** The number of buffers queued for the consumer thread. */
+    uint64 buffers_queued;
+    /** The number of buffers the consumer thread has passed to full_cb. */
+    uint64 buffers_processed;
+    /** The total size of the data in all queued buffers. */
+    uint64 bytes_queued;
+    /** The number of times a thread waited for one of its buffers to be processed. */
+    uint64 stalls;
+    /** The largest number of buffers ever queued and not yet processed at once. */
+    uint64 max_pending;
+} drx_buf_sideline_stats_t;
+
+DR_EXPORT
+/**
+ * Fills \p stats with statistics on \p buf, which must have been created
+ * by drx_buf_create_sideline_buffer().  \returns whether successful.
+ */
+bool
+drx_buf_get_sideline_stats(drx_buf_t *buf, drx_buf_sideline_stats_t *stats DR_PARAM_OUT);
+
 DR_EXPORT
 /** Cleans up the buffer associated with \p buf. \returns whether successful. */
 bool
@@ -50,14 +50,38 @@
 #define MINSERT instrlist_meta_preinsert
 
 /* denotes the possible buffer types */
-typedef enum { DRX_BUF_CIRCULAR_FAST, DRX_BUF_CIRCULAR, DRX_BUF_TRACE } drx_buf_type_t;
-
-typedef struct {
+typedef enum {
+    DRX_BUF_CIRCULAR_FAST,
+    DRX_BUF_CIRCULAR,
+    DRX_BUF_TRACE,
+    DRX_BUF_SIDELINE
+} drx_buf_type_t;
+
+typedef struct _per_thread_t per_thread_t;
+
+/* One of the buffers of a thread using a sideline buffer. */
+typedef struct _sideline_slot_t {
+    byte *cli_base;
+    size_t size; /* the size of the data, once queued */
+    per_thread_t *owner;
+    struct _sideline_slot_t *next; /* in the free list or the consumer queue */
+} sideline_slot_t;
+
+struct _per_thread_t {
     byte *seg_base;
     byte *cli_base;    /* the base of the buffer from the client's perspective */
     byte *buf_base;    /* the actual base of the buffer */
     size_t total_size; /* the actual size of the buffer */
-} per_thread_t;
+    /* The rest are only used by sideline buffers.  free_slots and num_free are
+     * protected by the drx_buf_t's sideline_lock.
+     */
+    void *drcontext;
+    sideline_slot_t *slots;
+    sideline_slot_t *cur_slot;
+    sideline_slot_t *free_slots;
+    uint num_free;
+    void *slot_freed; /* event signaled when the consumer releases a slot */
+};
 
 struct _drx_buf_t {
     drx_buf_type_t buf_type;
@@ -68,6 +92,18 @@ struct _drx_buf_t {
     int tls_idx;
     uint tls_offs;
     reg_id_t tls_seg;
+    /* The rest are only used by sideline buffers, and all but the events
+     * are protected by sideline_lock.
+     */
+    uint num_buffers;
+    void *sideline_lock;
+    void *work_ready;      /* event signaled when a slot is queued */
+    void *consumer_exited; /* event signaled when the consumer thread is done */
+    sideline_slot_t *queue_head;
+    sideline_slot_t *queue_tail;
+    uint num_pending;
+    bool exiting;
+    drx_buf_sideline_stats_t stats;
 };
 
 /* global rwlock to lock against updates to the clients vector */
@@ -84,12 +120,18 @@ void
 drx_buf_exit_library(void);
 
 static drx_buf_t *
-drx_buf_init(drx_buf_type_t bt, size_t bsz, drx_buf_full_cb_t full_cb);
+drx_buf_init(drx_buf_type_t bt, size_t bsz, uint num_buffers, drx_buf_full_cb_t full_cb);
 
 static per_thread_t *
 per_thread_init_2byte(void *drcontext, drx_buf_t *buf);
 static per_thread_t *
 per_thread_init_fault(void *drcontext, drx_buf_t *buf);
+static per_thread_t *
+per_thread_init_sideline(void *drcontext, drx_buf_t *buf);
+static void
+per_thread_exit_sideline(void *drcontext, drx_buf_t *buf, per_thread_t *data);
+static void
+sideline_consumer(void *arg);
 
 static void
 drx_buf_insert_update_buf_ptr_2byte(void *drcontext, drx_buf_t *buf, instrlist_t *ilist,
@@ -119,8 +161,10 @@ signal_event(void *drcontext, dr_siginfo_t *info);
 static reg_id_t
 deduce_buf_ptr(instr_t *instr);
 static bool
-reset_buf_ptr(void *drcontext, dr_mcontext_t *raw_mcontext, byte *seg_base,
-              byte *cli_base, drx_buf_t *buf);
+reset_buf_ptr(void *drcontext, dr_mcontext_t *raw_mcontext, per_thread_t *data,
+              drx_buf_t *buf);
+static void
+buffer_full(void *drcontext, drx_buf_t *buf, per_thread_t *data, byte *cli_ptr);
 static bool
 fault_event_helper(void *drcontext, byte *target, dr_mcontext_t *raw_mcontext);
 
@@ -182,18 +226,51 @@ drx_buf_create_circular_buffer(size_t buf_size)
     drx_buf_type_t buf_type = (buf_size == DRX_BUF_FAST_CIRCULAR_BUFSZ)
         ? DRX_BUF_CIRCULAR_FAST
         : DRX_BUF_CIRCULAR;
-    return drx_buf_init(buf_type, buf_size, NULL);
+    return drx_buf_init(buf_type, buf_size, 1, NULL);
 }
 
 DR_EXPORT
 drx_buf_t *
 drx_buf_create_trace_buffer(size_t buf_size, drx_buf_full_cb_t full_cb)
 {
-    return drx_buf_init(DRX_BUF_TRACE, buf_size, full_cb);
+    return drx_buf_init(DRX_BUF_TRACE, buf_size, 1, full_cb);
+}
+
+DR_EXPORT
+drx_buf_t *
+drx_buf_create_sideline_buffer(size_t buf_size, uint num_buffers,
+                               drx_buf_full_cb_t full_cb)
+{
+    drx_buf_t *buf;
+    if (num_buffers < 2)
+        return NULL;
+    buf = drx_buf_init(DRX_BUF_SIDELINE, buf_size, num_buffers, full_cb);
+    if (buf == NULL)
+        return NULL;
+    if (!dr_create_client_thread(sideline_consumer, buf)) {
+        /* There is no consumer for drx_buf_free() to wait for. */
+        dr_event_signal(buf->consumer_exited);
+        drx_buf_free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+DR_EXPORT
+bool
+drx_buf_get_sideline_stats(drx_buf_t *buf, drx_buf_sideline_stats_t *stats DR_PARAM_OUT)
+{
+    if (buf == NULL || buf->buf_type != DRX_BUF_SIDELINE || stats == NULL ||
+        stats->size != sizeof(*stats))
+        return false;
+    dr_mutex_lock(buf->sideline_lock);
+    *stats = buf->stats;
+    dr_mutex_unlock(buf->sideline_lock);
+    return true;
 }
 
 static drx_buf_t *
-drx_buf_init(drx_buf_type_t bt, size_t bsz, drx_buf_full_cb_t full_cb)
+drx_buf_init(drx_buf_type_t bt, size_t bsz, uint num_buffers, drx_buf_full_cb_t full_cb)
 {
     drx_buf_t *new_client;
     int tls_idx;
@@ -210,12 +287,20 @@ drx_buf_init(drx_buf_type_t bt, size_t bsz, drx_buf_full_cb_t full_cb)
 
     /* init the client struct */
     new_client = dr_global_alloc(sizeof(*new_client));
+    memset(new_client, 0, sizeof(*new_client));
     new_client->buf_type = bt;
     new_client->buf_size = bsz;
+    new_client->num_buffers = num_buffers;
     new_client->tls_offs = tls_offs;
     new_client->tls_seg = tls_seg;
     new_client->tls_idx = tls_idx;
     new_client->full_cb = full_cb;
+    if (bt == DRX_BUF_SIDELINE) {
+        new_client->sideline_lock = dr_mutex_create();
+        new_client->work_ready = dr_event_create();
+        new_client->consumer_exited = dr_event_create();
+        new_client->stats.size = sizeof(new_client->stats);
+    }
     dr_rwlock_write_lock(global_buf_rwlock);
     /* We don't attempt to re-use NULL entries (presumably which
      * have already been freed), for simplicity.
@@ -246,6 +331,19 @@ drx_buf_free(drx_buf_t *buf)
     ((drx_buf_t **)clients.array)[buf->vec_idx] = NULL;
     dr_rwlock_write_unlock(global_buf_rwlock);
 
+    if (buf->buf_type == DRX_BUF_SIDELINE) {
+        /* Threads still running may queue no more buffers now that the entry is
+         * gone, so once the queue is empty the consumer can go.
+         */
+        dr_mutex_lock(buf->sideline_lock);
+        buf->exiting = true;
+        dr_mutex_unlock(buf->sideline_lock);
+        dr_event_signal(buf->work_ready);
+        dr_event_wait(buf->consumer_exited);
+        dr_mutex_destroy(buf->sideline_lock);
+        dr_event_destroy(buf->work_ready);
+        dr_event_destroy(buf->consumer_exited);
+    }
     if (!drmgr_unregister_tls_field(buf->tls_idx) || !dr_raw_tls_cfree(buf->tls_offs, 1))
         return false;
     dr_global_free(buf, sizeof(*buf));
@@ -295,6 +393,8 @@ event_thread_init(void *drcontext)
         if (buf != NULL) {
             if (buf->buf_type == DRX_BUF_CIRCULAR_FAST)
                 data = per_thread_init_2byte(drcontext, buf);
+            else if (buf->buf_type == DRX_BUF_SIDELINE)
+                data = per_thread_init_sideline(drcontext, buf);
             else
                 data = per_thread_init_fault(drcontext, buf);
             drmgr_set_tls_field(drcontext, buf->tls_idx, data);
@@ -314,6 +414,10 @@ event_thread_exit(void *drcontext)
         if (buf != NULL) {
             per_thread_t *data = drmgr_get_tls_field(drcontext, buf->tls_idx);
             byte *cli_ptr = BUF_PTR(data->seg_base, buf->tls_offs);
+            if (buf->buf_type == DRX_BUF_SIDELINE) {
+                per_thread_exit_sideline(drcontext, buf, data);
+                continue;
+            }
             /* buffer has not yet been deleted, call user callback(s) */
             if (buf->full_cb != NULL) {
                 (*buf->full_cb)(drcontext, data->cli_base,
@@ -373,6 +477,152 @@ per_thread_init_fault(void *drcontext, drx_buf_t *buf)
     return per_thread;
 }
 
+static per_thread_t *
+per_thread_init_sideline(void *drcontext, drx_buf_t *buf)
+{
+    size_t page_size = dr_page_size();
+    /* Each buffer is laid out as for a trace buffer, right before its own
+     * read-only page.
+     */
+    size_t stride = ALIGN_FORWARD(buf->buf_size, page_size) + page_size;
+    per_thread_t *per_thread = dr_thread_alloc(drcontext, sizeof(per_thread_t));
+    byte *ret;
+    uint i;
+    memset(per_thread, 0, sizeof(*per_thread));
+    per_thread->seg_base = dr_get_dr_segment_base(buf->tls_seg);
+    per_thread->drcontext = drcontext;
+    per_thread->total_size = stride * buf->num_buffers;
+    ret = dr_raw_mem_alloc(per_thread->total_size, DR_MEMPROT_READ | DR_MEMPROT_WRITE,
+                           NULL);
+    per_thread->buf_base = ret;
+    per_thread->slots =
+        dr_thread_alloc(drcontext, buf->num_buffers * sizeof(sideline_slot_t));
+    for (i = 0; i < buf->num_buffers; ++i) {
+        sideline_slot_t *slot = &per_thread->slots[i];
+        bool ok = dr_memory_protect(ret + (i + 1) * stride - page_size, page_size,
+                                    DR_MEMPROT_READ);
+        DR_ASSERT(ok);
+        slot->cli_base = ret + i * stride + stride - page_size - buf->buf_size;
+        slot->size = 0;
+        slot->owner = per_thread;
+        slot->next = (i + 1 < buf->num_buffers) ? &per_thread->slots[i + 1] : NULL;
+    }
+    /* The first slot is filled first and the rest are free. */
+    per_thread->cur_slot = &per_thread->slots[0];
+    per_thread->free_slots = &per_thread->slots[1];
+    per_thread->num_free = buf->num_buffers - 1;
+    per_thread->cli_base = per_thread->cur_slot->cli_base;
+    per_thread->slot_freed = dr_event_create();
+    return per_thread;
+}
+
+/* Queues the current slot with "size" bytes of data for the consumer thread.
+ * The caller must hold sideline_lock.
+ */
+static void
+sideline_enqueue(drx_buf_t *buf, per_thread_t *data, size_t size)
+{
+    sideline_slot_t *slot = data->cur_slot;
+    slot->size = size;
+    slot->next = NULL;
+    if (buf->queue_tail == NULL)
+        buf->queue_head = slot;
+    else
+        buf->queue_tail->next = slot;
+    buf->queue_tail = slot;
+    buf->num_pending++;
+    buf->stats.buffers_queued++;
+    buf->stats.bytes_queued += size;
+    if (buf->num_pending > buf->stats.max_pending)
+        buf->stats.max_pending = buf->num_pending;
+    dr_event_signal(buf->work_ready);
+}
+
+/* Queues the full current slot and switches the thread to a free one, waiting
+ * for the consumer thread to release one if there is none.
+ */
+static void
+sideline_swap(drx_buf_t *buf, per_thread_t *data, size_t size)
+{
+    sideline_slot_t *slot;
+    dr_mutex_lock(buf->sideline_lock);
+    sideline_enqueue(buf, data, size);
+    if (data->free_slots == NULL)
+        buf->stats.stalls++;
+    while (data->free_slots == NULL) {
+        dr_mutex_unlock(buf->sideline_lock);
+        dr_event_wait(data->slot_freed);
+        dr_mutex_lock(buf->sideline_lock);
+    }
+    slot = data->free_slots;
+    data->free_slots = slot->next;
+    data->num_free--;
+    dr_mutex_unlock(buf->sideline_lock);
+    data->cur_slot = slot;
+    data->cli_base = slot->cli_base;
+}
+
+static void
+per_thread_exit_sideline(void *drcontext, drx_buf_t *buf, per_thread_t *data)
+{
+    byte *cli_ptr = BUF_PTR(data->seg_base, buf->tls_offs);
+    /* Queue the partial buffer and wait for all of this thread's buffers to be
+     * processed, while its drcontext is still valid for full_cb.
+     */
+    dr_mutex_lock(buf->sideline_lock);
+    sideline_enqueue(buf, data, (size_t)(cli_ptr - data->cli_base));
+    while (data->num_free < buf->num_buffers) {
+        dr_mutex_unlock(buf->sideline_lock);
+        dr_event_wait(data->slot_freed);
+        dr_mutex_lock(buf->sideline_lock);
+    }
+    dr_mutex_unlock(buf->sideline_lock);
+    dr_event_destroy(data->slot_freed);
+    dr_thread_free(drcontext, data->slots, buf->num_buffers * sizeof(sideline_slot_t));
+    dr_raw_mem_free(data->buf_base, data->total_size);
+    dr_thread_free(drcontext, data, sizeof(per_thread_t));
+}
+
+/* The consumer thread of a sideline buffer, which passes queued slots to
+ * full_cb in order until drx_buf_free() is called.
+ */
+static void
+sideline_consumer(void *arg)
+{
+    drx_buf_t *buf = (drx_buf_t *)arg;
+    dr_mutex_lock(buf->sideline_lock);
+    while (true) {
+        sideline_slot_t *slot = buf->queue_head;
+        per_thread_t *owner;
+        if (slot == NULL) {
+            if (buf->exiting)
+                break;
+            dr_mutex_unlock(buf->sideline_lock);
+            dr_event_wait(buf->work_ready);
+            dr_mutex_lock(buf->sideline_lock);
+            continue;
+        }
+        buf->queue_head = slot->next;
+        if (buf->queue_head == NULL)
+            buf->queue_tail = NULL;
+        dr_mutex_unlock(buf->sideline_lock);
+
+        owner = slot->owner;
+        if (buf->full_cb != NULL)
+            (*buf->full_cb)(owner->drcontext, slot->cli_base, slot->size);
+
+        dr_mutex_lock(buf->sideline_lock);
+        buf->num_pending--;
+        buf->stats.buffers_processed++;
+        slot->next = owner->free_slots;
+        owner->free_slots = slot;
+        owner->num_free++;
+        dr_event_signal(owner->slot_freed);
+    }
+    dr_mutex_unlock(buf->sideline_lock);
+    dr_event_signal(buf->consumer_exited);
+}
+
 DR_EXPORT
 void
 drx_buf_insert_load_buf_ptr(void *drcontext, drx_buf_t *buf, instrlist_t *ilist,
@@ -677,11 +927,8 @@ safe_memcpy(drx_buf_t *buf, void *src, size_t len)
     /* try to perform a safe memcpy */
     if (!dr_safe_write(cli_ptr, len, src, NULL)) {
         /* we overflowed the client buffer, so flush it and try again */
-        byte *cli_base = data->cli_base;
-        BUF_PTR(data->seg_base, buf->tls_offs) = cli_base;
-        if (buf->full_cb != NULL)
-            (*buf->full_cb)(drcontext, cli_base, (size_t)(cli_ptr - cli_base));
-        memcpy(cli_base, src, len);
+        buffer_full(drcontext, buf, data, cli_ptr);
+        memcpy(data->cli_base, src, len);
     }
 }
 
@@ -772,13 +1019,32 @@ deduce_buf_ptr(instr_t *instr)
 }
 
 /* returns true if we won't intercept the fault, false otherwise */
+/* Hands the data in the buffer up to "cli_ptr" to the client and points the
+ * buffer pointer at the (possibly different) buffer to fill next.
+ */
+static void
+buffer_full(void *drcontext, drx_buf_t *buf, per_thread_t *data, byte *cli_ptr)
+{
+    byte *cli_base = data->cli_base;
+    if (buf->buf_type == DRX_BUF_SIDELINE) {
+        sideline_swap(buf, data, (size_t)(cli_ptr - cli_base));
+        BUF_PTR(data->seg_base, buf->tls_offs) = data->cli_base;
+        return;
+    }
+    /* We set the buffer pointer before the callback so it's easier
+     * for the user to override it in the callback.
+     */
+    BUF_PTR(data->seg_base, buf->tls_offs) = cli_base;
+    if (buf->full_cb != NULL)
+        (*buf->full_cb)(drcontext, cli_base, (size_t)(cli_ptr - cli_base));
+}
+
 static bool
-reset_buf_ptr(void *drcontext, dr_mcontext_t *raw_mcontext, byte *seg_base,
-              byte *cli_base, drx_buf_t *buf)
+reset_buf_ptr(void *drcontext, dr_mcontext_t *raw_mcontext, per_thread_t *data,
+              drx_buf_t *buf)
 {
     instr_t *instr;
     reg_id_t buf_ptr;
-    app_pc tmp_base;
 
     /* decode the instruction to extract the base register */
     instr = instr_create(drcontext);
@@ -788,16 +1054,10 @@ reset_buf_ptr(void *drcontext, dr_mcontext_t *raw_mcontext, byte *seg_base,
     if (buf_ptr == DR_REG_NULL)
         return true;
 
-    /* We set the buffer pointer before the callback so it's easier
-     * for the user to override it in the callback.
-     */
-    tmp_base = BUF_PTR(seg_base, buf->tls_offs);
-    BUF_PTR(seg_base, buf->tls_offs) = cli_base;
-    if (buf->full_cb != NULL)
-        (*buf->full_cb)(drcontext, cli_base, (size_t)(tmp_base - cli_base));
+    buffer_full(drcontext, buf, data, BUF_PTR(data->seg_base, buf->tls_offs));
 
     /* change contents of buf_ptr and retry the instruction */
-    reg_set_value(buf_ptr, raw_mcontext, (reg_t)BUF_PTR(seg_base, buf->tls_offs));
+    reg_set_value(buf_ptr, raw_mcontext, (reg_t)BUF_PTR(data->seg_base, buf->tls_offs));
     return false;
 }
 
@@ -825,8 +1085,7 @@ fault_event_helper(void *drcontext, byte *target, dr_mcontext_t *raw_mcontext)
 
             /* we found the right client */
             if (target >= ro_lo && target < ro_lo + page_size) {
-                bool ret = reset_buf_ptr(drcontext, raw_mcontext, data->seg_base,
-                                         data->cli_base, buf);
+                bool ret = reset_buf_ptr(drcontext, raw_mcontext, data, buf);
                 dr_rwlock_read_unlock(global_buf_rwlock);
                 return ret;
             }
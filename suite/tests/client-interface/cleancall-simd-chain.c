@@ -0,0 +1,135 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* Tests that the app's xmm registers survive a clean call whose callee calls a
+ * routine that clobbers them, and on x86-64 that its GPRs survive as well, as
+ * these calls save GPRs inline.
+ */
+
+#include "tools.h"
+
+#define LOAD_XMM(n) "movdqu " #n "*16(%0), %%xmm" #n "\n\t"
+#define STORE_XMM(n) "movdqu %%xmm" #n ", " #n "*16(%1)\n\t"
+#define LOAD_XMM_0_7                                                             \
+    LOAD_XMM(0) LOAD_XMM(1) LOAD_XMM(2) LOAD_XMM(3) LOAD_XMM(4) LOAD_XMM(5) \
+    LOAD_XMM(6) LOAD_XMM(7)
+#define STORE_XMM_0_7                                                                 \
+    STORE_XMM(0) STORE_XMM(1) STORE_XMM(2) STORE_XMM(3) STORE_XMM(4) STORE_XMM(5) \
+    STORE_XMM(6) STORE_XMM(7)
+#define CLOBBER_XMM_0_7 "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+
+#ifdef X64
+#    define NUM_XMM 16
+#    define LOAD_XMM_ALL                                                           \
+        LOAD_XMM_0_7 LOAD_XMM(8) LOAD_XMM(9) LOAD_XMM(10) LOAD_XMM(11) LOAD_XMM(12) \
+        LOAD_XMM(13) LOAD_XMM(14) LOAD_XMM(15)
+#    define STORE_XMM_ALL                                                      \
+        STORE_XMM_0_7 STORE_XMM(8) STORE_XMM(9) STORE_XMM(10) STORE_XMM(11) \
+        STORE_XMM(12) STORE_XMM(13) STORE_XMM(14) STORE_XMM(15)
+#    define CLOBBER_XMM_ALL                                                         \
+        CLOBBER_XMM_0_7, "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", \
+            "xmm15"
+/* The GPRs are stored after the 16 xmm registers.  We leave out xsp, xbp, and
+ * xax and xdx, which hold the buffer pointers.
+ */
+#    define NUM_GPR 12
+#    define LOAD_GPR(n, reg) "mov 256+" #n "*8(%0), %%" #reg "\n\t"
+#    define STORE_GPR(n, reg) "mov %%" #reg ", 256+" #n "*8(%1)\n\t"
+#    define LOAD_GPR_ALL                                                            \
+        LOAD_GPR(0, rbx) LOAD_GPR(1, rcx) LOAD_GPR(2, rsi) LOAD_GPR(3, rdi)         \
+        LOAD_GPR(4, r8) LOAD_GPR(5, r9) LOAD_GPR(6, r10) LOAD_GPR(7, r11)           \
+        LOAD_GPR(8, r12) LOAD_GPR(9, r13) LOAD_GPR(10, r14) LOAD_GPR(11, r15)
+#    define STORE_GPR_ALL                                                           \
+        STORE_GPR(0, rbx) STORE_GPR(1, rcx) STORE_GPR(2, rsi) STORE_GPR(3, rdi)     \
+        STORE_GPR(4, r8) STORE_GPR(5, r9) STORE_GPR(6, r10) STORE_GPR(7, r11)       \
+        STORE_GPR(8, r12) STORE_GPR(9, r13) STORE_GPR(10, r14) STORE_GPR(11, r15)
+#    define CLOBBER_GPR_ALL                                                          \
+        , "rbx", "rcx", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", \
+            "r15"
+#else
+#    define NUM_XMM 8
+#    define LOAD_XMM_ALL LOAD_XMM_0_7
+#    define STORE_XMM_ALL STORE_XMM_0_7
+#    define CLOBBER_XMM_ALL CLOBBER_XMM_0_7
+#    define NUM_GPR 0
+#    define LOAD_GPR_ALL
+#    define STORE_GPR_ALL
+#    define CLOBBER_GPR_ALL
+#endif
+
+#define NUM_BYTES (NUM_XMM * 16 + NUM_GPR * sizeof(void *))
+
+static byte in[NUM_BYTES];
+static byte out[NUM_BYTES];
+
+static NOINLINE void
+load_call_store(void)
+{
+    /* The client inserts its clean calls at the three nops.  Everything is in one
+     * asm statement so the compiler cannot use the registers in between.
+     */
+    __asm__ __volatile__(LOAD_XMM_ALL LOAD_GPR_ALL "nop\n\tnop\n\tnop\n\t"
+                             STORE_XMM_ALL STORE_GPR_ALL
+                         :
+                         : "a"(in), "d"(out)
+                         : "memory", CLOBBER_XMM_ALL CLOBBER_GPR_ALL);
+}
+
+int
+main(void)
+{
+    int i, j, errors = 0;
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < NUM_BYTES; i++) {
+            in[i] = (byte)(i * 7 + j + 1);
+            out[i] = 0;
+        }
+        load_call_store();
+        for (i = 0; i < NUM_BYTES; i++) {
+            if (in[i] == out[i])
+                continue;
+            if (i < NUM_XMM * 16) {
+                print("xmm%d byte %d clobbered: 0x%x vs 0x%x\n", i / 16, i % 16,
+                      out[i], in[i]);
+            } else {
+                print("gpr%d byte %d clobbered: 0x%x vs 0x%x\n",
+                      (i - NUM_XMM * 16) / (int)sizeof(void *),
+                      (i - NUM_XMM * 16) % (int)sizeof(void *), out[i], in[i]);
+            }
+            errors++;
+        }
+    }
+    print("%s\n",
+          errors == 0 ? "register values preserved" : "register values clobbered");
+    return 0;
+}
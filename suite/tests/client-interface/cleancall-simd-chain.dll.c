@@ -0,0 +1,124 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* Inserts clean calls to callees that make calls of their own: one reaches code
+ * that clobbers xmm registers, which must still be preserved, and one reaches no
+ * SIMD code at all, whose xmm saves can be skipped.
+ */
+
+#include "dr_api.h"
+#include "client_tools.h"
+
+static int clobber_calls;
+static int plain_calls;
+static int helper_calls;
+
+static __attribute__((noinline)) void
+clobber_xmm(void)
+{
+    __asm__ __volatile__("pcmpeqd %%xmm0, %%xmm0\n\t"
+                         "pxor %%xmm1, %%xmm1\n\t"
+                         "movdqa %%xmm0, %%xmm2\n\t"
+                         "movdqa %%xmm0, %%xmm7\n\t"
+#ifdef X64
+                         "movdqa %%xmm1, %%xmm8\n\t"
+                         "movdqa %%xmm0, %%xmm15\n\t"
+#endif
+                         :
+                         :
+                         : "xmm0", "xmm1", "xmm2", "xmm7"
+#ifdef X64
+                           ,
+                           "xmm8", "xmm15"
+#endif
+    );
+}
+
+static __attribute__((noinline)) void
+count_plain(void)
+{
+    helper_calls++;
+}
+
+/* Each callee does some work after its call so that the call cannot become a tail
+ * jump, which would let the callee be analyzed as if it made no calls.
+ */
+static void
+callee_clobbers_xmm(void)
+{
+    clobber_xmm();
+    clobber_calls++;
+}
+
+static void
+callee_plain(void)
+{
+    count_plain();
+    plain_calls++;
+}
+
+static dr_emit_flags_t
+event_basic_block(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
+                  bool translating)
+{
+    instr_t *instr, *next, *next_next;
+    for (instr = instrlist_first_app(bb); instr != NULL;
+         instr = instr_get_next_app(instr)) {
+        next = instr_get_next_app(instr);
+        next_next = next == NULL ? NULL : instr_get_next_app(next);
+        if (instr_is_nop(instr) && next != NULL && instr_is_nop(next) &&
+            next_next != NULL && instr_is_nop(next_next)) {
+            dr_insert_clean_call(drcontext, bb, instr, (void *)callee_clobbers_xmm,
+                                 false, 0);
+            dr_insert_clean_call(drcontext, bb, instr, (void *)callee_plain, false, 0);
+            break;
+        }
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+event_exit(void)
+{
+    CHECK(clobber_calls > 0, "clobbering callee was never called");
+    CHECK(plain_calls == clobber_calls && helper_calls == plain_calls,
+          "callees called unequally");
+    dr_fprintf(STDERR, "clean calls made\n");
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    dr_register_bb_event(event_basic_block);
+    dr_register_exit_event(event_exit);
+}
@@ -0,0 +1,186 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Registers enough cases for drbbdup to dispatch with a binary search, and checks
+ * that each block copy is reached for exactly its own encoding.  With "-linear"
+ * the dispatcher compares against each case in turn instead; with "-print_time"
+ * the client prints the run time so the two dispatchers can be compared.
+ */
+
+#include "dr_api.h"
+#include "client_tools.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "drx.h"
+#include "drbbdup.h"
+#include <string.h>
+
+/* Sparse encodings, including some that do not fit in a compare immediate. */
+static const uintptr_t case_encodings[] = {
+    1, 2, 3, 5, 8, 0x100, 0x7fffffff, (uintptr_t)0x80000000U,
+#ifdef X64
+    (uintptr_t)0x123456789ULL,
+#endif
+};
+#define NUM_CASES (sizeof(case_encodings) / sizeof(case_encodings[0]))
+#define DEFAULT_ENCODING 0
+/* Lies between two registered encodings, so the search must miss on it. */
+#define UNKNOWN_ENCODING 4
+
+/* Each block copy sets the encoding for the next block to the encoding after its
+ * own, cycling through the cases and then an unknown encoding that the default
+ * copy handles.  A correct dispatcher thus executes the copies in a fixed order.
+ */
+static uintptr_t case_encoding = DEFAULT_ENCODING;
+static uint case_counts[NUM_CASES];
+static uint default_count;
+static bool linear_dispatch;
+static bool print_time;
+static uint64 start_time;
+
+static uintptr_t
+set_up_bb_dups(void *drbbdup_ctx, void *drcontext, void *tag, instrlist_t *bb,
+               bool *enable_dups, bool *enable_dynamic_handling, void *user_data)
+{
+    for (uint i = 0; i < NUM_CASES; i++) {
+        drbbdup_status_t res =
+            drbbdup_register_case_encoding(drbbdup_ctx, case_encodings[i]);
+        CHECK(res == DRBBDUP_SUCCESS, "failed to register case");
+    }
+    *enable_dups = true;
+    *enable_dynamic_handling = false;
+    return DEFAULT_ENCODING;
+}
+
+static void
+insert_set_encoding(void *drcontext, instrlist_t *bb, instr_t *where, uintptr_t next)
+{
+    reg_id_t reg_addr, reg_val;
+    if (drreg_reserve_register(drcontext, bb, where, NULL, &reg_addr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, where, NULL, &reg_val) != DRREG_SUCCESS)
+        CHECK(false, "failed to reserve registers");
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)&case_encoding,
+                                     opnd_create_reg(reg_addr), bb, where, NULL, NULL);
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)next,
+                                     opnd_create_reg(reg_val), bb, where, NULL, NULL);
+    instrlist_meta_preinsert(bb, where,
+                             XINST_CREATE_store(drcontext, OPND_CREATE_MEMPTR(reg_addr, 0),
+                                                opnd_create_reg(reg_val)));
+    if (drreg_unreserve_register(drcontext, bb, where, reg_val) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, where, reg_addr) != DRREG_SUCCESS)
+        CHECK(false, "failed to unreserve registers");
+}
+
+static void
+instrument_instr(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                 instr_t *where, uintptr_t encoding, void *user_data,
+                 void *orig_analysis_data, void *analysis_data)
+{
+    bool is_start;
+    drbbdup_status_t res = drbbdup_is_first_instr(drcontext, instr, &is_start);
+    CHECK(res == DRBBDUP_SUCCESS, "failed to check whether instr is start");
+    if (!is_start)
+        return;
+
+    uint *counter = &default_count;
+    uintptr_t next = case_encodings[0];
+    if (encoding != DEFAULT_ENCODING) {
+        uint i;
+        for (i = 0; i < NUM_CASES; i++) {
+            if (case_encodings[i] == encoding)
+                break;
+        }
+        CHECK(i < NUM_CASES, "unknown case instrumented");
+        counter = &case_counts[i];
+        next = i + 1 < NUM_CASES ? case_encodings[i + 1] : UNKNOWN_ENCODING;
+    }
+    drx_insert_counter_update(drcontext, bb, where, SPILL_SLOT_MAX + 1, counter, 1, 0);
+    insert_set_encoding(drcontext, bb, where, next);
+}
+
+static void
+event_exit(void)
+{
+    if (print_time) {
+        dr_fprintf(STDERR, "%s dispatch: %llu us\n",
+                   linear_dispatch ? "linear" : "search",
+                   dr_get_microseconds() - start_time);
+    }
+    /* Each cycle runs the default copy and then every case copy in order. */
+    bool in_order = case_counts[0] <= default_count;
+    for (uint i = 1; i < NUM_CASES; i++) {
+        if (case_counts[i] > case_counts[i - 1])
+            in_order = false;
+    }
+    if (case_counts[NUM_CASES - 1] + 1 < default_count)
+        in_order = false;
+    CHECK(case_counts[NUM_CASES - 1] > 0, "not every case was dispatched");
+    CHECK(in_order, "cases were dispatched out of order");
+    dr_fprintf(STDERR, "all cases dispatched in order\n");
+
+    drbbdup_status_t res = drbbdup_exit();
+    CHECK(res == DRBBDUP_SUCCESS, "drbbdup exit failed");
+    drx_exit();
+    drreg_exit();
+    drmgr_exit();
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-linear") == 0)
+            linear_dispatch = true;
+        else if (strcmp(argv[i], "-print_time") == 0)
+            print_time = true;
+        else
+            CHECK(false, "unknown client option");
+    }
+
+    drreg_options_t drreg_ops = { sizeof(drreg_ops), 3 /*max slots needed*/, false };
+    if (!drmgr_init() || !drx_init() || drreg_init(&drreg_ops) != DRREG_SUCCESS)
+        CHECK(false, "init failed");
+
+    drbbdup_options_t opts = { 0 };
+    opts.struct_size = sizeof(drbbdup_options_t);
+    opts.set_up_bb_dups = set_up_bb_dups;
+    opts.instrument_instr = instrument_instr;
+    opts.runtime_case_opnd = OPND_CREATE_ABSMEM(&case_encoding, OPSZ_PTR);
+    opts.non_default_case_limit = NUM_CASES;
+    opts.never_enable_dynamic_handling = true;
+    opts.dispatch_search_min_cases = linear_dispatch ? USHRT_MAX : 0;
+
+    drbbdup_status_t res = drbbdup_init(&opts);
+    CHECK(res == DRBBDUP_SUCCESS, "drbbdup init failed");
+    dr_register_exit_event(event_exit);
+    start_time = dr_get_microseconds();
+}
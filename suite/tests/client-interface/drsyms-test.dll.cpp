@@ -560,6 +560,88 @@ test_line_iteration(const module_data_t *dll_data)
         dr_fprintf(STDERR, "found tools.h\n");
 }
 
+#ifdef UNIX
+/* Client threads look up the same address while this thread repeatedly frees the
+ * module underneath them and looks up a symbol.  Symbol lookups stay on this
+ * thread as building the symbol table demangles, and the demangler's ctype calls
+ * crash in client threads, where the private libc's ctype tables are not set up.
+ * For the same reason the client threads leave names mangled.
+ */
+#    define CONCURRENT_THREADS 4
+#    define CONCURRENT_ROUNDS 64
+/* Building the symbol table is slow, so most rounds just free. */
+#    define CONCURRENT_SYMBOL_PERIOD 8
+
+typedef struct _concurrent_lookup_t {
+    const char *dll_path;
+    size_t modoffs;
+    volatile int stop;
+    volatile int running;
+    volatile int mismatches;
+    void *done;
+} concurrent_lookup_t;
+
+static void
+concurrent_lookup_thread(void *arg)
+{
+    concurrent_lookup_t *test = (concurrent_lookup_t *)arg;
+    while (dr_atomic_load32(&test->stop) == 0) {
+        char name[256];
+        char file[MAXIMUM_PATH];
+        drsym_info_t info;
+        drsym_error_t r;
+        info.struct_size = sizeof(info);
+        info.name = name;
+        info.name_size = BUFFER_SIZE_ELEMENTS(name);
+        info.file = file;
+        info.file_size = BUFFER_SIZE_ELEMENTS(file);
+        r = drsym_lookup_address(test->dll_path, test->modoffs, &info,
+                                 DRSYM_LEAVE_MANGLED);
+        if (r != DRSYM_SUCCESS || info.start_offs != test->modoffs ||
+            strcmp(name, "dll_export") != 0 ||
+            strstr(file, "drsyms-test.appdll.cpp") == nullptr)
+            dr_atomic_add32_return_sum(&test->mismatches, 1);
+    }
+    if (dr_atomic_add32_return_sum(&test->running, -1) == 0)
+        dr_event_signal(test->done);
+}
+
+static void
+test_concurrent_lookups(const char *dll_path, const char *dll_name, size_t modoffs)
+{
+    concurrent_lookup_t test;
+    char symbol[MAXIMUM_PATH];
+    int i;
+    dr_snprintf(symbol, BUFFER_SIZE_ELEMENTS(symbol), "%s!dll_export", dll_name);
+    NULL_TERMINATE_BUFFER(symbol);
+    test.dll_path = dll_path;
+    test.modoffs = modoffs;
+    test.stop = 0;
+    test.running = CONCURRENT_THREADS;
+    test.mismatches = 0;
+    test.done = dr_event_create();
+    for (i = 0; i < CONCURRENT_THREADS; i++) {
+        bool ok = dr_create_client_thread(concurrent_lookup_thread, &test);
+        ASSERT(ok);
+    }
+    for (i = 0; i < CONCURRENT_ROUNDS; i++) {
+        drsym_free_resources(dll_path);
+        if (i % CONCURRENT_SYMBOL_PERIOD == 0) {
+            size_t sym_offs;
+            drsym_error_t r =
+                drsym_lookup_symbol(dll_path, symbol, &sym_offs, DRSYM_DEFAULT_FLAGS);
+            if (r != DRSYM_SUCCESS || sym_offs != modoffs)
+                dr_atomic_add32_return_sum(&test.mismatches, 1);
+        }
+        dr_thread_yield();
+    }
+    dr_atomic_store32(&test.stop, 1);
+    dr_event_wait(test.done);
+    dr_event_destroy(test.done);
+    ASSERT(test.mismatches == 0);
+}
+#endif
+
 /* Lookup symbols in the appdll and wrap them. */
 static void
 lookup_dll_syms(void *dc, const module_data_t *dll_data, bool loaded)
@@ -632,6 +714,10 @@ lookup_dll_syms(void *dc, const module_data_t *dll_data, bool loaded)
 
     test_line_iteration(dll_data);
 
+#ifdef UNIX
+    test_concurrent_lookups(dll_path, dll_name, dll_export_offs);
+#endif
+
     drsym_free_resources(dll_path);
 }
 
@@ -0,0 +1,143 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Worker threads call wrapped routines while the client wraps and unwraps
+ * others and while a library with wrapped code is loaded and unloaded, to
+ * test drwrap's lock-free wrap and post-call lookups.
+ */
+
+#include "tools.h"
+#include "thread.h"
+#include <dlfcn.h>
+
+#define NUM_THREADS 4
+#define NUM_LOADS 16
+#define NUM_LIB_CALLS 100
+#define NUM_VERIFY_CALLS 1000
+/* Enough calls to an unwrapped routine to trigger drwrap's lazy removal. */
+#define NUM_DISABLED_CALLS 4096
+
+static volatile int zero;
+static volatile int verify;
+static volatile int done;
+static volatile int verified[NUM_THREADS];
+static volatile int errors[NUM_THREADS];
+
+/* The client's post-call callback adds 1 to the return values of these. */
+int EXPORT NOINLINE
+always_wrapped(int x)
+{
+    return x * 2 + zero;
+}
+
+int EXPORT NOINLINE
+toggled(int x)
+{
+    return x * 2 + zero;
+}
+
+/* The client unwraps toggled() and its other targets on even-numbered calls
+ * to this and wraps them again on odd-numbered ones.
+ */
+void EXPORT NOINLINE
+churn(void)
+{
+    zero = 0;
+}
+
+static THREAD_FUNC_RETURN_TYPE
+worker(void *arg)
+{
+    int idx = (int)(ptr_int_t)arg;
+    int i;
+    for (i = 0; !done; i++) {
+        /* Only check toggled() once the client has left it wrapped. */
+        int checking = verify;
+        if (always_wrapped(i) != i * 2 + 1)
+            errors[idx]++;
+        if (toggled(i) != i * 2 + 1 && checking)
+            errors[idx]++;
+        if (checking)
+            verified[idx]++;
+    }
+    return THREAD_FUNC_RETURN_ZERO;
+}
+
+int
+main(int argc, char *argv[])
+{
+    thread_t threads[NUM_THREADS];
+    int i, j, lib_errors = 0, total = 0;
+    /* We don't have "." on LD_LIBRARY_PATH path so we take in abs path */
+    if (argc < 2) {
+        print("need to pass in lib path\n");
+        return 1;
+    }
+    for (i = 0; i < NUM_THREADS; i++)
+        threads[i] = create_thread(worker, (void *)(ptr_int_t)i);
+    for (i = 0; i < NUM_LOADS; i++) {
+        int (*func)(int);
+        void *lib = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+        if (lib == NULL) {
+            print("error loading library %s: %s\n", argv[1], dlerror());
+            break;
+        }
+        func = (int (*)(int))dlsym(lib, "lib_outer");
+        for (j = 0; j < NUM_LIB_CALLS; j++) {
+            if (func(j) != j * 2 + 1)
+                lib_errors++;
+        }
+        churn();
+        if (i % 2 == 0) {
+            for (j = 0; j < NUM_DISABLED_CALLS; j++)
+                toggled(j);
+        }
+        dlclose(lib);
+    }
+    /* NUM_LOADS is even so the last churn left toggled() wrapped. */
+    verify = 1;
+    for (i = 0; i < NUM_THREADS; i++) {
+        while (verified[i] < NUM_VERIFY_CALLS)
+            thread_yield();
+    }
+    done = 1;
+    for (i = 0; i < NUM_THREADS; i++) {
+        join_thread(threads[i]);
+        total += errors[i];
+    }
+    if (lib_errors > 0)
+        print("error: %d wrong library results\n", lib_errors);
+    if (total > 0)
+        print("error: %d wrong worker results\n", total);
+    print("thank you for testing the client interface\n");
+    return 0;
+}
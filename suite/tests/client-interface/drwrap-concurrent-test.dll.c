@@ -0,0 +1,190 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests drwrap's wrap and post-call tables while other threads look them up:
+ * wraps and unwraps enough targets to resize the tables and leave removed
+ * entries behind, and marks post-call sites in a library that gets unloaded.
+ */
+
+#include "dr_api.h"
+#include "client_tools.h"
+#include "drwrap.h"
+#include "drmgr.h"
+#include <string.h> /* strstr */
+
+#define NUM_FAKE_WRAPS 100
+/* Over 3/4 of drwrap's initial post-call table capacity. */
+#define NUM_MARKED_POST_CALLS 1000
+/* Matches NUM_LOADS in the app. */
+#define NUM_LOADS 16
+
+static app_pc exe_start;
+static app_pc addr_churn;
+static app_pc addr_toggled;
+static app_pc addr_lib_inner;
+static app_pc lib_marked;
+static int churn_count;
+static int load_count;
+/* Never executed: these are only keys in drwrap's wrap table. */
+static byte fake_funcs[NUM_FAKE_WRAPS * 4];
+
+static void
+wrap_pre(void *wrapcxt, DR_PARAM_OUT void **user_data)
+{
+    *user_data = (void *)drwrap_get_retaddr(wrapcxt);
+}
+
+static void
+wrap_post(void *wrapcxt, void *user_data)
+{
+    bool ok;
+    if (wrapcxt == NULL)
+        return;
+    CHECK(drwrap_is_post_wrap((app_pc)user_data), "post-call site missing");
+    ok = drwrap_set_retval(wrapcxt, (void *)((ptr_int_t)drwrap_get_retval(wrapcxt) + 1));
+    CHECK(ok, "set_retval error");
+}
+
+static void
+set_wrapped(bool wrap)
+{
+    bool ok;
+    int i;
+    if (wrap)
+        ok = drwrap_wrap(addr_toggled, wrap_pre, wrap_post);
+    else
+        ok = drwrap_unwrap(addr_toggled, wrap_pre, wrap_post);
+    CHECK(ok, "toggle failed");
+    for (i = 0; i < NUM_FAKE_WRAPS; i++) {
+        if (wrap)
+            ok = drwrap_wrap(&fake_funcs[i * 4], wrap_pre, wrap_post);
+        else
+            ok = drwrap_unwrap(&fake_funcs[i * 4], wrap_pre, wrap_post);
+        CHECK(ok, "fake wrap failed");
+    }
+}
+
+/* Called at the entry of the app's churn().  drwrap_wrap() may flush, so unlike
+ * a drwrap callback, which holds drwrap's lock, this is a plain clean call.
+ */
+static void
+churn(void)
+{
+    /* Unwrapped entries stay in the tables until the app has hit enough
+     * disabled wraps, which it does after each even churn; the next odd
+     * churn then adds them back.
+     */
+    set_wrapped(churn_count % 2 != 0);
+    churn_count++;
+}
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                      bool for_trace, bool translating, void *user_data)
+{
+    if (drmgr_is_first_instr(drcontext, inst) && (app_pc)tag == addr_churn)
+        dr_insert_clean_call(drcontext, bb, inst, (void *)churn, false, 0);
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+module_load_event(void *drcontext, const module_data_t *mod, bool loaded)
+{
+    const char *name = dr_module_preferred_name(mod);
+    bool ok;
+    if (strstr(name, "client.drwrap-concurrent-test.appdll.") != NULL) {
+        int i;
+        load_count++;
+        addr_lib_inner = (app_pc)dr_get_proc_address(mod->handle, "lib_inner");
+        lib_marked = (app_pc)dr_get_proc_address(mod->handle, "lib_marked");
+        CHECK(addr_lib_inner != NULL && lib_marked != NULL, "cannot find lib export");
+        ok = drwrap_wrap(addr_lib_inner, wrap_pre, wrap_post);
+        CHECK(ok, "wrap failed");
+        /* If the library landed where it was before, the unload must have
+         * removed the sites marked then.
+         */
+        for (i = 0; i < NUM_MARKED_POST_CALLS; i++)
+            CHECK(!drwrap_is_post_wrap(lib_marked + i), "stale post-call site");
+        for (i = 0; i < NUM_MARKED_POST_CALLS; i++) {
+            ok = drwrap_mark_as_post_call(lib_marked + i);
+            CHECK(ok, "mark failed");
+        }
+        for (i = 0; i < NUM_MARKED_POST_CALLS; i++)
+            CHECK(drwrap_is_post_wrap(lib_marked + i), "marked post-call site missing");
+    } else if (mod->start == exe_start) {
+        app_pc addr_always = (app_pc)dr_get_proc_address(mod->handle, "always_wrapped");
+        addr_churn = (app_pc)dr_get_proc_address(mod->handle, "churn");
+        addr_toggled = (app_pc)dr_get_proc_address(mod->handle, "toggled");
+        CHECK(addr_always != NULL && addr_churn != NULL && addr_toggled != NULL,
+              "cannot find app export");
+        ok = drwrap_wrap(addr_always, wrap_pre, wrap_post);
+        CHECK(ok, "wrap failed");
+        set_wrapped(true);
+    }
+}
+
+static void
+module_unload_event(void *drcontext, const module_data_t *mod)
+{
+    if (strstr(dr_module_preferred_name(mod), "client.drwrap-concurrent-test.appdll.") !=
+        NULL) {
+        bool ok = drwrap_unwrap(addr_lib_inner, wrap_pre, wrap_post);
+        CHECK(ok, "unwrap failed");
+    }
+}
+
+static void
+event_exit(void)
+{
+    CHECK(churn_count == NUM_LOADS, "missed churn calls");
+    CHECK(load_count == NUM_LOADS, "missed library loads");
+    drmgr_unregister_module_load_event(module_load_event);
+    drmgr_unregister_module_unload_event(module_unload_event);
+    drmgr_unregister_bb_insertion_event(event_app_instruction);
+    drwrap_exit();
+    drmgr_exit();
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    module_data_t *exe = dr_get_main_module();
+    CHECK(exe != NULL, "cannot find main module");
+    exe_start = exe->start;
+    dr_free_module_data(exe);
+    drmgr_init();
+    drwrap_init();
+    dr_register_exit_event(event_exit);
+    drmgr_register_module_load_event(module_load_event);
+    drmgr_register_module_unload_event(module_unload_event);
+    drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL);
+}
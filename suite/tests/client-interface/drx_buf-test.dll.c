@@ -43,6 +43,8 @@
 #define CIRCULAR_FAST_SZ DRX_BUF_FAST_CIRCULAR_BUFSZ
 #define CIRCULAR_SLOW_SZ 256
 #define TRACE_SZ 256
+#define SIDELINE_SZ 256
+#define SIDELINE_COUNT 3
 
 #define MINSERT instrlist_meta_preinsert
 
@@ -62,7 +64,9 @@ static const char test_null[TRACE_SZ];
 static drx_buf_t *circular_fast;
 static drx_buf_t *circular_slow;
 static drx_buf_t *trace;
+static drx_buf_t *sideline;
 static volatile int num_faults;
+static volatile int num_sideline;
 
 static void
 event_thread_init(void *drcontext)
@@ -80,6 +84,9 @@ event_thread_init(void *drcontext)
 
     buf_base = drx_buf_get_buffer_base(drcontext, trace);
     memset(buf_base, 0, TRACE_SZ);
+
+    buf_base = drx_buf_get_buffer_base(drcontext, sideline);
+    memset(buf_base, 0, SIDELINE_SZ);
 }
 
 static void
@@ -111,6 +118,16 @@ verify_trace_buffer(void *drcontext, void *buf_base, size_t size)
     dr_atomic_add32_return_sum(&num_faults, 1);
 }
 
+static void
+verify_sideline_buffer(void *drcontext, void *buf_base, size_t size)
+{
+    /* Full sideline buffers are processed on the consumer thread. */
+    CHECK(drcontext != dr_get_current_drcontext(),
+          "sideline buffer processed on the app thread");
+    CHECK(size <= SIDELINE_SZ, "sideline buffer overflowed");
+    dr_atomic_add32_return_sum(&num_sideline, 1);
+}
+
 static void
 verify_store(drx_buf_t *client)
 {
@@ -265,6 +282,24 @@ event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst
         /* the buffer is now clean */
         dr_insert_clean_call(drcontext, bb, inst, verify_buffers_empty, false, 1,
                              OPND_CREATE_INTPTR(trace));
+
+        /* sideline buffer: the same, where the fault switches to another buffer */
+        dr_insert_clean_call(drcontext, bb, inst, verify_buffers_empty, false, 1,
+                             OPND_CREATE_INTPTR(sideline));
+        drx_buf_insert_load_buf_ptr(drcontext, sideline, bb, inst, reg_ptr);
+        drx_buf_insert_buf_store(drcontext, sideline, bb, inst, reg_ptr, DR_REG_NULL,
+                                 opnd_create_reg(scratch), OPSZ_4, 0);
+        drx_buf_insert_update_buf_ptr(drcontext, sideline, bb, inst, reg_ptr,
+                                      DR_REG_NULL, sizeof(int));
+        dr_insert_clean_call(drcontext, bb, inst, verify_buffers_dirty, false, 2,
+                             OPND_CREATE_INTPTR(sideline), opnd_create_reg(scratch));
+        drx_buf_insert_load_buf_ptr(drcontext, sideline, bb, inst, reg_ptr);
+        drx_buf_insert_update_buf_ptr(drcontext, sideline, bb, inst, reg_ptr,
+                                      DR_REG_NULL, SIDELINE_SZ - sizeof(int));
+        drx_buf_insert_buf_store(drcontext, sideline, bb, inst, reg_ptr, DR_REG_NULL,
+                                 opnd_create_reg(scratch), OPSZ_4, 0);
+        dr_insert_clean_call(drcontext, bb, inst, verify_buffers_empty, false, 1,
+                             OPND_CREATE_INTPTR(sideline));
     } else if (subtest == DRX_BUF_TEST_4_C) {
         /* test immediate store: 8 bytes (if possible), 4 bytes, 2 bytes and 1 byte */
         /* "ABCDEFGH\x00" (x2 for x64) */
@@ -391,16 +426,29 @@ event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst
 static void
 event_exit(void)
 {
+    drx_buf_sideline_stats_t stats = {
+        sizeof(stats),
+    };
+
     /* we are supposed to have faulted NUM_ITER times per thread, plus 2 more
      * because the callback is called on thread_exit(). Finally, two more for
      * drx_buf_insert_buf_memcpy().
      */
     CHECK(num_faults == NUM_ITER * 2 + 2 + 2, "the number of faults don't match up");
+    /* Each thread's exit waits for its sideline buffers to be processed. */
+    CHECK(num_sideline == NUM_ITER * 2 + 2, "sideline buffers were not all processed");
+    CHECK(drx_buf_get_sideline_stats(sideline, &stats), "sideline stats failed");
+    CHECK(stats.buffers_queued == NUM_ITER * 2 + 2 &&
+              stats.buffers_processed == stats.buffers_queued &&
+              stats.max_pending >= 1,
+          "sideline stats don't match up");
+    CHECK(!drx_buf_get_sideline_stats(trace, &stats), "trace buffer has sideline stats");
     if (!drmgr_unregister_bb_insertion_event(event_app_instruction))
         CHECK(false, "exit failed");
     drx_buf_free(circular_fast);
     drx_buf_free(circular_slow);
     drx_buf_free(trace);
+    drx_buf_free(sideline);
     drmgr_unregister_thread_init_event(event_thread_init);
     drmgr_exit();
     drx_exit();
@@ -417,9 +465,14 @@ dr_init(client_id_t id)
     circular_fast = drx_buf_create_circular_buffer(DRX_BUF_FAST_CIRCULAR_BUFSZ);
     circular_slow = drx_buf_create_circular_buffer(CIRCULAR_SLOW_SZ);
     trace = drx_buf_create_trace_buffer(TRACE_SZ, verify_trace_buffer);
+    sideline = drx_buf_create_sideline_buffer(SIDELINE_SZ, SIDELINE_COUNT,
+                                              verify_sideline_buffer);
     CHECK(circular_fast != NULL, "circular fast failed");
     CHECK(circular_slow != NULL, "circular slow failed");
     CHECK(trace != NULL, "trace failed");
+    CHECK(sideline != NULL, "sideline failed");
+    CHECK(drx_buf_create_sideline_buffer(SIDELINE_SZ, 1, verify_sideline_buffer) == NULL,
+          "sideline with one buffer should fail");
 
     CHECK(drmgr_register_thread_init_event(event_thread_init),
           "event thread init failed");
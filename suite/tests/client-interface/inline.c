@@ -52,6 +52,11 @@
         FUNCTION(callpic_mov)       \
         FUNCTION(nonleaf)           \
         FUNCTION(cond_br)           \
+        FUNCTION(cond_ret)          \
+        FUNCTION(tail_call)         \
+        FUNCTION(locals)            \
+        FUNCTION(backward_br)       \
+        FUNCTION(indirect_br)       \
         FUNCTION(tls_clobber)       \
         FUNCTION(aflags_clobber)    \
         LAST_FUNCTION()
@@ -49,6 +49,11 @@
         FUNCTION(callpic_mov)       \
         FUNCTION(nonleaf)           \
         FUNCTION(cond_br)           \
+        FUNCTION(cond_ret)          \
+        FUNCTION(tail_call)         \
+        FUNCTION(locals)            \
+        FUNCTION(backward_br)       \
+        FUNCTION(indirect_br)       \
         FUNCTION(tls_clobber)       \
         FUNCTION(aflags_clobber)    \
         FUNCTION(bbcount)           \
@@ -73,6 +78,14 @@ compiler_inscount(ptr_uint_t count);
 
 static void
 test_inlined_call_args(void *dc, instrlist_t *bb, instr_t *where, int fn_idx);
+#ifdef X86
+static void
+insert_check_result(void *dc, instrlist_t *bb, instr_t *where, int fn_idx,
+                    ptr_uint_t arg);
+static void
+test_inlined_call_result(void *dc, instrlist_t *bb, instr_t *where, int fn_idx,
+                         ptr_uint_t arg);
+#endif
 
 static void
 fill_scratch(void)
@@ -215,6 +228,9 @@ event_basic_block(void *dc, void *tag, instrlist_t *bb, bool for_trace, bool tra
 #ifdef X86
     case FN_compiler_inscount:
     case FN_gcc47_inscount:
+    case FN_cond_ret:
+    case FN_tail_call:
+    case FN_locals:
 #endif
         /* FIXME i#1569: passing instruction operands is NYI on AArch64.
          * We use a workaround involving ADR. */
@@ -228,6 +244,8 @@ event_basic_block(void *dc, void *tag, instrlist_t *bb, bool for_trace, bool tra
 #ifdef X86
     case FN_nonleaf:
     case FN_cond_br:
+    case FN_backward_br:
+    case FN_indirect_br:
         /* These functions cannot be inlined (yet). */
         PRE(bb, entry, before_label);
         dr_insert_clean_call(dc, bb, entry, func_ptrs[i], false, 0);
@@ -265,6 +283,11 @@ event_basic_block(void *dc, void *tag, instrlist_t *bb, bool for_trace, bool tra
 #ifdef X86
     if (i == FN_inscount || i == FN_empty_1arg) {
         test_inlined_call_args(dc, bb, entry, i);
+    } else if (i == FN_cond_ret || i == FN_tail_call || i == FN_locals) {
+        insert_check_result(dc, bb, entry, i, 0xDEAD);
+        /* Also take the branch to Larg_zero. */
+        if (i == FN_cond_ret)
+            test_inlined_call_result(dc, bb, entry, i, 0);
     }
 #endif
 
@@ -367,6 +390,66 @@ test_inlined_call_args(void *dc, instrlist_t *bb, instr_t *where, int fn_idx)
             OPND_CREATE_INTPTR(0));
     }
 }
+
+/* Returns what the callee at fn_idx leaves in global_count when passed arg. */
+static ptr_uint_t
+expected_result(int fn_idx, ptr_uint_t arg)
+{
+    switch (fn_idx) {
+    case FN_cond_ret: return arg == 0 ? 1 : arg;
+    case FN_tail_call: return 2 * arg;
+    case FN_locals: return 3 * arg;
+    default: DR_ASSERT_MSG(false, "No expected result for this function!"); return 0;
+    }
+}
+
+static void
+check_result(int fn_idx, ptr_uint_t arg)
+{
+    ptr_uint_t expected = expected_result(fn_idx, arg);
+    if (global_count != expected) {
+        dr_fprintf(STDERR,
+                   "global_count is " PFX " instead of " PFX " after %s(" PFX ")!\n",
+                   global_count, expected, func_names[fn_idx], arg);
+    }
+}
+
+/* Checks the result of an inlined call.  If the callee was not inlined, after_callee()
+ * has already complained and the patched callee did not compute anything.
+ */
+static void
+insert_check_result(void *dc, instrlist_t *bb, instr_t *where, int fn_idx,
+                    ptr_uint_t arg)
+{
+#    ifndef X64
+    /* On 32-bit we only map the argument to a scratch slot, not other locals. */
+    if (fn_idx == FN_locals)
+        return;
+#    endif
+    dr_insert_clean_call(dc, bb, where, (void *)check_result, false, 2,
+                         OPND_CREATE_INT32(fn_idx), OPND_CREATE_INTPTR(arg));
+}
+
+/* Calls the callee at fn_idx with arg, checking that it is inlined and its result. */
+static void
+test_inlined_call_result(void *dc, instrlist_t *bb, instr_t *where, int fn_idx,
+                         ptr_uint_t arg)
+{
+    instr_t *before_label = INSTR_CREATE_label(dc);
+    instr_t *after_label = INSTR_CREATE_label(dc);
+    dr_insert_clean_call(dc, bb, where, (void *)before_callee, false, 2,
+                         OPND_CREATE_INTPTR(func_ptrs[fn_idx]), OPND_CREATE_INTPTR(0));
+    PRE(bb, where, before_label);
+    dr_insert_clean_call(dc, bb, where, func_ptrs[fn_idx], false, 1,
+                         OPND_CREATE_INTPTR(arg));
+    PRE(bb, where, after_label);
+    dr_insert_clean_call_ex(
+        dc, bb, where, (void *)after_callee, DR_CLEANCALL_READS_APP_CONTEXT, 6,
+        opnd_create_instr(before_label), opnd_create_instr(after_label),
+        OPND_CREATE_INT32(true), OPND_CREATE_INT32(false), OPND_CREATE_INT32(fn_idx),
+        OPND_CREATE_INTPTR(0));
+    insert_check_result(dc, bb, where, fn_idx, arg);
+}
 #endif
 /*****************************************************************************/
 /* Instrumentation function code generation. */
@@ -446,8 +529,8 @@ codegen_nonleaf(void *dc)
     return ilist;
 }
 
-/* Conditional branches cannot be inlined.  Avoid flags usage to make test case
- * more specific.
+/* Loop-style conditional branches cannot be inlined.  Avoid flags usage to make
+ * test case more specific.
 cond_br:
     push REG_XBP
     mov REG_XBP, REG_XSP
@@ -478,6 +561,162 @@ codegen_cond_br(void *dc)
     return ilist;
 }
 
+/* Forward conditional branches and early returns can be inlined.
+cond_ret:
+    push REG_XBP
+    mov REG_XBP, REG_XSP
+    mov REG_XCX, ARG1
+    test REG_XCX, REG_XCX
+    jz Larg_zero
+        add SYMREF(global_count), REG_XCX
+        leave
+        ret
+    Larg_zero:
+    mov SYMREF(global_count), 1
+    leave
+    ret
+*/
+static instrlist_t *
+codegen_cond_ret(void *dc)
+{
+    instrlist_t *ilist = instrlist_create(dc);
+    instr_t *arg_zero = INSTR_CREATE_label(dc);
+    opnd_t xcx = opnd_create_reg(DR_REG_XCX);
+    codegen_prologue(dc, ilist);
+    APP(ilist, INSTR_CREATE_mov_ld(dc, xcx, codegen_opnd_arg1()));
+    APP(ilist, INSTR_CREATE_test(dc, xcx, xcx));
+    APP(ilist, INSTR_CREATE_jcc(dc, OP_jz, opnd_create_instr(arg_zero)));
+    APP(ilist, INSTR_CREATE_add(dc, OPND_CREATE_ABSMEM(&global_count, OPSZ_PTR), xcx));
+    codegen_epilogue(dc, ilist);
+    APP(ilist, arg_zero);
+    APP(ilist,
+        INSTR_CREATE_mov_st(dc, OPND_CREATE_ABSMEM(&global_count, OPSZ_PTR),
+                            OPND_CREATE_INT32(1)));
+    codegen_epilogue(dc, ilist);
+    return ilist;
+}
+
+/* Tail calls into short routines are followed, and can be inlined.  The int3s
+ * make sure we follow the jumps rather than fall through.
+tail_call:
+    push REG_XBP
+    mov REG_XBP, REG_XSP
+    mov REG_XCX, ARG1
+    leave
+    jmp Ltail1
+    int3
+    Ltail1:
+    add SYMREF(global_count), REG_XCX
+    jmp Ltail2
+    int3
+    Ltail2:
+    add SYMREF(global_count), REG_XCX
+    ret
+*/
+static instrlist_t *
+codegen_tail_call(void *dc)
+{
+    instrlist_t *ilist = instrlist_create(dc);
+    instr_t *tail1 = INSTR_CREATE_label(dc);
+    instr_t *tail2 = INSTR_CREATE_label(dc);
+    opnd_t xcx = opnd_create_reg(DR_REG_XCX);
+    codegen_prologue(dc, ilist);
+    APP(ilist, INSTR_CREATE_mov_ld(dc, xcx, codegen_opnd_arg1()));
+    APP(ilist, INSTR_CREATE_leave(dc));
+    APP(ilist, INSTR_CREATE_jmp(dc, opnd_create_instr(tail1)));
+    APP(ilist, INSTR_CREATE_int3(dc));
+    APP(ilist, tail1);
+    APP(ilist, INSTR_CREATE_add(dc, OPND_CREATE_ABSMEM(&global_count, OPSZ_PTR), xcx));
+    APP(ilist, INSTR_CREATE_jmp(dc, opnd_create_instr(tail2)));
+    APP(ilist, INSTR_CREATE_int3(dc));
+    APP(ilist, tail2);
+    APP(ilist, INSTR_CREATE_add(dc, OPND_CREATE_ABSMEM(&global_count, OPSZ_PTR), xcx));
+    APP(ilist, INSTR_CREATE_ret(dc));
+    return ilist;
+}
+
+/* Each of several stack locals is mapped to its own scratch slot, so this can be
+ * inlined on 64-bit.  Together with xax, xdi and the flags, the two locals use
+ * all of the scratch slots.  On 32-bit the argument already takes the only slot
+ * we use for stack locations.
+locals:
+    push REG_XBP
+    mov REG_XBP, REG_XSP
+    sub REG_XSP, 2 * ARG_SZ
+    mov REG_XAX, ARG1
+    mov [REG_XBP - ARG_SZ], REG_XAX
+    add REG_XAX, [REG_XBP - ARG_SZ]
+    mov [REG_XBP - 2 * ARG_SZ], REG_XAX
+    mov REG_XAX, [REG_XBP - ARG_SZ]
+    add REG_XAX, [REG_XBP - 2 * ARG_SZ]
+    add SYMREF(global_count), REG_XAX
+    leave
+    ret
+*/
+static instrlist_t *
+codegen_locals(void *dc)
+{
+    instrlist_t *ilist = instrlist_create(dc);
+    opnd_t xax = opnd_create_reg(DR_REG_XAX);
+    opnd_t local1 = OPND_CREATE_MEMPTR(DR_REG_XBP, -(int)sizeof(reg_t));
+    opnd_t local2 = OPND_CREATE_MEMPTR(DR_REG_XBP, -2 * (int)sizeof(reg_t));
+    codegen_prologue(dc, ilist);
+    APP(ilist,
+        INSTR_CREATE_sub(dc, opnd_create_reg(DR_REG_XSP),
+                         OPND_CREATE_INT8(2 * sizeof(reg_t))));
+    APP(ilist, INSTR_CREATE_mov_ld(dc, xax, codegen_opnd_arg1()));
+    APP(ilist, INSTR_CREATE_mov_st(dc, local1, xax));
+    APP(ilist, INSTR_CREATE_add(dc, xax, local1));
+    APP(ilist, INSTR_CREATE_mov_st(dc, local2, xax));
+    APP(ilist, INSTR_CREATE_mov_ld(dc, xax, local1));
+    APP(ilist, INSTR_CREATE_add(dc, xax, local2));
+    APP(ilist, INSTR_CREATE_add(dc, OPND_CREATE_ABSMEM(&global_count, OPSZ_PTR), xax));
+    codegen_epilogue(dc, ilist);
+    return ilist;
+}
+
+/* Backward branches cannot be inlined, and are counted as loops in the stats.
+backward_br:
+    mov REG_XCX, 3
+    Lloop:
+    dec REG_XCX
+    jnz Lloop
+    ret
+*/
+static instrlist_t *
+codegen_backward_br(void *dc)
+{
+    instrlist_t *ilist = instrlist_create(dc);
+    instr_t *loop = INSTR_CREATE_label(dc);
+    opnd_t xcx = opnd_create_reg(DR_REG_XCX);
+    APP(ilist, INSTR_CREATE_mov_imm(dc, xcx, OPND_CREATE_INT32(3)));
+    APP(ilist, loop);
+    APP(ilist, INSTR_CREATE_dec(dc, xcx));
+    APP(ilist, INSTR_CREATE_jcc(dc, OP_jnz, opnd_create_instr(loop)));
+    APP(ilist, INSTR_CREATE_ret(dc));
+    return ilist;
+}
+
+/* Indirect branches other than returns cannot be inlined, and we cannot find the
+ * SIMD registers used past them either.
+indirect_br:
+    mov REG_XAX, Ldone
+    jmp REG_XAX
+    Ldone:
+    ret
+*/
+static instrlist_t *
+codegen_indirect_br(void *dc)
+{
+    instrlist_t *ilist = instrlist_create(dc);
+    instr_t *done = INSTR_CREATE_ret(dc);
+    opnd_t xax = opnd_create_reg(DR_REG_XAX);
+    APP(ilist, INSTR_CREATE_mov_imm(dc, xax, opnd_create_instr(done)));
+    APP(ilist, INSTR_CREATE_jmp_ind(dc, xax));
+    APP(ilist, done);
+    return ilist;
+}
+
 /* A function that uses 2 registers and 1 local variable, which should fill all
  * of the scratch slots that the inliner uses.  This used to clobber the scratch
  * slots exposed to the client.
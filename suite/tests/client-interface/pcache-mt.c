@@ -0,0 +1,78 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Worker threads run hot loops in a position-independent executable, which
+ * loads at a different base each run, so the second run uses a pcache whose
+ * unit has to be shifted.  The client checks that traces are still built.
+ */
+
+#include "tools.h"
+#include "thread.h"
+
+#define NUM_THREADS 4
+#define NUM_ITERS 200000
+
+static volatile int sums[NUM_THREADS];
+
+static THREAD_FUNC_RETURN_TYPE
+worker(void *arg)
+{
+    int idx = (int)(ptr_int_t)arg;
+    int i, sum = 0;
+    for (i = 0; i < NUM_ITERS; i++) {
+        if (i % 7 == 3)
+            sum += i * 3;
+        else if (i % 5 == 1)
+            sum -= i;
+        else
+            sum ^= i;
+    }
+    sums[idx] = sum;
+    return THREAD_FUNC_RETURN_ZERO;
+}
+
+int
+main(int argc, char *argv[])
+{
+    thread_t threads[NUM_THREADS];
+    int i;
+    for (i = 0; i < NUM_THREADS; i++)
+        threads[i] = create_thread(worker, (void *)(ptr_int_t)i);
+    for (i = 0; i < NUM_THREADS; i++)
+        join_thread(threads[i]);
+    for (i = 1; i < NUM_THREADS; i++) {
+        if (sums[i] != sums[0])
+            print("error: thread %d computed %d, not %d\n", i, sums[i], sums[0]);
+    }
+    print("all done\n");
+    return 0;
+}
@@ -34,11 +34,15 @@
 #include "hashtable.h"
 
 #include "client_tools.h" /* For ASSERT; DR_ASSERT raises a message box. */
+#include <string.h>
 
 static byte *mybase;
 static uint bb_execs;
 static uint resurrect_success;
 static bool verbose;
+/* Whether to report if the app's own pcache was used, to test pcache keying. */
+static bool report_main;
+static bool main_resurrected;
 
 /* test hashtable persistence via a table that contains one entry per
  * pcache written or loaded.  key is start, payload is size.
@@ -163,6 +167,12 @@ event_resurrect_ro(void *drcontext, void *perscxt, byte **map DR_PARAM_OUT)
         }
     }
 
+    if (report_main) {
+        module_data_t *app = dr_get_main_module();
+        if (start >= app->start && start < app->end)
+            main_resurrected = true;
+        dr_free_module_data(app);
+    }
     resurrect_success++;
     return true;
 }
@@ -213,7 +223,11 @@ event_bb(void *drcontext, void *tag, instrlist_t *bb, bool for_trace, bool trans
 static void
 event_exit(void)
 {
-    if (resurrect_success > 0)
+    /* Which other modules have pcaches varies, so we only report the app's. */
+    if (report_main) {
+        dr_fprintf(STDERR, "main module pcache resurrected: %s\n",
+                   main_resurrected ? "yes" : "no");
+    } else if (resurrect_success > 0)
         dr_fprintf(STDERR, "successfully resurrected at least one pcache\n");
     hashtable_delete(&sample_inlined_table);
     hashtable_delete(&sample_pointer_table);
@@ -221,8 +235,19 @@ event_exit(void)
 
 DR_EXPORT
 void
-dr_init(client_id_t id)
+dr_client_main(client_id_t id, int argc, const char *argv[])
 {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-report_main") == 0)
+            report_main = true;
+        else if (strcmp(argv[i], "-rebuilt_test") == 0) {
+            /* Only changes the client options, which keeps the pcaches of the
+             * rebuilt-app tests apart from those of the other tests.
+             */
+        } else
+            CHECK(false, "unknown client option");
+    }
     mybase = dr_get_client_base(id);
     dr_fprintf(STDERR, "thank you for testing the client interface\n");
     dr_register_exit_event(event_exit);
@@ -0,0 +1,102 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Runs a loop whose hot path changes between phases, in one or more threads, to
+ * test -trace_profile_ms re-forming traces whose exits no longer match the path.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "tools.h"
+
+#define MAX_THREADS 8
+#define ROUNDS 6
+#define ITERS (8 * 1024 * 1024)
+
+static unsigned int results[MAX_THREADS];
+
+static unsigned int
+run_phase(int phase, unsigned int seed)
+{
+    unsigned int sum = seed;
+    int i;
+    for (i = 0; i < ITERS; i++) {
+        /* In even phases the first path is taken 15 of 16 times, and in odd
+         * phases the second is, so a trace built in one phase mostly takes its
+         * side exit in the next.
+         */
+        if (((i & 0xf) != 0) == (phase % 2 == 0))
+            sum = sum * 31 + i;
+        else
+            sum = (sum ^ (sum >> 7)) + i;
+    }
+    return sum;
+}
+
+static void *
+thread_main(void *arg)
+{
+    int idx = (int)(ptr_int_t)arg;
+    unsigned int sum = 0;
+    int phase;
+    for (phase = 0; phase < ROUNDS; phase++)
+        sum = run_phase(phase, sum);
+    results[idx] = sum;
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t threads[MAX_THREADS];
+    int num_threads = argc > 1 ? atoi(argv[1]) : 1;
+    int i;
+    if (num_threads < 1 || num_threads > MAX_THREADS) {
+        print("invalid thread count\n");
+        return 1;
+    }
+    for (i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, thread_main, (void *)(ptr_int_t)i) != 0)
+            print("failed to create thread\n");
+    }
+    thread_main((void *)0);
+    for (i = 1; i < num_threads; i++) {
+        if (pthread_join(threads[i], NULL) != 0)
+            print("failed to join thread\n");
+    }
+    for (i = 1; i < num_threads; i++) {
+        if (results[i] != results[0])
+            print("thread %d result mismatch\n", i);
+    }
+    print("result 0x%08x\n", results[0]);
+    return 0;
+}